@@ -0,0 +1,132 @@
+/*
+	 The WebSocket protocol (RFC 6455) without the I/O: frame headers,
+	 masking, a parser for the frames a client sends, the opening
+	 handshake and permessage-deflate (RFC 7692). websocket_server.c puts
+	 it on netconns; the host build checks and benchmarks it on its own.
+
+	 Masking goes a 32 bit word at a time. The parser takes the stream in
+	 whatever pieces TCP hands out and puts a message together in its own
+	 buffer, unmasked in place, so a message costs one copy on the way in.
+*/
+
+#ifndef WEBSOCKET_H_
+#define WEBSOCKET_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define WS_MAX_HEADER 14		// of a frame: 2, 8 bytes of length, 4 of mask
+#define WS_MAX_CONTROL 125		// payload of a control frame
+#define WS_ACCEPT_SIZE 29		// Sec-WebSocket-Accept and its NUL
+
+typedef enum {
+	WEBSOCKET_OPCODE_CONT = 0x0,
+	WEBSOCKET_OPCODE_TEXT = 0x1,
+	WEBSOCKET_OPCODE_BIN = 0x2,
+	WEBSOCKET_OPCODE_CLOSE = 0x8,
+	WEBSOCKET_OPCODE_PING = 0x9,
+	WEBSOCKET_OPCODE_PONG = 0xA,
+} WEBSOCKET_OPCODES_t;
+
+// what the callback of a client is told
+typedef enum {
+	WEBSOCKET_CONNECT,
+	WEBSOCKET_DISCONNECT_EXTERNAL,	// the client closed
+	WEBSOCKET_DISCONNECT_INTERNAL,	// the server closed
+	WEBSOCKET_DISCONNECT_ERROR,		// a protocol error, no pong in time or a broken connection
+	WEBSOCKET_TEXT,
+	WEBSOCKET_BIN,
+	WEBSOCKET_PING,
+	WEBSOCKET_PONG,
+} WEBSOCKET_TYPE_t;
+
+// status codes of a close frame
+#define WS_CLOSE_NORMAL 1000
+#define WS_CLOSE_GOING_AWAY 1001
+#define WS_CLOSE_PROTOCOL 1002
+#define WS_CLOSE_INVALID_DATA 1007
+#define WS_CLOSE_TOO_BIG 1009
+
+// data ^= the mask key repeated, starting offset bytes into the payload
+void ws_mask(uint8_t *data, size_t len, const uint8_t key[4], size_t offset);
+
+// a frame header with fin set, key NULL for an unmasked frame; returns its length
+size_t ws_put_header(uint8_t *header, int opcode, bool compressed, uint64_t len, const uint8_t *key);
+
+bool ws_utf8_valid(const uint8_t *data, size_t len);
+
+typedef struct {
+	int opcode;			// WEBSOCKET_OPCODE_TEXT, _BIN, _CLOSE, _PING or _PONG
+	bool compressed;	// a data message with RSV1, to go through ws_inflate()
+	uint8_t *data;		// unmasked and NUL terminated, valid until the next ws_parse()
+	size_t len;
+} WS_MESSAGE_t;
+
+typedef struct {
+	// the data message being put together
+	uint8_t *buf;
+	size_t len;
+	size_t cap;
+	size_t max;			// longest one accepted
+	int opcode;			// 0 while there is none
+	bool compressed;
+	bool deflate;		// RSV1 allowed, permessage-deflate was negotiated
+	bool delivered;		// buf went out, start over at the next byte
+	// the frame being read
+	uint8_t header[WS_MAX_HEADER];
+	int header_len;
+	int header_need;
+	int frame_opcode;
+	bool fin;
+	uint8_t key[4];
+	uint64_t left;		// payload bytes still to come
+	size_t offset;		// payload bytes so far
+	uint8_t control[WS_MAX_CONTROL + 1];
+} WS_PARSER_t;
+
+void ws_parser_init(WS_PARSER_t *parser, size_t max, bool deflate);
+void ws_parser_free(WS_PARSER_t *parser);
+
+/*
+	 Takes bytes of the stream until a message is complete: returns 1 with
+	 it in msg, 0 once all len bytes are taken and more are needed, or
+	 minus the close code to answer with when the client broke the
+	 protocol. *used is the number of bytes taken, call again with the rest.
+	 Control frames come out as they arrive, also in between the fragments
+	 of a data message. A close frame is checked: no code, or a valid one
+	 and a UTF-8 reason.
+*/
+int ws_parse(WS_PARSER_t *parser, const uint8_t *data, size_t len, size_t *used, WS_MESSAGE_t *msg);
+
+// the value of Sec-WebSocket-Accept for a Sec-WebSocket-Key
+void ws_accept_key(const char *key, size_t key_len, char accept[WS_ACCEPT_SIZE]);
+
+/*
+	 Answers the HTTP upgrade request in request with the 101 response in
+	 out, returns its length or -1 when the request is no websocket
+	 version 13 upgrade or out is too small. *deflate goes in as whether
+	 permessage-deflate may be used and comes out as whether it was
+	 agreed, always without context takeover both ways.
+*/
+int ws_handshake(const char *request, size_t len, char *out, size_t size, bool *deflate);
+
+/*
+	 permessage-deflate without context takeover: every message on its own,
+	 so one compressed message can go to every client that agreed to it.
+	 The compressor uses the fixed Huffman codes and greedy matches found
+	 through a hash of the next 3 bytes.
+*/
+#define WS_DEFLATE_HASH_BITS 11
+#define WS_DEFLATE_MAX_INPUT 65535
+
+typedef struct {
+	uint16_t head[1 << WS_DEFLATE_HASH_BITS];	// position + 1 of the last 3 bytes with this hash
+} WS_DEFLATE_t;
+
+// returns the length of the payload or -1 when it would not be shorter than len or fit in size
+int ws_deflate(WS_DEFLATE_t *z, const uint8_t *in, size_t len, uint8_t *out, size_t size);
+// returns the length of the message, -1 when in is broken or -2 when the message is longer than size
+int ws_inflate(const uint8_t *in, size_t len, uint8_t *out, size_t size);
+
+#endif /* WEBSOCKET_H_ */
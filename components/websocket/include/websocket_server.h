@@ -0,0 +1,76 @@
+/*
+	 WebSocket server on lwIP netconns.
+
+	 The HTTP server accepts a connection, reads the upgrade request and
+	 hands both to ws_server_add_client(). From then on the server task
+	 reads the client: the netconn event callback queues the connections
+	 with data, the task parses their frames, answers pings and closes, and
+	 calls the callback of the client with every message. It also pings
+	 clients that have been quiet for CONFIG_WEBSOCKET_SERVER_PING_INTERVAL
+	 ms and drops the ones with no pong CONFIG_WEBSOCKET_SERVER_PONG_TIMEOUT
+	 ms later.
+
+	 Sends may come from any task, the callback included: a frame goes out
+	 as the header and the caller's payload in one vectored write, under a
+	 lock per client. That saves building the frame in a buffer of its own,
+	 but it is not zero-copy: lwIP copies the payload into its send buffer
+	 (NETCONN_COPY), so the caller may reuse it as soon as the send returns.
+	 A client that fails a write is closed by the server task, never in
+	 the middle of a send.
+
+	 Clients are numbered 0 to CONFIG_WEBSOCKET_SERVER_MAX_CLIENTS - 1.
+*/
+
+#ifndef WEBSOCKET_SERVER_H_
+#define WEBSOCKET_SERVER_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "lwip/api.h"
+#include "sdkconfig.h"
+
+#include "websocket.h"
+
+// the callback of a client: its number, what happened and the message, NUL terminated
+typedef void (*WS_CALLBACK_t)(uint8_t num, WEBSOCKET_TYPE_t type, char *msg, uint64_t len);
+
+// starts the server task, returns 1 on success
+int ws_server_start(void);
+// closes every client and stops the task
+int ws_server_stop(void);
+
+/*
+	 Answers the upgrade request msg of conn and adds it as a client of url,
+	 returns its number or -1. The server owns conn from here, also when it
+	 fails: a bad request gets a 400 and the connection is closed.
+*/
+int ws_server_add_client(struct netconn *conn, char *msg, uint16_t len, char *url, WS_CALLBACK_t callback);
+
+int ws_server_len_url(char *url);	// clients of url
+int ws_server_len_all(void);		// clients
+
+// close frame with WS_CLOSE_NORMAL, the callback gets WEBSOCKET_DISCONNECT_INTERNAL
+int ws_server_remove_client(int num);
+int ws_server_remove_clients(char *url);
+int ws_server_remove_all(void);
+
+// return the number of clients sent to, 0 or 1 for a single one
+int ws_server_send_text_client(int num, char *msg, uint64_t len);
+int ws_server_send_text_clients(char *url, char *msg, uint64_t len);
+int ws_server_send_text_all(char *msg, uint64_t len);
+int ws_server_send_bin_client(int num, char *msg, uint64_t len);
+int ws_server_send_bin_clients(char *url, char *msg, uint64_t len);
+int ws_server_send_bin_all(char *msg, uint64_t len);
+
+// the same, from the callback; nothing is locked while it runs, so these are the plain ones
+int ws_server_send_text_client_from_callback(int num, char *msg, uint64_t len);
+int ws_server_send_text_clients_from_callback(char *url, char *msg, uint64_t len);
+int ws_server_send_text_all_from_callback(char *msg, uint64_t len);
+int ws_server_send_bin_client_from_callback(int num, char *msg, uint64_t len);
+int ws_server_send_bin_clients_from_callback(char *url, char *msg, uint64_t len);
+int ws_server_send_bin_all_from_callback(char *msg, uint64_t len);
+
+int ws_server_ping(int num);
+
+#endif /* WEBSOCKET_SERVER_H_ */
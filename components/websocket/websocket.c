@@ -0,0 +1,460 @@
+/*
+	 WebSocket protocol, see websocket.h
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdio.h>
+
+#include "websocket.h"
+
+// a 32 bit word that may alias the bytes of a buffer
+typedef uint32_t __attribute__((may_alias)) WORD_t;
+
+void ws_mask(uint8_t *data, size_t len, const uint8_t key[4], size_t offset)
+{
+	size_t i = 0;
+	// bytes up to a word boundary, then words, then the bytes left
+	for (; i < len && ((uintptr_t)(data + i) & 3); i++) data[i] ^= key[(offset + i) & 3];
+	if (len - i >= 4) {
+		uint8_t rotated[4];
+		for (int k = 0; k < 4; k++) rotated[k] = key[(offset + i + k) & 3];
+		uint32_t word;
+		memcpy(&word, rotated, 4);
+		WORD_t *p = (WORD_t *)(data + i);
+		size_t words = (len - i) / 4;
+		for (size_t k = 0; k < words; k++) p[k] ^= word;
+		i += words * 4;
+	}
+	for (; i < len; i++) data[i] ^= key[(offset + i) & 3];
+}
+
+size_t ws_put_header(uint8_t *header, int opcode, bool compressed, uint64_t len, const uint8_t *key)
+{
+	size_t h = 0;
+	header[h++] = 0x80 | (compressed ? 0x40 : 0) | (opcode & 0x0f);
+	uint8_t masked = key ? 0x80 : 0;
+	if (len < 126) {
+		header[h++] = masked | len;
+	} else if (len < 65536) {
+		header[h++] = masked | 126;
+		header[h++] = len >> 8;
+		header[h++] = len;
+	} else {
+		header[h++] = masked | 127;
+		for (int i = 7; i >= 0; i--) header[h++] = len >> (8 * i);
+	}
+	if (key) {
+		memcpy(header + h, key, 4);
+		h += 4;
+	}
+	return h;
+}
+
+bool ws_utf8_valid(const uint8_t *s, size_t len)
+{
+	size_t i = 0;
+	while (i < len) {
+		// ASCII a word at a time, most text is
+		if (((uintptr_t)(s + i) & 3) == 0) {
+			while (len - i >= 4 && (*(const WORD_t *)(s + i) & 0x80808080) == 0) i += 4;
+			if (i == len) break;
+		}
+		uint8_t c = s[i];
+		if (c < 0x80) {
+			i++;
+			continue;
+		}
+		size_t n;
+		uint32_t cp;
+		if (c >= 0xc2 && c <= 0xdf) {
+			n = 1;
+			cp = c & 0x1f;
+		} else if ((c & 0xf0) == 0xe0) {
+			n = 2;
+			cp = c & 0x0f;
+		} else if (c >= 0xf0 && c <= 0xf4) {
+			n = 3;
+			cp = c & 0x07;
+		} else {
+			return false;
+		}
+		if (len - i - 1 < n) return false;
+		for (size_t k = 1; k <= n; k++) {
+			if ((s[i + k] & 0xc0) != 0x80) return false;
+			cp = (cp << 6) | (s[i + k] & 0x3f);
+		}
+		// overlong, surrogates, past U+10FFFF
+		if (n == 2 && (cp < 0x800 || (cp >= 0xd800 && cp <= 0xdfff))) return false;
+		if (n == 3 && (cp < 0x10000 || cp > 0x10ffff)) return false;
+		i += n + 1;
+	}
+	return true;
+}
+
+/*
+	 The parser
+*/
+
+void ws_parser_init(WS_PARSER_t *p, size_t max, bool deflate)
+{
+	memset(p, 0, sizeof(WS_PARSER_t));
+	p->max = max;
+	p->deflate = deflate;
+	p->header_need = 2;
+}
+
+void ws_parser_free(WS_PARSER_t *p)
+{
+	free(p->buf);
+	p->buf = NULL;
+	p->cap = 0;
+}
+
+// room for need bytes and the NUL
+static int grow(WS_PARSER_t *p, size_t need)
+{
+	if (need + 1 <= p->cap) return 0;
+	size_t cap = p->cap ? p->cap : 256;
+	while (cap < need + 1) cap *= 2;
+	if (cap > p->max + 1) cap = p->max + 1;
+	uint8_t *buf = realloc(p->buf, cap);
+	if (buf == NULL) return -1;
+	p->buf = buf;
+	p->cap = cap;
+	return 0;
+}
+
+static bool is_control(int opcode)
+{
+	return opcode & 0x08;
+}
+
+// the header is complete: checks it and gets ready for the payload
+static int start_frame(WS_PARSER_t *p)
+{
+	uint8_t b0 = p->header[0], b1 = p->header[1];
+	int opcode = b0 & 0x0f;
+	bool rsv1 = b0 & 0x40;
+	uint64_t len = b1 & 0x7f;
+	if (len == 126) {
+		len = (p->header[2] << 8) | p->header[3];
+	} else if (len == 127) {
+		len = 0;
+		for (int i = 0; i < 8; i++) len = (len << 8) | p->header[2 + i];
+		if (len >> 63) return -WS_CLOSE_PROTOCOL;
+	}
+	memcpy(p->key, p->header + p->header_need - 4, 4);
+	if (b0 & 0x30) return -WS_CLOSE_PROTOCOL;
+	// RSV1 is permessage-deflate, on the first frame of a data message only
+	if (rsv1 && (!p->deflate || opcode == WEBSOCKET_OPCODE_CONT || is_control(opcode))) return -WS_CLOSE_PROTOCOL;
+
+	switch (opcode) {
+		case WEBSOCKET_OPCODE_CLOSE:
+		case WEBSOCKET_OPCODE_PING:
+		case WEBSOCKET_OPCODE_PONG:
+			if (!(b0 & 0x80) || len > WS_MAX_CONTROL) return -WS_CLOSE_PROTOCOL;
+			break;
+		case WEBSOCKET_OPCODE_TEXT:
+		case WEBSOCKET_OPCODE_BIN:
+			if (p->opcode) return -WS_CLOSE_PROTOCOL;
+			p->opcode = opcode;
+			p->compressed = rsv1;
+			break;
+		case WEBSOCKET_OPCODE_CONT:
+			if (p->opcode == 0) return -WS_CLOSE_PROTOCOL;
+			break;
+		default:
+			return -WS_CLOSE_PROTOCOL;
+	}
+	if (!is_control(opcode)) {
+		if (len > p->max - p->len) return -WS_CLOSE_TOO_BIG;
+		if (grow(p, p->len + len) != 0) return -WS_CLOSE_TOO_BIG;
+	}
+	p->frame_opcode = opcode;
+	p->fin = b0 & 0x80;
+	p->left = len;
+	p->offset = 0;
+	return 0;
+}
+
+static int check_close(const uint8_t *data, size_t len)
+{
+	if (len == 0) return 0;
+	if (len == 1) return -WS_CLOSE_PROTOCOL;
+	int code = (data[0] << 8) | data[1];
+	bool valid = (code >= 1000 && code <= 1003) || (code >= 1007 && code <= 1011) || (code >= 3000 && code <= 4999);
+	if (!valid) return -WS_CLOSE_PROTOCOL;
+	if (!ws_utf8_valid(data + 2, len - 2)) return -WS_CLOSE_INVALID_DATA;
+	return 0;
+}
+
+// the payload of a frame is in: 1 with a message, 0 while fragments are missing
+static int end_frame(WS_PARSER_t *p, WS_MESSAGE_t *msg)
+{
+	p->header_len = 0;
+	p->header_need = 2;
+	if (is_control(p->frame_opcode)) {
+		p->control[p->offset] = 0;
+		if (p->frame_opcode == WEBSOCKET_OPCODE_CLOSE) {
+			int err = check_close(p->control, p->offset);
+			if (err) return err;
+		}
+		*msg = (WS_MESSAGE_t) { .opcode = p->frame_opcode, .data = p->control, .len = p->offset };
+		return 1;
+	}
+	if (!p->fin) return 0;
+	p->buf[p->len] = 0;
+	*msg = (WS_MESSAGE_t) { .opcode = p->opcode, .compressed = p->compressed, .data = p->buf, .len = p->len };
+	p->delivered = true;
+	return 1;
+}
+
+int ws_parse(WS_PARSER_t *p, const uint8_t *data, size_t len, size_t *used, WS_MESSAGE_t *msg)
+{
+	size_t i = 0;
+	int ret = 0;
+	if (p->delivered) {
+		p->delivered = false;
+		p->len = 0;
+		p->opcode = 0;
+		p->compressed = false;
+	}
+	while (i < len && ret == 0) {
+		if (p->header_len < p->header_need) {
+			size_t take = p->header_need - p->header_len;
+			if (take > len - i) take = len - i;
+			memcpy(p->header + p->header_len, data + i, take);
+			p->header_len += take;
+			i += take;
+			if (p->header_len == 2 && p->header_need == 2) {
+				// a client masks every frame
+				if ((p->header[1] & 0x80) == 0) {
+					ret = -WS_CLOSE_PROTOCOL;
+					break;
+				}
+				int len7 = p->header[1] & 0x7f;
+				p->header_need = 2 + (len7 == 126 ? 2 : len7 == 127 ? 8 : 0) + 4;
+			}
+			if (p->header_len < p->header_need) continue;
+			ret = start_frame(p);
+			if (ret == 0 && p->left == 0) ret = end_frame(p, msg);
+			continue;
+		}
+		size_t n = len - i;
+		if (n > p->left) n = p->left;
+		uint8_t *dst = is_control(p->frame_opcode) ? p->control + p->offset : p->buf + p->len;
+		memcpy(dst, data + i, n);
+		ws_mask(dst, n, p->key, p->offset);
+		if (!is_control(p->frame_opcode)) p->len += n;
+		p->offset += n;
+		p->left -= n;
+		i += n;
+		if (p->left == 0) ret = end_frame(p, msg);
+	}
+	*used = i;
+	return ret;
+}
+
+/*
+	 The opening handshake: SHA-1 and base64 of the key, and the headers
+*/
+
+typedef struct {
+	uint32_t h[5];
+	uint8_t block[64];
+	size_t len;
+} SHA1_t;
+
+static uint32_t rol(uint32_t v, int n)
+{
+	return (v << n) | (v >> (32 - n));
+}
+
+static void sha1_block(SHA1_t *s)
+{
+	uint32_t w[80];
+	for (int i = 0; i < 16; i++) {
+		w[i] = (uint32_t)s->block[4 * i] << 24 | s->block[4 * i + 1] << 16 | s->block[4 * i + 2] << 8 | s->block[4 * i + 3];
+	}
+	for (int i = 16; i < 80; i++) w[i] = rol(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+	uint32_t a = s->h[0], b = s->h[1], c = s->h[2], d = s->h[3], e = s->h[4];
+	for (int i = 0; i < 80; i++) {
+		uint32_t f, k;
+		if (i < 20) {
+			f = (b & c) | (~b & d);
+			k = 0x5a827999;
+		} else if (i < 40) {
+			f = b ^ c ^ d;
+			k = 0x6ed9eba1;
+		} else if (i < 60) {
+			f = (b & c) | (b & d) | (c & d);
+			k = 0x8f1bbcdc;
+		} else {
+			f = b ^ c ^ d;
+			k = 0xca62c1d6;
+		}
+		uint32_t t = rol(a, 5) + f + e + k + w[i];
+		e = d;
+		d = c;
+		c = rol(b, 30);
+		b = a;
+		a = t;
+	}
+	s->h[0] += a;
+	s->h[1] += b;
+	s->h[2] += c;
+	s->h[3] += d;
+	s->h[4] += e;
+}
+
+static void sha1_update(SHA1_t *s, const void *data, size_t len)
+{
+	const uint8_t *p = data;
+	for (size_t i = 0; i < len; i++) {
+		s->block[s->len++ % 64] = p[i];
+		if (s->len % 64 == 0) sha1_block(s);
+	}
+}
+
+static void sha1_digest(const void *a, size_t a_len, const void *b, size_t b_len, uint8_t digest[20])
+{
+	SHA1_t s = { .h = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0 } };
+	sha1_update(&s, a, a_len);
+	sha1_update(&s, b, b_len);
+	uint64_t bits = (uint64_t)s.len * 8;
+	uint8_t pad = 0x80;
+	sha1_update(&s, &pad, 1);
+	pad = 0;
+	while (s.len % 64 != 56) sha1_update(&s, &pad, 1);
+	for (int i = 7; i >= 0; i--) {
+		uint8_t byte = bits >> (8 * i);
+		sha1_update(&s, &byte, 1);
+	}
+	for (int i = 0; i < 20; i++) digest[i] = s.h[i / 4] >> (24 - 8 * (i % 4));
+}
+
+void ws_accept_key(const char *key, size_t key_len, char accept[WS_ACCEPT_SIZE])
+{
+	static const char GUID[] = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+	static const char BASE64[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	uint8_t digest[21];
+	sha1_digest(key, key_len, GUID, sizeof(GUID) - 1, digest);
+	digest[20] = 0;
+	// 20 bytes: six groups of 3, and 2 with one '='
+	char *out = accept;
+	for (int i = 0; i < 21; i += 3) {
+		uint32_t v = digest[i] << 16 | digest[i + 1] << 8 | (i + 2 < 21 ? digest[i + 2] : 0);
+		*out++ = BASE64[(v >> 18) & 63];
+		*out++ = BASE64[(v >> 12) & 63];
+		*out++ = i + 1 < 20 ? BASE64[(v >> 6) & 63] : '=';
+		*out++ = i + 2 < 20 ? BASE64[v & 63] : '=';
+	}
+	accept[28] = 0;
+}
+
+// the value of a header of the request, trimmed; NULL when it is not there
+static const char *find_header(const char *req, size_t len, const char *name, size_t *value_len)
+{
+	size_t name_len = strlen(name);
+	const char *end = req + len;
+	const char *line = memchr(req, '\n', len);
+	while (line && ++line < end && *line != '\r' && *line != '\n') {
+		const char *eol = memchr(line, '\n', end - line);
+		if (eol == NULL) eol = end;
+		if ((size_t)(eol - line) > name_len && line[name_len] == ':' && strncasecmp(line, name, name_len) == 0) {
+			const char *v = line + name_len + 1;
+			const char *v_end = eol;
+			while (v < v_end && (*v == ' ' || *v == '\t')) v++;
+			while (v_end > v && (v_end[-1] == '\r' || v_end[-1] == ' ' || v_end[-1] == '\t')) v_end--;
+			*value_len = v_end - v;
+			return v;
+		}
+		line = eol < end ? eol : NULL;
+	}
+	return NULL;
+}
+
+// the next item of a list separated by sep, trimmed; false at the end
+static bool next_item(const char **s, const char *end, char sep, const char **item, size_t *item_len)
+{
+	while (*s < end && (**s == ' ' || **s == '\t' || **s == sep)) (*s)++;
+	if (*s >= end) return false;
+	const char *start = *s;
+	while (*s < end && **s != sep) (*s)++;
+	const char *stop = *s;
+	while (stop > start && (stop[-1] == ' ' || stop[-1] == '\t')) stop--;
+	*item = start;
+	*item_len = stop - start;
+	return true;
+}
+
+static bool has_token(const char *value, size_t len, const char *token)
+{
+	const char *item;
+	size_t item_len;
+	const char *end = value + len;
+	while (next_item(&value, end, ',', &item, &item_len)) {
+		if (item_len == strlen(token) && strncasecmp(item, token, item_len) == 0) return true;
+	}
+	return false;
+}
+
+static bool is_param(const char *item, size_t len, const char *name)
+{
+	size_t n = strlen(name);
+	return len >= n && strncasecmp(item, name, n) == 0 && (len == n || item[n] == '=' || item[n] == ' ');
+}
+
+// one offer of Sec-WebSocket-Extensions: permessage-deflate with parameters we can live with
+static bool deflate_offer(const char *offer, size_t len)
+{
+	const char *end = offer + len;
+	const char *item;
+	size_t item_len;
+	if (!next_item(&offer, end, ';', &item, &item_len)) return false;
+	if (item_len != 18 || strncasecmp(item, "permessage-deflate", 18) != 0) return false;
+	while (next_item(&offer, end, ';', &item, &item_len)) {
+		if (is_param(item, item_len, "server_no_context_takeover") || is_param(item, item_len, "client_no_context_takeover")
+			|| is_param(item, item_len, "client_max_window_bits")) continue;
+		// the window of the compressor is the message, up to 32 KB: only the full window will do
+		if (is_param(item, item_len, "server_max_window_bits")) {
+			const char *v = memchr(item, '=', item_len);
+			if (v && atoi(v + 1 + (v[1] == '"')) == 15) continue;
+		}
+		return false;
+	}
+	return true;
+}
+
+int ws_handshake(const char *request, size_t len, char *out, size_t size, bool *deflate)
+{
+	size_t n;
+	const char *v;
+	if (len < 4 || strncmp(request, "GET ", 4) != 0) return -1;
+	if ((v = find_header(request, len, "Upgrade", &n)) == NULL || !has_token(v, n, "websocket")) return -1;
+	if ((v = find_header(request, len, "Connection", &n)) == NULL || !has_token(v, n, "upgrade")) return -1;
+	if ((v = find_header(request, len, "Sec-WebSocket-Version", &n)) == NULL || n != 2 || strncmp(v, "13", 2) != 0) return -1;
+	const char *key = find_header(request, len, "Sec-WebSocket-Key", &n);
+	if (key == NULL || n == 0) return -1;
+	char accept[WS_ACCEPT_SIZE];
+	ws_accept_key(key, n, accept);
+
+	bool agreed = false;
+	if (*deflate && (v = find_header(request, len, "Sec-WebSocket-Extensions", &n)) != NULL) {
+		const char *end = v + n;
+		const char *offer;
+		size_t offer_len;
+		while (!agreed && next_item(&v, end, ',', &offer, &offer_len)) agreed = deflate_offer(offer, offer_len);
+	}
+	*deflate = agreed;
+	int ret = snprintf(out, size,
+		"HTTP/1.1 101 Switching Protocols\r\n"
+		"Upgrade: websocket\r\n"
+		"Connection: Upgrade\r\n"
+		"Sec-WebSocket-Accept: %s\r\n"
+		"%s\r\n", accept,
+		agreed ? "Sec-WebSocket-Extensions: permessage-deflate; server_no_context_takeover; client_no_context_takeover\r\n" : "");
+	return ret > 0 && (size_t)ret < size ? ret : -1;
+}
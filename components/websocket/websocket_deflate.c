@@ -0,0 +1,380 @@
+/*
+	 permessage-deflate (RFC 7692), see websocket.h
+
+	 A message is a deflate stream cut after a sync flush: the empty stored
+	 block at the end loses its 00 00 ff ff on the wire. The compressor
+	 writes one block with the fixed codes, then the 3 bits of the empty
+	 stored block. The decompressor (after puff.c of zlib) puts the 4
+	 bytes back behind the input and takes any block type.
+*/
+
+#include <string.h>
+
+#include "websocket.h"
+
+static const uint16_t LENGTH_BASE[29] = {
+	3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+static const uint8_t LENGTH_EXTRA[29] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+static const uint16_t DIST_BASE[30] = {
+	1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769,
+	1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+static const uint8_t DIST_EXTRA[30] = {
+	0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+/*
+	 The compressor
+*/
+
+#define WINDOW 32768
+#define MIN_MATCH 3
+#define MAX_MATCH 258
+
+// the codes of the fixed Huffman table, bit reversed to go out LSB first
+static struct {
+	bool ready;
+	uint16_t lit_code[288];
+	uint8_t lit_bits[288];
+	uint8_t length_code[MAX_MATCH + 1];		// length to its symbol - 257
+	uint8_t dist_code[512];					// distance - 1 to its code, see dist_code()
+} enc;
+
+static uint32_t reverse(uint32_t code, int bits)
+{
+	uint32_t r = 0;
+	for (int i = 0; i < bits; i++, code >>= 1) r = (r << 1) | (code & 1);
+	return r;
+}
+
+// the same every time, two tasks that get here first do no harm
+static void init_encoder(void)
+{
+	if (enc.ready) return;
+	for (int i = 0; i < 288; i++) {
+		uint32_t code;
+		int bits;
+		if (i < 144) {
+			code = 0x30 + i;
+			bits = 8;
+		} else if (i < 256) {
+			code = 0x190 + i - 144;
+			bits = 9;
+		} else if (i < 280) {
+			code = i - 256;
+			bits = 7;
+		} else {
+			code = 0xc0 + i - 280;
+			bits = 8;
+		}
+		enc.lit_code[i] = reverse(code, bits);
+		enc.lit_bits[i] = bits;
+	}
+	for (int code = 0; code < 29; code++) {
+		int top = code < 28 ? LENGTH_BASE[code] + (1 << LENGTH_EXTRA[code]) : MAX_MATCH + 1;
+		for (int len = LENGTH_BASE[code]; len < top && len <= MAX_MATCH; len++) enc.length_code[len] = code;
+	}
+	enc.length_code[MAX_MATCH] = 28;
+	for (int code = 0; code < 30; code++) {
+		for (int d = DIST_BASE[code]; d < DIST_BASE[code] + (1 << DIST_EXTRA[code]); d++) {
+			if (d <= 256) enc.dist_code[d - 1] = code;
+			else enc.dist_code[256 + ((d - 1) >> 7)] = code;
+		}
+	}
+	enc.ready = true;
+}
+
+static int dist_code(size_t dist)
+{
+	return dist <= 256 ? enc.dist_code[dist - 1] : enc.dist_code[256 + ((dist - 1) >> 7)];
+}
+
+typedef struct {
+	uint8_t *out;
+	size_t pos;
+	size_t size;
+	uint32_t bits;
+	int count;
+	bool full;
+} BITS_t;
+
+static inline void put_bits(BITS_t *w, uint32_t value, int n)
+{
+	w->bits |= value << w->count;
+	w->count += n;
+	while (w->count >= 8) {
+		if (w->pos < w->size) w->out[w->pos++] = w->bits;
+		else w->full = true;
+		w->bits >>= 8;
+		w->count -= 8;
+	}
+}
+
+static inline uint32_t hash(const uint8_t *p)
+{
+	uint32_t v = (uint32_t)p[0] << 16 | p[1] << 8 | p[2];
+	return (v * 2654435761u) >> (32 - WS_DEFLATE_HASH_BITS);
+}
+
+int ws_deflate(WS_DEFLATE_t *z, const uint8_t *in, size_t len, uint8_t *out, size_t size)
+{
+	if (len == 0 || len > WS_DEFLATE_MAX_INPUT) return -1;
+	init_encoder();
+	memset(z->head, 0, sizeof(z->head));
+	// no use going past len - 1 bytes
+	BITS_t w = { .out = out, .size = size < len ? size : len - 1 };
+	put_bits(&w, 2, 3);		// not the last block, fixed codes
+	size_t i = 0;
+	while (i < len && !w.full) {
+		size_t best = 0, dist = 0;
+		if (len - i >= MIN_MATCH) {
+			uint32_t h = hash(in + i);
+			size_t cand = z->head[h];
+			z->head[h] = i + 1;
+			if (cand && i - (cand - 1) <= WINDOW) {
+				const uint8_t *a = in + cand - 1, *b = in + i;
+				size_t max = len - i < MAX_MATCH ? len - i : MAX_MATCH;
+				size_t n = 0;
+				while (n < max && a[n] == b[n]) n++;
+				if (n >= MIN_MATCH) {
+					best = n;
+					dist = i - (cand - 1);
+				}
+			}
+		}
+		if (best == 0) {
+			put_bits(&w, enc.lit_code[in[i]], enc.lit_bits[in[i]]);
+			i++;
+			continue;
+		}
+		int lc = enc.length_code[best];
+		put_bits(&w, enc.lit_code[257 + lc], enc.lit_bits[257 + lc]);
+		put_bits(&w, best - LENGTH_BASE[lc], LENGTH_EXTRA[lc]);
+		int dc = dist_code(dist);
+		put_bits(&w, reverse(dc, 5), 5);
+		put_bits(&w, dist - DIST_BASE[dc], DIST_EXTRA[dc]);
+		// the positions inside the match go in the hash too
+		for (size_t k = i + 1; k < i + best && len - k >= MIN_MATCH; k++) z->head[hash(in + k)] = k + 1;
+		i += best;
+	}
+	put_bits(&w, enc.lit_code[256], enc.lit_bits[256]);
+	// the empty stored block of the flush, down to its header and the padding
+	put_bits(&w, 0, 3);
+	if (w.count) put_bits(&w, 0, 8 - w.count);
+	return w.full ? -1 : (int)w.pos;
+}
+
+/*
+	 The decompressor
+*/
+
+#define BROKEN -1
+#define FULL -2
+
+typedef struct {
+	const uint8_t *in;
+	size_t len;
+	size_t pos;			// past len: into the 00 00 ff ff
+	uint32_t bits;
+	int count;
+	uint8_t *out;
+	size_t size;
+	size_t n;
+} INFLATE_t;
+
+typedef struct {
+	uint16_t count[16];		// codes of each length
+	uint16_t symbol[288];	// by code
+} HUFF_t;
+
+static int next_byte(INFLATE_t *s)
+{
+	static const uint8_t TAIL[4] = { 0x00, 0x00, 0xff, 0xff };
+	if (s->pos < s->len) return s->in[s->pos++];
+	if (s->pos < s->len + 4) return TAIL[s->pos++ - s->len];
+	return -1;
+}
+
+static int get_bits(INFLATE_t *s, int need)
+{
+	uint32_t v = s->bits;
+	while (s->count < need) {
+		int byte = next_byte(s);
+		if (byte < 0) return -1;
+		v |= (uint32_t)byte << s->count;
+		s->count += 8;
+	}
+	s->bits = v >> need;
+	s->count -= need;
+	return v & ((1u << need) - 1);
+}
+
+static int decode(INFLATE_t *s, const HUFF_t *h)
+{
+	int code = 0, first = 0, index = 0;
+	for (int len = 1; len < 16; len++) {
+		int bit = get_bits(s, 1);
+		if (bit < 0) return -1;
+		code |= bit;
+		int count = h->count[len];
+		if (code - count < first) return h->symbol[index + code - first];
+		index += count;
+		first = (first + count) << 1;
+		code <<= 1;
+	}
+	return -1;
+}
+
+// returns 0 for a complete code, more for an incomplete one, less when over-subscribed
+static int construct(HUFF_t *h, const uint8_t *length, int n)
+{
+	memset(h->count, 0, sizeof(h->count));
+	for (int i = 0; i < n; i++) h->count[length[i]]++;
+	if (h->count[0] == n) return 0;
+	int left = 1;
+	for (int len = 1; len < 16; len++) {
+		left <<= 1;
+		left -= h->count[len];
+		if (left < 0) return left;
+	}
+	uint16_t offs[16];
+	offs[1] = 0;
+	for (int len = 1; len < 15; len++) offs[len + 1] = offs[len] + h->count[len];
+	for (int i = 0; i < n; i++) {
+		if (length[i]) h->symbol[offs[length[i]]++] = i;
+	}
+	return left;
+}
+
+static int stored(INFLATE_t *s)
+{
+	s->bits = 0;
+	s->count = 0;
+	int b[4];
+	for (int i = 0; i < 4; i++) {
+		if ((b[i] = next_byte(s)) < 0) return -1;
+	}
+	unsigned len = b[0] | b[1] << 8;
+	if (len != (~(b[2] | b[3] << 8) & 0xffff)) return -1;
+	if (s->len + 4 - s->pos < len) return BROKEN;
+	if (s->size - s->n < len) return FULL;
+	for (unsigned i = 0; i < len; i++) s->out[s->n++] = next_byte(s);
+	return 0;
+}
+
+static int codes(INFLATE_t *s, const HUFF_t *lencode, const HUFF_t *distcode)
+{
+	for (;;) {
+		int sym = decode(s, lencode);
+		if (sym < 0) return -1;
+		if (sym < 256) {
+			if (s->n == s->size) return FULL;
+			s->out[s->n++] = sym;
+			continue;
+		}
+		if (sym == 256) return 0;
+		sym -= 257;
+		if (sym >= 29) return -1;
+		int extra = get_bits(s, LENGTH_EXTRA[sym]);
+		int dsym = decode(s, distcode);
+		if (extra < 0 || dsym < 0 || dsym >= 30) return -1;
+		size_t len = LENGTH_BASE[sym] + extra;
+		extra = get_bits(s, DIST_EXTRA[dsym]);
+		if (extra < 0) return -1;
+		size_t dist = DIST_BASE[dsym] + extra;
+		if (dist > s->n) return BROKEN;
+		if (s->size - s->n < len) return FULL;
+		// may overlap, byte by byte
+		for (size_t i = 0; i < len; i++, s->n++) s->out[s->n] = s->out[s->n - dist];
+	}
+}
+
+static int fixed(INFLATE_t *s)
+{
+	static HUFF_t lencode, distcode;
+	static bool ready;
+	if (!ready) {
+		uint8_t lengths[288];
+		int i = 0;
+		for (; i < 144; i++) lengths[i] = 8;
+		for (; i < 256; i++) lengths[i] = 9;
+		for (; i < 280; i++) lengths[i] = 7;
+		for (; i < 288; i++) lengths[i] = 8;
+		construct(&lencode, lengths, 288);
+		for (i = 0; i < 30; i++) lengths[i] = 5;
+		construct(&distcode, lengths, 30);
+		ready = true;
+	}
+	return codes(s, &lencode, &distcode);
+}
+
+static int dynamic(INFLATE_t *s)
+{
+	static const uint8_t ORDER[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+	int nlen = get_bits(s, 5), ndist = get_bits(s, 5), ncode = get_bits(s, 4);
+	if (nlen < 0 || ndist < 0 || ncode < 0) return -1;
+	nlen += 257;
+	ndist += 1;
+	ncode += 4;
+	if (nlen > 286 || ndist > 30) return -1;
+
+	uint8_t lengths[286 + 30] = { 0 };
+	for (int i = 0; i < ncode; i++) {
+		int v = get_bits(s, 3);
+		if (v < 0) return -1;
+		lengths[ORDER[i]] = v;
+	}
+	HUFF_t lencode, distcode;
+	if (construct(&lencode, lengths, 19) != 0) return -1;
+
+	for (int i = 0; i < nlen + ndist;) {
+		int sym = decode(s, &lencode);
+		if (sym < 0) return -1;
+		if (sym < 16) {
+			lengths[i++] = sym;
+			continue;
+		}
+		int len = 0, repeat;
+		if (sym == 16) {
+			if (i == 0) return -1;
+			len = lengths[i - 1];
+			repeat = get_bits(s, 2);
+			repeat = repeat < 0 ? -1 : 3 + repeat;
+		} else if (sym == 17) {
+			repeat = get_bits(s, 3);
+			repeat = repeat < 0 ? -1 : 3 + repeat;
+		} else {
+			repeat = get_bits(s, 7);
+			repeat = repeat < 0 ? -1 : 11 + repeat;
+		}
+		if (repeat < 0 || i + repeat > nlen + ndist) return -1;
+		while (repeat--) lengths[i++] = len;
+	}
+	if (lengths[256] == 0) return -1;
+	// incomplete codes only with a single length
+	int err = construct(&lencode, lengths, nlen);
+	if (err < 0 || (err > 0 && nlen - lencode.count[0] != 1)) return -1;
+	err = construct(&distcode, lengths + nlen, ndist);
+	if (err < 0 || (err > 0 && ndist - distcode.count[0] != 1)) return -1;
+	return codes(s, &lencode, &distcode);
+}
+
+int ws_inflate(const uint8_t *in, size_t len, uint8_t *out, size_t size)
+{
+	INFLATE_t s = { .in = in, .len = len, .out = out, .size = size };
+	bool last = false;
+	// up to a final block or the end of the flush
+	while (!last && !(s.pos == s.len + 4 && s.count == 0)) {
+		int header = get_bits(&s, 3);
+		if (header < 0) return -1;
+		last = header & 1;
+		int err;
+		switch (header >> 1) {
+			case 0: err = stored(&s); break;
+			case 1: err = fixed(&s); break;
+			case 2: err = dynamic(&s); break;
+			default: err = BROKEN;
+		}
+		if (err) return err;
+	}
+	return s.n;
+}
@@ -0,0 +1,528 @@
+/*
+	 WebSocket server, see websocket_server.h
+
+	 The server task is the only one to read the clients and to free them;
+	 any task may send. The send lock of a client covers its netconn and
+	 its state, the table lock the choice of a free slot. Lock order: the
+	 table, then a client.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "websocket_server.h"
+
+static const char *TAG = "websocket_server";
+
+#define MAX_CLIENTS CONFIG_WEBSOCKET_SERVER_MAX_CLIENTS
+#define URL_MAX 32
+// how often the task looks for quiet clients
+#if CONFIG_WEBSOCKET_SERVER_PING_INTERVAL > 0
+#define TICK_MS 250
+#else
+#define TICK_MS portMAX_DELAY
+#endif
+
+typedef enum {
+	CLIENT_FREE,
+	CLIENT_OPENING,		// handshake done, the callback is yet to hear of it
+	CLIENT_OPEN,
+	CLIENT_CLOSING,		// no more sends, the server task closes it
+} CLIENT_STATE_t;
+
+typedef struct {
+	struct netconn *conn;
+	char url[URL_MAX];
+	WS_CALLBACK_t callback;
+	SemaphoreHandle_t send_lock;
+	WS_PARSER_t parser;
+	CLIENT_STATE_t state;
+	WEBSOCKET_TYPE_t reason;	// what the callback is told at the close
+	bool deflate;
+	int64_t last_rx_us;
+	int64_t ping_us;			// of the keepalive ping not answered yet, 0 none
+} CLIENT_t;
+
+static CLIENT_t clients[MAX_CLIENTS];
+static SemaphoreHandle_t table_lock;
+static QueueHandle_t queue;			// netconns with data, NULL to stop
+static volatile bool overflow;		// events were lost, read every client
+static volatile bool running;
+
+#ifdef CONFIG_WEBSOCKET_SERVER_DEFLATE
+// one compressor for all, a message to many clients is compressed once
+static SemaphoreHandle_t deflate_lock;
+static WS_DEFLATE_t deflater;
+static uint8_t deflate_buf[CONFIG_WEBSOCKET_SERVER_MAX_MESSAGE];
+static uint8_t inflate_buf[CONFIG_WEBSOCKET_SERVER_MAX_MESSAGE + 1];	// server task only
+#endif
+
+static void post(struct netconn *conn)
+{
+	if (xQueueSend(queue, &conn, 0) != pdTRUE) overflow = true;
+}
+
+// the lwIP event callback, in the tcpip thread
+static void ws_server_event(struct netconn *conn, enum netconn_evt evt, uint16_t len)
+{
+	if (evt == NETCONN_EVT_RCVPLUS) post(conn);
+}
+
+/*
+	 Sending
+*/
+
+// one frame, the header and payload in one write; the send lock is held. lwIP copies
+// both: callers send from the stack and reuse their buffers, nothing would keep them
+// until the client acknowledges them
+static bool write_frame(int num, int opcode, bool compressed, const void *data, uint64_t len)
+{
+	CLIENT_t *c = &clients[num];
+	uint8_t header[WS_MAX_HEADER];
+	struct netvector vectors[2] = {
+		{ header, ws_put_header(header, opcode, compressed, len, NULL) },
+		{ data, len },
+	};
+	size_t written = 0;
+	err_t err = netconn_write_vectors_partly(c->conn, vectors, len ? 2 : 1, NETCONN_COPY, &written);
+	if (err == ERR_OK && written == vectors[0].len + len) return true;
+	// a partial frame leaves the stream broken, the server task closes it
+	ESP_LOGW(TAG, "client %d: write failed (%d, %u bytes)", num, err, (unsigned)written);
+	c->state = CLIENT_CLOSING;
+	c->reason = WEBSOCKET_DISCONNECT_ERROR;
+	post(c->conn);
+	return false;
+}
+
+static bool send_frame(int num, int opcode, bool compressed, const void *data, uint64_t len)
+{
+	CLIENT_t *c = &clients[num];
+	bool sent = false;
+	xSemaphoreTake(c->send_lock, portMAX_DELAY);
+	if (c->state == CLIENT_OPEN) sent = write_frame(num, opcode, compressed, data, len);
+	xSemaphoreGive(c->send_lock);
+	return sent;
+}
+
+// a close frame with code, then no more sends
+static bool close_frame(int num, int code, WEBSOCKET_TYPE_t reason)
+{
+	CLIENT_t *c = &clients[num];
+	uint8_t payload[2] = { code >> 8, code };
+	bool closed = false;
+	xSemaphoreTake(c->send_lock, portMAX_DELAY);
+	if (c->state == CLIENT_OPEN) {
+		write_frame(num, WEBSOCKET_OPCODE_CLOSE, false, payload, code ? 2 : 0);
+		c->state = CLIENT_CLOSING;
+		c->reason = reason;
+		closed = true;
+	}
+	xSemaphoreGive(c->send_lock);
+	return closed;
+}
+
+// to client num, or with num < 0 to the clients of url or all of them (url NULL)
+static int send_message(int num, const char *url, int opcode, const char *msg, uint64_t len)
+{
+	if (num >= MAX_CLIENTS || !running) return 0;
+	int first = num >= 0 ? num : 0;
+	int last = num >= 0 ? num + 1 : MAX_CLIENTS;
+	int sent = 0;
+#ifdef CONFIG_WEBSOCKET_SERVER_DEFLATE
+	bool compress = opcode == WEBSOCKET_OPCODE_TEXT && len >= CONFIG_WEBSOCKET_SERVER_DEFLATE_MIN && len <= WS_DEFLATE_MAX_INPUT;
+	int zlen = -1;		// -1 not tried, -2 not worth it
+	if (compress) xSemaphoreTake(deflate_lock, portMAX_DELAY);
+#endif
+	for (int i = first; i < last; i++) {
+		CLIENT_t *c = &clients[i];
+		if (c->state != CLIENT_OPEN || (url && strcmp(c->url, url) != 0)) continue;
+#ifdef CONFIG_WEBSOCKET_SERVER_DEFLATE
+		if (compress && c->deflate) {
+			if (zlen == -1) zlen = ws_deflate(&deflater, (const uint8_t *)msg, len, deflate_buf, sizeof(deflate_buf));
+			if (zlen == -1) zlen = -2;
+			if (zlen >= 0) {
+				sent += send_frame(i, opcode, true, deflate_buf, zlen);
+				continue;
+			}
+		}
+#endif
+		sent += send_frame(i, opcode, false, msg, len);
+	}
+#ifdef CONFIG_WEBSOCKET_SERVER_DEFLATE
+	if (compress) xSemaphoreGive(deflate_lock);
+#endif
+	return sent;
+}
+
+int ws_server_send_text_client(int num, char *msg, uint64_t len)
+{
+	return num >= 0 ? send_message(num, NULL, WEBSOCKET_OPCODE_TEXT, msg, len) : 0;
+}
+
+int ws_server_send_text_clients(char *url, char *msg, uint64_t len)
+{
+	return send_message(-1, url, WEBSOCKET_OPCODE_TEXT, msg, len);
+}
+
+int ws_server_send_text_all(char *msg, uint64_t len)
+{
+	return send_message(-1, NULL, WEBSOCKET_OPCODE_TEXT, msg, len);
+}
+
+int ws_server_send_bin_client(int num, char *msg, uint64_t len)
+{
+	return num >= 0 ? send_message(num, NULL, WEBSOCKET_OPCODE_BIN, msg, len) : 0;
+}
+
+int ws_server_send_bin_clients(char *url, char *msg, uint64_t len)
+{
+	return send_message(-1, url, WEBSOCKET_OPCODE_BIN, msg, len);
+}
+
+int ws_server_send_bin_all(char *msg, uint64_t len)
+{
+	return send_message(-1, NULL, WEBSOCKET_OPCODE_BIN, msg, len);
+}
+
+int ws_server_send_text_client_from_callback(int num, char *msg, uint64_t len)
+{
+	return ws_server_send_text_client(num, msg, len);
+}
+
+int ws_server_send_text_clients_from_callback(char *url, char *msg, uint64_t len)
+{
+	return ws_server_send_text_clients(url, msg, len);
+}
+
+int ws_server_send_text_all_from_callback(char *msg, uint64_t len)
+{
+	return ws_server_send_text_all(msg, len);
+}
+
+int ws_server_send_bin_client_from_callback(int num, char *msg, uint64_t len)
+{
+	return ws_server_send_bin_client(num, msg, len);
+}
+
+int ws_server_send_bin_clients_from_callback(char *url, char *msg, uint64_t len)
+{
+	return ws_server_send_bin_clients(url, msg, len);
+}
+
+int ws_server_send_bin_all_from_callback(char *msg, uint64_t len)
+{
+	return ws_server_send_bin_all(msg, len);
+}
+
+int ws_server_ping(int num)
+{
+	if (num < 0 || num >= MAX_CLIENTS) return 0;
+	return send_frame(num, WEBSOCKET_OPCODE_PING, false, NULL, 0);
+}
+
+/*
+	 Clients
+*/
+
+int ws_server_add_client(struct netconn *conn, char *msg, uint16_t len, char *url, WS_CALLBACK_t callback)
+{
+	static const char BAD_REQUEST[] = "HTTP/1.1 400 Bad Request\r\nConnection: close\r\n\r\n";
+	static const char BUSY[] = "HTTP/1.1 503 Service Unavailable\r\nConnection: close\r\n\r\n";
+	char response[256];
+#ifdef CONFIG_WEBSOCKET_SERVER_DEFLATE
+	bool deflate = true;
+#else
+	bool deflate = false;
+#endif
+	int response_len = running ? ws_handshake(msg, len, response, sizeof(response), &deflate) : -1;
+	int num = -1;
+	if (response_len > 0) {
+		xSemaphoreTake(table_lock, portMAX_DELAY);
+		for (int i = 0; i < MAX_CLIENTS && num < 0; i++) {
+			if (clients[i].state == CLIENT_FREE) num = i;
+		}
+		if (num >= 0) clients[num].state = CLIENT_OPENING;
+		xSemaphoreGive(table_lock);
+	}
+	if (num < 0) {
+		if (response_len > 0) {
+			ESP_LOGW(TAG, "no room for a client");
+			netconn_write(conn, BUSY, sizeof(BUSY) - 1, NETCONN_NOCOPY);
+		} else {
+			ESP_LOGW(TAG, "bad upgrade request");
+			netconn_write(conn, BAD_REQUEST, sizeof(BAD_REQUEST) - 1, NETCONN_NOCOPY);
+		}
+		netconn_close(conn);
+		netconn_delete(conn);
+		return -1;
+	}
+
+	CLIENT_t *c = &clients[num];
+	c->conn = conn;
+	snprintf(c->url, sizeof(c->url), "%s", url);
+	c->callback = callback;
+	c->deflate = deflate;
+	c->reason = WEBSOCKET_DISCONNECT_ERROR;
+	c->last_rx_us = esp_timer_get_time();
+	c->ping_us = 0;
+	ws_parser_init(&c->parser, CONFIG_WEBSOCKET_SERVER_MAX_MESSAGE, deflate);
+	netconn_set_sendtimeout(conn, CONFIG_WEBSOCKET_SERVER_SEND_TIMEOUT);
+	if (netconn_write(conn, response, response_len, NETCONN_COPY) != ERR_OK) c->state = CLIENT_CLOSING;
+	// what came in before is waiting, the task reads it with the first event
+	conn->callback = ws_server_event;
+	post(conn);
+	ESP_LOGI(TAG, "client %d on %s%s", num, c->url, deflate ? ", permessage-deflate" : "");
+	return num;
+}
+
+int ws_server_len_url(char *url)
+{
+	int n = 0;
+	for (int i = 0; i < MAX_CLIENTS; i++) {
+		if (clients[i].state == CLIENT_OPEN && strcmp(clients[i].url, url) == 0) n++;
+	}
+	return n;
+}
+
+int ws_server_len_all(void)
+{
+	int n = 0;
+	for (int i = 0; i < MAX_CLIENTS; i++) {
+		if (clients[i].state == CLIENT_OPEN) n++;
+	}
+	return n;
+}
+
+int ws_server_remove_client(int num)
+{
+	if (num < 0 || num >= MAX_CLIENTS) return 0;
+	if (!close_frame(num, WS_CLOSE_NORMAL, WEBSOCKET_DISCONNECT_INTERNAL)) return 0;
+	post(clients[num].conn);
+	return 1;
+}
+
+int ws_server_remove_clients(char *url)
+{
+	int n = 0;
+	for (int i = 0; i < MAX_CLIENTS; i++) {
+		if (clients[i].state == CLIENT_OPEN && strcmp(clients[i].url, url) == 0) n += ws_server_remove_client(i);
+	}
+	return n;
+}
+
+int ws_server_remove_all(void)
+{
+	int n = 0;
+	for (int i = 0; i < MAX_CLIENTS; i++) n += ws_server_remove_client(i);
+	return n;
+}
+
+/*
+	 The server task
+*/
+
+// tells the callback and frees the slot
+static void close_client(int num)
+{
+	CLIENT_t *c = &clients[num];
+	c->callback(num, c->reason, NULL, 0);
+	xSemaphoreTake(table_lock, portMAX_DELAY);
+	xSemaphoreTake(c->send_lock, portMAX_DELAY);
+	struct netconn *conn = c->conn;
+	c->conn = NULL;
+	c->state = CLIENT_FREE;
+	xSemaphoreGive(c->send_lock);
+	xSemaphoreGive(table_lock);
+	ws_parser_free(&c->parser);
+	conn->callback = NULL;
+	netconn_close(conn);
+	netconn_delete(conn);
+	ESP_LOGI(TAG, "client %d closed (%d)", num, c->reason);
+}
+
+static void deliver(int num, WS_MESSAGE_t *msg)
+{
+	CLIENT_t *c = &clients[num];
+	uint8_t *data = msg->data;
+	size_t len = msg->len;
+	switch (msg->opcode) {
+		case WEBSOCKET_OPCODE_PING:
+			send_frame(num, WEBSOCKET_OPCODE_PONG, false, data, len);
+			c->callback(num, WEBSOCKET_PING, (char *)data, len);
+			return;
+		case WEBSOCKET_OPCODE_PONG:
+			c->callback(num, WEBSOCKET_PONG, (char *)data, len);
+			return;
+		case WEBSOCKET_OPCODE_CLOSE:
+			// the code back, or none
+			close_frame(num, len >= 2 ? (data[0] << 8) | data[1] : 0, WEBSOCKET_DISCONNECT_EXTERNAL);
+			return;
+	}
+	if (msg->compressed) {
+#ifdef CONFIG_WEBSOCKET_SERVER_DEFLATE
+		int n = ws_inflate(data, len, inflate_buf, sizeof(inflate_buf) - 1);
+		if (n < 0) {
+			close_frame(num, n == -2 ? WS_CLOSE_TOO_BIG : WS_CLOSE_INVALID_DATA, WEBSOCKET_DISCONNECT_ERROR);
+			return;
+		}
+		data = inflate_buf;
+		len = n;
+		data[len] = 0;
+#endif
+	}
+	if (msg->opcode == WEBSOCKET_OPCODE_TEXT && !ws_utf8_valid(data, len)) {
+		close_frame(num, WS_CLOSE_INVALID_DATA, WEBSOCKET_DISCONNECT_ERROR);
+		return;
+	}
+	c->callback(num, msg->opcode == WEBSOCKET_OPCODE_TEXT ? WEBSOCKET_TEXT : WEBSOCKET_BIN, (char *)data, len);
+}
+
+// all the messages in data
+static void receive(int num, const uint8_t *data, size_t len)
+{
+	CLIENT_t *c = &clients[num];
+	while (len > 0 && c->state == CLIENT_OPEN) {
+		WS_MESSAGE_t msg;
+		size_t used;
+		int ret = ws_parse(&c->parser, data, len, &used, &msg);
+		data += used;
+		len -= used;
+		if (ret < 0) {
+			ESP_LOGW(TAG, "client %d: protocol error, closing with %d", num, -ret);
+			close_frame(num, -ret, WEBSOCKET_DISCONNECT_ERROR);
+		} else if (ret > 0) {
+			deliver(num, &msg);
+		}
+	}
+}
+
+// what the client sent, until there is no more
+static void serve(int num)
+{
+	CLIENT_t *c = &clients[num];
+	if (c->state == CLIENT_OPENING) {
+		c->state = CLIENT_OPEN;
+		c->callback(num, WEBSOCKET_CONNECT, NULL, 0);
+	}
+	while (c->state == CLIENT_OPEN) {
+		struct netbuf *buf;
+		// a blocking netconn for the writes, a non blocking one for this read
+		xSemaphoreTake(c->send_lock, portMAX_DELAY);
+		netconn_set_nonblocking(c->conn, 1);
+		err_t err = netconn_recv(c->conn, &buf);
+		netconn_set_nonblocking(c->conn, 0);
+		xSemaphoreGive(c->send_lock);
+		if (err == ERR_WOULDBLOCK) break;
+		if (err != ERR_OK) {
+			// gone without a close frame
+			c->state = CLIENT_CLOSING;
+			c->reason = WEBSOCKET_DISCONNECT_ERROR;
+			break;
+		}
+		c->last_rx_us = esp_timer_get_time();
+		c->ping_us = 0;
+		netbuf_first(buf);
+		do {
+			void *data;
+			uint16_t len;
+			netbuf_data(buf, &data, &len);
+			receive(num, data, len);
+		} while (c->state == CLIENT_OPEN && netbuf_next(buf) >= 0);
+		netbuf_delete(buf);
+	}
+	if (c->state == CLIENT_CLOSING) close_client(num);
+}
+
+static void keepalive(void)
+{
+#if CONFIG_WEBSOCKET_SERVER_PING_INTERVAL > 0
+	int64_t now = esp_timer_get_time();
+	for (int i = 0; i < MAX_CLIENTS; i++) {
+		CLIENT_t *c = &clients[i];
+		if (c->state != CLIENT_OPEN) continue;
+		if (c->ping_us && now - c->ping_us > CONFIG_WEBSOCKET_SERVER_PONG_TIMEOUT * 1000LL) {
+			ESP_LOGW(TAG, "client %d: no pong in %d ms", i, CONFIG_WEBSOCKET_SERVER_PONG_TIMEOUT);
+			xSemaphoreTake(c->send_lock, portMAX_DELAY);
+			c->state = CLIENT_CLOSING;
+			c->reason = WEBSOCKET_DISCONNECT_ERROR;
+			xSemaphoreGive(c->send_lock);
+			close_client(i);
+		} else if (!c->ping_us && now - c->last_rx_us > CONFIG_WEBSOCKET_SERVER_PING_INTERVAL * 1000LL) {
+			c->ping_us = now;
+			send_frame(i, WEBSOCKET_OPCODE_PING, false, NULL, 0);
+		}
+	}
+#endif
+}
+
+static void ws_server_task(void *pvParameters)
+{
+	for (;;) {
+		struct netconn *conn = NULL;
+		bool got = xQueueReceive(queue, &conn, TICK_MS == portMAX_DELAY ? portMAX_DELAY : pdMS_TO_TICKS(TICK_MS)) == pdTRUE;
+		if (!running) break;
+		if (overflow) {
+			overflow = false;
+			for (int i = 0; i < MAX_CLIENTS; i++) {
+				if (clients[i].state != CLIENT_FREE) serve(i);
+			}
+		} else if (got && conn) {
+			for (int i = 0; i < MAX_CLIENTS; i++) {
+				if (clients[i].conn == conn && clients[i].state != CLIENT_FREE) {
+					serve(i);
+					break;
+				}
+			}
+		}
+		keepalive();
+	}
+	for (int i = 0; i < MAX_CLIENTS; i++) {
+		if (clients[i].state != CLIENT_FREE) close_client(i);
+	}
+	ESP_LOGI(TAG, "stopped");
+	vTaskDelete(NULL);
+}
+
+int ws_server_start(void)
+{
+	if (running) return 0;
+	if (queue == NULL) {
+		queue = xQueueCreate(CONFIG_WEBSOCKET_SERVER_QUEUE_SIZE, sizeof(struct netconn *));
+		table_lock = xSemaphoreCreateMutex();
+		for (int i = 0; i < MAX_CLIENTS; i++) clients[i].send_lock = xSemaphoreCreateMutex();
+#ifdef CONFIG_WEBSOCKET_SERVER_DEFLATE
+		deflate_lock = xSemaphoreCreateMutex();
+#endif
+	}
+	running = true;
+#ifdef CONFIG_WEBSOCKET_SERVER_PINNED
+	BaseType_t ok = xTaskCreatePinnedToCore(&ws_server_task, "ws_server", CONFIG_WEBSOCKET_SERVER_TASK_STACK_DEPTH, NULL,
+		CONFIG_WEBSOCKET_SERVER_TASK_PRIORITY, NULL, CONFIG_WEBSOCKET_SERVER_PINNED_CORE);
+#else
+	BaseType_t ok = xTaskCreate(&ws_server_task, "ws_server", CONFIG_WEBSOCKET_SERVER_TASK_STACK_DEPTH, NULL,
+		CONFIG_WEBSOCKET_SERVER_TASK_PRIORITY, NULL);
+#endif
+	if (ok != pdPASS) {
+		running = false;
+		return 0;
+	}
+	return 1;
+}
+
+int ws_server_stop(void)
+{
+	if (!running) return 0;
+	ws_server_remove_all();
+	running = false;
+	struct netconn *stop = NULL;
+	xQueueSend(queue, &stop, portMAX_DELAY);
+	return 1;
+}
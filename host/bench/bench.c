@@ -0,0 +1,265 @@
+/*
+	 Micro-benchmark runner for the host build, see bench.h.
+
+	 usage: ioto_bench [-l] [-f filter] [-t seconds] [-s save.txt] [-b baseline.txt] [-r percent]
+
+	 -l  list the benchmarks
+	 -f  only run benchmarks whose name contains filter
+	 -t  minimum run time per benchmark, default 0.5 s
+	 -s  save the results to a file, to be used later as a baseline
+	 -b  compare against a saved baseline
+	 -r  with -b, exit with status 1 when ns/op grew by more than percent
+*/
+
+#define _GNU_SOURCE
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "esp_log.h"
+
+#include "bench.h"
+
+volatile uint64_t bench_sink;
+
+static BENCH_t *bench_list;
+static BENCH_t **bench_tail = &bench_list;
+
+void bench_register(BENCH_t *b)
+{
+	*bench_tail = b;
+	bench_tail = &b->next;
+}
+
+/* allocation counting, every malloc of the process goes through here */
+
+static atomic_uint_fast64_t alloc_count;
+static atomic_uint_fast64_t alloc_bytes;
+
+#ifdef __GLIBC__
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+void *malloc(size_t size)
+{
+	atomic_fetch_add_explicit(&alloc_count, 1, memory_order_relaxed);
+	atomic_fetch_add_explicit(&alloc_bytes, size, memory_order_relaxed);
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+	atomic_fetch_add_explicit(&alloc_count, 1, memory_order_relaxed);
+	atomic_fetch_add_explicit(&alloc_bytes, nmemb * size, memory_order_relaxed);
+	return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	atomic_fetch_add_explicit(&alloc_count, 1, memory_order_relaxed);
+	atomic_fetch_add_explicit(&alloc_bytes, size, memory_order_relaxed);
+	return __libc_realloc(ptr, size);
+}
+#endif
+
+int64_t bench_now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+void bench_start(BENCH_t *b)
+{
+	if (b->running) return;
+	b->running = 1;
+	b->start_allocs = atomic_load(&alloc_count);
+	b->start_bytes = atomic_load(&alloc_bytes);
+	b->start_ns = bench_now_ns();
+}
+
+void bench_stop(BENCH_t *b)
+{
+	if (!b->running) return;
+	b->elapsed_ns += bench_now_ns() - b->start_ns;
+	b->allocs += atomic_load(&alloc_count) - b->start_allocs;
+	b->bytes += atomic_load(&alloc_bytes) - b->start_bytes;
+	b->running = 0;
+}
+
+void bench_metric(BENCH_t *b, const char *name, double value)
+{
+	for (int i = 0; i < b->metrics; i++) {
+		if (strcmp(b->metric_name[i], name) == 0) {
+			b->metric_value[i] = value;
+			return;
+		}
+	}
+	if (b->metrics == BENCH_MAX_METRICS) return;
+	b->metric_name[b->metrics] = name;
+	b->metric_value[b->metrics] = value;
+	b->metrics++;
+}
+
+static void run_once(BENCH_t *b, uint64_t n)
+{
+	b->running = 0;
+	b->elapsed_ns = 0;
+	b->allocs = 0;
+	b->bytes = 0;
+	b->metrics = 0;
+	bench_start(b);
+	b->fn(b, n);
+	bench_stop(b);
+}
+
+// same scaling as go test -bench: grow n until the run is long enough
+static uint64_t run_bench(BENCH_t *b, int64_t min_ns)
+{
+	uint64_t n = 1;
+	for (;;) {
+		run_once(b, n);
+		if (b->elapsed_ns >= min_ns || n >= 1000000000ULL) return n;
+		int64_t per_op = b->elapsed_ns / (int64_t)n;
+		if (per_op < 1) per_op = 1;
+		uint64_t next = (uint64_t)(min_ns / per_op) * 6 / 5;
+		if (next > n * 100) next = n * 100;
+		if (next <= n) next = n + 1;
+		n = next;
+	}
+}
+
+typedef struct {
+	char name[64];
+	double ns_per_op;
+	double allocs_per_op;
+	double bytes_per_op;
+} RESULT_t;
+
+static int load_baseline(const char *path, RESULT_t **results)
+{
+	FILE *fp = fopen(path, "r");
+	if (fp == NULL) {
+		perror(path);
+		return -1;
+	}
+	int count = 0;
+	int size = 0;
+	char line[512];
+	*results = NULL;
+	while (fgets(line, sizeof(line), fp)) {
+		if (line[0] == '#' || line[0] == '\n') continue;
+		if (count == size) {
+			size = size ? size * 2 : 32;
+			*results = realloc(*results, size * sizeof(RESULT_t));
+		}
+		RESULT_t *r = &(*results)[count];
+		if (sscanf(line, "%63s %lf %lf %lf", r->name, &r->ns_per_op, &r->allocs_per_op, &r->bytes_per_op) == 4) count++;
+	}
+	fclose(fp);
+	return count;
+}
+
+static const RESULT_t *find_result(const RESULT_t *results, int count, const char *name)
+{
+	for (int i = 0; i < count; i++) {
+		if (strcmp(results[i].name, name) == 0) return &results[i];
+	}
+	return NULL;
+}
+
+int main(int argc, char **argv)
+{
+	const char *filter = NULL;
+	const char *save_path = NULL;
+	const char *baseline_path = NULL;
+	double min_seconds = 0.5;
+	double max_regression = -1;
+	int list = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "lf:t:s:b:r:")) != -1) {
+		switch (opt) {
+			case 'l': list = 1; break;
+			case 'f': filter = optarg; break;
+			case 't': min_seconds = atof(optarg); break;
+			case 's': save_path = optarg; break;
+			case 'b': baseline_path = optarg; break;
+			case 'r': max_regression = atof(optarg); break;
+			default:
+				fprintf(stderr, "usage: %s [-l] [-f filter] [-t seconds] [-s save.txt] [-b baseline.txt] [-r percent]\n", argv[0]);
+				return 2;
+		}
+	}
+
+	if (list) {
+		for (BENCH_t *b = bench_list; b; b = b->next) printf("%s\n", b->name);
+		return 0;
+	}
+
+	// the code under test logs like it does on the board, but nobody reads it here
+	esp_log_level_set("*", ESP_LOG_NONE);
+
+	RESULT_t *baseline = NULL;
+	int baseline_count = 0;
+	if (baseline_path) {
+		baseline_count = load_baseline(baseline_path, &baseline);
+		if (baseline_count < 0) return 2;
+	}
+
+	FILE *save = NULL;
+	if (save_path) {
+		save = fopen(save_path, "w");
+		if (save == NULL) {
+			perror(save_path);
+			return 2;
+		}
+		fprintf(save, "# name ns/op allocs/op bytes/op [metric=value ...]\n");
+	}
+
+	int regressions = 0;
+	for (BENCH_t *b = bench_list; b; b = b->next) {
+		if (filter && strstr(b->name, filter) == NULL) continue;
+		uint64_t n = run_bench(b, (int64_t)(min_seconds * 1e9));
+		double ns_per_op = (double)b->elapsed_ns / n;
+		double allocs_per_op = (double)b->allocs / n;
+		double bytes_per_op = (double)b->bytes / n;
+
+		printf("%-36s %10llu %12.1f ns/op %8.2f allocs/op %10.1f B/op",
+			b->name, (unsigned long long)n, ns_per_op, allocs_per_op, bytes_per_op);
+		for (int i = 0; i < b->metrics; i++) {
+			printf("  %s=%.4g", b->metric_name[i], b->metric_value[i]);
+		}
+		if (baseline) {
+			const RESULT_t *r = find_result(baseline, baseline_count, b->name);
+			if (r && r->ns_per_op > 0) {
+				double delta = (ns_per_op - r->ns_per_op) * 100.0 / r->ns_per_op;
+				printf("  [%+.1f%% ns/op, %+.2f allocs/op]", delta, allocs_per_op - r->allocs_per_op);
+				if (max_regression >= 0 && delta > max_regression) {
+					printf(" REGRESSION");
+					regressions++;
+				}
+			} else {
+				printf("  [new]");
+			}
+		}
+		printf("\n");
+		fflush(stdout);
+
+		if (save) {
+			fprintf(save, "%s %.3f %.4f %.2f", b->name, ns_per_op, allocs_per_op, bytes_per_op);
+			for (int i = 0; i < b->metrics; i++) {
+				fprintf(save, " %s=%.6g", b->metric_name[i], b->metric_value[i]);
+			}
+			fprintf(save, "\n");
+		}
+	}
+
+	if (save) fclose(save);
+	free(baseline);
+	return regressions ? 1 : 0;
+}
@@ -0,0 +1,64 @@
+/*
+	 Micro-benchmark runner for the host build.
+
+	 A benchmark is a function that runs its body n times:
+
+		BENCH(make_send_text) {
+			char out[64];
+			for (uint64_t i = 0; i < n; i++) {
+				bench_keep(makeSendText(out, "AN", "GPIO2", "1234", "12:00:00"));
+			}
+		}
+
+	 The runner grows n until the run takes long enough and reports ns/op,
+	 allocations/op and bytes/op. Setup can be kept out of the numbers with
+	 bench_stop() / bench_start(). Extra results (compression ratio, ...)
+	 are reported with bench_metric().
+*/
+
+#ifndef HOST_BENCH_H_
+#define HOST_BENCH_H_
+
+#include <stdint.h>
+
+#define BENCH_MAX_METRICS 8
+
+typedef struct BENCH_s BENCH_t;
+
+struct BENCH_s {
+	const char *name;
+	void (*fn)(BENCH_t *b, uint64_t n);
+	BENCH_t *next;
+
+	/* filled in by the runner */
+	int running;
+	int64_t start_ns;
+	int64_t elapsed_ns;
+	uint64_t start_allocs;
+	uint64_t start_bytes;
+	uint64_t allocs;
+	uint64_t bytes;
+	int metrics;
+	const char *metric_name[BENCH_MAX_METRICS];
+	double metric_value[BENCH_MAX_METRICS];
+};
+
+void bench_register(BENCH_t *b);
+void bench_start(BENCH_t *b);
+void bench_stop(BENCH_t *b);
+void bench_metric(BENCH_t *b, const char *name, double value);
+int64_t bench_now_ns(void);
+
+extern volatile uint64_t bench_sink;
+#define bench_keep(x) (bench_sink += (uint64_t)(x))
+
+#define BENCH(id)                                                           \
+	static void bench_##id(BENCH_t *b, uint64_t n);                         \
+	static BENCH_t bench_entry_##id = { #id, bench_##id };                  \
+	__attribute__((constructor)) static void bench_register_##id(void)      \
+	{                                                                       \
+		bench_register(&bench_entry_##id);                                  \
+	}                                                                       \
+	static void bench_##id(BENCH_t *b, uint64_t n)
+
+#endif /* HOST_BENCH_H_ */
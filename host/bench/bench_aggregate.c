@@ -0,0 +1,399 @@
+/*
+	 tools/ingest.c and tools/archive.c: the aggregator of the UDP streams
+	 of many boards. That it puts blocks back in order, gives up gaps and
+	 reads back what was sent is checked by host/test/test_aggregate.c.
+
+	 The boards of sim/boardsim.c: 48 boards at the highest rate of the
+	 firmware, 4 channels at 20 kS/s, a block of 64 samples per datagram,
+	 1250 datagrams/s per board; one datagram in 97 of every board comes
+	 after the one behind it.
+
+	   aggregate_ingest   the datagrams handed to ingest_datagram() directly
+	   aggregate_udp      the boards send from their own address (127.0.1.x)
+	                      to one socket on loopback, read with
+	                      ingest_receive() the way the aggregator does; the
+	                      sender waits for the receiver to stay within
+	                      WINDOW datagrams, nothing is lost
+	   aggregate_mqtt     every board an MQTT client of its own publishing
+	                      on ioto/<its address>/stream to a broker on
+	                      loopback (sim/brokersim.c), the aggregator a
+	                      client subscribed to all of them that hands every
+	                      message to ingest_mqtt() in its event handler;
+	                      TCP holds the boards up, nothing is lost
+	   archive_query_100ms  100 ms of one series out of 10 s of all of them
+
+	 Reported: cpu_ns the CPU time of the receiving thread per datagram (the
+	 sender may share its core), boards the boards that one core keeps up
+	 with at that cost, bytes/sample of the archive with its index;
+	 aggregate_mqtt adds all_cpu_ns and all_boards, the CPU time of the
+	 whole process per datagram, the boards and the broker included. A run
+	 that lost or gave up blocks aborts, its numbers would not be the ones
+	 of the streams.
+*/
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "mqtt_client.h"
+
+#include "archive.h"
+#include "boardsim.h"
+#include "brokersim.h"
+#include "ingest.h"
+#include "bench.h"
+
+#define BOARDS BOARDSIM_BOARDS
+#define CHANNELS BOARDSIM_CHANNELS
+#define BLOCK BOARDSIM_BLOCK
+#define PERIOD_US BOARDSIM_PERIOD_US
+#define SWAP BOARDSIM_SWAP
+#define FIRST_ADDR BOARDSIM_FIRST_ADDR
+#define WINDOW 256
+#define LATENCY_US 2000
+#define QUERY_SECONDS 10
+
+static char dir[] = "/tmp/ioto_bench_archive_XXXXXX";
+static char path[64];
+static ARCHIVE_t archive;
+static INGEST_t ingest;
+static int64_t base_us;		// archive time of board time 0
+
+static void fail(const char *what, long long got)
+{
+	fprintf(stderr, "aggregate: %s (%lld)\n", what, got);
+	abort();
+}
+
+static void prepare(void)
+{
+	static bool done;
+	if (done) return;
+	done = true;
+	if (boardsim_init() != 0) fail("encode", 0);
+	if (mkdtemp(dir) == NULL) fail("mkdtemp", 0);
+	snprintf(path, sizeof(path), "%s/archive", dir);
+}
+
+static void open_archive(void)
+{
+	char index[80];
+	snprintf(index, sizeof(index), "%s.idx", path);
+	unlink(path);
+	unlink(index);
+	if (archive_open(&archive, path, true) != 0) fail("open", 0);
+	ingest_init(&ingest, &archive);
+}
+
+static void close_archive(void)
+{
+	ingest_free(&ingest);
+	if (archive_close(&archive) != 0) fail("close", 0);
+}
+
+/*
+	 Benchmarks
+*/
+
+static void report(BENCH_t *b, uint64_t n, int64_t cpu_ns)
+{
+	if (ingest.stats.gaps || ingest.stats.late || ingest.stats.errors || ingest.stats.blocks != n) {
+		fprintf(stderr, "aggregate: %llu blocks of %llu, %llu gaps, %llu late, %llu errors\n",
+			(unsigned long long)ingest.stats.blocks, (unsigned long long)n, (unsigned long long)ingest.stats.gaps,
+			(unsigned long long)ingest.stats.late, (unsigned long long)ingest.stats.errors);
+		abort();
+	}
+	double per = (double)cpu_ns / n;
+	bench_metric(b, "cpu_ns", per);
+	bench_metric(b, "boards", 1e9 / per / BOARDSIM_DATAGRAMS_PER_S);
+	bench_metric(b, "bytes/sample", archive.samples ? (double)archive.bytes / archive.samples : 0);
+}
+
+static int64_t thread_cpu_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// the datagrams of n steps of all the boards together, a whole number of swapped pairs each
+static uint64_t steps_per_board(uint64_t n)
+{
+	uint64_t steps = (n + BOARDS - 1) / BOARDS;
+	return steps % SWAP == 1 ? steps + 1 : steps;
+}
+
+BENCH(aggregate_ingest) {
+	bench_stop(b);
+	prepare();
+	base_us = 1760781600000000LL;
+	open_archive();
+	uint64_t steps = steps_per_board(n);
+	bench_start(b);
+	int64_t cpu_ns = thread_cpu_ns();
+	for (uint64_t k = 0; k < steps; k++) {
+		uint64_t step = boardsim_swapped(k);
+		for (int board = 0; board < BOARDS; board++) {
+			size_t len;
+			const uint8_t *d = boardsim_datagram(board, step, &len);
+			ingest_datagram(&ingest, FIRST_ADDR + board, d, len, base_us + (step / CHANNELS + 1) * BLOCK * PERIOD_US + LATENCY_US);
+		}
+		if (k % 1024 == 0) ingest_tick(&ingest, base_us + (step / CHANNELS + 1) * BLOCK * PERIOD_US + LATENCY_US);
+	}
+	ingest_flush(&ingest);
+	archive_sync(&archive, false);
+	cpu_ns = thread_cpu_ns() - cpu_ns;
+	bench_stop(b);
+	report(b, steps * BOARDS, cpu_ns);
+	close_archive();
+	bench_start(b);
+}
+
+typedef struct {
+	uint16_t port;
+	uint64_t steps;
+	atomic_uint_fast64_t received;
+} SENDER_t;
+
+static void *sender(void *arg)
+{
+	SENDER_t *s = arg;
+	int fds[BOARDS];
+	for (int board = 0; board < BOARDS; board++) {
+		fds[board] = socket(AF_INET, SOCK_DGRAM, 0);
+		struct sockaddr_in sin = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(FIRST_ADDR + board) };
+		if (fds[board] < 0 || bind(fds[board], (struct sockaddr *)&sin, sizeof(sin)) < 0) fail("board socket", board);
+	}
+	struct sockaddr_in to = { .sin_family = AF_INET, .sin_port = htons(s->port), .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+	uint64_t sent = 0;
+	for (uint64_t k = 0; k < s->steps; k++) {
+		uint64_t step = boardsim_swapped(k);
+		for (int board = 0; board < BOARDS; board++) {
+			while (sent - atomic_load(&s->received) >= WINDOW) sched_yield();
+			size_t len;
+			const uint8_t *d = boardsim_datagram(board, step, &len);
+			if (sendto(fds[board], d, len, 0, (struct sockaddr *)&to, sizeof(to)) != (ssize_t)len) fail("send", sent);
+			sent++;
+		}
+	}
+	for (int board = 0; board < BOARDS; board++) close(fds[board]);
+	return NULL;
+}
+
+BENCH(aggregate_udp) {
+	bench_stop(b);
+	prepare();
+	open_archive();
+	int fd = socket(AF_INET, SOCK_DGRAM, 0);
+	struct sockaddr_in sin = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+	socklen_t sin_len = sizeof(sin);
+	int size = 4 << 20;
+	setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+	if (fd < 0 || bind(fd, (struct sockaddr *)&sin, sizeof(sin)) < 0 || getsockname(fd, (struct sockaddr *)&sin, &sin_len) < 0) {
+		fail("socket", 0);
+	}
+	static SENDER_t s;
+	s.port = ntohs(sin.sin_port);
+	s.steps = steps_per_board(n);
+	atomic_store(&s.received, 0);
+	uint64_t total = s.steps * BOARDS;
+	pthread_t thread;
+	bench_start(b);
+	int64_t cpu_ns = thread_cpu_ns();
+	pthread_create(&thread, NULL, sender, &s);
+	struct timespec ts;
+	int64_t next_tick = 0;
+	while (ingest.stats.datagrams < total) {
+		clock_gettime(CLOCK_REALTIME, &ts);
+		int64_t now_us = (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+		int got = ingest_receive(&ingest, fd, now_us);
+		if (got < 0) fail("receive", got);
+		if (got > 0) {
+			atomic_store(&s.received, ingest.stats.datagrams);
+		} else {
+			sched_yield();
+		}
+		if (now_us >= next_tick) {
+			ingest_tick(&ingest, now_us);
+			next_tick = now_us + 100000;
+		}
+	}
+	ingest_flush(&ingest);
+	archive_sync(&archive, false);
+	cpu_ns = thread_cpu_ns() - cpu_ns;
+	pthread_join(thread, NULL);
+	bench_stop(b);
+	close(fd);
+	uint64_t lost = 0;
+	for (int i = 0; i < ingest.boards; i++) lost += ingest.board[i].lost;
+	if (lost) fail("lost on loopback", lost);
+	report(b, total, cpu_ns);
+	close_archive();
+	bench_start(b);
+}
+
+static atomic_int mqtt_ready;
+static struct {
+	uint64_t total;
+	atomic_uint_fast64_t received;
+	int64_t next_tick_us;
+	int64_t cpu_first_ns;		// of the subscriber, at the first message and the last
+	int64_t cpu_last_ns;
+} mqtt_run;
+
+static int64_t wall_us(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static esp_err_t subscriber_event(esp_mqtt_event_handle_t event)
+{
+	if (event->event_id == MQTT_EVENT_CONNECTED) esp_mqtt_client_subscribe(event->client, INGEST_MQTT_TOPIC, 0);
+	if (event->event_id == MQTT_EVENT_SUBSCRIBED) atomic_fetch_add(&mqtt_ready, 1);
+	if (event->event_id != MQTT_EVENT_DATA) return ESP_OK;
+	if (atomic_load(&mqtt_run.received) == 0) mqtt_run.cpu_first_ns = thread_cpu_ns();
+	int64_t now_us = wall_us();
+	ingest_mqtt(&ingest, event->topic, event->topic_len, (const uint8_t *)event->data, event->data_len, now_us);
+	if (now_us >= mqtt_run.next_tick_us) {
+		ingest_tick(&ingest, now_us);
+		mqtt_run.next_tick_us = now_us + 100000;
+	}
+	if (atomic_fetch_add(&mqtt_run.received, 1) + 1 == mqtt_run.total) {
+		ingest_flush(&ingest);
+		archive_sync(&archive, false);
+		mqtt_run.cpu_last_ns = thread_cpu_ns();
+	}
+	return ESP_OK;
+}
+
+static esp_err_t board_event(esp_mqtt_event_handle_t event)
+{
+	if (event->event_id == MQTT_EVENT_CONNECTED) atomic_fetch_add(&mqtt_ready, 1);
+	return ESP_OK;
+}
+
+static void wait_ready(int clients)
+{
+	for (int ms = 0; atomic_load(&mqtt_ready) < clients; ms++) {
+		if (ms == 5000) fail("MQTT clients ready", atomic_load(&mqtt_ready));
+		usleep(1000);
+	}
+}
+
+BENCH(aggregate_mqtt) {
+	bench_stop(b);
+	prepare();
+	open_archive();
+	uint16_t port = 0;
+	if (brokersim_start(&port) != 0) fail("broker", 0);
+	char uri[40];
+	snprintf(uri, sizeof(uri), "mqtt://127.0.0.1:%u", port);
+	esp_mqtt_client_config_t config = { .event_handle = subscriber_event, .uri = uri, .buffer_size = 2048 };
+	esp_mqtt_client_handle_t sub = esp_mqtt_client_init(&config);
+	static esp_mqtt_client_handle_t boards[BOARDS];
+	static char topics[BOARDS][40];
+	config.event_handle = board_event;
+	atomic_store(&mqtt_ready, 0);
+	esp_mqtt_client_start(sub);
+	for (int board = 0; board < BOARDS; board++) {
+		boards[board] = esp_mqtt_client_init(&config);
+		esp_mqtt_client_start(boards[board]);
+		struct in_addr addr = { .s_addr = htonl(FIRST_ADDR + board) };
+		snprintf(topics[board], sizeof(topics[board]), INGEST_MQTT_PREFIX "%s" INGEST_MQTT_SUFFIX, inet_ntoa(addr));
+	}
+	wait_ready(1 + BOARDS);
+	uint64_t steps = steps_per_board(n);
+	mqtt_run.total = steps * BOARDS;
+	atomic_store(&mqtt_run.received, 0);
+	mqtt_run.next_tick_us = 0;
+	mqtt_run.cpu_last_ns = 0;
+	struct timespec ts;
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+	int64_t all_ns = (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+	bench_start(b);
+	for (uint64_t k = 0; k < steps; k++) {
+		uint64_t step = boardsim_swapped(k);
+		for (int board = 0; board < BOARDS; board++) {
+			size_t len;
+			const uint8_t *d = boardsim_datagram(board, step, &len);
+			if (esp_mqtt_client_publish(boards[board], topics[board], (const char *)d, len, 0, 0) < 0) fail("publish", k);
+		}
+	}
+	while (atomic_load(&mqtt_run.received) < mqtt_run.total || mqtt_run.cpu_last_ns == 0) sched_yield();
+	bench_stop(b);
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+	all_ns = (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec - all_ns;
+	for (int board = 0; board < BOARDS; board++) esp_mqtt_client_destroy(boards[board]);
+	esp_mqtt_client_destroy(sub);
+	brokersim_stop();
+	report(b, mqtt_run.total, mqtt_run.cpu_last_ns - mqtt_run.cpu_first_ns);
+	double per = (double)all_ns / mqtt_run.total;
+	bench_metric(b, "all_cpu_ns", per);
+	bench_metric(b, "all_boards", 1e9 / per / BOARDSIM_DATAGRAMS_PER_S);
+	close_archive();
+	bench_start(b);
+}
+
+static int64_t query_first_us;
+static uint64_t query_samples;
+
+static void count_block(const ARCHIVE_BLOCK_t *block, void *arg)
+{
+	query_samples += block->count;
+}
+
+BENCH(archive_query_100ms) {
+	bench_stop(b);
+	prepare();
+	static bool built;
+	if (!built) {
+		// QUERY_SECONDS of all the boards, archived as they come
+		built = true;
+		base_us = 1760781600000000LL;
+		open_archive();
+		uint64_t steps = (uint64_t)QUERY_SECONDS * BOARDSIM_DATAGRAMS_PER_S;
+		for (uint64_t step = 0; step < steps; step++) {
+			int64_t now_us = base_us + (step / CHANNELS + 1) * BLOCK * PERIOD_US + LATENCY_US;
+			for (int board = 0; board < BOARDS; board++) {
+				size_t len;
+				const uint8_t *d = boardsim_datagram(board, step, &len);
+				ingest_datagram(&ingest, FIRST_ADDR + board, d, len, now_us);
+			}
+			if (step % 1024 == 0) ingest_tick(&ingest, now_us);
+		}
+		ingest_flush(&ingest);
+		close_archive();
+		query_first_us = base_us + LATENCY_US;
+	}
+	if (archive_open(&archive, path, false) != 0) fail("open to read", 0);
+	query_samples = 0;
+	int64_t chunks = 0;
+	uint32_t r = 7;
+	bench_start(b);
+	for (uint64_t i = 0; i < n; i++) {
+		r = r * 1103515245u + 12345u;
+		int64_t from_us = query_first_us + (int64_t)((r >> 8) % ((QUERY_SECONDS - 1) * 10)) * 100000;
+		int64_t got = archive_query(&archive, FIRST_ADDR + (r >> 4) % BOARDS, (r >> 12) % CHANNELS, from_us,
+			from_us + 100000, count_block, NULL);
+		if (got < 0) fail("query", got);
+		chunks += got;
+	}
+	bench_stop(b);
+	if (query_samples != n * (100000 / PERIOD_US)) fail("query samples", query_samples);
+	bench_metric(b, "chunks/query", (double)chunks / n);
+	bench_metric(b, "entries", archive.entries);
+	bench_metric(b, "MB", (archive.data_size + archive.entries * ARCHIVE_ENTRY_SIZE) / 1e6);
+	archive_close(&archive);
+	bench_start(b);
+}
@@ -0,0 +1,119 @@
+/*
+	 main/json_arena.c: what the arena saves a JSON request. The arena
+	 itself is checked by host/test/test_arena.c.
+
+	 A request is what forward_request() in main/app.c does with a
+	 connect-request: cJSON_Parse(), a look at its id, cJSON_Delete().
+	 On the heap that is a malloc and a free per node and string, on the
+	 arena a bump each and one reset. The soak cases keep long lived
+	 blocks of other sizes coming and going in between, like the other
+	 tasks do, and report the heap and how much of it is left free in
+	 holes when they are done.
+*/
+
+#include <malloc.h>
+#include <stdbool.h>
+
+#include "cJSON.h"
+
+#include "json_arena.h"
+#include "bench.h"
+
+#define LIVE 256	// long lived blocks of the soak
+
+static const char connect_request[] =
+	"{\"id\":\"connect-request\",\"host\":[\"broker.local\"],\"port\":[\"1883\"],"
+	"\"clientId\":[\"ioto\"],\"username\":[\"\"],\"password\":[\"\"],"
+	"\"topic\":[\"ioto/sub\",\"ioto/pub\"],\"qos\":[\"0\",\"1\"],\"payload\":[\"hello\"]}";
+
+static void *live[LIVE];
+
+static void request(bool on_arena)
+{
+	if (on_arena) json_arena_begin();
+	cJSON *root = cJSON_Parse(connect_request);
+	bench_keep(cJSON_IsString(cJSON_GetObjectItem(root, "id")));
+	cJSON_Delete(root);
+	if (on_arena) json_arena_end();
+}
+
+// cJSON on the heap, or hooked to the arena
+static void hooks(bool on_arena)
+{
+	if (on_arena) {
+		json_arena_init();
+	} else {
+		cJSON_InitHooks(NULL);
+	}
+}
+
+static void report(BENCH_t *b, bool on_arena)
+{
+	if (!on_arena) return;
+	JSON_ARENA_STATS_t stats;
+	json_arena_get_stats(&stats);
+	bench_metric(b, "bytes", stats.high);
+	bench_metric(b, "heap_allocs", stats.heap_allocs);
+}
+
+// replaces one of the long lived blocks, 16 to 1024 bytes
+static void churn(uint32_t *rng)
+{
+	*rng = *rng * 1664525u + 1013904223u;
+	int slot = (*rng >> 8) % LIVE;
+	free(live[slot]);
+	live[slot] = malloc(16 + (*rng >> 16) % 1009);
+}
+
+static void run(BENCH_t *b, uint64_t n, bool on_arena)
+{
+	bench_stop(b);
+	hooks(on_arena);
+	bench_start(b);
+	for (uint64_t i = 0; i < n; i++) request(on_arena);
+	bench_stop(b);
+	report(b, on_arena);
+	cJSON_InitHooks(NULL);
+	bench_start(b);
+}
+
+static void soak(BENCH_t *b, uint64_t n, bool on_arena)
+{
+	uint32_t rng = 1;
+	bench_stop(b);
+	hooks(on_arena);
+	malloc_trim(0);
+	for (int i = 0; i < LIVE; i++) live[i] = malloc(16 + i * 4);
+	bench_start(b);
+	for (uint64_t i = 0; i < n; i++) {
+		churn(&rng);
+		request(on_arena);
+	}
+	bench_stop(b);
+	struct mallinfo2 mi = mallinfo2();
+	bench_metric(b, "heap_kB", mi.arena / 1024.0);
+	bench_metric(b, "free_pct", 100.0 * mi.fordblks / mi.arena);
+	report(b, on_arena);
+	for (int i = 0; i < LIVE; i++) {
+		free(live[i]);
+		live[i] = NULL;
+	}
+	cJSON_InitHooks(NULL);
+	bench_start(b);
+}
+
+BENCH(arena_heap_request) {
+	run(b, n, false);
+}
+
+BENCH(arena_request) {
+	run(b, n, true);
+}
+
+BENCH(arena_heap_request_soak) {
+	soak(b, n, false);
+}
+
+BENCH(arena_request_soak) {
+	soak(b, n, true);
+}
@@ -0,0 +1,68 @@
+/*
+	 main/clocksync.c without a network: a follower whose oscillator runs
+	 50 ppm fast exchanges with a master through a link with queueing
+	 jitter, one exchange per simulated second. ns/op is one exchange
+	 through the servo, or one conversion of a block time to the shared
+	 clock. What the servo converges to is checked by
+	 host/test/test_clocksync.c.
+*/
+
+#include "clocksync.h"
+#include "bench.h"
+
+#define DRIFT_PPM 50
+
+static uint32_t rng = 12345;
+
+static uint32_t next_random(void)
+{
+	rng ^= rng << 13;
+	rng ^= rng >> 17;
+	rng ^= rng << 5;
+	return rng;
+}
+
+// one way: 300 us on the wire, and now and then a queue of up to 5 ms
+static int64_t one_way_us(void)
+{
+	uint32_t r = next_random();
+	return 300 + (r % 4 == 0 ? (r >> 8) % 5000 : (r >> 8) % 20);
+}
+
+static int64_t follower_clock(int64_t true_us)
+{
+	return 5000000 + true_us + true_us * DRIFT_PPM / 1000000;
+}
+
+// an exchange at true time t, the master's clock is true time plus master_us
+static void exchange(CLOCKSYNC_SERVO_t *servo, int64_t t, int64_t master_us)
+{
+	int64_t t1 = follower_clock(t);
+	t += one_way_us();
+	int64_t t2 = t + master_us;
+	t += 40;
+	int64_t t3 = t + master_us;
+	t += one_way_us();
+	clocksync_servo_update(servo, t1, t2, t3, follower_clock(t));
+}
+
+BENCH(clocksync_update) {
+	CLOCKSYNC_SERVO_t servo;
+	clocksync_servo_init(&servo);
+	int64_t t = 1000000;
+	for (uint64_t i = 0; i < n; i++, t += 1000000) {
+		exchange(&servo, t, 0);
+	}
+	bench_metric(b, "filtered/exchange", (double)servo.filtered / n);
+}
+
+BENCH(clocksync_to_shared) {
+	CLOCKSYNC_SERVO_t servo;
+	bench_stop(b);
+	clocksync_servo_init(&servo);
+	for (int i = 0; i < 20; i++) exchange(&servo, i * 1000000LL, 0);
+	bench_start(b);
+	for (uint64_t i = 0; i < n; i++) {
+		bench_keep(clocksync_servo_to_shared(&servo, 25000000 + i * 64000));
+	}
+}
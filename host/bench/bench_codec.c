@@ -0,0 +1,167 @@
+/*
+	 Benchmarks for main/codec.c: compression ratio and encode cost per
+	 sample of every stream encoding on synthetic waveforms, and on a
+	 recording when IOTO_BENCH_RECORDING names a file with one millivolt
+	 value per line (the format of the simulator's file signal). The round
+	 trip is checked by host/test/test_codec.c.
+*/
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "codec.h"
+#include "bench.h"
+
+#define BITS 13			// ADC_WIDTH_BIT_13
+#define MAX_RAW 8191
+#define RATE_HZ 1000	// CONFIG_ACQ_SAMPLE_RATE_HZ
+#define BLOCK 64		// CONFIG_ACQ_BLOCK_SAMPLES
+#define WAVE_SAMPLES (BLOCK * 256)
+
+typedef enum {
+	WAVE_SINE_1HZ,
+	WAVE_SINE_50HZ,
+	WAVE_SQUARE_10HZ,
+	WAVE_NOISE,
+	WAVE_DC,
+	WAVE_RECORDING,
+	WAVE_MAX
+} WAVE_t;
+
+static uint16_t wave[WAVE_MAX][WAVE_SAMPLES];
+static int wave_len[WAVE_MAX];
+
+static double gauss(void)
+{
+	double sum = 0;
+	for (int i = 0; i < 4; i++) sum += (double)rand() / RAND_MAX - 0.5;
+	return sum * 1.732;
+}
+
+static uint16_t clamp(double v)
+{
+	if (v < 0) return 0;
+	if (v > MAX_RAW) return MAX_RAW;
+	return (uint16_t)lround(v);
+}
+
+static void make_waves(void)
+{
+	static int made;
+	if (made) return;
+	made = 1;
+	srand(1);
+	for (int i = 0; i < WAVE_SAMPLES; i++) {
+		double t = (double)i / RATE_HZ;
+		wave[WAVE_SINE_1HZ][i] = clamp(4096 + 3000 * sin(2 * M_PI * 1 * t) + 2 * gauss());
+		wave[WAVE_SINE_50HZ][i] = clamp(4096 + 3000 * sin(2 * M_PI * 50 * t) + 2 * gauss());
+		wave[WAVE_SQUARE_10HZ][i] = clamp((fmod(t * 10, 1) < 0.5 ? 1000 : 6000) + 2 * gauss());
+		wave[WAVE_NOISE][i] = clamp(4096 + 200 * gauss());
+		wave[WAVE_DC][i] = clamp(2000 + gauss());
+	}
+	for (int w = 0; w < WAVE_RECORDING; w++) wave_len[w] = WAVE_SAMPLES;
+
+	const char *path = getenv("IOTO_BENCH_RECORDING");
+	FILE *fp = path ? fopen(path, "r") : NULL;
+	if (fp) {
+		float mv;
+		while (wave_len[WAVE_RECORDING] < WAVE_SAMPLES && fscanf(fp, "%f", &mv) == 1) {
+			wave[WAVE_RECORDING][wave_len[WAVE_RECORDING]++] = clamp(mv * MAX_RAW / 2500);	// ADC_ATTEN_DB_11
+		}
+		fclose(fp);
+	}
+}
+
+static uint64_t cycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	return 0;
+#endif
+}
+
+// bytes per sample of the "AS" text message, the baseline
+static double text_bytes_per_sample(const uint16_t *s, int len)
+{
+	char buf[16];
+	size_t total = 0;
+	for (int i = 0; i < len; i++) total += snprintf(buf, sizeof(buf), "%u,", (unsigned)(s[i] * 2500 / MAX_RAW));
+	return (double)total / len;
+}
+
+static void run(BENCH_t *b, uint64_t n, CODEC_t codec, WAVE_t w)
+{
+	bench_stop(b);
+	make_waves();
+	int len = wave_len[w] - wave_len[w] % BLOCK;
+	static uint8_t out[4096];
+	uint64_t bytes = 0, samples = 0;
+	uint64_t c0 = cycles();
+	bench_start(b);
+
+	int pos = 0;
+	for (uint64_t i = 0; i < n; i++) {
+		int size = codec_encode(codec, &wave[w][pos], BLOCK, BITS, out, sizeof(out));
+		bytes += size;
+		samples += BLOCK;
+		pos += BLOCK;
+		if (pos >= len) pos = 0;
+	}
+
+	bench_stop(b);
+	uint64_t c1 = cycles();
+	bench_metric(b, "bytes/sample", (double)bytes / samples);
+	bench_metric(b, "ratio_u16", 2.0 * samples / bytes);
+	bench_metric(b, "ratio_text", text_bytes_per_sample(wave[w], len) * samples / bytes);
+	if (c1 > c0) bench_metric(b, "cycles/sample", (double)(c1 - c0) / samples);
+	bench_start(b);
+}
+
+#define CODEC_BENCH(codec, wave_name, w)                \
+	BENCH(codec_##codec##_##wave_name) {               \
+		run(b, n, CODEC_##codec, w);                   \
+	}
+
+CODEC_BENCH(PACKED, sine_1hz, WAVE_SINE_1HZ)
+CODEC_BENCH(DELTA, sine_1hz, WAVE_SINE_1HZ)
+CODEC_BENCH(RICE, sine_1hz, WAVE_SINE_1HZ)
+CODEC_BENCH(PACKED, sine_50hz, WAVE_SINE_50HZ)
+CODEC_BENCH(DELTA, sine_50hz, WAVE_SINE_50HZ)
+CODEC_BENCH(RICE, sine_50hz, WAVE_SINE_50HZ)
+CODEC_BENCH(PACKED, square_10hz, WAVE_SQUARE_10HZ)
+CODEC_BENCH(DELTA, square_10hz, WAVE_SQUARE_10HZ)
+CODEC_BENCH(RICE, square_10hz, WAVE_SQUARE_10HZ)
+CODEC_BENCH(PACKED, noise, WAVE_NOISE)
+CODEC_BENCH(DELTA, noise, WAVE_NOISE)
+CODEC_BENCH(RICE, noise, WAVE_NOISE)
+CODEC_BENCH(PACKED, dc, WAVE_DC)
+CODEC_BENCH(DELTA, dc, WAVE_DC)
+CODEC_BENCH(RICE, dc, WAVE_DC)
+
+// the recording benches only exist when there is a recording to run them on
+#define RECORDING_BENCH(codec)                                      \
+	static void bench_codec_##codec##_recording(BENCH_t *b, uint64_t n) \
+	{                                                               \
+		run(b, n, CODEC_##codec, WAVE_RECORDING);                   \
+	}                                                               \
+	static BENCH_t bench_entry_codec_##codec##_recording = {        \
+		"codec_" #codec "_recording", bench_codec_##codec##_recording \
+	};
+
+RECORDING_BENCH(PACKED)
+RECORDING_BENCH(DELTA)
+RECORDING_BENCH(RICE)
+
+__attribute__((constructor)) static void bench_register_recording(void)
+{
+	make_waves();
+	if (wave_len[WAVE_RECORDING] < BLOCK) return;
+	bench_register(&bench_entry_codec_PACKED_recording);
+	bench_register(&bench_entry_codec_DELTA_recording);
+	bench_register(&bench_entry_codec_RICE_recording);
+}
@@ -0,0 +1,97 @@
+/*
+	 main/decoder.c on generated bit streams (sim/busgen.c): ns/op is per
+	 edge fed. That the decoder finds the frames that went in is checked
+	 by host/test/test_decoder.c.
+
+	 bytes_per_frame compares what the browser gets for a frame, the
+	 decoder_format() token and its time offset, with the 16 bytes of
+	 every raw edge it took.
+*/
+
+#include <stdio.h>
+
+#include "busgen.h"
+#include "decoder.h"
+#include "bench.h"
+
+#define FRAMES 1000
+
+#define UART_RX 42
+#define I2C_SCL 41
+#define I2C_SDA 40
+#define SPI_SCK 39
+#define SPI_MOSI 38
+#define SPI_MISO 37
+#define SPI_CS 36
+
+static BUSGEN_t g;
+
+static void measure(BENCH_t *b, const DECODER_CONFIG_t *config)
+{
+	static DECODER_t d;
+	DECODER_EVENT_t out[DECODER_MAX_EVENTS];
+	ESP_ERROR_CHECK(decoder_init(&d, config));
+	size_t text = 0;
+	char token[32];
+	int64_t last_ns = 0;
+	for (int i = 0; i <= g.nedges; i++) {
+		int n = i < g.nedges ? decoder_feed(&d, g.edges[i].t_ns, g.edges[i].levels, out)
+			: decoder_flush(&d, g.edges[g.nedges - 1].t_ns + 1000000000LL, out);
+		for (int k = 0; k < n; k++) {
+			// as the browser gets it: "dt_us:token,"
+			text += snprintf(token, sizeof(token), "%lld:", (long long)((out[k].t_ns - last_ns) / 1000));
+			text += decoder_format(&d, &out[k], token, sizeof(token)) + 1;
+			last_ns = out[k].t_ns;
+		}
+	}
+	bench_metric(b, "edges/frame", (double)g.nedges / g.frames);
+	bench_metric(b, "bytes_per_frame", (double)text / g.frames);
+	bench_metric(b, "raw_bytes_per_frame", (double)g.nedges * sizeof(BUSGEN_EDGE_t) / g.frames);
+}
+
+static void run(BENCH_t *b, uint64_t n, const DECODER_CONFIG_t *config)
+{
+	static DECODER_t d;
+	DECODER_EVENT_t out[DECODER_MAX_EVENTS];
+	bench_stop(b);
+	measure(b, config);
+	bench_start(b);
+	uint64_t events = 0;
+	for (uint64_t i = 0; i < n; i++) {
+		int k = i % g.nedges;
+		if (k == 0) decoder_init(&d, config);
+		events += decoder_feed(&d, g.edges[k].t_ns, g.edges[k].levels, out);
+	}
+	bench_keep(events);
+}
+
+BENCH(decoder_uart_115200_8n1) {
+	DECODER_CONFIG_t c = { .bus = DECODER_UART, .uart = { .rx = UART_RX, .baud = 115200, .bits = 8, .stop = 1 } };
+	busgen_uart(&g, &c, FRAMES, 0);
+	run(b, n, &c);
+}
+
+BENCH(decoder_uart_9600_7e2_errors) {
+	DECODER_CONFIG_t c = { .bus = DECODER_UART, .uart = { .rx = UART_RX, .baud = 9600, .bits = 7, .parity = DECODER_PARITY_EVEN, .stop = 2 } };
+	busgen_uart(&g, &c, FRAMES, 17);
+	run(b, n, &c);
+}
+
+BENCH(decoder_i2c_400k) {
+	DECODER_CONFIG_t c = { .bus = DECODER_I2C, .i2c = { .scl = I2C_SCL, .sda = I2C_SDA } };
+	busgen_i2c(&g, &c, FRAMES);
+	run(b, n, &c);
+}
+
+#define SPI_BENCH(id, mode_, bits_, lsb)                                                          \
+	BENCH(decoder_spi_##id) {                                                                     \
+		DECODER_CONFIG_t c = { .bus = DECODER_SPI, .spi = { .sck = SPI_SCK, .mosi = SPI_MOSI,     \
+			.miso = SPI_MISO, .cs = SPI_CS, .mode = mode_, .bits = bits_, .lsb_first = lsb } };  \
+		busgen_spi(&g, &c, FRAMES);                                                               \
+		run(b, n, &c);                                                                            \
+	}
+
+SPI_BENCH(mode0, 0, 8, 0)
+SPI_BENCH(mode1, 1, 8, 0)
+SPI_BENCH(mode2, 2, 8, 0)
+SPI_BENCH(mode3_12bit_lsb, 3, 12, 1)
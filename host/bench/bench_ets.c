@@ -0,0 +1,147 @@
+/*
+	 main/ets.c against synthetic periodic signals with a known waveform.
+
+	 The ADC samples at 1 kHz with 5 mV of noise and 13 bits, the signals
+	 are far faster. Before timing, every case runs a fixed acquisition of
+	 a few seconds; the effective rate, coverage and error of the
+	 reconstruction are reported as metrics, host/test/test_ets.c holds
+	 them to their bounds. The timed part is the cost of one block of 64
+	 readings.
+
+	 ets_gpio_*   triggers are the true rising edges stamped with a 1 us
+	              timer and up to 2 us of interrupt latency, like
+	              hal_gpio_capture_read(); 1 us bins, 1 MS/s equivalent
+	 ets_inband_* triggers are interpolated from the readings, for a signal
+	              slow around its crossing; 20 us bins
+*/
+
+#include <math.h>
+#include <stddef.h>
+
+#include "ets.h"
+#include "bench.h"
+
+#define PERIOD_NS 1000000		// 1 kHz ADC
+#define BLOCK 64
+#define CHECK_BLOCKS 4000		// 4 s of acquisition
+#define MV_PER_LSB (2500.0 / 8191)
+#define TICK_NS 10000000
+
+typedef struct {
+	double freq_hz;
+	int square;					// sine otherwise
+	double amplitude_mv;
+	double offset_mv;
+} WAVE_t;
+
+static uint32_t rng = 0x2545f491;
+
+static double uniform(void)
+{
+	rng ^= rng << 13;
+	rng ^= rng >> 17;
+	rng ^= rng << 5;
+	return (double)rng / UINT32_MAX;
+}
+
+static double wave_mv(const WAVE_t *w, double t_ns)
+{
+	double cycles = t_ns * w->freq_hz / 1e9;
+	double phase = cycles - floor(cycles);
+	if (w->square) return w->offset_mv + (phase < 0.5 ? w->amplitude_mv : -w->amplitude_mv);
+	return w->offset_mv + w->amplitude_mv * sin(2 * M_PI * phase);
+}
+
+static uint16_t adc(const WAVE_t *w, double t_ns)
+{
+	double noise = 0;
+	for (int i = 0; i < 4; i++) noise += uniform() - 0.5;
+	double raw = (wave_mv(w, t_ns) + noise * 5 * 1.732) / MV_PER_LSB;
+	return raw < 0 ? 0 : raw > 8191 ? 8191 : (uint16_t)(raw + 0.5);
+}
+
+// one block of readings, and for gpio the edges that happened during it
+static void feed(ETS_t *ets, const WAVE_t *w, int64_t block, int gpio)
+{
+	int64_t t0 = block * BLOCK * PERIOD_NS;
+	if (gpio) {
+		double period_ns = 1e9 / w->freq_hz;
+		int64_t k = (int64_t)ceil(t0 / period_ns);
+		for (double edge = k * period_ns; edge < t0 + BLOCK * PERIOD_NS; edge += period_ns) {
+			int64_t stamp_us = (int64_t)((edge + uniform() * 2000) / 1000);
+			ets_add_trigger(ets, stamp_us * 1000);
+		}
+	}
+	if (!gpio) {
+		uint16_t raw[BLOCK];
+		for (int i = 0; i < BLOCK; i++) raw[i] = adc(w, t0 + (double)i * PERIOD_NS);
+		ets_add_samples(ets, raw, BLOCK, t0, PERIOD_NS);
+		return;
+	}
+	// like acquire_task: the readings due are taken in a burst on the next 10 ms tick,
+	// one conversion after the other, and stamped with the time they were taken
+	for (int i = 0; i < BLOCK; i++) {
+		int64_t due = t0 + (int64_t)i * PERIOD_NS;
+		int64_t tick = (due + TICK_NS - 1) / TICK_NS * TICK_NS;
+		double t = tick + (due - tick + TICK_NS) % TICK_NS / PERIOD_NS * (40000 + uniform() * 1000);
+		ets_add_sample(ets, adc(w, t), (int64_t)t);
+	}
+}
+
+static void run(BENCH_t *b, uint64_t n, const WAVE_t *w, int gpio, uint32_t bin_ns, uint16_t bins)
+{
+	static ETS_t ets;
+	ETS_CONFIG_t config = {
+		.start_ns = -(int32_t)(bins / 8 * bin_ns),
+		.bin_ns = bin_ns,
+		.bins = bins,
+		.edge = gpio ? ETS_TRIGGER_EXTERNAL : ETS_TRIGGER_RISING,
+		.level = w->offset_mv / MV_PER_LSB,
+		.hysteresis = 20,
+	};
+	bench_stop(b);
+	ESP_ERROR_CHECK(ets_init(&ets, &config));
+	for (int64_t k = 0; k < CHECK_BLOCKS; k++) feed(&ets, w, k, gpio);
+
+	// against the true waveform at the middle of every bin: both waves rise through the offset
+	// at phase 0, and the gpio stamps are late by 0.5 us on average (+1 us latency, -0.5 us floor)
+	static uint16_t mean[ETS_MAX_BINS];
+	ets_read(&ets, mean, NULL);
+	double delay_ns = gpio ? 500 : 0;
+	double err2 = 0;
+	for (int i = 0; i < bins; i++) {
+		double err = mean[i] * MV_PER_LSB - wave_mv(w, config.start_ns + (i + 0.5) * bin_ns + delay_ns);
+		err2 += err * err;
+	}
+	double rms = sqrt(err2 / bins);
+	ETS_STATS_t stats;
+	ets_get_stats(&ets, &stats);
+	bench_metric(b, "coverage", stats.coverage_permille / 1000.0);
+	bench_metric(b, "effective_rate", stats.effective_rate_hz);
+	bench_metric(b, "x_realtime", stats.effective_rate_hz / (1e9 / PERIOD_NS));
+	bench_metric(b, "rms_err_mv", rms);
+	bench_metric(b, "min_count", stats.min_count);
+	bench_metric(b, "max_sem_mv", stats.max_sem * MV_PER_LSB);
+
+	ets_reset(&ets);
+	bench_start(b);
+	for (uint64_t k = 0; k < n; k++) feed(&ets, w, CHECK_BLOCKS + k, gpio);
+	bench_keep(ets.samples);
+}
+
+// 7.3 kHz, 137 us per period, the ADC sees one reading every 7.3 periods
+BENCH(ets_gpio_sine_7k3) {
+	WAVE_t w = { .freq_hz = 7301.7, .amplitude_mv = 1000, .offset_mv = 1250 };
+	run(b, n, &w, 1, 1000, 128);
+}
+
+BENCH(ets_gpio_square_2k) {
+	WAVE_t w = { .freq_hz = 2000.3, .square = 1, .amplitude_mv = 1000, .offset_mv = 1250 };
+	run(b, n, &w, 1, 1000, 400);
+}
+
+// 90.3 Hz, in-band: slow enough at the crossing to interpolate the trigger
+BENCH(ets_inband_sine_90) {
+	WAVE_t w = { .freq_hz = 90.3, .amplitude_mv = 1000, .offset_mv = 1250 };
+	run(b, n, &w, 0, 20000, 500);
+}
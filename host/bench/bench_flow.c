@@ -0,0 +1,60 @@
+/*
+	 main/flow.c: the rate control of the streams, against a link that
+	 slows down (sim/flowsim.c).
+
+	 Reported: the latency of the frames from their last sample to the
+	 browser while the link is slow (20 to 40 s, once settled), the blocks
+	 lost, the factor at the end and how long after the link came back it
+	 was 1 again; the _off case is the same without the control. ns/op is
+	 the 70 s of the simulation. The decisions of the control, and that it
+	 keeps the target here, are checked by host/test/test_flow.c.
+*/
+
+#include "flow.h"
+#include "flowsim.h"
+#include "bench.h"
+
+#define NUM 3				// the websocket client
+#define TARGET_US 500000
+#define FRAME_BYTES 360
+
+static void apply(int num, int factor, uint32_t latency_us)
+{
+}
+
+static void report(BENCH_t *b, const FLOWSIM_RESULT_t *r)
+{
+	bench_metric(b, "p50_ms", r->lat_p50_ms);
+	bench_metric(b, "p99_ms", r->lat_p99_ms);
+	bench_metric(b, "max_ms", r->lat_max_ms);
+	bench_metric(b, "lost", r->lost_blocks);
+	bench_metric(b, "kB/s", r->kbytes_per_s);
+	bench_metric(b, "factor", r->factor);
+	bench_metric(b, "recover_s", r->recover_s);
+}
+
+BENCH(flow_link_drop) {
+	FLOWSIM_RESULT_t r;
+	for (uint64_t i = 0; i < n; i++) flowsim_run(TARGET_US, &r);
+	report(b, &r);
+}
+
+BENCH(flow_link_drop_off) {
+	FLOWSIM_RESULT_t r;
+	for (uint64_t i = 0; i < n; i++) flowsim_run(0, &r);
+	report(b, &r);
+}
+
+// the bookkeeping of a frame: its send and its acknowledgement
+BENCH(flow_sent_ack) {
+	FLOW_IO_t io = { .target_us = TARGET_US, .interval_us = FLOWSIM_INTERVAL_US, .apply = apply };
+	ESP_ERROR_CHECK(flow_init(&io));
+	flow_open(NUM);
+	int64_t t = 0;
+	for (uint64_t i = 0; i < n; i++) {
+		flow_sent(NUM, t += 1000, 0, FRAME_BYTES);
+		flow_ack(NUM, i + 1, t + 500);
+		flow_update(t);
+	}
+	flow_close(NUM);
+}
@@ -0,0 +1,191 @@
+/*
+	 main/history.c: the ring of recent points and levels, and the burst a
+	 new client gets. That the snapshot holds the readings fed in is
+	 checked by host/test/test_history.c.
+
+	 history_add() per block, and the burst of windows of 1, 5 and 10 s
+	 (the ring holds CONFIG_HISTORY_SECONDS): the snapshot, the encode and
+	 the send to a websocket client on loopback, until it has the whole
+	 message.
+*/
+
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "lwip/api.h"
+
+#include "history.h"
+#include "websocket_server.h"
+#include "wsclient.h"
+#include "bench.h"
+
+#define CHANNEL 6
+#define PERIOD_US 1000		// 1 kHz, CONFIG_ACQ_SAMPLE_RATE_HZ
+#define PER_POINT (CONFIG_HISTORY_POINT_MS * 1000 / PERIOD_US)
+// a gap longer than the ring
+#define RESTART_BLOCKS (HISTORY_POINTS * PER_POINT / ACQ_BLOCK_SAMPLES + 2)
+
+static uint64_t pins = 0x30;
+static uint64_t levels;
+static uint32_t seq;
+static SAMPLE_BLOCK_t block;
+static uint8_t msg[HISTORY_MAX_MESSAGE];
+
+static void fail(const char *what, long long got)
+{
+	fprintf(stderr, "history: %s (%lld)\n", what, got);
+	abort();
+}
+
+static uint64_t get_levels(uint64_t *out)
+{
+	*out = pins;
+	return levels;
+}
+
+// a slow triangle and a bit of noise, reading i of the whole run
+static uint16_t reading(uint32_t i)
+{
+	uint32_t phase = i % 4000;
+	uint32_t tri = phase < 2000 ? phase : 4000 - phase;
+	return 1000 + tri + (i * 2654435761u >> 26);
+}
+
+static void feed(void)
+{
+	block.seq = seq;
+	block.channels = 1 << CHANNEL;
+	block.count = ACQ_BLOCK_SAMPLES;
+	block.period_us = PERIOD_US;
+	block.t0_us = 1000000 + (int64_t)seq * ACQ_BLOCK_SAMPLES * PERIOD_US;
+	for (int i = 0; i < ACQ_BLOCK_SAMPLES; i++) block.raw[i] = reading(seq * ACQ_BLOCK_SAMPLES + i);
+	history_add(&block);
+	seq++;
+}
+
+static void init(void)
+{
+	static bool done;
+	if (done) return;
+	done = true;
+	HISTORY_IO_t io = {
+		.channel = CHANNEL,
+		.bits = 13,
+		.mv_per_lsb = 0.25f,
+		.offset_mv = 0,
+		.levels = get_levels,
+	};
+	if (history_init(&io) != ESP_OK) fail("init", 0);
+}
+
+// starts the history over with blocks whole points of the signal
+static void refill(int blocks)
+{
+	seq += RESTART_BLOCKS;
+	for (int i = 0; i < blocks; i++) feed();
+}
+
+/*
+	 A websocket client on loopback, for the burst
+*/
+
+static uint16_t port;
+static volatile int connected = -1;
+
+static void callback(uint8_t num, WEBSOCKET_TYPE_t type, char *data, uint64_t len)
+{
+	if (type == WEBSOCKET_CONNECT) connected = num;
+}
+
+static void accept_task(void *arg)
+{
+	struct netconn *listener = arg;
+	for (;;) {
+		struct netconn *conn;
+		struct netbuf *inbuf;
+		char *buf;
+		uint16_t buflen;
+		if (netconn_accept(listener, &conn) != ERR_OK) continue;
+		netconn_set_recvtimeout(conn, 1000);
+		if (netconn_recv(conn, &inbuf) != ERR_OK) {
+			netconn_delete(conn);
+			continue;
+		}
+		netbuf_data(inbuf, (void **)&buf, &buflen);
+		ws_server_add_client(conn, buf, buflen, "/", callback);
+		netbuf_delete(inbuf);
+	}
+}
+
+static void connect_client(WS_CLIENT_t *c)
+{
+	if (port == 0) {
+		esp_log_level = ESP_LOG_WARN;
+		ip_addr_t loopback;
+		ipaddr_aton("127.0.0.1", &loopback);
+		struct netconn *listener = netconn_new(NETCONN_TCP);
+		if (listener == NULL || netconn_bind(listener, &loopback, 0) != ERR_OK || netconn_listen(listener) != ERR_OK
+			|| netconn_addr(listener, NULL, &port) != ERR_OK) fail("listener", 0);
+		ws_server_start();	// or already running for bench_websocket.c
+		xTaskCreate(accept_task, "history_accept", 4096, listener, 5, NULL);
+	}
+	connected = -1;
+	if (ws_client_connect(c, "127.0.0.1", port, "/") != 0) fail("connect", 0);
+	int64_t deadline = bench_now_ns() + 1000000000LL;
+	while (connected < 0) {
+		if (bench_now_ns() > deadline) fail("no CONNECT", 0);
+		sched_yield();
+	}
+}
+
+static void burst(BENCH_t *b, uint64_t n, int seconds)
+{
+	init();
+	bench_stop(b);
+	refill((seconds * 1000000 / PERIOD_US + ACQ_BLOCK_SAMPLES - 1) / ACQ_BLOCK_SAMPLES);
+	WS_CLIENT_t c;
+	connect_client(&c);
+	int num = connected;
+	bench_start(b);
+	int len = 0;
+	for (uint64_t i = 0; i < n; i++) {
+		len = history_snapshot(msg, sizeof(msg), CODEC_RICE);
+		if (len <= 0 || ws_server_send_bin_client(num, (char *)msg, len) != 1) fail("send", len);
+		WS_FRAME_t frame;
+		int64_t deadline = bench_now_ns() + 1000000000LL;
+		while (ws_client_next_frame(&c, &frame) != 1) {
+			if (ws_client_fill(&c) < 0 || bench_now_ns() > deadline) fail("receive", i);
+		}
+		if (frame.opcode != WS_OP_BIN || frame.len != (size_t)len) fail("frame", frame.len);
+	}
+	bench_stop(b);
+	HISTORY_STATS_t stats;
+	history_get_stats(&stats);
+	bench_metric(b, "points", stats.points);
+	bench_metric(b, "bytes", len);
+	ws_server_remove_client(num);
+	ws_client_close(&c);
+	bench_start(b);
+}
+
+BENCH(history_add) {
+	init();
+	refill(0);
+	for (uint64_t i = 0; i < n; i++) feed();
+}
+
+BENCH(history_burst_1s) {
+	burst(b, n, 1);
+}
+
+BENCH(history_burst_5s) {
+	burst(b, n, 5);
+}
+
+BENCH(history_burst_10s) {
+	burst(b, n, CONFIG_HISTORY_SECONDS);
+}
@@ -0,0 +1,45 @@
+/*
+	 Benchmarks for main/mqtt_json.c
+	 Only built when cJSON was found, see host/CMakeLists.txt.
+*/
+
+#include <string.h>
+
+#include "cJSON.h"
+#include "mqtt.h"
+#include "bench.h"
+
+static const char connect_request[] =
+	"{\"id\":\"connect-request\",\"host\":[\"broker.local\"],\"port\":[\"1883\"],"
+	"\"clientId\":[\"ioto\"],\"username\":[\"\"],\"password\":[\"\"],"
+	"\"topic\":[\"ioto/sub\",\"ioto/pub\"],\"qos\":[\"0\",\"1\"],\"payload\":[\"hello\"]}";
+
+BENCH(cjson_parse_request) {
+	for (uint64_t i = 0; i < n; i++) {
+		cJSON *request = cJSON_Parse(connect_request);
+		bench_keep(request != NULL);
+		cJSON_Delete(request);
+	}
+}
+
+BENCH(object2text) {
+	cJSON *request = cJSON_Parse(connect_request);
+	TEXT_t textBuf;
+	for (uint64_t i = 0; i < n; i++) {
+		object2text(request, &textBuf);
+		bench_keep(text_get(&textBuf, TEXT_HOST)[0]);
+	}
+	cJSON_Delete(request);
+}
+
+BENCH(mqtt_response_print) {
+	for (uint64_t i = 0; i < n; i++) {
+		cJSON *response = cJSON_CreateObject();
+		cJSON_AddStringToObject(response, "id", "publish-response");
+		cJSON_AddStringToObject(response, "result", "OK");
+		char *my_json_string = cJSON_Print(response);
+		bench_keep(strlen(my_json_string));
+		cJSON_Delete(response);
+		cJSON_free(my_json_string);
+	}
+}
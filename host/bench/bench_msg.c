@@ -0,0 +1,102 @@
+/*
+	 Benchmarks for main/msg.c
+
+	 msg_two_tasks passes requests by handle between two tasks, next to
+	 message_buffer_json_two_tasks, which copies the JSON text through a
+	 message buffer the way the main loop and the MQTT task used to. The
+	 pool, the overflow policies and the old deadlock scenario are checked
+	 by host/test/test_msg.c.
+*/
+
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/event_groups.h"
+#include "freertos/message_buffer.h"
+#include "esp_log.h"
+
+#include "msg.h"
+#include "bench.h"
+
+static const char publish_request[] =
+	"{\"id\":\"publish-request\",\"topic\":[\"ioto/sub\",\"ioto/pub\"],\"qos\":[\"0\",\"1\"],\"payload\":[\"hello\"]}";
+
+#define DONE_BIT BIT0
+
+typedef struct {
+	MSG_QUEUE_t *queue;
+	MessageBufferHandle_t mb;
+	uint64_t n;
+	EventGroupHandle_t done;
+} PRODUCER_t;
+
+static void msg_producer(void *arg)
+{
+	PRODUCER_t *p = arg;
+	for (uint64_t i = 0; i < p->n; i++) {
+		MSG_t *msg;
+		while ((msg = msg_alloc(MSG_MQTT_PUBLISH)) == NULL) taskYIELD();
+		text_init(&msg->mqtt);
+		text_set(&msg->mqtt, TEXT_TOPIC_PUB, "ioto/pub", 8);
+		text_set(&msg->mqtt, TEXT_PAYLOAD, "hello", 5);
+		// the producer may wait here, the point is the cost of one hand off
+		xQueueSend(p->queue->queue, &msg, portMAX_DELAY);
+	}
+	xEventGroupSetBits(p->done, DONE_BIT);
+	vTaskDelete(NULL);
+}
+
+BENCH(msg_two_tasks) {
+	bench_stop(b);
+	static MSG_QUEUE_t queue;
+	esp_log_level_t level = esp_log_level;
+	esp_log_level = ESP_LOG_ERROR;
+	msg_pool_init();
+	msg_queue_init(&queue, "bench", 8, MSG_DROP_NEWEST);
+	PRODUCER_t p = { .queue = &queue, .n = n, .done = xEventGroupCreate() };
+	bench_start(b);
+
+	xTaskCreate(msg_producer, "producer", 4096, &p, 5, NULL);
+	for (uint64_t i = 0; i < n; i++) {
+		MSG_t *msg = msg_receive(&queue, portMAX_DELAY);
+		bench_keep(text_get(&msg->mqtt, TEXT_PAYLOAD)[0]);
+		msg_free(msg);
+	}
+	xEventGroupWaitBits(p.done, DONE_BIT, pdTRUE, pdTRUE, portMAX_DELAY);
+
+	bench_stop(b);
+	vEventGroupDelete(p.done);
+	vQueueDelete(queue.queue);
+	esp_log_level = level;
+	bench_start(b);
+}
+
+static void mb_producer(void *arg)
+{
+	PRODUCER_t *p = arg;
+	for (uint64_t i = 0; i < p->n; i++) {
+		xMessageBufferSend(p->mb, publish_request, sizeof(publish_request), portMAX_DELAY);
+	}
+	xEventGroupSetBits(p->done, DONE_BIT);
+	vTaskDelete(NULL);
+}
+
+BENCH(message_buffer_json_two_tasks) {
+	bench_stop(b);
+	PRODUCER_t p = { .mb = xMessageBufferCreate(1024), .n = n, .done = xEventGroupCreate() };
+	bench_start(b);
+
+	xTaskCreate(mb_producer, "producer", 4096, &p, 5, NULL);
+	char cRxBuffer[512];
+	for (uint64_t i = 0; i < n; i++) {
+		size_t readBytes = xMessageBufferReceive(p.mb, cRxBuffer, sizeof(cRxBuffer), portMAX_DELAY);
+		bench_keep(readBytes);
+	}
+	xEventGroupWaitBits(p.done, DONE_BIT, pdTRUE, pdTRUE, portMAX_DELAY);
+
+	bench_stop(b);
+	vEventGroupDelete(p.done);
+	vMessageBufferDelete(p.mb);
+	bench_start(b);
+}
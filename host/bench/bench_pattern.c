@@ -0,0 +1,49 @@
+/*
+	 main/pattern.c on an 8 bit counter: ns/op is one step, with one alarm
+	 per step or all of a pass caught up in one alarm. The schedule
+	 against a timer that goes off late is checked by
+	 host/test/test_pattern.c.
+*/
+
+#include "pattern.h"
+#include "bench.h"
+
+static PATTERN_t pattern;
+static uint64_t pins;		// the levels of the simulated GPIOs
+
+static void write_pins(uint64_t mask, uint64_t levels)
+{
+	pins = (pins & ~mask) | (levels & mask);
+}
+
+// an 8 bit counter on GPIO0-7, a pass takes 256 us
+static void load_counter(uint32_t delay_us)
+{
+	static PATTERN_STEP_t steps[PATTERN_MAX_STEPS];
+	for (int i = 0; i < PATTERN_MAX_STEPS; i++) steps[i] = (PATTERN_STEP_t) { 0xff, i, delay_us };
+	steps[PATTERN_MAX_STEPS - 1].delay_us = PATTERN_MAX_STEPS - (PATTERN_MAX_STEPS - 1) * delay_us;
+	ESP_ERROR_CHECK(pattern_load(&pattern, steps, PATTERN_MAX_STEPS));
+	pattern_rewind(&pattern, 0, 0);
+}
+
+BENCH(pattern_step) {
+	bench_stop(b);
+	load_counter(1);
+	bench_start(b);
+	for (uint64_t i = 0; i < n; i++) {
+		bench_keep(pattern_run(&pattern, i, write_pins));
+	}
+	bench_keep(pins);
+}
+
+BENCH(pattern_catch_up) {
+	bench_stop(b);
+	load_counter(0);
+	bench_start(b);
+	uint64_t passes = n / PATTERN_MAX_STEPS + 1;
+	for (uint64_t i = 0; i < passes; i++) {
+		bench_keep(pattern_run(&pattern, i * PATTERN_MAX_STEPS, write_pins));
+	}
+	bench_metric(b, "steps/alarm", (double)pattern.played / passes);
+	bench_keep(pins);
+}
@@ -0,0 +1,39 @@
+/*
+	 Benchmarks for main/protocol.c
+*/
+
+#include <string.h>
+
+#include "protocol.h"
+#include "bench.h"
+
+BENCH(make_send_text) {
+	char out[64];
+	for (uint64_t i = 0; i < n; i++) {
+		bench_keep(makeSendText(out, "AN", "GPIO2", "1234", "12:34:56"));
+	}
+}
+
+BENCH(protocol_parse_get) {
+	static const char msg[] = "G GPIO42_pin";
+	COMMAND_t cmd;
+	for (uint64_t i = 0; i < n; i++) {
+		bench_keep(protocol_parse(msg, sizeof(msg) - 1, &cmd));
+	}
+}
+
+BENCH(protocol_parse_output) {
+	static const char msg[] = "O GPIO41 1";
+	COMMAND_t cmd;
+	for (uint64_t i = 0; i < n; i++) {
+		bench_keep(protocol_parse(msg, sizeof(msg) - 1, &cmd));
+	}
+}
+
+BENCH(protocol_parse_json) {
+	static const char msg[] = "{\"id\":\"init\"}";
+	COMMAND_t cmd;
+	for (uint64_t i = 0; i < n; i++) {
+		bench_keep(protocol_parse(msg, sizeof(msg) - 1, &cmd));
+	}
+}
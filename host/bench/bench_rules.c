@@ -0,0 +1,70 @@
+/*
+	 main/rules.c: the cost of a compile, of measuring a block for the rules
+	 and of evaluating many rules per acquisition block. ns/op is one
+	 compile, one block of rules_measure() or one rules_eval() of
+	 RULES_MAX rules. The compiler and the firing logic are checked by
+	 host/test/test_rules.c.
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "rules.h"
+#include "bench.h"
+
+#define MV_PER_LSB (2500.0f / 8191)
+
+static const char *good[] = {
+	"rms(6) > 500 for 200",
+	"freq(D3) > 100 hyst 5 every 10000",
+	"mean(0) - mean(1) >= 12.5 and not level(40)",
+	"(max(6) - min(6)) / 2 < 3 or pp(6) > 2000",
+	"level(D1) == 1 and level(D2) != 1 or -mean(2) < -100",
+	"1",
+};
+
+BENCH(rules_compile) {
+	RULE_CODE_t code;
+	char error[64];
+	for (uint64_t i = 0; i < n; i++) {
+		bench_keep(rules_compile(good[i % 5], &code, error, sizeof(error)));
+	}
+}
+
+BENCH(rules_measure_64) {
+	RULES_INPUT_t in;
+	uint16_t raw[64];
+	for (int i = 0; i < 64; i++) raw[i] = 4096 + (i % 16) * 100;
+	memset(&in, 0, sizeof(in));
+	for (uint64_t i = 0; i < n; i++) {
+		rules_measure(&in, 6, raw, 64, MV_PER_LSB, 0);
+		bench_keep(in.rms[6]);
+	}
+}
+
+// RULES_MAX rules of every kind, a quarter of them changing state now and then
+BENCH(rules_eval_32) {
+	static RULES_t rules;
+	RULES_INPUT_t in;
+	RULES_EVENT_t events[RULES_MAX];
+	char name[RULES_NAME_SIZE], error[64];
+	bench_stop(b);
+	rules_init(&rules);
+	for (int i = 0; i < RULES_MAX; i++) {
+		snprintf(name, sizeof(name), "r%d", i);
+		ESP_ERROR_CHECK(rules_set(&rules, name, good[i % 5], error, sizeof(error)));
+		rules.rule[i].code.every_ms = 0;	// every state change is an event
+	}
+	memset(&in, 0, sizeof(in));
+	bench_start(b);
+	uint64_t fired = 0;
+	for (uint64_t i = 0; i < n; i++) {
+		in.t_us = i * 64000;
+		in.rms[6] = in.max[6] = (i & 7) ? 400 : 700;
+		in.freq_hz[40] = (i & 3) ? 50 : 150;
+		in.levels = (i & 1) << 40;
+		fired += rules_eval(&rules, &in, events);
+	}
+	bench_keep(fired);
+	bench_metric(b, "events/eval", (double)fired / n);
+}
@@ -0,0 +1,100 @@
+/*
+	 Scaling of main/session.c with the number of clients: the cost of one
+	 acquisition block through session_process() for 1, 4 and 8 sessions,
+	 all with the same view (one shared pipeline) or each with its own
+	 decimation (a pipeline per session). Sending is a counter here, so
+	 the numbers are the per block work of the stream task without the
+	 network. host/test/test_session.c checks what they send.
+*/
+
+#include <math.h>
+
+#include "esp_log.h"
+
+#include "session.h"
+#include "bench.h"
+
+#define WAVE_BLOCKS 64
+
+static uint64_t sent_messages;
+static uint64_t sent_bytes;
+
+static int count_send(int num, const void *data, size_t len, int binary)
+{
+	sent_messages++;
+	sent_bytes += len;
+	return 1;
+}
+
+static uint32_t raw_to_mv(int raw)
+{
+	return (uint32_t)raw * 2500 / 8191;
+}
+
+static void run(BENCH_t *b, uint64_t n, int clients, int shared, CODEC_t codec)
+{
+	bench_stop(b);
+	static int ready;
+	if (!ready) {
+		SESSION_IO_t io = { .send = count_send, .raw_to_mv = raw_to_mv, .bits = 13, .mv_per_lsb = 2500.0f / 8191 };
+		ESP_ERROR_CHECK(session_init(&io));
+		ready = 1;
+	}
+	for (int i = 0; i < clients; i++) {
+		session_open(i);
+		session_set_codec(i, codec);
+		// decimation 1 for everyone, or 1..clients: the same pipeline or one each
+		session_set_decimation(i, shared ? 1 : i + 1);
+		session_set_channel(i, 6, 1);
+	}
+	SESSION_STATS_t before;
+	session_get_stats(&before);
+	sent_messages = 0;
+	sent_bytes = 0;
+
+	// ten periods of a sine, as blocks
+	static SAMPLE_BLOCK_t blocks[WAVE_BLOCKS];
+	for (int k = 0; k < WAVE_BLOCKS; k++) {
+		blocks[k].channels = 1 << 6;
+		blocks[k].count = ACQ_BLOCK_SAMPLES;
+		blocks[k].period_us = 1000;
+		for (int i = 0; i < ACQ_BLOCK_SAMPLES; i++) {
+			blocks[k].raw[i] = 4096 + (int)(3000 * sin(2 * M_PI * 10 * (k * ACQ_BLOCK_SAMPLES + i) / (WAVE_BLOCKS * ACQ_BLOCK_SAMPLES)));
+		}
+	}
+	bench_start(b);
+	for (uint64_t k = 0; k < n; k++) {
+		SAMPLE_BLOCK_t *block = &blocks[k % WAVE_BLOCKS];
+		block->seq = k;
+		block->t0_us = k * ACQ_BLOCK_SAMPLES * 1000;
+		session_process(block);
+	}
+	bench_stop(b);
+
+	SESSION_STATS_t after;
+	session_get_stats(&after);
+	for (int i = 0; i < clients; i++) session_close(i);
+	bench_metric(b, "pipelines", after.pipelines);
+	bench_metric(b, "encodes/block", n ? (double)(after.outputs - before.outputs) / n : 0);
+	bench_metric(b, "sends/block", n ? (double)sent_messages / n : 0);
+	bench_metric(b, "bytes/block", n ? (double)sent_bytes / n : 0);
+	bench_start(b);
+}
+
+#define SESSION_BENCH(clients, kind, shared, codec) \
+	BENCH(session_##clients##_##kind) {              \
+		run(b, n, clients, shared, codec);          \
+	}
+
+SESSION_BENCH(1, shared_text, 1, CODEC_TEXT)
+SESSION_BENCH(4, shared_text, 1, CODEC_TEXT)
+SESSION_BENCH(8, shared_text, 1, CODEC_TEXT)
+SESSION_BENCH(1, distinct_text, 0, CODEC_TEXT)
+SESSION_BENCH(4, distinct_text, 0, CODEC_TEXT)
+SESSION_BENCH(8, distinct_text, 0, CODEC_TEXT)
+SESSION_BENCH(1, shared_rice, 1, CODEC_RICE)
+SESSION_BENCH(4, shared_rice, 1, CODEC_RICE)
+SESSION_BENCH(8, shared_rice, 1, CODEC_RICE)
+SESSION_BENCH(1, distinct_rice, 0, CODEC_RICE)
+SESSION_BENCH(4, distinct_rice, 0, CODEC_RICE)
+SESSION_BENCH(8, distinct_rice, 0, CODEC_RICE)
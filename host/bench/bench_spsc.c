@@ -0,0 +1,141 @@
+/*
+	 Two thread stress of main/spsc.c, the ring between acquire_task and
+	 the network side, next to the message buffer it replaces.
+
+	 ns/op is one slot handed over. That the slots arrive whole and in
+	 order is checked by host/test/test_spsc.c.
+*/
+
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/message_buffer.h"
+
+#include "spsc.h"
+#include "bench.h"
+
+#define SLOT_WORDS 36	// about a SAMPLE_BLOCK_t
+#define RING_SLOTS 16
+
+typedef struct {
+	uint32_t seq;
+	uint32_t word[SLOT_WORDS - 1];
+} SLOT_t;
+
+typedef struct {
+	SPSC_RING_t ring;
+	uint64_t n;
+	int lossy;		// drop on full instead of retrying
+	uint64_t full;
+	uint64_t dropped;
+} STRESS_t;
+
+static SLOT_t storage[RING_SLOTS];
+
+static void fill(SLOT_t *s, uint32_t seq)
+{
+	s->seq = seq;
+	for (int i = 0; i < SLOT_WORDS - 1; i++) s->word[i] = seq * 2654435761u + i;
+}
+
+static void *producer(void *arg)
+{
+	STRESS_t *st = arg;
+	for (uint64_t i = 0; i < st->n; i++) {
+		SLOT_t *s;
+		while ((s = spsc_claim(&st->ring)) == NULL) {
+			st->full++;
+			if (st->lossy) break;
+			sched_yield();
+		}
+		if (s == NULL) {
+			st->dropped++;
+			continue;
+		}
+		fill(s, (uint32_t)i);
+		spsc_publish(&st->ring);
+	}
+	// end marker, always delivered
+	SLOT_t *s;
+	while ((s = spsc_claim(&st->ring)) == NULL) sched_yield();
+	s->seq = UINT32_MAX;
+	spsc_publish(&st->ring);
+	return NULL;
+}
+
+static void stress(BENCH_t *b, uint64_t n, int lossy)
+{
+	static STRESS_t st;
+	memset(&st, 0, sizeof(st));
+	spsc_init(&st.ring, storage, sizeof(SLOT_t), RING_SLOTS);
+	st.n = n;
+	st.lossy = lossy;
+
+	pthread_t thread;
+	pthread_create(&thread, NULL, producer, &st);
+	uint64_t received = 0;
+	for (;;) {
+		const SLOT_t *s = spsc_peek(&st.ring);
+		if (s == NULL) {
+			sched_yield();
+			continue;
+		}
+		if (s->seq == UINT32_MAX) {
+			spsc_release(&st.ring);
+			break;
+		}
+		bench_keep(s->word[0]);
+		received++;
+		spsc_release(&st.ring);
+	}
+	pthread_join(thread, NULL);
+
+	bench_keep(received);
+	bench_metric(b, "full/op", (double)st.full / n);
+	if (lossy) bench_metric(b, "dropped/op", (double)st.dropped / n);
+}
+
+BENCH(spsc_two_threads) {
+	stress(b, n, 0);
+}
+
+BENCH(spsc_two_threads_lossy) {
+	stress(b, n, 1);
+}
+
+// the same hand off through a message buffer, which copies and locks twice per message
+typedef struct {
+	MessageBufferHandle_t mb;
+	uint64_t n;
+} MB_STRESS_t;
+
+static void *mb_producer(void *arg)
+{
+	MB_STRESS_t *st = arg;
+	SLOT_t s;
+	for (uint64_t i = 0; i <= st->n; i++) {
+		fill(&s, i == st->n ? UINT32_MAX : (uint32_t)i);
+		xMessageBufferSend(st->mb, &s, sizeof(s), portMAX_DELAY);
+	}
+	return NULL;
+}
+
+BENCH(message_buffer_two_threads) {
+	bench_stop(b);
+	MB_STRESS_t st = { xMessageBufferCreate(RING_SLOTS * (sizeof(SLOT_t) + 4)), n };
+	bench_start(b);
+	pthread_t thread;
+	pthread_create(&thread, NULL, mb_producer, &st);
+	SLOT_t s;
+	for (;;) {
+		xMessageBufferReceive(st.mb, &s, sizeof(s), portMAX_DELAY);
+		if (s.seq == UINT32_MAX) break;
+		bench_keep(s.word[0]);
+	}
+	pthread_join(thread, NULL);
+	bench_stop(b);
+	vMessageBufferDelete(st.mb);
+	bench_start(b);
+}
@@ -0,0 +1,155 @@
+/*
+	 main/topic.c: the trie of the MQTT subscriptions, against the plain
+	 way, every filter compared with the topic one after the other, on the
+	 same tables and topics. That the trie follows the rules of MQTT and
+	 agrees with the plain way is checked by host/test/test_topic.c.
+
+	 The tables are what a lot of clients of a lot of devices would
+	 subscribe to: "s<site>/d<device>/k<kind>", one in ten with '+' for
+	 the device and one in ten ending in '#', over 20 sinks. The topics
+	 are the messages of those devices. Matching is timed with 1k, 4k and
+	 10k filters, against the trie and against the list.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "topic.h"
+#include "bench.h"
+
+#define SINKS 20
+#define SITES 16
+#define KINDS 4
+#define NAMES 256
+#define MAX_FILTERS 10000
+
+static uint8_t arena[4 << 20] __attribute__((aligned(8)));
+static TOPIC_TABLE_t table;
+static char filters[MAX_FILTERS][32];
+static int nfilters;
+static char names[NAMES][32];
+
+static void fail(const char *what, long long got)
+{
+	fprintf(stderr, "topic: %s (%lld)\n", what, got);
+	abort();
+}
+
+static int match(const char *name, uint16_t *sinks)
+{
+	return topic_match(&table, name, strlen(name), sinks, SINKS);
+}
+
+static void subscribe(const char *filter, uint16_t sink)
+{
+	if (topic_subscribe(&table, filter, strlen(filter), sink) != ESP_OK) fail(filter, sink);
+}
+
+/*
+	 The plain way, a filter at a time
+*/
+
+static bool filter_matches(const char *f, const char *t)
+{
+	if (t[0] == '$' && (f[0] == '+' || f[0] == '#')) return false;
+	for (;;) {
+		if (f[0] == '#') return true;
+		const char *fe = strchr(f, '/');
+		const char *te = strchr(t, '/');
+		size_t fl = fe ? (size_t)(fe - f) : strlen(f);
+		size_t tl = te ? (size_t)(te - t) : strlen(t);
+		if (!(fl == 1 && f[0] == '+') && (fl != tl || memcmp(f, t, fl) != 0)) return false;
+		if (te == NULL) return fe == NULL || strcmp(fe, "/#") == 0;
+		if (fe == NULL) return false;
+		f = fe + 1;
+		t = te + 1;
+	}
+}
+
+static uint32_t linear_mask(const char *name)
+{
+	uint32_t mask = 0;
+	for (int i = 0; i < nfilters; i++) {
+		if (filter_matches(filters[i], name)) mask |= 1u << (i % SINKS);
+	}
+	return mask;
+}
+
+/*
+	 Tables
+*/
+
+static void build(int count)
+{
+	topic_table_init(&table, arena, sizeof(arena));
+	uint32_t r = 12345;
+	for (nfilters = 0; nfilters < count; nfilters++) {
+		int i = nfilters;
+		r = r * 1103515245u + 12345u;
+		int site = i % SITES, device = (r >> 8) % (count / 8 + 1), kind = (r >> 20) % KINDS;
+		if (i % 10 == 3) {
+			sprintf(filters[i], "s%d/+/k%d", site, kind);
+		} else if (i % 10 == 7) {
+			sprintf(filters[i], "s%d/d%d/#", site, device);
+		} else {
+			sprintf(filters[i], "s%d/d%d/k%d", site, device, kind);
+		}
+		subscribe(filters[i], i % SINKS);
+	}
+	for (int i = 0; i < NAMES; i++) {
+		r = r * 1103515245u + 12345u;
+		sprintf(names[i], "s%u/d%u/k%u", (r >> 4) % SITES, (r >> 8) % (count / 8 + 1), (r >> 20) % KINDS);
+	}
+}
+
+static void trie(BENCH_t *b, uint64_t n, int count)
+{
+	bench_stop(b);
+	build(count);
+	bench_start(b);
+	uint16_t sinks[SINKS];
+	uint64_t matched = 0;
+	for (uint64_t i = 0; i < n; i++) {
+		const char *name = names[i % NAMES];
+		matched += match(name, sinks);
+	}
+	bench_keep(matched);
+	bench_metric(b, "sinks", (double)matched / n);
+	bench_metric(b, "nodes", table.nodes);
+	bench_metric(b, "arena_kB", table.arena.used / 1024.0);
+}
+
+static void linear(BENCH_t *b, uint64_t n, int count)
+{
+	bench_stop(b);
+	build(count);
+	bench_start(b);
+	for (uint64_t i = 0; i < n; i++) bench_keep(linear_mask(names[i % NAMES]));
+}
+
+BENCH(topic_subscribe) {
+	for (uint64_t i = 0; i < n; i += MAX_FILTERS) {
+		build(n - i < MAX_FILTERS ? n - i : MAX_FILTERS);
+	}
+}
+
+BENCH(topic_match_1k) {
+	trie(b, n, 1000);
+}
+
+BENCH(topic_match_4k) {
+	trie(b, n, 4000);
+}
+
+BENCH(topic_match_10k) {
+	trie(b, n, 10000);
+}
+
+BENCH(topic_linear_1k) {
+	linear(b, n, 1000);
+}
+
+BENCH(topic_linear_10k) {
+	linear(b, n, 10000);
+}
@@ -0,0 +1,51 @@
+/*
+	 main/trace.c: the cost of a record on the hot path against formatting
+	 it there, a level compiled out, and reading the rings back. The
+	 records themselves are checked by host/test/test_trace.c.
+*/
+
+#include <stdio.h>
+
+#define TRACE_LEVEL TRACE_INFO		// TRACE_D and TRACE_V compile to nothing here
+#include "trace.h"
+#include "bench.h"
+
+static const char *TAG = "bench";
+
+BENCH(trace_write_2) {
+	for (uint64_t i = 0; i < n; i++) {
+		TRACE_I("client %d sent %d bytes", (int)i, 42);
+	}
+}
+
+BENCH(trace_compiled_out) {
+	for (uint64_t i = 0; i < n; i++) {
+		TRACE_D("client %d sent %d bytes", (int)i, 42);
+		bench_keep(i);
+	}
+}
+
+// what the hot path paid before: formatting the line where it happens
+BENCH(trace_snprintf_2) {
+	char line[160];
+	for (uint64_t i = 0; i < n; i++) {
+		bench_keep(snprintf(line, sizeof(line), "I (%lld) %s: client %d sent %d bytes\n", (long long)i, TAG, (int)i, 42));
+	}
+}
+
+BENCH(trace_read_format) {
+	TRACE_READER_t reader;
+	TRACE_RECORD_t record;
+	char line[160];
+	for (uint64_t i = 0; i < n; ) {
+		bench_stop(b);
+		trace_reader_init(&reader, 0);
+		for (int j = 0; j < TRACE_RECORDS / 2; j++) {
+			TRACE_I("client %d sent %d bytes", j, 42);
+		}
+		bench_start(b);
+		for (; i < n && trace_read(&reader, &record); i++) {
+			bench_keep(trace_format(&record, line, sizeof(line)));
+		}
+	}
+}
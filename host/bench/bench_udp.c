@@ -0,0 +1,86 @@
+/*
+	 main/udp_stream.c on loopback: the datagrams of a stream of encoded
+	 blocks, received again on a plain socket the way tools/udprecv does.
+	 ns/op is one datagram sent and received. What arrives is checked by
+	 host/test/test_udp_stream.c.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "esp_log.h"
+
+#include "codec.h"
+#include "protocol.h"
+#include "udp_stream.h"
+#include "bench.h"
+
+#define BLOCK 64	// CONFIG_ACQ_BLOCK_SAMPLES
+
+static int open_receiver(uint16_t *port)
+{
+	int fd = socket(AF_INET, SOCK_DGRAM, 0);
+	struct sockaddr_in sin = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+	socklen_t len = sizeof(sin);
+	int size = 1 << 20;
+	setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+	if (fd < 0 || bind(fd, (struct sockaddr *)&sin, sizeof(sin)) < 0 || getsockname(fd, (struct sockaddr *)&sin, &len) < 0) {
+		perror("udp receiver");
+		abort();
+	}
+	*port = ntohs(sin.sin_port);
+	return fd;
+}
+
+static void run(BENCH_t *b, uint64_t n, CODEC_t codec)
+{
+	bench_stop(b);
+	esp_log_level = ESP_LOG_WARN;
+	static int ready;
+	if (!ready) {
+		ESP_ERROR_CHECK(udp_stream_init());
+		ready = 1;
+	}
+	uint16_t port;
+	int fd = open_receiver(&port);
+	ESP_ERROR_CHECK(udp_stream_start("127.0.0.1", port, codec));
+	uint16_t samples[BLOCK];
+	for (int i = 0; i < BLOCK; i++) samples[i] = 4096 + (i * 37) % 200;
+	static uint8_t frame[PROTOCOL_FRAME_HEADER_SIZE + CODEC_MAX_SIZE(BLOCK)];
+	static uint8_t buf[UDP_STREAM_MAX_DATAGRAM];
+	uint64_t bytes = 0;
+	bench_start(b);
+
+	for (uint64_t i = 0; i < n; i++) {
+		protocol_put_frame_header(frame, &(STREAM_FRAME_t) {
+			.channel = 6, .bits = 13, .seq = (uint32_t)i, .period_us = 1000,
+			.mv_per_lsb = 2500.0f / 8191, .t0_us = (int64_t)i * BLOCK * 1000,
+		});
+		int len = codec_encode(codec, samples, BLOCK, 13, frame + PROTOCOL_FRAME_HEADER_SIZE, sizeof(frame) - PROTOCOL_FRAME_HEADER_SIZE);
+		if (udp_stream_send(frame, PROTOCOL_FRAME_HEADER_SIZE + len) != ESP_OK) {
+			fprintf(stderr, "udp_stream: send %llu failed\n", (unsigned long long)i);
+			abort();
+		}
+		ssize_t got = recv(fd, buf, sizeof(buf), 0);
+		bytes += got;
+	}
+
+	bench_stop(b);
+	udp_stream_stop();
+	close(fd);
+	esp_log_level = ESP_LOG_INFO;
+	bench_metric(b, "bytes/datagram", n ? (double)bytes / n : 0);
+	bench_start(b);
+}
+
+BENCH(udp_stream_loopback_packed) {
+	run(b, n, CODEC_PACKED);
+}
+
+BENCH(udp_stream_loopback_rice) {
+	run(b, n, CODEC_RICE);
+}
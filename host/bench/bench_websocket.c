@@ -0,0 +1,261 @@
+/*
+	 components/websocket: mask and parse per KB and per frame, deflate of
+	 a sample message, and messages per second over loopback through the
+	 netconn shim in each direction. The protocol, the handshake, deflate
+	 and the server end to end are checked by host/test/test_websocket.c.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "lwip/api.h"
+
+#include "websocket.h"
+#include "websocket_server.h"
+#include "wsclient.h"
+#include "bench.h"
+
+static const uint8_t KEY[4] = { 0x37, 0xfa, 0x21, 0x3d };
+
+static void fail(const char *what, long long got)
+{
+	fprintf(stderr, "websocket: %s (%lld)\n", what, got);
+	abort();
+}
+
+// a frame as a client sends it, b0 is fin, rsv and opcode
+static size_t client_frame(uint8_t *out, uint8_t b0, const void *data, uint64_t len)
+{
+	size_t h = ws_put_header(out, 0, false, len, KEY);
+	out[0] = b0;
+	memcpy(out + h, data, len);
+	ws_mask(out + h, len, KEY, 0);
+	return h + len;
+}
+
+// 24 readings as JSON, 432 bytes
+static size_t sample_message(char *out, size_t size)
+{
+	size_t len = 0;
+	for (int i = 0; i < 24; i++) len += snprintf(out + len, size - len, "{\"ch\":%d,\"mv\":%d}", i % 4, 1000 + (i * 37) % 200);
+	return len;
+}
+
+/*
+	 The server on loopback
+*/
+
+static uint16_t port;
+static volatile int connected = -1;		// the client number
+static volatile int disconnects;
+static volatile WEBSOCKET_TYPE_t last_event;
+static volatile uint64_t received;
+static volatile bool echo;
+
+static void callback(uint8_t num, WEBSOCKET_TYPE_t type, char *msg, uint64_t len)
+{
+	switch (type) {
+		case WEBSOCKET_CONNECT:
+			connected = num;
+			break;
+		case WEBSOCKET_DISCONNECT_EXTERNAL:
+		case WEBSOCKET_DISCONNECT_INTERNAL:
+		case WEBSOCKET_DISCONNECT_ERROR:
+			last_event = type;
+			disconnects++;
+			break;
+		case WEBSOCKET_TEXT:
+		case WEBSOCKET_BIN:
+			if (echo) ws_server_send_text_client_from_callback(num, msg, len);
+			received++;
+			break;
+		default:
+			last_event = type;
+	}
+}
+
+// what the HTTP server of app.c does
+static void accept_task(void *arg)
+{
+	struct netconn *listener = arg;
+	for (;;) {
+		struct netconn *conn;
+		struct netbuf *inbuf;
+		char *buf;
+		uint16_t buflen;
+		if (netconn_accept(listener, &conn) != ERR_OK) continue;
+		netconn_set_recvtimeout(conn, 1000);
+		if (netconn_recv(conn, &inbuf) != ERR_OK) {
+			netconn_delete(conn);
+			continue;
+		}
+		netbuf_data(inbuf, (void **)&buf, &buflen);
+		ws_server_add_client(conn, buf, buflen, "/", callback);
+		netbuf_delete(inbuf);
+	}
+}
+
+static void start_server(void)
+{
+	if (port) return;
+	esp_log_level = ESP_LOG_WARN;
+	ip_addr_t loopback;
+	ipaddr_aton("127.0.0.1", &loopback);
+	struct netconn *listener = netconn_new(NETCONN_TCP);
+	if (listener == NULL || netconn_bind(listener, &loopback, 0) != ERR_OK || netconn_listen(listener) != ERR_OK
+		|| netconn_addr(listener, NULL, &port) != ERR_OK) fail("listener", 0);
+	ws_server_start();	// or already running for bench_history.c, a server that is not fails the CONNECT below
+	xTaskCreate(accept_task, "accept", 4096, listener, 5, NULL);
+}
+
+static void wait_for(volatile uint64_t *counter, uint64_t value)
+{
+	int64_t deadline = bench_now_ns() + 5000000000LL;
+	while (*counter < value) {
+		if (bench_now_ns() > deadline) fail("timed out waiting, got", *counter);
+		sched_yield();
+	}
+}
+
+// the next frame that is no pong, waiting up to a second
+static int next_frame(WS_CLIENT_t *c, WS_FRAME_t *frame)
+{
+	int64_t deadline = bench_now_ns() + 1000000000LL;
+	for (;;) {
+		if (ws_client_next_frame(c, frame) == 1) return 1;
+		if (ws_client_fill(c) < 0 || bench_now_ns() > deadline) return 0;
+		sched_yield();
+	}
+}
+
+static void connect_client(WS_CLIENT_t *c)
+{
+	connected = -1;
+	if (ws_client_connect(c, "127.0.0.1", port, "/") != 0) fail("connect", 0);
+	int64_t deadline = bench_now_ns() + 1000000000LL;
+	while (connected < 0) {
+		if (bench_now_ns() > deadline) fail("no CONNECT", 0);
+		sched_yield();
+	}
+}
+
+BENCH(websocket_mask_1k) {
+	static uint8_t buf[1024];
+	for (uint64_t i = 0; i < n; i++) ws_mask(buf, sizeof(buf), KEY, i);
+	bench_keep(buf[17]);
+}
+
+BENCH(websocket_mask_1k_bytewise) {
+	static uint8_t buf[1024];
+	for (uint64_t i = 0; i < n; i++) {
+		for (size_t k = 0; k < sizeof(buf); k++) buf[k] ^= KEY[(i + k) & 3];
+		__asm__ volatile("" : : "r"(buf) : "memory");
+	}
+	bench_keep(buf[17]);
+}
+
+// a stream of 64 byte text frames, in 1460 byte segments
+BENCH(websocket_parse_64) {
+	bench_stop(b);
+	static uint8_t stream[64 * 70];
+	uint8_t text[64];
+	memset(text, 'a', sizeof(text));
+	size_t len = 0;
+	for (int i = 0; i < 64; i++) len += client_frame(stream + len, 0x81, text, sizeof(text));
+	WS_PARSER_t p;
+	ws_parser_init(&p, 8192, false);
+	bench_start(b);
+	uint64_t frames = 0;
+	while (frames < n) {
+		for (size_t off = 0; off < len;) {
+			size_t seg = len - off < 1460 ? len - off : 1460;
+			size_t i = 0;
+			while (i < seg) {
+				WS_MESSAGE_t msg;
+				size_t used;
+				if (ws_parse(&p, stream + off + i, seg - i, &used, &msg) == 1) {
+					frames++;
+					bench_keep(msg.data[0]);
+				}
+				i += used;
+			}
+			off += seg;
+		}
+	}
+	ws_parser_free(&p);
+}
+
+BENCH(websocket_deflate) {
+	bench_stop(b);
+	char msg[512];
+	size_t len = sample_message(msg, sizeof(msg));
+	static WS_DEFLATE_t z;
+	uint8_t out[512];
+	int zlen = 0;
+	bench_start(b);
+	for (uint64_t i = 0; i < n; i++) zlen = ws_deflate(&z, (const uint8_t *)msg, len, out, sizeof(out));
+	bench_metric(b, "ratio", (double)len / zlen);
+	bench_keep(zlen);
+}
+
+// client to server, 64 byte text messages, to the callback
+BENCH(websocket_loopback_rx) {
+	bench_stop(b);
+	start_server();
+	WS_CLIENT_t c;
+	connect_client(&c);
+	char text[64];
+	memset(text, 'r', sizeof(text));
+	uint64_t start = received;
+	bench_start(b);
+	int64_t t0 = bench_now_ns();
+	for (uint64_t i = 0; i < n; i++) {
+		if (ws_client_send_text(&c, text, sizeof(text)) != 0) fail("client send", i);
+	}
+	wait_for(&received, start + n);
+	double s = (bench_now_ns() - t0) / 1e9;
+	bench_stop(b);
+	bench_metric(b, "msgs/s", n / s);
+	int before = disconnects;
+	ws_client_close(&c);
+	while (disconnects == before) sched_yield();
+	bench_start(b);
+}
+
+static volatile uint64_t tx_count;
+
+static void sender_task(void *arg)
+{
+	char text[64];
+	memset(text, 's', sizeof(text));
+	for (uint64_t i = 0; i < tx_count; i++) ws_server_send_text_client(connected, text, sizeof(text));
+	vTaskDelete(NULL);
+}
+
+// server to client, 64 byte text messages from another task
+BENCH(websocket_loopback_tx) {
+	bench_stop(b);
+	start_server();
+	WS_CLIENT_t c;
+	connect_client(&c);
+	tx_count = n;
+	bench_start(b);
+	int64_t t0 = bench_now_ns();
+	xTaskCreate(sender_task, "sender", 4096, NULL, 5, NULL);
+	WS_FRAME_t frame;
+	for (uint64_t i = 0; i < n; i++) {
+		if (!next_frame(&c, &frame) || frame.len != 64) fail("frame from the server", i);
+	}
+	double s = (bench_now_ns() - t0) / 1e9;
+	bench_stop(b);
+	bench_metric(b, "msgs/s", n / s);
+	int before = disconnects;
+	ws_client_close(&c);
+	while (disconnects == before) sched_yield();
+	bench_start(b);
+}
@@ -0,0 +1,91 @@
+/*
+	 esp_log, esp_err, esp_timer and esp_system for the host build.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_system.h"
+
+esp_log_level_t esp_log_level = CONFIG_LOG_DEFAULT_LEVEL;
+
+// the host build keeps a single level, whatever the tag
+void esp_log_level_set(const char* tag, esp_log_level_t level)
+{
+	(void)tag;
+	esp_log_level = level;
+}
+
+static int64_t monotonic_us(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int64_t boot_us = -1;
+
+int64_t esp_timer_get_time(void)
+{
+	int64_t now = monotonic_us();
+	if (boot_us < 0) boot_us = now;
+	return now - boot_us;
+}
+
+uint32_t esp_log_timestamp(void)
+{
+	return (uint32_t)(esp_timer_get_time() / 1000);
+}
+
+void esp_log_write(esp_log_level_t level, const char* tag, const char* format, ...)
+{
+	(void)level;
+	(void)tag;
+	va_list args;
+	va_start(args, format);
+	vprintf(format, args);
+	va_end(args);
+}
+
+const char *esp_err_to_name(esp_err_t code)
+{
+	switch (code) {
+		case ESP_OK: return "ESP_OK";
+		case ESP_FAIL: return "ESP_FAIL";
+		case ESP_ERR_NO_MEM: return "ESP_ERR_NO_MEM";
+		case ESP_ERR_INVALID_ARG: return "ESP_ERR_INVALID_ARG";
+		case ESP_ERR_INVALID_STATE: return "ESP_ERR_INVALID_STATE";
+		case ESP_ERR_INVALID_SIZE: return "ESP_ERR_INVALID_SIZE";
+		case ESP_ERR_NOT_FOUND: return "ESP_ERR_NOT_FOUND";
+		case ESP_ERR_NOT_SUPPORTED: return "ESP_ERR_NOT_SUPPORTED";
+		case ESP_ERR_TIMEOUT: return "ESP_ERR_TIMEOUT";
+		default: return "UNKNOWN ERROR";
+	}
+}
+
+void _esp_error_check_failed(esp_err_t rc, const char *file, int line, const char *function, const char *expression)
+{
+	fprintf(stderr, "ESP_ERROR_CHECK failed: esp_err_t 0x%x (%s) at %s:%d\nfunc: %s\nexpression: %s\n",
+			rc, esp_err_to_name(rc), file, line, function, expression);
+	abort();
+}
+
+void esp_restart(void)
+{
+	fprintf(stderr, "esp_restart called, exiting\n");
+	exit(1);
+}
+
+uint32_t esp_get_free_heap_size(void)
+{
+	return 320 * 1024;
+}
+
+uint32_t esp_get_minimum_free_heap_size(void)
+{
+	return 320 * 1024;
+}
@@ -0,0 +1,567 @@
+/*
+	 FreeRTOS API on top of POSIX threads, for the host build.
+
+	 Only what ioto uses is implemented. Priorities and core affinity are
+	 recorded but not enforced, the Linux scheduler decides who runs.
+*/
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/event_groups.h"
+#include "freertos/message_buffer.h"
+
+static pthread_mutex_t critical_lock;
+static pthread_once_t shim_once = PTHREAD_ONCE_INIT;
+static struct timespec shim_epoch;
+
+static void shim_init(void)
+{
+	pthread_mutexattr_t attr;
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&critical_lock, &attr);
+	pthread_mutexattr_destroy(&attr);
+	clock_gettime(CLOCK_MONOTONIC, &shim_epoch);
+}
+
+static void shim_cond_init(pthread_cond_t *cond)
+{
+	pthread_condattr_t attr;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(cond, &attr);
+	pthread_condattr_destroy(&attr);
+}
+
+// absolute CLOCK_MONOTONIC deadline for a tick timeout
+static void shim_deadline(TickType_t ticks, struct timespec *ts)
+{
+	clock_gettime(CLOCK_MONOTONIC, ts);
+	uint64_t ns = (uint64_t)ticks * portTICK_PERIOD_MS * 1000000ULL;
+	ts->tv_sec += ns / 1000000000ULL;
+	ts->tv_nsec += ns % 1000000000ULL;
+	if (ts->tv_nsec >= 1000000000L) {
+		ts->tv_sec++;
+		ts->tv_nsec -= 1000000000L;
+	}
+}
+
+// waits on cond until woken or the deadline passed, returns false on timeout
+static bool shim_wait(pthread_cond_t *cond, pthread_mutex_t *lock, TickType_t ticks, const struct timespec *deadline)
+{
+	if (ticks == 0) return false;
+	if (ticks == portMAX_DELAY) {
+		pthread_cond_wait(cond, lock);
+		return true;
+	}
+	return pthread_cond_timedwait(cond, lock, deadline) != ETIMEDOUT;
+}
+
+void vPortEnterCritical(portMUX_TYPE *mux)
+{
+	(void)mux;
+	pthread_once(&shim_once, shim_init);
+	pthread_mutex_lock(&critical_lock);
+}
+
+void vPortExitCritical(portMUX_TYPE *mux)
+{
+	(void)mux;
+	pthread_mutex_unlock(&critical_lock);
+}
+
+/* tasks */
+
+struct shim_task {
+	pthread_t thread;
+	char name[16];
+	UBaseType_t priority;
+	BaseType_t core;
+	TaskFunction_t code;
+	void *param;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	uint32_t notify;
+};
+
+static __thread struct shim_task *current_task;
+
+static struct shim_task *shim_task_new(const char *name, UBaseType_t priority, BaseType_t core)
+{
+	struct shim_task *task = calloc(1, sizeof(struct shim_task));
+	strncpy(task->name, name, sizeof(task->name) - 1);
+	task->priority = priority;
+	task->core = core;
+	pthread_mutex_init(&task->lock, NULL);
+	shim_cond_init(&task->cond);
+	return task;
+}
+
+static void *shim_task_entry(void *arg)
+{
+	current_task = arg;
+	pthread_setname_np(pthread_self(), current_task->name);
+	current_task->code(current_task->param);
+	return NULL;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t pvTaskCode, const char * const pcName,
+		const uint32_t usStackDepth, void * const pvParameters, UBaseType_t uxPriority,
+		TaskHandle_t * const pvCreatedTask, const BaseType_t xCoreID)
+{
+	(void)usStackDepth;
+	pthread_once(&shim_once, shim_init);
+	struct shim_task *task = shim_task_new(pcName, uxPriority, xCoreID);
+	task->code = pvTaskCode;
+	task->param = pvParameters;
+	if (pthread_create(&task->thread, NULL, shim_task_entry, task) != 0) {
+		free(task);
+		return pdFAIL;
+	}
+	pthread_detach(task->thread);
+	if (pvCreatedTask) *pvCreatedTask = task;
+	return pdPASS;
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+	if (current_task == NULL) {
+		current_task = shim_task_new("main", 1, tskNO_AFFINITY);
+		current_task->thread = pthread_self();
+	}
+	return current_task;
+}
+
+void vTaskDelete(TaskHandle_t xTaskToDelete)
+{
+	if (xTaskToDelete == NULL || xTaskToDelete == current_task) {
+		pthread_exit(NULL);
+	}
+	pthread_cancel(xTaskToDelete->thread);
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+	pthread_once(&shim_once, shim_init);
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	int64_t ms = (now.tv_sec - shim_epoch.tv_sec) * 1000LL + (now.tv_nsec - shim_epoch.tv_nsec) / 1000000LL;
+	return (TickType_t)(ms / portTICK_PERIOD_MS);
+}
+
+void vTaskDelay(const TickType_t xTicksToDelay)
+{
+	if (xTicksToDelay == 0) {
+		sched_yield();
+		return;
+	}
+	struct timespec ts;
+	ts.tv_sec = (xTicksToDelay * portTICK_PERIOD_MS) / 1000;
+	ts.tv_nsec = ((xTicksToDelay * portTICK_PERIOD_MS) % 1000) * 1000000L;
+	while (nanosleep(&ts, &ts) == -1 && errno == EINTR);
+}
+
+void vTaskDelayUntil(TickType_t * const pxPreviousWakeTime, const TickType_t xTimeIncrement)
+{
+	TickType_t wake = *pxPreviousWakeTime + xTimeIncrement;
+	TickType_t now = xTaskGetTickCount();
+	if ((int32_t)(wake - now) > 0) vTaskDelay(wake - now);
+	*pxPreviousWakeTime = wake;
+}
+
+char *pcTaskGetName(TaskHandle_t xTaskToQuery)
+{
+	if (xTaskToQuery == NULL) xTaskToQuery = xTaskGetCurrentTaskHandle();
+	return xTaskToQuery->name;
+}
+
+UBaseType_t uxTaskPriorityGet(TaskHandle_t xTask)
+{
+	if (xTask == NULL) xTask = xTaskGetCurrentTaskHandle();
+	return xTask->priority;
+}
+
+BaseType_t xPortGetCoreID(void)
+{
+	int cpu = sched_getcpu();
+	return cpu < 0 ? 0 : cpu % portNUM_PROCESSORS;
+}
+
+void taskYIELD(void)
+{
+	sched_yield();
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t xTaskToNotify)
+{
+	pthread_mutex_lock(&xTaskToNotify->lock);
+	xTaskToNotify->notify++;
+	pthread_cond_signal(&xTaskToNotify->cond);
+	pthread_mutex_unlock(&xTaskToNotify->lock);
+	return pdPASS;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t xClearCountOnExit, TickType_t xTicksToWait)
+{
+	struct shim_task *task = xTaskGetCurrentTaskHandle();
+	struct timespec deadline;
+	shim_deadline(xTicksToWait, &deadline);
+	pthread_mutex_lock(&task->lock);
+	while (task->notify == 0) {
+		if (!shim_wait(&task->cond, &task->lock, xTicksToWait, &deadline)) break;
+	}
+	uint32_t value = task->notify;
+	if (value) task->notify = xClearCountOnExit ? 0 : value - 1;
+	pthread_mutex_unlock(&task->lock);
+	return value;
+}
+
+/* queues and semaphores */
+
+struct shim_queue {
+	pthread_mutex_t lock;
+	pthread_cond_t not_empty;
+	pthread_cond_t not_full;
+	UBaseType_t length;
+	UBaseType_t item_size;
+	UBaseType_t count;
+	UBaseType_t head;
+	uint8_t *items;
+};
+
+QueueHandle_t xQueueCreate(UBaseType_t uxQueueLength, UBaseType_t uxItemSize)
+{
+	struct shim_queue *q = calloc(1, sizeof(struct shim_queue));
+	if (q == NULL) return NULL;
+	pthread_mutex_init(&q->lock, NULL);
+	shim_cond_init(&q->not_empty);
+	shim_cond_init(&q->not_full);
+	q->length = uxQueueLength;
+	q->item_size = uxItemSize;
+	if (uxItemSize) {
+		q->items = malloc((size_t)uxQueueLength * uxItemSize);
+		if (q->items == NULL) {
+			free(q);
+			return NULL;
+		}
+	}
+	return q;
+}
+
+void vQueueDelete(QueueHandle_t xQueue)
+{
+	pthread_cond_destroy(&xQueue->not_empty);
+	pthread_cond_destroy(&xQueue->not_full);
+	pthread_mutex_destroy(&xQueue->lock);
+	free(xQueue->items);
+	free(xQueue);
+}
+
+BaseType_t xQueueGenericSend(QueueHandle_t q, const void * const pvItemToQueue, TickType_t xTicksToWait, BaseType_t xFront)
+{
+	struct timespec deadline;
+	shim_deadline(xTicksToWait, &deadline);
+	pthread_mutex_lock(&q->lock);
+	while (q->count == q->length) {
+		if (!shim_wait(&q->not_full, &q->lock, xTicksToWait, &deadline)) {
+			pthread_mutex_unlock(&q->lock);
+			return pdFAIL;
+		}
+	}
+	if (q->item_size && pvItemToQueue) {
+		UBaseType_t slot;
+		if (xFront) {
+			q->head = (q->head + q->length - 1) % q->length;
+			slot = q->head;
+		} else {
+			slot = (q->head + q->count) % q->length;
+		}
+		memcpy(q->items + (size_t)slot * q->item_size, pvItemToQueue, q->item_size);
+	}
+	q->count++;
+	pthread_cond_signal(&q->not_empty);
+	pthread_mutex_unlock(&q->lock);
+	return pdPASS;
+}
+
+static BaseType_t shim_queue_take(QueueHandle_t q, void * const pvBuffer, TickType_t xTicksToWait, bool remove)
+{
+	struct timespec deadline;
+	shim_deadline(xTicksToWait, &deadline);
+	pthread_mutex_lock(&q->lock);
+	while (q->count == 0) {
+		if (!shim_wait(&q->not_empty, &q->lock, xTicksToWait, &deadline)) {
+			pthread_mutex_unlock(&q->lock);
+			return pdFAIL;
+		}
+	}
+	if (q->item_size && pvBuffer) {
+		memcpy(pvBuffer, q->items + (size_t)q->head * q->item_size, q->item_size);
+	}
+	if (remove) {
+		if (q->item_size) q->head = (q->head + 1) % q->length;
+		q->count--;
+		pthread_cond_signal(&q->not_full);
+	}
+	pthread_mutex_unlock(&q->lock);
+	return pdPASS;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t xQueue, void * const pvBuffer, TickType_t xTicksToWait)
+{
+	return shim_queue_take(xQueue, pvBuffer, xTicksToWait, true);
+}
+
+BaseType_t xQueuePeek(QueueHandle_t xQueue, void * const pvBuffer, TickType_t xTicksToWait)
+{
+	return shim_queue_take(xQueue, pvBuffer, xTicksToWait, false);
+}
+
+UBaseType_t uxQueueMessagesWaiting(const QueueHandle_t xQueue)
+{
+	pthread_mutex_lock(&xQueue->lock);
+	UBaseType_t count = xQueue->count;
+	pthread_mutex_unlock(&xQueue->lock);
+	return count;
+}
+
+UBaseType_t uxQueueSpacesAvailable(const QueueHandle_t xQueue)
+{
+	return xQueue->length - uxQueueMessagesWaiting(xQueue);
+}
+
+BaseType_t xQueueReset(QueueHandle_t xQueue)
+{
+	pthread_mutex_lock(&xQueue->lock);
+	xQueue->count = 0;
+	xQueue->head = 0;
+	pthread_cond_broadcast(&xQueue->not_full);
+	pthread_mutex_unlock(&xQueue->lock);
+	return pdPASS;
+}
+
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t uxMaxCount, UBaseType_t uxInitialCount)
+{
+	QueueHandle_t q = xQueueCreate(uxMaxCount, 0);
+	if (q) q->count = uxInitialCount;
+	return q;
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void)
+{
+	return xSemaphoreCreateCounting(1, 0);
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+	return xSemaphoreCreateCounting(1, 1);
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t xSemaphore, TickType_t xBlockTime)
+{
+	return xQueueReceive(xSemaphore, NULL, xBlockTime);
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t xSemaphore)
+{
+	return xQueueGenericSend(xSemaphore, NULL, 0, pdFALSE);
+}
+
+/* event groups */
+
+struct shim_event_group {
+	pthread_mutex_t lock;
+	pthread_cond_t changed;
+	EventBits_t bits;
+};
+
+EventGroupHandle_t xEventGroupCreate(void)
+{
+	struct shim_event_group *group = calloc(1, sizeof(struct shim_event_group));
+	if (group == NULL) return NULL;
+	pthread_mutex_init(&group->lock, NULL);
+	shim_cond_init(&group->changed);
+	return group;
+}
+
+void vEventGroupDelete(EventGroupHandle_t xEventGroup)
+{
+	pthread_cond_destroy(&xEventGroup->changed);
+	pthread_mutex_destroy(&xEventGroup->lock);
+	free(xEventGroup);
+}
+
+EventBits_t xEventGroupSetBits(EventGroupHandle_t xEventGroup, const EventBits_t uxBitsToSet)
+{
+	pthread_mutex_lock(&xEventGroup->lock);
+	xEventGroup->bits |= uxBitsToSet;
+	EventBits_t bits = xEventGroup->bits;
+	pthread_cond_broadcast(&xEventGroup->changed);
+	pthread_mutex_unlock(&xEventGroup->lock);
+	return bits;
+}
+
+EventBits_t xEventGroupClearBits(EventGroupHandle_t xEventGroup, const EventBits_t uxBitsToClear)
+{
+	pthread_mutex_lock(&xEventGroup->lock);
+	EventBits_t bits = xEventGroup->bits;
+	xEventGroup->bits &= ~uxBitsToClear;
+	pthread_mutex_unlock(&xEventGroup->lock);
+	return bits;
+}
+
+EventBits_t xEventGroupGetBits(EventGroupHandle_t xEventGroup)
+{
+	pthread_mutex_lock(&xEventGroup->lock);
+	EventBits_t bits = xEventGroup->bits;
+	pthread_mutex_unlock(&xEventGroup->lock);
+	return bits;
+}
+
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t xEventGroup, const EventBits_t uxBitsToWaitFor,
+		const BaseType_t xClearOnExit, const BaseType_t xWaitForAllBits, TickType_t xTicksToWait)
+{
+	struct timespec deadline;
+	shim_deadline(xTicksToWait, &deadline);
+	pthread_mutex_lock(&xEventGroup->lock);
+	for (;;) {
+		EventBits_t match = xEventGroup->bits & uxBitsToWaitFor;
+		bool done = xWaitForAllBits ? (match == uxBitsToWaitFor) : (match != 0);
+		if (done) {
+			EventBits_t bits = xEventGroup->bits;
+			if (xClearOnExit) xEventGroup->bits &= ~uxBitsToWaitFor;
+			pthread_mutex_unlock(&xEventGroup->lock);
+			return bits;
+		}
+		if (!shim_wait(&xEventGroup->changed, &xEventGroup->lock, xTicksToWait, &deadline)) break;
+	}
+	EventBits_t bits = xEventGroup->bits;
+	pthread_mutex_unlock(&xEventGroup->lock);
+	return bits;
+}
+
+/* message buffers */
+
+struct shim_message_buffer {
+	pthread_mutex_t lock;
+	pthread_cond_t changed;
+	size_t size;
+	size_t head;
+	size_t used;
+	uint8_t *data;
+};
+
+MessageBufferHandle_t xMessageBufferCreate(size_t xBufferSizeBytes)
+{
+	struct shim_message_buffer *mb = calloc(1, sizeof(struct shim_message_buffer));
+	if (mb == NULL) return NULL;
+	mb->data = malloc(xBufferSizeBytes);
+	if (mb->data == NULL) {
+		free(mb);
+		return NULL;
+	}
+	pthread_mutex_init(&mb->lock, NULL);
+	shim_cond_init(&mb->changed);
+	mb->size = xBufferSizeBytes;
+	return mb;
+}
+
+void vMessageBufferDelete(MessageBufferHandle_t xMessageBuffer)
+{
+	pthread_cond_destroy(&xMessageBuffer->changed);
+	pthread_mutex_destroy(&xMessageBuffer->lock);
+	free(xMessageBuffer->data);
+	free(xMessageBuffer);
+}
+
+static void mb_write(struct shim_message_buffer *mb, const void *src, size_t len)
+{
+	size_t tail = (mb->head + mb->used) % mb->size;
+	size_t first = mb->size - tail < len ? mb->size - tail : len;
+	memcpy(mb->data + tail, src, first);
+	memcpy(mb->data, (const uint8_t *)src + first, len - first);
+	mb->used += len;
+}
+
+static void mb_read(struct shim_message_buffer *mb, void *dst, size_t len, bool consume)
+{
+	size_t first = mb->size - mb->head < len ? mb->size - mb->head : len;
+	memcpy(dst, mb->data + mb->head, first);
+	memcpy((uint8_t *)dst + first, mb->data, len - first);
+	if (consume) {
+		mb->head = (mb->head + len) % mb->size;
+		mb->used -= len;
+	}
+}
+
+size_t xMessageBufferSend(MessageBufferHandle_t mb, const void *pvTxData, size_t xDataLengthBytes, TickType_t xTicksToWait)
+{
+	size_t need = xDataLengthBytes + sizeof(size_t);
+	if (need > mb->size) return 0;
+	struct timespec deadline;
+	shim_deadline(xTicksToWait, &deadline);
+	pthread_mutex_lock(&mb->lock);
+	while (mb->size - mb->used < need) {
+		if (!shim_wait(&mb->changed, &mb->lock, xTicksToWait, &deadline)) {
+			pthread_mutex_unlock(&mb->lock);
+			return 0;
+		}
+	}
+	mb_write(mb, &xDataLengthBytes, sizeof(size_t));
+	mb_write(mb, pvTxData, xDataLengthBytes);
+	pthread_cond_broadcast(&mb->changed);
+	pthread_mutex_unlock(&mb->lock);
+	return xDataLengthBytes;
+}
+
+size_t xMessageBufferReceive(MessageBufferHandle_t mb, void *pvRxData, size_t xBufferLengthBytes, TickType_t xTicksToWait)
+{
+	struct timespec deadline;
+	shim_deadline(xTicksToWait, &deadline);
+	pthread_mutex_lock(&mb->lock);
+	while (mb->used == 0) {
+		if (!shim_wait(&mb->changed, &mb->lock, xTicksToWait, &deadline)) {
+			pthread_mutex_unlock(&mb->lock);
+			return 0;
+		}
+	}
+	size_t len;
+	mb_read(mb, &len, sizeof(size_t), false);
+	if (len > xBufferLengthBytes) {
+		// as in FreeRTOS the message stays in the buffer
+		pthread_mutex_unlock(&mb->lock);
+		return 0;
+	}
+	mb_read(mb, &len, sizeof(size_t), true);
+	mb_read(mb, pvRxData, len, true);
+	pthread_cond_broadcast(&mb->changed);
+	pthread_mutex_unlock(&mb->lock);
+	return len;
+}
+
+size_t xMessageBufferSpaceAvailable(MessageBufferHandle_t mb)
+{
+	pthread_mutex_lock(&mb->lock);
+	size_t space = mb->size - mb->used;
+	pthread_mutex_unlock(&mb->lock);
+	return space > sizeof(size_t) ? space - sizeof(size_t) : 0;
+}
+
+BaseType_t xMessageBufferIsEmpty(MessageBufferHandle_t mb)
+{
+	pthread_mutex_lock(&mb->lock);
+	BaseType_t empty = mb->used == 0;
+	pthread_mutex_unlock(&mb->lock);
+	return empty;
+}
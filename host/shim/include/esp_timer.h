@@ -0,0 +1,6 @@
+#pragma once
+
+#include <stdint.h>
+
+/* microseconds since the process started, CLOCK_MONOTONIC */
+int64_t esp_timer_get_time(void);
@@ -0,0 +1,16 @@
+#pragma once
+
+#include "FreeRTOS.h"
+
+typedef struct shim_message_buffer *MessageBufferHandle_t;
+
+/* every message costs sizeof(size_t) bytes of length prefix, as in FreeRTOS */
+MessageBufferHandle_t xMessageBufferCreate(size_t xBufferSizeBytes);
+void vMessageBufferDelete(MessageBufferHandle_t xMessageBuffer);
+size_t xMessageBufferSend(MessageBufferHandle_t xMessageBuffer, const void *pvTxData, size_t xDataLengthBytes, TickType_t xTicksToWait);
+size_t xMessageBufferReceive(MessageBufferHandle_t xMessageBuffer, void *pvRxData, size_t xBufferLengthBytes, TickType_t xTicksToWait);
+size_t xMessageBufferSpaceAvailable(MessageBufferHandle_t xMessageBuffer);
+BaseType_t xMessageBufferIsEmpty(MessageBufferHandle_t xMessageBuffer);
+
+#define xMessageBufferSendFromISR(b, d, l, woken) xMessageBufferSend((b), (d), (l), 0)
+#define xMessageBufferReceiveFromISR(b, d, l, woken) xMessageBufferReceive((b), (d), (l), 0)
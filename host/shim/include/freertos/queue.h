@@ -0,0 +1,21 @@
+#pragma once
+
+#include "FreeRTOS.h"
+
+typedef struct shim_queue *QueueHandle_t;
+
+QueueHandle_t xQueueCreate(UBaseType_t uxQueueLength, UBaseType_t uxItemSize);
+void vQueueDelete(QueueHandle_t xQueue);
+BaseType_t xQueueGenericSend(QueueHandle_t xQueue, const void * const pvItemToQueue, TickType_t xTicksToWait, BaseType_t xFront);
+BaseType_t xQueueReceive(QueueHandle_t xQueue, void * const pvBuffer, TickType_t xTicksToWait);
+BaseType_t xQueuePeek(QueueHandle_t xQueue, void * const pvBuffer, TickType_t xTicksToWait);
+UBaseType_t uxQueueMessagesWaiting(const QueueHandle_t xQueue);
+UBaseType_t uxQueueSpacesAvailable(const QueueHandle_t xQueue);
+BaseType_t xQueueReset(QueueHandle_t xQueue);
+
+#define xQueueSend(q, item, ticks) xQueueGenericSend((q), (item), (ticks), pdFALSE)
+#define xQueueSendToBack(q, item, ticks) xQueueGenericSend((q), (item), (ticks), pdFALSE)
+#define xQueueSendToFront(q, item, ticks) xQueueGenericSend((q), (item), (ticks), pdTRUE)
+#define xQueueSendFromISR(q, item, woken) xQueueGenericSend((q), (item), 0, pdFALSE)
+#define xQueueSendToBackFromISR(q, item, woken) xQueueGenericSend((q), (item), 0, pdFALSE)
+#define xQueueReceiveFromISR(q, buf, woken) xQueueReceive((q), (buf), 0)
@@ -0,0 +1,17 @@
+#pragma once
+
+#include "queue.h"
+
+typedef QueueHandle_t SemaphoreHandle_t;
+
+/* semaphores are zero item size queues, as in FreeRTOS */
+SemaphoreHandle_t xSemaphoreCreateBinary(void);
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t uxMaxCount, UBaseType_t uxInitialCount);
+SemaphoreHandle_t xSemaphoreCreateMutex(void);
+BaseType_t xSemaphoreTake(SemaphoreHandle_t xSemaphore, TickType_t xBlockTime);
+BaseType_t xSemaphoreGive(SemaphoreHandle_t xSemaphore);
+
+#define vSemaphoreDelete(s) vQueueDelete(s)
+#define xSemaphoreGiveFromISR(s, woken) xSemaphoreGive(s)
+#define xSemaphoreTakeFromISR(s, woken) xSemaphoreTake((s), 0)
+#define xSemaphoreCreateRecursiveMutex() xSemaphoreCreateMutex()
@@ -0,0 +1,35 @@
+#pragma once
+
+#include "FreeRTOS.h"
+
+typedef struct shim_task *TaskHandle_t;
+typedef void (*TaskFunction_t)(void *);
+
+#define tskIDLE_PRIORITY ((UBaseType_t)0U)
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t pvTaskCode, const char * const pcName,
+		const uint32_t usStackDepth, void * const pvParameters, UBaseType_t uxPriority,
+		TaskHandle_t * const pvCreatedTask, const BaseType_t xCoreID);
+
+static inline BaseType_t xTaskCreate(TaskFunction_t pvTaskCode, const char * const pcName,
+		const uint32_t usStackDepth, void * const pvParameters, UBaseType_t uxPriority,
+		TaskHandle_t * const pvCreatedTask)
+{
+	return xTaskCreatePinnedToCore(pvTaskCode, pcName, usStackDepth, pvParameters, uxPriority, pvCreatedTask, tskNO_AFFINITY);
+}
+
+void vTaskDelete(TaskHandle_t xTaskToDelete);
+void vTaskDelay(const TickType_t xTicksToDelay);
+void vTaskDelayUntil(TickType_t * const pxPreviousWakeTime, const TickType_t xTimeIncrement);
+TickType_t xTaskGetTickCount(void);
+TaskHandle_t xTaskGetCurrentTaskHandle(void);
+char *pcTaskGetName(TaskHandle_t xTaskToQuery);
+#define pcTaskGetTaskName pcTaskGetName
+UBaseType_t uxTaskPriorityGet(TaskHandle_t xTask);
+BaseType_t xPortGetCoreID(void);
+void taskYIELD(void);
+
+/* direct to task notifications, the counting semaphore flavour */
+BaseType_t xTaskNotifyGive(TaskHandle_t xTaskToNotify);
+uint32_t ulTaskNotifyTake(BaseType_t xClearCountOnExit, TickType_t xTicksToWait);
+#define vTaskNotifyGiveFromISR(t, woken) ((void)(woken), xTaskNotifyGive(t))
@@ -0,0 +1,103 @@
+/*
+	 The lwIP netconn API on top of BSD sockets, for the host build.
+	 TCP and UDP, and only the calls ioto makes.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "lwip/err.h"
+
+#define NETCONN_NOFLAG    0x00
+#define NETCONN_NOCOPY    0x00
+#define NETCONN_COPY      0x01
+#define NETCONN_MORE      0x02
+#define NETCONN_DONTBLOCK 0x04
+
+enum netconn_type {
+	NETCONN_TCP = 0x10,
+	NETCONN_UDP = 0x20,
+};
+
+typedef struct {
+	uint32_t addr;
+} ip_addr_t;
+
+enum netconn_evt {
+	NETCONN_EVT_RCVPLUS,
+	NETCONN_EVT_RCVMINUS,
+	NETCONN_EVT_SENDPLUS,
+	NETCONN_EVT_SENDMINUS,
+	NETCONN_EVT_ERROR,
+};
+
+struct netconn;
+typedef void (*netconn_callback)(struct netconn *conn, enum netconn_evt evt, uint16_t len);
+
+/*
+	 The callback of an accepted TCP netconn gets NETCONN_EVT_RCVPLUS from a
+	 thread that polls the socket, once when data or the end of the stream
+	 is there and again after the next netconn_recv().
+*/
+struct netconn {
+	int fd;
+	enum netconn_type type;
+	int recv_timeout;
+	int send_timeout;
+	int send_timeout_set;	// the one the socket has
+	uint8_t nonblocking;
+	netconn_callback callback;
+	void *callback_arg;
+	int watch;				// its slot in the poll thread, -1 none
+};
+
+struct netvector {
+	const void *ptr;
+	size_t len;
+};
+
+struct netbuf {
+	void *data;
+	uint16_t len;
+	uint8_t ref;	// data belongs to the caller, see netbuf_ref()
+	ip_addr_t addr;	// sender of a received datagram
+	uint16_t port;
+};
+
+struct netconn *netconn_new(enum netconn_type type);
+err_t netconn_delete(struct netconn *conn);
+err_t netconn_bind(struct netconn *conn, const ip_addr_t *addr, uint16_t port);
+err_t netconn_listen(struct netconn *conn);
+err_t netconn_accept(struct netconn *conn, struct netconn **new_conn);
+err_t netconn_recv(struct netconn *conn, struct netbuf **new_buf);
+err_t netconn_write_partly(struct netconn *conn, const void *dataptr, size_t size, uint8_t apiflags, size_t *bytes_written);
+err_t netconn_write_vectors_partly(struct netconn *conn, struct netvector *vectors, uint16_t vectorcnt, uint8_t apiflags, size_t *bytes_written);
+err_t netconn_close(struct netconn *conn);
+err_t netconn_getaddr(struct netconn *conn, ip_addr_t *addr, uint16_t *port, uint8_t local);
+err_t netconn_connect(struct netconn *conn, const ip_addr_t *addr, uint16_t port);
+err_t netconn_send(struct netconn *conn, struct netbuf *buf);
+err_t netconn_sendto(struct netconn *conn, struct netbuf *buf, const ip_addr_t *addr, uint16_t port);
+
+#define netconn_write(conn, dataptr, size, apiflags) netconn_write_partly(conn, dataptr, size, apiflags, NULL)
+#define netconn_peer(c,i,p) netconn_getaddr(c,i,p,0)
+#define netconn_addr(c,i,p) netconn_getaddr(c,i,p,1)
+#define netconn_set_recvtimeout(conn, timeout) ((conn)->recv_timeout = (timeout))
+#define netconn_get_recvtimeout(conn) ((conn)->recv_timeout)
+#define netconn_set_sendtimeout(conn, timeout) ((conn)->send_timeout = (timeout))
+#define netconn_set_nonblocking(conn, val) ((conn)->nonblocking = (val))
+#define netconn_is_nonblocking(conn) ((conn)->nonblocking)
+
+struct netbuf *netbuf_new(void);
+err_t netbuf_ref(struct netbuf *buf, const void *dataptr, uint16_t size);
+err_t netbuf_data(struct netbuf *buf, void **dataptr, uint16_t *len);
+void netbuf_delete(struct netbuf *buf);
+// a received netbuf is one piece
+#define netbuf_first(buf) ((void)(buf))
+#define netbuf_next(buf) ((void)(buf), -1)
+#define netbuf_fromaddr(buf) (&(buf)->addr)
+#define netbuf_fromport(buf) ((buf)->port)
+
+/* lwip/ip_addr.h, IPv4 only */
+int ipaddr_aton(const char *cp, ip_addr_t *addr);
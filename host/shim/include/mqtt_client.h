@@ -0,0 +1,82 @@
+/*
+	 esp-mqtt client API for the host build.
+	 A small MQTT 3.1.1 client over TCP, QoS 0 and 1, no TLS.
+*/
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+typedef struct esp_mqtt_client *esp_mqtt_client_handle_t;
+
+typedef enum {
+	MQTT_EVENT_ANY = -1,
+	MQTT_EVENT_ERROR = 0,
+	MQTT_EVENT_CONNECTED,
+	MQTT_EVENT_DISCONNECTED,
+	MQTT_EVENT_SUBSCRIBED,
+	MQTT_EVENT_UNSUBSCRIBED,
+	MQTT_EVENT_PUBLISHED,
+	MQTT_EVENT_DATA,
+	MQTT_EVENT_BEFORE_CONNECT,
+} esp_mqtt_event_id_t;
+
+typedef enum {
+	MQTT_ERROR_TYPE_NONE = 0,
+	MQTT_ERROR_TYPE_TCP_TRANSPORT,
+	MQTT_ERROR_TYPE_CONNECTION_REFUSED,
+} esp_mqtt_error_type_t;
+
+typedef struct {
+	esp_err_t esp_tls_last_esp_err;
+	int esp_tls_stack_err;
+	int esp_tls_cert_verify_flags;
+	esp_mqtt_error_type_t error_type;
+	int connect_return_code;
+	int esp_transport_sock_errno;
+} esp_mqtt_error_codes_t;
+
+typedef struct {
+	esp_mqtt_event_id_t event_id;
+	esp_mqtt_client_handle_t client;
+	void *user_context;
+	char *data;
+	int data_len;
+	int total_data_len;
+	int current_data_offset;
+	char *topic;
+	int topic_len;
+	int msg_id;
+	int session_present;
+	esp_mqtt_error_codes_t *error_handle;
+	bool retain;
+	int qos;
+	bool dup;
+} esp_mqtt_event_t;
+
+typedef esp_mqtt_event_t *esp_mqtt_event_handle_t;
+typedef esp_err_t (*mqtt_event_callback_t)(esp_mqtt_event_handle_t event);
+
+typedef struct {
+	mqtt_event_callback_t event_handle;
+	const char *host;
+	const char *uri;
+	uint32_t port;
+	const char *client_id;
+	const char *username;
+	const char *password;
+	int keepalive;
+	int buffer_size;	// a message with more data comes in events of at most that much, 1024 by default
+	void *user_context;
+} esp_mqtt_client_config_t;
+
+esp_mqtt_client_handle_t esp_mqtt_client_init(const esp_mqtt_client_config_t *config);
+esp_err_t esp_mqtt_client_start(esp_mqtt_client_handle_t client);
+esp_err_t esp_mqtt_client_stop(esp_mqtt_client_handle_t client);
+esp_err_t esp_mqtt_client_disconnect(esp_mqtt_client_handle_t client);
+esp_err_t esp_mqtt_client_destroy(esp_mqtt_client_handle_t client);
+int esp_mqtt_client_subscribe(esp_mqtt_client_handle_t client, const char *topic, int qos);
+int esp_mqtt_client_unsubscribe(esp_mqtt_client_handle_t client, const char *topic);
+int esp_mqtt_client_publish(esp_mqtt_client_handle_t client, const char *topic, const char *data, int len, int qos, int retain);
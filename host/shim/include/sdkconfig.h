@@ -0,0 +1,52 @@
+/*
+	 sdkconfig.h for the host build.
+	 Mirrors the defaults of main/Kconfig.projbuild and
+	 components/websocket/Kconfig, with permessage-deflate on so the host
+	 build runs it.
+*/
+
+#pragma once
+
+#define CONFIG_IDF_TARGET "linux"
+#define CONFIG_IDF_TARGET_LINUX 1
+#define CONFIG_LOG_DEFAULT_LEVEL 3
+#ifndef CONFIG_FREERTOS_HZ
+#define CONFIG_FREERTOS_HZ 1000		// 100 is the default of ESP-IDF, see ioto_test_hz100
+#endif
+
+#define CONFIG_ESP_WIFI_SSID "myssid"
+#define CONFIG_ESP_WIFI_PASSWORD "mypassword"
+#define CONFIG_ESP_MAXIMUM_RETRY 5
+#define CONFIG_MDNS_HOSTNAME "esp32-server"
+#define CONFIG_NTP_SERVER "pool.ntp.org"
+#define CONFIG_LOCAL_TIMEZONE 0
+#define CONFIG_HTTP_PORT 8080
+#define CONFIG_ACQ_SAMPLE_RATE_HZ 1000
+#define CONFIG_ACQ_BLOCK_SAMPLES 64
+#define CONFIG_ACQ_RING_BLOCKS 16
+#define CONFIG_TRACE_LEVEL 3
+#define CONFIG_TRACE_RECORDS 256
+#define CONFIG_TRACE_ECHO_LEVEL 3
+#define CONFIG_CLOCKSYNC_PORT 3190
+#define CONFIG_CLOCKSYNC_MASTER ""
+#define CONFIG_CLOCKSYNC_INTERVAL_MS 1000
+#define CONFIG_CLOCKSYNC_STEP_US 1000
+#define CONFIG_WAVEGEN_DAC_CHANNEL 1
+#define CONFIG_WAVEGEN_RATE_HZ 100000
+#define CONFIG_WAVEGEN_BUFFER 1024
+#define CONFIG_HISTORY_SECONDS 10
+#define CONFIG_HISTORY_POINT_MS 10
+#define CONFIG_JSON_ARENA_SIZE 4096
+#define CONFIG_MQTT_TOPIC_ARENA_SIZE 4096
+#define CONFIG_MQTT_TRIGGER_TOPIC ""
+#define CONFIG_FLOW_TARGET_MS 500
+#define CONFIG_WEBSOCKET_SERVER_MAX_CLIENTS 20
+#define CONFIG_WEBSOCKET_SERVER_QUEUE_SIZE 10
+#define CONFIG_WEBSOCKET_SERVER_TASK_STACK_DEPTH 6000
+#define CONFIG_WEBSOCKET_SERVER_TASK_PRIORITY 5
+#define CONFIG_WEBSOCKET_SERVER_MAX_MESSAGE 8192
+#define CONFIG_WEBSOCKET_SERVER_SEND_TIMEOUT 2000
+#define CONFIG_WEBSOCKET_SERVER_PING_INTERVAL 10000
+#define CONFIG_WEBSOCKET_SERVER_PONG_TIMEOUT 5000
+#define CONFIG_WEBSOCKET_SERVER_DEFLATE 1
+#define CONFIG_WEBSOCKET_SERVER_DEFLATE_MIN 256
@@ -0,0 +1,420 @@
+/*
+	 esp-mqtt client API for the host build: MQTT 3.1.1 over a TCP socket.
+
+	 esp_mqtt_client_start() spawns a thread that connects, then reads
+	 packets and turns them into events for the configured handler, the same
+	 way the esp-mqtt task does on the board.
+*/
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <netdb.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include "esp_log.h"
+#include "mqtt_client.h"
+
+#define MQTT_CONNECT     0x10
+#define MQTT_CONNACK     0x20
+#define MQTT_PUBLISH     0x30
+#define MQTT_PUBACK      0x40
+#define MQTT_SUBSCRIBE   0x82
+#define MQTT_SUBACK      0x90
+#define MQTT_UNSUBSCRIBE 0xA2
+#define MQTT_UNSUBACK    0xB0
+#define MQTT_PINGREQ     0xC0
+#define MQTT_PINGRESP    0xD0
+#define MQTT_DISCONNECT  0xE0
+
+static const char *TAG = "MQTT_CLIENT";
+
+struct esp_mqtt_client {
+	esp_mqtt_client_config_t config;
+	char host[128];
+	char *client_id;
+	char *username;
+	char *password;
+	int fd;
+	bool running;
+	bool connected;
+	pthread_t thread;
+	pthread_mutex_t write_lock;
+	int next_msg_id;
+	esp_mqtt_error_codes_t error;
+};
+
+static char *dup_or_null(const char *s)
+{
+	return s ? strdup(s) : NULL;
+}
+
+static void dispatch(esp_mqtt_client_handle_t client, esp_mqtt_event_t *event)
+{
+	event->client = client;
+	event->user_context = client->config.user_context;
+	event->error_handle = &client->error;
+	if (client->config.event_handle) client->config.event_handle(event);
+}
+
+static void dispatch_simple(esp_mqtt_client_handle_t client, esp_mqtt_event_id_t id, int msg_id)
+{
+	esp_mqtt_event_t event = { .event_id = id, .msg_id = msg_id };
+	dispatch(client, &event);
+}
+
+static void transport_error(esp_mqtt_client_handle_t client, int sock_errno)
+{
+	client->error.error_type = MQTT_ERROR_TYPE_TCP_TRANSPORT;
+	client->error.esp_transport_sock_errno = sock_errno;
+	dispatch_simple(client, MQTT_EVENT_ERROR, -1);
+}
+
+static int write_all(esp_mqtt_client_handle_t client, const uint8_t *buf, size_t len)
+{
+	pthread_mutex_lock(&client->write_lock);
+	size_t done = 0;
+	while (done < len) {
+		ssize_t n = send(client->fd, buf + done, len - done, MSG_NOSIGNAL);
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			pthread_mutex_unlock(&client->write_lock);
+			return -1;
+		}
+		done += n;
+	}
+	pthread_mutex_unlock(&client->write_lock);
+	return 0;
+}
+
+static int read_all(int fd, uint8_t *buf, size_t len)
+{
+	size_t done = 0;
+	while (done < len) {
+		ssize_t n = recv(fd, buf + done, len - done, 0);
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) return -1;
+		done += n;
+	}
+	return 0;
+}
+
+static size_t put_remaining_length(uint8_t *p, size_t len)
+{
+	size_t i = 0;
+	do {
+		uint8_t byte = len % 128;
+		len /= 128;
+		if (len) byte |= 0x80;
+		p[i++] = byte;
+	} while (len);
+	return i;
+}
+
+static size_t put_string(uint8_t *p, const char *s, size_t len)
+{
+	p[0] = len >> 8;
+	p[1] = len & 0xff;
+	memcpy(p + 2, s, len);
+	return len + 2;
+}
+
+// builds header + body and sends it in one write
+static int send_packet(esp_mqtt_client_handle_t client, uint8_t type, const uint8_t *body, size_t body_len)
+{
+	uint8_t *packet = malloc(body_len + 5);
+	if (packet == NULL) return -1;
+	packet[0] = type;
+	size_t header_len = 1 + put_remaining_length(packet + 1, body_len);
+	memcpy(packet + header_len, body, body_len);
+	int ret = write_all(client, packet, header_len + body_len);
+	free(packet);
+	return ret;
+}
+
+static int next_msg_id(esp_mqtt_client_handle_t client)
+{
+	pthread_mutex_lock(&client->write_lock);
+	client->next_msg_id = client->next_msg_id % 65535 + 1;
+	int msg_id = client->next_msg_id;
+	pthread_mutex_unlock(&client->write_lock);
+	return msg_id;
+}
+
+static int mqtt_connect(esp_mqtt_client_handle_t client)
+{
+	char port[12];
+	snprintf(port, sizeof(port), "%u", client->config.port ? client->config.port : 1883);
+	struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM };
+	struct addrinfo *res;
+	if (getaddrinfo(client->host, port, &hints, &res) != 0) return EHOSTUNREACH;
+	int err = ECONNREFUSED;
+	for (struct addrinfo *ai = res; ai; ai = ai->ai_next) {
+		int fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+		if (fd < 0) continue;
+		if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+			int one = 1;
+			setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+			client->fd = fd;
+			err = 0;
+			break;
+		}
+		err = errno;
+		close(fd);
+	}
+	freeaddrinfo(res);
+	if (err) return err;
+
+	const char *client_id = client->client_id ? client->client_id : "";
+	size_t len = strlen(client_id);
+	uint8_t body[512];
+	size_t n = put_string(body, "MQTT", 4);
+	body[n++] = 4;	// protocol level 3.1.1
+	uint8_t flags = 0x02;	// clean session
+	if (client->username) flags |= 0x80;
+	if (client->password) flags |= 0x40;
+	body[n++] = flags;
+	body[n++] = client->config.keepalive >> 8;
+	body[n++] = client->config.keepalive & 0xff;
+	n += put_string(body + n, client_id, len);
+	if (client->username) n += put_string(body + n, client->username, strlen(client->username));
+	if (client->password) n += put_string(body + n, client->password, strlen(client->password));
+	if (send_packet(client, MQTT_CONNECT, body, n) < 0) return errno;
+
+	uint8_t connack[4];
+	if (read_all(client->fd, connack, sizeof(connack)) < 0) return ECONNRESET;
+	if ((connack[0] & 0xf0) != MQTT_CONNACK || connack[3] != 0) {
+		client->error.error_type = MQTT_ERROR_TYPE_CONNECTION_REFUSED;
+		client->error.connect_return_code = connack[3];
+		return ECONNREFUSED;
+	}
+	return 0;
+}
+
+static void handle_packet(esp_mqtt_client_handle_t client, uint8_t type, uint8_t *body, size_t len)
+{
+	switch (type & 0xf0) {
+		case MQTT_PUBLISH: {
+			if (len < 2) return;
+			int qos = (type >> 1) & 3;
+			size_t topic_len = (body[0] << 8) | body[1];
+			size_t offset = 2 + topic_len;
+			int msg_id = 0;
+			if (qos) {
+				msg_id = (body[offset] << 8) | body[offset + 1];
+				offset += 2;
+			}
+			if (offset > len) return;
+			// like esp-mqtt: data longer than the buffer comes in parts, the topic with the first
+			int total = len - offset;
+			int part = client->config.buffer_size;
+			for (int at = 0; at == 0 || at < total; at += part) {
+				esp_mqtt_event_t event = {
+					.event_id = MQTT_EVENT_DATA,
+					.topic = at == 0 ? (char *)body + 2 : NULL,
+					.topic_len = at == 0 ? topic_len : 0,
+					.data = (char *)body + offset + at,
+					.data_len = total - at < part ? total - at : part,
+					.total_data_len = total,
+					.current_data_offset = at,
+					.msg_id = msg_id,
+					.qos = qos,
+					.retain = type & 1,
+				};
+				dispatch(client, &event);
+			}
+			if (qos == 1) {
+				uint8_t ack[2] = { msg_id >> 8, msg_id & 0xff };
+				send_packet(client, MQTT_PUBACK, ack, 2);
+			}
+			break;
+		}
+		case MQTT_PUBACK:
+			dispatch_simple(client, MQTT_EVENT_PUBLISHED, len >= 2 ? (body[0] << 8) | body[1] : 0);
+			break;
+		case MQTT_SUBACK:
+			dispatch_simple(client, MQTT_EVENT_SUBSCRIBED, len >= 2 ? (body[0] << 8) | body[1] : 0);
+			break;
+		case MQTT_UNSUBACK:
+			dispatch_simple(client, MQTT_EVENT_UNSUBSCRIBED, len >= 2 ? (body[0] << 8) | body[1] : 0);
+			break;
+		default:
+			break;
+	}
+}
+
+static void *mqtt_task(void *arg)
+{
+	esp_mqtt_client_handle_t client = arg;
+	int err = mqtt_connect(client);
+	if (err) {
+		ESP_LOGE(TAG, "connect to %s failed: %s", client->host, strerror(err));
+		if (client->fd >= 0) close(client->fd);
+		client->fd = -1;
+		transport_error(client, err);
+		client->running = false;
+		return NULL;
+	}
+	client->connected = true;
+	dispatch_simple(client, MQTT_EVENT_CONNECTED, 0);
+
+	int keepalive_ms = client->config.keepalive * 1000 / 2;
+	uint8_t *body = NULL;
+	while (client->running) {
+		struct pollfd pfd = { .fd = client->fd, .events = POLLIN };
+		int ready = poll(&pfd, 1, keepalive_ms);
+		if (ready == 0) {
+			send_packet(client, MQTT_PINGREQ, NULL, 0);
+			continue;
+		}
+		if (ready < 0 && errno == EINTR) continue;
+
+		uint8_t type;
+		if (read_all(client->fd, &type, 1) < 0) break;
+		size_t len = 0;
+		int shift = 0;
+		uint8_t byte;
+		do {
+			if (read_all(client->fd, &byte, 1) < 0) goto closed;
+			len |= (size_t)(byte & 0x7f) << shift;
+			shift += 7;
+		} while ((byte & 0x80) && shift < 28);
+		// one spare byte so topic and data can be printed as strings
+		body = realloc(body, len + 1);
+		if (len && read_all(client->fd, body, len) < 0) break;
+		body[len] = 0;
+		handle_packet(client, type, body, len);
+	}
+closed:
+	free(body);
+	client->connected = false;
+	close(client->fd);
+	client->fd = -1;
+	dispatch_simple(client, MQTT_EVENT_DISCONNECTED, 0);
+	return NULL;
+}
+
+esp_mqtt_client_handle_t esp_mqtt_client_init(const esp_mqtt_client_config_t *config)
+{
+	esp_mqtt_client_handle_t client = calloc(1, sizeof(struct esp_mqtt_client));
+	if (client == NULL) return NULL;
+	client->config = *config;
+	if (client->config.keepalive == 0) client->config.keepalive = 120;
+	if (client->config.buffer_size <= 0) client->config.buffer_size = 1024;
+	const char *host = config->host;
+	if (config->uri) {
+		host = strstr(config->uri, "://");
+		host = host ? host + 3 : config->uri;
+	}
+	snprintf(client->host, sizeof(client->host), "%s", host ? host : "localhost");
+	char *colon = strchr(client->host, ':');
+	if (colon) {
+		if (client->config.port == 0) client->config.port = atoi(colon + 1);
+		*colon = 0;
+	}
+	client->client_id = dup_or_null(config->client_id);
+	client->username = dup_or_null(config->username);
+	client->password = dup_or_null(config->password);
+	client->fd = -1;
+	pthread_mutex_init(&client->write_lock, NULL);
+	return client;
+}
+
+esp_err_t esp_mqtt_client_start(esp_mqtt_client_handle_t client)
+{
+	if (client->running) return ESP_FAIL;
+	client->running = true;
+	if (pthread_create(&client->thread, NULL, mqtt_task, client) != 0) {
+		client->running = false;
+		return ESP_FAIL;
+	}
+	return ESP_OK;
+}
+
+esp_err_t esp_mqtt_client_disconnect(esp_mqtt_client_handle_t client)
+{
+	if (!client->connected) return ESP_FAIL;
+	send_packet(client, MQTT_DISCONNECT, NULL, 0);
+	shutdown(client->fd, SHUT_RDWR);
+	return ESP_OK;
+}
+
+esp_err_t esp_mqtt_client_stop(esp_mqtt_client_handle_t client)
+{
+	if (client->thread == 0) return ESP_FAIL;
+	client->running = false;
+	if (client->connected) esp_mqtt_client_disconnect(client);
+	if (!pthread_equal(client->thread, pthread_self())) pthread_join(client->thread, NULL);
+	client->thread = 0;
+	return ESP_OK;
+}
+
+esp_err_t esp_mqtt_client_destroy(esp_mqtt_client_handle_t client)
+{
+	if (client == NULL) return ESP_ERR_INVALID_ARG;
+	esp_mqtt_client_stop(client);
+	free(client->client_id);
+	free(client->username);
+	free(client->password);
+	free(client);
+	return ESP_OK;
+}
+
+int esp_mqtt_client_subscribe(esp_mqtt_client_handle_t client, const char *topic, int qos)
+{
+	if (!client->connected) return -1;
+	size_t len = strlen(topic);
+	uint8_t *body = malloc(len + 5);
+	if (body == NULL) return -1;
+	int msg_id = next_msg_id(client);
+	body[0] = msg_id >> 8;
+	body[1] = msg_id & 0xff;
+	size_t n = 2 + put_string(body + 2, topic, len);
+	body[n++] = qos;
+	int ret = send_packet(client, MQTT_SUBSCRIBE, body, n);
+	free(body);
+	return ret < 0 ? -1 : msg_id;
+}
+
+int esp_mqtt_client_unsubscribe(esp_mqtt_client_handle_t client, const char *topic)
+{
+	if (!client->connected) return -1;
+	size_t len = strlen(topic);
+	uint8_t *body = malloc(len + 4);
+	if (body == NULL) return -1;
+	int msg_id = next_msg_id(client);
+	body[0] = msg_id >> 8;
+	body[1] = msg_id & 0xff;
+	size_t n = 2 + put_string(body + 2, topic, len);
+	int ret = send_packet(client, MQTT_UNSUBSCRIBE, body, n);
+	free(body);
+	return ret < 0 ? -1 : msg_id;
+}
+
+int esp_mqtt_client_publish(esp_mqtt_client_handle_t client, const char *topic, const char *data, int len, int qos, int retain)
+{
+	if (!client->connected) return -1;
+	if (len == 0 && data) len = strlen(data);
+	size_t topic_len = strlen(topic);
+	uint8_t *body = malloc(topic_len + len + 4);
+	if (body == NULL) return -1;
+	size_t n = put_string(body, topic, topic_len);
+	int msg_id = 0;
+	if (qos) {
+		msg_id = next_msg_id(client);
+		body[n++] = msg_id >> 8;
+		body[n++] = msg_id & 0xff;
+	}
+	memcpy(body + n, data, len);
+	n += len;
+	int ret = send_packet(client, MQTT_PUBLISH | (qos << 1) | (retain ? 1 : 0), body, n);
+	free(body);
+	return ret < 0 ? -1 : msg_id;
+}
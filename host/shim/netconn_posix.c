@@ -0,0 +1,385 @@
+/*
+	 lwIP netconn API on top of BSD sockets, for the host build.
+*/
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+
+#include "lwip/api.h"
+
+#define NETBUF_SIZE 2048
+
+static err_t errno_to_err(int err)
+{
+	switch (err) {
+		case EAGAIN: return ERR_TIMEOUT;
+		case ENOMEM: return ERR_MEM;
+		case ECONNRESET: return ERR_RST;
+		case EPIPE: return ERR_CLSD;
+		case EADDRINUSE: return ERR_USE;
+		case ENOTCONN: return ERR_CONN;
+		default: return ERR_ARG;
+	}
+}
+
+static struct netconn *netconn_wrap(int fd, enum netconn_type type)
+{
+	struct netconn *conn = calloc(1, sizeof(struct netconn));
+	if (conn == NULL) return NULL;
+	conn->fd = fd;
+	conn->type = type;
+	conn->watch = -1;
+	return conn;
+}
+
+/*
+	 The event callbacks: one thread polls the accepted TCP netconns that
+	 have a callback and are armed, calls it and disarms them until the
+	 next netconn_recv(). It looks at the table again every WATCH_MS, for
+	 callbacks set in the meantime.
+*/
+
+#define WATCH_MAX 64
+#define WATCH_MS 20
+
+static struct {
+	struct netconn *conn;
+	bool armed;
+} watch[WATCH_MAX];
+static pthread_mutex_t watch_lock = PTHREAD_MUTEX_INITIALIZER;
+static int wake_pipe[2] = { -1, -1 };
+
+static void watch_wake(void)
+{
+	char c = 0;
+	if (wake_pipe[1] >= 0) (void)!write(wake_pipe[1], &c, 1);
+}
+
+static void *watch_thread(void *arg)
+{
+	struct pollfd pfd[WATCH_MAX + 1];
+	int slot[WATCH_MAX + 1];
+	struct netconn *conns[WATCH_MAX + 1];
+	for (;;) {
+		int n = 0;
+		pfd[n++] = (struct pollfd) { .fd = wake_pipe[0], .events = POLLIN };
+		pthread_mutex_lock(&watch_lock);
+		for (int i = 0; i < WATCH_MAX; i++) {
+			struct netconn *conn = watch[i].conn;
+			if (conn == NULL || conn->callback == NULL || !watch[i].armed) continue;
+			slot[n] = i;
+			conns[n] = conn;
+			pfd[n++] = (struct pollfd) { .fd = conn->fd, .events = POLLIN };
+		}
+		pthread_mutex_unlock(&watch_lock);
+		if (poll(pfd, n, WATCH_MS) <= 0) continue;
+		if (pfd[0].revents) {
+			char buf[64];
+			(void)!read(wake_pipe[0], buf, sizeof(buf));
+		}
+		pthread_mutex_lock(&watch_lock);
+		for (int k = 1; k < n; k++) {
+			// gone while polled
+			if (pfd[k].revents == 0 || watch[slot[k]].conn != conns[k] || !watch[slot[k]].armed) continue;
+			watch[slot[k]].armed = false;
+			netconn_callback callback = conns[k]->callback;
+			if (callback) callback(conns[k], NETCONN_EVT_RCVPLUS, 0);
+		}
+		pthread_mutex_unlock(&watch_lock);
+	}
+	return NULL;
+}
+
+static void watch_start(void)
+{
+	pthread_t thread;
+	if (pipe(wake_pipe) == 0) pthread_create(&thread, NULL, watch_thread, NULL);
+}
+
+static void watch_add(struct netconn *conn)
+{
+	static pthread_once_t once = PTHREAD_ONCE_INIT;
+	pthread_once(&once, watch_start);
+	pthread_mutex_lock(&watch_lock);
+	for (int i = 0; i < WATCH_MAX; i++) {
+		if (watch[i].conn == NULL) {
+			watch[i].conn = conn;
+			watch[i].armed = true;
+			conn->watch = i;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&watch_lock);
+}
+
+static void watch_arm(struct netconn *conn, bool armed)
+{
+	if (conn->watch < 0) return;
+	pthread_mutex_lock(&watch_lock);
+	if (armed) watch[conn->watch].armed = true;
+	else watch[conn->watch].conn = NULL;
+	pthread_mutex_unlock(&watch_lock);
+	if (armed) watch_wake();
+}
+
+struct netconn *netconn_new(enum netconn_type type)
+{
+	int fd = socket(AF_INET, type == NETCONN_UDP ? SOCK_DGRAM : SOCK_STREAM, 0);
+	if (fd < 0) return NULL;
+	int one = 1;
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	return netconn_wrap(fd, type);
+}
+
+err_t netconn_delete(struct netconn *conn)
+{
+	if (conn == NULL) return ERR_OK;
+	watch_arm(conn, false);
+	if (conn->fd >= 0) close(conn->fd);
+	free(conn);
+	return ERR_OK;
+}
+
+err_t netconn_bind(struct netconn *conn, const ip_addr_t *addr, uint16_t port)
+{
+	struct sockaddr_in sin = {
+		.sin_family = AF_INET,
+		.sin_port = htons(port),
+		.sin_addr.s_addr = addr ? addr->addr : htonl(INADDR_ANY),
+	};
+	if (bind(conn->fd, (struct sockaddr *)&sin, sizeof(sin)) < 0) return errno_to_err(errno);
+	return ERR_OK;
+}
+
+err_t netconn_listen(struct netconn *conn)
+{
+	if (listen(conn->fd, 16) < 0) return errno_to_err(errno);
+	return ERR_OK;
+}
+
+err_t netconn_accept(struct netconn *conn, struct netconn **new_conn)
+{
+	int fd;
+	do {
+		fd = accept(conn->fd, NULL, NULL);
+	} while (fd < 0 && errno == EINTR);
+	if (fd < 0) return errno_to_err(errno);
+	int one = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	*new_conn = netconn_wrap(fd, NETCONN_TCP);
+	if (*new_conn == NULL) return ERR_MEM;
+	watch_add(*new_conn);
+	return ERR_OK;
+}
+
+err_t netconn_recv(struct netconn *conn, struct netbuf **new_buf)
+{
+	*new_buf = NULL;
+	if (conn->nonblocking) {
+		struct pollfd pfd = { .fd = conn->fd, .events = POLLIN };
+		if (poll(&pfd, 1, 0) == 0) {
+			watch_arm(conn, true);
+			return ERR_WOULDBLOCK;
+		}
+	} else if (conn->recv_timeout > 0) {
+		struct pollfd pfd = { .fd = conn->fd, .events = POLLIN };
+		int ready;
+		do {
+			ready = poll(&pfd, 1, conn->recv_timeout);
+		} while (ready < 0 && errno == EINTR);
+		if (ready == 0) return ERR_TIMEOUT;
+	}
+
+	struct netbuf *buf = calloc(1, sizeof(struct netbuf));
+	if (buf == NULL) return ERR_MEM;
+	// one spare byte so the data is always NUL terminated
+	buf->data = malloc(NETBUF_SIZE + 1);
+	if (buf->data == NULL) {
+		free(buf);
+		return ERR_MEM;
+	}
+	ssize_t len;
+	struct sockaddr_in from;
+	socklen_t from_len = sizeof(from);
+	do {
+		len = recvfrom(conn->fd, buf->data, NETBUF_SIZE, 0, (struct sockaddr *)&from, &from_len);
+	} while (len < 0 && errno == EINTR);
+	watch_arm(conn, true);
+	if (len <= 0) {
+		netbuf_delete(buf);
+		return len == 0 ? ERR_CLSD : errno_to_err(errno);
+	}
+	((char *)buf->data)[len] = 0;
+	buf->len = (uint16_t)len;
+	if (conn->type == NETCONN_UDP && from_len == sizeof(from)) {
+		buf->addr.addr = from.sin_addr.s_addr;
+		buf->port = ntohs(from.sin_port);
+	}
+	*new_buf = buf;
+	return ERR_OK;
+}
+
+err_t netconn_write_partly(struct netconn *conn, const void *dataptr, size_t size, uint8_t apiflags, size_t *bytes_written)
+{
+	size_t done = 0;
+	int flags = MSG_NOSIGNAL | ((apiflags & NETCONN_MORE) ? MSG_MORE : 0);
+	while (done < size) {
+		ssize_t sent = send(conn->fd, (const uint8_t *)dataptr + done, size - done, flags);
+		if (sent < 0) {
+			if (errno == EINTR) continue;
+			if (bytes_written) *bytes_written = done;
+			return errno_to_err(errno);
+		}
+		done += sent;
+	}
+	if (bytes_written) *bytes_written = done;
+	return ERR_OK;
+}
+
+// header and payload in one go, like lwIP without the copy into pbufs
+err_t netconn_write_vectors_partly(struct netconn *conn, struct netvector *vectors, uint16_t vectorcnt, uint8_t apiflags, size_t *bytes_written)
+{
+	if (conn->send_timeout != conn->send_timeout_set) {
+		struct timeval tv = { .tv_sec = conn->send_timeout / 1000, .tv_usec = (conn->send_timeout % 1000) * 1000 };
+		setsockopt(conn->fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+		conn->send_timeout_set = conn->send_timeout;
+	}
+	struct iovec iov[vectorcnt];
+	size_t size = 0;
+	for (int i = 0; i < vectorcnt; i++) {
+		iov[i] = (struct iovec) { .iov_base = (void *)vectors[i].ptr, .iov_len = vectors[i].len };
+		size += vectors[i].len;
+	}
+	struct msghdr msg = { .msg_iov = iov, .msg_iovlen = vectorcnt };
+	int flags = MSG_NOSIGNAL | ((apiflags & NETCONN_MORE) ? MSG_MORE : 0) | (conn->nonblocking ? MSG_DONTWAIT : 0);
+	size_t done = 0;
+	while (done < size) {
+		ssize_t sent = sendmsg(conn->fd, &msg, flags);
+		if (sent < 0) {
+			if (errno == EINTR) continue;
+			if (bytes_written) *bytes_written = done;
+			// a send timeout or a full buffer without blocking: what went out counts
+			if ((errno == EAGAIN || errno == EWOULDBLOCK) && done > 0) return ERR_OK;
+			return errno == EAGAIN || errno == EWOULDBLOCK ? ERR_WOULDBLOCK : errno_to_err(errno);
+		}
+		done += sent;
+		// past what went out
+		while (msg.msg_iovlen && (size_t)sent >= msg.msg_iov->iov_len) {
+			sent -= msg.msg_iov->iov_len;
+			msg.msg_iov++;
+			msg.msg_iovlen--;
+		}
+		if (msg.msg_iovlen) {
+			msg.msg_iov->iov_base = (uint8_t *)msg.msg_iov->iov_base + sent;
+			msg.msg_iov->iov_len -= sent;
+		}
+	}
+	if (bytes_written) *bytes_written = done;
+	return ERR_OK;
+}
+
+err_t netconn_close(struct netconn *conn)
+{
+	if (conn == NULL) return ERR_ARG;
+	shutdown(conn->fd, SHUT_RDWR);
+	return ERR_OK;
+}
+
+err_t netconn_getaddr(struct netconn *conn, ip_addr_t *addr, uint16_t *port, uint8_t local)
+{
+	struct sockaddr_in sin;
+	socklen_t sin_len = sizeof(sin);
+	int ret = local ? getsockname(conn->fd, (struct sockaddr *)&sin, &sin_len)
+		: getpeername(conn->fd, (struct sockaddr *)&sin, &sin_len);
+	if (ret < 0) return errno_to_err(errno);
+	if (addr) addr->addr = sin.sin_addr.s_addr;
+	if (port) *port = ntohs(sin.sin_port);
+	return ERR_OK;
+}
+
+err_t netconn_connect(struct netconn *conn, const ip_addr_t *addr, uint16_t port)
+{
+	struct sockaddr_in sin = {
+		.sin_family = AF_INET,
+		.sin_port = htons(port),
+		.sin_addr.s_addr = addr->addr,
+	};
+	if (connect(conn->fd, (struct sockaddr *)&sin, sizeof(sin)) < 0) return errno_to_err(errno);
+	return ERR_OK;
+}
+
+// one datagram on a connected UDP netconn
+err_t netconn_send(struct netconn *conn, struct netbuf *buf)
+{
+	ssize_t sent;
+	do {
+		sent = send(conn->fd, buf->data, buf->len, MSG_NOSIGNAL | MSG_DONTWAIT);
+	} while (sent < 0 && errno == EINTR);
+	if (sent < 0) return errno == EAGAIN || errno == ENOBUFS ? ERR_MEM : errno_to_err(errno);
+	return ERR_OK;
+}
+
+// one datagram to addr:port on an unconnected UDP netconn
+err_t netconn_sendto(struct netconn *conn, struct netbuf *buf, const ip_addr_t *addr, uint16_t port)
+{
+	struct sockaddr_in sin = {
+		.sin_family = AF_INET,
+		.sin_port = htons(port),
+		.sin_addr.s_addr = addr->addr,
+	};
+	ssize_t sent;
+	do {
+		sent = sendto(conn->fd, buf->data, buf->len, MSG_NOSIGNAL | MSG_DONTWAIT, (struct sockaddr *)&sin, sizeof(sin));
+	} while (sent < 0 && errno == EINTR);
+	if (sent < 0) return errno == EAGAIN || errno == ENOBUFS ? ERR_MEM : errno_to_err(errno);
+	return ERR_OK;
+}
+
+struct netbuf *netbuf_new(void)
+{
+	return calloc(1, sizeof(struct netbuf));
+}
+
+err_t netbuf_ref(struct netbuf *buf, const void *dataptr, uint16_t size)
+{
+	if (buf == NULL) return ERR_ARG;
+	if (!buf->ref) free(buf->data);
+	buf->data = (void *)dataptr;
+	buf->len = size;
+	buf->ref = 1;
+	return ERR_OK;
+}
+
+err_t netbuf_data(struct netbuf *buf, void **dataptr, uint16_t *len)
+{
+	if (buf == NULL) return ERR_ARG;
+	*dataptr = buf->data;
+	*len = buf->len;
+	return ERR_OK;
+}
+
+void netbuf_delete(struct netbuf *buf)
+{
+	if (buf == NULL) return;
+	if (!buf->ref) free(buf->data);
+	free(buf);
+}
+
+int ipaddr_aton(const char *cp, ip_addr_t *addr)
+{
+	struct in_addr in;
+	if (inet_aton(cp, &in) == 0) return 0;
+	addr->addr = in.s_addr;
+	return 1;
+}
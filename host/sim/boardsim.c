@@ -0,0 +1,77 @@
+/*
+	 The UDP streams of synthetic boards, see boardsim.h
+
+	 The signal repeats after CYCLE_BLOCKS blocks, so the datagrams are
+	 encoded once; the number of the datagram, the seq and the time of the
+	 block are patched in when one is asked for.
+*/
+
+#include <math.h>
+
+#include "codec.h"
+#include "protocol.h"
+#include "udp_stream.h"
+#include "boardsim.h"
+
+#define CYCLE_BLOCKS 16
+#define CYCLE (CYCLE_BLOCKS * BOARDSIM_BLOCK)
+#define DATAGRAM_MAX (UDP_STREAM_HEADER_SIZE + PROTOCOL_FRAME_HEADER_SIZE + CODEC_MAX_SIZE(BOARDSIM_BLOCK))
+
+static uint16_t signal_raw[CYCLE];
+static uint8_t datagrams[BOARDSIM_BOARDS][BOARDSIM_CHANNELS][CYCLE_BLOCKS][DATAGRAM_MAX];
+static uint16_t datagram_len[BOARDSIM_BOARDS][BOARDSIM_CHANNELS][CYCLE_BLOCKS];
+
+static void put_u32(uint8_t *p, uint32_t v)
+{
+	for (int i = 0; i < 4; i++) p[i] = v >> (8 * i);
+}
+
+uint16_t boardsim_sample(int board, int channel, uint64_t k)
+{
+	return signal_raw[(k + board * 37 + channel * 101) % CYCLE];
+}
+
+int boardsim_init(void)
+{
+	uint32_t r = 1;
+	for (int i = 0; i < CYCLE; i++) {
+		r = r * 1103515245u + 12345u;
+		signal_raw[i] = 4096 + (int)(1500 * sin(2 * M_PI * 2 * i / CYCLE)) + (int)((r >> 16) % 7) - 3;
+	}
+	for (int b = 0; b < BOARDSIM_BOARDS; b++) {
+		for (int ch = 0; ch < BOARDSIM_CHANNELS; ch++) {
+			for (int c = 0; c < CYCLE_BLOCKS; c++) {
+				uint16_t raw[BOARDSIM_BLOCK];
+				for (int i = 0; i < BOARDSIM_BLOCK; i++) raw[i] = boardsim_sample(b, ch, (uint64_t)c * BOARDSIM_BLOCK + i);
+				uint8_t *d = datagrams[b][ch][c];
+				protocol_put_frame_header(d + UDP_STREAM_HEADER_SIZE, &(STREAM_FRAME_t) {
+					.channel = ch, .bits = BOARDSIM_BITS, .period_us = BOARDSIM_PERIOD_US, .mv_per_lsb = 2500.0f / 8191,
+				});
+				int len = codec_encode(CODEC_RICE, raw, BOARDSIM_BLOCK, BOARDSIM_BITS,
+					d + UDP_STREAM_HEADER_SIZE + PROTOCOL_FRAME_HEADER_SIZE, CODEC_MAX_SIZE(BOARDSIM_BLOCK));
+				if (len < 0) return -1;
+				datagram_len[b][ch][c] = UDP_STREAM_HEADER_SIZE + PROTOCOL_FRAME_HEADER_SIZE + len;
+			}
+		}
+	}
+	return 0;
+}
+
+const uint8_t *boardsim_datagram(int board, uint64_t step, size_t *len)
+{
+	int channel = step % BOARDSIM_CHANNELS;
+	uint64_t seq = step / BOARDSIM_CHANNELS;
+	uint8_t *d = datagrams[board][channel][seq % CYCLE_BLOCKS];
+	put_u32(d, step);
+	put_u32(d + UDP_STREAM_HEADER_SIZE + 4, seq);
+	int64_t t0_us = seq * BOARDSIM_BLOCK * BOARDSIM_PERIOD_US;
+	put_u32(d + UDP_STREAM_HEADER_SIZE + 20, t0_us);
+	put_u32(d + UDP_STREAM_HEADER_SIZE + 24, t0_us >> 32);
+	*len = datagram_len[board][channel][seq % CYCLE_BLOCKS];
+	return d;
+}
+
+uint64_t boardsim_swapped(uint64_t k)
+{
+	return k % BOARDSIM_SWAP == 0 ? k + 1 : k % BOARDSIM_SWAP == 1 ? k - 1 : k;
+}
@@ -0,0 +1,40 @@
+/*
+	 The UDP streams of synthetic boards, for tools/ingest.c and
+	 tools/archive.c
+
+	 BOARDSIM_BOARDS boards at the highest rate of the firmware: 4
+	 channels at 20 kS/s, a block of 64 samples per datagram, 1250
+	 datagrams/s per board; the signal a sine and a few LSB of noise,
+	 different for every board and channel. Board b sends from
+	 BOARDSIM_FIRST_ADDR + b.
+*/
+
+#ifndef HOST_BOARDSIM_H_
+#define HOST_BOARDSIM_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define BOARDSIM_BOARDS 48
+#define BOARDSIM_CHANNELS 4
+#define BOARDSIM_BLOCK 64
+#define BOARDSIM_PERIOD_US 50		// CONFIG_ACQ_SAMPLE_RATE_HZ at its most
+#define BOARDSIM_BITS 13
+#define BOARDSIM_DATAGRAMS_PER_S (BOARDSIM_CHANNELS * 1000000 / BOARDSIM_PERIOD_US / BOARDSIM_BLOCK)
+#define BOARDSIM_SWAP 97			// one step in that many goes out after the one behind it
+#define BOARDSIM_FIRST_ADDR 0x7f000101u	// 127.0.1.1
+
+// encodes the datagrams of all the boards; -1 when one did not encode
+int boardsim_init(void);
+
+// the k-th sample of a channel of a board
+uint16_t boardsim_sample(int board, int channel, uint64_t k);
+
+// the step-th datagram of board: the channels of a block one after the other, seq step / 4
+// from board time 0; valid until the next call
+const uint8_t *boardsim_datagram(int board, uint64_t step, size_t *len);
+
+// the step a board sends k-th
+uint64_t boardsim_swapped(uint64_t k);
+
+#endif /* HOST_BOARDSIM_H_ */
@@ -0,0 +1,294 @@
+/*
+	 A small MQTT 3.1.1 broker, see brokersim.h
+*/
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "topic.h"
+#include "brokersim.h"
+
+#define CONNECT     0x10
+#define CONNACK     0x20
+#define PUBLISH     0x30
+#define PUBACK      0x40
+#define SUBSCRIBE   0x80
+#define SUBACK      0x90
+#define UNSUBSCRIBE 0xA0
+#define UNSUBACK    0xB0
+#define PINGREQ     0xC0
+#define PINGRESP    0xD0
+#define DISCONNECT  0xE0
+
+#define IN_SIZE 16384		// a packet bigger than that closes the client
+#define POLL_MS 50			// to see a stop
+
+typedef struct {
+	int fd;
+	size_t len;
+	uint8_t in[IN_SIZE];
+} CLIENT_t;
+
+static struct {
+	int listen_fd;
+	pthread_t thread;
+	atomic_bool running;
+	CLIENT_t client[BROKERSIM_MAX_CLIENTS];
+	TOPIC_TABLE_t topics;		// sinks are the places in client[]
+	uint8_t arena[16384];
+	atomic_uint_fast64_t received;
+	atomic_uint_fast64_t sent;
+	atomic_uint clients;
+} broker;
+
+static int send_all(int fd, struct iovec *iov, int count)
+{
+	struct msghdr msg = { .msg_iov = iov, .msg_iovlen = count };
+	while (msg.msg_iovlen > 0) {
+		ssize_t n = sendmsg(fd, &msg, MSG_NOSIGNAL);
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			return -1;
+		}
+		while (msg.msg_iovlen > 0 && (size_t)n >= msg.msg_iov->iov_len) {
+			n -= msg.msg_iov->iov_len;
+			msg.msg_iov++;
+			msg.msg_iovlen--;
+		}
+		if (msg.msg_iovlen > 0) {
+			msg.msg_iov->iov_base = (uint8_t *)msg.msg_iov->iov_base + n;
+			msg.msg_iov->iov_len -= n;
+		}
+	}
+	return 0;
+}
+
+static int send_bytes(int fd, const uint8_t *buf, size_t len)
+{
+	struct iovec iov = { (void *)buf, len };
+	return send_all(fd, &iov, 1);
+}
+
+static void close_client(int i)
+{
+	CLIENT_t *c = &broker.client[i];
+	topic_remove_sink(&broker.topics, i, NULL, NULL);
+	close(c->fd);
+	c->fd = -1;
+	c->len = 0;
+	atomic_fetch_sub(&broker.clients, 1);
+}
+
+static size_t put_length(uint8_t *p, size_t len)
+{
+	size_t n = 0;
+	do {
+		p[n] = len % 128;
+		len /= 128;
+		if (len) p[n] |= 0x80;
+		n++;
+	} while (len);
+	return n;
+}
+
+// to every subscriber of the topic, at QoS 0
+static void pass_on(const uint8_t *topic, size_t topic_len, const uint8_t *payload, size_t len)
+{
+	uint16_t sinks[BROKERSIM_MAX_CLIENTS];
+	int n = topic_match(&broker.topics, (const char *)topic, topic_len, sinks, BROKERSIM_MAX_CLIENTS);
+	if (n <= 0) return;
+	uint8_t header[8];
+	header[0] = PUBLISH;
+	size_t h = 1 + put_length(header + 1, 2 + topic_len + len);
+	header[h++] = topic_len >> 8;
+	header[h++] = topic_len & 0xff;
+	for (int i = 0; i < n; i++) {
+		CLIENT_t *c = &broker.client[sinks[i]];
+		struct iovec iov[3] = { { header, h }, { (void *)topic, topic_len }, { (void *)payload, len } };
+		if (c->fd < 0 || send_all(c->fd, iov, 3) != 0) continue;
+		atomic_fetch_add(&broker.sent, 1);
+	}
+}
+
+static void subscribe(int i, const uint8_t *body, size_t len, bool un)
+{
+	if (len < 2) return;
+	uint8_t reply[4 + BROKERSIM_MAX_CLIENTS] = { un ? UNSUBACK : SUBACK, 2, body[0], body[1] };
+	size_t n = 4;
+	for (size_t at = 2; at + 2 <= len;) {
+		size_t flen = body[at] << 8 | body[at + 1];
+		const char *filter = (const char *)body + at + 2;
+		at += 2 + flen + !un;
+		if (at > len) break;
+		if (un) {
+			topic_unsubscribe(&broker.topics, filter, flen, i);
+		} else if (n < sizeof(reply)) {
+			reply[n++] = topic_subscribe(&broker.topics, filter, flen, i) == ESP_OK ? 0 : 0x80;
+		}
+	}
+	if (!un) reply[1] = n - 2;
+	send_bytes(broker.client[i].fd, reply, n);
+}
+
+// false when the client goes
+static bool packet(int i, uint8_t type, const uint8_t *body, size_t len)
+{
+	int fd = broker.client[i].fd;
+	switch (type & 0xf0) {
+		case CONNECT: {
+			static const uint8_t connack[] = { CONNACK, 2, 0, 0 };
+			return send_bytes(fd, connack, sizeof(connack)) == 0;
+		}
+		case PUBLISH: {
+			int qos = (type >> 1) & 3;
+			if (len < 2) return false;
+			size_t topic_len = body[0] << 8 | body[1];
+			size_t at = 2 + topic_len + (qos ? 2 : 0);
+			if (at > len) return false;
+			atomic_fetch_add(&broker.received, 1);
+			if (qos) {
+				const uint8_t puback[] = { PUBACK, 2, body[at - 2], body[at - 1] };
+				send_bytes(fd, puback, sizeof(puback));
+			}
+			pass_on(body + 2, topic_len, body + at, len - at);
+			return true;
+		}
+		case SUBSCRIBE:
+			subscribe(i, body, len, false);
+			return true;
+		case UNSUBSCRIBE:
+			subscribe(i, body, len, true);
+			return true;
+		case PINGREQ: {
+			static const uint8_t pingresp[] = { PINGRESP, 0 };
+			return send_bytes(fd, pingresp, sizeof(pingresp)) == 0;
+		}
+		case DISCONNECT:
+			return false;
+		default:
+			return true;
+	}
+}
+
+// the whole packets in the buffer of client i, false when it goes
+static bool packets(int i)
+{
+	CLIENT_t *c = &broker.client[i];
+	size_t at = 0;
+	while (c->len - at >= 2) {
+		size_t len = 0, h = 1;
+		int shift = 0;
+		for (;; h++, shift += 7) {
+			if (at + h >= c->len) goto partial;
+			len |= (size_t)(c->in[at + h] & 0x7f) << shift;
+			if ((c->in[at + h] & 0x80) == 0) break;
+			if (shift == 21) return false;
+		}
+		h++;
+		if (h + len > IN_SIZE) return false;
+		if (at + h + len > c->len) break;
+		if (!packet(i, c->in[at], c->in + at + h, len)) return false;
+		at += h + len;
+	}
+partial:
+	memmove(c->in, c->in + at, c->len - at);
+	c->len -= at;
+	return true;
+}
+
+static void accept_client(void)
+{
+	int fd = accept(broker.listen_fd, NULL, NULL);
+	if (fd < 0) return;
+	for (int i = 0; i < BROKERSIM_MAX_CLIENTS; i++) {
+		if (broker.client[i].fd >= 0) continue;
+		int one = 1;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		broker.client[i].fd = fd;
+		broker.client[i].len = 0;
+		atomic_fetch_add(&broker.clients, 1);
+		return;
+	}
+	close(fd);
+}
+
+static void *broker_thread(void *arg)
+{
+	struct pollfd pfd[1 + BROKERSIM_MAX_CLIENTS];
+	while (atomic_load(&broker.running)) {
+		pfd[0] = (struct pollfd) { .fd = broker.listen_fd, .events = POLLIN };
+		for (int i = 0; i < BROKERSIM_MAX_CLIENTS; i++) {
+			pfd[1 + i] = (struct pollfd) { .fd = broker.client[i].fd, .events = POLLIN };
+		}
+		int ready = poll(pfd, 1 + BROKERSIM_MAX_CLIENTS, POLL_MS);
+		if (ready <= 0) continue;
+		if (pfd[0].revents & POLLIN) accept_client();
+		for (int i = 0; i < BROKERSIM_MAX_CLIENTS; i++) {
+			CLIENT_t *c = &broker.client[i];
+			if (c->fd < 0 || (pfd[1 + i].revents & (POLLIN | POLLHUP | POLLERR)) == 0) continue;
+			ssize_t n = recv(c->fd, c->in + c->len, IN_SIZE - c->len, 0);
+			if (n < 0 && errno == EINTR) continue;
+			if (n > 0) c->len += n;
+			if (n <= 0 || !packets(i)) close_client(i);
+		}
+	}
+	return NULL;
+}
+
+int brokersim_start(uint16_t *port)
+{
+	if (atomic_load(&broker.running)) return -1;
+	topic_table_init(&broker.topics, broker.arena, sizeof(broker.arena));
+	for (int i = 0; i < BROKERSIM_MAX_CLIENTS; i++) broker.client[i].fd = -1;
+	atomic_store(&broker.received, 0);
+	atomic_store(&broker.sent, 0);
+	atomic_store(&broker.clients, 0);
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	int one = 1;
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	struct sockaddr_in sin = { .sin_family = AF_INET, .sin_port = htons(*port), .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+	socklen_t sin_len = sizeof(sin);
+	if (fd < 0 || bind(fd, (struct sockaddr *)&sin, sizeof(sin)) < 0 || listen(fd, BROKERSIM_MAX_CLIENTS) < 0
+		|| getsockname(fd, (struct sockaddr *)&sin, &sin_len) < 0) {
+		if (fd >= 0) close(fd);
+		return -1;
+	}
+	*port = ntohs(sin.sin_port);
+	broker.listen_fd = fd;
+	atomic_store(&broker.running, true);
+	if (pthread_create(&broker.thread, NULL, broker_thread, NULL) != 0) {
+		atomic_store(&broker.running, false);
+		close(fd);
+		return -1;
+	}
+	return 0;
+}
+
+void brokersim_stop(void)
+{
+	if (!atomic_load(&broker.running)) return;
+	atomic_store(&broker.running, false);
+	pthread_join(broker.thread, NULL);
+	for (int i = 0; i < BROKERSIM_MAX_CLIENTS; i++) {
+		if (broker.client[i].fd >= 0) close_client(i);
+	}
+	close(broker.listen_fd);
+}
+
+void brokersim_get_stats(BROKERSIM_STATS_t *stats)
+{
+	stats->received = atomic_load(&broker.received);
+	stats->sent = atomic_load(&broker.sent);
+	stats->clients = atomic_load(&broker.clients);
+}
@@ -0,0 +1,32 @@
+/*
+	 A small MQTT 3.1.1 broker on loopback, for the MQTT source of
+	 tools/ingest.c
+
+	 CONNECT, SUBSCRIBE and UNSUBSCRIBE with the filters of main/topic.h,
+	 PUBLISH at QoS 0 (QoS 1 is acknowledged and passed on at 0), PINGREQ
+	 and DISCONNECT; no retained messages, wills or sessions. One thread
+	 polls every client and passes each message on to the subscribers it
+	 matches, in the order it came. A subscriber that does not read holds
+	 the broker up and through it the publishers, so nothing is dropped.
+*/
+
+#ifndef HOST_BROKERSIM_H_
+#define HOST_BROKERSIM_H_
+
+#include <stdint.h>
+
+#define BROKERSIM_MAX_CLIENTS 64
+
+typedef struct {
+	uint64_t received;		// messages published to the broker
+	uint64_t sent;			// messages passed on to subscribers
+	uint32_t clients;		// connected now
+} BROKERSIM_STATS_t;
+
+// listens on 127.0.0.1:*port, any free port when it is 0, and sets it; -1 when it cannot
+int brokersim_start(uint16_t *port);
+// closes every client
+void brokersim_stop(void);
+void brokersim_get_stats(BROKERSIM_STATS_t *stats);
+
+#endif /* HOST_BROKERSIM_H_ */
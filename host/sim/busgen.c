@@ -0,0 +1,160 @@
+/*
+	 Bit streams of UART, I2C and SPI senders for main/decoder.c
+
+	 The clock of the sender is off by a bit and every edge is moved at
+	 random; the random numbers start from the same seed for every stream,
+	 so a stream is the same on every run.
+*/
+
+#include "busgen.h"
+
+static uint32_t random32(BUSGEN_t *g)
+{
+	g->rng ^= g->rng << 13;
+	g->rng ^= g->rng >> 17;
+	g->rng ^= g->rng << 5;
+	return g->rng;
+}
+
+// -1 to 1
+static double jitter(BUSGEN_t *g)
+{
+	return (double)random32(g) / UINT32_MAX * 2 - 1;
+}
+
+static void set(BUSGEN_t *g, int64_t t_ns, int pin, int level)
+{
+	uint64_t next = level ? g->levels | (1ULL << pin) : g->levels & ~(1ULL << pin);
+	if (next == g->levels) return;
+	if (g->nedges == BUSGEN_MAX_EDGES) {
+		g->full = 1;
+		return;
+	}
+	g->levels = next;
+	g->edges[g->nedges++] = (BUSGEN_EDGE_t) { t_ns, g->levels };
+}
+
+static void expect(BUSGEN_t *g, DECODER_EVENT_TYPE_t type, uint16_t data, uint16_t data2, uint8_t ack)
+{
+	if (g->nexpected == BUSGEN_MAX_EVENTS) {
+		g->full = 1;
+		return;
+	}
+	g->expected[g->nexpected++] = (DECODER_EVENT_t) { .type = type, .data = data, .data2 = data2, .ack = ack };
+}
+
+static void begin(BUSGEN_t *g, uint64_t idle)
+{
+	g->nedges = 0;
+	g->nexpected = 0;
+	g->frames = 0;
+	g->full = 0;
+	g->levels = idle;
+	g->rng = 0x9e3779b9;
+	g->edges[g->nedges++] = (BUSGEN_EDGE_t) { 0, g->levels };
+}
+
+void busgen_uart(BUSGEN_t *g, const DECODER_CONFIG_t *c, int frames, int bad_parity_every)
+{
+	double bit_ns = 1e9 / c->uart.baud * 0.985;
+	double t = 10 * bit_ns;
+	begin(g, 1ULL << c->uart.rx);
+	for (; g->frames < frames; g->frames++) {
+		uint16_t data = random32(g) & ((1 << c->uart.bits) - 1);
+		int bits[16], nbits = 0;
+		bits[nbits++] = 0;
+		for (int i = 0; i < c->uart.bits; i++) bits[nbits++] = (data >> i) & 1;
+		int bad = bad_parity_every && g->frames % bad_parity_every == bad_parity_every - 1;
+		if (c->uart.parity != DECODER_PARITY_NONE) {
+			int odd = __builtin_popcount(data) & 1;
+			int parity = c->uart.parity == DECODER_PARITY_EVEN ? odd : !odd;
+			bits[nbits++] = parity ^ bad;
+		}
+		for (int i = 0; i < c->uart.stop; i++) bits[nbits++] = 1;
+		for (int i = 0; i < nbits; i++) set(g, (int64_t)(t + i * bit_ns + jitter(g) * 0.04 * bit_ns), c->uart.rx, bits[i]);
+		t += nbits * bit_ns + (random32(g) % 4) * bit_ns;	// idle between characters
+		if (bad) {
+			expect(g, DECODER_EV_ERROR, DECODER_ERROR_PARITY, data, 0);
+		} else {
+			expect(g, DECODER_EV_DATA, data, 0, 0);
+		}
+	}
+}
+
+void busgen_i2c(BUSGEN_t *g, const DECODER_CONFIG_t *c, int frames)
+{
+	const double half = 1250;
+	int scl = c->i2c.scl, sda = c->i2c.sda;
+	double t = 10000;
+	begin(g, (1ULL << scl) | (1ULL << sda));
+	while (g->frames < frames) {
+		uint8_t address = 0x08 + random32(g) % 0x70;
+		for (int part = 0; part < 2; part++) {
+			// start (or repeated start): SDA falls while SCL is high, then SCL goes low
+			set(g, (int64_t)t, sda, 1);
+			set(g, (int64_t)(t + half / 2), scl, 1);
+			set(g, (int64_t)(t + half), sda, 0);
+			set(g, (int64_t)(t + 1.5 * half), scl, 0);
+			t += 2 * half;
+			expect(g, DECODER_EV_START, part, 0, 0);
+			int count = 1 + random32(g) % 4;
+			for (int byte = -1; byte < count; byte++) {
+				uint8_t value = byte < 0 ? (address << 1) | part : random32(g) & 0xff;
+				// the reader does not acknowledge the last byte
+				int ack = !(part == 1 && byte == count - 1);
+				for (int i = 0; i < 9; i++) {
+					set(g, (int64_t)(t + jitter(g) * 100), sda, i < 8 ? (value >> (7 - i)) & 1 : !ack);
+					set(g, (int64_t)(t + half / 2 + jitter(g) * 100), scl, 1);
+					set(g, (int64_t)(t + 1.5 * half + jitter(g) * 100), scl, 0);
+					t += 2 * half;
+				}
+				if (byte < 0) {
+					expect(g, DECODER_EV_ADDRESS, address, part, ack);
+				} else {
+					expect(g, DECODER_EV_DATA, value, 0, ack);
+				}
+				g->frames++;
+			}
+		}
+		// stop: SDA rises while SCL is high
+		set(g, (int64_t)t, sda, 0);
+		set(g, (int64_t)(t + half / 2), scl, 1);
+		set(g, (int64_t)(t + half), sda, 1);
+		t += 4 * half;
+		expect(g, DECODER_EV_STOP, 0, 0, 0);
+	}
+}
+
+void busgen_spi(BUSGEN_t *g, const DECODER_CONFIG_t *c, int frames)
+{
+	const double half = 500;
+	int cpol = c->spi.mode >> 1, cpha = c->spi.mode & 1;
+	double t = 10000;
+	begin(g, (uint64_t)cpol << c->spi.sck | 1ULL << c->spi.cs);
+	while (g->frames < frames) {
+		set(g, (int64_t)t, c->spi.cs, 0);
+		t += half;
+		expect(g, DECODER_EV_START, 0, 0, 0);
+		int count = 1 + random32(g) % 8;
+		for (int w = 0; w < count; w++) {
+			uint16_t mosi = random32(g) & ((1 << c->spi.bits) - 1);
+			uint16_t miso = random32(g) & ((1 << c->spi.bits) - 1);
+			for (int i = 0; i < c->spi.bits; i++) {
+				int shift = c->spi.lsb_first ? i : c->spi.bits - 1 - i;
+				// CPHA 0: data before the leading edge; CPHA 1: data on the leading edge
+				double data_t = cpha ? t + half / 2 : t - half / 4;
+				set(g, (int64_t)(data_t + jitter(g) * 50), c->spi.mosi, (mosi >> shift) & 1);
+				set(g, (int64_t)(data_t + jitter(g) * 50), c->spi.miso, (miso >> shift) & 1);
+				set(g, (int64_t)(t + jitter(g) * 50), c->spi.sck, !cpol);
+				set(g, (int64_t)(t + half + jitter(g) * 50), c->spi.sck, cpol);
+				t += 2 * half;
+			}
+			expect(g, DECODER_EV_DATA, mosi, miso, 0);
+			g->frames++;
+		}
+		t += half;
+		set(g, (int64_t)t, c->spi.cs, 1);
+		t += 4 * half;
+		expect(g, DECODER_EV_STOP, 0, 0, 0);
+	}
+}
@@ -0,0 +1,43 @@
+/*
+	 Bit streams of UART, I2C and SPI senders, as the edges
+	 hal_gpio_edges_read() delivers, with the frames main/decoder.c
+	 has to find in them
+*/
+
+#ifndef HOST_BUSGEN_H_
+#define HOST_BUSGEN_H_
+
+#include <stdint.h>
+
+#include "decoder.h"
+
+#define BUSGEN_MAX_EDGES 40000
+#define BUSGEN_MAX_EVENTS 4096
+
+typedef struct {
+	int64_t t_ns;
+	uint64_t levels;	// of all pins from t_ns on
+} BUSGEN_EDGE_t;
+
+typedef struct {
+	BUSGEN_EDGE_t edges[BUSGEN_MAX_EDGES];
+	int nedges;
+	DECODER_EVENT_t expected[BUSGEN_MAX_EVENTS];	// t_ns is not set
+	int nexpected;
+	int frames;			// characters, bytes or words
+	int full;			// edges or events did not fit, the stream is cut
+	uint64_t levels;
+	uint32_t rng;
+} BUSGEN_t;
+
+// characters of c->uart, the sender 1.5% fast, every edge moved by up to 4% of a bit;
+// every bad_parity_every-th character has its parity bit flipped (0: none)
+void busgen_uart(BUSGEN_t *g, const DECODER_CONFIG_t *c, int frames, int bad_parity_every);
+
+// transactions at 400 kHz: a write of 1 to 4 bytes, a repeated start, a read of 1 to 4
+void busgen_i2c(BUSGEN_t *g, const DECODER_CONFIG_t *c, int frames);
+
+// selections of 1 to 8 words of c->spi at 1 MHz
+void busgen_spi(BUSGEN_t *g, const DECODER_CONFIG_t *c, int frames);
+
+#endif /* HOST_BUSGEN_H_ */
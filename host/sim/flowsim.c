@@ -0,0 +1,158 @@
+/*
+	 A websocket client behind a link that slows down, see flowsim.h
+*/
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "flow.h"
+#include "flowsim.h"
+
+#define NUM 3				// the websocket client
+#define CHANNELS 4
+#define FRAME_BYTES 360		// "AS" of 64 readings in mV
+#define BLOCK_US 64000
+#define ACQ_RING 16
+#define SND_BUF 5744		// CONFIG_LWIP_TCP_SND_BUF_DEFAULT
+#define PROP_US 5000
+#define ACK_US 100000
+#define SLOW_US 10000000
+#define FAST_US 40000000
+#define END_US 70000000
+#define MAX_FRAMES (END_US / BLOCK_US * CHANNELS)
+
+static int factor_applied = 1;
+
+static void apply(int num, int factor, uint32_t latency_us)
+{
+	factor_applied = factor;
+}
+
+typedef struct {
+	int64_t block_end_us;	// of the last sample of the frame
+	int64_t arrive_us;		// at the browser, 0 while on its way
+	uint32_t bytes_left;
+} FRAME_t;
+
+static FRAME_t frames[MAX_FRAMES];
+static uint32_t latencies[MAX_FRAMES];
+
+static int cmp_u32(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+	return x < y ? -1 : x > y;
+}
+
+static uint32_t bandwidth(int64_t t)
+{
+	return t >= SLOW_US && t < FAST_US ? 8000 : 200000;
+}
+
+int flowsim_run(uint32_t target_us, FLOWSIM_RESULT_t *r)
+{
+	FLOW_IO_t io = { .target_us = target_us, .interval_us = FLOWSIM_INTERVAL_US, .apply = apply };
+	if (flow_init(&io) != ESP_OK) return -1;
+	flow_open(NUM);
+	factor_applied = 1;
+	memset(r, 0, sizeof(*r));
+	r->recover_s = -1;
+	int nframes = 0;
+	int link = 0;			// first frame not yet through the link
+	int browser = 0;		// frames the browser has
+	uint32_t queued = 0;	// bytes in the send buffer
+	int64_t next_block = 1;	// blocks 0 .. next_block - 1 are processed or lost
+	int pending = 0;		// frames of the block being sent, still to send
+	int64_t blocked_since = -1;
+	int64_t block_end_us = 0;
+	int since_frame = 0;	// blocks since the last frames, thinned by factor
+	int factor = 1;
+	uint32_t acks[64];		// counts on their way to the device
+	int64_t ack_at[64];
+	int ack_head = 0, ack_tail = 0;
+	uint32_t acked = 0;
+	uint64_t slow_bytes = 0;
+	int nlat = 0;
+
+	for (int64_t t = 0; t < END_US; t += 1000) {
+		// the link drains the send buffer, the browser gets the frames PROP_US later
+		uint32_t budget = bandwidth(t) / 1000;
+		while (budget > 0 && link < nframes) {
+			FRAME_t *f = &frames[link];
+			uint32_t take = f->bytes_left < budget ? f->bytes_left : budget;
+			f->bytes_left -= take;
+			budget -= take;
+			queued -= take;
+			if (f->bytes_left == 0) {
+				f->arrive_us = t + PROP_US;
+				link++;
+			}
+		}
+		while (browser < link && frames[browser].arrive_us <= t) {
+			int64_t latency = frames[browser].arrive_us - frames[browser].block_end_us;
+			if (frames[browser].block_end_us >= 20000000 && frames[browser].block_end_us < FAST_US) latencies[nlat++] = latency;
+			browser++;
+		}
+		if (t % ACK_US == 0 && (uint32_t)browser != acked) {
+			acked = browser;
+			acks[ack_tail % 64] = acked;
+			ack_at[ack_tail % 64] = t + PROP_US;
+			ack_tail++;
+		}
+		while (ack_head != ack_tail && ack_at[ack_head % 64] <= t) {
+			flow_ack(NUM, acks[ack_head % 64], t);
+			ack_head++;
+		}
+
+		// the stream task: the frames of a block, then the next block that is due
+		for (;;) {
+			if (pending == 0) {
+				int64_t due = t / BLOCK_US;		// blocks whose last sample is in
+				if (next_block > due) break;
+				if (due - next_block >= ACQ_RING) {
+					r->lost_blocks += due - next_block - ACQ_RING + 1;
+					next_block = due - ACQ_RING + 1;
+				}
+				block_end_us = next_block * BLOCK_US;
+				next_block++;
+				if (++since_frame >= factor) {
+					since_frame = 0;
+					pending = CHANNELS;
+				}
+				if (pending == 0) {
+					flow_update(t);
+					continue;
+				}
+			}
+			if (queued + FRAME_BYTES > SND_BUF) {
+				if (blocked_since < 0) blocked_since = t;
+				break;
+			}
+			frames[nframes++] = (FRAME_t) { .block_end_us = block_end_us, .bytes_left = FRAME_BYTES };
+			queued += FRAME_BYTES;
+			if (t >= 20000000 && t < FAST_US) slow_bytes += FRAME_BYTES;
+			flow_sent(NUM, t, blocked_since < 0 ? 0 : t - blocked_since, FRAME_BYTES);
+			blocked_since = -1;
+			if (--pending == 0) {
+				flow_update(t);
+				if (factor_applied != factor) {
+					// the session takes new pipelines, they start empty
+					factor = factor_applied;
+					since_frame = 0;
+				}
+			}
+		}
+		if (t >= FAST_US && r->recover_s < 0 && factor == 1) r->recover_s = (t - FAST_US) / 1e6;
+	}
+	flow_close(NUM);
+
+	qsort(latencies, nlat, sizeof(latencies[0]), cmp_u32);
+	if (nlat == 0) return -1;
+	r->lat_p50_ms = latencies[nlat / 2] / 1000.0;
+	r->lat_p99_ms = latencies[nlat * 99 / 100] / 1000.0;
+	r->lat_max_ms = latencies[nlat - 1] / 1000.0;
+	r->factor = factor;
+	r->kbytes_per_s = slow_bytes / 20.0 / 1000;
+	return 0;
+}
+
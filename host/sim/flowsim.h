@@ -0,0 +1,36 @@
+/*
+	 A websocket client behind a link that slows down, for main/flow.c
+
+	 In steps of 1 ms: 4 channels streamed as text, a frame of 360 bytes
+	 per channel every block of 64 ms, 22 kB/s, or every factor blocks
+	 once thinned. The sends go into a TCP send buffer of 5744 bytes (what
+	 lwIP takes before netconn_write() blocks) drained by the link; a
+	 blocked send holds the stream task, the blocks wait in the ring of
+	 the acquisition and the oldest is lost when more than 16 wait. The
+	 browser acknowledges every 100 ms, 5 ms later the device hears it.
+	 The link runs at 200 kB/s, drops to 8 kB/s from 10 to 40 s, then
+	 comes back.
+*/
+
+#ifndef HOST_FLOWSIM_H_
+#define HOST_FLOWSIM_H_
+
+#include <stdint.h>
+
+#define FLOWSIM_INTERVAL_US 250000
+
+typedef struct {
+	// the latency of the frames from their last sample to the browser while the link is slow (20 to 40 s, once settled)
+	double lat_p50_ms;
+	double lat_p99_ms;
+	double lat_max_ms;
+	uint32_t lost_blocks;
+	int factor;				// at the end
+	double recover_s;		// after the link came back until the factor was 1, -1 never
+	double kbytes_per_s;	// sent while slow
+} FLOWSIM_RESULT_t;
+
+// the 70 s of the client with the rate control at target_us, 0 for off; -1 when nothing arrived while slow
+int flowsim_run(uint32_t target_us, FLOWSIM_RESULT_t *r);
+
+#endif /* HOST_FLOWSIM_H_ */
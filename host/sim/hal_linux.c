@@ -0,0 +1,677 @@
+/*
+	 Linux backend of hal.h
+
+	 ADC channels and input pins follow simulated signals (see hal_sim.h),
+	 outputs just remember their level, the DAC is refilled at the pace it
+	 would play and can be wired back to an ADC channel, and storage is a
+	 directory with one file per key. Values are computed from the clock at the time of the
+	 read, so any sampling rate sees a consistent signal.
+*/
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "hal.h"
+#include "hal_sim.h"
+
+#define ADC_MAX_RAW 8191	// ADC_WIDTH_BIT_13
+#define ADC_MAX_MV  2500	// ADC_ATTEN_DB_11
+
+static const char *TAG = "hal_sim";
+
+typedef struct {
+	HAL_SIM_SIGNAL_t signal;
+	float *samples;
+	size_t sample_count;
+} ADC_SIM_t;
+
+typedef struct {
+	HAL_GPIO_MODE_t mode;
+	int level;
+	double freq_hz;
+	double jitter_us;
+} GPIO_SIM_t;
+
+static ADC_SIM_t adc[HAL_SIM_ADC_CHANNELS];
+static GPIO_SIM_t gpio[HAL_SIM_GPIO_PINS];
+static char storage_dir[256] = "ioto-nvs";
+static uint32_t rng_state = 0x12345678;
+
+static uint32_t xorshift32(void)
+{
+	uint32_t x = rng_state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	rng_state = x;
+	return x;
+}
+
+// uniform in [-1, 1], the same value every time for the same key
+static double hash_unit(uint64_t key)
+{
+	key ^= key >> 33;
+	key *= 0xff51afd7ed558ccdULL;
+	key ^= key >> 33;
+	key *= 0xc4ceb9fe1a85ec53ULL;
+	key ^= key >> 33;
+	return (double)(key & 0xffffff) / 0x7fffff - 1.0;
+}
+
+// roughly gaussian, sum of four uniforms
+static double noise(double sigma)
+{
+	double sum = 0;
+	for (int i = 0; i < 4; i++) sum += (double)xorshift32() / UINT32_MAX - 0.5;
+	return sum * sigma * 1.732;
+}
+
+// square wave level at t, every edge moved by a repeatable random jitter
+static int square_level(double t_us, double freq_hz, double jitter_us, uint64_t seed)
+{
+	double period_us = 1e6 / freq_hz;
+	int64_t k = (int64_t)floor(t_us / period_us);
+	double phase_us = t_us - k * period_us;
+	double rise = jitter_us * hash_unit(seed ^ (k * 2));
+	double fall = period_us / 2 + jitter_us * hash_unit(seed ^ (k * 2 + 1));
+	if (phase_us < rise) return 0;
+	return phase_us < fall;
+}
+
+/*
+	 The DAC: buffer k plays from start_us + k * len / rate_hz on, the task
+	 refills one as soon as the one before the one before it has played.
+	 The ring keeps the last few for dac_value_mv().
+*/
+#define DAC_RING 4
+
+static struct {
+	HAL_DAC_REFILL_t refill;
+	void *arg;
+	uint32_t rate_hz;
+	size_t len;
+	uint8_t *ring;
+	int64_t start_us;
+	volatile uint32_t filled;	// buffers made so far
+	volatile bool running;
+	volatile bool stopped;		// the task is gone
+} dac;
+
+static void dac_task(void *pvParameters)
+{
+	while (dac.running) {
+		int64_t due_us = dac.start_us + (int64_t)(dac.filled - 1) * dac.len * 1000000 / dac.rate_hz;
+		int64_t wait_us = due_us - hal_clock_us();
+		if (wait_us > 0) {
+			vTaskDelay(pdMS_TO_TICKS(wait_us / 1000 + 1));
+			continue;
+		}
+		dac.refill(dac.ring + (dac.filled % DAC_RING) * dac.len, dac.len, dac.arg);
+		dac.filled++;
+	}
+	dac.stopped = true;
+	vTaskDelete(NULL);
+}
+
+static double dac_value_mv(double t_us)
+{
+	if (!dac.running || t_us < dac.start_us) return 0;
+	uint64_t i = (uint64_t)((t_us - dac.start_us) * dac.rate_hz / 1e6);
+	uint32_t k = i / dac.len, filled = dac.filled;
+	if (k >= filled || k + DAC_RING < filled) return 0;
+	return (double)dac.ring[(k % DAC_RING) * dac.len + i % dac.len] * HAL_DAC_FULL_SCALE_MV / ((1 << HAL_DAC_BITS) - 1);
+}
+
+static double adc_value_mv(int channel, double t_us)
+{
+	ADC_SIM_t *a = &adc[channel];
+	const HAL_SIM_SIGNAL_t *s = &a->signal;
+	double mv = 0;
+	switch (s->wave) {
+		case HAL_SIM_SINE:
+			mv = s->offset_mv + s->amplitude_mv * sin(2 * M_PI * s->freq_hz * t_us / 1e6);
+			break;
+		case HAL_SIM_SQUARE:
+			mv = s->offset_mv + (square_level(t_us, s->freq_hz, s->jitter_us, channel) ? s->amplitude_mv : -s->amplitude_mv);
+			break;
+		case HAL_SIM_NOISE:
+			mv = s->offset_mv + noise(s->amplitude_mv);
+			break;
+		case HAL_SIM_DAC:
+			mv = dac_value_mv(t_us);
+			break;
+		case HAL_SIM_FILE:
+			if (a->sample_count) {
+				uint64_t i = (uint64_t)(t_us * s->rate_hz / 1e6);
+				mv = a->samples[i % a->sample_count];
+			}
+			break;
+		default:
+			break;
+	}
+	if (s->noise_mv > 0) mv += noise(s->noise_mv);
+	return mv;
+}
+
+esp_err_t hal_sim_set_adc(int channel, const HAL_SIM_SIGNAL_t *signal)
+{
+	if (channel < 0 || channel >= HAL_SIM_ADC_CHANNELS) return ESP_ERR_INVALID_ARG;
+	ADC_SIM_t *a = &adc[channel];
+	free(a->samples);
+	a->samples = NULL;
+	a->sample_count = 0;
+	a->signal = *signal;
+	a->signal.path = NULL;
+
+	if (signal->wave == HAL_SIM_FILE) {
+		FILE *fp = fopen(signal->path, "r");
+		if (fp == NULL) {
+			ESP_LOGE(TAG, "cannot open %s", signal->path);
+			a->signal.wave = HAL_SIM_NONE;
+			return ESP_ERR_NOT_FOUND;
+		}
+		size_t size = 0;
+		float value;
+		while (fscanf(fp, "%f", &value) == 1) {
+			if (a->sample_count == size) {
+				size = size ? size * 2 : 4096;
+				a->samples = realloc(a->samples, size * sizeof(float));
+			}
+			a->samples[a->sample_count++] = value;
+		}
+		fclose(fp);
+		if (a->signal.rate_hz <= 0) a->signal.rate_hz = 1000;
+		ESP_LOGI(TAG, "adc%d plays %zu samples from %s at %.0f Hz", channel, a->sample_count, signal->path, a->signal.rate_hz);
+	}
+	return ESP_OK;
+}
+
+esp_err_t hal_sim_set_gpio(int pin, double freq_hz, double jitter_us)
+{
+	if (pin < 0 || pin >= HAL_SIM_GPIO_PINS) return ESP_ERR_INVALID_ARG;
+	gpio[pin].freq_hz = freq_hz;
+	gpio[pin].jitter_us = jitter_us;
+	return ESP_OK;
+}
+
+esp_err_t hal_sim_parse(const char *spec)
+{
+	char copy[512];
+	snprintf(copy, sizeof(copy), "%s", spec);
+	char *eq = strchr(copy, '=');
+	if (eq == NULL) return ESP_ERR_INVALID_ARG;
+	*eq = 0;
+	char *fields[8];
+	int count = 0;
+	for (char *save, *tok = strtok_r(eq + 1, ":", &save); tok && count < 8; tok = strtok_r(NULL, ":", &save)) {
+		fields[count++] = tok;
+	}
+	if (count == 0) return ESP_ERR_INVALID_ARG;
+
+	int number;
+	if (sscanf(copy, "gpio%d", &number) == 1) {
+		return hal_sim_set_gpio(number, atof(fields[0]), count > 1 ? atof(fields[1]) : 0);
+	}
+	if (sscanf(copy, "adc%d", &number) != 1) return ESP_ERR_INVALID_ARG;
+
+	HAL_SIM_SIGNAL_t s = { 0 };
+	if (strcmp(fields[0], "sine") == 0 && count >= 4) {
+		s.wave = HAL_SIM_SINE;
+		s.freq_hz = atof(fields[1]);
+		s.amplitude_mv = atof(fields[2]);
+		s.offset_mv = atof(fields[3]);
+		if (count > 4) s.noise_mv = atof(fields[4]);
+	} else if (strcmp(fields[0], "square") == 0 && count >= 4) {
+		s.wave = HAL_SIM_SQUARE;
+		s.freq_hz = atof(fields[1]);
+		s.amplitude_mv = atof(fields[2]);
+		s.offset_mv = atof(fields[3]);
+		if (count > 4) s.jitter_us = atof(fields[4]);
+		if (count > 5) s.noise_mv = atof(fields[5]);
+	} else if (strcmp(fields[0], "noise") == 0 && count >= 3) {
+		s.wave = HAL_SIM_NOISE;
+		s.amplitude_mv = atof(fields[1]);
+		s.offset_mv = atof(fields[2]);
+	} else if (strcmp(fields[0], "dac") == 0) {
+		s.wave = HAL_SIM_DAC;
+		if (count > 1) s.noise_mv = atof(fields[1]);
+	} else if (strcmp(fields[0], "file") == 0 && count >= 3) {
+		s.wave = HAL_SIM_FILE;
+		s.path = fields[1];
+		s.rate_hz = atof(fields[2]);
+	} else {
+		return ESP_ERR_INVALID_ARG;
+	}
+	return hal_sim_set_adc(number, &s);
+}
+
+void hal_sim_set_storage_dir(const char *dir)
+{
+	snprintf(storage_dir, sizeof(storage_dir), "%s", dir);
+}
+
+esp_err_t hal_init(void)
+{
+	// the analog channels and digital inputs of the README, when nothing else was asked for
+	if (adc[6].signal.wave == HAL_SIM_NONE) {
+		HAL_SIM_SIGNAL_t ch1 = { .wave = HAL_SIM_SINE, .freq_hz = 1, .amplitude_mv = 1000, .offset_mv = 1250, .noise_mv = 5 };
+		hal_sim_set_adc(6, &ch1);
+	}
+	if (adc[5].signal.wave == HAL_SIM_NONE) {
+		HAL_SIM_SIGNAL_t ch2 = { .wave = HAL_SIM_SQUARE, .freq_hz = 0.5, .amplitude_mv = 500, .offset_mv = 1000, .jitter_us = 1000 };
+		hal_sim_set_adc(5, &ch2);
+	}
+	for (int pin = 37; pin <= 42; pin++) {
+		if (gpio[pin].freq_hz == 0) gpio[pin].freq_hz = 0.1 * (43 - pin);
+	}
+	mkdir(storage_dir, 0755);
+	return ESP_OK;
+}
+
+int hal_adc_read_raw(int channel)
+{
+	if (channel < 0 || channel >= HAL_SIM_ADC_CHANNELS) return -1;
+	double mv = adc_value_mv(channel, (double)hal_clock_us());
+	int raw = (int)lround(mv * ADC_MAX_RAW / ADC_MAX_MV);
+	if (raw < 0) raw = 0;
+	if (raw > ADC_MAX_RAW) raw = ADC_MAX_RAW;
+	return raw;
+}
+
+uint32_t hal_adc_raw_to_mv(int raw)
+{
+	return (uint32_t)raw * ADC_MAX_MV / ADC_MAX_RAW;
+}
+
+uint32_t hal_adc_read_mv(int channel, int samples)
+{
+	uint32_t adc_reading = 0;
+	for (int i = 0; i < samples; i++) {
+		adc_reading += hal_adc_read_raw(channel);
+	}
+	adc_reading /= samples;
+	return hal_adc_raw_to_mv(adc_reading);
+}
+
+int hal_adc_bits(void)
+{
+	return 13;	// ADC_WIDTH_BIT_13
+}
+
+bool hal_gpio_valid(int pin)
+{
+	return pin >= 0 && pin < HAL_SIM_GPIO_PINS;
+}
+
+void hal_gpio_reset(int pin)
+{
+	if (!hal_gpio_valid(pin)) return;
+	gpio[pin].mode = HAL_GPIO_MODE_DISABLE;
+	gpio[pin].level = 0;
+}
+
+void hal_gpio_set_direction(int pin, HAL_GPIO_MODE_t mode)
+{
+	if (!hal_gpio_valid(pin)) return;
+	gpio[pin].mode = mode;
+}
+
+esp_err_t hal_gpio_output(uint64_t mask)
+{
+	if (mask >> HAL_SIM_GPIO_PINS) return ESP_ERR_INVALID_ARG;
+	for (int pin = 0; pin < HAL_SIM_GPIO_PINS; pin++) {
+		if (mask & (1ULL << pin)) gpio[pin].mode = HAL_GPIO_MODE_OUTPUT;
+	}
+	return ESP_OK;
+}
+
+void hal_gpio_write(uint64_t mask, uint64_t levels)
+{
+	for (int pin = 0; pin < HAL_SIM_GPIO_PINS; pin++) {
+		if (mask & (1ULL << pin)) gpio[pin].level = (levels >> pin) & 1;
+	}
+}
+
+void hal_gpio_set_level(int pin, int level)
+{
+	if (!hal_gpio_valid(pin)) return;
+	gpio[pin].level = level ? 1 : 0;
+}
+
+int hal_gpio_get_level(int pin)
+{
+	if (!hal_gpio_valid(pin)) return 0;
+	GPIO_SIM_t *g = &gpio[pin];
+	if (g->mode == HAL_GPIO_MODE_OUTPUT || g->freq_hz <= 0) return g->level;
+	return square_level((double)hal_clock_us(), g->freq_hz, g->jitter_us, 0x100 + pin);
+}
+
+// the rising edges of square_level(), computed for the time since the last read
+static int capture_pin = -1;
+static int64_t capture_from_us;
+
+esp_err_t hal_gpio_capture_start(int pin)
+{
+	if (pin < 0 || pin >= HAL_SIM_GPIO_PINS) return ESP_ERR_INVALID_ARG;
+	gpio[pin].mode = HAL_GPIO_MODE_INPUT;
+	capture_pin = pin;
+	capture_from_us = hal_clock_us();
+	return ESP_OK;
+}
+
+void hal_gpio_capture_stop(void)
+{
+	capture_pin = -1;
+}
+
+int hal_gpio_capture_read(int64_t *times_us, int max)
+{
+	if (capture_pin < 0 || gpio[capture_pin].freq_hz <= 0) return 0;
+	GPIO_SIM_t *g = &gpio[capture_pin];
+	double period_us = 1e6 / g->freq_hz;
+	int64_t now = hal_clock_us();
+	int n = 0;
+	for (int64_t k = (int64_t)floor(capture_from_us / period_us); n < max; k++) {
+		double edge = k * period_us + g->jitter_us * hash_unit((0x100 + capture_pin) ^ (k * 2));
+		if (edge >= now) break;
+		if (edge < capture_from_us) continue;
+		times_us[n++] = (int64_t)edge;
+		capture_from_us = (int64_t)edge + 1;
+	}
+	if (n < max) capture_from_us = now;
+	return n;
+}
+
+// all edges of the simulated pins in time order, the same edges square_level() has
+static uint64_t edges_pins;
+static uint64_t edges_levels;
+static double edges_from_us;	// edges up to this one were read
+static int edges_first;
+
+// edge j of a pin: j = 2k is the rise of period k, 2k + 1 its fall
+static double gpio_edge_us(int pin, int64_t j)
+{
+	double period_us = 1e6 / gpio[pin].freq_hz;
+	double base = (j >> 1) * period_us + ((j & 1) ? period_us / 2 : 0);
+	return base + gpio[pin].jitter_us * hash_unit((0x100 + pin) ^ j);
+}
+
+esp_err_t hal_gpio_edges_start(uint64_t pins)
+{
+	edges_pins = pins & ((1ULL << HAL_SIM_GPIO_PINS) - 1);
+	edges_from_us = hal_clock_us();
+	edges_levels = 0;
+	for (int pin = 0; pin < HAL_SIM_GPIO_PINS; pin++) {
+		if ((edges_pins & (1ULL << pin)) == 0) continue;
+		gpio[pin].mode = HAL_GPIO_MODE_INPUT;
+		GPIO_SIM_t *g = &gpio[pin];
+		int level = g->freq_hz > 0 ? square_level(edges_from_us, g->freq_hz, g->jitter_us, 0x100 + pin) : g->level;
+		if (level) edges_levels |= 1ULL << pin;
+	}
+	edges_first = 1;
+	return ESP_OK;
+}
+
+void hal_gpio_edges_stop(void)
+{
+	edges_pins = 0;
+}
+
+int hal_gpio_edges_read(HAL_GPIO_EDGE_t *edges, int max)
+{
+	int n = 0;
+	if (edges_first && max > 0) {
+		edges[n++] = (HAL_GPIO_EDGE_t) { .t_us = (int64_t)edges_from_us, .levels = edges_levels };
+		edges_first = 0;
+	}
+	double now = hal_clock_us();
+	int64_t next[HAL_SIM_GPIO_PINS];
+	for (int pin = 0; pin < HAL_SIM_GPIO_PINS; pin++) {
+		if ((edges_pins & (1ULL << pin)) == 0 || gpio[pin].freq_hz <= 0) continue;
+		int64_t j = (int64_t)floor(edges_from_us * 2 * gpio[pin].freq_hz / 1e6) - 1;
+		while (gpio_edge_us(pin, j) <= edges_from_us) j++;
+		next[pin] = j;
+	}
+	while (n < max) {
+		int first = -1;
+		double t = now;
+		for (int pin = 0; pin < HAL_SIM_GPIO_PINS; pin++) {
+			if ((edges_pins & (1ULL << pin)) == 0 || gpio[pin].freq_hz <= 0) continue;
+			double edge = gpio_edge_us(pin, next[pin]);
+			if (edge < t) {
+				t = edge;
+				first = pin;
+			}
+		}
+		if (first < 0) break;
+		if (next[first] & 1) {
+			edges_levels &= ~(1ULL << first);
+		} else {
+			edges_levels |= 1ULL << first;
+		}
+		next[first]++;
+		edges_from_us = t;
+		edges[n++] = (HAL_GPIO_EDGE_t) { .t_us = (int64_t)t, .levels = edges_levels };
+	}
+	if (n < max) edges_from_us = now;
+	return n;
+}
+
+uint32_t hal_gpio_edges_dropped(void)
+{
+	return 0;
+}
+
+// the rising edges of square_level() since the start, jitter left out
+static int pulse_pins[HAL_PULSE_PINS] = { -1, -1, -1, -1 };
+static int64_t pulse_from_us[HAL_PULSE_PINS];
+
+static int find_pulse(int pin)
+{
+	for (int i = 0; i < HAL_PULSE_PINS; i++) {
+		if (pulse_pins[i] == pin) return i;
+	}
+	return -1;
+}
+
+esp_err_t hal_pulse_start(int pin)
+{
+	if (pin < 0 || pin >= HAL_SIM_GPIO_PINS) return ESP_ERR_INVALID_ARG;
+	if (find_pulse(pin) >= 0) return ESP_OK;
+	int i = find_pulse(-1);
+	if (i < 0) return ESP_ERR_NO_MEM;
+	pulse_pins[i] = pin;
+	pulse_from_us[i] = hal_clock_us();
+	return ESP_OK;
+}
+
+void hal_pulse_stop(int pin)
+{
+	int i = find_pulse(pin);
+	if (i >= 0) pulse_pins[i] = -1;
+}
+
+int64_t hal_pulse_count(int pin)
+{
+	int i = find_pulse(pin);
+	if (i < 0 || pin < 0) return -1;
+	if (gpio[pin].freq_hz <= 0) return 0;
+	double period_us = 1e6 / gpio[pin].freq_hz;
+	return (int64_t)floor(hal_clock_us() / period_us) - (int64_t)floor(pulse_from_us[i] / period_us);
+}
+
+esp_err_t hal_dac_stream_start(int channel, uint32_t rate_hz, size_t len, HAL_DAC_REFILL_t refill, void *arg)
+{
+	if (dac.running) return ESP_ERR_INVALID_STATE;
+	if ((channel != 1 && channel != 2) || rate_hz == 0 || len == 0) return ESP_ERR_INVALID_ARG;
+	free(dac.ring);
+	dac.ring = calloc(DAC_RING, len);
+	if (dac.ring == NULL) return ESP_ERR_NO_MEM;
+	dac.refill = refill;
+	dac.arg = arg;
+	dac.rate_hz = rate_hz;
+	dac.len = len;
+	// the first two are ready when it starts, like the descriptors of the DMA
+	refill(dac.ring, len, arg);
+	refill(dac.ring + len, len, arg);
+	dac.filled = 2;
+	dac.start_us = hal_clock_us();
+	dac.running = true;
+	dac.stopped = false;
+	if (xTaskCreate(dac_task, "dac_task", 1024 * 2, NULL, 10, NULL) != pdPASS) {
+		dac.running = false;
+		return ESP_ERR_NO_MEM;
+	}
+	ESP_LOGI(TAG, "DAC %d at %u Hz", channel, (unsigned)rate_hz);
+	return ESP_OK;
+}
+
+void hal_dac_stream_stop(void)
+{
+	if (!dac.running) return;
+	dac.running = false;
+	while (!dac.stopped) vTaskDelay(1);
+}
+
+// the alarm is a task that sleeps until the next time, the us of a real timer are not promised
+static struct {
+	HAL_ALARM_t fn;
+	void *arg;
+	int64_t start_us;
+	volatile bool running;
+	volatile bool stopped;
+} alarm_sim;
+
+static void alarm_task(void *pvParameters)
+{
+	int64_t next = 0;
+	while (alarm_sim.running && next >= 0) {
+		int64_t now = hal_clock_us() - alarm_sim.start_us;
+		if (now < next) {
+			// at least once a ms, to see a stop
+			usleep(next - now < 1000 ? next - now : 1000);
+			continue;
+		}
+		next = alarm_sim.fn(now, alarm_sim.arg);
+	}
+	alarm_sim.stopped = true;
+	vTaskDelete(NULL);
+}
+
+esp_err_t hal_alarm_start(HAL_ALARM_t fn, void *arg)
+{
+	hal_alarm_stop();
+	alarm_sim.fn = fn;
+	alarm_sim.arg = arg;
+	alarm_sim.start_us = hal_clock_us();
+	alarm_sim.running = true;
+	alarm_sim.stopped = false;
+	if (xTaskCreate(alarm_task, "alarm_task", 1024 * 2, NULL, 12, NULL) != pdPASS) {
+		alarm_sim.running = false;
+		return ESP_ERR_NO_MEM;
+	}
+	return ESP_OK;
+}
+
+void hal_alarm_stop(void)
+{
+	if (!alarm_sim.running) return;
+	alarm_sim.running = false;
+	while (!alarm_sim.stopped) vTaskDelay(1);
+}
+
+// the tick is a task that sleeps until absolute times period_us apart, so it does not drift;
+// like a timer whose interrupt is still pending it does not make up the ticks it missed
+static struct {
+	HAL_TICK_t fn;
+	void *arg;
+	uint32_t period_us;
+	int64_t start_ns;
+	volatile bool running;
+	volatile bool stopped;
+} tick_sim;
+
+static void tick_task(void *pvParameters)
+{
+	const int64_t period_ns = tick_sim.period_us * 1000LL;
+	struct timespec ts;
+	int64_t next = tick_sim.start_ns + period_ns;
+	while (tick_sim.running) {
+		ts.tv_sec = next / 1000000000LL;
+		ts.tv_nsec = next % 1000000000LL;
+		if (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) != 0) continue;
+		if (!tick_sim.running) break;
+		tick_sim.fn(tick_sim.arg);
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		int64_t now = ts.tv_sec * 1000000000LL + ts.tv_nsec;
+		next += period_ns;
+		if (next <= now) next += (now - next) / period_ns * period_ns + period_ns;
+	}
+	tick_sim.stopped = true;
+	vTaskDelete(NULL);
+}
+
+esp_err_t hal_tick_start(uint32_t period_us, HAL_TICK_t tick, void *arg)
+{
+	if (period_us == 0) return ESP_ERR_INVALID_ARG;
+	hal_tick_stop();
+	tick_sim.fn = tick;
+	tick_sim.arg = arg;
+	tick_sim.period_us = period_us;
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	tick_sim.start_ns = ts.tv_sec * 1000000000LL + ts.tv_nsec;
+	tick_sim.running = true;
+	tick_sim.stopped = false;
+	if (xTaskCreate(tick_task, "tick_task", 1024 * 2, NULL, 22, NULL) != pdPASS) {
+		tick_sim.running = false;
+		return ESP_ERR_NO_MEM;
+	}
+	return ESP_OK;
+}
+
+void hal_tick_stop(void)
+{
+	if (!tick_sim.running) return;
+	tick_sim.running = false;
+	while (!tick_sim.stopped) vTaskDelay(1);
+}
+
+int64_t hal_clock_us(void)
+{
+	return esp_timer_get_time();
+}
+
+esp_err_t hal_storage_get(const char *key, void *buf, size_t *len)
+{
+	char path[300];
+	snprintf(path, sizeof(path), "%s/%s", storage_dir, key);
+	FILE *fp = fopen(path, "rb");
+	if (fp == NULL) return ESP_ERR_NOT_FOUND;
+	size_t n = fread(buf, 1, *len, fp);
+	fclose(fp);
+	*len = n;
+	return ESP_OK;
+}
+
+esp_err_t hal_storage_set(const char *key, const void *buf, size_t len)
+{
+	char path[300];
+	snprintf(path, sizeof(path), "%s/%s", storage_dir, key);
+	FILE *fp = fopen(path, "wb");
+	if (fp == NULL) return ESP_FAIL;
+	size_t n = fwrite(buf, 1, len, fp);
+	fclose(fp);
+	return n == len ? ESP_OK : ESP_FAIL;
+}
@@ -0,0 +1,52 @@
+/*
+	 Configuration of the simulated signals of the Linux backend of hal.h
+*/
+
+#ifndef HOST_HAL_SIM_H_
+#define HOST_HAL_SIM_H_
+
+#include "esp_err.h"
+
+#define HAL_SIM_ADC_CHANNELS 10
+#define HAL_SIM_GPIO_PINS 48
+
+typedef enum {
+	HAL_SIM_NONE = 0,
+	HAL_SIM_SINE,
+	HAL_SIM_SQUARE,
+	HAL_SIM_NOISE,
+	HAL_SIM_FILE,
+	HAL_SIM_DAC,		// wired to the DAC output
+} HAL_SIM_WAVE_t;
+
+typedef struct {
+	HAL_SIM_WAVE_t wave;
+	double freq_hz;
+	double amplitude_mv;
+	double offset_mv;
+	double jitter_us;	// square: each edge is moved by up to this much
+	double noise_mv;	// added to every wave
+	const char *path;	// file: one value in mV per line, played in a loop
+	double rate_hz;		// file: playback rate
+} HAL_SIM_SIGNAL_t;
+
+esp_err_t hal_sim_set_adc(int channel, const HAL_SIM_SIGNAL_t *signal);
+
+// simulated edges on an input pin, a square wave at freq_hz
+esp_err_t hal_sim_set_gpio(int pin, double freq_hz, double jitter_us);
+
+/*
+	 Parses one signal description, as given on the ioto_sim command line:
+		adcN=sine:FREQ:AMP_MV:OFFSET_MV[:NOISE_MV]
+		adcN=square:FREQ:AMP_MV:OFFSET_MV[:JITTER_US[:NOISE_MV]]
+		adcN=noise:AMP_MV:OFFSET_MV
+		adcN=file:PATH:RATE_HZ
+		adcN=dac[:NOISE_MV]
+		gpioN=FREQ[:JITTER_US]
+*/
+esp_err_t hal_sim_parse(const char *spec);
+
+// directory holding the hal_storage_* keys, one file each
+void hal_sim_set_storage_dir(const char *dir);
+
+#endif /* HOST_HAL_SIM_H_ */
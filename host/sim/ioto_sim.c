@@ -0,0 +1,102 @@
+/*
+	 ioto as a Linux process: the application of main/app.c on top of the
+	 FreeRTOS/lwIP/esp-mqtt shims and the simulated hal.
+
+	 usage: ioto_sim [-p port] [-d storage_dir] [-v level] [-s signal]... [-u]
+	                 [-y port[,master_ip:master_port]]
+
+	 -p  http/websocket port, default CONFIG_HTTP_PORT
+	 -d  directory for the hal_storage_* keys
+	 -v  log level, 0 (none) to 5 (verbose)
+	 -s  simulated signal, see hal_sim_parse(), may be repeated
+	 -u  no time server: the wall clock of Linux stands in for SNTP
+	     otherwise, with -u times stay relative to the start like on a
+	     network without internet
+	 -y  clock synchronization (main/clocksync.h) on UDP port, following
+	     the master given, the master itself without one
+*/
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "sdkconfig.h"
+#include "esp_log.h"
+
+#include "app.h"
+#include "hal.h"
+#include "hal_sim.h"
+#include "timebase.h"
+
+static const char *TAG = "ioto_sim";
+
+// "port" or "port,ip:port"
+static bool parse_clocksync(char *arg)
+{
+	char *master = strchr(arg, ',');
+	char *master_port = master ? strchr(master, ':') : NULL;
+	if (master && !master_port) return false;
+	if (master) {
+		*master++ = 0;
+		*master_port++ = 0;
+	}
+	int port = atoi(arg);
+	if (port <= 0 || port > 65535) return false;
+	app_set_clocksync(port, master, master ? atoi(master_port) : 0);
+	return true;
+}
+
+int main(int argc, char **argv)
+{
+	int port = CONFIG_HTTP_PORT;
+	bool synced = true;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "p:d:v:s:uy:")) != -1) {
+		switch (opt) {
+			case 'p':
+				port = atoi(optarg);
+				break;
+			case 'd':
+				hal_sim_set_storage_dir(optarg);
+				break;
+			case 'v':
+				esp_log_level_set("*", atoi(optarg));
+				break;
+			case 's':
+				if (hal_sim_parse(optarg) != ESP_OK) {
+					fprintf(stderr, "bad signal: %s\n", optarg);
+					return 2;
+				}
+				break;
+			case 'u':
+				synced = false;
+				break;
+			case 'y':
+				if (!parse_clocksync(optarg)) {
+					fprintf(stderr, "bad clock sync: %s\n", optarg);
+					return 2;
+				}
+				break;
+			default:
+				fprintf(stderr, "usage: %s [-p port] [-d storage_dir] [-v level] [-s signal]... [-u] [-y port[,master_ip:master_port]]\n", argv[0]);
+				return 2;
+		}
+	}
+
+	// a soak run is killed, not stopped: what it logged to a file must be there
+	setvbuf(stdout, NULL, _IOLBF, 0);
+	ESP_ERROR_CHECK(hal_init());
+	ESP_LOGI(TAG, "web application on http://127.0.0.1:%d/", port);
+	app_start("127.0.0.1", port);
+	if (synced) {
+		struct timespec ts;
+		clock_gettime(CLOCK_REALTIME, &ts);
+		timebase_set_anchor((int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000, hal_clock_us());
+	}
+	app_loop();
+	return 0;
+}
@@ -0,0 +1,85 @@
+/*
+	 Test runner for the host build, see test.h.
+
+	 usage: ioto_test [-l] [-f prefix]
+
+	 -l  list the tests
+	 -f  only run the tests whose name starts with prefix
+*/
+
+#define _GNU_SOURCE
+#include <setjmp.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "esp_log.h"
+
+#include "test.h"
+
+static TEST_t *test_list;
+static TEST_t **test_tail = &test_list;
+static TEST_t *current;
+static jmp_buf failed;
+
+void test_register(TEST_t *t)
+{
+	*test_tail = t;
+	test_tail = &t->next;
+}
+
+void test_fail(const char *what, long long got)
+{
+	fprintf(stderr, "FAIL %s: %s (%lld)\n", current->name, what, got);
+	longjmp(failed, 1);
+}
+
+static double now_s(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv)
+{
+	const char *prefix = NULL;
+	int list = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "lf:")) != -1) {
+		switch (opt) {
+			case 'l': list = 1; break;
+			case 'f': prefix = optarg; break;
+			default:
+				fprintf(stderr, "usage: %s [-l] [-f prefix]\n", argv[0]);
+				return 2;
+		}
+	}
+
+	if (list) {
+		for (TEST_t *t = test_list; t; t = t->next) printf("%s\n", t->name);
+		return 0;
+	}
+
+	// the code under test logs like it does on the board, but nobody reads it here
+	esp_log_level_set("*", ESP_LOG_NONE);
+
+	int run = 0, failures = 0;
+	for (TEST_t *t = test_list; t; t = t->next) {
+		if (prefix && strncmp(t->name, prefix, strlen(prefix)) != 0) continue;
+		current = t;
+		run++;
+		double start = now_s();
+		if (setjmp(failed) == 0) {
+			t->fn();
+			printf("ok   %-36s %8.3f s\n", t->name, now_s() - start);
+		} else {
+			failures++;
+		}
+		fflush(stdout);
+	}
+	printf("%d tests, %d failed\n", run, failures);
+	return failures || run == 0 ? 1 : 0;
+}
@@ -0,0 +1,41 @@
+/*
+	 Test runner for the host build.
+
+	 A test is a function that checks the code under test and calls
+	 test_fail() on the first thing that is not as it should be:
+
+		TEST(codec_roundtrip) {
+			int count = codec_decode(out, len, back, 64);
+			if (count != 64) test_fail("decoded count", count);
+		}
+
+	 test_fail() reports the test, what failed and the value it got, and
+	 ends the test; the runner goes on with the next one and exits with 1
+	 when any failed. host/CMakeLists.txt registers the tests of every
+	 module with ctest. Timings belong in host/bench, not here.
+*/
+
+#ifndef HOST_TEST_H_
+#define HOST_TEST_H_
+
+typedef struct TEST_s TEST_t;
+
+struct TEST_s {
+	const char *name;
+	void (*fn)(void);
+	TEST_t *next;
+};
+
+void test_register(TEST_t *t);
+__attribute__((noreturn)) void test_fail(const char *what, long long got);
+
+#define TEST(id)                                                            \
+	static void test_##id(void);                                            \
+	static TEST_t test_entry_##id = { #id, test_##id };                     \
+	__attribute__((constructor)) static void test_register_##id(void)       \
+	{                                                                       \
+		test_register(&test_entry_##id);                                    \
+	}                                                                       \
+	static void test_##id(void)
+
+#endif /* HOST_TEST_H_ */
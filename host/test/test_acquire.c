@@ -0,0 +1,53 @@
+/*
+	 main/acquire.c on the Linux hal: the readings come at the rate asked
+	 for, each taken close to its own time instead of in a burst once per
+	 FreeRTOS tick. ctest runs it with the tick of the host build and with
+	 the 100 Hz of ESP-IDF (ioto_test_hz100).
+*/
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "acquire.h"
+#include "hal.h"
+#include "hal_sim.h"
+#include "test.h"
+
+#define CHANNEL 6
+#define RATE_HZ 1000
+#define PERIOD_US (1000000 / RATE_HZ)
+#define BLOCKS 20
+
+TEST(acquire_fixed_rate) {
+	HAL_SIM_SIGNAL_t sine = { .wave = HAL_SIM_SINE, .freq_hz = 50, .amplitude_mv = 1000, .offset_mv = 1250 };
+	hal_sim_set_adc(CHANNEL, &sine);
+	int64_t start = hal_clock_us();
+	if (acquire_start(1 << CHANNEL, RATE_HZ) != ESP_OK) test_fail("start", 0);
+	int blocks = 0, samples = 0, late = 0;
+	int64_t t0 = 0, last = 0;
+	while (blocks < BLOCKS) {
+		if (hal_clock_us() - start > 5000000) test_fail("blocks in 5 s", blocks);
+		const SAMPLE_BLOCK_t *block = acquire_peek();
+		if (block == NULL) {
+			vTaskDelay(1);
+			continue;
+		}
+		if (block->period_us != PERIOD_US) test_fail("period", block->period_us);
+		if (block->count != ACQ_BLOCK_SAMPLES) test_fail("readings in a block", block->count);
+		if (block->seq != blocks) test_fail("block dropped", block->seq);
+		if (blocks == 0) t0 = block->t0_us;
+		for (int i = 0; i < block->count; i++, samples++) {
+			if (block->lag_us[i] > PERIOD_US / 2) late++;
+		}
+		last = block->t0_us + (int64_t)(block->count - 1) * PERIOD_US;
+		blocks++;
+		acquire_release();
+	}
+	// read once per 10 ms tick, nine in ten were several periods late; a loaded host
+	// may keep the task from running for a while, half of them is plenty
+	if (late * 2 > samples) test_fail("readings more than half a period late", late);
+	// the times of the readings are those of the clock
+	int64_t behind = hal_clock_us() - last;
+	if (behind < 0 || behind > 100000) test_fail("readings behind the clock, us", behind);
+	if (t0 - start > 100000) test_fail("first reading after, us", t0 - start);
+}
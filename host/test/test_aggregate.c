@@ -0,0 +1,301 @@
+/*
+	 tools/ingest.c and tools/archive.c on the streams of synthetic boards
+	 (sim/boardsim.c): blocks that come out of order, twice, too late or
+	 never are put back in order, left out or given up as a gap; the
+	 samples and their times read back from the archive are the ones sent;
+	 a range cuts blocks where it should; what a crash leaves at the end of
+	 the files is dropped when opening again. The datagrams of boards
+	 published on their MQTT topics through a broker (sim/brokersim.c) are
+	 all archived, each under the board of its topic.
+*/
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+
+#include "mqtt_client.h"
+
+#include "archive.h"
+#include "boardsim.h"
+#include "brokersim.h"
+#include "ingest.h"
+#include "test.h"
+
+#define BLOCK BOARDSIM_BLOCK
+#define PERIOD_US BOARDSIM_PERIOD_US
+#define FIRST_ADDR BOARDSIM_FIRST_ADDR
+#define LATENCY_US 2000
+#define BASE_US 1760781600000000LL	// archive time of board time 0
+#define MQTT_BOARDS 4
+#define MQTT_STEPS 200
+
+static char dir[] = "/tmp/ioto_test_archive_XXXXXX";
+static char path[64];
+static char index_path[80];
+static ARCHIVE_t archive;
+static INGEST_t ingest;
+
+typedef struct {
+	uint64_t samples;
+	uint64_t mismatches;
+	int64_t first_us;
+	int64_t last_us;
+} READ_t;
+
+static void setup(void)
+{
+	static int ready;
+	if (!ready) {
+		if (boardsim_init() != 0) test_fail("encode", 0);
+		if (mkdtemp(dir) == NULL) test_fail("mkdtemp", 0);
+		snprintf(path, sizeof(path), "%s/archive", dir);
+		snprintf(index_path, sizeof(index_path), "%s.idx", path);
+		ready = 1;
+	}
+	unlink(path);
+	unlink(index_path);
+	if (archive_open(&archive, path, true) != 0) test_fail("open", 0);
+	ingest_init(&ingest, &archive);
+}
+
+static void close_archive(void)
+{
+	ingest_free(&ingest);
+	if (archive_close(&archive) != 0) test_fail("close", 0);
+}
+
+static void give(int board, uint64_t step)
+{
+	size_t len;
+	const uint8_t *d = boardsim_datagram(board, step, &len);
+	int64_t end_us = (step / BOARDSIM_CHANNELS + 1) * BLOCK * PERIOD_US;
+	ingest_datagram(&ingest, FIRST_ADDR + board, d, len, BASE_US + end_us + LATENCY_US);
+}
+
+// board 0: 400 steps out of order by up to 8, 52 twice while it waits for 48, 150 never,
+// 20 again much later; board 1: in order, 61 never, the block after it held until INGEST_WAIT_US
+static void feed(void)
+{
+	for (uint64_t k = 0; k < 400; k += 8) {
+		for (int i = 7; i >= 0; i--) {
+			if (k + i != 150) give(0, k + i);
+			if (k + i == 52) give(0, 52);
+		}
+		if (k == 200) give(0, 20);
+	}
+	for (uint64_t k = 0; k < 100; k++) {
+		if (k != 61) give(1, k);
+	}
+}
+
+static void feed_and_close(void)
+{
+	feed();
+	int64_t now_us = BASE_US + 100 * BLOCK * PERIOD_US;
+	ingest_tick(&ingest, now_us + INGEST_WAIT_US + LATENCY_US);
+	ingest_flush(&ingest);
+	close_archive();
+}
+
+// the samples read back against the generator, and their times
+static void compare(const ARCHIVE_BLOCK_t *block, void *arg)
+{
+	READ_t *r = arg;
+	int board = block->board - FIRST_ADDR;
+	for (int i = 0; i < block->count; i++) {
+		int64_t t_us = block->t0_us + (int64_t)i * block->period_us;
+		int64_t board_us = t_us - BASE_US - LATENCY_US;
+		if (block->raw[i] != boardsim_sample(board, block->channel, board_us / PERIOD_US) || board_us % PERIOD_US) {
+			r->mismatches++;
+		}
+		if (r->samples == 0 || t_us < r->first_us) r->first_us = t_us;
+		if (r->samples == 0 || t_us > r->last_us) r->last_us = t_us;
+		r->samples++;
+	}
+}
+
+static READ_t read_back(int board, int channel, int64_t from_us, int64_t to_us)
+{
+	READ_t r = { 0 };
+	if (archive_query(&archive, board < 0 ? 0 : FIRST_ADDR + board, channel, from_us, to_us, compare, &r) < 0) {
+		test_fail("damaged", 0);
+	}
+	if (r.mismatches) test_fail("samples read back", r.mismatches);
+	return r;
+}
+
+TEST(aggregate_reorder) {
+	setup();
+	feed();
+	if (ingest.stats.gaps != 1) test_fail("gaps", ingest.stats.gaps);
+	if (ingest.stats.duplicates != 1) test_fail("duplicates", ingest.stats.duplicates);
+	if (ingest.stats.late != 1) test_fail("late", ingest.stats.late);
+	int64_t now_us = BASE_US + 100 * BLOCK * PERIOD_US;
+	ingest_tick(&ingest, now_us);
+	if (ingest.stats.gaps != 1) test_fail("gave up too soon", ingest.stats.gaps);
+	ingest_tick(&ingest, now_us + INGEST_WAIT_US + LATENCY_US);
+	if (ingest.stats.gaps != 2) test_fail("gave up after INGEST_WAIT_US", ingest.stats.gaps);
+	ingest_flush(&ingest);
+	INGEST_BOARD_t *b = ingest_board(&ingest, FIRST_ADDR);
+	if (b == NULL) test_fail("board", 0);
+	if (b->offset_us != BASE_US + LATENCY_US) test_fail("offset", b->offset_us - BASE_US);
+	if (b->datagrams != 401 || b->reordered == 0) test_fail("datagrams", b->datagrams);
+	if (ingest.stats.blocks != 399 + 99) test_fail("blocks", ingest.stats.blocks);
+	close_archive();
+}
+
+TEST(aggregate_read_back) {
+	setup();
+	feed_and_close();
+	if (archive_open(&archive, path, false) != 0) test_fail("open to read", 0);
+	READ_t all = read_back(-1, -1, INT64_MIN, INT64_MAX);
+	if (all.samples != (399 + 99) * BLOCK) test_fail("samples", all.samples);
+	// seq 37 of channel 2 (step 150) was never there
+	int64_t first_us = BASE_US + LATENCY_US;
+	READ_t gap = read_back(0, 2, first_us + 36 * BLOCK * PERIOD_US, first_us + 39 * BLOCK * PERIOD_US);
+	if (gap.samples != 2 * BLOCK) test_fail("gap", gap.samples);
+	archive_close(&archive);
+}
+
+TEST(aggregate_range) {
+	setup();
+	feed_and_close();
+	if (archive_open(&archive, path, false) != 0) test_fail("open to read", 0);
+	// from the 10th sample of seq 5 to the 3rd of seq 9
+	int64_t from_us = BASE_US + LATENCY_US + (5 * BLOCK + 10) * PERIOD_US;
+	int64_t to_us = BASE_US + LATENCY_US + (9 * BLOCK + 3) * PERIOD_US;
+	READ_t cut = read_back(0, 1, from_us, to_us);
+	if (cut.samples != 4 * BLOCK - 7) test_fail("samples", cut.samples);
+	if (cut.first_us != from_us) test_fail("first", cut.first_us - from_us);
+	if (cut.last_us != to_us - PERIOD_US) test_fail("last", cut.last_us - to_us);
+	archive_close(&archive);
+}
+
+TEST(aggregate_crash) {
+	setup();
+	feed_and_close();
+	if (archive_open(&archive, path, false) != 0) test_fail("open to read", 0);
+	uint64_t entries = archive.entries;
+	archive_close(&archive);
+	// a crash halfway through a chunk and its entry: dropped, the rest is still there
+	FILE *f = fopen(path, "a");
+	fwrite("half a chunk", 1, 12, f);
+	fclose(f);
+	f = fopen(index_path, "a");
+	fwrite("half an entry", 1, 13, f);
+	fclose(f);
+	if (archive_open(&archive, path, true) != 0) test_fail("open after crash", 0);
+	if (archive.entries != entries) test_fail("entries", archive.entries);
+	if (archive.dropped != 25) test_fail("dropped", archive.dropped);
+	ingest_init(&ingest, &archive);
+	for (uint64_t k = 400; k < 480; k++) give(0, k);
+	ingest_flush(&ingest);
+	close_archive();
+	if (archive_open(&archive, path, false) != 0) test_fail("open to read", 0);
+	READ_t all = read_back(0, -1, INT64_MIN, INT64_MAX);
+	if (all.samples != (399 + 80) * BLOCK) test_fail("samples after the crash", all.samples);
+	archive_close(&archive);
+}
+
+// the topic board publishes on
+static void board_topic(int board, char *topic, size_t size)
+{
+	char name[INET_ADDRSTRLEN];
+	struct in_addr addr = { .s_addr = htonl(FIRST_ADDR + board) };
+	snprintf(topic, size, INGEST_MQTT_PREFIX "%s" INGEST_MQTT_SUFFIX, inet_ntop(AF_INET, &addr, name, sizeof(name)));
+}
+
+TEST(aggregate_mqtt_topic) {
+	setup();
+	char topic[64];
+	size_t len;
+	board_topic(1, topic, sizeof(topic));
+	const uint8_t *d = boardsim_datagram(1, 0, &len);
+	if (!ingest_mqtt(&ingest, topic, strlen(topic), d, len, BASE_US)) test_fail("topic of a board", 0);
+	if (ingest_board(&ingest, FIRST_ADDR + 1) == NULL) test_fail("board of the topic", 0);
+	static const char *others[] = { "ioto/127.0.1.2/streams", "ioto/board7/stream", "ioto//stream", "io/127.0.1.2/stream", "ioto/stream" };
+	for (int i = 0; i < 5; i++) {
+		if (ingest_mqtt(&ingest, others[i], strlen(others[i]), d, len, BASE_US)) test_fail("not the topic of a board", i);
+	}
+	if (ingest.stats.datagrams != 1 || ingest.stats.bad != 5) test_fail("bad", ingest.stats.bad);
+	close_archive();
+}
+
+static atomic_int mqtt_ready;
+static atomic_int mqtt_received;
+
+static esp_err_t subscriber_event(esp_mqtt_event_handle_t event)
+{
+	if (event->event_id == MQTT_EVENT_CONNECTED) esp_mqtt_client_subscribe(event->client, INGEST_MQTT_TOPIC, 0);
+	if (event->event_id == MQTT_EVENT_SUBSCRIBED) atomic_fetch_add(&mqtt_ready, 1);
+	if (event->event_id == MQTT_EVENT_DATA) {
+		// message k is step k / MQTT_BOARDS, it arrives when give() would give it
+		uint64_t step = atomic_load(&mqtt_received) / MQTT_BOARDS;
+		int64_t end_us = (step / BOARDSIM_CHANNELS + 1) * BLOCK * PERIOD_US;
+		ingest_mqtt(&ingest, event->topic, event->topic_len, (const uint8_t *)event->data, event->data_len,
+			BASE_US + end_us + LATENCY_US);
+		atomic_fetch_add(&mqtt_received, 1);
+	}
+	return ESP_OK;
+}
+
+static esp_err_t publisher_event(esp_mqtt_event_handle_t event)
+{
+	if (event->event_id == MQTT_EVENT_CONNECTED) atomic_fetch_add(&mqtt_ready, 1);
+	return ESP_OK;
+}
+
+// waits up to 5 s for *counter to reach value
+static void wait_for(atomic_int *counter, int value, const char *what)
+{
+	for (int ms = 0; atomic_load(counter) < value; ms++) {
+		if (ms == 5000) test_fail(what, atomic_load(counter));
+		usleep(1000);
+	}
+}
+
+TEST(aggregate_mqtt_broker) {
+	setup();
+	uint16_t port = 0;
+	if (brokersim_start(&port) != 0) test_fail("broker", 0);
+	char uri[40];
+	snprintf(uri, sizeof(uri), "mqtt://127.0.0.1:%u", port);
+	esp_mqtt_client_config_t config = { .event_handle = subscriber_event, .uri = uri, .buffer_size = 2048 };
+	esp_mqtt_client_handle_t sub = esp_mqtt_client_init(&config);
+	config.event_handle = publisher_event;
+	esp_mqtt_client_handle_t pub = esp_mqtt_client_init(&config);
+	atomic_store(&mqtt_ready, 0);
+	atomic_store(&mqtt_received, 0);
+	esp_mqtt_client_start(sub);
+	esp_mqtt_client_start(pub);
+	wait_for(&mqtt_ready, 2, "clients ready");
+	char topic[64];
+	for (uint64_t step = 0; step < MQTT_STEPS; step++) {
+		for (int board = 0; board < MQTT_BOARDS; board++) {
+			size_t len;
+			const uint8_t *d = boardsim_datagram(board, step, &len);
+			board_topic(board, topic, sizeof(topic));
+			if (esp_mqtt_client_publish(pub, topic, (const char *)d, len, 0, 0) < 0) test_fail("publish", step);
+		}
+	}
+	wait_for(&mqtt_received, MQTT_STEPS * MQTT_BOARDS, "messages");
+	esp_mqtt_client_destroy(pub);
+	esp_mqtt_client_destroy(sub);
+	BROKERSIM_STATS_t broker;
+	brokersim_get_stats(&broker);
+	brokersim_stop();
+	if (broker.received != MQTT_STEPS * MQTT_BOARDS || broker.sent != broker.received) test_fail("passed on", broker.sent);
+	ingest_flush(&ingest);
+	if (ingest.stats.bad || ingest.stats.gaps || ingest.boards != MQTT_BOARDS) test_fail("boards", ingest.boards);
+	close_archive();
+	if (archive_open(&archive, path, false) != 0) test_fail("open to read", 0);
+	for (int board = 0; board < MQTT_BOARDS; board++) {
+		READ_t all = read_back(board, -1, INT64_MIN, INT64_MAX);
+		if (all.samples != MQTT_STEPS * BLOCK) test_fail("samples of a board", board);
+	}
+	archive_close(&archive);
+}
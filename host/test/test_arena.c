@@ -0,0 +1,96 @@
+/*
+	 main/arena.c and main/json_arena.c: blocks are aligned from any
+	 buffer, a full arena says so, a reset gives everything back; cJSON
+	 parses a browser request on the arena without the heap, and one that
+	 outgrows it goes on the heap and is freed by cJSON_Delete().
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "cJSON.h"
+#include "sdkconfig.h"
+
+#include "arena.h"
+#include "json_arena.h"
+#include "test.h"
+
+static const char connect_request[] =
+	"{\"id\":\"connect-request\",\"host\":[\"broker.local\"],\"port\":[\"1883\"],"
+	"\"clientId\":[\"ioto\"],\"username\":[\"\"],\"password\":[\"\"],"
+	"\"topic\":[\"ioto/sub\",\"ioto/pub\"],\"qos\":[\"0\",\"1\"],\"payload\":[\"hello\"]}";
+
+static uint64_t buffer[4096 / sizeof(uint64_t)];
+
+TEST(arena_align) {
+	ARENA_t arena;
+	// an odd buffer still gives aligned blocks
+	arena_init(&arena, (uint8_t *)buffer + 3, sizeof(buffer) - 3);
+	if ((uintptr_t)arena.base % ARENA_ALIGN) test_fail("base not aligned", (uintptr_t)arena.base);
+	uint8_t *a = arena_alloc(&arena, 1);
+	uint8_t *b = arena_alloc(&arena, 13);
+	if (b - a != ARENA_ALIGN) test_fail("1 byte block", b - a);
+	if ((uintptr_t)b % ARENA_ALIGN) test_fail("block not aligned", (uintptr_t)b);
+	if (arena.used != 24 || arena.allocs != 2) test_fail("used", arena.used);
+	if (!arena_owns(&arena, b) || arena_owns(&arena, &arena)) test_fail("owns", 0);
+}
+
+TEST(arena_full_and_reset) {
+	ARENA_t arena;
+	arena_init(&arena, buffer, sizeof(buffer));
+	uint8_t *a = arena_alloc(&arena, 8);
+	if (arena_alloc(&arena, arena.size) != NULL) test_fail("too big", arena.size);
+	if (arena_alloc(&arena, (size_t)-1) != NULL) test_fail("overflow", 0);
+	if (arena_alloc(&arena, arena.size - arena.used) == NULL) test_fail("exact fit", 0);
+	if (arena_alloc(&arena, 1) != NULL) test_fail("full", arena.used);
+	size_t size = arena.size;
+	arena_reset(&arena);
+	if (arena.used != 0 || arena.allocs != 0 || arena.high != size) test_fail("reset", arena.used);
+	if (arena_alloc(&arena, 8) != a) test_fail("reuse", 0);
+}
+
+static int count_items(const cJSON *item)
+{
+	int n = 0;
+	for (const cJSON *c = item ? item->child : NULL; c; c = c->next) n += 1 + count_items(c);
+	return n;
+}
+
+TEST(arena_json_request) {
+	json_arena_init();
+	JSON_ARENA_STATS_t before, after;
+	json_arena_get_stats(&before);
+	json_arena_begin();
+	cJSON *root = cJSON_Parse(connect_request);
+	cJSON *host = cJSON_GetArrayItem(cJSON_GetObjectItem(root, "host"), 0);
+	if (!cJSON_IsString(host) || strcmp(host->valuestring, "broker.local") != 0) test_fail("parsed", 0);
+	if (count_items(root) != 19) test_fail("items", count_items(root));
+	cJSON_Delete(root);
+	json_arena_end();
+	json_arena_get_stats(&after);
+	cJSON_InitHooks(NULL);
+	if (after.requests != before.requests + 1) test_fail("requests", after.requests - before.requests);
+	if (after.heap_allocs != before.heap_allocs) test_fail("heap allocations", after.heap_allocs - before.heap_allocs);
+	if (after.high == 0 || after.high > after.size) test_fail("arena used", after.high);
+}
+
+TEST(arena_json_outgrown) {
+	// a request of twice the arena: what does not fit is on the heap, the tree is whole
+	static char big[2 * CONFIG_JSON_ARENA_SIZE + 64];
+	int len = sprintf(big, "{\"id\":\"publish-request\",\"payload\":[");
+	int values = 0;
+	for (; len < 2 * CONFIG_JSON_ARENA_SIZE; values++) len += sprintf(big + len, "%s\"v%d\"", values ? "," : "", values);
+	sprintf(big + len, "]}");
+	json_arena_init();
+	JSON_ARENA_STATS_t before, after;
+	json_arena_get_stats(&before);
+	json_arena_begin();
+	cJSON *root = cJSON_Parse(big);
+	int items = count_items(root);
+	cJSON_Delete(root);
+	json_arena_end();
+	json_arena_get_stats(&after);
+	cJSON_InitHooks(NULL);
+	if (items != 2 + values) test_fail("items", items);
+	if (after.heap_allocs == before.heap_allocs) test_fail("no heap allocation", 0);
+}
@@ -0,0 +1,97 @@
+/*
+	 main/clocksync.c without a network: a follower whose oscillator runs
+	 50 ppm fast exchanges with a master through a link with queueing
+	 jitter, one exchange per simulated second. The packets round trip,
+	 the shared clock ends up within 20 us of the master with the drift
+	 within 1 ppm, it never jumps while locked, and a restart of the
+	 master costs one step.
+*/
+
+#include <string.h>
+
+#include "clocksync.h"
+#include "test.h"
+
+#define DRIFT_PPM 50
+
+static uint32_t rng;
+
+static uint32_t next_random(void)
+{
+	rng ^= rng << 13;
+	rng ^= rng >> 17;
+	rng ^= rng << 5;
+	return rng;
+}
+
+// one way: 300 us on the wire, and now and then a queue of up to 5 ms
+static int64_t one_way_us(void)
+{
+	uint32_t r = next_random();
+	return 300 + (r % 4 == 0 ? (r >> 8) % 5000 : (r >> 8) % 20);
+}
+
+static int64_t follower_clock(int64_t true_us)
+{
+	return 5000000 + true_us + true_us * DRIFT_PPM / 1000000;
+}
+
+// an exchange at true time t, the master's clock is true time plus master_us
+static void exchange(CLOCKSYNC_SERVO_t *servo, int64_t t, int64_t master_us)
+{
+	int64_t t1 = follower_clock(t);
+	t += one_way_us();
+	int64_t t2 = t + master_us;
+	t += 40;
+	int64_t t3 = t + master_us;
+	t += one_way_us();
+	int64_t before = clocksync_servo_to_shared(servo, follower_clock(t));
+	bool locked = servo->locked;
+	clocksync_servo_update(servo, t1, t2, t3, follower_clock(t));
+	int64_t after = clocksync_servo_to_shared(servo, follower_clock(t));
+	if (locked && servo->steps == 0 && after != before) test_fail("shared clock jumped, us", after - before);
+}
+
+static void check_error(const CLOCKSYNC_SERVO_t *servo, int64_t t, int64_t master_us, int64_t limit_us)
+{
+	if (!servo->locked) test_fail("unlocked at s", t / 1000000);
+	int64_t error = clocksync_servo_to_shared(servo, follower_clock(t)) - (t + master_us);
+	if (error > limit_us || error < -limit_us) test_fail("shared clock off, us", error);
+}
+
+TEST(clocksync_packet) {
+	CLOCKSYNC_PACKET_t packet = { CLOCKSYNC_RESPONSE, 7, -1, 1LL << 40, 123456789012LL, 1700000000000000LL }, back;
+	uint8_t buf[CLOCKSYNC_PACKET_SIZE];
+	if (clocksync_put_packet(buf, sizeof(buf), &packet) != CLOCKSYNC_PACKET_SIZE) test_fail("put", 0);
+	if (clocksync_get_packet(buf, sizeof(buf), &back) != CLOCKSYNC_PACKET_SIZE) test_fail("get", 0);
+	if (memcmp(&packet, &back, sizeof(back)) != 0) test_fail("round trip", 0);
+	if (clocksync_get_packet(buf, sizeof(buf) - 1, &back) >= 0) test_fail("short packet taken", sizeof(buf) - 1);
+}
+
+TEST(clocksync_lock_and_drift) {
+	CLOCKSYNC_SERVO_t servo;
+	clocksync_servo_init(&servo);
+	rng = 12345;
+	int64_t t = 1000000, master_us = 20000000;
+	for (int i = 0; i < 60; i++, t += 1000000) exchange(&servo, t, master_us);
+	check_error(&servo, t, master_us, 20);
+	// the follower runs fast, the master is behind it by DRIFT_PPM
+	if (servo.drift_ppb > -DRIFT_PPM * 1000 + 1000 || servo.drift_ppb < -DRIFT_PPM * 1000 - 1000) test_fail("drift ppb", servo.drift_ppb);
+	if (servo.steps != 0) test_fail("steps", servo.steps);
+	if (servo.filtered == 0) test_fail("queued exchanges not filtered", 0);
+	int64_t local = clocksync_servo_to_local(&servo, t + master_us);
+	if (local - follower_clock(t) > 20 || local - follower_clock(t) < -20) test_fail("to local, us", local - follower_clock(t));
+}
+
+TEST(clocksync_master_restart) {
+	CLOCKSYNC_SERVO_t servo;
+	clocksync_servo_init(&servo);
+	rng = 12345;
+	int64_t t = 1000000, master_us = 20000000;
+	for (int i = 0; i < 60; i++, t += 1000000) exchange(&servo, t, master_us);
+	// the master restarts with its clock at 0
+	master_us = -t;
+	for (int i = 0; i < 20; i++, t += 1000000) exchange(&servo, t, master_us);
+	check_error(&servo, t, master_us, 20);
+	if (servo.steps != 1) test_fail("steps after a restart", servo.steps);
+}
@@ -0,0 +1,103 @@
+/*
+	 main/codec.c: every binary encoding gives back exactly the samples it
+	 was given, on the waveforms of the bench and on the worst cases (full
+	 scale jumps, 16 bit samples, one sample), stays within
+	 codec_max_size(), and refuses a block that was cut short.
+*/
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "codec.h"
+#include "test.h"
+
+#define BITS 13			// ADC_WIDTH_BIT_13
+#define MAX_RAW 8191
+#define RATE_HZ 1000	// CONFIG_ACQ_SAMPLE_RATE_HZ
+#define BLOCK 64		// CONFIG_ACQ_BLOCK_SAMPLES
+#define WAVE_SAMPLES (BLOCK * 64)
+
+static uint16_t wave[WAVE_SAMPLES];
+static uint8_t out[CODEC_MAX_SIZE(BLOCK * 4)];
+
+static double gauss(void)
+{
+	double sum = 0;
+	for (int i = 0; i < 4; i++) sum += (double)rand() / RAND_MAX - 0.5;
+	return sum * 1.732;
+}
+
+static uint16_t clamp(double v)
+{
+	if (v < 0) return 0;
+	if (v > MAX_RAW) return MAX_RAW;
+	return (uint16_t)lround(v);
+}
+
+// every codec, block by block
+static void round_trip(const uint16_t *samples, int len, int block, int bits)
+{
+	uint16_t back[BLOCK * 4];
+	for (CODEC_t codec = CODEC_PACKED; codec < CODEC_MAX; codec++) {
+		for (int pos = 0; pos + block <= len; pos += block) {
+			int size = codec_encode(codec, &samples[pos], block, bits, out, sizeof(out));
+			if (size < 0) test_fail(codec_name(codec), size);
+			if ((size_t)size > codec_max_size(block, bits)) test_fail("over codec_max_size", size);
+			if (codec_decode(out, size, back, block) != block) test_fail(codec_name(codec), pos);
+			if (memcmp(back, &samples[pos], block * sizeof(back[0])) != 0) test_fail(codec_name(codec), pos);
+		}
+	}
+}
+
+TEST(codec_sine) {
+	srand(1);
+	for (int i = 0; i < WAVE_SAMPLES; i++) wave[i] = clamp(4096 + 3000 * sin(2 * M_PI * 50 * i / RATE_HZ) + 2 * gauss());
+	round_trip(wave, WAVE_SAMPLES, BLOCK, BITS);
+}
+
+TEST(codec_square) {
+	srand(1);
+	for (int i = 0; i < WAVE_SAMPLES; i++) wave[i] = clamp((fmod(i * 10.0 / RATE_HZ, 1) < 0.5 ? 1000 : 6000) + 2 * gauss());
+	round_trip(wave, WAVE_SAMPLES, BLOCK, BITS);
+}
+
+TEST(codec_noise) {
+	srand(1);
+	for (int i = 0; i < WAVE_SAMPLES; i++) wave[i] = clamp(4096 + 200 * gauss());
+	round_trip(wave, WAVE_SAMPLES, BLOCK, BITS);
+}
+
+TEST(codec_dc) {
+	for (int i = 0; i < WAVE_SAMPLES; i++) wave[i] = 2000;
+	round_trip(wave, WAVE_SAMPLES, BLOCK, BITS);
+}
+
+// the largest residuals there are: Rice escapes on every sample
+TEST(codec_full_scale_jumps) {
+	for (int i = 0; i < WAVE_SAMPLES; i++) wave[i] = i & 1 ? MAX_RAW : 0;
+	round_trip(wave, WAVE_SAMPLES, BLOCK, BITS);
+	for (int i = 0; i < WAVE_SAMPLES; i++) wave[i] = (i * 40503u) & 0xffff;
+	round_trip(wave, WAVE_SAMPLES, BLOCK * 4, 16);
+}
+
+TEST(codec_short_blocks) {
+	for (int i = 0; i < WAVE_SAMPLES; i++) wave[i] = 100 + i % 7;
+	round_trip(wave, 8, 1, BITS);
+	round_trip(wave, 8, 2, BITS);
+	round_trip(wave, 21, 3, BITS);
+}
+
+TEST(codec_cut_short) {
+	uint16_t back[BLOCK];
+	srand(2);
+	for (int i = 0; i < BLOCK; i++) wave[i] = clamp(4096 + 200 * gauss());
+	for (CODEC_t codec = CODEC_PACKED; codec < CODEC_MAX; codec++) {
+		int size = codec_encode(codec, wave, BLOCK, BITS, out, sizeof(out));
+		if (codec_decode(out, size - 1, back, BLOCK) >= 0) test_fail(codec_name(codec), size - 1);
+		if (codec_decode(out, size, back, BLOCK - 1) >= 0) test_fail("more samples than the room", BLOCK);
+	}
+	if (codec_decode(out, CODEC_HEADER_SIZE - 1, back, BLOCK) >= 0) test_fail("header cut", 0);
+	if (codec_encode(CODEC_PACKED, wave, BLOCK, 17, out, sizeof(out)) >= 0) test_fail("17 bits", 17);
+	if (codec_encode(CODEC_RICE, wave, BLOCK, BITS, out, 10) >= 0) test_fail("output too small", 10);
+}
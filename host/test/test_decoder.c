@@ -0,0 +1,91 @@
+/*
+	 main/decoder.c: the decoder returns exactly the frames that went into
+	 a generated bit stream (sim/busgen.c), errors included, for every bus
+	 and SPI mode.
+*/
+
+#include "busgen.h"
+#include "decoder.h"
+#include "test.h"
+
+#define FRAMES 1000
+
+#define UART_RX 42
+#define I2C_SCL 41
+#define I2C_SDA 40
+#define SPI_SCK 39
+#define SPI_MOSI 38
+#define SPI_MISO 37
+#define SPI_CS 36
+
+static BUSGEN_t g;
+
+static void check(const DECODER_CONFIG_t *config)
+{
+	static DECODER_t d;
+	DECODER_EVENT_t out[DECODER_MAX_EVENTS];
+	if (g.full) test_fail("stream cut", g.nedges);
+	if (decoder_init(&d, config) != ESP_OK) test_fail("init", config->bus);
+	int got = 0;
+	for (int i = 0; i <= g.nedges; i++) {
+		int n = i < g.nedges ? decoder_feed(&d, g.edges[i].t_ns, g.edges[i].levels, out)
+			: decoder_flush(&d, g.edges[g.nedges - 1].t_ns + 1000000000LL, out);
+		for (int k = 0; k < n; k++, got++) {
+			if (got >= g.nexpected) test_fail("events", got + 1);
+			const DECODER_EVENT_t *e = &g.expected[got];
+			if (out[k].type != e->type) test_fail("type of event", got);
+			if (out[k].data != e->data || out[k].data2 != e->data2) test_fail("data of event", got);
+			if (out[k].ack != e->ack) test_fail("ack of event", got);
+			if (i < g.nedges && out[k].t_ns > g.edges[i].t_ns) test_fail("event after the edge that ends it", got);
+		}
+	}
+	if (got != g.nexpected) test_fail("events", got);
+}
+
+TEST(decoder_uart_8n1) {
+	DECODER_CONFIG_t c = { .bus = DECODER_UART, .uart = { .rx = UART_RX, .baud = 115200, .bits = 8, .stop = 1 } };
+	busgen_uart(&g, &c, FRAMES, 0);
+	check(&c);
+}
+
+TEST(decoder_uart_7e2_parity_errors) {
+	DECODER_CONFIG_t c = { .bus = DECODER_UART, .uart = { .rx = UART_RX, .baud = 9600, .bits = 7, .parity = DECODER_PARITY_EVEN, .stop = 2 } };
+	busgen_uart(&g, &c, FRAMES, 17);
+	check(&c);
+}
+
+TEST(decoder_uart_9o1) {
+	DECODER_CONFIG_t c = { .bus = DECODER_UART, .uart = { .rx = UART_RX, .baud = 57600, .bits = 9, .parity = DECODER_PARITY_ODD, .stop = 1 } };
+	busgen_uart(&g, &c, FRAMES, 0);
+	check(&c);
+}
+
+TEST(decoder_i2c) {
+	DECODER_CONFIG_t c = { .bus = DECODER_I2C, .i2c = { .scl = I2C_SCL, .sda = I2C_SDA } };
+	busgen_i2c(&g, &c, FRAMES);
+	check(&c);
+}
+
+#define SPI_TEST(id, mode_, bits_, lsb)                                                           \
+	TEST(decoder_spi_##id) {                                                                      \
+		DECODER_CONFIG_t c = { .bus = DECODER_SPI, .spi = { .sck = SPI_SCK, .mosi = SPI_MOSI,     \
+			.miso = SPI_MISO, .cs = SPI_CS, .mode = mode_, .bits = bits_, .lsb_first = lsb } };  \
+		busgen_spi(&g, &c, FRAMES);                                                               \
+		check(&c);                                                                                \
+	}
+
+SPI_TEST(mode0, 0, 8, 0)
+SPI_TEST(mode1, 1, 8, 0)
+SPI_TEST(mode2, 2, 8, 0)
+SPI_TEST(mode3_12bit_lsb, 3, 12, 1)
+
+TEST(decoder_bad_config) {
+	static DECODER_t d;
+	DECODER_CONFIG_t uart = { .bus = DECODER_UART, .uart = { .rx = UART_RX, .baud = 0, .bits = 8, .stop = 1 } };
+	if (decoder_init(&d, &uart) == ESP_OK) test_fail("baud 0", 0);
+	uart.uart.baud = 9600;
+	uart.uart.bits = 10;
+	if (decoder_init(&d, &uart) == ESP_OK) test_fail("10 bits", uart.uart.bits);
+	DECODER_CONFIG_t spi = { .bus = DECODER_SPI, .spi = { .sck = SPI_SCK, .mosi = SPI_MOSI, .miso = SPI_MISO, .cs = SPI_CS, .bits = 17 } };
+	if (decoder_init(&d, &spi) == ESP_OK) test_fail("17 bit words", spi.spi.bits);
+}
@@ -0,0 +1,146 @@
+/*
+	 main/ets.c against synthetic periodic signals with a known waveform.
+
+	 The ADC samples at 1 kHz with 5 mV of noise and 13 bits, the signals
+	 are far faster. A few seconds of acquisition have to cover every bin
+	 and stay within an error bound of the ground truth.
+
+	 ets_gpio_*   triggers are the true rising edges stamped with a 1 us
+	              timer and up to 2 us of interrupt latency, like
+	              hal_gpio_capture_read(); 1 us bins, 1 MS/s equivalent
+	 ets_inband_* triggers are interpolated from the readings, for a signal
+	              slow around its crossing; 20 us bins
+*/
+
+#include <math.h>
+#include <stddef.h>
+
+#include "ets.h"
+#include "test.h"
+
+#define PERIOD_NS 1000000		// 1 kHz ADC
+#define BLOCK 64
+#define BLOCKS 4000				// 4 s of acquisition
+#define MV_PER_LSB (2500.0 / 8191)
+#define TICK_NS 10000000
+
+typedef struct {
+	double freq_hz;
+	int square;					// sine otherwise
+	double amplitude_mv;
+	double offset_mv;
+} WAVE_t;
+
+static uint32_t rng = 0x2545f491;
+
+static double uniform(void)
+{
+	rng ^= rng << 13;
+	rng ^= rng >> 17;
+	rng ^= rng << 5;
+	return (double)rng / UINT32_MAX;
+}
+
+static double wave_mv(const WAVE_t *w, double t_ns)
+{
+	double cycles = t_ns * w->freq_hz / 1e9;
+	double phase = cycles - floor(cycles);
+	if (w->square) return w->offset_mv + (phase < 0.5 ? w->amplitude_mv : -w->amplitude_mv);
+	return w->offset_mv + w->amplitude_mv * sin(2 * M_PI * phase);
+}
+
+static uint16_t adc(const WAVE_t *w, double t_ns)
+{
+	double noise = 0;
+	for (int i = 0; i < 4; i++) noise += uniform() - 0.5;
+	double raw = (wave_mv(w, t_ns) + noise * 5 * 1.732) / MV_PER_LSB;
+	return raw < 0 ? 0 : raw > 8191 ? 8191 : (uint16_t)(raw + 0.5);
+}
+
+// one block of readings, and for gpio the edges that happened during it
+static void feed(ETS_t *ets, const WAVE_t *w, int64_t block, int gpio)
+{
+	int64_t t0 = block * BLOCK * PERIOD_NS;
+	if (!gpio) {
+		uint16_t raw[BLOCK];
+		for (int i = 0; i < BLOCK; i++) raw[i] = adc(w, t0 + (double)i * PERIOD_NS);
+		ets_add_samples(ets, raw, BLOCK, t0, PERIOD_NS);
+		return;
+	}
+	double period_ns = 1e9 / w->freq_hz;
+	int64_t k = (int64_t)ceil(t0 / period_ns);
+	for (double edge = k * period_ns; edge < t0 + BLOCK * PERIOD_NS; edge += period_ns) {
+		int64_t stamp_us = (int64_t)((edge + uniform() * 2000) / 1000);
+		ets_add_trigger(ets, stamp_us * 1000);
+	}
+	// readings taken in bursts, one conversion after the other, stamped with the time they were taken
+	for (int i = 0; i < BLOCK; i++) {
+		int64_t due = t0 + (int64_t)i * PERIOD_NS;
+		int64_t tick = (due + TICK_NS - 1) / TICK_NS * TICK_NS;
+		double t = tick + (due - tick + TICK_NS) % TICK_NS / PERIOD_NS * (40000 + uniform() * 1000);
+		ets_add_sample(ets, adc(w, t), (int64_t)t);
+	}
+}
+
+static void check(const WAVE_t *w, int gpio, uint32_t bin_ns, uint16_t bins, double max_rms_mv)
+{
+	static ETS_t ets;
+	ETS_CONFIG_t config = {
+		.start_ns = -(int32_t)(bins / 8 * bin_ns),
+		.bin_ns = bin_ns,
+		.bins = bins,
+		.edge = gpio ? ETS_TRIGGER_EXTERNAL : ETS_TRIGGER_RISING,
+		.level = w->offset_mv / MV_PER_LSB,
+		.hysteresis = 20,
+	};
+	if (ets_init(&ets, &config) != ESP_OK) test_fail("init", 0);
+	for (int64_t k = 0; k < BLOCKS; k++) feed(&ets, w, k, gpio);
+
+	// against the true waveform at the middle of every bin: both waves rise through the offset
+	// at phase 0, and the gpio stamps are late by 0.5 us on average (+1 us latency, -0.5 us floor)
+	static uint16_t mean[ETS_MAX_BINS];
+	ets_read(&ets, mean, NULL);
+	double delay_ns = gpio ? 500 : 0;
+	double err2 = 0;
+	for (int i = 0; i < bins; i++) {
+		double err = mean[i] * MV_PER_LSB - wave_mv(w, config.start_ns + (i + 0.5) * bin_ns + delay_ns);
+		err2 += err * err;
+	}
+	ETS_STATS_t stats;
+	ets_get_stats(&ets, &stats);
+	if (stats.coverage_permille != 1000) test_fail("coverage, permille", stats.coverage_permille);
+	if (stats.captures < 1000) test_fail("captures", stats.captures);
+	if (stats.effective_rate_hz != 1000000000u / bin_ns) test_fail("effective rate", stats.effective_rate_hz);
+	double rms = sqrt(err2 / bins);
+	if (rms > max_rms_mv) test_fail("rms error, uV", (long long)(rms * 1000));
+
+	ets_reset(&ets);
+	ets_get_stats(&ets, &stats);
+	if (stats.filled != 0 || stats.captures != 0) test_fail("reset", stats.filled);
+}
+
+// 7.3 kHz, 137 us per period, the ADC sees one reading every 7.3 periods
+TEST(ets_gpio_sine_7k3) {
+	WAVE_t w = { .freq_hz = 7301.7, .amplitude_mv = 1000, .offset_mv = 1250 };
+	check(&w, 1, 1000, 128, 10);
+}
+
+TEST(ets_gpio_square_2k) {
+	WAVE_t w = { .freq_hz = 2000.3, .square = 1, .amplitude_mv = 1000, .offset_mv = 1250 };
+	check(&w, 1, 1000, 400, 120);
+}
+
+// 90.3 Hz, in-band: slow enough at the crossing to interpolate the trigger
+TEST(ets_inband_sine_90) {
+	WAVE_t w = { .freq_hz = 90.3, .amplitude_mv = 1000, .offset_mv = 1250 };
+	check(&w, 0, 20000, 500, 10);
+}
+
+TEST(ets_bad_config) {
+	ETS_t ets;
+	ETS_CONFIG_t config = { .bin_ns = 1000, .bins = ETS_MAX_BINS + 1 };
+	if (ets_init(&ets, &config) == ESP_OK) test_fail("too many bins", config.bins);
+	config.bins = 16;
+	config.bin_ns = 0;
+	if (ets_init(&ets, &config) == ESP_OK) test_fail("zero bin width", 0);
+}
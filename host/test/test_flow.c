@@ -0,0 +1,108 @@
+/*
+	 main/flow.c: a client that does not acknowledge is left alone, a late
+	 acknowledgement or a blocked send thins, nothing is decided while the
+	 frames of the old rate are on their way, good intervals step back;
+	 and against a link that drops to 8 kB/s for 30 s (sim/flowsim.c) the
+	 control keeps the frames under the target without losing a block and
+	 is back at the full rate after, where without it blocks are lost.
+*/
+
+#include <stdbool.h>
+
+#include "flow.h"
+#include "flowsim.h"
+#include "test.h"
+
+#define NUM 3				// the websocket client
+#define TARGET_US 500000
+#define INTERVAL_US FLOWSIM_INTERVAL_US
+
+static int factor_applied = 1;
+
+static void apply(int num, int factor, uint32_t latency_us)
+{
+	if (num != NUM) test_fail("apply num", num);
+	factor_applied = factor;
+}
+
+static int64_t init(void)
+{
+	FLOW_IO_t io = { .target_us = TARGET_US, .interval_us = INTERVAL_US, .apply = apply };
+	if (flow_init(&io) != ESP_OK) test_fail("init", 0);
+	flow_close(NUM);
+	flow_open(NUM);
+	factor_applied = 1;
+	return 1000000;
+}
+
+// no acknowledgement, no control however late
+TEST(flow_no_ack) {
+	int64_t t = init();
+	for (int i = 0; i < 20; i++) flow_sent(NUM, t += 100000, 0, 100);
+	flow_update(t += INTERVAL_US);
+	flow_update(t += INTERVAL_US);
+	if (factor_applied != 1) test_fail("not acking", factor_applied);
+	flow_ack(NUM, 21, t);	// more than sent
+	flow_update(t += INTERVAL_US);
+	if (factor_applied != 1) test_fail("ack ahead", factor_applied);
+	flow_close(NUM);
+}
+
+// thinned by late acknowledgements and a blocked send, then back a step
+TEST(flow_thin_and_recover) {
+	FLOW_CLIENT_t c;
+	int64_t t = init();
+	for (int i = 0; i < 20; i++) flow_sent(NUM, t, 0, 100);
+	flow_ack(NUM, 20, t);
+	// acknowledged 600 ms after the send: thinned
+	flow_sent(NUM, t, 0, 100);
+	flow_sent(NUM, t, 0, 100);
+	flow_ack(NUM, 21, t + 600000);
+	flow_update(t += 600000);
+	if (factor_applied != 2) test_fail("late", factor_applied);
+	// the other frame of the old rate is as late, the first one of the new rate is not yet
+	flow_ack(NUM, 22, t + 50000);
+	flow_sent(NUM, t + 100000, 0, 100);
+	flow_update(t += INTERVAL_US);
+	if (factor_applied != 2) test_fail("hold", factor_applied);
+	// it is acknowledged late too
+	flow_ack(NUM, 23, t + 450000);
+	flow_update(t += 500000);
+	if (factor_applied != 4) test_fail("late again", factor_applied);
+	if (!flow_get_client(NUM, &c) || c.slower != 2) test_fail("slower", c.slower);
+
+	// a send that blocked for a third of the target
+	flow_sent(NUM, t, TARGET_US / 3, 100);
+	flow_ack(NUM, 24, t + 1000);
+	flow_update(t += INTERVAL_US);
+	if (factor_applied != 8) test_fail("blocked", factor_applied);
+
+	// good intervals with frames: a step back after FLOW_RECOVER of them
+	for (int i = 0; i < FLOW_RECOVER; i++) {
+		if (factor_applied != 8) test_fail("too soon", i);
+		flow_sent(NUM, t, 0, 100);
+		flow_ack(NUM, 25 + i, t + 1000);
+		flow_update(t += INTERVAL_US);
+	}
+	if (factor_applied != 4) test_fail("recover", factor_applied);
+	if (!flow_get_client(NUM, &c) || c.faster != 1) test_fail("faster", c.faster);
+	// and none without frames
+	for (int i = 0; i < 2 * FLOW_RECOVER; i++) flow_update(t += INTERVAL_US);
+	if (factor_applied != 4) test_fail("idle", factor_applied);
+	flow_close(NUM);
+}
+
+TEST(flow_link_drop) {
+	FLOWSIM_RESULT_t r;
+	if (flowsim_run(TARGET_US, &r) != 0) test_fail("no frame while slow", 0);
+	if (r.lat_p99_ms * 1000 > TARGET_US) test_fail("p99 ms", (long long)r.lat_p99_ms);
+	if (r.lost_blocks > 0) test_fail("lost blocks", r.lost_blocks);
+	if (r.factor != 1) test_fail("factor at the end", r.factor);
+	if (r.recover_s < 0) test_fail("never back at the full rate", 0);
+}
+
+TEST(flow_link_drop_off) {
+	FLOWSIM_RESULT_t r;
+	if (flowsim_run(0, &r) != 0) test_fail("no frame while slow", 0);
+	if (r.lost_blocks == 0) test_fail("the link was never too slow", 0);
+}
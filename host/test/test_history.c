@@ -0,0 +1,197 @@
+/*
+	 main/history.c: blocks of a known signal go in, the snapshot is
+	 decoded back (protocol.h, codec.h) and compared with the averages and
+	 times computed here, with the changes of the levels where they
+	 happened; then with a ring that went round, missing blocks filled
+	 with the reading before them, what starts the history over, a change
+	 in force that went out of the ring of changes, and a buffer too
+	 small.
+*/
+
+#include <stdbool.h>
+
+#include "history.h"
+#include "test.h"
+
+#define CHANNEL 6
+#define PERIOD_US 1000		// 1 kHz, CONFIG_ACQ_SAMPLE_RATE_HZ
+#define PER_POINT (CONFIG_HISTORY_POINT_MS * 1000 / PERIOD_US)
+// a gap longer than the ring
+#define RESTART_BLOCKS (HISTORY_POINTS * PER_POINT / ACQ_BLOCK_SAMPLES + 2)
+
+static uint64_t pins = 0x30;
+static uint64_t levels;
+static uint32_t seq;
+static uint32_t first_block;	// of the history now
+static uint32_t hole_from, hole_to;	// readings that were missing, from the first block
+static SAMPLE_BLOCK_t block;
+static uint8_t msg[HISTORY_MAX_MESSAGE];
+static uint16_t decoded[HISTORY_POINTS];
+
+static uint64_t get_levels(uint64_t *out)
+{
+	*out = pins;
+	return levels;
+}
+
+// a slow triangle and a bit of noise, reading i of the whole run
+static uint16_t reading(uint32_t i)
+{
+	uint32_t phase = i % 4000;
+	uint32_t tri = phase < 2000 ? phase : 4000 - phase;
+	return 1000 + tri + (i * 2654435761u >> 26);
+}
+
+// what the history holds for reading i of the whole run
+static uint16_t held(uint32_t i)
+{
+	uint32_t r0 = first_block * ACQ_BLOCK_SAMPLES;
+	if (i >= r0 + hole_from && i < r0 + hole_to) return reading(r0 + hole_from - 1);
+	return reading(i);
+}
+
+static void feed(void)
+{
+	block.seq = seq;
+	block.channels = 1 << CHANNEL;
+	block.count = ACQ_BLOCK_SAMPLES;
+	block.period_us = PERIOD_US;
+	block.t0_us = 1000000 + (int64_t)seq * ACQ_BLOCK_SAMPLES * PERIOD_US;
+	for (int i = 0; i < ACQ_BLOCK_SAMPLES; i++) block.raw[i] = reading(seq * ACQ_BLOCK_SAMPLES + i);
+	history_add(&block);
+	seq++;
+}
+
+// starts the history over with blocks of the signal
+static void start_over(int blocks)
+{
+	static bool ready;
+	if (!ready) {
+		HISTORY_IO_t io = { .channel = CHANNEL, .bits = 13, .mv_per_lsb = 0.25f, .levels = get_levels };
+		if (history_init(&io) != ESP_OK) test_fail("init", 0);
+		ready = true;
+	}
+	seq += RESTART_BLOCKS;
+	first_block = seq;
+	hole_from = hole_to = 0;
+	levels = 0;
+	for (int i = 0; i < blocks; i++) feed();
+}
+
+// the first point that ends in block j of the history
+static uint32_t point_of_block(uint32_t j)
+{
+	return j * ACQ_BLOCK_SAMPLES / PER_POINT;
+}
+
+// decodes msg and compares it with the readings of the history
+static void check_snapshot(int len, uint32_t n, int nchanges, const HISTORY_CHANGE_t *expect)
+{
+	STREAM_FRAME_t h;
+	if (len <= 0 || protocol_get_history_header(msg, len, &h) != PROTOCOL_FRAME_HEADER_SIZE) test_fail("header", len);
+	if (h.channel != CHANNEL || h.bits != 13) test_fail("channel", h.channel);
+	if (h.seq != n) test_fail("points", h.seq);
+	if (h.period_us != PER_POINT * PERIOD_US) test_fail("interval", h.period_us);
+	// the first point of the window, the points before it went round
+	uint32_t total = (seq - first_block) * ACQ_BLOCK_SAMPLES / PER_POINT;
+	uint32_t first = total - n;
+	uint32_t r0 = first_block * ACQ_BLOCK_SAMPLES + first * PER_POINT;
+	if (h.t0_us != 1000000 + (int64_t)r0 * PERIOD_US) test_fail("t0", h.t0_us);
+	const uint8_t *c = msg + PROTOCOL_FRAME_HEADER_SIZE;
+	if ((c[0] | c[1] << 8) != nchanges) test_fail("changes", c[0] | c[1] << 8);
+	for (int i = 0; expect && i < nchanges; i++) {
+		HISTORY_CHANGE_t got;
+		protocol_get_history_change(c + 2 + i * PROTOCOL_HISTORY_CHANGE_SIZE, &got);
+		if (got.point != expect[i].point) test_fail("point of change", i);
+		if (got.pins != expect[i].pins || got.levels != expect[i].levels) test_fail("levels of change", i);
+	}
+	size_t skip = PROTOCOL_FRAME_HEADER_SIZE + 2 + nchanges * PROTOCOL_HISTORY_CHANGE_SIZE;
+	int count = codec_decode(msg + skip, len - skip, decoded, HISTORY_POINTS);
+	if (count != (int)n) test_fail("decoded points", count);
+	for (uint32_t p = 0; p < n; p++) {
+		uint32_t sum = 0;
+		for (int i = 0; i < PER_POINT; i++) sum += held(r0 + p * PER_POINT + i);
+		if (decoded[p] != (sum + PER_POINT / 2) / PER_POINT) test_fail("point", p);
+	}
+}
+
+TEST(history_snapshot) {
+	// 40 blocks, the levels change in block 10: its first point is the one that ends in it
+	start_over(0);
+	levels = 0x10;
+	for (int i = 0; i < 10; i++) feed();
+	levels = 0x20;
+	for (int i = 0; i < 30; i++) feed();
+	HISTORY_CHANGE_t two[2] = { { 0, 0x30, 0x10 }, { point_of_block(10), 0x30, 0x20 } };
+	check_snapshot(history_snapshot(msg, sizeof(msg), CODEC_RICE), 40 * ACQ_BLOCK_SAMPLES / PER_POINT, 2, two);
+}
+
+TEST(history_ring_round) {
+	// round the ring once and a half: the change in force at the new first point is at 0
+	start_over(0);
+	levels = 0x10;
+	for (int i = 0; i < 10; i++) feed();
+	levels = 0x20;
+	int blocks = (HISTORY_POINTS * 3 / 2) * PER_POINT / ACQ_BLOCK_SAMPLES;
+	for (int i = 0; i < blocks; i++) feed();
+	HISTORY_CHANGE_t one[1] = { { 0, 0x30, 0x20 } };
+	check_snapshot(history_snapshot(msg, sizeof(msg), CODEC_DELTA), HISTORY_POINTS, 1, one);
+}
+
+TEST(history_gap_filled) {
+	// blocks 10 to 12 missing: their readings are the last of block 9, the points go on
+	start_over(10);
+	HISTORY_STATS_t before, after;
+	history_get_stats(&before);
+	seq += 3;
+	hole_from = 10 * ACQ_BLOCK_SAMPLES;
+	hole_to = 13 * ACQ_BLOCK_SAMPLES;
+	for (int i = 0; i < 10; i++) feed();
+	history_get_stats(&after);
+	if (after.restarts != before.restarts) test_fail("restarted", after.restarts - before.restarts);
+	if (after.gaps != before.gaps + 1) test_fail("gaps", after.gaps - before.gaps);
+	if (after.filled != before.filled + 3 * ACQ_BLOCK_SAMPLES) test_fail("filled", after.filled - before.filled);
+	check_snapshot(history_snapshot(msg, sizeof(msg), CODEC_RICE), 23 * ACQ_BLOCK_SAMPLES / PER_POINT, 1, NULL);
+}
+
+TEST(history_restarts) {
+	// a gap longer than the ring
+	start_over(10);
+	HISTORY_STATS_t before, after;
+	history_get_stats(&before);
+	start_over(1);
+	history_get_stats(&after);
+	if (after.restarts != before.restarts + 1) test_fail("long gap", after.restarts - before.restarts);
+	if (after.points != ACQ_BLOCK_SAMPLES / PER_POINT) test_fail("points after a long gap", after.points);
+	// a change of the period
+	block.seq = seq++;
+	block.period_us = PERIOD_US / 2;
+	block.t0_us += ACQ_BLOCK_SAMPLES * PERIOD_US;
+	history_add(&block);
+	history_get_stats(&after);
+	if (after.restarts != before.restarts + 2) test_fail("period", after.restarts - before.restarts);
+	if (after.interval_us != PER_POINT * PERIOD_US) test_fail("interval", after.interval_us);
+}
+
+TEST(history_change_out_of_ring) {
+	// 200 blocks at 0x10, past the first point of the window, then a change in each of
+	// HISTORY_CHANGES blocks: the first change, in force at the first point, left the ring
+	start_over(0);
+	levels = 0x10;
+	for (int i = 0; i < 200; i++) feed();
+	for (int i = 0; i < HISTORY_CHANGES; i++) {
+		levels = i % 2 ? 0x10 : 0x20;
+		feed();
+	}
+	HISTORY_CHANGE_t expect[HISTORY_CHANGES + 1] = { { 0, 0x30, 0x10 } };
+	uint32_t first = point_of_block(200 + HISTORY_CHANGES) - HISTORY_POINTS;
+	for (int i = 0; i < HISTORY_CHANGES; i++) {
+		expect[i + 1] = (HISTORY_CHANGE_t) { point_of_block(200 + i) - first, 0x30, i % 2 ? 0x10 : 0x20 };
+	}
+	check_snapshot(history_snapshot(msg, sizeof(msg), CODEC_RICE), HISTORY_POINTS, HISTORY_CHANGES + 1, expect);
+}
+
+TEST(history_too_small) {
+	start_over(1);
+	if (history_snapshot(msg, PROTOCOL_FRAME_HEADER_SIZE + 8, CODEC_RICE) != -1) test_fail("too small", 0);
+}
@@ -0,0 +1,200 @@
+/*
+	 main/msg.c: the pool hands out each message once and counts what it
+	 could not, full queues drop the newest or the oldest message and give
+	 it back to the pool, data is cut to the message and says so, and the
+	 old deadlock between the MQTT task, its event handler and the main
+	 loop cannot happen: every send returns, the overflow is counted and
+	 no message is lost from the pool.
+*/
+
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/event_groups.h"
+
+#include "msg.h"
+#include "test.h"
+
+static void check_pool_full(void)
+{
+	uint32_t free, failed;
+	msg_pool_stats(&free, &failed);
+	if (free != MSG_POOL_SIZE) test_fail("messages not back in the pool", MSG_POOL_SIZE - free);
+}
+
+TEST(msg_pool) {
+	msg_pool_init();
+	check_pool_full();
+	MSG_t *msgs[MSG_POOL_SIZE];
+	uint32_t free, failed_before, failed;
+	msg_pool_stats(&free, &failed_before);
+	for (int i = 0; i < MSG_POOL_SIZE; i++) {
+		msgs[i] = msg_alloc(MSG_MQTT_PUBLISH);
+		if (msgs[i] == NULL || msgs[i]->type != MSG_MQTT_PUBLISH) test_fail("alloc", i);
+		for (int k = 0; k < i; k++) {
+			if (msgs[k] == msgs[i]) test_fail("message handed out twice", i);
+		}
+	}
+	if (msg_alloc(MSG_MQTT_DATA) != NULL) test_fail("alloc from an empty pool", 0);
+	msg_pool_stats(&free, &failed);
+	if (free != 0 || failed != failed_before + 1) test_fail("failed allocations", failed - failed_before);
+	for (int i = 0; i < MSG_POOL_SIZE; i++) msg_free(msgs[i]);
+	msg_free(NULL);
+	check_pool_full();
+}
+
+static MSG_t *send_numbered(MSG_QUEUE_t *q, int number, esp_err_t expect)
+{
+	MSG_t *msg = msg_alloc(MSG_WS_JSON);
+	if (msg == NULL) test_fail("alloc", number);
+	msg->text.client = number;
+	if (msg_send(q, msg) != expect) test_fail("send", number);
+	return msg;
+}
+
+TEST(msg_drop_newest) {
+	static MSG_QUEUE_t q;
+	msg_pool_init();
+	msg_queue_init(&q, "test", 2, MSG_DROP_NEWEST);
+	for (int i = 0; i < 2; i++) send_numbered(&q, i, ESP_OK);
+	send_numbered(&q, 2, ESP_FAIL);
+	if (q.sent != 2 || q.dropped != 1) test_fail("dropped", q.dropped);
+	for (int i = 0; i < 2; i++) {
+		MSG_t *msg = msg_receive(&q, 0);
+		if (msg == NULL || msg->text.client != i) test_fail("kept", i);
+		msg_free(msg);
+	}
+	if (msg_receive(&q, 0) != NULL) test_fail("message after the last", 0);
+	vQueueDelete(q.queue);
+	check_pool_full();
+}
+
+TEST(msg_drop_oldest) {
+	static MSG_QUEUE_t q;
+	msg_pool_init();
+	msg_queue_init(&q, "test", 2, MSG_DROP_OLDEST);
+	for (int i = 0; i < 4; i++) send_numbered(&q, i, ESP_OK);
+	if (q.sent != 4 || q.dropped != 2) test_fail("dropped", q.dropped);
+	for (int i = 2; i < 4; i++) {
+		MSG_t *msg = msg_receive(&q, 0);
+		if (msg == NULL || msg->text.client != i) test_fail("kept", i);
+		msg_free(msg);
+	}
+	vQueueDelete(q.queue);
+	check_pool_full();
+}
+
+TEST(msg_set_data) {
+	msg_pool_init();
+	MSG_t *msg = msg_alloc(MSG_MQTT_DATA);
+	if (!msg_set_data(msg, "ioto/sub", 8, "hello", 5)) test_fail("short data cut", 0);
+	if (strcmp(msg_topic(msg), "ioto/sub") != 0 || strcmp(msg_payload(msg), "hello") != 0) test_fail("data", msg->data.payload_len);
+	// topic, payload and their two NULs fill the buffer exactly
+	static char payload[MSG_TEXT_SIZE + 100];
+	memset(payload, 'p', sizeof(payload));
+	size_t fits = MSG_TEXT_SIZE - 2 - 8;
+	if (!msg_set_data(msg, "ioto/sub", 8, payload, fits)) test_fail("data that fits cut", fits);
+	if (msg_set_data(msg, "ioto/sub", 8, payload, fits + 1)) test_fail("cut not reported", fits + 1);
+	if (msg->data.payload_len != fits || msg_payload(msg)[fits] != 0) test_fail("cut payload", msg->data.payload_len);
+	if (!msg->data.cut) test_fail("cut not flagged", 0);
+	msg_free(msg);
+	check_pool_full();
+}
+
+TEST(msg_append_data) {
+	msg_pool_init();
+	MSG_t *msg = msg_alloc(MSG_MQTT_DATA);
+	uint32_t cut = msg_data_cut();
+	// a message in parts, as MQTT_EVENT_DATA brings one longer than the buffer of the client
+	msg_set_data(msg, "ioto/sub", 8, "hel", 3);
+	if (!msg_append_data(msg, "lo", 2) || !msg_append_data(msg, NULL, 0)) test_fail("short part cut", msg->data.payload_len);
+	if (strcmp(msg_payload(msg), "hello") != 0 || msg->data.cut) test_fail("parts", msg->data.payload_len);
+	static char part[300];
+	memset(part, 'p', sizeof(part));
+	size_t fits = MSG_TEXT_SIZE - 2 - 8;
+	if (!msg_append_data(msg, part, 250)) test_fail("part that fits cut", msg->data.payload_len);
+	if (msg_append_data(msg, part, 300)) test_fail("cut not reported", msg->data.payload_len);
+	if (msg_append_data(msg, part, 1)) test_fail("part after the cut", msg->data.payload_len);
+	if (msg->data.payload_len != fits || msg_payload(msg)[fits] != 0 || !msg->data.cut) test_fail("cut payload", msg->data.payload_len);
+	// counted once per message
+	if (msg_data_cut() != cut + 1) test_fail("cuts counted", msg_data_cut() - cut);
+	msg_free(msg);
+	check_pool_full();
+}
+
+#define CONNECTED_BIT BIT1
+#define HANDLER_DONE_BIT BIT2
+#define MAIN_DONE_BIT BIT3
+#define MQTT_DONE_BIT BIT4
+#define MAIN_SENT_BIT BIT5
+#define FLOOD 64
+
+static MSG_QUEUE_t main_q;
+static MSG_QUEUE_t mqtt_q;
+static EventGroupHandle_t events;
+
+// the MQTT task, waiting for the broker like connect-request does
+static void mqtt_task(void *arg)
+{
+	xEventGroupWaitBits(events, CONNECTED_BIT | MAIN_SENT_BIT, pdFALSE, pdTRUE, portMAX_DELAY);
+	MSG_t *msg;
+	while ((msg = msg_receive(&mqtt_q, 0)) != NULL) msg_free(msg);
+	xEventGroupSetBits(events, MQTT_DONE_BIT);
+	vTaskDelete(NULL);
+}
+
+// the MQTT event handler, subscribe-data arriving before it reports the connection
+static void handler_task(void *arg)
+{
+	for (int i = 0; i < FLOOD; i++) {
+		MSG_t *msg = msg_alloc(MSG_MQTT_DATA);
+		if (msg == NULL) continue;
+		msg_set_data(msg, "ioto/sub", 8, "1", 1);
+		msg_send(&main_q, msg);
+	}
+	xEventGroupSetBits(events, CONNECTED_BIT | HANDLER_DONE_BIT);
+	vTaskDelete(NULL);
+}
+
+// the main loop, forwarding browser requests before it reads its own queue
+static void main_task(void *arg)
+{
+	for (int i = 0; i < FLOOD; i++) {
+		MSG_t *msg = msg_alloc(MSG_MQTT_PUBLISH);
+		if (msg == NULL) continue;
+		msg_send(&mqtt_q, msg);
+	}
+	xEventGroupSetBits(events, MAIN_SENT_BIT);
+	xEventGroupWaitBits(events, HANDLER_DONE_BIT, pdFALSE, pdTRUE, portMAX_DELAY);
+	MSG_t *msg;
+	while ((msg = msg_receive(&main_q, 0)) != NULL) msg_free(msg);
+	xEventGroupSetBits(events, MAIN_DONE_BIT);
+	vTaskDelete(NULL);
+}
+
+/* The old deadlock: the MQTT task waits on its event group, the MQTT event
+   handler floods the main queue and the main loop floods the MQTT queue
+   before either reads. With blocking sends all three waited on each other
+   forever. */
+TEST(msg_deadlock_scenario) {
+	msg_pool_init();
+	events = xEventGroupCreate();
+	uint32_t dropped = 0;
+	for (int i = 0; i < 20; i++) {
+		msg_queue_init(&main_q, "main_queue", 8, MSG_DROP_OLDEST);
+		msg_queue_init(&mqtt_q, "mqtt_queue", 4, MSG_DROP_NEWEST);
+		xEventGroupClearBits(events, 0xff);
+		xTaskCreate(mqtt_task, "mqtt_task", 4096, NULL, 2, NULL);
+		xTaskCreate(handler_task, "mqtt_handler", 4096, NULL, 5, NULL);
+		xTaskCreate(main_task, "main_task", 4096, NULL, 1, NULL);
+		EventBits_t bits = xEventGroupWaitBits(events, MAIN_DONE_BIT | MQTT_DONE_BIT, pdFALSE, pdTRUE, pdMS_TO_TICKS(1000));
+		if ((bits & (MAIN_DONE_BIT | MQTT_DONE_BIT)) != (MAIN_DONE_BIT | MQTT_DONE_BIT)) test_fail("tasks still waiting after 1 s, bits", bits);
+		dropped += main_q.dropped + mqtt_q.dropped;
+		vQueueDelete(main_q.queue);
+		vQueueDelete(mqtt_q.queue);
+	}
+	vEventGroupDelete(events);
+	if (dropped == 0) test_fail("floods that did not overflow", 0);
+	check_pool_full();
+}
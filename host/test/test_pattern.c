@@ -0,0 +1,141 @@
+/*
+	 main/pattern.c against a simulated timer: each alarm goes off 2 to 5 us
+	 after the time asked for, and one in fifty 40 us late, as behind a
+	 flash write or another interrupt. Every step is written once per pass
+	 in order, only its pins change, no step goes out before it is due or
+	 more than one late alarm after, the schedule does not drift over a
+	 thousand passes, steps with no delay go out together, a pattern
+	 upload round trips through the protocol and bad patterns are refused.
+*/
+
+#include "pattern.h"
+#include "protocol.h"
+#include "test.h"
+
+#define LATE_US 40
+
+static PATTERN_t pattern;
+static uint64_t pins;		// the levels of the simulated GPIOs
+static uint32_t writes;
+static int64_t now;
+static uint32_t rng;
+
+// a 1 kHz clock on GPIO4 and a data bit on GPIO5 that changes with the falling edge
+static const PATTERN_STEP_t steps[] = {
+	{ 0x30, 0x10, 250 },
+	{ 0x10, 0x00, 250 },
+	{ 0x30, 0x30, 250 },
+	{ 0x10, 0x00, 250 },
+};
+
+static uint32_t next_random(void)
+{
+	rng ^= rng << 13;
+	rng ^= rng >> 17;
+	rng ^= rng << 5;
+	return rng;
+}
+
+static void write_pins(uint64_t mask, uint64_t levels)
+{
+	pins = (pins & ~mask) | (levels & mask);
+	writes++;
+}
+
+static int64_t latency_us(void)
+{
+	uint32_t r = next_random();
+	return r % 50 == 0 ? LATE_US : 2 + (r >> 8) % 4;
+}
+
+// the timer: runs the pattern until it is over or max alarms, returns the alarms
+static int play(int max)
+{
+	int alarms = 0;
+	int64_t next = 0;
+	while (next >= 0 && alarms < max) {
+		now = next + latency_us();
+		next = pattern_run(&pattern, now, write_pins);
+		alarms++;
+	}
+	return alarms;
+}
+
+static void setup(void)
+{
+	if (pattern_load(&pattern, steps, 4) != ESP_OK) test_fail("load", 0);
+	pins = 0xff00ff0000000f00ULL;
+	writes = 0;
+	rng = 12345;
+}
+
+TEST(pattern_steps_in_order) {
+	setup();
+	pattern_rewind(&pattern, 3, 0);
+	int64_t next = 0;
+	for (int i = 0; i < 12; i++) {
+		now = next + latency_us();
+		next = pattern_run(&pattern, now, write_pins);
+		const PATTERN_STEP_t *step = &steps[i % 4];
+		if (writes != (uint32_t)i + 1) test_fail("writes", writes);
+		if ((pins & step->mask) != (step->levels & step->mask)) test_fail("levels of step", i);
+		if ((pins & ~0x30ULL) != 0xff00ff0000000f00ULL) test_fail("pins outside the masks", i);
+		if (next != (i < 11 ? (i + 1) * 250 : -1)) test_fail("next due", next);
+	}
+}
+
+// a thousand passes: a late alarm catches up, none adds up
+TEST(pattern_no_drift) {
+	setup();
+	pattern_rewind(&pattern, 1000, 0);
+	play(1000000);
+	if (writes != 4000 || pattern.played != 4000) test_fail("steps of 1000 passes", writes);
+	if (pattern.late_max_us > LATE_US) test_fail("late max", pattern.late_max_us);
+	if (now > 999 * 1000 + 750 + LATE_US) test_fail("end of the last pass", now);
+}
+
+TEST(pattern_forever) {
+	setup();
+	pattern_rewind(&pattern, 0, 0);
+	if (play(10000) != 10000) test_fail("stopped", pattern.played);
+	if (pattern.next != 0) test_fail("next step after 2500 passes", pattern.next);
+}
+
+// steps with no delay in between go out in the same alarm
+TEST(pattern_burst) {
+	const PATTERN_STEP_t burst[] = { { 1, 1, 0 }, { 2, 2, 0 }, { 4, 4, 100 } };
+	if (pattern_load(&pattern, burst, 3) != ESP_OK) test_fail("load", 0);
+	pattern_rewind(&pattern, 2, 0);
+	pins = 0;
+	writes = 0;
+	int64_t next = pattern_run(&pattern, 0, write_pins);
+	if (next != 100) test_fail("next due", next);
+	if (writes != 3 || pins != 7) test_fail("writes of one alarm", writes);
+}
+
+TEST(pattern_bad) {
+	const PATTERN_STEP_t still[] = { { 1, 1, 0 }, { 1, 0, 0 } };
+	if (pattern_load(&pattern, still, 2) == ESP_OK) test_fail("accepted a pattern with no delay", 0);
+	if (pattern_load(&pattern, steps, 0) == ESP_OK) test_fail("accepted no steps", 0);
+	if (pattern_load(&pattern, steps, PATTERN_MAX_STEPS + 1) == ESP_OK) test_fail("accepted steps", PATTERN_MAX_STEPS + 1);
+}
+
+TEST(pattern_upload) {
+	uint8_t msg[4 + 4 * PROTOCOL_PATTERN_STEP_SIZE] = { PROTOCOL_PATTERN_MAGIC, 0, 4, 0 };
+	for (int i = 0; i < 4; i++) {
+		uint8_t *p = msg + 4 + PROTOCOL_PATTERN_STEP_SIZE * i;
+		for (int k = 0; k < 8; k++) {
+			p[k] = steps[i].mask >> (8 * k);
+			p[8 + k] = steps[i].levels >> (8 * k);
+		}
+		for (int k = 0; k < 4; k++) p[16 + k] = steps[i].delay_us >> (8 * k);
+	}
+	PATTERN_STEP_t back[4];
+	if (protocol_get_pattern(msg, sizeof(msg) - 1, back, 4) >= 0) test_fail("short message taken", 0);
+	if (protocol_get_pattern(msg, sizeof(msg), back, 3) >= 0) test_fail("steps over the room taken", 0);
+	int count = protocol_get_pattern(msg, sizeof(msg), back, 4);
+	if (count != 4) test_fail("steps", count);
+	for (int i = 0; i < 4; i++) {
+		if (back[i].mask != steps[i].mask || back[i].levels != steps[i].levels || back[i].delay_us != steps[i].delay_us) test_fail("step", i);
+	}
+}
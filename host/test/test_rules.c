@@ -0,0 +1,171 @@
+/*
+	 main/rules.c: the compiler takes good rules and refuses bad ones at the
+	 right position, a block is measured right, a rule fires after its
+	 for, clears past its hysteresis and waits its every, and rules come
+	 back from storage; what goes back to the browser is cut to what
+	 a rule holds however long the request was.
+*/
+
+#include <string.h>
+
+#include "protocol.h"
+#include "rules.h"
+#include "test.h"
+
+#define MV_PER_LSB (2500.0f / 8191)
+
+static const char *good[] = {
+	"rms(6) > 500 for 200",
+	"freq(D3) > 100 hyst 5 every 10000",
+	"mean(0) - mean(1) >= 12.5 and not level(40)",
+	"(max(6) - min(6)) / 2 < 3 or pp(6) > 2000",
+	"level(D1) == 1 and level(D2) != 1 or -mean(2) < -100",
+	"1",
+};
+
+static const struct {
+	const char *text;
+	const char *error;
+} bad[] = {
+	{ "rms(6) >", "at 8: unexpected end" },
+	{ "rms(10) > 1", "at 4: bad channel" },
+	{ "freq(D7) > 1", "at 5: bad pin" },
+	{ "volts(1) > 1", "at 0: unknown 'volts'" },
+	{ "mean(1 > 2", "at 7: ) expected" },
+	{ "mean(1) > 2 for", "at 15: number expected" },
+	{ "mean(1) > 2 for 10 for 20", "at 22: option given twice" },
+	{ "mean(1) > 2 soon", "at 12: for, hyst or every expected" },
+	{ "1+(1+(1+(1+(1+(1+(1+(1+(1+1))))))))", "at 25: too deeply nested" },
+	{ "1+1+1+1+1+1+1+1+1+1+1+1+1 > 0", "too long" },
+	{ "mean(1) > 1 > 2", "at 12: for, hyst or every expected" },
+};
+
+TEST(rules_compile_good) {
+	RULE_CODE_t code;
+	char error[64];
+	for (size_t i = 0; i < sizeof(good) / sizeof(good[0]); i++) {
+		if (rules_compile(good[i], &code, error, sizeof(error)) != ESP_OK) test_fail(good[i], i);
+	}
+}
+
+TEST(rules_compile_bad) {
+	RULE_CODE_t code;
+	char error[64];
+	for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+		if (rules_compile(bad[i].text, &code, error, sizeof(error)) == ESP_OK) test_fail(bad[i].text, i);
+		if (strstr(error, bad[i].error) == NULL) test_fail(bad[i].error, i);
+	}
+}
+
+TEST(rules_compile_needs) {
+	RULE_CODE_t code;
+	char error[64];
+	if (rules_compile("freq(D3) > 100 hyst 5 every 10000", &code, error, sizeof(error)) != ESP_OK) test_fail("compile", 0);
+	if (code.pulses != 1ULL << 40) test_fail("pulse pins", code.pulses);
+	if (code.channels || code.levels) test_fail("channels or levels", code.channels);
+	if (code.for_ms != 0 || code.every_ms != 10000 || code.hyst != 5) test_fail("options", code.every_ms);
+}
+
+TEST(rules_measure) {
+	RULES_INPUT_t in;
+	uint16_t raw[64];
+	for (int i = 0; i < 64; i++) raw[i] = 4096 + (i % 16) * 100;
+	memset(&in, 0, sizeof(in));
+	rules_measure(&in, 6, raw, 64, MV_PER_LSB, 0);
+	if (in.min[6] != 4096 * MV_PER_LSB) test_fail("min", in.min[6]);
+	if (in.max[6] != (4096 + 1500) * MV_PER_LSB) test_fail("max", in.max[6]);
+	if (in.rms[6] < in.mean[6]) test_fail("rms below the mean", in.rms[6]);
+}
+
+// one block of input with channel 6 at mv
+static void block_at(RULES_INPUT_t *in, int64_t t_ms, float mv)
+{
+	memset(in, 0, sizeof(*in));
+	in->t_us = t_ms * 1000;
+	in->mean[6] = in->rms[6] = in->min[6] = in->max[6] = mv;
+}
+
+static void eval(RULES_t *rules, int64_t t_ms, float mv, int count, int active)
+{
+	RULES_INPUT_t in;
+	RULES_EVENT_t events[RULES_MAX];
+	block_at(&in, t_ms, mv);
+	int got = rules_eval(rules, &in, events);
+	if (got != count) test_fail("events at ms", t_ms);
+	if (count && events[0].active != active) test_fail("active at ms", t_ms);
+	if (count && events[0].t_us != t_ms * 1000) test_fail("event time", events[0].t_us);
+	if (count && active && events[0].value != mv) test_fail("event value", events[0].value);
+}
+
+// the scripted signal: 64 ms blocks, a threshold of 500 mV held for 200 ms, 20 mV of hysteresis, 1 s apart at least
+TEST(rules_eval_for_hyst_every) {
+	RULES_t rules;
+	char error[64];
+	rules_init(&rules);
+	if (rules_set(&rules, "hot", "rms(6) > 500 for 200 hyst 20 every 1000", error, sizeof(error)) != ESP_OK) test_fail(error, 0);
+
+	int64_t t = 0;
+	// a spike shorter than for does not fire
+	for (int i = 0; i < 3; i++, t += 64) eval(&rules, t, 600, 0, 0);
+	eval(&rules, t, 400, 0, 0);
+	t += 64;
+	// held: fires on the block 200 ms after the first one above
+	int64_t first = t;
+	for (; t - first < 200; t += 64) eval(&rules, t, 600, 0, 0);
+	eval(&rules, t, 600, 1, 1);
+	int64_t fired = t;
+	t += 64;
+	// within the hysteresis it stays active, below it clears
+	eval(&rules, t, 485, 0, 0);
+	t += 64;
+	eval(&rules, t, 479, 1, 0);
+	t += 64;
+	// every: back above at once, it waits until 1 s after the firing
+	for (; t - fired < 1000; t += 64) eval(&rules, t, 600, 0, 0);
+	eval(&rules, t, 600, 1, 1);
+	if (rules.rule[0].fired != 2) test_fail("fired", rules.rule[0].fired);
+	if (rules.rule[0].suppressed == 0) test_fail("suppressed", 0);
+}
+
+TEST(rules_storage) {
+	RULES_t rules, loaded;
+	char error[64], saved[1024];
+	rules_init(&rules);
+	if (rules_set(&rules, "hot", good[0], error, sizeof(error)) != ESP_OK) test_fail(error, 0);
+	if (rules_set(&rules, "d3_fast", "freq(D3) > 100", error, sizeof(error)) != ESP_OK) test_fail(error, 1);
+	if (rules_save(&rules, saved, sizeof(saved)) < 0) test_fail("save", 0);
+	int count = rules_load(&loaded, saved);
+	if (count != 2) test_fail("rules loaded", count);
+	if (strcmp(loaded.rule[1].text, "freq(D3) > 100") != 0) test_fail("text loaded", 1);
+	if (loaded.rule[0].code.len != rules.rule[0].code.len) test_fail("code loaded", loaded.rule[0].code.len);
+	if (rules_delete(&rules, "hot") != ESP_OK) test_fail("delete", 0);
+	if (rules.count != 1 || strcmp(rules.rule[0].name, "d3_fast") != 0) test_fail("rules left", rules.count);
+	if (rules_delete(&rules, "hot") == ESP_OK) test_fail("delete of a rule that is gone", 0);
+}
+
+TEST(rules_reply_oversized) {
+	// what app.c echoes of a rule-set with a name and a rule far longer than a rule holds
+	static char name[400], text[400];
+	memset(name, 'n', sizeof(name) - 1);
+	memset(text, ' ', sizeof(text) - 1);
+	text[0] = '1';
+	RULES_t rules;
+	char error[RULES_ERROR_SIZE];
+	rules_init(&rules);
+	if (rules_set(&rules, "long", text, error, sizeof(error)) == ESP_OK) test_fail("rule too long taken", strlen(text));
+	if (rules_set(&rules, name, "1", error, sizeof(error)) == ESP_OK) test_fail("name too long taken", strlen(name));
+	struct {
+		char out[RULES_REPLY_SIZE];
+		char guard[16];
+	} reply;
+	memset(reply.guard, 0x5a, sizeof(reply.guard));
+	int len = rules_reply_text(reply.out, name, text, error);
+	for (size_t i = 0; i < sizeof(reply.guard); i++) {
+		if (reply.guard[i] != 0x5a) test_fail("written past the reply", i);
+	}
+	if (len != (int)strlen(reply.out)) test_fail("length", len);
+	// the fields cut to what a rule holds, the separators kept
+	int expect = 2 + 3 + (RULES_NAME_SIZE - 1) + (RULES_TEXT_SIZE - 1) + (int)strlen(error);
+	if (len != expect) test_fail("reply", len);
+	if (reply.out[2] != PROTOCOL_DEL || reply.out[3 + RULES_NAME_SIZE - 1] != PROTOCOL_DEL) test_fail("name cut", 0);
+}
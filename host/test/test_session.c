@@ -0,0 +1,169 @@
+/*
+	 main/session.c: sessions with the same view share a pipeline and get
+	 the same message, different views get one pipeline each, decimation
+	 averages, a trigger captures after its edge, and closing gives the
+	 pipelines back.
+*/
+
+#include <string.h>
+
+#include "esp_log.h"
+
+#include "protocol.h"
+#include "session.h"
+#include "test.h"
+
+#define CLIENTS 4
+
+static struct {
+	int messages;
+	size_t len;
+	int binary;
+	uint8_t data[512];
+} sent[SESSION_MAX];
+
+static int record_send(int num, const void *data, size_t len, int binary)
+{
+	sent[num].messages++;
+	sent[num].len = len;
+	sent[num].binary = binary;
+	memcpy(sent[num].data, data, len < sizeof(sent[num].data) ? len : sizeof(sent[num].data));
+	return 1;
+}
+
+static uint32_t raw_to_mv(int raw)
+{
+	return raw;
+}
+
+static void setup(void)
+{
+	static int ready;
+	if (!ready) {
+		SESSION_IO_t io = { .send = record_send, .raw_to_mv = raw_to_mv, .bits = 13, .mv_per_lsb = 1.0f };
+		ESP_ERROR_CHECK(session_init(&io));
+		ready = 1;
+	}
+	// a test that failed left its sessions open
+	for (int i = 0; i < SESSION_MAX; i++) session_close(i);
+	memset(sent, 0, sizeof(sent));
+}
+
+static void teardown(void)
+{
+	for (int i = 0; i < SESSION_MAX; i++) session_close(i);
+	SESSION_STATS_t stats;
+	session_get_stats(&stats);
+	if (stats.pipelines != 0 || stats.sessions != 0) test_fail("pipelines left after closing", stats.pipelines);
+}
+
+// a block of channel 6 with the readings start, start + 1, ...
+static void feed(uint32_t seq, int start)
+{
+	static SAMPLE_BLOCK_t block;
+	block.seq = seq;
+	block.channels = 1 << 6;
+	block.count = ACQ_BLOCK_SAMPLES;
+	block.period_us = 1000;
+	block.t0_us = (int64_t)seq * ACQ_BLOCK_SAMPLES * 1000;
+	for (int i = 0; i < ACQ_BLOCK_SAMPLES; i++) block.raw[i] = start + i;
+	session_process(&block);
+}
+
+static int decode(int num, STREAM_FRAME_t *frame, uint16_t *samples)
+{
+	int header = protocol_get_frame_header(sent[num].data, sent[num].len, frame);
+	if (header < 0) test_fail("frame header", header);
+	return codec_decode(sent[num].data + header, sent[num].len - header, samples, SESSION_OUT_SAMPLES);
+}
+
+TEST(session_shared_view) {
+	setup();
+	for (int i = 0; i < CLIENTS; i++) {
+		session_open(i);
+		session_set_codec(i, CODEC_RICE);
+		session_set_channel(i, 6, 1);
+	}
+	SESSION_STATS_t before, after;
+	session_get_stats(&before);
+	if (before.pipelines != 1) test_fail("pipelines of one view", before.pipelines);
+	feed(0, 100);
+	session_get_stats(&after);
+	if (after.outputs - before.outputs != 1) test_fail("outputs of one block", after.outputs - before.outputs);
+	if (after.sends - before.sends != CLIENTS) test_fail("sends of one block", after.sends - before.sends);
+	for (int i = 0; i < CLIENTS; i++) {
+		if (sent[i].messages != 1 || !sent[i].binary) test_fail("messages of a client", sent[i].messages);
+		if (sent[i].len != sent[0].len || memcmp(sent[i].data, sent[0].data, sent[0].len) != 0) test_fail("same message", i);
+	}
+	STREAM_FRAME_t frame;
+	uint16_t samples[SESSION_OUT_SAMPLES];
+	if (decode(0, &frame, samples) != SESSION_OUT_SAMPLES) test_fail("decoded samples", 0);
+	if (frame.channel != 6 || frame.period_us != 1000 || frame.seq != 0) test_fail("frame", frame.period_us);
+	for (int i = 0; i < SESSION_OUT_SAMPLES; i++) {
+		if (samples[i] != 100 + i) test_fail("sample", i);
+	}
+	if (after.dropped != before.dropped) test_fail("dropped", after.dropped - before.dropped);
+	teardown();
+}
+
+TEST(session_decimation) {
+	setup();
+	for (int i = 0; i < CLIENTS; i++) {
+		session_open(i);
+		session_set_codec(i, CODEC_RICE);
+		session_set_decimation(i, i + 1);
+		session_set_channel(i, 6, 1);
+	}
+	SESSION_STATS_t stats;
+	session_get_stats(&stats);
+	if (stats.pipelines != CLIENTS) test_fail("pipelines of distinct views", stats.pipelines);
+	for (int k = 0; k < 12; k++) feed(k, k * ACQ_BLOCK_SAMPLES);
+	// a message per decimation blocks
+	for (int i = 0; i < CLIENTS; i++) {
+		if (sent[i].messages != 12 / (i + 1)) test_fail("messages at decimation", sent[i].messages);
+	}
+	STREAM_FRAME_t frame;
+	uint16_t samples[SESSION_OUT_SAMPLES];
+	if (decode(1, &frame, samples) != SESSION_OUT_SAMPLES) test_fail("decoded samples", 1);
+	if (frame.period_us != 2000) test_fail("decimated period", frame.period_us);
+	// the last message of decimation 2 starts at reading 5 * 64 * 2, averages of pairs rounded up
+	int64_t first = 5 * ACQ_BLOCK_SAMPLES * 2;
+	if (frame.t0_us != first * 1000) test_fail("decimated t0", frame.t0_us);
+	for (int i = 0; i < SESSION_OUT_SAMPLES; i++) {
+		int expect = (int)((first + 2 * i) * 2 + 1 + 1) / 2;
+		if (samples[i] != expect) test_fail("average", samples[i]);
+	}
+	teardown();
+}
+
+TEST(session_trigger) {
+	setup();
+	session_open(0);
+	session_set_codec(0, CODEC_RICE);
+	session_set_channel(0, 6, 1);
+	session_set_trigger(0, SESSION_TRIGGER_RISING, 1000);
+	// a ramp from 900: 1000 is crossed at reading 100, the capture starts there
+	feed(0, 900);
+	if (sent[0].messages != 0) test_fail("message before the capture is full", sent[0].messages);
+	feed(1, 900 + ACQ_BLOCK_SAMPLES);
+	feed(2, 900 + 2 * ACQ_BLOCK_SAMPLES);
+	if (sent[0].messages != 1) test_fail("captures", sent[0].messages);
+	STREAM_FRAME_t frame;
+	uint16_t samples[SESSION_OUT_SAMPLES];
+	if (decode(0, &frame, samples) != SESSION_OUT_SAMPLES) test_fail("decoded samples", 0);
+	if (samples[0] != 1000 || frame.t0_us != 100 * 1000) test_fail("capture start", samples[0]);
+	teardown();
+}
+
+TEST(session_text) {
+	setup();
+	session_open(2);
+	session_set_channel(2, 6, 1);
+	feed(0, 7);
+	if (sent[2].messages != 1 || sent[2].binary) test_fail("text message", sent[2].messages);
+	// "AS", the name, then the values in mV from 7 on
+	char expect[32];
+	int len = makeSendText(expect, "AS", "ADC6", "7,8,9,", "") - 1;
+	if (memcmp(sent[2].data, expect, len) != 0) test_fail("text", len);
+	teardown();
+}
@@ -0,0 +1,141 @@
+/*
+	 main/spsc.c: the ring holds count slots and counts the claims it
+	 refuses when full, and under two threads every slot arrives whole
+	 and in order. The producer writes a sequence number and a pattern
+	 derived from it into every slot and the consumer checks both, so a
+	 torn or reordered slot fails.
+*/
+
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+
+#include "spsc.h"
+#include "test.h"
+
+#define SLOT_WORDS 36	// about a SAMPLE_BLOCK_t
+#define RING_SLOTS 16
+#define STRESS 200000
+
+typedef struct {
+	uint32_t seq;
+	uint32_t word[SLOT_WORDS - 1];
+} SLOT_t;
+
+typedef struct {
+	SPSC_RING_t ring;
+	uint64_t n;
+	int lossy;		// drop on full instead of retrying
+	uint64_t dropped;
+} STRESS_t;
+
+static SLOT_t storage[RING_SLOTS];
+
+static void fill(SLOT_t *s, uint32_t seq)
+{
+	s->seq = seq;
+	for (int i = 0; i < SLOT_WORDS - 1; i++) s->word[i] = seq * 2654435761u + i;
+}
+
+static int whole(const SLOT_t *s)
+{
+	for (int i = 0; i < SLOT_WORDS - 1; i++) {
+		if (s->word[i] != s->seq * 2654435761u + i) return 0;
+	}
+	return 1;
+}
+
+TEST(spsc_init) {
+	SPSC_RING_t ring;
+	if (spsc_init(&ring, storage, sizeof(SLOT_t), 12) == ESP_OK) test_fail("count not a power of two", 12);
+	if (spsc_init(&ring, storage, sizeof(SLOT_t), 0) == ESP_OK) test_fail("count", 0);
+	if (spsc_init(&ring, NULL, sizeof(SLOT_t), RING_SLOTS) == ESP_OK) test_fail("no storage", 0);
+	if (spsc_init(&ring, storage, sizeof(SLOT_t), RING_SLOTS) != ESP_OK) test_fail("init", RING_SLOTS);
+}
+
+TEST(spsc_full_and_empty) {
+	SPSC_RING_t ring;
+	spsc_init(&ring, storage, sizeof(SLOT_t), RING_SLOTS);
+	if (spsc_peek(&ring) != NULL) test_fail("slot in an empty ring", 0);
+	for (uint32_t i = 0; i < RING_SLOTS; i++) {
+		SLOT_t *s = spsc_claim(&ring);
+		if (s == NULL) test_fail("claim", i);
+		fill(s, i);
+		spsc_publish(&ring);
+	}
+	if (spsc_used(&ring) != RING_SLOTS) test_fail("used", spsc_used(&ring));
+	if (spsc_claim(&ring) != NULL) test_fail("claim of a full ring", 0);
+	if (spsc_overruns(&ring) != 1) test_fail("overruns", spsc_overruns(&ring));
+	for (uint32_t i = 0; i < RING_SLOTS; i++) {
+		const SLOT_t *s = spsc_peek(&ring);
+		if (s == NULL || s->seq != i || !whole(s)) test_fail("slot", i);
+		spsc_release(&ring);
+	}
+	if (spsc_peek(&ring) != NULL || spsc_used(&ring) != 0) test_fail("slot after the last", 0);
+}
+
+static void *producer(void *arg)
+{
+	STRESS_t *st = arg;
+	for (uint64_t i = 0; i < st->n; i++) {
+		SLOT_t *s;
+		while ((s = spsc_claim(&st->ring)) == NULL) {
+			if (st->lossy) break;
+			sched_yield();
+		}
+		if (s == NULL) {
+			st->dropped++;
+			continue;
+		}
+		fill(s, (uint32_t)i);
+		spsc_publish(&st->ring);
+	}
+	// end marker, always delivered
+	SLOT_t *s;
+	while ((s = spsc_claim(&st->ring)) == NULL) sched_yield();
+	s->seq = UINT32_MAX;
+	spsc_publish(&st->ring);
+	return NULL;
+}
+
+static void stress(int lossy)
+{
+	static STRESS_t st;
+	memset(&st, 0, sizeof(st));
+	spsc_init(&st.ring, storage, sizeof(SLOT_t), RING_SLOTS);
+	st.n = STRESS;
+	st.lossy = lossy;
+
+	pthread_t thread;
+	pthread_create(&thread, NULL, producer, &st);
+	uint64_t received = 0, torn = 0, order = 0;
+	int64_t last = -1;
+	for (;;) {
+		const SLOT_t *s = spsc_peek(&st.ring);
+		if (s == NULL) {
+			sched_yield();
+			continue;
+		}
+		if (s->seq == UINT32_MAX) {
+			spsc_release(&st.ring);
+			break;
+		}
+		if (!whole(s)) torn++;
+		if ((int64_t)s->seq <= last || (!lossy && s->seq != last + 1)) order++;
+		last = s->seq;
+		received++;
+		spsc_release(&st.ring);
+	}
+	pthread_join(thread, NULL);
+	if (torn) test_fail("torn slots", torn);
+	if (order) test_fail("slots out of order", order);
+	if (received + st.dropped != STRESS) test_fail("received and dropped", received + st.dropped);
+}
+
+TEST(spsc_two_threads) {
+	stress(0);
+}
+
+TEST(spsc_two_threads_lossy) {
+	stress(1);
+}
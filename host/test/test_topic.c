@@ -0,0 +1,229 @@
+/*
+	 main/topic.c: the MQTT 3.1.1 rules of '+', '#' and '$', a sink
+	 matched once however many of its filters match, unsubscribing, a
+	 client going away, a full arena, nodes given back and taken again,
+	 and the trie against every filter compared with the topic in turn on
+	 a big table.
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "topic.h"
+#include "test.h"
+
+#define SINKS 20
+#define SITES 16
+#define KINDS 4
+#define NAMES 256
+#define FILTERS 4000
+
+static uint8_t arena[1 << 20] __attribute__((aligned(8)));
+static TOPIC_TABLE_t table;
+
+// the sinks as a bit mask
+static uint32_t match_mask(const char *name)
+{
+	uint16_t sinks[SINKS];
+	int n = topic_match(&table, name, strlen(name), sinks, SINKS);
+	uint32_t mask = 0;
+	for (int i = 0; i < n; i++) {
+		if (mask & 1u << sinks[i]) test_fail("sink twice", sinks[i]);
+		mask |= 1u << sinks[i];
+	}
+	return mask;
+}
+
+static void subscribe(const char *filter, uint16_t sink)
+{
+	if (topic_subscribe(&table, filter, strlen(filter), sink) != ESP_OK) test_fail(filter, sink);
+}
+
+// sinks 1 to 6 on filters that overlap
+static void setup(void)
+{
+	topic_table_init(&table, arena, sizeof(arena));
+	subscribe("a/b/c", 1);
+	subscribe("a/+/c", 2);
+	subscribe("a/#", 3);
+	subscribe("#", 4);
+	subscribe("+/+/+", 5);
+	subscribe("$SYS/#", 6);
+}
+
+TEST(topic_valid) {
+	const char *valid[] = { "a/+/c", "#", "+", "a/#", "/", "+/+", "a//b", "$SYS/#" };
+	const char *invalid[] = { "", "a#", "a/#/b", "a+/b", "+a", "a/b#" };
+	for (size_t i = 0; i < sizeof(valid) / sizeof(valid[0]); i++) {
+		if (!topic_valid_filter(valid[i], strlen(valid[i]))) test_fail(valid[i], i);
+	}
+	for (size_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++) {
+		if (topic_valid_filter(invalid[i], strlen(invalid[i]))) test_fail(invalid[i], i);
+	}
+	if (topic_valid_name("a/+", 3)) test_fail("name with +", 0);
+	if (!topic_valid_name("a/b", 3)) test_fail("name", 0);
+}
+
+TEST(topic_match_rules) {
+	setup();
+	if (topic_subscribe(&table, "a/#/c", 5, 7) != ESP_ERR_INVALID_ARG) test_fail("bad filter", 0);
+	if (match_mask("a/b/c") != 0x3e) test_fail("a/b/c", match_mask("a/b/c"));
+	if (match_mask("a") != 0x18) test_fail("a", match_mask("a"));		// a/# matches a
+	if (match_mask("a/b") != 0x18) test_fail("a/b", match_mask("a/b"));
+	if (match_mask("a/x/c") != 0x3c) test_fail("a/x/c", match_mask("a/x/c"));
+	if (match_mask("$SYS/x/y") != 0x40) test_fail("$SYS", match_mask("$SYS/x/y"));	// not #, not +/+/+
+	if (match_mask("b/c") != 0x10) test_fail("b/c", match_mask("b/c"));
+}
+
+TEST(topic_sink_once) {
+	setup();
+	subscribe("a/#", 1);
+	subscribe("a/b/c", 1);
+	if (match_mask("a/b/c") != 0x3e) test_fail("twice", match_mask("a/b/c"));
+	if (table.filters != 6) test_fail("filters", table.filters);
+}
+
+TEST(topic_unsubscribe) {
+	// then again: the nodes and the entry of the sink are reused
+	setup();
+	if (topic_unsubscribe(&table, "a/+/c", 5, 2) != ESP_OK) test_fail("unsubscribe", 0);
+	if (topic_unsubscribe(&table, "a/+/c", 5, 2) != ESP_ERR_NOT_FOUND) test_fail("unsubscribe twice", 0);
+	if (match_mask("a/x/c") != 0x38) test_fail("a/x/c after", match_mask("a/x/c"));
+	size_t used = table.arena.used;
+	subscribe("a/+/c", 2);
+	if (table.arena.used != used) test_fail("reuse", table.arena.used - used);
+}
+
+static char emptied[4][32];
+static int nemptied;
+
+static void on_emptied(const char *filter, size_t len, void *arg)
+{
+	if (len != strlen(filter) || nemptied == 4) test_fail("emptied", len);
+	strcpy(emptied[nemptied++], filter);
+}
+
+static void count_filter(const char *filter, size_t len, void *arg)
+{
+	(*(int *)arg)++;
+}
+
+TEST(topic_remove_sink) {
+	// sink 1 goes away: a/b/c has nobody left, a/# still has 3
+	setup();
+	subscribe("a/#", 1);
+	nemptied = 0;
+	topic_remove_sink(&table, 1, on_emptied, NULL);
+	if (nemptied != 1 || strcmp(emptied[0], "a/b/c") != 0) test_fail("emptied filters", nemptied);
+	if (topic_sinks(&table, "a/#", 3) != 1) test_fail("sinks of a/#", topic_sinks(&table, "a/#", 3));
+	if (topic_sinks(&table, "a/b/c", 5) != 0) test_fail("sinks of a/b/c", topic_sinks(&table, "a/b/c", 5));
+	int listed = 0;
+	topic_each_filter(&table, count_filter, &listed);
+	if (listed != 5 || table.filters != 5) test_fail("each filter", listed);
+}
+
+TEST(topic_full) {
+	static uint8_t small[256] __attribute__((aligned(8)));
+	TOPIC_TABLE_t full;
+	topic_table_init(&full, small, sizeof(small));
+	esp_err_t err = ESP_OK;
+	char filter[32];
+	for (int i = 0; i < 32 && err == ESP_OK; i++) {
+		int len = sprintf(filter, "x/y%d", i);
+		err = topic_subscribe(&full, filter, len, 0);
+	}
+	if (err != ESP_ERR_NO_MEM) test_fail("full", err);
+}
+
+TEST(topic_free_nodes) {
+	// filters that come and go, each on levels of its own, in the 4 kB of the firmware
+	static uint8_t small[4096] __attribute__((aligned(8)));
+	TOPIC_TABLE_t t;
+	topic_table_init(&t, small, sizeof(small));
+	char filter[48];
+	size_t used = 0;
+	for (int i = 0; i < 10000; i++) {
+		int len = sprintf(filter, "site%d/device%05d/temperature", i % 7, i);
+		if (topic_subscribe(&t, filter, len, i % 3) != ESP_OK) test_fail("subscribe", i);
+		if (topic_unsubscribe(&t, filter, len, i % 3) != ESP_OK) test_fail("unsubscribe", i);
+		if (t.nodes != 1) test_fail("nodes left", t.nodes);
+		if (i == 0) used = t.arena.used;
+		if (t.arena.used != used) test_fail("arena grew", i);
+	}
+	// a sink that goes away gives its nodes back, the others keep theirs and still match
+	for (int i = 0; i < 20; i++) {
+		int len = sprintf(filter, "s/d%d/+", i);
+		if (topic_subscribe(&t, filter, len, i % 2) != ESP_OK) test_fail("subscribe", i);
+	}
+	topic_remove_sink(&t, 1, NULL, NULL);
+	if (t.nodes != 1 + 1 + 10 * 2) test_fail("nodes after remove", t.nodes);
+	for (int i = 0; i < 20; i++) {
+		uint16_t sinks[2];
+		int len = sprintf(filter, "s/d%d/x", i);
+		if (topic_match(&t, filter, len, sinks, 2) != (i % 2 ? 0 : 1)) test_fail("match after reuse", i);
+	}
+	topic_remove_sink(&t, 0, NULL, NULL);
+	if (t.nodes != 1 || t.filters != 0) test_fail("nodes at the end", t.nodes);
+}
+
+TEST(topic_full_leaves_nothing) {
+	// a filter that did not fit takes the nodes made for it back
+	static uint8_t small[512] __attribute__((aligned(8)));
+	TOPIC_TABLE_t t;
+	topic_table_init(&t, small, sizeof(small));
+	const char *deep = "aaaa/bbbb/cccc/dddd/eeee/ffff/gggg/hhhh/iiii/jjjj/kkkk/llll";
+	if (topic_subscribe(&t, deep, strlen(deep), 0) != ESP_ERR_NO_MEM) test_fail("deep filter fit", t.nodes);
+	if (t.nodes != 1) test_fail("nodes left", t.nodes);
+	if (topic_subscribe(&t, "a/b", 3, 0) != ESP_OK) test_fail("short filter after", t.nodes);
+}
+
+/*
+	 The plain way, a filter at a time
+*/
+
+static char filters[FILTERS][32];
+static char names[NAMES][32];
+
+static bool filter_matches(const char *f, const char *t)
+{
+	if (t[0] == '$' && (f[0] == '+' || f[0] == '#')) return false;
+	for (;;) {
+		if (f[0] == '#') return true;
+		const char *fe = strchr(f, '/');
+		const char *te = strchr(t, '/');
+		size_t fl = fe ? (size_t)(fe - f) : strlen(f);
+		size_t tl = te ? (size_t)(te - t) : strlen(t);
+		if (!(fl == 1 && f[0] == '+') && (fl != tl || memcmp(f, t, fl) != 0)) return false;
+		if (te == NULL) return fe == NULL || strcmp(fe, "/#") == 0;
+		if (fe == NULL) return false;
+		f = fe + 1;
+		t = te + 1;
+	}
+}
+
+TEST(topic_trie_agrees) {
+	// "s<site>/d<device>/k<kind>", one in ten with '+' for the device, one in ten ending in '#'
+	topic_table_init(&table, arena, sizeof(arena));
+	uint32_t r = 12345;
+	for (int i = 0; i < FILTERS; i++) {
+		r = r * 1103515245u + 12345u;
+		int site = i % SITES, device = (r >> 8) % (FILTERS / 8 + 1), kind = (r >> 20) % KINDS;
+		if (i % 10 == 3) {
+			sprintf(filters[i], "s%d/+/k%d", site, kind);
+		} else if (i % 10 == 7) {
+			sprintf(filters[i], "s%d/d%d/#", site, device);
+		} else {
+			sprintf(filters[i], "s%d/d%d/k%d", site, device, kind);
+		}
+		subscribe(filters[i], i % SINKS);
+	}
+	for (int i = 0; i < NAMES; i++) {
+		r = r * 1103515245u + 12345u;
+		sprintf(names[i], "s%u/d%u/k%u", (r >> 4) % SITES, (r >> 8) % (FILTERS / 8 + 1), (r >> 20) % KINDS);
+		uint32_t linear = 0;
+		for (int k = 0; k < FILTERS; k++) {
+			if (filter_matches(filters[k], names[i])) linear |= 1u << (k % SINKS);
+		}
+		if (match_mask(names[i]) != linear) test_fail(names[i], i);
+	}
+}
@@ -0,0 +1,66 @@
+/*
+	 main/trace.c: records come back in order with their arguments, a level
+	 above TRACE_LEVEL is not even evaluated, a record formats like the
+	 ESP_LOG line, and what a reader falls behind on is counted as lost.
+*/
+
+#include <string.h>
+
+#define TRACE_LEVEL TRACE_INFO		// TRACE_D and TRACE_V compile to nothing here
+#include "trace.h"
+#include "test.h"
+
+static const char *TAG = "test";
+
+TEST(trace_read_back) {
+	TRACE_READER_t reader;
+	TRACE_RECORD_t record;
+	trace_reader_init(&reader, 0);
+	for (int i = 0; i < 10; i++) {
+		TRACE_I("client %d sent %d bytes", i, 100 + i);
+	}
+	for (int i = 0; i < 10; i++) {
+		if (!trace_read(&reader, &record)) test_fail("records read", i);
+		if (record.args[0] != (uintptr_t)i || record.args[1] != (uintptr_t)(100 + i)) test_fail("arguments of record", i);
+	}
+	if (trace_read(&reader, &record)) test_fail("record after the last", 0);
+	if (reader.lost) test_fail("lost", reader.lost);
+}
+
+TEST(trace_compiled_out) {
+	int evaluated = 0;
+	TRACE_D("never written %d", ++evaluated);
+	TRACE_V("never written %d", ++evaluated);
+	if (evaluated) test_fail("arguments evaluated", evaluated);
+}
+
+TEST(trace_format) {
+	TRACE_READER_t reader;
+	TRACE_RECORD_t record;
+	char line[160];
+	trace_reader_init(&reader, 0);
+	TRACE_I("client %d sent %d bytes", 9, 109);
+	if (!trace_read(&reader, &record)) test_fail("record", 0);
+	trace_format(&record, line, sizeof(line));
+	if (strstr(line, "I (") != line) test_fail("level and time", 0);
+	if (strstr(line, ") test: client 9 sent 109 bytes\n") == NULL) test_fail("tag and message", strlen(line));
+}
+
+// three rings worth: what is not read back is counted as lost
+TEST(trace_lost) {
+	TRACE_READER_t reader;
+	TRACE_RECORD_t record;
+	trace_reader_init(&reader, 0);
+	for (int i = 0; i < 3 * TRACE_RECORDS; i++) {
+		TRACE_I("%s %d", "filling", i);
+	}
+	uint32_t read = 0;
+	uint64_t last = 0;
+	while (trace_read(&reader, &record)) {
+		if (read && record.t_us < last) test_fail("record older than the one before", read);
+		last = record.t_us;
+		read++;
+	}
+	if (read > TRACE_RECORDS * portNUM_PROCESSORS) test_fail("read more than the rings hold", read);
+	if (read + reader.lost != 3 * TRACE_RECORDS) test_fail("read and lost", read + reader.lost);
+}
@@ -0,0 +1,109 @@
+/*
+	 main/udp_stream.c on loopback: every datagram of a stream of encoded
+	 blocks arrives with its number and decodes to the block that went in
+	 (loopback loses nothing as long as the receive buffer keeps up, and
+	 the test reads each one before the next is sent), the stats count
+	 them, bad destinations are refused and a stopped stream sends
+	 nothing.
+*/
+
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "codec.h"
+#include "protocol.h"
+#include "udp_stream.h"
+#include "test.h"
+
+#define BLOCK 64	// CONFIG_ACQ_BLOCK_SAMPLES
+#define DATAGRAMS 1000
+
+static int open_receiver(uint16_t *port)
+{
+	int fd = socket(AF_INET, SOCK_DGRAM, 0);
+	struct sockaddr_in sin = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+	socklen_t len = sizeof(sin);
+	int size = 1 << 20;
+	setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+	if (fd < 0 || bind(fd, (struct sockaddr *)&sin, sizeof(sin)) < 0 || getsockname(fd, (struct sockaddr *)&sin, &len) < 0) {
+		test_fail("udp receiver", fd);
+	}
+	*port = ntohs(sin.sin_port);
+	return fd;
+}
+
+static void setup(void)
+{
+	static int ready;
+	if (!ready) {
+		if (udp_stream_init() != ESP_OK) test_fail("init", 0);
+		ready = 1;
+	}
+}
+
+static void stream(CODEC_t codec)
+{
+	setup();
+	uint16_t port;
+	int fd = open_receiver(&port);
+	if (udp_stream_start("127.0.0.1", port, codec) != ESP_OK) test_fail("start", port);
+	if (udp_stream_codec() != codec) test_fail("codec", udp_stream_codec());
+	static uint8_t frame[PROTOCOL_FRAME_HEADER_SIZE + CODEC_MAX_SIZE(BLOCK)];
+	static uint8_t buf[UDP_STREAM_MAX_DATAGRAM];
+	uint16_t samples[BLOCK], back[BLOCK];
+	for (uint32_t i = 0; i < DATAGRAMS; i++) {
+		for (int k = 0; k < BLOCK; k++) samples[k] = 4096 + ((i + k) * 37) % 200;
+		protocol_put_frame_header(frame, &(STREAM_FRAME_t) {
+			.channel = 6, .bits = 13, .seq = i, .period_us = 1000,
+			.mv_per_lsb = 2500.0f / 8191, .t0_us = (int64_t)i * BLOCK * 1000,
+		});
+		int len = codec_encode(codec, samples, BLOCK, 13, frame + PROTOCOL_FRAME_HEADER_SIZE, sizeof(frame) - PROTOCOL_FRAME_HEADER_SIZE);
+		if (udp_stream_send(frame, PROTOCOL_FRAME_HEADER_SIZE + len) != ESP_OK) test_fail("send", i);
+
+		ssize_t got = recv(fd, buf, sizeof(buf), 0);
+		if (got <= UDP_STREAM_HEADER_SIZE) test_fail("datagram size", got);
+		uint32_t seq = buf[0] | (buf[1] << 8) | (buf[2] << 16) | ((uint32_t)buf[3] << 24);
+		if (seq != i) test_fail("datagram number", seq);
+		STREAM_FRAME_t header;
+		int header_len = protocol_get_frame_header(buf + UDP_STREAM_HEADER_SIZE, got - UDP_STREAM_HEADER_SIZE, &header);
+		if (header_len < 0 || header.seq != i) test_fail("frame header", i);
+		const uint8_t *block = buf + UDP_STREAM_HEADER_SIZE + header_len;
+		if (codec_decode(block, got - UDP_STREAM_HEADER_SIZE - header_len, back, BLOCK) != BLOCK) test_fail("decode", i);
+		if (memcmp(back, samples, sizeof(back)) != 0) test_fail("samples", i);
+	}
+	UDP_STREAM_STATS_t stats;
+	udp_stream_get_stats(&stats);
+	if (stats.sent != DATAGRAMS) test_fail("sent", stats.sent);
+	if (stats.send_errors != 0) test_fail("send errors", stats.send_errors);
+	udp_stream_report(DATAGRAMS - 3, 3, 1);
+	udp_stream_get_stats(&stats);
+	if (stats.received != DATAGRAMS - 3 || stats.lost != 3 || stats.reordered != 1) test_fail("report", stats.lost);
+	udp_stream_stop();
+	close(fd);
+}
+
+TEST(udp_stream_packed) {
+	stream(CODEC_PACKED);
+}
+
+TEST(udp_stream_delta) {
+	stream(CODEC_DELTA);
+}
+
+TEST(udp_stream_rice) {
+	stream(CODEC_RICE);
+}
+
+TEST(udp_stream_refused) {
+	setup();
+	uint8_t frame[PROTOCOL_FRAME_HEADER_SIZE + 8] = { 0 };
+	if (udp_stream_start("127.0.0.1", 9, CODEC_TEXT) == ESP_OK) test_fail("text codec", CODEC_TEXT);
+	if (udp_stream_start("127.0.0.1", 0, CODEC_RICE) == ESP_OK) test_fail("port", 0);
+	if (udp_stream_start("not an address", 9, CODEC_RICE) == ESP_OK) test_fail("host", 0);
+	udp_stream_stop();
+	if (udp_stream_codec() != CODEC_TEXT) test_fail("codec of a stopped stream", udp_stream_codec());
+	if (udp_stream_send(frame, sizeof(frame)) == ESP_OK) test_fail("sent without a destination", 0);
+}
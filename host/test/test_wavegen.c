@@ -0,0 +1,132 @@
+/*
+	 main/wavegen.c into 8 bit codes at 100 kHz over 3300 mV: a 1 kHz sine
+	 crosses the middle 1000 times a second and peaks at offset +-
+	 amplitude within a code, a square has two levels, a triangle the same
+	 peaks, a 100 to 1000 Hz sweep averages 550 Hz, a table upload round
+	 trips through the protocol and plays its points, and bad configs are
+	 refused.
+*/
+
+#include <stdlib.h>
+
+#include "protocol.h"
+#include "wavegen.h"
+#include "test.h"
+
+#define RATE_HZ 100000
+#define FULL_SCALE_MV 3300
+#define BITS 8
+
+static WAVEGEN_t gen;
+static uint8_t buf[RATE_HZ];
+
+static int code_of(int mv)
+{
+	return (mv * ((1 << BITS) - 1) + FULL_SCALE_MV / 2) / FULL_SCALE_MV;
+}
+
+static void play(const WAVEGEN_CONFIG_t *cfg, const int16_t *points, int count, size_t len)
+{
+	gen.phase = 0;
+	if (wavegen_configure(&gen, cfg, points, count, RATE_HZ, FULL_SCALE_MV, BITS) != ESP_OK) test_fail("refused", cfg->shape);
+	wavegen_fill(&gen, buf, len);
+}
+
+// times the codes go up through mid within len
+static int rising(size_t len, int mid)
+{
+	int count = 0;
+	for (size_t i = 1; i < len; i++) count += buf[i - 1] < mid && buf[i] >= mid;
+	return count;
+}
+
+static void check_levels(size_t len, int low, int high)
+{
+	int min = 255, max = 0;
+	for (size_t i = 0; i < len; i++) {
+		if (buf[i] < min) min = buf[i];
+		if (buf[i] > max) max = buf[i];
+	}
+	if (abs(min - low) > 1) test_fail("low level", min);
+	if (abs(max - high) > 1) test_fail("high level", max);
+}
+
+static const WAVEGEN_CONFIG_t khz = { .shape = WAVEGEN_SINE, .freq_hz = 1000, .amplitude_mv = 1000, .offset_mv = 1650 };
+
+TEST(wavegen_sine) {
+	play(&khz, NULL, 0, RATE_HZ);
+	int crossings = rising(RATE_HZ, code_of(1650));
+	if (crossings < 999 || crossings > 1001) test_fail("crossings", crossings);
+	check_levels(RATE_HZ, code_of(650), code_of(2650));
+}
+
+TEST(wavegen_square) {
+	const int low = code_of(650), high = code_of(2650), mid = code_of(1650);
+	WAVEGEN_CONFIG_t cfg = khz;
+	cfg.shape = WAVEGEN_SQUARE;
+	play(&cfg, NULL, 0, RATE_HZ);
+	check_levels(RATE_HZ, low, high);
+	for (size_t i = 0; i < RATE_HZ; i++) {
+		if (abs(buf[i] - low) > 1 && abs(buf[i] - high) > 1 && abs(buf[i] - mid) > 1) test_fail("level", buf[i]);
+	}
+}
+
+TEST(wavegen_triangle) {
+	WAVEGEN_CONFIG_t cfg = khz;
+	cfg.shape = WAVEGEN_TRIANGLE;
+	play(&cfg, NULL, 0, RATE_HZ);
+	check_levels(RATE_HZ, code_of(650), code_of(2650));
+	int crossings = rising(RATE_HZ, code_of(1650));
+	if (crossings < 999 || crossings > 1001) test_fail("crossings", crossings);
+}
+
+// 100 ms from 100 to 1000 Hz: 55 periods, and then again
+TEST(wavegen_sweep) {
+	WAVEGEN_CONFIG_t cfg = { .shape = WAVEGEN_SWEEP, .freq_hz = 100, .to_hz = 1000, .sweep_ms = 100, .amplitude_mv = 1000, .offset_mv = 1650 };
+	const int mid = code_of(1650);
+	play(&cfg, NULL, 0, RATE_HZ / 10);
+	int crossings = rising(RATE_HZ / 10, mid);
+	if (crossings < 53 || crossings > 57) test_fail("crossings", crossings);
+	wavegen_fill(&gen, buf, RATE_HZ / 10);
+	if (abs(rising(RATE_HZ / 10, mid) - crossings) > 1) test_fail("crossings of the second sweep", rising(RATE_HZ / 10, mid));
+}
+
+// a staircase of four points through a websocket message
+TEST(wavegen_table_upload) {
+	const int16_t steps[4] = { 32767, 10922, -10922, -32767 };
+	uint8_t msg[4 + 2 * 4] = { PROTOCOL_WAVETABLE_MAGIC, 0, 4, 0 };
+	for (int i = 0; i < 4; i++) {
+		msg[4 + 2 * i] = steps[i] & 0xff;
+		msg[5 + 2 * i] = (uint16_t)steps[i] >> 8;
+	}
+	int16_t points[WAVEGEN_MAX_POINTS];
+	if (protocol_get_wavetable(msg, sizeof(msg) - 1, points, WAVEGEN_MAX_POINTS) >= 0) test_fail("short message taken", 0);
+	if (protocol_get_wavetable(msg, sizeof(msg), points, 3) >= 0) test_fail("points over the room taken", 0);
+	int count = protocol_get_wavetable(msg, sizeof(msg), points, WAVEGEN_MAX_POINTS);
+	if (count != 4) test_fail("points", count);
+	for (int i = 0; i < 4; i++) {
+		if (points[i] != steps[i]) test_fail("point", i);
+	}
+	WAVEGEN_CONFIG_t cfg = khz;
+	cfg.shape = WAVEGEN_TABLE;
+	play(&cfg, points, 4, 100);
+	// 100 samples a period, the points a quarter apart
+	for (int i = 0; i < 4; i++) {
+		if (abs(buf[i * 25] - code_of(1650 + 1000 * steps[i] / 32767)) > 1) test_fail("played point", i);
+	}
+}
+
+TEST(wavegen_bad_config) {
+	int16_t points[4] = { 0 };
+	WAVEGEN_CONFIG_t bad[] = {
+		{ .shape = WAVEGEN_OFF, .freq_hz = 1000 },
+		{ .shape = WAVEGEN_SINE, .freq_hz = 0 },
+		{ .shape = WAVEGEN_SINE, .freq_hz = RATE_HZ / 2 },
+		{ .shape = WAVEGEN_SINE, .freq_hz = 1000, .amplitude_mv = FULL_SCALE_MV + 1 },
+		{ .shape = WAVEGEN_SWEEP, .freq_hz = 100, .to_hz = 1000, .sweep_ms = 0 },
+		{ .shape = WAVEGEN_TABLE, .freq_hz = 1000 },
+	};
+	for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+		if (wavegen_configure(&gen, &bad[i], points, i == 5 ? 1 : 4, RATE_HZ, FULL_SCALE_MV, BITS) == ESP_OK) test_fail("accepted", i);
+	}
+}
@@ -0,0 +1,483 @@
+/*
+	 components/websocket: the examples of RFC 6455 (accept key, a masked
+	 "Hello", fragments with a ping in between, 16 and 64 bit lengths fed
+	 a byte at a time), every protocol error the parser closes with and
+	 its status code, UTF-8 edge cases, the handshake and the
+	 permessage-deflate offers, the RFC 7692 examples and a dynamic Huffman
+	 block from zlib, a compress/inflate round trip, word-wise masking
+	 against byte-wise at every alignment, and on loopback through the
+	 netconn shim: an echo, a ping, a compressed message and the close
+	 handshake.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "lwip/api.h"
+
+#include "websocket.h"
+#include "websocket_server.h"
+#include "wsclient.h"
+#include "test.h"
+
+static const uint8_t KEY[4] = { 0x37, 0xfa, 0x21, 0x3d };
+static uint8_t payload[70000];
+
+static void fill_payload(void)
+{
+	for (size_t i = 0; i < sizeof(payload); i++) payload[i] = i * 7;
+}
+
+static int64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// a frame as a client sends it, b0 is fin, rsv and opcode
+static size_t client_frame(uint8_t *out, uint8_t b0, const void *data, uint64_t len)
+{
+	size_t h = ws_put_header(out, 0, false, len, KEY);
+	out[0] = b0;
+	memcpy(out + h, data, len);
+	ws_mask(out + h, len, KEY, 0);
+	return h + len;
+}
+
+// parses all of data, step bytes at a time; returns the last result, the messages in msgs
+static int parse(WS_PARSER_t *p, const uint8_t *data, size_t len, size_t step, WS_MESSAGE_t *msgs, int *count)
+{
+	int ret = 0;
+	*count = 0;
+	size_t i = 0;
+	while (i < len) {
+		size_t n = len - i < step ? len - i : step;
+		size_t used;
+		ret = ws_parse(p, data + i, n, &used, &msgs[*count]);
+		if (ret < 0) return ret;
+		if (ret == 1) (*count)++;
+		i += used;
+	}
+	return ret;
+}
+
+// the close code the parser answers frame with, 0 for none
+static int parse_error(const uint8_t *frame, size_t len, bool deflate)
+{
+	WS_PARSER_t p;
+	WS_MESSAGE_t msgs[4];
+	int count;
+	ws_parser_init(&p, 1000, deflate);
+	int ret = parse(&p, frame, len, len, msgs, &count);
+	ws_parser_free(&p);
+	return ret < 0 ? -ret : 0;
+}
+
+TEST(websocket_accept_and_header) {
+	char accept[WS_ACCEPT_SIZE];
+	ws_accept_key("dGhlIHNhbXBsZSBub25jZQ==", 24, accept);
+	if (strcmp(accept, "s3pPLMBiTxaQ9kYGzzhZRbK+xOo=") != 0) test_fail("accept key", 0);
+
+	uint8_t header[WS_MAX_HEADER];
+	if (ws_put_header(header, WEBSOCKET_OPCODE_TEXT, false, 125, NULL) != 2 || header[0] != 0x81 || header[1] != 125
+		|| ws_put_header(header, WEBSOCKET_OPCODE_BIN, true, 126, NULL) != 4 || header[0] != 0xc2 || header[1] != 126
+		|| ws_put_header(header, WEBSOCKET_OPCODE_TEXT, false, 65535, NULL) != 4 || header[2] != 0xff
+		|| ws_put_header(header, WEBSOCKET_OPCODE_TEXT, false, 65536, KEY) != 14 || header[1] != 0xff || header[7] != 1) {
+		test_fail("header", header[1]);
+	}
+}
+
+TEST(websocket_parse_rfc_examples) {
+	// RFC 6455 5.7
+	static const uint8_t hello[] = { 0x81, 0x85, 0x37, 0xfa, 0x21, 0x3d, 0x7f, 0x9f, 0x4d, 0x51, 0x58 };
+	WS_PARSER_t p;
+	WS_MESSAGE_t msgs[4];
+	int count;
+	ws_parser_init(&p, 100000, false);
+	for (size_t step = 1; step <= sizeof(hello); step++) {
+		if (parse(&p, hello, sizeof(hello), step, msgs, &count) != 1 || count != 1 || msgs[0].opcode != WEBSOCKET_OPCODE_TEXT
+			|| msgs[0].len != 5 || strcmp((char *)msgs[0].data, "Hello") != 0) test_fail("masked Hello, in pieces of", step);
+	}
+
+	// "Hel", a ping, "lo"
+	uint8_t stream[80000];
+	size_t len = client_frame(stream, 0x01, "Hel", 3);
+	len += client_frame(stream + len, 0x89, "ping", 4);
+	len += client_frame(stream + len, 0x80, "lo", 2);
+	if (parse(&p, stream, len, len, msgs, &count) != 1 || count != 2 || msgs[0].opcode != WEBSOCKET_OPCODE_PING
+		|| memcmp(msgs[0].data, "ping", 4) != 0 || msgs[1].opcode != WEBSOCKET_OPCODE_TEXT || strcmp((char *)msgs[1].data, "Hello") != 0) {
+		test_fail("fragments around a ping", count);
+	}
+
+	// 16 and 64 bit lengths, a byte at a time
+	fill_payload();
+	size_t sizes[] = { 126, 300, 65535, 65536, 70000 };
+	for (int k = 0; k < 5; k++) {
+		len = client_frame(stream, 0x82, payload, sizes[k]);
+		if (parse(&p, stream, len, 1, msgs, &count) != 1 || count != 1 || msgs[0].len != sizes[k] || msgs[0].opcode != WEBSOCKET_OPCODE_BIN
+			|| memcmp(msgs[0].data, payload, sizes[k]) != 0) test_fail("binary message of", sizes[k]);
+	}
+	ws_parser_free(&p);
+}
+
+TEST(websocket_protocol_errors) {
+	uint8_t stream[4096];
+	size_t len;
+	fill_payload();
+	// errors and the code they close with
+	struct {
+		uint8_t b0;
+		const char *data;
+		size_t len;
+		int code;
+	} bad[] = {
+		{ 0xc1, "x", 1, WS_CLOSE_PROTOCOL },			// RSV1 without deflate
+		{ 0xa1, "x", 1, WS_CLOSE_PROTOCOL },			// RSV2
+		{ 0x91, "x", 1, WS_CLOSE_PROTOCOL },			// RSV3
+		{ 0x83, "x", 1, WS_CLOSE_PROTOCOL },			// reserved opcode
+		{ 0x8b, "x", 1, WS_CLOSE_PROTOCOL },			// reserved control opcode
+		{ 0x09, "x", 1, WS_CLOSE_PROTOCOL },			// fragmented ping
+		{ 0x80, "x", 1, WS_CLOSE_PROTOCOL },			// continuation of nothing
+		{ 0x88, "\x03", 1, WS_CLOSE_PROTOCOL },			// close with 1 byte
+		{ 0x88, "\x03\xed", 2, WS_CLOSE_PROTOCOL },		// 1005 is not sent
+		{ 0x88, "\x03\xe7", 2, WS_CLOSE_PROTOCOL },		// 999
+		{ 0x88, "\x13\x88", 2, WS_CLOSE_PROTOCOL },		// 5000
+		{ 0x88, "\x03\xe8\xff", 3, WS_CLOSE_INVALID_DATA },	// reason not UTF-8
+		{ 0x81, "", 0, 0 },
+		{ 0x88, "\x03\xe8ok", 4, 0 },
+		{ 0x88, "\x0b\xb8", 2, 0 },						// 3000
+	};
+	for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+		len = client_frame(stream, bad[i].b0, bad[i].data, bad[i].len);
+		if (parse_error(stream, len, false) != bad[i].code) test_fail("error case", i);
+	}
+	len = client_frame(stream, 0x89, payload, 126);
+	if (parse_error(stream, len, false) != WS_CLOSE_PROTOCOL) test_fail("ping of 126 bytes", 0);
+	len = client_frame(stream, 0x81, payload, 1001);
+	if (parse_error(stream, len, false) != WS_CLOSE_TOO_BIG) test_fail("message past the max", 0);
+	len = client_frame(stream, 0x01, payload, 600);
+	len += client_frame(stream + len, 0x80, payload, 600);
+	if (parse_error(stream, len, false) != WS_CLOSE_TOO_BIG) test_fail("fragments past the max", 0);
+	len = client_frame(stream, 0x01, "a", 1);
+	len += client_frame(stream + len, 0x81, "b", 1);
+	if (parse_error(stream, len, false) != WS_CLOSE_PROTOCOL) test_fail("new message inside a fragmented one", 0);
+	len = client_frame(stream, 0x41, "a", 1);
+	len += client_frame(stream + len, 0xc0, "b", 1);
+	if (parse_error(stream, len, true) != WS_CLOSE_PROTOCOL) test_fail("RSV1 on a continuation", 0);
+	len = client_frame(stream, 0xc1, "a", 1);
+	if (parse_error(stream, len, true) != 0) test_fail("RSV1 with deflate", 0);
+	static const uint8_t unmasked[] = { 0x81, 0x01, 'x' };
+	if (parse_error(unmasked, sizeof(unmasked), false) != WS_CLOSE_PROTOCOL) test_fail("unmasked frame", 0);
+	static const uint8_t huge[] = { 0x82, 0xff, 0x80, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 0 };
+	if (parse_error(huge, sizeof(huge), false) != WS_CLOSE_PROTOCOL) test_fail("64 bit length with its top bit", 0);
+}
+
+TEST(websocket_utf8) {
+	struct {
+		const char *s;
+		bool valid;
+	} utf8[] = {
+		{ "", true }, { "plain ascii text, longer than a word", true },
+		{ "\xce\xba\xe1\xbd\xb9\xcf\x83\xce\xbc\xce\xb5", true },	// κόσμε
+		{ "\xf0\x9f\x98\x80", true }, { "\xf4\x8f\xbf\xbf", true }, { "\xed\x9f\xbf", true },
+		{ "\xc0\x80", false }, { "\xe0\x80\xaf", false }, { "\xf0\x80\x80\xaf", false },	// overlong
+		{ "\xed\xa0\x80", false }, { "\xf4\x90\x80\x80", false }, { "\xf5\x80\x80\x80", false },
+		{ "\xe2\x82", false }, { "abc\x80", false }, { "\xff", false }, { "12345678\xce", false },
+	};
+	for (size_t i = 0; i < sizeof(utf8) / sizeof(utf8[0]); i++) {
+		if (ws_utf8_valid((const uint8_t *)utf8[i].s, strlen(utf8[i].s)) != utf8[i].valid) test_fail("UTF-8 case", i);
+	}
+}
+
+TEST(websocket_mask_wordwise) {
+	// word-wise masking against byte-wise, at every alignment, offset and length
+	uint8_t a[64], b[64];
+	for (int align = 0; align < 4; align++) {
+		for (int offset = 0; offset < 4; offset++) {
+			for (int n = 0; n < 48; n++) {
+				for (int i = 0; i < 64; i++) a[i] = b[i] = i * 13;
+				ws_mask(a + align, n, KEY, offset);
+				for (int i = 0; i < n; i++) b[align + i] ^= KEY[(offset + i) & 3];
+				if (memcmp(a, b, sizeof(a)) != 0) test_fail("word-wise mask", align * 1000 + offset * 100 + n);
+			}
+		}
+	}
+}
+
+TEST(websocket_handshake) {
+	char out[512];
+	const char *request =
+		"GET / HTTP/1.1\r\n"
+		"Host: server.example.com\r\n"
+		"upgrade: WebSocket\r\n"
+		"Connection: keep-alive, Upgrade\r\n"
+		"Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+		"Sec-WebSocket-Version: 13\r\n"
+		"%s\r\n";
+	struct {
+		const char *extra;
+		bool deflate;
+		int result;		// -1 refused, 0 plain, 1 with deflate
+	} cases[] = {
+		{ "", true, 0 },
+		{ "Sec-WebSocket-Extensions: permessage-deflate; client_max_window_bits\r\n", true, 1 },
+		{ "Sec-WebSocket-Extensions: permessage-deflate; client_max_window_bits\r\n", false, 0 },
+		{ "Sec-WebSocket-Extensions: permessage-deflate; server_max_window_bits=10\r\n", true, 0 },
+		{ "Sec-WebSocket-Extensions: permessage-deflate; server_max_window_bits=10, permessage-deflate\r\n", true, 1 },
+		{ "Sec-WebSocket-Extensions: x-webkit-deflate-frame, permessage-deflate; server_max_window_bits=\"15\"\r\n", true, 1 },
+		{ "Sec-WebSocket-Extensions: permessage-deflate; unknown\r\n", true, 0 },
+	};
+	char req[512];
+	for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+		int len = snprintf(req, sizeof(req), request, cases[i].extra);
+		bool deflate = cases[i].deflate;
+		int n = ws_handshake(req, len, out, sizeof(out), &deflate);
+		if (n < 0 || strncmp(out, "HTTP/1.1 101", 12) != 0 || !strstr(out, "Sec-WebSocket-Accept: s3pPLMBiTxaQ9kYGzzhZRbK+xOo=\r\n")
+			|| deflate != cases[i].result || (strstr(out, "permessage-deflate") != NULL) != deflate) test_fail("handshake case", i);
+	}
+	const char *refused[] = {
+		"POST / HTTP/1.1\r\nUpgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Key: a\r\nSec-WebSocket-Version: 13\r\n\r\n",
+		"GET / HTTP/1.1\r\nConnection: Upgrade\r\nSec-WebSocket-Key: a\r\nSec-WebSocket-Version: 13\r\n\r\n",
+		"GET / HTTP/1.1\r\nUpgrade: websocket\r\nConnection: close\r\nSec-WebSocket-Key: a\r\nSec-WebSocket-Version: 13\r\n\r\n",
+		"GET / HTTP/1.1\r\nUpgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Version: 13\r\n\r\n",
+		"GET / HTTP/1.1\r\nUpgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Key: a\r\nSec-WebSocket-Version: 8\r\n\r\n",
+		// headers after the blank line do not count
+		"GET / HTTP/1.1\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n\r\nSec-WebSocket-Key: a\r\nSec-WebSocket-Version: 13\r\n",
+	};
+	for (size_t i = 0; i < sizeof(refused) / sizeof(refused[0]); i++) {
+		bool deflate = true;
+		if (ws_handshake(refused[i], strlen(refused[i]), out, sizeof(out), &deflate) >= 0) test_fail("accepted bad request", i);
+	}
+}
+
+// 24 readings as JSON, 432 bytes
+static size_t sample_message(char *out, size_t size)
+{
+	size_t len = 0;
+	for (int i = 0; i < 24; i++) len += snprintf(out + len, size - len, "{\"ch\":%d,\"mv\":%d}", i % 4, 1000 + (i * 37) % 200);
+	return len;
+}
+
+TEST(websocket_deflate) {
+	uint8_t out[70000];
+	// RFC 7692 7.2.3.1 and 7.2.3.3
+	static const uint8_t fixed[] = { 0xf2, 0x48, 0xcd, 0xc9, 0xc9, 0x07, 0x00 };
+	static const uint8_t stored[] = { 0x00, 0x05, 0x00, 0xfa, 0xff, 0x48, 0x65, 0x6c, 0x6c, 0x6f, 0x00 };
+	if (ws_inflate(fixed, sizeof(fixed), out, sizeof(out)) != 5 || memcmp(out, "Hello", 5) != 0) test_fail("inflate fixed Hello", 0);
+	if (ws_inflate(stored, sizeof(stored), out, sizeof(out)) != 5 || memcmp(out, "Hello", 5) != 0) test_fail("inflate stored Hello", 0);
+
+	// zlib -15, level 9, sync flush, 00 00 ff ff cut
+	static const uint8_t dynamic[] = {
+		0x64, 0xd0, 0x31, 0x0e, 0xc3, 0x30, 0x0c, 0x43, 0xd1, 0xbb, 0x78, 0xee, 0x40, 0x4a, 0xb2, 0x65, 0xe7, 0x3a, 0x5d, 0xba,
+		0x74, 0xed, 0x12, 0xe4, 0xee, 0x09, 0x0a, 0x7b, 0xa1, 0x35, 0xfe, 0xe1, 0x01, 0xd4, 0x59, 0xde, 0x9f, 0x72, 0xe0, 0x55,
+		0xbe, 0xbf, 0x72, 0x10, 0xc0, 0x75, 0xfe, 0x0b, 0x57, 0xf1, 0x9c, 0xc5, 0x56, 0xc9, 0x98, 0xc5, 0x67, 0x79, 0x6e, 0x96,
+		0xe5, 0x30, 0xba, 0x38, 0xec, 0x55, 0x1d, 0x33, 0x71, 0x50, 0x87, 0x38, 0x18, 0x4d, 0x1d, 0x77, 0x71, 0x98, 0x50, 0x07,
+		0xa9, 0x4e, 0x84, 0xee, 0xea, 0x54, 0x87, 0x5d, 0x77, 0xd5, 0xaa, 0xbb, 0x86, 0xa9, 0x63, 0x43, 0x77, 0xb5, 0xa6, 0x0e,
+		0x7c, 0xfb, 0x8f, 0xfe, 0x99, 0xb9, 0xfd, 0x99, 0xb1, 0xfd, 0x87, 0xd7, 0x0d,
+	};
+	char msg[512];
+	size_t len = sample_message(msg, sizeof(msg));
+	if (ws_inflate(dynamic, sizeof(dynamic), out, sizeof(out)) != (int)len || memcmp(out, msg, len) != 0) test_fail("inflate dynamic", len);
+	if (ws_inflate(dynamic, sizeof(dynamic), out, len - 1) != -2) test_fail("inflate past the size", 0);
+	static const uint8_t broken[] = { 0xff, 0xff, 0xff };
+	if (ws_inflate(broken, sizeof(broken), out, sizeof(out)) != -1) test_fail("inflate broken", 0);
+
+	static WS_DEFLATE_t z;
+	if (ws_deflate(&z, (const uint8_t *)"Hello", 5, out, sizeof(out)) != -1) test_fail("deflate of what does not shrink", 0);
+	uint8_t back[70000];
+	int zlen = ws_deflate(&z, (const uint8_t *)msg, len, out, sizeof(out));
+	if (zlen <= 0 || ws_inflate(out, zlen, back, sizeof(back)) != (int)len || memcmp(back, msg, len) != 0) test_fail("deflate round trip", zlen);
+	// long matches, far distances and literals above 143
+	static uint8_t big[60000];
+	for (size_t i = 0; i < sizeof(big); i++) big[i] = i < 300 ? 0xa5 : (i % 1000 < 500 ? big[i - 300] : (uint8_t)(i * 131 >> 3));
+	zlen = ws_deflate(&z, big, sizeof(big), out, sizeof(out));
+	if (zlen <= 0 || ws_inflate(out, zlen, back, sizeof(back)) != (int)sizeof(big) || memcmp(back, big, sizeof(big)) != 0) test_fail("deflate round trip big", zlen);
+	if (ws_deflate(&z, big, sizeof(big), out, 10) != -1) test_fail("deflate past the size", 0);
+}
+
+/*
+	 The server on loopback
+*/
+
+static uint16_t port;
+static volatile int connected = -1;		// the client number
+static volatile int disconnects;
+static volatile WEBSOCKET_TYPE_t last_event;
+static volatile uint64_t received;
+static volatile bool echo;
+
+static void callback(uint8_t num, WEBSOCKET_TYPE_t type, char *msg, uint64_t len)
+{
+	switch (type) {
+		case WEBSOCKET_CONNECT:
+			connected = num;
+			break;
+		case WEBSOCKET_DISCONNECT_EXTERNAL:
+		case WEBSOCKET_DISCONNECT_INTERNAL:
+		case WEBSOCKET_DISCONNECT_ERROR:
+			last_event = type;
+			disconnects++;
+			break;
+		case WEBSOCKET_TEXT:
+		case WEBSOCKET_BIN:
+			if (echo) ws_server_send_text_client_from_callback(num, msg, len);
+			received++;
+			break;
+		default:
+			last_event = type;
+	}
+}
+
+// what the HTTP server of app.c does
+static void accept_task(void *arg)
+{
+	struct netconn *listener = arg;
+	for (;;) {
+		struct netconn *conn;
+		struct netbuf *inbuf;
+		char *buf;
+		uint16_t buflen;
+		if (netconn_accept(listener, &conn) != ERR_OK) continue;
+		netconn_set_recvtimeout(conn, 1000);
+		if (netconn_recv(conn, &inbuf) != ERR_OK) {
+			netconn_delete(conn);
+			continue;
+		}
+		netbuf_data(inbuf, (void **)&buf, &buflen);
+		ws_server_add_client(conn, buf, buflen, "/", callback);
+		netbuf_delete(inbuf);
+	}
+}
+
+static void start_server(void)
+{
+	if (port) return;
+	esp_log_level = ESP_LOG_WARN;
+	ip_addr_t loopback;
+	ipaddr_aton("127.0.0.1", &loopback);
+	struct netconn *listener = netconn_new(NETCONN_TCP);
+	if (listener == NULL || netconn_bind(listener, &loopback, 0) != ERR_OK || netconn_listen(listener) != ERR_OK
+		|| netconn_addr(listener, NULL, &port) != ERR_OK) test_fail("listener", 0);
+	ws_server_start();	// or already running for another test, a server that is not fails the CONNECT below
+	xTaskCreate(accept_task, "accept", 4096, listener, 5, NULL);
+}
+
+static void wait_for(volatile uint64_t *counter, uint64_t value)
+{
+	int64_t deadline = now_ns() + 5000000000LL;
+	while (*counter < value) {
+		if (now_ns() > deadline) test_fail("timed out waiting, got", *counter);
+		sched_yield();
+	}
+}
+
+// the next frame that is no pong, waiting up to a second
+static int next_frame(WS_CLIENT_t *c, WS_FRAME_t *frame)
+{
+	int64_t deadline = now_ns() + 1000000000LL;
+	for (;;) {
+		if (ws_client_next_frame(c, frame) == 1) return 1;
+		if (ws_client_fill(c) < 0 || now_ns() > deadline) return 0;
+		sched_yield();
+	}
+}
+
+static void connect_client(WS_CLIENT_t *c)
+{
+	connected = -1;
+	if (ws_client_connect(c, "127.0.0.1", port, "/") != 0) test_fail("connect", 0);
+	int64_t deadline = now_ns() + 1000000000LL;
+	while (connected < 0) {
+		if (now_ns() > deadline) test_fail("no CONNECT", 0);
+		sched_yield();
+	}
+}
+
+// a client that offers permessage-deflate, wsclient does not
+static void connect_deflate(WS_CLIENT_t *c)
+{
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	struct sockaddr_in sin = { .sin_family = AF_INET, .sin_port = htons(port), .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+	if (connect(fd, (struct sockaddr *)&sin, sizeof(sin)) != 0) test_fail("connect", 0);
+	static const char request[] = "GET / HTTP/1.1\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+		"Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\nSec-WebSocket-Version: 13\r\n"
+		"Sec-WebSocket-Extensions: permessage-deflate; client_max_window_bits\r\n\r\n";
+	connected = -1;
+	if (send(fd, request, sizeof(request) - 1, 0) != sizeof(request) - 1) test_fail("request", 0);
+	*c = (WS_CLIENT_t) { .fd = fd, .cap = 65536, .buf = malloc(65536) };
+	char *end = NULL;
+	while (end == NULL) {
+		ssize_t r = recv(fd, c->buf + c->len, c->cap - c->len - 1, 0);
+		if (r <= 0) test_fail("response", r);
+		c->len += r;
+		c->buf[c->len] = 0;
+		end = strstr(c->buf, "\r\n\r\n");
+	}
+	if (strncmp(c->buf, "HTTP/1.1 101", 12) != 0 || !strstr(c->buf, "permessage-deflate")) test_fail("no permessage-deflate", 0);
+	c->pos = end + 4 - c->buf;
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	while (connected < 0) sched_yield();
+}
+
+TEST(websocket_loopback) {
+	start_server();
+	WS_CLIENT_t c;
+	WS_FRAME_t frame;
+	connect_client(&c);
+	echo = true;
+	if (ws_client_send_text(&c, "echo me", 7) != 0 || !next_frame(&c, &frame) || frame.opcode != WS_OP_TEXT
+		|| frame.len != 7 || memcmp(frame.data, "echo me", 7) != 0) test_fail("echo", frame.len);
+	echo = false;
+	if (ws_client_send(&c, WS_OP_PING, "p1", 2) != 0 || !next_frame(&c, &frame) || frame.opcode != WS_OP_PONG
+		|| frame.len != 2 || memcmp(frame.data, "p1", 2) != 0) test_fail("pong", frame.opcode);
+	// invalid UTF-8 closes with 1007
+	int before = disconnects;
+	if (ws_client_send_text(&c, "\xc0\x80", 2) != 0 || !next_frame(&c, &frame) || frame.opcode != WS_OP_CLOSE || frame.len != 2
+		|| ((uint8_t)frame.data[0] << 8 | (uint8_t)frame.data[1]) != WS_CLOSE_INVALID_DATA) test_fail("close on bad UTF-8", frame.opcode);
+	while (disconnects == before) sched_yield();
+	if (last_event != WEBSOCKET_DISCONNECT_ERROR) test_fail("disconnect event", last_event);
+	ws_client_close(&c);
+
+	// a message to a client that agreed to deflate, and one back
+	connect_deflate(&c);
+	char msg[512];
+	size_t len = sample_message(msg, sizeof(msg));
+	uint8_t out[1024];
+	if (ws_server_send_text_all(msg, len) != 1 || !next_frame(&c, &frame) || frame.opcode != WS_OP_TEXT
+		|| ((uint8_t)frame.data[-2 - (frame.len >= 126 ? 2 : 0)] & 0x40) == 0 || frame.len >= len
+		|| ws_inflate((uint8_t *)frame.data, frame.len, out, sizeof(out)) != (int)len || memcmp(out, msg, len) != 0) {
+		test_fail("compressed message", frame.len);
+	}
+	static WS_DEFLATE_t z;
+	int zlen = ws_deflate(&z, (const uint8_t *)msg, len, out, sizeof(out));
+	uint8_t wire[1024];
+	size_t wire_len = client_frame(wire, 0xc1, out, zlen);
+	uint64_t before_rx = received;
+	echo = true;
+	if (send(c.fd, wire, wire_len, 0) != (ssize_t)wire_len) test_fail("send compressed", 0);
+	wait_for(&received, before_rx + 1);
+	echo = false;
+	if (!next_frame(&c, &frame) || ws_inflate((uint8_t *)frame.data, frame.len, out, sizeof(out)) != (int)len) test_fail("compressed echo", frame.len);
+
+	// the close handshake
+	before = disconnects;
+	ws_client_send(&c, WS_OP_CLOSE, "\x03\xe8", 2);
+	if (!next_frame(&c, &frame) || frame.opcode != WS_OP_CLOSE || frame.len != 2 || frame.data[1] != (char)0xe8) test_fail("close echo", frame.opcode);
+	while (disconnects == before) sched_yield();
+	if (last_event != WEBSOCKET_DISCONNECT_EXTERNAL) test_fail("close event", last_event);
+	close(c.fd);
+	free(c.buf);
+	if (ws_server_len_all() != 0) test_fail("clients left", ws_server_len_all());
+}
@@ -0,0 +1,358 @@
+/*
+	 Aggregator of the sample streams of many boards into one archive.
+
+	 Registers itself with every board given over its websocket with
+	 "U address port codec", like udprecv, takes the UDP streams of all of
+	 them on one port, puts the blocks of every board and channel back in
+	 order (ingest.h) and appends them to an archive (archive.h) that
+	 archquery reads. Boards that stream to the port without being given
+	 are taken too. A board that goes away is asked again every 5 s.
+
+	 With -m the datagrams also come from an MQTT broker, on the topics
+	 ioto/<IPv4 address of the board>/stream (ingest.h); the connection is
+	 made again every 5 s when it is lost.
+
+	 usage: aggregator [-l udp_port] [-o archive] [-b host[:port]]... [-m broker[:port]] [-a address] [-c codec] [-d seconds] [-r report_ms] [-s]
+
+	 -l  UDP port to listen on, default 7000
+	 -o  archive, default ioto.archive (and ioto.archive.idx)
+	 -b  websocket of a board, port 80 when left out; up to 64 of them
+	 -m  MQTT broker to subscribe to the streams on, port 1883 when left out
+	 -a  address the boards send to, default the local address of each websocket
+	 -c  1 packed, 2 delta, 3 rice (main/codec.h), default 3
+	 -d  duration in seconds, default until SIGINT or SIGTERM
+	 -r  loss report to the boards and archive write interval, default 1000 ms
+	 -s  on the disk (fdatasync) at every report, not only written
+
+	 Every 10 s a line of counts goes to stderr, the totals to stdout as one
+	 JSON object at the end.
+*/
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "mqtt_client.h"
+
+#include "codec.h"
+#include "ingest.h"
+#include "protocol.h"
+#include "wsclient.h"
+
+#define MAX_LINKS 64
+#define RETRY_NS 5000000000LL
+#define TICK_NS 100000000LL
+#define STATUS_NS 10000000000LL
+#define MQTT_BUFFER 2048	// a datagram in one MQTT_EVENT_DATA
+
+typedef struct {
+	char host[128];
+	int port;
+	WS_CLIENT_t ws;
+	bool connected;
+	uint32_t addr;			// of the board as the datagrams come from it
+	int64_t retry_ns;
+} LINK_t;
+
+static struct {
+	int udp_port;
+	const char *output;
+	const char *broker;
+	const char *address;
+	int codec;
+	double duration;
+	int report_ms;
+	bool durable;
+} opt = {
+	.udp_port = 7000,
+	.output = "ioto.archive",
+	.codec = CODEC_RICE,
+	.report_ms = 1000,
+};
+
+static LINK_t links[MAX_LINKS];
+static int nlinks;
+static ARCHIVE_t archive;
+static INGEST_t ingest;
+static pthread_mutex_t ingest_lock = PTHREAD_MUTEX_INITIALIZER;	// the MQTT task and the loop
+static esp_mqtt_client_handle_t mqtt;
+static volatile bool mqtt_up;
+static int64_t mqtt_retry_ns;
+static uint64_t mqtt_parts;		// messages longer than MQTT_BUFFER, left out
+static volatile sig_atomic_t stop;
+
+static int64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// archive time
+static int64_t wall_us(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (int64_t)ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+static void on_signal(int sig)
+{
+	stop = 1;
+}
+
+static void send_text(LINK_t *l, const char *text)
+{
+	if (ws_client_send_text(&l->ws, text, strlen(text)) != 0) fprintf(stderr, "%s: cannot send \"%s\"\n", l->host, text);
+}
+
+static void link_connect(LINK_t *l, uint16_t udp_port)
+{
+	if (ws_client_connect(&l->ws, l->host, l->port, "/") != 0) {
+		fprintf(stderr, "%s:%d: cannot connect, again in %lld s\n", l->host, l->port, RETRY_NS / 1000000000LL);
+		l->retry_ns = now_ns() + RETRY_NS;
+		return;
+	}
+	// by default the board sends to the address it sees the websocket coming from
+	struct sockaddr_in local, peer;
+	socklen_t local_len = sizeof(local), peer_len = sizeof(peer);
+	getsockname(l->ws.fd, (struct sockaddr *)&local, &local_len);
+	getpeername(l->ws.fd, (struct sockaddr *)&peer, &peer_len);
+	l->addr = ntohl(peer.sin_addr.s_addr);
+	char text[80];
+	snprintf(text, sizeof(text), "U %s %d %d", opt.address ? opt.address : inet_ntoa(local.sin_addr), udp_port, opt.codec);
+	fprintf(stderr, "%s:%d: asking for %s\n", l->host, l->port, text + 2);
+	send_text(l, text);
+	l->connected = true;
+}
+
+static void link_read(LINK_t *l)
+{
+	WS_FRAME_t frame;
+	if (ws_client_fill(&l->ws) < 0) {
+		fprintf(stderr, "%s:%d: websocket closed, again in %lld s\n", l->host, l->port, RETRY_NS / 1000000000LL);
+		ws_client_close(&l->ws);
+		l->connected = false;
+		l->retry_ns = now_ns() + RETRY_NS;
+		return;
+	}
+	while (ws_client_next_frame(&l->ws, &frame) > 0) {
+		if (frame.opcode != WS_OP_TEXT || frame.len < 3 || memcmp(frame.data, "UD\4", 3) != 0) continue;
+		for (size_t i = 0; i < frame.len; i++) {
+			if (frame.data[i] == PROTOCOL_DEL) frame.data[i] = ' ';
+		}
+		fprintf(stderr, "%s:%d: %.*s\n", l->host, l->port, (int)frame.len, frame.data);
+	}
+}
+
+static esp_err_t mqtt_event(esp_mqtt_event_handle_t event)
+{
+	switch (event->event_id) {
+		case MQTT_EVENT_CONNECTED:
+			fprintf(stderr, "%s: connected, subscribing to %s\n", opt.broker, INGEST_MQTT_TOPIC);
+			esp_mqtt_client_subscribe(event->client, INGEST_MQTT_TOPIC, 0);
+			mqtt_up = true;
+			break;
+		case MQTT_EVENT_DISCONNECTED:
+		case MQTT_EVENT_ERROR:
+			mqtt_up = false;
+			break;
+		case MQTT_EVENT_DATA:
+			pthread_mutex_lock(&ingest_lock);
+			if (event->data_len != event->total_data_len) {
+				if (event->current_data_offset == 0) mqtt_parts++;
+			} else {
+				ingest_mqtt(&ingest, event->topic, event->topic_len, (const uint8_t *)event->data, event->data_len, wall_us());
+			}
+			pthread_mutex_unlock(&ingest_lock);
+			break;
+		default:
+			break;
+	}
+	return ESP_OK;
+}
+
+static void mqtt_connect(void)
+{
+	if (mqtt == NULL) {
+		esp_mqtt_client_config_t config = {
+			.event_handle = mqtt_event,
+			.uri = opt.broker,
+			.client_id = "ioto-aggregator",
+			.buffer_size = MQTT_BUFFER,
+		};
+		mqtt = esp_mqtt_client_init(&config);
+		if (mqtt == NULL) return;
+	}
+	esp_mqtt_client_stop(mqtt);
+	esp_mqtt_client_start(mqtt);
+	mqtt_retry_ns = now_ns() + RETRY_NS;
+}
+
+static void report(void)
+{
+	char text[80];
+	for (int i = 0; i < nlinks; i++) {
+		INGEST_BOARD_t *b = links[i].connected ? ingest_board(&ingest, links[i].addr) : NULL;
+		if (b == NULL) continue;
+		snprintf(text, sizeof(text), "L %llu %llu %llu", (unsigned long long)b->datagrams,
+			(unsigned long long)b->lost, (unsigned long long)b->reordered);
+		send_text(&links[i], text);
+	}
+	if (archive_sync(&archive, opt.durable) != 0) perror(opt.output);
+}
+
+static void status(double seconds)
+{
+	static INGEST_STATS_t last;
+	const INGEST_STATS_t *s = &ingest.stats;
+	fprintf(stderr, "%d boards, %d series, %.0f datagrams/s, %.0f samples/s, %llu gaps, %llu late, %.2f MB archived\n",
+		ingest.boards, ingest.series, (s->datagrams - last.datagrams) / seconds, (s->samples - last.samples) / seconds,
+		(unsigned long long)s->gaps, (unsigned long long)s->late, archive.bytes / 1e6);
+	last = *s;
+}
+
+int main(int argc, char **argv)
+{
+	int o;
+	while ((o = getopt(argc, argv, "l:o:b:m:a:c:d:r:s")) != -1) {
+		switch (o) {
+			case 'l': opt.udp_port = atoi(optarg); break;
+			case 'o': opt.output = optarg; break;
+			case 'b': {
+				if (nlinks == MAX_LINKS) {
+					fprintf(stderr, "%d boards at most\n", MAX_LINKS);
+					return 2;
+				}
+				LINK_t *l = &links[nlinks++];
+				snprintf(l->host, sizeof(l->host), "%s", optarg);
+				char *colon = strchr(l->host, ':');
+				l->port = colon ? atoi(colon + 1) : 80;
+				if (colon) *colon = 0;
+				break;
+			}
+			case 'm': opt.broker = optarg; break;
+			case 'a': opt.address = optarg; break;
+			case 'c': opt.codec = atoi(optarg); break;
+			case 'd': opt.duration = atof(optarg); break;
+			case 'r': opt.report_ms = atoi(optarg); break;
+			case 's': opt.durable = true; break;
+			default:
+				fprintf(stderr, "usage: %s [-l udp_port] [-o archive] [-b host[:port]]... [-m broker[:port]] [-a address] [-c codec] [-d seconds] [-r report_ms] [-s]\n", argv[0]);
+				return 2;
+		}
+	}
+	if (opt.codec <= CODEC_TEXT || opt.codec >= CODEC_MAX || opt.report_ms <= 0) return 2;
+
+	int fd = socket(AF_INET, SOCK_DGRAM, 0);
+	struct sockaddr_in sin = { .sin_family = AF_INET, .sin_port = htons(opt.udp_port), .sin_addr.s_addr = htonl(INADDR_ANY) };
+	int size = 8 << 20;
+	setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+	if (bind(fd, (struct sockaddr *)&sin, sizeof(sin)) < 0) {
+		perror("bind");
+		return 1;
+	}
+	socklen_t sin_len = sizeof(sin);
+	getsockname(fd, (struct sockaddr *)&sin, &sin_len);
+
+	if (archive_open(&archive, opt.output, true) != 0) {
+		perror(opt.output);
+		return 1;
+	}
+	if (archive.dropped) fprintf(stderr, "%s: %llu bytes left by a crash dropped\n", opt.output, (unsigned long long)archive.dropped);
+	fprintf(stderr, "%s: %llu chunks, listening on UDP port %d\n", opt.output, (unsigned long long)archive.entries,
+		ntohs(sin.sin_port));
+	ingest_init(&ingest, &archive);
+
+	struct sigaction sa = { .sa_handler = on_signal };
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	signal(SIGPIPE, SIG_IGN);
+
+	int64_t start = now_ns();
+	int64_t end = opt.duration > 0 ? start + (int64_t)(opt.duration * 1e9) : INT64_MAX;
+	int64_t next_tick = start + TICK_NS;
+	int64_t next_report = start + opt.report_ms * 1000000LL;
+	int64_t next_status = start + STATUS_NS;
+	struct pollfd pfd[1 + MAX_LINKS];
+	for (int64_t now = start; !stop && now < end; now = now_ns()) {
+		for (int i = 0; i < nlinks; i++) {
+			if (!links[i].connected && now >= links[i].retry_ns) link_connect(&links[i], ntohs(sin.sin_port));
+		}
+		if (opt.broker && !mqtt_up && now >= mqtt_retry_ns) mqtt_connect();
+		pfd[0] = (struct pollfd) { .fd = fd, .events = POLLIN };
+		for (int i = 0; i < nlinks; i++) {
+			pfd[1 + i] = (struct pollfd) { .fd = links[i].connected ? links[i].ws.fd : -1, .events = POLLIN };
+		}
+		int64_t next = next_tick < end ? next_tick : end;
+		int wait_ms = next > now ? (int)((next - now + 999999) / 1000000) : 0;
+		if (poll(pfd, 1 + nlinks, wait_ms) < 0 && errno != EINTR) break;
+		pthread_mutex_lock(&ingest_lock);
+		if (pfd[0].revents & POLLIN) {
+			if (ingest_receive(&ingest, fd, wall_us()) < 0) perror("recvmmsg");
+		}
+		for (int i = 0; i < nlinks; i++) {
+			if (links[i].connected && (pfd[1 + i].revents & (POLLIN | POLLHUP))) link_read(&links[i]);
+		}
+		now = now_ns();
+		if (now >= next_tick) {
+			ingest_tick(&ingest, wall_us());
+			next_tick = now + TICK_NS;
+		}
+		if (now >= next_report) {
+			report();
+			next_report += opt.report_ms * 1000000LL;
+		}
+		if (now >= next_status) {
+			status((now - next_status + STATUS_NS) / 1e9);
+			next_status = now + STATUS_NS;
+		}
+		pthread_mutex_unlock(&ingest_lock);
+	}
+	if (mqtt) esp_mqtt_client_destroy(mqtt);
+
+	for (int i = 0; i < nlinks; i++) {
+		if (!links[i].connected) continue;
+		send_text(&links[i], "U 0");
+	}
+	usleep(100000);		// a moment for the commands to get out before the close
+	for (int i = 0; i < nlinks; i++) {
+		if (links[i].connected) ws_client_close(&links[i].ws);
+	}
+	ingest_flush(&ingest);
+	if (archive_close(&archive) != 0) perror(opt.output);
+	close(fd);
+
+	const INGEST_STATS_t *s = &ingest.stats;
+	double span_s = (now_ns() - start) / 1e9;
+	uint64_t lost = 0, reordered = 0;
+	for (int i = 0; i < ingest.boards; i++) {
+		lost += ingest.board[i].lost;
+		reordered += ingest.board[i].reordered;
+	}
+	printf("{\"archive\":\"%s\",\"udp_port\":%d,\"boards\":%d,\"series\":%d,\"seconds\":%.1f,", opt.output,
+		ntohs(sin.sin_port), ingest.boards, ingest.series, span_s);
+	printf("\"mqtt_parts\":%llu,", (unsigned long long)mqtt_parts);
+	printf("\"datagrams\":%llu,\"lost\":%llu,\"reordered\":%llu,\"bad\":%llu,\"refused\":%llu,"
+		"\"blocks\":%llu,\"gaps\":%llu,\"late\":%llu,\"duplicates\":%llu,\"samples\":%llu,\"samples_per_s\":%.1f,"
+		"\"chunks\":%llu,\"archive_bytes\":%llu,\"bytes_per_sample\":%.3f,\"errors\":%llu}\n",
+		(unsigned long long)s->datagrams, (unsigned long long)lost, (unsigned long long)reordered,
+		(unsigned long long)s->bad, (unsigned long long)s->refused, (unsigned long long)s->blocks,
+		(unsigned long long)s->gaps, (unsigned long long)s->late, (unsigned long long)s->duplicates,
+		(unsigned long long)s->samples, span_s > 0 ? s->samples / span_s : 0.0,
+		(unsigned long long)archive.chunks, (unsigned long long)archive.bytes,
+		archive.samples ? (double)archive.bytes / archive.samples : 0.0, (unsigned long long)s->errors);
+	ingest_free(&ingest);
+	return s->errors ? 1 : 0;
+}
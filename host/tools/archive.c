@@ -0,0 +1,517 @@
+/*
+	 Append-only archive of sample streams, see archive.h
+*/
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "archive.h"
+
+#define INDEX_BUF (1024 * ARCHIVE_ENTRY_SIZE)
+
+/*
+	 Little endian, varints, crc32
+*/
+
+static void put_u32(uint8_t *p, uint32_t v)
+{
+	for (int i = 0; i < 4; i++) p[i] = v >> (8 * i);
+}
+
+static void put_u64(uint8_t *p, uint64_t v)
+{
+	for (int i = 0; i < 8; i++) p[i] = v >> (8 * i);
+}
+
+static void put_f32(uint8_t *p, float f)
+{
+	uint32_t v;
+	memcpy(&v, &f, 4);
+	put_u32(p, v);
+}
+
+static uint32_t get_u32(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint64_t get_u64(const uint8_t *p)
+{
+	return get_u32(p) | (uint64_t)get_u32(p + 4) << 32;
+}
+
+static float get_f32(const uint8_t *p)
+{
+	uint32_t v = get_u32(p);
+	float f;
+	memcpy(&f, &v, 4);
+	return f;
+}
+
+static size_t put_varint(uint8_t *p, uint64_t v)
+{
+	size_t n = 0;
+	while (v >= 0x80) {
+		p[n++] = v | 0x80;
+		v >>= 7;
+	}
+	p[n++] = v;
+	return n;
+}
+
+// false when the varint runs past end or over 64 bits
+static bool get_varint(const uint8_t **p, const uint8_t *end, uint64_t *v)
+{
+	*v = 0;
+	for (int shift = 0; shift < 64 && *p < end; shift += 7) {
+		uint8_t byte = *(*p)++;
+		*v |= (uint64_t)(byte & 0x7f) << shift;
+		if ((byte & 0x80) == 0) return true;
+	}
+	return false;
+}
+
+static uint64_t zigzag(int64_t v)
+{
+	return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static int64_t unzigzag(uint64_t v)
+{
+	return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+static uint32_t crc32(const uint8_t *p, size_t len)
+{
+	static uint32_t table[256];
+	if (table[1] == 0) {
+		for (uint32_t i = 0; i < 256; i++) {
+			uint32_t c = i;
+			for (int k = 0; k < 8; k++) c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+			table[i] = c;
+		}
+	}
+	uint32_t crc = 0xffffffffu;
+	while (len--) crc = table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+	return crc ^ 0xffffffffu;
+}
+
+/*
+	 Files
+*/
+
+static int write_all(int fd, const uint8_t *buf, size_t len)
+{
+	while (len > 0) {
+		ssize_t n = write(fd, buf, len);
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) return -1;
+		buf += n;
+		len -= n;
+	}
+	return 0;
+}
+
+// the chunks before their entries: an entry on disk always has its chunk
+static int write_buffers(ARCHIVE_t *a)
+{
+	if (a->data_len > 0) {
+		if (write_all(a->data, a->data_buf, a->data_len) != 0) return -1;
+		a->data_len = 0;
+	}
+	if (a->index_len > 0) {
+		if (write_all(a->index, a->index_buf, a->index_len) != 0) return -1;
+		a->index_len = 0;
+	}
+	return 0;
+}
+
+static void parse_entry(const uint8_t *p, ARCHIVE_ENTRY_t *e)
+{
+	e->offset = get_u64(p);
+	e->len = get_u32(p + 8);
+	e->board = get_u32(p + 12);
+	e->channel = p[16];
+	e->samples = get_u32(p + 20);
+	e->t0_us = (int64_t)get_u64(p + 24);
+	e->t1_us = (int64_t)get_u64(p + 32);
+	e->t_end_us = (int64_t)get_u64(p + 40);
+	e->lag_us = (int64_t)get_u64(p + 48);
+}
+
+int archive_entry(ARCHIVE_t *a, uint64_t i, ARCHIVE_ENTRY_t *e)
+{
+	if (i >= a->entries) return -1;
+	uint64_t on_disk = a->entries - a->index_len / ARCHIVE_ENTRY_SIZE;
+	if (i >= on_disk) {
+		parse_entry(a->index_buf + (i - on_disk) * ARCHIVE_ENTRY_SIZE, e);
+		return 0;
+	}
+	if (i < a->cache_first || i >= a->cache_first + a->cache_count) {
+		uint64_t count = on_disk - i < ARCHIVE_ENTRY_CACHE ? on_disk - i : ARCHIVE_ENTRY_CACHE;
+		ssize_t len = pread(a->index, a->cache, count * ARCHIVE_ENTRY_SIZE, i * ARCHIVE_ENTRY_SIZE);
+		if (len < ARCHIVE_ENTRY_SIZE) {
+			a->cache_count = 0;
+			return -1;
+		}
+		a->cache_first = i;
+		a->cache_count = len / ARCHIVE_ENTRY_SIZE;
+	}
+	parse_entry(a->cache + (i - a->cache_first) * ARCHIVE_ENTRY_SIZE, e);
+	return 0;
+}
+
+int archive_open(ARCHIVE_t *a, const char *path, bool write)
+{
+	memset(a, 0, sizeof(*a));
+	a->data = a->index = -1;
+	a->write = write;
+	a->t_end_us = INT64_MIN;
+	char index_path[PATH_MAX];
+	if (snprintf(index_path, sizeof(index_path), "%s.idx", path) >= (int)sizeof(index_path)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	int flags = write ? O_RDWR | O_CREAT : O_RDONLY;
+	a->data = open(path, flags | O_CLOEXEC, 0644);
+	a->index = a->data < 0 ? -1 : open(index_path, flags | O_CLOEXEC, 0644);
+	a->chunk = malloc(ARCHIVE_MAX_CHUNK);
+	a->cache = malloc(ARCHIVE_ENTRY_CACHE * ARCHIVE_ENTRY_SIZE);
+	if (write) {
+		a->data_buf = malloc(ARCHIVE_WRITE_BUF);
+		a->index_buf = malloc(INDEX_BUF);
+	}
+	struct stat data_st, index_st;
+	if (a->index < 0 || a->chunk == NULL || a->cache == NULL || (write && (a->data_buf == NULL || a->index_buf == NULL))
+			|| fstat(a->data, &data_st) != 0 || fstat(a->index, &index_st) != 0) {
+		int err = a->index >= 0 ? ENOMEM : errno;
+		archive_close(a);
+		errno = err;
+		return -1;
+	}
+
+	// what a crash left: an entry cut short, entries of chunks cut short, data after the last entry
+	a->entries = index_st.st_size / ARCHIVE_ENTRY_SIZE;
+	ARCHIVE_ENTRY_t e;
+	uint64_t end = 0;
+	while (a->entries > 0) {
+		if (archive_entry(a, a->entries - 1, &e) != 0) {
+			int err = errno;
+			archive_close(a);
+			errno = err;
+			return -1;
+		}
+		if (e.offset + e.len <= (uint64_t)data_st.st_size) {
+			end = e.offset + e.len;
+			a->t_end_us = e.t_end_us;
+			a->lag_us = e.lag_us;
+			break;
+		}
+		a->entries--;
+	}
+	a->dropped = data_st.st_size - end + index_st.st_size - a->entries * ARCHIVE_ENTRY_SIZE;
+	a->data_size = end;
+	if (write && (ftruncate(a->index, a->entries * ARCHIVE_ENTRY_SIZE) != 0 || ftruncate(a->data, end) != 0
+			|| lseek(a->index, 0, SEEK_END) < 0 || lseek(a->data, 0, SEEK_END) < 0)) {
+		int err = errno;
+		archive_close(a);
+		errno = err;
+		return -1;
+	}
+	return 0;
+}
+
+int archive_close(ARCHIVE_t *a)
+{
+	int ret = 0;
+	if (a->write && a->data >= 0 && a->index >= 0) ret = write_buffers(a);
+	if (a->data >= 0) close(a->data);
+	if (a->index >= 0) close(a->index);
+	free(a->data_buf);
+	free(a->index_buf);
+	free(a->chunk);
+	free(a->cache);
+	a->data = a->index = -1;
+	a->data_buf = a->index_buf = a->chunk = a->cache = NULL;
+	return ret;
+}
+
+int archive_sync(ARCHIVE_t *a, bool durable)
+{
+	if (write_buffers(a) != 0) return -1;
+	if (durable && (fdatasync(a->data) != 0 || fdatasync(a->index) != 0)) return -1;
+	return 0;
+}
+
+/*
+	 Writing
+*/
+
+void archive_series_init(ARCHIVE_SERIES_t *s, uint32_t board, uint8_t channel)
+{
+	s->board = board;
+	s->channel = channel;
+	s->blocks = 0;
+	s->samples = 0;
+	s->block_len = 0;
+}
+
+int archive_add(ARCHIVE_t *a, ARCHIVE_SERIES_t *s, const STREAM_FRAME_t *frame, const uint16_t *raw, int count,
+	int64_t offset_us)
+{
+	if (count <= 0 || count > ARCHIVE_CHUNK_SAMPLES || frame->bits == 0 || frame->bits > CODEC_MAX_BITS) {
+		errno = EINVAL;
+		return -1;
+	}
+	// a block before the last one is a new stream, the board restarted
+	if (s->samples > 0 && (frame->bits != s->bits || frame->period_us != s->period_us
+			|| frame->mv_per_lsb != s->mv_per_lsb || frame->offset_mv != s->offset_mv
+			|| s->samples + count > ARCHIVE_CHUNK_SAMPLES || s->blocks == ARCHIVE_CHUNK_BLOCKS
+			|| (int32_t)(frame->seq - s->seq) <= 0)) {
+		if (archive_flush(a, s) != 0) return -1;
+	}
+	uint8_t *p = s->block_col + s->block_len;
+	if (s->samples == 0) {
+		s->bits = frame->bits;
+		s->period_us = frame->period_us;
+		s->mv_per_lsb = frame->mv_per_lsb;
+		s->offset_mv = frame->offset_mv;
+		s->offset_us = offset_us;
+		s->t0_us = frame->t0_us;
+		p += put_varint(p, frame->seq);
+		p += put_varint(p, zigzag(frame->t0_us));
+	} else {
+		p += put_varint(p, frame->seq - s->seq);
+		p += put_varint(p, zigzag(frame->t0_us - s->t1_us));
+	}
+	p += put_varint(p, count);
+	s->block_len = p - s->block_col;
+	memcpy(s->raw + s->samples, raw, count * sizeof(raw[0]));
+	s->seq = frame->seq;
+	s->t1_us = frame->t0_us + (int64_t)count * frame->period_us;
+	s->blocks++;
+	s->samples += count;
+	return 0;
+}
+
+int archive_flush(ARCHIVE_t *a, ARCHIVE_SERIES_t *s)
+{
+	if (s->samples == 0) return 0;
+	uint8_t *c = a->chunk;
+	uint8_t *p = c + ARCHIVE_CHUNK_HEADER_SIZE;
+	memcpy(p, s->block_col, s->block_len);
+	p += s->block_len;
+	for (int i = 0; i < s->samples; i += ARCHIVE_PIECE) {
+		int count = s->samples - i < ARCHIVE_PIECE ? s->samples - i : ARCHIVE_PIECE;
+		int len = codec_encode(CODEC_RICE, s->raw + i, count, s->bits, p + 2, c + ARCHIVE_MAX_CHUNK - p - 2);
+		if (len < 0) {
+			errno = EINVAL;
+			return -1;
+		}
+		p[0] = len;
+		p[1] = len >> 8;
+		p += 2 + len;
+	}
+	uint32_t len = p - c;
+	uint32_t sample_bytes = len - ARCHIVE_CHUNK_HEADER_SIZE - s->block_len;
+	int64_t t0_us = s->t0_us + s->offset_us;
+	int64_t t1_us = s->t1_us + s->offset_us;
+
+	put_u32(c, ARCHIVE_MAGIC);
+	put_u32(c + 4, s->board);
+	c[8] = s->channel;
+	c[9] = s->bits;
+	c[10] = s->blocks;
+	c[11] = s->blocks >> 8;
+	put_u32(c + 12, s->samples);
+	put_u32(c + 16, s->period_us);
+	put_f32(c + 20, s->mv_per_lsb);
+	put_f32(c + 24, s->offset_mv);
+	put_u64(c + 28, t0_us);
+	put_u64(c + 36, s->offset_us);
+	put_u32(c + 44, s->block_len);
+	put_u32(c + 48, sample_bytes);
+	put_u32(c + 52, crc32(c + ARCHIVE_CHUNK_HEADER_SIZE, s->block_len + sample_bytes));
+
+	if (a->data_len + len > ARCHIVE_WRITE_BUF && write_buffers(a) != 0) return -1;
+	memcpy(a->data_buf + a->data_len, c, len);
+	a->data_len += len;
+
+	if (a->entries > 0 && a->t_end_us - t0_us > a->lag_us) a->lag_us = a->t_end_us - t0_us;
+	if (t1_us > a->t_end_us) a->t_end_us = t1_us;
+	if (a->index_len + ARCHIVE_ENTRY_SIZE > INDEX_BUF && write_buffers(a) != 0) return -1;
+	uint8_t *e = a->index_buf + a->index_len;
+	memset(e, 0, ARCHIVE_ENTRY_SIZE);
+	put_u64(e, a->data_size);
+	put_u32(e + 8, len);
+	put_u32(e + 12, s->board);
+	e[16] = s->channel;
+	put_u32(e + 20, s->samples);
+	put_u64(e + 24, t0_us);
+	put_u64(e + 32, t1_us);
+	put_u64(e + 40, a->t_end_us);
+	put_u64(e + 48, a->lag_us);
+	a->index_len += ARCHIVE_ENTRY_SIZE;
+
+	a->data_size += len;
+	a->entries++;
+	a->chunks++;
+	a->samples += s->samples;
+	a->bytes += len + ARCHIVE_ENTRY_SIZE;
+	archive_series_init(s, s->board, s->channel);
+	return 0;
+}
+
+/*
+	 Reading
+*/
+
+uint64_t archive_find(ARCHIVE_t *a, int64_t from_us)
+{
+	uint64_t lo = 0, hi = a->entries;
+	ARCHIVE_ENTRY_t e;
+	while (lo < hi) {
+		uint64_t mid = lo + (hi - lo) / 2;
+		if (archive_entry(a, mid, &e) != 0) return a->entries;
+		if (e.t_end_us > from_us) {
+			hi = mid;
+		} else {
+			lo = mid + 1;
+		}
+	}
+	return lo;
+}
+
+// reads the chunk of e and calls fn for its blocks in [from_us, to_us), -1 when it is damaged
+static int read_chunk(ARCHIVE_t *a, const ARCHIVE_ENTRY_t *e, int64_t from_us, int64_t to_us,
+	void (*fn)(const ARCHIVE_BLOCK_t *block, void *arg), void *arg)
+{
+	uint8_t *c = a->chunk;
+	if (e->len < ARCHIVE_CHUNK_HEADER_SIZE || e->len > ARCHIVE_MAX_CHUNK) return -1;
+	uint64_t on_disk = a->data_size - a->data_len;
+	if (e->offset >= on_disk) {
+		memcpy(c, a->data_buf + (e->offset - on_disk), e->len);
+	} else if (pread(a->data, c, e->len, e->offset) != (ssize_t)e->len) {
+		return -1;
+	}
+	uint32_t block_bytes = get_u32(c + 44), sample_bytes = get_u32(c + 48);
+	int blocks = c[10] | (c[11] << 8);
+	int samples = get_u32(c + 12);
+	if (get_u32(c) != ARCHIVE_MAGIC || (uint64_t)ARCHIVE_CHUNK_HEADER_SIZE + block_bytes + sample_bytes != e->len
+			|| samples > ARCHIVE_CHUNK_SAMPLES || blocks > ARCHIVE_CHUNK_BLOCKS
+			|| get_u32(c + 52) != crc32(c + ARCHIVE_CHUNK_HEADER_SIZE, block_bytes + sample_bytes)) {
+		return -1;
+	}
+
+	uint16_t raw[ARCHIVE_CHUNK_SAMPLES];
+	const uint8_t *p = c + ARCHIVE_CHUNK_HEADER_SIZE + block_bytes;
+	const uint8_t *end = p + sample_bytes;
+	int decoded = 0;
+	while (decoded < samples) {
+		if (end - p < 2) return -1;
+		size_t size = p[0] | (p[1] << 8);
+		p += 2;
+		if (size > (size_t)(end - p)) return -1;
+		int len = codec_decode(p, size, raw + decoded, samples - decoded);
+		if (len <= 0) return -1;
+		p += size;
+		decoded += len;
+	}
+
+	ARCHIVE_BLOCK_t block = {
+		.board = get_u32(c + 4),
+		.channel = c[8],
+		.bits = c[9],
+		.period_us = get_u32(c + 16),
+		.mv_per_lsb = get_f32(c + 20),
+		.offset_mv = get_f32(c + 24),
+	};
+	int64_t offset_us = (int64_t)get_u64(c + 36);
+	p = c + ARCHIVE_CHUNK_HEADER_SIZE;
+	end = p + block_bytes;
+	int64_t t_us = 0;
+	uint32_t seq = 0;
+	int at = 0;
+	for (int i = 0; i < blocks; i++) {
+		uint64_t dseq, dt, count;
+		if (!get_varint(&p, end, &dseq) || !get_varint(&p, end, &dt) || !get_varint(&p, end, &count)) return -1;
+		if (count > (uint64_t)(samples - at)) return -1;
+		seq = i == 0 ? dseq : seq + dseq;
+		t_us = i == 0 ? unzigzag(dt) : t_us + unzigzag(dt);
+		block.seq = seq;
+		// cut to the range
+		int64_t t0_us = t_us + offset_us;
+		int first = 0, last = count;
+		if (block.period_us > 0) {
+			if (from_us > t0_us) first = (from_us - t0_us + block.period_us - 1) / block.period_us;
+			if (to_us <= t0_us) {
+				last = 0;
+			} else if ((to_us - t0_us + block.period_us - 1) / block.period_us < last) {
+				last = (to_us - t0_us + block.period_us - 1) / block.period_us;
+			}
+		} else if (t0_us < from_us || t0_us >= to_us) {
+			last = 0;
+		}
+		if (first < last) {
+			block.t0_us = t0_us + (int64_t)first * block.period_us;
+			block.count = last - first;
+			block.raw = raw + at + first;
+			fn(&block, arg);
+		}
+		at += count;
+		t_us += (int64_t)count * block.period_us;
+	}
+	return at == samples ? 0 : -1;
+}
+
+int64_t archive_each_entry(ARCHIVE_t *a, uint32_t board, int channel, int64_t from_us, int64_t to_us,
+	int (*fn)(const ARCHIVE_ENTRY_t *e, void *arg), void *arg)
+{
+	int64_t count = 0;
+	ARCHIVE_ENTRY_t e;
+	uint64_t i = archive_find(a, from_us);
+	int64_t t_end_us = INT64_MIN;
+	if (i > 0 && i < a->entries) {
+		if (archive_entry(a, i - 1, &e) != 0) return -1;
+		t_end_us = e.t_end_us;
+	}
+	for (; i < a->entries; i++) {
+		// no entry from here on starts before to_us
+		if (t_end_us != INT64_MIN && t_end_us - a->lag_us >= to_us) break;
+		if (archive_entry(a, i, &e) != 0) return -1;
+		t_end_us = e.t_end_us;
+		if ((board && e.board != board) || (channel >= 0 && e.channel != channel)) continue;
+		if (e.t1_us <= from_us || e.t0_us >= to_us) continue;
+		if (fn(&e, arg) != 0) return -1;
+		count++;
+	}
+	return count;
+}
+
+typedef struct {
+	ARCHIVE_t *a;
+	int64_t from_us;
+	int64_t to_us;
+	void (*fn)(const ARCHIVE_BLOCK_t *block, void *arg);
+	void *arg;
+} QUERY_t;
+
+static int query_entry(const ARCHIVE_ENTRY_t *e, void *arg)
+{
+	QUERY_t *q = arg;
+	return read_chunk(q->a, e, q->from_us, q->to_us, q->fn, q->arg);
+}
+
+int64_t archive_query(ARCHIVE_t *a, uint32_t board, int channel, int64_t from_us, int64_t to_us,
+	void (*fn)(const ARCHIVE_BLOCK_t *block, void *arg), void *arg)
+{
+	QUERY_t q = { a, from_us, to_us, fn, arg };
+	return archive_each_entry(a, board, channel, from_us, to_us, query_entry, &q);
+}
@@ -0,0 +1,160 @@
+/*
+	 Append-only archive of sample streams, written by host/tools/aggregator
+	 and read by host/tools/archquery.
+
+	 Two files. <path> holds the chunks one after the other, <path>.idx one
+	 ARCHIVE_ENTRY_SIZE entry per chunk, written after its chunk: the time
+	 index. A chunk is a run of blocks of one series (board and channel)
+	 with the same bits, period and scale, up to ARCHIVE_CHUNK_SAMPLES
+	 samples, stored as two columns:
+
+	   blocks   per block varint seq - seq before (the first one: seq),
+	            zigzag varint t0 - end of the block before (the first one:
+	            t0), varint count; t0 in the time of the board
+	   samples  the raw readings of all the blocks, in codec blocks
+	            (main/codec.h, CODEC_RICE) of ARCHIVE_PIECE samples, each
+	            after its length as a u16
+
+	 A chunk starts with ARCHIVE_CHUNK_HEADER_SIZE bytes, little endian:
+	   u32 magic, u32 board, u8 channel, u8 bits, u16 blocks, u32 samples,
+	   u32 period_us, f32 mv_per_lsb, f32 offset_mv, i64 t0_us,
+	   i64 offset_us, u32 block bytes, u32 sample bytes, u32 crc32 of both
+	 t0_us is the archive time of the first sample, offset_us what is
+	 added to the time of the board to get it. Archive time is the wall
+	 clock of the aggregator in us since the epoch.
+
+	 An entry of the index, little endian:
+	   u64 offset of the chunk, u32 bytes, u32 board, u8 channel, 3 zero
+	   bytes, u32 samples, i64 t0_us, i64 t1_us (after the last sample),
+	   i64 t_end_us (the largest t1_us of this entry and all before it),
+	   i64 lag_us (the largest t_end_us before an entry minus its t0_us,
+	   of this entry and all before it)
+	 Chunks end up in the index in the order they were finished, not in
+	 the order of their time. t_end_us never goes down, a query finds its
+	 first entry by bisection; no entry starts more than the lag_us of the
+	 last one before the t_end_us of the entry before it, so the query
+	 stops at the first t_end_us that far after its range.
+
+	 Opening for writing drops what a crash left half written: index
+	 entries cut short or pointing past the data, and data past the last
+	 entry.
+*/
+
+#ifndef HOST_ARCHIVE_H_
+#define HOST_ARCHIVE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "codec.h"
+#include "protocol.h"
+
+#define ARCHIVE_MAGIC 0x41544f49u	// "IOTA"
+#define ARCHIVE_CHUNK_SAMPLES 4096
+#define ARCHIVE_CHUNK_BLOCKS 512
+#define ARCHIVE_PIECE 512
+#define ARCHIVE_CHUNK_HEADER_SIZE 56
+#define ARCHIVE_ENTRY_SIZE 56
+#define ARCHIVE_ENTRY_CACHE 256		// entries read at a time
+#define ARCHIVE_BLOCK_BYTES 17		// a block in the blocks column at most
+#define ARCHIVE_MAX_CHUNK (ARCHIVE_CHUNK_HEADER_SIZE + ARCHIVE_CHUNK_BLOCKS * ARCHIVE_BLOCK_BYTES \
+	+ ARCHIVE_CHUNK_SAMPLES / ARCHIVE_PIECE * (2 + CODEC_MAX_SIZE(ARCHIVE_PIECE)))
+#define ARCHIVE_WRITE_BUF (1 << 20)
+
+typedef struct {
+	uint64_t offset;
+	uint32_t len;
+	uint32_t board;			// IPv4 address of the board, host byte order
+	uint8_t channel;
+	uint32_t samples;
+	int64_t t0_us;
+	int64_t t1_us;
+	int64_t t_end_us;
+	int64_t lag_us;
+} ARCHIVE_ENTRY_t;
+
+// the chunk of a series being put together
+typedef struct {
+	uint32_t board;
+	uint8_t channel;
+	uint8_t bits;
+	uint32_t period_us;
+	float mv_per_lsb;
+	float offset_mv;
+	int64_t offset_us;
+	uint32_t seq;			// of the last block
+	int64_t t0_us;			// start of the first block, time of the board
+	int64_t t1_us;			// end of the last block
+	int blocks;
+	int samples;
+	size_t block_len;
+	uint8_t block_col[ARCHIVE_CHUNK_BLOCKS * ARCHIVE_BLOCK_BYTES];
+	uint16_t raw[ARCHIVE_CHUNK_SAMPLES];
+} ARCHIVE_SERIES_t;
+
+// a block read back, cut to the range of the query
+typedef struct {
+	uint32_t board;
+	uint8_t channel;
+	uint8_t bits;
+	uint32_t seq;
+	int64_t t0_us;			// archive time of raw[0]
+	uint32_t period_us;
+	float mv_per_lsb;
+	float offset_mv;
+	int count;
+	const uint16_t *raw;
+} ARCHIVE_BLOCK_t;
+
+typedef struct {
+	int data;
+	int index;
+	bool write;
+	uint64_t data_size;		// with what is still in the buffers
+	uint64_t entries;
+	int64_t t_end_us;
+	int64_t lag_us;
+	// written since the archive was opened
+	uint64_t chunks;
+	uint64_t samples;
+	uint64_t bytes;
+	uint64_t dropped;		// bytes a crash left, dropped when opening
+	uint8_t *data_buf;
+	size_t data_len;
+	uint8_t *index_buf;
+	size_t index_len;
+	uint8_t *chunk;			// ARCHIVE_MAX_CHUNK, the chunk being written or read
+	uint8_t *cache;			// ARCHIVE_ENTRY_CACHE entries of the index file from cache_first
+	uint64_t cache_first;
+	uint64_t cache_count;
+} ARCHIVE_t;
+
+// 0, or -1 with errno; write creates the files when they are not there
+int archive_open(ARCHIVE_t *a, const char *path, bool write);
+// writes what is buffered, -1 when that fails
+int archive_close(ARCHIVE_t *a);
+// writes what is buffered, and to the disk with durable
+int archive_sync(ARCHIVE_t *a, bool durable);
+
+void archive_series_init(ARCHIVE_SERIES_t *s, uint32_t board, uint8_t channel);
+// adds a block to the chunk of s, writing the chunk first when the block does not fit it;
+// offset_us turns the time of the board into archive time for a new chunk
+int archive_add(ARCHIVE_t *a, ARCHIVE_SERIES_t *s, const STREAM_FRAME_t *frame, const uint16_t *raw, int count,
+	int64_t offset_us);
+// writes the chunk of s, when it has samples
+int archive_flush(ARCHIVE_t *a, ARCHIVE_SERIES_t *s);
+
+int archive_entry(ARCHIVE_t *a, uint64_t i, ARCHIVE_ENTRY_t *e);
+// the first entry that can have samples at or after from_us
+uint64_t archive_find(ARCHIVE_t *a, int64_t from_us);
+// calls fn for the entries of the chunks of board (0 any) and channel (-1 any) with samples in
+// [from_us, to_us); returns their number, or -1 when the index cannot be read or fn returned non-zero
+int64_t archive_each_entry(ARCHIVE_t *a, uint32_t board, int channel, int64_t from_us, int64_t to_us,
+	int (*fn)(const ARCHIVE_ENTRY_t *e, void *arg), void *arg);
+// calls fn for the blocks of board (0 any) and channel (-1 any) in [from_us, to_us), in the
+// order of the index; returns the chunks read or -1 when one is damaged
+int64_t archive_query(ARCHIVE_t *a, uint32_t board, int channel, int64_t from_us, int64_t to_us,
+	void (*fn)(const ARCHIVE_BLOCK_t *block, void *arg), void *arg);
+
+#endif /* HOST_ARCHIVE_H_ */
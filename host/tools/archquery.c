@@ -0,0 +1,211 @@
+/*
+	 Reads the samples of a time range out of an archive of the aggregator
+	 (archive.h).
+
+	 usage: archquery [-b board] [-c channel] [-f from] [-t to] [-r] [-l] archive
+
+	 -b  IPv4 address of the board, default all of them
+	 -c  channel, default all of them
+	 -f  from, default the start of the archive
+	 -t  to (not included), default the end of the archive
+	 -r  the raw readings instead of mV
+	 -l  lists the series instead: board, channel, chunks, samples, first and
+	     last sample, archived bytes per sample
+
+	 A time is seconds since the epoch ("1760781600.25"), local time
+	 ("2026-10-18 12:00:00.25", or with a T), or seconds before the end of
+	 the archive when negative ("-60").
+
+	 The samples go to stdout as CSV: t_us,board,channel,mv (or raw), t_us in
+	 us since the epoch. The chunks read and the time it took go to stderr.
+*/
+
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+
+#include "archive.h"
+
+#define MAX_SERIES 4096
+
+typedef struct {
+	uint32_t board;
+	uint8_t channel;
+	uint64_t chunks;
+	uint64_t samples;
+	uint64_t bytes;
+	int64_t first_us;
+	int64_t last_us;
+} SERIES_t;
+
+static struct {
+	bool raw;
+	uint64_t samples;
+	char board[INET_ADDRSTRLEN];
+	uint32_t last_board;
+} out;
+
+static int64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static const char *board_name(uint32_t board, char *buf)
+{
+	struct in_addr in = { .s_addr = htonl(board) };
+	return inet_ntop(AF_INET, &in, buf, INET_ADDRSTRLEN);
+}
+
+static const char *time_name(int64_t t_us, char *buf, size_t size)
+{
+	time_t t = t_us / 1000000;
+	struct tm tm;
+	localtime_r(&t, &tm);
+	size_t len = strftime(buf, size, "%Y-%m-%d %H:%M:%S", &tm);
+	snprintf(buf + len, size - len, ".%06lld", (long long)(t_us % 1000000));
+	return buf;
+}
+
+// us since the epoch, end_us for what is relative to the end; false when it cannot be read
+static bool parse_time(const char *s, int64_t end_us, int64_t *t_us)
+{
+	char *rest;
+	double seconds = strtod(s, &rest);
+	if (*rest == 0 && rest != s) {
+		*t_us = seconds < 0 ? end_us + (int64_t)(seconds * 1e6) : (int64_t)(seconds * 1e6);
+		return true;
+	}
+	struct tm tm = { .tm_isdst = -1 };
+	rest = strptime(s, "%Y-%m-%d", &tm);
+	if (rest == NULL || (*rest != ' ' && *rest != 'T')) return false;
+	rest = strptime(rest + 1, "%H:%M:%S", &tm);
+	if (rest == NULL) return false;
+	double fraction = 0;
+	if (*rest == '.') fraction = strtod(rest, &rest);
+	if (*rest != 0) return false;
+	*t_us = (int64_t)mktime(&tm) * 1000000 + (int64_t)(fraction * 1e6);
+	return true;
+}
+
+static void print_block(const ARCHIVE_BLOCK_t *block, void *arg)
+{
+	if (block->board != out.last_board || out.board[0] == 0) {
+		board_name(block->board, out.board);
+		out.last_board = block->board;
+	}
+	for (int i = 0; i < block->count; i++) {
+		int64_t t_us = block->t0_us + (int64_t)i * block->period_us;
+		if (out.raw) {
+			printf("%lld,%s,%u,%u\n", (long long)t_us, out.board, block->channel, block->raw[i]);
+		} else {
+			printf("%lld,%s,%u,%.1f\n", (long long)t_us, out.board, block->channel,
+				block->offset_mv + block->raw[i] * block->mv_per_lsb);
+		}
+	}
+	out.samples += block->count;
+}
+
+static int add_entry(const ARCHIVE_ENTRY_t *e, void *arg)
+{
+	static int count;
+	SERIES_t *series = arg;
+	int s = 0;
+	while (s < count && (series[s].board != e->board || series[s].channel != e->channel)) s++;
+	if (s == count) {
+		if (count == MAX_SERIES) return 0;
+		series[count++] = (SERIES_t) { .board = e->board, .channel = e->channel, .first_us = e->t0_us, .last_us = e->t1_us };
+	}
+	SERIES_t *r = &series[s];
+	r->chunks++;
+	r->samples += e->samples;
+	r->bytes += e->len + ARCHIVE_ENTRY_SIZE;
+	if (e->t0_us < r->first_us) r->first_us = e->t0_us;
+	if (e->t1_us > r->last_us) r->last_us = e->t1_us;
+	return 0;
+}
+
+static int list(ARCHIVE_t *a, uint32_t board, int channel, int64_t from_us, int64_t to_us)
+{
+	static SERIES_t series[MAX_SERIES];
+	if (archive_each_entry(a, board, channel, from_us, to_us, add_entry, series) < 0) return 1;
+	printf("board,channel,chunks,samples,first,last,bytes_per_sample\n");
+	char name[INET_ADDRSTRLEN], first[40], last[40];
+	for (int s = 0; s < MAX_SERIES && series[s].chunks; s++) {
+		SERIES_t *r = &series[s];
+		printf("%s,%u,%llu,%llu,%s,%s,%.3f\n", board_name(r->board, name), r->channel,
+			(unsigned long long)r->chunks, (unsigned long long)r->samples, time_name(r->first_us, first, sizeof(first)),
+			time_name(r->last_us, last, sizeof(last)), r->samples ? (double)r->bytes / r->samples : 0.0);
+	}
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	const char *board_arg = NULL, *from_arg = NULL, *to_arg = NULL;
+	int channel = -1;
+	bool listing = false;
+	int o;
+	while ((o = getopt(argc, argv, "b:c:f:t:rl")) != -1) {
+		switch (o) {
+			case 'b': board_arg = optarg; break;
+			case 'c': channel = atoi(optarg); break;
+			case 'f': from_arg = optarg; break;
+			case 't': to_arg = optarg; break;
+			case 'r': out.raw = true; break;
+			case 'l': listing = true; break;
+			default:
+				fprintf(stderr, "usage: %s [-b board] [-c channel] [-f from] [-t to] [-r] [-l] archive\n", argv[0]);
+				return 2;
+		}
+	}
+	if (optind != argc - 1) {
+		fprintf(stderr, "usage: %s [-b board] [-c channel] [-f from] [-t to] [-r] [-l] archive\n", argv[0]);
+		return 2;
+	}
+	const char *path = argv[optind];
+	uint32_t board = 0;
+	struct in_addr in;
+	if (board_arg) {
+		if (inet_pton(AF_INET, board_arg, &in) != 1) {
+			fprintf(stderr, "%s: not an IPv4 address\n", board_arg);
+			return 2;
+		}
+		board = ntohl(in.s_addr);
+	}
+
+	ARCHIVE_t a;
+	if (archive_open(&a, path, false) != 0) {
+		perror(path);
+		return 1;
+	}
+	int64_t from_us = INT64_MIN, to_us = INT64_MAX;
+	if ((from_arg && !parse_time(from_arg, a.t_end_us, &from_us)) || (to_arg && !parse_time(to_arg, a.t_end_us, &to_us))) {
+		fprintf(stderr, "a time is seconds since the epoch, YYYY-MM-DD HH:MM:SS[.frac] or -seconds before the end\n");
+		archive_close(&a);
+		return 2;
+	}
+
+	int ret = 0;
+	if (listing) {
+		ret = list(&a, board, channel, from_us, to_us);
+	} else {
+		int64_t start = now_ns();
+		printf("t_us,board,channel,%s\n", out.raw ? "raw" : "mv");
+		int64_t chunks = archive_query(&a, board, channel, from_us, to_us, print_block, NULL);
+		if (chunks < 0) {
+			fprintf(stderr, "%s: a chunk is damaged\n", path);
+			ret = 1;
+		}
+		fprintf(stderr, "%lld of %llu chunks read, %llu samples in %.3f s\n", (long long)chunks,
+			(unsigned long long)a.entries, (unsigned long long)out.samples, (now_ns() - start) / 1e9);
+	}
+	archive_close(&a);
+	return ret;
+}
@@ -0,0 +1,67 @@
+/*
+	 Log-linear histogram, see hist.h
+*/
+
+#include <string.h>
+
+#include "hist.h"
+
+static int bucket_of(uint64_t v)
+{
+	if (v < 16) return (int)v;
+	int e = 63 - __builtin_clzll(v);	// 4 and up
+	return 16 * (e - 3) + (int)((v >> (e - 4)) & 15);
+}
+
+// middle of the values that fall in bucket i
+static uint64_t value_of(int i)
+{
+	if (i < 16) return i;
+	int e = i / 16 + 3;
+	uint64_t low = (16ULL + i % 16) << (e - 4);
+	return low + ((1ULL << (e - 4)) >> 1);
+}
+
+void hist_init(HIST_t *h)
+{
+	memset(h, 0, sizeof(HIST_t));
+}
+
+void hist_add(HIST_t *h, uint64_t value)
+{
+	int i = bucket_of(value);
+	if (i >= HIST_BUCKETS) i = HIST_BUCKETS - 1;
+	h->bucket[i]++;
+	h->count++;
+	h->sum += value;
+	if (value > h->max) h->max = value;
+}
+
+void hist_merge(HIST_t *dst, const HIST_t *src)
+{
+	for (int i = 0; i < HIST_BUCKETS; i++) dst->bucket[i] += src->bucket[i];
+	dst->count += src->count;
+	dst->sum += src->sum;
+	if (src->max > dst->max) dst->max = src->max;
+}
+
+uint64_t hist_percentile(const HIST_t *h, double percent)
+{
+	if (h->count == 0) return 0;
+	uint64_t rank = (uint64_t)(h->count * percent / 100.0);
+	if (rank >= h->count) rank = h->count - 1;
+	uint64_t seen = 0;
+	for (int i = 0; i < HIST_BUCKETS; i++) {
+		seen += h->bucket[i];
+		if (seen > rank) {
+			uint64_t v = value_of(i);
+			return v > h->max ? h->max : v;
+		}
+	}
+	return h->max;
+}
+
+double hist_mean(const HIST_t *h)
+{
+	return h->count ? (double)h->sum / h->count : 0;
+}
@@ -0,0 +1,26 @@
+/*
+	 Log-linear histogram of microsecond values for the host tools,
+	 16 buckets per power of two, so percentiles are within ~6%.
+*/
+
+#ifndef HOST_HIST_H_
+#define HOST_HIST_H_
+
+#include <stdint.h>
+
+#define HIST_BUCKETS (16 * 61)
+
+typedef struct {
+	uint64_t count;
+	uint64_t sum;
+	uint64_t max;
+	uint64_t bucket[HIST_BUCKETS];
+} HIST_t;
+
+void hist_init(HIST_t *h);
+void hist_add(HIST_t *h, uint64_t value);
+void hist_merge(HIST_t *dst, const HIST_t *src);
+uint64_t hist_percentile(const HIST_t *h, double percent);
+double hist_mean(const HIST_t *h);
+
+#endif /* HOST_HIST_H_ */
@@ -0,0 +1,307 @@
+/*
+	 Reassembly of the UDP sample streams, see ingest.h
+*/
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "udp_stream.h"
+#include "ingest.h"
+
+#define RESTART (16 * INGEST_WINDOW)	// a seq this far back is a new stream
+#define RESTART_DATAGRAMS 1024
+
+static uint32_t hash32(uint32_t x)
+{
+	x ^= x >> 16;
+	x *= 0x7feb352du;
+	x ^= x >> 15;
+	x *= 0x846ca68bu;
+	x ^= x >> 16;
+	return x;
+}
+
+void ingest_init(INGEST_t *in, ARCHIVE_t *archive)
+{
+	memset(in, 0, sizeof(*in));
+	in->archive = archive;
+}
+
+void ingest_free(INGEST_t *in)
+{
+	for (int i = 0; i < in->series; i++) free(in->series_list[i]);
+	ingest_init(in, in->archive);
+}
+
+INGEST_BOARD_t *ingest_board(INGEST_t *in, uint32_t addr)
+{
+	const uint32_t mask = 2 * INGEST_MAX_BOARDS - 1;
+	for (uint32_t h = hash32(addr) & mask;; h = (h + 1) & mask) {
+		INGEST_BOARD_t *b = in->board_table[h];
+		if (b == NULL || b->addr == addr) return b;
+	}
+}
+
+static INGEST_BOARD_t *get_board(INGEST_t *in, uint32_t addr)
+{
+	const uint32_t mask = 2 * INGEST_MAX_BOARDS - 1;
+	uint32_t h = hash32(addr) & mask;
+	for (; in->board_table[h]; h = (h + 1) & mask) {
+		if (in->board_table[h]->addr == addr) return in->board_table[h];
+	}
+	if (in->boards == INGEST_MAX_BOARDS) return NULL;
+	INGEST_BOARD_t *b = &in->board[in->boards++];
+	b->addr = addr;
+	in->board_table[h] = b;
+	return b;
+}
+
+static INGEST_SERIES_t *get_series(INGEST_t *in, uint32_t addr, uint8_t channel)
+{
+	const uint32_t mask = 2 * INGEST_MAX_SERIES - 1;
+	uint32_t h = hash32(addr ^ channel * 0x9e3779b9u) & mask;
+	for (; in->series_table[h]; h = (h + 1) & mask) {
+		INGEST_SERIES_t *s = in->series_table[h];
+		if (s->board->addr == addr && s->channel == channel) return s;
+	}
+	INGEST_BOARD_t *b = in->series == INGEST_MAX_SERIES ? NULL : get_board(in, addr);
+	INGEST_SERIES_t *s = b ? calloc(1, sizeof(INGEST_SERIES_t)) : NULL;
+	if (s == NULL) return NULL;
+	s->board = b;
+	s->channel = channel;
+	archive_series_init(&s->chunk, addr, channel);
+	in->series_table[h] = s;
+	in->series_list[in->series++] = s;
+	return s;
+}
+
+// the datagram numbers of the board, and the offset of its clock
+static void board_datagram(INGEST_BOARD_t *b, uint32_t number, int64_t end_us, int64_t now_us)
+{
+	if (!b->started || (int32_t)(number - b->expected) < -RESTART_DATAGRAMS) {
+		// the first one, or the stream started again: its clock may have too
+		b->started = true;
+		b->expected = number;
+		b->window_end_us = 0;
+	}
+	int32_t ahead = (int32_t)(number - b->expected);
+	if (ahead < 0) {
+		// counted as lost when the later ones came, it was only late
+		b->reordered++;
+		if (b->lost) b->lost--;
+	} else {
+		b->lost += ahead;
+		b->expected = number + 1;
+	}
+	b->datagrams++;
+
+	int64_t d = now_us - end_us;
+	if (b->window_end_us == 0) {
+		b->offset_us = b->window_min_us = d;
+		b->window_end_us = now_us + INGEST_OFFSET_WINDOW_US;
+		return;
+	}
+	if (d < b->window_min_us) b->window_min_us = d;
+	if (d < b->offset_us) b->offset_us = d;
+	if (now_us >= b->window_end_us) {
+		// the clock of the board may run slower than ours, the offset can grow too
+		b->offset_us = b->window_min_us;
+		b->window_min_us = d;
+		b->window_end_us = now_us + INGEST_OFFSET_WINDOW_US;
+	}
+}
+
+static void write_block(INGEST_t *in, INGEST_SERIES_t *s, INGEST_SLOT_t *slot, int64_t now_us)
+{
+	if (archive_add(in->archive, &s->chunk, &slot->frame, slot->raw, slot->count, s->board->offset_us) != 0) {
+		in->stats.errors++;
+	} else {
+		if (s->chunk.samples == slot->count) s->chunk_since_us = now_us;
+		in->stats.blocks++;
+		in->stats.samples += slot->count;
+	}
+	s->opening = false;
+	slot->present = false;
+	s->held--;
+}
+
+// writes the blocks in order from next, as far as they are in
+static void drain(INGEST_t *in, INGEST_SERIES_t *s, int64_t now_us)
+{
+	for (;;) {
+		INGEST_SLOT_t *slot = &s->slot[s->next % INGEST_WINDOW];
+		if (!slot->present || slot->frame.seq != s->next) break;
+		write_block(in, s, slot, now_us);
+		s->next++;
+	}
+	if (s->held == 0) {
+		s->wait_since_us = 0;
+	} else if (s->wait_since_us == 0) {
+		s->wait_since_us = now_us;
+	}
+}
+
+// gives up the blocks missing at next
+static void skip_gap(INGEST_t *in, INGEST_SERIES_t *s, int64_t now_us)
+{
+	while (s->held > 0 && !s->slot[s->next % INGEST_WINDOW].present) {
+		if (!s->opening) in->stats.gaps++;
+		s->next++;
+	}
+	s->wait_since_us = 0;
+	drain(in, s, now_us);
+}
+
+static void restart(INGEST_t *in, INGEST_SERIES_t *s, int64_t now_us)
+{
+	while (s->held > 0) skip_gap(in, s, now_us);
+	s->started = false;
+}
+
+void ingest_datagram(INGEST_t *in, uint32_t addr, const uint8_t *buf, size_t len, int64_t now_us)
+{
+	STREAM_FRAME_t frame;
+	in->stats.datagrams++;
+	in->stats.bytes += len;
+	int header = len > UDP_STREAM_HEADER_SIZE
+		? protocol_get_frame_header(buf + UDP_STREAM_HEADER_SIZE, len - UDP_STREAM_HEADER_SIZE, &frame) : -1;
+	if (header < 0 || frame.bits == 0 || frame.bits > CODEC_MAX_BITS) {
+		in->stats.bad++;
+		return;
+	}
+	const uint8_t *block = buf + UDP_STREAM_HEADER_SIZE + header;
+	size_t block_len = len - UDP_STREAM_HEADER_SIZE - header;
+	INGEST_SERIES_t *s = block_len < CODEC_HEADER_SIZE ? NULL : get_series(in, addr, frame.channel);
+	if (s == NULL) {
+		in->stats.refused += block_len >= CODEC_HEADER_SIZE;
+		in->stats.bad += block_len < CODEC_HEADER_SIZE;
+		return;
+	}
+	// late and doubled ones too, they are what the board sent
+	int count = block[2] | (block[3] << 8);
+	board_datagram(s->board, buf[0] | (buf[1] << 8) | (buf[2] << 16) | ((uint32_t)buf[3] << 24),
+		frame.t0_us + (int64_t)count * frame.period_us, now_us);
+
+	// the place of the block in the window
+	uint32_t seq = frame.seq;
+	if (s->started && (int32_t)(seq - s->next) < -RESTART) restart(in, s, now_us);
+	if (!s->started) {
+		// the window reaches back from the first block, for the ones before it still on their way
+		s->started = true;
+		s->opening = true;
+		s->next = seq - (INGEST_WINDOW - 1);
+	}
+	int32_t ahead = (int32_t)(seq - s->next);
+	if (ahead < 0) {
+		in->stats.late++;
+		return;
+	}
+	INGEST_SLOT_t *slot = &s->slot[seq % INGEST_WINDOW];
+	if (ahead < INGEST_WINDOW && slot->present && slot->frame.seq == seq) {
+		in->stats.duplicates++;
+		return;
+	}
+	if (ahead >= INGEST_WINDOW) {
+		// the window moves on: what is before it now is written or a gap
+		uint32_t first = seq - INGEST_WINDOW + 1;
+		while (s->held > 0 && (int32_t)(first - s->next) > 0) {
+			INGEST_SLOT_t *old = &s->slot[s->next % INGEST_WINDOW];
+			if (old->present && old->frame.seq == s->next) {
+				write_block(in, s, old, now_us);
+			} else if (!s->opening) {
+				in->stats.gaps++;
+			}
+			s->next++;
+		}
+		if ((int32_t)(first - s->next) > 0) {
+			if (!s->opening) in->stats.gaps += first - s->next;
+			s->next = first;
+		}
+		drain(in, s, now_us);
+	}
+
+	count = codec_decode(block, block_len, slot->raw, INGEST_MAX_BLOCK);
+	if (count <= 0) {
+		in->stats.bad++;
+		return;
+	}
+	slot->present = true;
+	slot->count = count;
+	slot->arrived_us = now_us;
+	slot->frame = frame;
+	s->held++;
+	drain(in, s, now_us);
+}
+
+bool ingest_mqtt(INGEST_t *in, const char *topic, size_t topic_len, const uint8_t *buf, size_t len, int64_t now_us)
+{
+	const size_t prefix = sizeof(INGEST_MQTT_PREFIX) - 1, suffix = sizeof(INGEST_MQTT_SUFFIX) - 1;
+	char name[INET_ADDRSTRLEN];
+	struct in_addr addr;
+	size_t name_len = topic_len - prefix - suffix;
+	if (topic_len <= prefix + suffix || name_len >= sizeof(name) || memcmp(topic, INGEST_MQTT_PREFIX, prefix) != 0
+		|| memcmp(topic + topic_len - suffix, INGEST_MQTT_SUFFIX, suffix) != 0) {
+		in->stats.bad++;
+		return false;
+	}
+	memcpy(name, topic + prefix, name_len);
+	name[name_len] = 0;
+	if (inet_pton(AF_INET, name, &addr) != 1) {
+		in->stats.bad++;
+		return false;
+	}
+	ingest_datagram(in, ntohl(addr.s_addr), buf, len, now_us);
+	return true;
+}
+
+int ingest_receive(INGEST_t *in, int fd, int64_t now_us)
+{
+	static uint8_t buf[INGEST_BATCH][UDP_STREAM_MAX_DATAGRAM + 1];
+	static struct mmsghdr msgs[INGEST_BATCH];
+	static struct iovec iov[INGEST_BATCH];
+	static struct sockaddr_in from[INGEST_BATCH];
+	int total = 0;
+	for (;;) {
+		for (int i = 0; i < INGEST_BATCH; i++) {
+			iov[i] = (struct iovec) { .iov_base = buf[i], .iov_len = sizeof(buf[i]) };
+			msgs[i].msg_hdr = (struct msghdr) {
+				.msg_name = &from[i], .msg_namelen = sizeof(from[i]), .msg_iov = &iov[i], .msg_iovlen = 1,
+			};
+		}
+		int n = recvmmsg(fd, msgs, INGEST_BATCH, MSG_DONTWAIT, NULL);
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			return errno == EAGAIN || errno == EWOULDBLOCK ? total : -1;
+		}
+		for (int i = 0; i < n; i++) {
+			ingest_datagram(in, ntohl(from[i].sin_addr.s_addr), buf[i], msgs[i].msg_len, now_us);
+		}
+		total += n;
+		if (n < INGEST_BATCH) return total;
+	}
+}
+
+void ingest_tick(INGEST_t *in, int64_t now_us)
+{
+	for (int i = 0; i < in->series; i++) {
+		INGEST_SERIES_t *s = in->series_list[i];
+		if (s->held > 0 && s->wait_since_us && now_us - s->wait_since_us >= INGEST_WAIT_US) skip_gap(in, s, now_us);
+		if (s->chunk.samples > 0 && now_us - s->chunk_since_us >= INGEST_CHUNK_AGE_US) {
+			if (archive_flush(in->archive, &s->chunk) != 0) in->stats.errors++;
+		}
+	}
+}
+
+void ingest_flush(INGEST_t *in)
+{
+	for (int i = 0; i < in->series; i++) {
+		INGEST_SERIES_t *s = in->series_list[i];
+		while (s->held > 0) skip_gap(in, s, 0);
+		if (archive_flush(in->archive, &s->chunk) != 0) in->stats.errors++;
+	}
+}
@@ -0,0 +1,119 @@
+/*
+	 Reassembly of the UDP sample streams of many boards into an archive
+	 (archive.h), for host/tools/aggregator.
+
+	 A datagram is what main/udp_stream.h sends: a u32 datagram number and
+	 a binary stream frame. The board is the IPv4 address it came from, a
+	 series is a board and a channel. The blocks of a series go to its chunk
+	 in the order of their seq: one that comes early is held until the ones
+	 before it are in, for at most INGEST_WINDOW blocks or INGEST_WAIT_US;
+	 then the missing ones are a gap. The first block of a series waits the
+	 same way for the ones before it. A block that comes after its place
+	 was written, or twice, is left out.
+
+	 The same datagrams can come as MQTT messages instead, published on
+	 ioto/<IPv4 address of the board>/stream; the address in the topic is
+	 then the board.
+
+	 Board time becomes archive time (the wall clock of the aggregator)
+	 with an offset per board: the smallest arrival minus end of block of
+	 the last INGEST_OFFSET_WINDOW_US, the block that waited least on the
+	 way. It follows the drift of the board's clock window by window; a
+	 chunk keeps the offset it started with.
+*/
+
+#ifndef HOST_INGEST_H_
+#define HOST_INGEST_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "archive.h"
+
+#define INGEST_MAX_BLOCK 512			// CONFIG_ACQ_BLOCK_SAMPLES at most
+#define INGEST_WINDOW 16				// blocks of a series held for the ones before them
+#define INGEST_WAIT_US 500000			// longest a gap is waited for
+#define INGEST_CHUNK_AGE_US 10000000	// a chunk older than that is written, full or not
+#define INGEST_OFFSET_WINDOW_US 10000000
+#define INGEST_MAX_BOARDS 256
+#define INGEST_MAX_SERIES 4096
+#define INGEST_BATCH 64					// datagrams per recvmmsg()
+#define INGEST_MQTT_PREFIX "ioto/"
+#define INGEST_MQTT_SUFFIX "/stream"
+#define INGEST_MQTT_TOPIC INGEST_MQTT_PREFIX "+" INGEST_MQTT_SUFFIX	// to subscribe to
+
+typedef struct {
+	uint32_t addr;				// IPv4, host byte order
+	bool started;
+	uint32_t expected;			// next datagram number
+	uint64_t datagrams;
+	uint64_t lost;
+	uint64_t reordered;
+	int64_t offset_us;			// archive time - board time
+	int64_t window_min_us;		// of the window going on
+	int64_t window_end_us;
+} INGEST_BOARD_t;
+
+typedef struct {
+	bool present;
+	int count;
+	int64_t arrived_us;
+	STREAM_FRAME_t frame;
+	uint16_t raw[INGEST_MAX_BLOCK];
+} INGEST_SLOT_t;
+
+typedef struct INGEST_SERIES_s {
+	INGEST_BOARD_t *board;
+	uint8_t channel;
+	bool started;
+	bool opening;				// nothing written yet, what is skipped is before the stream
+	uint32_t next;				// seq of the next block to write
+	int held;					// blocks in the window
+	int64_t wait_since_us;		// since the block at next is missing
+	int64_t chunk_since_us;		// the chunk got its first block
+	INGEST_SLOT_t slot[INGEST_WINDOW];
+	ARCHIVE_SERIES_t chunk;
+} INGEST_SERIES_t;
+
+typedef struct {
+	uint64_t datagrams;
+	uint64_t bytes;
+	uint64_t blocks;			// written to the archive
+	uint64_t samples;
+	uint64_t gaps;				// blocks never seen
+	uint64_t late;				// after their place was written
+	uint64_t duplicates;
+	uint64_t bad;				// not a stream frame
+	uint64_t refused;			// boards or series over the limits
+	uint64_t errors;			// archive writes that failed
+} INGEST_STATS_t;
+
+typedef struct {
+	ARCHIVE_t *archive;
+	int boards;
+	int series;
+	INGEST_BOARD_t board[INGEST_MAX_BOARDS];
+	INGEST_BOARD_t *board_table[2 * INGEST_MAX_BOARDS];		// by address
+	INGEST_SERIES_t *series_table[2 * INGEST_MAX_SERIES];	// by address and channel
+	INGEST_SERIES_t *series_list[INGEST_MAX_SERIES];
+	INGEST_STATS_t stats;
+} INGEST_t;
+
+void ingest_init(INGEST_t *in, ARCHIVE_t *archive);
+// frees the series; ingest_flush() first to keep what they hold
+void ingest_free(INGEST_t *in);
+
+void ingest_datagram(INGEST_t *in, uint32_t addr, const uint8_t *buf, size_t len, int64_t now_us);
+// a datagram that came on the MQTT topic, false (and bad) when the topic is not one of a board
+bool ingest_mqtt(INGEST_t *in, const char *topic, size_t topic_len, const uint8_t *buf, size_t len, int64_t now_us);
+// reads what fd has with recvmmsg(), returns the datagrams or -1
+int ingest_receive(INGEST_t *in, int fd, int64_t now_us);
+// gives up the gaps waited for long enough and writes the chunks old enough, every 100 ms or so
+void ingest_tick(INGEST_t *in, int64_t now_us);
+// writes everything held, gaps and all
+void ingest_flush(INGEST_t *in);
+
+INGEST_BOARD_t *ingest_board(INGEST_t *in, uint32_t addr);
+
+#endif /* HOST_INGEST_H_ */
@@ -0,0 +1,356 @@
+/*
+	 Websocket load generator for ioto.
+
+	 Opens N websocket clients against the server started by ws_server_start(),
+	 on the board or on ioto_sim, and sends the commands of the web application
+	 at a fixed rate per client. Every command carries a " #seq" tag (see
+	 main/protocol.h) so the replies can be matched to it.
+
+	 usage: loadgen [-h host] [-p port] [-c clients] [-r rate] [-d seconds] [-m mix] [-t timeout_ms] [-g pin] [-a pin]
+
+	 -c  number of websocket clients, default 1
+	 -r  commands per second and client, default 10
+	 -d  test duration in seconds, default 10
+	 -m  command mix as weights, default "A:4,G:4,O:1,I:1,R:0,J:0"
+	     A analog read, G digital read, O output, I input, R reset,
+	     J a JSON "init" request for the MQTT bridge (no reply)
+	 -t  a reply later than this is counted as dropped, default 2000 ms
+
+	 The results go to stdout as one JSON object, a summary to stderr:
+	 command to reply latency percentiles, delivered samples per second and
+	 client, dropped and out of order replies.
+*/
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <netdb.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+#include "hist.h"
+#include "wsclient.h"
+
+#define WINDOW 4096	// outstanding commands per client
+
+typedef struct {
+	int64_t sent_ns;
+	uint64_t counter;
+	bool pending;
+} PENDING_t;
+
+typedef struct {
+	WS_CLIENT_t ws;
+	int index;
+	int64_t next_send_ns;
+	uint64_t counter;
+	uint64_t last_counter;
+	bool have_last;
+	PENDING_t pending[WINDOW];
+
+	uint64_t sent;
+	uint64_t expected;
+	uint64_t replies;
+	uint64_t dropped;
+	uint64_t out_of_order;
+	uint64_t samples;
+	uint64_t frames;
+	uint64_t bytes;
+	uint64_t foreign;
+	HIST_t latency;
+} CLIENT_t;
+
+static struct {
+	const char *host;
+	int port;
+	int clients;
+	double rate;
+	double duration;
+	int64_t timeout_ns;
+	int gpio_pin;
+	int adc_pin;
+	int weight[6];
+} opt = {
+	.host = "127.0.0.1",
+	.port = 80,
+	.clients = 1,
+	.rate = 10,
+	.duration = 10,
+	.timeout_ns = 2000000000LL,
+	.gpio_pin = 42,
+	.adc_pin = 7,
+	.weight = { 4, 4, 1, 1, 0, 0 },
+};
+
+static const char ops[] = "AGOIRJ";
+
+static int64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int parse_mix(const char *mix)
+{
+	memset(opt.weight, 0, sizeof(opt.weight));
+	char copy[128];
+	snprintf(copy, sizeof(copy), "%s", mix);
+	for (char *save, *tok = strtok_r(copy, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+		const char *op = strchr(ops, tok[0]);
+		if (op == NULL || tok[1] != ':') return -1;
+		opt.weight[op - ops] = atoi(tok + 2);
+	}
+	return 0;
+}
+
+static char pick_op(uint64_t counter)
+{
+	int total = 0;
+	for (int i = 0; i < 6; i++) total += opt.weight[i];
+	if (total == 0) return 'A';
+	// deterministic round robin over the weights
+	int slot = counter % total;
+	for (int i = 0; i < 6; i++) {
+		if (slot < opt.weight[i]) return ops[i];
+		slot -= opt.weight[i];
+	}
+	return 'A';
+}
+
+static void send_command(CLIENT_t *c, int64_t now)
+{
+	char msg[128];
+	uint64_t counter = c->counter++;
+	long seq = (long)(counter * opt.clients + c->index);
+	char op = pick_op(counter);
+	bool expect = false;
+	switch (op) {
+		case 'A':
+			snprintf(msg, sizeof(msg), "A GPIO%d_pin #%ld", opt.adc_pin, seq);
+			expect = true;
+			break;
+		case 'G':
+			snprintf(msg, sizeof(msg), "G GPIO%d_pin #%ld", opt.gpio_pin, seq);
+			expect = true;
+			break;
+		case 'O':
+			snprintf(msg, sizeof(msg), "O GPIO%d %d #%ld", opt.gpio_pin, (int)(counter & 1), seq);
+			break;
+		case 'I':
+			snprintf(msg, sizeof(msg), "I GPIO%d #%ld", opt.gpio_pin, seq);
+			break;
+		case 'R':
+			snprintf(msg, sizeof(msg), "R GPIO%d #%ld", opt.gpio_pin, seq);
+			break;
+		default:
+			snprintf(msg, sizeof(msg), "{\"id\":\"init\"}");
+			break;
+	}
+	PENDING_t *p = &c->pending[counter % WINDOW];
+	if (p->pending) c->dropped++;	// the window wrapped before the reply came
+	p->pending = expect;
+	p->counter = counter;
+	p->sent_ns = now;
+	if (expect) c->expected++;
+	if (ws_client_send_text(&c->ws, msg, strlen(msg)) == 0) c->sent++;
+}
+
+// a text frame from the server: "TYPE\4name\4value\4time[\4seq]", not NUL terminated
+static void on_text(CLIENT_t *c, const char *text, size_t len, int64_t now)
+{
+	if (len >= 3 && memcmp(text, "AN\4", 3) == 0) c->samples++;
+
+	int fields = 1;
+	size_t last = 0;
+	for (size_t i = 0; i < len; i++) {
+		if (text[i] == 0x04) {
+			fields++;
+			last = i + 1;
+		}
+	}
+	if (fields != 5) return;
+
+	char seq_str[24];
+	size_t seq_len = len - last < sizeof(seq_str) - 1 ? len - last : sizeof(seq_str) - 1;
+	memcpy(seq_str, text + last, seq_len);
+	seq_str[seq_len] = 0;
+	long seq = strtol(seq_str, NULL, 10);
+	if (seq < 0 || seq % opt.clients != c->index) {
+		c->foreign++;
+		return;
+	}
+	uint64_t counter = seq / opt.clients;
+	PENDING_t *p = &c->pending[counter % WINDOW];
+	if (!p->pending || p->counter != counter) return;	// already counted as dropped
+	p->pending = false;
+	c->replies++;
+	hist_add(&c->latency, (now - p->sent_ns) / 1000);
+	if (c->have_last && counter < c->last_counter) c->out_of_order++;
+	c->last_counter = counter;
+	c->have_last = true;
+}
+
+static void expire(CLIENT_t *c, int64_t now, int64_t timeout_ns)
+{
+	for (int i = 0; i < WINDOW; i++) {
+		PENDING_t *p = &c->pending[i];
+		if (p->pending && now - p->sent_ns > timeout_ns) {
+			p->pending = false;
+			c->dropped++;
+		}
+	}
+}
+
+static void print_results(CLIENT_t *clients, double elapsed_s)
+{
+	HIST_t all;
+	hist_init(&all);
+	uint64_t sent = 0, expected = 0, replies = 0, dropped = 0, out_of_order = 0, samples = 0, bytes = 0;
+	for (int i = 0; i < opt.clients; i++) {
+		CLIENT_t *c = &clients[i];
+		hist_merge(&all, &c->latency);
+		sent += c->sent;
+		expected += c->expected;
+		replies += c->replies;
+		dropped += c->dropped;
+		out_of_order += c->out_of_order;
+		samples += c->samples;
+		bytes += c->bytes;
+	}
+
+	printf("{\"host\":\"%s\",\"port\":%d,\"clients\":%d,\"rate\":%.1f,\"duration_s\":%.3f,",
+		opt.host, opt.port, opt.clients, opt.rate, elapsed_s);
+	printf("\"sent\":%llu,\"expected_replies\":%llu,\"replies\":%llu,\"dropped\":%llu,\"out_of_order\":%llu,",
+		(unsigned long long)sent, (unsigned long long)expected, (unsigned long long)replies,
+		(unsigned long long)dropped, (unsigned long long)out_of_order);
+	printf("\"latency_us\":{\"p50\":%llu,\"p99\":%llu,\"p999\":%llu,\"max\":%llu,\"mean\":%.1f},",
+		(unsigned long long)hist_percentile(&all, 50), (unsigned long long)hist_percentile(&all, 99),
+		(unsigned long long)hist_percentile(&all, 99.9), (unsigned long long)all.max, hist_mean(&all));
+	printf("\"samples_per_s\":%.1f,\"bytes_per_s\":%.1f,\"per_client\":[",
+		samples / elapsed_s, bytes / elapsed_s);
+	for (int i = 0; i < opt.clients; i++) {
+		CLIENT_t *c = &clients[i];
+		printf("%s{\"client\":%d,\"sent\":%llu,\"replies\":%llu,\"dropped\":%llu,\"out_of_order\":%llu,"
+			"\"samples_per_s\":%.1f,\"frames\":%llu,\"p50_us\":%llu,\"p99_us\":%llu,\"p999_us\":%llu}",
+			i ? "," : "", i, (unsigned long long)c->sent, (unsigned long long)c->replies,
+			(unsigned long long)c->dropped, (unsigned long long)c->out_of_order,
+			c->samples / elapsed_s, (unsigned long long)c->frames,
+			(unsigned long long)hist_percentile(&c->latency, 50),
+			(unsigned long long)hist_percentile(&c->latency, 99),
+			(unsigned long long)hist_percentile(&c->latency, 99.9));
+	}
+	printf("]}\n");
+
+	fprintf(stderr, "%d clients, %.1f s: %llu sent, %llu/%llu replies, %llu dropped, %llu out of order\n",
+		opt.clients, elapsed_s, (unsigned long long)sent, (unsigned long long)replies,
+		(unsigned long long)expected, (unsigned long long)dropped, (unsigned long long)out_of_order);
+	fprintf(stderr, "latency p50 %llu us, p99 %llu us, p999 %llu us, max %llu us; %.1f samples/s per client\n",
+		(unsigned long long)hist_percentile(&all, 50), (unsigned long long)hist_percentile(&all, 99),
+		(unsigned long long)hist_percentile(&all, 99.9), (unsigned long long)all.max,
+		samples / elapsed_s / opt.clients);
+}
+
+int main(int argc, char **argv)
+{
+	int o;
+	while ((o = getopt(argc, argv, "h:p:c:r:d:m:t:g:a:")) != -1) {
+		switch (o) {
+			case 'h': opt.host = optarg; break;
+			case 'p': opt.port = atoi(optarg); break;
+			case 'c': opt.clients = atoi(optarg); break;
+			case 'r': opt.rate = atof(optarg); break;
+			case 'd': opt.duration = atof(optarg); break;
+			case 't': opt.timeout_ns = atoll(optarg) * 1000000LL; break;
+			case 'g': opt.gpio_pin = atoi(optarg); break;
+			case 'a': opt.adc_pin = atoi(optarg); break;
+			case 'm':
+				if (parse_mix(optarg) == 0) break;
+				fprintf(stderr, "bad mix: %s\n", optarg);
+				return 2;
+			default:
+				fprintf(stderr, "usage: %s [-h host] [-p port] [-c clients] [-r rate] [-d seconds] [-m mix] [-t timeout_ms] [-g pin] [-a pin]\n", argv[0]);
+				return 2;
+		}
+	}
+	if (opt.clients < 1 || opt.rate <= 0) return 2;
+
+	CLIENT_t *clients = calloc(opt.clients, sizeof(CLIENT_t));
+	int ep = epoll_create1(0);
+	int64_t interval_ns = (int64_t)(1e9 / opt.rate);
+	int64_t start = now_ns();
+	for (int i = 0; i < opt.clients; i++) {
+		CLIENT_t *c = &clients[i];
+		c->index = i;
+		hist_init(&c->latency);
+		if (ws_client_connect(&c->ws, opt.host, opt.port, "/") != 0) {
+			fprintf(stderr, "client %d: cannot connect to %s:%d\n", i, opt.host, opt.port);
+			return 1;
+		}
+		// spread the clients over one interval
+		c->next_send_ns = start + interval_ns * i / opt.clients;
+		struct epoll_event ev = { .events = EPOLLIN, .data.ptr = c };
+		epoll_ctl(ep, EPOLL_CTL_ADD, c->ws.fd, &ev);
+	}
+
+	start = now_ns();
+	int64_t end = start + (int64_t)(opt.duration * 1e9);
+	int64_t next_expire = start + 100000000LL;
+	struct epoll_event events[64];
+	int64_t now = start;
+	// keep reading for one timeout after the last command so late replies still count
+	while (now < end + opt.timeout_ns) {
+		int64_t next = end + opt.timeout_ns;
+		if (now < end) {
+			for (int i = 0; i < opt.clients; i++) {
+				if (clients[i].next_send_ns < next) next = clients[i].next_send_ns;
+			}
+		}
+		int wait_ms = next > now ? (int)((next - now + 999999) / 1000000) : 0;
+		int n = epoll_wait(ep, events, 64, wait_ms);
+		now = now_ns();
+		for (int i = 0; i < n; i++) {
+			CLIENT_t *c = events[i].data.ptr;
+			WS_FRAME_t frame;
+			if (ws_client_fill(&c->ws) < 0) {
+				fprintf(stderr, "client %d: connection closed\n", c->index);
+				epoll_ctl(ep, EPOLL_CTL_DEL, c->ws.fd, NULL);
+				continue;
+			}
+			while (ws_client_next_frame(&c->ws, &frame) > 0) {
+				c->frames++;
+				c->bytes += frame.len;
+				if (frame.opcode == WS_OP_TEXT) on_text(c, frame.data, frame.len, now);
+			}
+		}
+		if (now < end) {
+			for (int i = 0; i < opt.clients; i++) {
+				CLIENT_t *c = &clients[i];
+				while (c->next_send_ns <= now) {
+					send_command(c, now);
+					c->next_send_ns += interval_ns;
+				}
+			}
+		}
+		if (now >= next_expire) {
+			for (int i = 0; i < opt.clients; i++) expire(&clients[i], now, opt.timeout_ns);
+			next_expire = now + 100000000LL;
+		}
+	}
+	for (int i = 0; i < opt.clients; i++) {
+		expire(&clients[i], INT64_MAX / 2, 0);
+		ws_client_close(&clients[i].ws);
+	}
+
+	print_results(clients, (end - start) / 1e9);
+	free(clients);
+	return 0;
+}
@@ -0,0 +1,262 @@
+/*
+	 main/clocksync.c between Linux processes, with clocks that are off on
+	 purpose: a node's monotonic clock is CLOCK_MONOTONIC running -s ppm
+	 fast and -o ms ahead. All the nodes of one machine read the same
+	 CLOCK_MONOTONIC underneath, so a follower told the skew of its master
+	 (-M) knows the right answer and prints how far off it is.
+
+	 usage: syncnode [-l port] [-m master_ip:port] [-s ppm] [-o ms]
+	                 [-M ppm,ms] [-c seconds] [-t seconds] [-e max_error_us]
+	        syncnode -p listen_port:to_port [-d delay_us] [-j jitter_us] [-a asym_us]
+
+	 -l  UDP port of the node, default CONFIG_CLOCKSYNC_PORT
+	 -m  the master, without it the node is the master
+	 -M  skew and offset the master was started with, for the error
+	 -c  on the master: a capture on every node that often, each node
+	     prints the true time it was armed for
+	 -t  exit after that long, with 1 when the follower is not locked or,
+	     with -e, more than max_error_us off at the end
+
+	 With -p it is a proxy on 127.0.0.1 instead: datagrams to listen_port
+	 go to to_port and the answers back to whoever sent last, delay_us
+	 later, one in four up to jitter_us more, with asym_us more on the
+	 way to to_port.
+	 A delay that is not the same both ways is an error of half the
+	 difference the protocol cannot see.
+
+	 One line of JSON a second on stdout, e.g. for three nodes:
+		syncnode -l 4001 -s -20 -o 300 -c 5 &
+		syncnode -p 4000:4001 -d 500 -j 5000 &
+		syncnode -l 4002 -m 127.0.0.1:4000 -s 80 -M -20,300 -t 30 -e 100
+*/
+
+#include <errno.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "sdkconfig.h"
+#include "esp_log.h"
+
+#include "clocksync.h"
+
+static struct {
+	int port;
+	const char *master;
+	int master_port;
+	double ppm;
+	int64_t offset_us;
+	bool master_known;
+	double master_ppm;
+	int64_t master_offset_us;
+	int capture_s;
+	int duration_s;
+	int64_t max_error_us;
+} opt = { .port = CONFIG_CLOCKSYNC_PORT, .max_error_us = -1 };
+
+static int64_t true_us(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int64_t skewed(int64_t t, double ppm, int64_t offset_us)
+{
+	return offset_us + t + (int64_t)(t * ppm / 1e6);
+}
+
+static int64_t node_clock(void)
+{
+	return skewed(true_us(), opt.ppm, opt.offset_us);
+}
+
+static void on_arm(uint32_t id, int64_t local_us)
+{
+	int64_t t = (int64_t)((local_us - opt.offset_us) / (1 + opt.ppm / 1e6));
+	printf("{\"capture\":%u,\"true_us\":%lld}\n", id, (long long)t);
+	fflush(stdout);
+}
+
+static const char *state_name(CLOCKSYNC_STATE_t state)
+{
+	switch (state) {
+		case CLOCKSYNC_MASTER: return "master";
+		case CLOCKSYNC_UNLOCKED: return "unlocked";
+		case CLOCKSYNC_LOCKED: return "locked";
+		default: return "off";
+	}
+}
+
+// prints the stats, returns the error against the master, 0 without -M
+static int64_t report(int seconds)
+{
+	CLOCKSYNC_STATS_t stats;
+	clocksync_get_stats(&stats);
+	int64_t t = true_us();
+	int64_t error = clocksync_to_shared(skewed(t, opt.ppm, opt.offset_us))
+		- skewed(t, opt.master_ppm, opt.master_offset_us);
+	printf("{\"t\":%d,\"state\":\"%s\",\"requests\":%u,\"timeouts\":%u,\"used\":%u,\"filtered\":%u,\"steps\":%u,"
+		"\"delay_us\":%u,\"drift_ppb\":%d,\"peers\":%d", seconds, state_name(stats.state), stats.requests, stats.timeouts,
+		stats.used, stats.filtered, stats.steps, stats.delay_us, stats.drift_ppb, stats.peers);
+	if (opt.master_known && stats.state == CLOCKSYNC_LOCKED) printf(",\"error_us\":%lld", (long long)error);
+	printf("}\n");
+	fflush(stdout);
+	return opt.master_known ? error : 0;
+}
+
+static int run_node(void)
+{
+	static const CLOCKSYNC_IO_t io = { .clock_us = node_clock, .arm = on_arm };
+	if (clocksync_start(&io, opt.port, opt.master, opt.master_port) != ESP_OK) {
+		fprintf(stderr, "cannot start on port %d\n", opt.port);
+		return 1;
+	}
+	int64_t error = 0;
+	for (int s = 1; !opt.duration_s || s <= opt.duration_s; s++) {
+		vTaskDelay(pdMS_TO_TICKS(1000));
+		error = report(s);
+		if (!opt.master && opt.capture_s && s % opt.capture_s == 0) {
+			uint32_t id;
+			int64_t at_us;
+			int peers;
+			if (clocksync_arm_all(500, &id, &at_us, &peers) != ESP_OK) fprintf(stderr, "cannot arm\n");
+		}
+	}
+	if (opt.master && clocksync_state() != CLOCKSYNC_LOCKED) return 1;
+	if (opt.max_error_us >= 0 && (error > opt.max_error_us || error < -opt.max_error_us)) return 1;
+	return 0;
+}
+
+/*
+	 The proxy: what is in flight waits in pending until it is due.
+*/
+
+#define PROXY_PENDING 256
+
+typedef struct {
+	int64_t due_us;
+	struct sockaddr_in to;
+	size_t len;
+	uint8_t data[64];
+} DATAGRAM_t;
+
+static DATAGRAM_t pending[PROXY_PENDING];
+static int pending_count;
+
+static int run_proxy(int listen_port, int to_port, int delay_us, int jitter_us, int asym_us)
+{
+	int fd = socket(AF_INET, SOCK_DGRAM, 0);
+	struct sockaddr_in sin = { .sin_family = AF_INET, .sin_port = htons(listen_port), .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+	if (bind(fd, (struct sockaddr *)&sin, sizeof(sin)) < 0) {
+		perror("bind");
+		return 1;
+	}
+	struct sockaddr_in target = { .sin_family = AF_INET, .sin_port = htons(to_port), .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+	struct sockaddr_in client = { 0 };
+	uint64_t forwarded = 0, dropped = 0;
+	int64_t next_report = true_us() + 1000000;
+	srand(12345);
+
+	for (;;) {
+		int64_t now = true_us();
+		int timeout = 1000;
+		for (int i = 0; i < pending_count; i++) {
+			int64_t wait = (pending[i].due_us - now + 999) / 1000;
+			if (wait < timeout) timeout = wait < 0 ? 0 : (int)wait;
+		}
+		struct pollfd pfd = { .fd = fd, .events = POLLIN };
+		if (poll(&pfd, 1, timeout) < 0 && errno != EINTR) {
+			perror("poll");
+			return 1;
+		}
+		now = true_us();
+		if (pfd.revents & POLLIN) {
+			DATAGRAM_t datagram;
+			struct sockaddr_in from;
+			socklen_t from_len = sizeof(from);
+			ssize_t len = recvfrom(fd, datagram.data, sizeof(datagram.data), 0, (struct sockaddr *)&from, &from_len);
+			if (len > 0) {
+				bool to_target = from.sin_port != target.sin_port;
+				if (to_target) client = from;
+				datagram.to = to_target ? target : client;
+				datagram.len = len;
+				// like a busy access point: most go straight through, one in four waits in a queue
+				int queued = jitter_us && rand() % 4 == 0 ? rand() % jitter_us : 0;
+				datagram.due_us = now + delay_us + queued + (to_target ? asym_us : 0);
+				if (pending_count < PROXY_PENDING && datagram.to.sin_port) {
+					pending[pending_count++] = datagram;
+				} else {
+					dropped++;
+				}
+			}
+		}
+		for (int i = 0; i < pending_count; ) {
+			if (pending[i].due_us > now) {
+				i++;
+				continue;
+			}
+			sendto(fd, pending[i].data, pending[i].len, 0, (struct sockaddr *)&pending[i].to, sizeof(pending[i].to));
+			forwarded++;
+			pending[i] = pending[--pending_count];
+		}
+		if (now >= next_report) {
+			printf("{\"forwarded\":%llu,\"dropped\":%llu}\n", (unsigned long long)forwarded, (unsigned long long)dropped);
+			fflush(stdout);
+			next_report += 1000000;
+		}
+	}
+}
+
+int main(int argc, char **argv)
+{
+	int proxy_port = 0, to_port = 0, delay_us = 0, jitter_us = 0, asym_us = 0;
+	double master_offset_ms;
+	char *colon;
+	int o;
+
+	while ((o = getopt(argc, argv, "l:m:s:o:M:c:t:e:p:d:j:a:")) != -1) {
+		switch (o) {
+			case 'l': opt.port = atoi(optarg); break;
+			case 'm':
+				colon = strchr(optarg, ':');
+				if (!colon) return 2;
+				*colon = 0;
+				opt.master = optarg;
+				opt.master_port = atoi(colon + 1);
+				break;
+			case 's': opt.ppm = atof(optarg); break;
+			case 'o': opt.offset_us = (int64_t)(atof(optarg) * 1000); break;
+			case 'M':
+				if (sscanf(optarg, "%lf,%lf", &opt.master_ppm, &master_offset_ms) != 2) return 2;
+				opt.master_offset_us = (int64_t)(master_offset_ms * 1000);
+				opt.master_known = true;
+				break;
+			case 'c': opt.capture_s = atoi(optarg); break;
+			case 't': opt.duration_s = atoi(optarg); break;
+			case 'e': opt.max_error_us = atoll(optarg); break;
+			case 'p':
+				if (sscanf(optarg, "%d:%d", &proxy_port, &to_port) != 2) return 2;
+				break;
+			case 'd': delay_us = atoi(optarg); break;
+			case 'j': jitter_us = atoi(optarg); break;
+			case 'a': asym_us = atoi(optarg); break;
+			default:
+				fprintf(stderr, "usage: %s [-l port] [-m master_ip:port] [-s ppm] [-o ms] [-M ppm,ms] [-c seconds] [-t seconds] [-e max_error_us]\n"
+					"       %s -p listen_port:to_port [-d delay_us] [-j jitter_us] [-a asym_us]\n", argv[0], argv[0]);
+				return 2;
+		}
+	}
+	if (proxy_port) return run_proxy(proxy_port, to_port, delay_us, jitter_us, asym_us);
+	esp_log_level_set("*", ESP_LOG_WARN);
+	return run_node();
+}
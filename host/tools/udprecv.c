@@ -0,0 +1,270 @@
+/*
+	 Receiver of the UDP sample stream (main/udp_stream.h).
+
+	 Registers itself over the websocket of the board or of ioto_sim with
+	 "U address port codec", writes the samples it gets to a file and
+	 reports its loss counts back with "L received lost reordered" while
+	 it runs. Stops the stream with "U 0" when done.
+
+	 usage: udprecv [-h host] [-p port] [-a address] [-l udp_port] [-c codec] [-d seconds] [-o file] [-r report_ms]
+
+	 -h, -p  websocket of the server, default 127.0.0.1:80
+	 -a  address the server sends to, default the local address of the websocket
+	 -l  UDP port to listen on, default any free one
+	 -c  1 packed, 2 delta, 3 rice (main/codec.h), default 1
+	 -d  duration in seconds, default 10
+	 -o  file for the samples, one mV value per line (what ioto_sim -s adcN=file: and
+	     IOTO_BENCH_RECORDING read); lost blocks are left out
+	 -r  loss report interval, default 1000 ms
+
+	 Every gap is printed to stderr as it is noticed, the totals go to stdout
+	 as one JSON object. A gap in the datagram numbers is network loss; a gap
+	 in the block numbers between consecutive datagrams was dropped on the
+	 device, before sending.
+*/
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "codec.h"
+#include "protocol.h"
+#include "udp_stream.h"
+#include "wsclient.h"
+
+static struct {
+	const char *host;
+	int port;
+	const char *address;
+	int udp_port;
+	int codec;
+	double duration;
+	const char *output;
+	int report_ms;
+} opt = {
+	.host = "127.0.0.1",
+	.port = 80,
+	.codec = CODEC_PACKED,
+	.duration = 10,
+	.report_ms = 1000,
+};
+
+static struct {
+	uint64_t datagrams;
+	uint64_t bytes;
+	uint64_t samples;
+	uint64_t lost;
+	uint64_t reordered;
+	uint64_t bad;
+	uint64_t gaps;
+	uint64_t max_gap;
+	uint64_t device_dropped;
+	uint32_t expected;		// next datagram number
+	uint32_t next_block;
+	int have_block;
+} stats;
+
+static int64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void send_text(WS_CLIENT_t *ws, const char *text)
+{
+	if (ws_client_send_text(ws, text, strlen(text)) != 0) fprintf(stderr, "cannot send \"%s\"\n", text);
+}
+
+static void on_datagram(const uint8_t *buf, size_t len, FILE *out)
+{
+	STREAM_FRAME_t frame;
+	uint16_t raw[1024];
+	if (len < UDP_STREAM_HEADER_SIZE) {
+		stats.bad++;
+		return;
+	}
+	uint32_t seq = buf[0] | (buf[1] << 8) | (buf[2] << 16) | ((uint32_t)buf[3] << 24);
+	int header = protocol_get_frame_header(buf + UDP_STREAM_HEADER_SIZE, len - UDP_STREAM_HEADER_SIZE, &frame);
+	int count = header < 0 ? -1 : codec_decode(buf + UDP_STREAM_HEADER_SIZE + header,
+		len - UDP_STREAM_HEADER_SIZE - header, raw, sizeof(raw) / sizeof(raw[0]));
+	if (count < 0) {
+		stats.bad++;
+		return;
+	}
+	stats.datagrams++;
+	stats.bytes += len;
+
+	int32_t ahead = (int32_t)(seq - stats.expected);
+	if (ahead < 0) {
+		// counted as lost when the later ones came, it was only late
+		stats.reordered++;
+		if (stats.lost) stats.lost--;
+	} else {
+		if (ahead > 0) {
+			fprintf(stderr, "gap: datagrams %u-%u lost\n", stats.expected, seq - 1);
+			stats.lost += ahead;
+			stats.gaps++;
+			if ((uint64_t)ahead > stats.max_gap) stats.max_gap = ahead;
+		} else if (stats.have_block && frame.seq != stats.next_block) {
+			uint32_t dropped = frame.seq - stats.next_block;
+			fprintf(stderr, "gap: blocks %u-%u dropped on the device\n", stats.next_block, frame.seq - 1);
+			stats.device_dropped += dropped;
+		}
+		stats.expected = seq + 1;
+		stats.next_block = frame.seq + 1;
+		stats.have_block = 1;
+	}
+
+	stats.samples += count;
+	if (out) {
+		for (int i = 0; i < count; i++) fprintf(out, "%.1f\n", frame.offset_mv + raw[i] * frame.mv_per_lsb);
+	}
+}
+
+// reads the websocket, returns 1 when the reply to "U" said "on", -1 on "error", 0 otherwise
+static int on_websocket(WS_CLIENT_t *ws)
+{
+	WS_FRAME_t frame;
+	int result = 0;
+	if (ws_client_fill(ws) < 0) return -1;
+	while (ws_client_next_frame(ws, &frame) > 0) {
+		if (frame.opcode != WS_OP_TEXT || frame.len < 3 || memcmp(frame.data, "UD\4", 3) != 0) continue;
+		fprintf(stderr, "server: %.*s\n", (int)frame.len, frame.data);
+		for (size_t i = 0; i < frame.len; i++) {
+			if (frame.data[i] == PROTOCOL_DEL) frame.data[i] = ' ';
+		}
+		if (memmem(frame.data, frame.len, " on", 3)) result = 1;
+		if (memmem(frame.data, frame.len, " error", 6)) result = -1;
+	}
+	return result;
+}
+
+static void report(WS_CLIENT_t *ws)
+{
+	char text[80];
+	snprintf(text, sizeof(text), "L %llu %llu %llu", (unsigned long long)stats.datagrams,
+		(unsigned long long)stats.lost, (unsigned long long)stats.reordered);
+	send_text(ws, text);
+}
+
+int main(int argc, char **argv)
+{
+	int o;
+	while ((o = getopt(argc, argv, "h:p:a:l:c:d:o:r:")) != -1) {
+		switch (o) {
+			case 'h': opt.host = optarg; break;
+			case 'p': opt.port = atoi(optarg); break;
+			case 'a': opt.address = optarg; break;
+			case 'l': opt.udp_port = atoi(optarg); break;
+			case 'c': opt.codec = atoi(optarg); break;
+			case 'd': opt.duration = atof(optarg); break;
+			case 'o': opt.output = optarg; break;
+			case 'r': opt.report_ms = atoi(optarg); break;
+			default:
+				fprintf(stderr, "usage: %s [-h host] [-p port] [-a address] [-l udp_port] [-c codec] [-d seconds] [-o file] [-r report_ms]\n", argv[0]);
+				return 2;
+		}
+	}
+	if (opt.codec <= CODEC_TEXT || opt.codec >= CODEC_MAX || opt.report_ms <= 0) return 2;
+
+	WS_CLIENT_t ws;
+	if (ws_client_connect(&ws, opt.host, opt.port, "/") != 0) {
+		fprintf(stderr, "cannot connect to %s:%d\n", opt.host, opt.port);
+		return 1;
+	}
+	// by default the server sends to the address it sees the websocket coming from
+	struct sockaddr_in local;
+	socklen_t local_len = sizeof(local);
+	getsockname(ws.fd, (struct sockaddr *)&local, &local_len);
+	char address[INET_ADDRSTRLEN];
+	snprintf(address, sizeof(address), "%s", opt.address ? opt.address : inet_ntoa(local.sin_addr));
+
+	int fd = socket(AF_INET, SOCK_DGRAM, 0);
+	struct sockaddr_in sin = { .sin_family = AF_INET, .sin_port = htons(opt.udp_port), .sin_addr.s_addr = htonl(INADDR_ANY) };
+	int size = 4 << 20;
+	setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+	if (bind(fd, (struct sockaddr *)&sin, sizeof(sin)) < 0) {
+		perror("bind");
+		return 1;
+	}
+	socklen_t sin_len = sizeof(sin);
+	getsockname(fd, (struct sockaddr *)&sin, &sin_len);
+
+	FILE *out = NULL;
+	if (opt.output && (out = fopen(opt.output, "w")) == NULL) {
+		perror(opt.output);
+		return 1;
+	}
+
+	char text[80];
+	snprintf(text, sizeof(text), "U %s %d %d", address, ntohs(sin.sin_port), opt.codec);
+	fprintf(stderr, "asking %s:%d for %s\n", opt.host, opt.port, text + 2);
+	send_text(&ws, text);
+
+	int64_t start = now_ns();
+	int64_t end = start + (int64_t)(opt.duration * 1e9);
+	int64_t next_report = start + opt.report_ms * 1000000LL;
+	int64_t first_ns = 0, last_ns = 0;
+	int started = 0;
+	static uint8_t buf[UDP_STREAM_MAX_DATAGRAM + 1];
+	for (int64_t now = start; now < end; now = now_ns()) {
+		struct pollfd pfd[2] = { { .fd = fd, .events = POLLIN }, { .fd = ws.fd, .events = POLLIN } };
+		int64_t next = next_report < end ? next_report : end;
+		int wait_ms = next > now ? (int)((next - now + 999999) / 1000000) : 0;
+		if (poll(pfd, 2, wait_ms) < 0 && errno != EINTR) break;
+		if (pfd[0].revents & POLLIN) {
+			ssize_t len;
+			while ((len = recv(fd, buf, sizeof(buf), MSG_DONTWAIT)) > 0) {
+				last_ns = now_ns();
+				if (stats.datagrams == 0) first_ns = last_ns;
+				on_datagram(buf, len, out);
+			}
+		}
+		if (pfd[1].revents & (POLLIN | POLLHUP)) {
+			int ret = on_websocket(&ws);
+			if (ret < 0) {
+				fprintf(stderr, "the server refused the stream or closed the websocket\n");
+				return 1;
+			}
+			if (ret > 0) started = 1;
+		}
+		if (now_ns() >= next_report) {
+			report(&ws);
+			next_report += opt.report_ms * 1000000LL;
+		}
+	}
+	report(&ws);
+	send_text(&ws, "U 0");
+	usleep(100000);		// a moment for the commands to get out before the close
+	ws_client_close(&ws);
+	close(fd);
+	if (out) fclose(out);
+	if (!started) fprintf(stderr, "no reply to the U command\n");
+
+	double span_s = last_ns > first_ns ? (last_ns - first_ns) / 1e9 : 0;
+	printf("{\"host\":\"%s\",\"port\":%d,\"address\":\"%s\",\"udp_port\":%d,\"codec\":\"%s\",",
+		opt.host, opt.port, address, ntohs(sin.sin_port), codec_name(opt.codec));
+	printf("\"datagrams\":%llu,\"lost\":%llu,\"reordered\":%llu,\"bad\":%llu,\"gaps\":%llu,\"max_gap\":%llu,"
+		"\"device_dropped\":%llu,\"samples\":%llu,\"samples_per_s\":%.1f,\"bytes_per_sample\":%.3f}\n",
+		(unsigned long long)stats.datagrams, (unsigned long long)stats.lost,
+		(unsigned long long)stats.reordered, (unsigned long long)stats.bad,
+		(unsigned long long)stats.gaps, (unsigned long long)stats.max_gap,
+		(unsigned long long)stats.device_dropped, (unsigned long long)stats.samples,
+		span_s > 0 ? stats.samples / span_s : 0.0,
+		stats.samples ? (double)stats.bytes / stats.samples : 0.0);
+	fprintf(stderr, "%llu datagrams, %llu lost in %llu gaps (largest %llu), %llu reordered, %llu blocks dropped on the device\n",
+		(unsigned long long)stats.datagrams, (unsigned long long)stats.lost, (unsigned long long)stats.gaps,
+		(unsigned long long)stats.max_gap, (unsigned long long)stats.reordered,
+		(unsigned long long)stats.device_dropped);
+	return stats.datagrams > 0 ? 0 : 1;
+}
@@ -0,0 +1,226 @@
+/*
+	 Minimal websocket client, see wsclient.h
+*/
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include "wsclient.h"
+
+#define WS_BUF_SIZE 65536
+
+static int send_all(int fd, const void *data, size_t len)
+{
+	const uint8_t *p = data;
+	while (len > 0) {
+		ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			if (errno == EAGAIN) {
+				// the socket is non blocking, wait for room instead of dropping half a frame
+				struct pollfd pfd = { .fd = fd, .events = POLLOUT };
+				poll(&pfd, 1, -1);
+				continue;
+			}
+			return -1;
+		}
+		p += n;
+		len -= n;
+	}
+	return 0;
+}
+
+int ws_client_connect(WS_CLIENT_t *c, const char *host, int port, const char *path)
+{
+	memset(c, 0, sizeof(WS_CLIENT_t));
+	c->fd = -1;
+
+	char service[12];
+	snprintf(service, sizeof(service), "%d", port);
+	struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM };
+	struct addrinfo *res;
+	if (getaddrinfo(host, service, &hints, &res) != 0) return -1;
+	int fd = -1;
+	for (struct addrinfo *ai = res; ai; ai = ai->ai_next) {
+		fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+		if (fd < 0) continue;
+		if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) break;
+		close(fd);
+		fd = -1;
+	}
+	freeaddrinfo(res);
+	if (fd < 0) return -1;
+	int one = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+	char request[512];
+	int n = snprintf(request, sizeof(request),
+		"GET %s HTTP/1.1\r\n"
+		"Host: %s:%d\r\n"
+		"Upgrade: websocket\r\n"
+		"Connection: Upgrade\r\n"
+		"Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+		"Sec-WebSocket-Version: 13\r\n\r\n", path, host, port);
+	if (send_all(fd, request, n) != 0) {
+		close(fd);
+		return -1;
+	}
+
+	c->fd = fd;
+	c->cap = WS_BUF_SIZE;
+	c->buf = malloc(c->cap);
+	if (c->buf == NULL) {
+		ws_client_close(c);
+		return -1;
+	}
+	// read the response header, anything after it is already websocket data
+	char *end = NULL;
+	while (end == NULL) {
+		if (c->len == c->cap) {
+			ws_client_close(c);
+			return -1;
+		}
+		ssize_t r = recv(fd, c->buf + c->len, c->cap - c->len, 0);
+		if (r <= 0) {
+			if (r < 0 && errno == EINTR) continue;
+			ws_client_close(c);
+			return -1;
+		}
+		c->len += r;
+		end = memmem(c->buf, c->len, "\r\n\r\n", 4);
+	}
+	if (c->len < 12 || memcmp(c->buf + 9, "101", 3) != 0) {
+		ws_client_close(c);
+		return -1;
+	}
+	c->pos = end + 4 - c->buf;
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	return 0;
+}
+
+int ws_client_send(WS_CLIENT_t *c, int opcode, const void *data, size_t len)
+{
+	uint8_t header[14];
+	size_t h = 0;
+	header[h++] = 0x80 | (opcode & 0x0f);
+	if (len < 126) {
+		header[h++] = 0x80 | len;
+	} else if (len < 65536) {
+		header[h++] = 0x80 | 126;
+		header[h++] = len >> 8;
+		header[h++] = len & 0xff;
+	} else {
+		header[h++] = 0x80 | 127;
+		for (int i = 7; i >= 0; i--) header[h++] = (uint64_t)len >> (8 * i);
+	}
+	uint32_t key = (uint32_t)random();
+	uint8_t *mask = header + h;
+	memcpy(mask, &key, 4);
+	h += 4;
+
+	uint8_t *frame = malloc(h + len);
+	if (frame == NULL) return -1;
+	memcpy(frame, header, h);
+	const uint8_t *in = data;
+	for (size_t i = 0; i < len; i++) frame[h + i] = in[i] ^ mask[i & 3];
+	int ret = send_all(c->fd, frame, h + len);
+	free(frame);
+	return ret;
+}
+
+int ws_client_send_text(WS_CLIENT_t *c, const char *text, size_t len)
+{
+	return ws_client_send(c, WS_OP_TEXT, text, len);
+}
+
+int ws_client_fill(WS_CLIENT_t *c)
+{
+	if (c->fd < 0) return -1;
+	// frames handed out before are no longer needed, make room at the end
+	if (c->pos > 0) {
+		memmove(c->buf, c->buf + c->pos, c->len - c->pos);
+		c->len -= c->pos;
+		c->pos = 0;
+	}
+	int total = 0;
+	for (;;) {
+		if (c->len == c->cap) {
+			char *bigger = realloc(c->buf, c->cap * 2);
+			if (bigger == NULL) return -1;
+			c->buf = bigger;
+			c->cap *= 2;
+		}
+		ssize_t n = recv(c->fd, c->buf + c->len, c->cap - c->len, 0);
+		if (n > 0) {
+			c->len += n;
+			total += n;
+			continue;
+		}
+		if (n < 0 && errno == EINTR) continue;
+		if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return total;
+		return total > 0 ? total : -1;
+	}
+}
+
+int ws_client_next_frame(WS_CLIENT_t *c, WS_FRAME_t *frame)
+{
+	for (;;) {
+		uint8_t *p = (uint8_t *)c->buf + c->pos;
+		size_t avail = c->len - c->pos;
+		if (avail < 2) return 0;
+		size_t h = 2;
+		uint64_t len = p[1] & 0x7f;
+		if (len == 126) {
+			if (avail < 4) return 0;
+			len = (p[2] << 8) | p[3];
+			h = 4;
+		} else if (len == 127) {
+			if (avail < 10) return 0;
+			len = 0;
+			for (int i = 0; i < 8; i++) len = (len << 8) | p[2 + i];
+			h = 10;
+		}
+		bool masked = p[1] & 0x80;
+		if (masked) h += 4;
+		if (avail < h + len) return 0;
+		if (masked) {
+			for (uint64_t i = 0; i < len; i++) p[h + i] ^= p[h - 4 + (i & 3)];
+		}
+		c->pos += h + len;
+
+		int opcode = p[0] & 0x0f;
+		if (opcode == WS_OP_PING) {
+			ws_client_send(c, WS_OP_PONG, p + h, len);
+			continue;
+		}
+		frame->opcode = opcode;
+		frame->data = (char *)p + h;
+		frame->len = len;
+		return 1;
+	}
+}
+
+void ws_client_close(WS_CLIENT_t *c)
+{
+	if (c->fd >= 0) {
+		uint8_t status[2] = { 1000 >> 8, 1000 & 0xff };
+		ws_client_send(c, WS_OP_CLOSE, status, sizeof(status));
+		close(c->fd);
+	}
+	c->fd = -1;
+	free(c->buf);
+	c->buf = NULL;
+	c->cap = c->len = c->pos = 0;
+}
@@ -0,0 +1,44 @@
+/*
+	 Minimal websocket client (RFC 6455) for the host tools.
+
+	 Only what the tools need: the HTTP upgrade, masked text frames out,
+	 and unfragmented frames in. Pings are answered while parsing.
+*/
+
+#ifndef HOST_WSCLIENT_H_
+#define HOST_WSCLIENT_H_
+
+#include <stddef.h>
+
+#define WS_OP_CONT  0x0
+#define WS_OP_TEXT  0x1
+#define WS_OP_BIN   0x2
+#define WS_OP_CLOSE 0x8
+#define WS_OP_PING  0x9
+#define WS_OP_PONG  0xA
+
+typedef struct {
+	int fd;
+	char *buf;
+	size_t cap;
+	size_t len;		// bytes in buf
+	size_t pos;		// bytes of buf already parsed
+} WS_CLIENT_t;
+
+typedef struct {
+	int opcode;
+	char *data;		// points into the client buffer, valid until the next ws_client_fill()
+	size_t len;
+} WS_FRAME_t;
+
+// connect and upgrade, blocking; the socket is non blocking afterwards
+int ws_client_connect(WS_CLIENT_t *c, const char *host, int port, const char *path);
+int ws_client_send(WS_CLIENT_t *c, int opcode, const void *data, size_t len);
+int ws_client_send_text(WS_CLIENT_t *c, const char *text, size_t len);
+// read what is available, returns the bytes read or -1 when the connection is gone
+int ws_client_fill(WS_CLIENT_t *c);
+// 1 and the next complete frame, or 0 when more data is needed
+int ws_client_next_frame(WS_CLIENT_t *c, WS_FRAME_t *frame);
+void ws_client_close(WS_CLIENT_t *c);
+
+#endif /* HOST_WSCLIENT_H_ */
@@ -0,0 +1,105 @@
+// Benchmark of the scope rendering pipeline, see bench.html.
+//
+// Every 10 ms each channel gets rate/100 new samples, as 'AS' messages
+// through the decode.js worker (worker=1) or pushed straight into the
+// rings (worker=0). The view shows the last `points` samples per channel.
+// After `seconds` the draw time and frame interval percentiles are printed
+// as JSON.
+
+var params = new URLSearchParams(location.search);
+var CHANNELS = parseInt(params.get('channels') || '2');
+var POINTS = parseInt(params.get('points') || '100000');
+var RATE = parseInt(params.get('rate') || '100000');		// samples per second and channel
+var SECONDS = parseFloat(params.get('seconds') || '10');
+var USE_WORKER = (params.get('worker') || '1') != '0';
+var BLOCK = 64;		// samples per 'AS' message, like CONFIG_ACQ_BLOCK_SAMPLES
+
+var scope = new ScopeView(document.getElementById('scope'), { yMin: 0, yMax: 2.5, window: POINTS });
+var rings = [];
+for (var c = 0; c < CHANNELS; c++) {
+	rings.push(new ScopeRing(POINTS));
+	scope.addChannel(rings[c]);
+}
+
+var drawTimes = [];
+var frameTimes = [];
+var lastFrame = 0;
+var received = 0;
+scope.onframe = function(ms) {
+	drawTimes.push(ms);
+};
+function tick(now) {
+	if (lastFrame) frameTimes.push(now - lastFrame);
+	lastFrame = now;
+	if (!done) requestAnimationFrame(tick);
+}
+requestAnimationFrame(tick);
+
+var decoder = null;
+if (USE_WORKER) {
+	decoder = new Worker('decode.js');
+	decoder.onmessage = function(evt) {
+		var channels = evt.data.channels;
+		for (var name in channels) {
+			var c = parseInt(name.substring(3));
+			rings[c].pushArray(channels[name]);
+			received += channels[name].length;
+		}
+		scope.invalidate();
+	};
+}
+
+var phase = 0;
+var sent = 0;
+function produce() {
+	var n = Math.round(RATE / 100);
+	for (var c = 0; c < CHANNELS; c++) {
+		for (var off = 0; off < n; off += BLOCK) {
+			var count = Math.min(BLOCK, n - off);
+			var mv = new Array(count);
+			for (var i = 0; i < count; i++) {
+				var t = (phase + off + i) / RATE;
+				mv[i] = Math.round(1250 + 1000 * Math.sin(2 * Math.PI * (50 + 20 * c) * t) + 20 * (Math.random() - 0.5));
+			}
+			if (decoder) {
+				decoder.postMessage({ text: 'AS\4ADC' + c + '\4' + mv.join(',') + '\4' + Math.round((phase + off) * 1e6 / RATE) });
+			} else {
+				rings[c].pushArray(Float32Array.from(mv, function(v) { return v / 1000; }));
+				received += count;
+			}
+		}
+	}
+	phase += n;
+	sent += n * CHANNELS;
+	if (!decoder) scope.invalidate();
+}
+
+function percentile(list, p) {
+	if (list.length == 0) return 0;
+	var sorted = Float64Array.from(list).sort();
+	return sorted[Math.min(sorted.length - 1, Math.floor(sorted.length * p / 100))];
+}
+
+var done = false;
+var producer = setInterval(produce, 10);
+var started = performance.now();
+setTimeout(function() {
+	done = true;
+	clearInterval(producer);
+	var elapsed = (performance.now() - started) / 1000;
+	var result = {
+		channels: CHANNELS,
+		points: POINTS,
+		rate: RATE,
+		worker: USE_WORKER,
+		seconds: +elapsed.toFixed(2),
+		fps: +(frameTimes.length / elapsed).toFixed(1),
+		draws: drawTimes.length,
+		draw_ms: { p50: +percentile(drawTimes, 50).toFixed(2), p99: +percentile(drawTimes, 99).toFixed(2), max: +percentile(drawTimes, 100).toFixed(2) },
+		frame_ms: { p50: +percentile(frameTimes, 50).toFixed(2), p99: +percentile(frameTimes, 99).toFixed(2), max: +percentile(frameTimes, 100).toFixed(2) },
+		samples_sent: sent,
+		samples_drawn_from: received,
+	};
+	document.getElementById('result').textContent = JSON.stringify(result, null, 2);
+	console.log(JSON.stringify(result));
+}, SECONDS * 1000);
@@ -0,0 +1,181 @@
+// Web Worker that turns sample messages from the ESP32 into Float32Arrays.
+//
+// main.js passes the 'AN' and 'AS' messages and the binary stream frames on
+// as they arrive. Decoded samples are collected per channel and posted back
+// at most every few milliseconds, with the buffers transferred instead of
+// copied.
+//
+// in : { text: "AN\4GPIOn\4mV\4time" } or { text: "AS\4GPIOn\4mV,mV,...\4t0_us" }
+//      or { frame: ArrayBuffer }, a frame header and a codec block (main/protocol.h, main/codec.h),
+//      or the history sent on connect, which goes before everything else in the channel
+// out: { channels: { name: Float32Array (volts) }, messages: n,
+//        history: { points: n, pins: [n, ...], levels: [0|1, ...] } after a history, the levels at its end }
+
+var FLUSH_MS = 8;
+var pending = {};
+var messages = 0;
+var history = null;
+var timer = null;
+
+function append(name, values) {
+	var list = pending[name];
+	if (!list) list = pending[name] = [];
+	list.push(values);
+}
+
+function flush() {
+	timer = null;
+	var out = {};
+	var transfer = [];
+	for (var name in pending) {
+		var list = pending[name];
+		var n = 0;
+		for (var i = 0; i < list.length; i++) n += list[i].length;
+		var all = new Float32Array(n);
+		var pos = 0;
+		for (var i = 0; i < list.length; i++) {
+			all.set(list[i], pos);
+			pos += list[i].length;
+		}
+		out[name] = all;
+		transfer.push(all.buffer);
+	}
+	var msg = { channels: out, messages: messages };
+	if (history) msg.history = history;
+	postMessage(msg, transfer);
+	pending = {};
+	messages = 0;
+	history = null;
+}
+
+function decodeText(text) {
+	var values = text.split('\4');	// \4 is EOT
+	switch (values[0]) {
+		case 'AN':
+			append(values[1], Float32Array.of(parseInt(values[2]) / 1000));
+			break;
+		case 'AS': {
+			var list = values[2].split(',');
+			var samples = new Float32Array(list.length);
+			for (var i = 0; i < list.length; i++) samples[i] = parseInt(list[i]) / 1000;
+			append(values[1], samples);
+			break;
+		}
+		default:
+			return;
+	}
+	messages++;
+}
+
+var FRAME_HEADER_SIZE = 28;
+var CODEC_HEADER_SIZE = 6;
+var CODEC_PACKED = 1, CODEC_DELTA = 2, CODEC_RICE = 3;
+var RICE_ESCAPE = 24, ZZ_BITS = 18;
+
+// LSB first, like the writer in codec.c; at most 25 bits are ever buffered
+function BitReader(bytes, pos) {
+	this.bytes = bytes;
+	this.pos = pos;
+	this.acc = 0;
+	this.nbits = 0;
+}
+
+BitReader.prototype.get = function(bits) {
+	while (this.nbits < bits) {
+		var byte = this.pos < this.bytes.length ? this.bytes[this.pos] : 0;
+		this.pos++;
+		this.acc |= byte << this.nbits;
+		this.nbits += 8;
+	}
+	var value = this.acc & ((1 << bits) - 1);
+	this.acc >>>= bits;
+	this.nbits -= bits;
+	return value;
+}
+
+function unzigzag(v) {
+	return (v >>> 1) ^ -(v & 1);
+}
+
+// the JS twin of codec_decode(), returns the raw readings or null
+function decodeBlock(bytes, pos) {
+	if (bytes.length - pos < CODEC_HEADER_SIZE) return null;
+	var codec = bytes[pos], param = bytes[pos + 1];
+	var count = bytes[pos + 2] | (bytes[pos + 3] << 8);
+	var first = bytes[pos + 4] | (bytes[pos + 5] << 8);
+	var raw = new Uint16Array(count);	// wraps like the uint16_t arithmetic of the encoder
+	if (count == 0) return raw;
+	var r = new BitReader(bytes, pos + CODEC_HEADER_SIZE);
+	switch (codec) {
+		case CODEC_PACKED:
+			for (var i = 0; i < count; i++) raw[i] = r.get(param);
+			break;
+		case CODEC_DELTA:
+			raw[0] = first;
+			for (var i = 1; i < count; i++) raw[i] = raw[i - 1] + (param ? unzigzag(r.get(param)) : 0);
+			break;
+		case CODEC_RICE: {
+			var k = param & 0x0f;
+			var order = param & 0x80 ? 2 : 1;
+			raw[0] = first;
+			for (var i = 1; i < count; i++) {
+				var q = 0;
+				while (q < RICE_ESCAPE && r.get(1)) q++;
+				var v = q == RICE_ESCAPE ? r.get(ZZ_BITS) : (q << k) | (k ? r.get(k) : 0);
+				var prediction = (order == 2 && i >= 2) ? 2 * raw[i - 1] - raw[i - 2] : raw[i - 1];
+				raw[i] = prediction + unzigzag(v);
+			}
+			break;
+		}
+		default:
+			return null;
+	}
+	if (r.pos > bytes.length) return null;	// the block was cut short
+	return raw;
+}
+
+var HISTORY_CHANGE_SIZE = 20;
+
+function decodeFrame(buffer) {
+	var view = new DataView(buffer);
+	var magic = buffer.byteLength < FRAME_HEADER_SIZE ? 0 : view.getUint8(0);
+	if (magic != 0x53 && magic != 0x48) return;	// 'S', or 'H' for the history
+	var channel = view.getUint8(1);
+	var mvPerLsb = view.getFloat32(12, true);
+	var offsetMv = view.getFloat32(16, true);
+	var pos = FRAME_HEADER_SIZE;
+	var last = null;
+	if (magic == 0x48) {
+		// the changes of the levels come first, only the last one matters here
+		var changes = view.getUint16(pos, true);
+		pos += 2 + changes * HISTORY_CHANGE_SIZE;
+		if (pos > buffer.byteLength) return;
+		if (changes > 0) last = pos - HISTORY_CHANGE_SIZE;
+	}
+	var raw = decodeBlock(new Uint8Array(buffer), pos);
+	if (raw === null) return;
+	var name = 'ADC' + channel;
+	var samples = new Float32Array(raw.length);
+	for (var i = 0; i < raw.length; i++) samples[i] = (offsetMv + raw[i] * mvPerLsb) / 1000;
+	if (magic == 0x48) {
+		pending[name] = [];	// the history is older than anything else of the channel
+		history = { points: raw.length, pins: [], levels: [] };
+		if (last !== null) {
+			var pins = view.getBigUint64(last + 4, true), levels = view.getBigUint64(last + 12, true);
+			for (var pin = 0; pin < 64; pin++) {
+				if ((pins >> BigInt(pin)) & 1n) {
+					history.pins.push(pin);
+					history.levels.push(Number((levels >> BigInt(pin)) & 1n));
+				}
+			}
+		}
+	}
+	append(name, samples);
+	messages++;
+}
+
+onmessage = function(evt) {
+	if (evt.data.text !== undefined) decodeText(evt.data.text);
+	if (evt.data.frame !== undefined) decodeFrame(evt.data.frame);
+	if (messages > 0 && timer === null) timer = setTimeout(flush, FLUSH_MS);
+}
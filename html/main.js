@@ -1,6 +1,7 @@
 //document.getElementById("datetime").innerHTML = "WebSocket is not connected";
 
 var websocket = new WebSocket('ws://'+location.hostname+'/');
+websocket.binaryType = 'arraybuffer';	// binary stream frames, see setEncoding()
 document.getElementsByName("mode")[0].checked = true;
 document.getElementsByName("level")[0].checked = true;
 var selected = ""
@@ -10,30 +11,63 @@ var selected = ""
 // }
 
 var arrayLength = 30
-var dataArray = []
+var STREAM_WINDOW = 100000	// samples shown while streaming
+var RING_SIZE = 100000		// samples kept per channel
+var streaming = false;
 
-var curr = 0;
 var cnt = 0;
 
+// samples are decoded in decode.js and drawn by scope.js, at most once per frame
 TESTER = document.getElementById('tester');
-Plotly.newPlot( TESTER, [{
-	y: dataArray, mode: 'lines',}],  {
-	paper_bgcolor: 'hsl(0, 0%, 21%)',
-	plot_bgcolor:'hsl(0, 0%, 21%)',
-	margin: { t: 0, b:20, r:0, l:20 },
-	xaxis: {
-	  range: [0, arrayLength],
-	  zeroline: false,
-	//   showline: true,
-	  color: '#fff',
-	},
-	yaxis: {
-	  range: [-2.5, 3],
-	  zeroline: false,
-	//   showline: true,
-	  color: '#fff',
+var scopeCanvas = document.createElement('canvas');
+scopeCanvas.style.width = '100%';
+scopeCanvas.style.height = '100%';
+TESTER.appendChild(scopeCanvas);
+var scope = new ScopeView(scopeCanvas, { yMin: -2.5, yMax: 3, window: arrayLength });
+var rings = {};
+window.addEventListener('resize', function() { scope.resize(); });
+
+function ringFor(name) {
+	if (!rings[name]) {
+		rings[name] = new ScopeRing(RING_SIZE);
+		scope.addChannel(rings[name]);
+	}
+	return rings[name];
+}
+
+var decoder = new Worker('decode.js');
+decoder.onmessage = function(evt) {
+	var channels = evt.data.channels;
+	var history = evt.data.history;
+	if (history) {
+		// the last seconds before we connected, shown whole until streaming starts
+		if (!streaming) scope.window = Math.max(arrayLength, history.points);
+		for (var i = 0; i < history.pins.length; i++) showLevel('GPIO' + history.pins[i], String(history.levels[i]));
+	}
+	for (var name in channels) {
+		ringFor(name).pushArray(channels[name]);
 	}
-  }, {displayModeBar: false} );
+	scope.invalidate();
+}
+
+function toggleStream() {
+	streaming = !streaming;
+	websocket.send('S GPIO6_pin ' + (streaming ? 1 : 0));
+	for (var name in rings) rings[name].clear();
+	scope.window = streaming ? STREAM_WINDOW : arrayLength;
+	scope.invalidate();
+	document.getElementById('stream').classList.toggle('is-link', streaming);
+}
+
+// 0 text, 1 packed, 2 delta, 3 rice (main/codec.h)
+function setEncoding(codec) {
+	websocket.send('E GPIO6_pin ' + codec);
+}
+
+// samples are averaged in groups of n on the ESP32, for this client only
+function setDecimation(n) {
+	websocket.send('D GPIO6_pin ' + n);
+}
 
 var getInput = setInterval(function() {	
 	var x = document.getElementById("pins1").children;
@@ -60,10 +94,7 @@ var getInput = setInterval(function() {
 			}
 		}
 	}
-	websocket.send('A GPIO2')
-	// Plotly.extendTraces(TESTER, {
-	// 	y: [[rand()]]
-	//   }, [0])
+	if (!streaming) websocket.send('A GPIO2')
 	
 	if(++cnt === 100) clearInterval(interval);
   }, 100);
@@ -180,6 +211,25 @@ function sendText(name) {
 */
 }
 
+// the badge of a pin, "GPIOn", from its level '0' or '1'
+function showLevel(pin, level) {
+	var span = document.getElementById(pin + "_span");
+	if (span == null) return;
+	if (level == '0') {
+		span.innerHTML = "LOW";
+		span.classList.remove("is-black", "is-success");
+		span.classList.add("is-danger");
+	} else if (level == '1') {
+		span.innerHTML = "HIGH";
+		span.classList.remove("is-black", "is-danger");
+		span.classList.add("is-success");
+	} else {
+		span.innerHTML = "None";
+		span.classList.remove("is-success", "is-danger");
+		span.classList.add("is-black");
+	}
+}
+
 websocket.onopen = function(evt) {
 	console.log('WebSocket connection opened');
 	var data = {};
@@ -193,8 +243,28 @@ websocket.onopen = function(evt) {
 	document.getElementById("status").classList.remove("is-danger");
 }
 
+// the stream frames received, acknowledged for the rate control of the ESP32 (main/flow.h)
+var framesReceived = 0;
+var framesAcked = 0;
+setInterval(function() {
+	if (framesReceived == framesAcked || websocket.readyState != WebSocket.OPEN) return;
+	framesAcked = framesReceived;
+	websocket.send('K ' + framesReceived);
+}, 100);
+
 websocket.onmessage = function(evt) {
 	var msg = evt.data;
+	// samples go straight to the worker, without logging every one
+	if (msg instanceof ArrayBuffer) {
+		if (msg.byteLength && new Uint8Array(msg)[0] == 0x53) framesReceived++;	// 'S', not the history
+		decoder.postMessage({ frame: msg }, [msg]);
+		return;
+	}
+	if (msg.startsWith('AN\4') || msg.startsWith('AS\4')) {
+		if (msg[1] == 'S') framesReceived++;
+		decoder.postMessage({ text: msg });
+		return;
+	}
 	console.log("msg=" + msg);
 	var values = msg.split('\4'); // \4 is EOT
 	console.log("values=" + values);
@@ -205,48 +275,64 @@ websocket.onmessage = function(evt) {
 			console.log("ID values[3]=" + values[3]);
 			break;
 
+		case 'TB':
+			// the ESP32 stamps samples with its time since boot until SNTP gets through,
+			// or with the clock of the bench master when it follows one
+			document.getElementById("status").innerHTML = (values[2] == '1' ? "Connected" : "Connected, time since boot") +
+				(values[3] == 'sync' ? ", bench clock" : "");
+			break;
+
+		case 'CS':
+			// a coordinated capture: id, its time on the bench clock, followers told
+			console.log("capture " + values[1] + " at " + values[2] + " us, " + values[3] + " followers");
+			break;
+
+		case 'WG':
+			// the waveform generator: shape (or table), frequency played (or points), on/off/ok/error
+			console.log("wave " + values[1] + " " + values[2] + " " + values[3]);
+			break;
+
+		case 'FC':
+			// the ESP32 thins our streams this many times to keep up with the link, 1 for none
+			console.log("streams thinned " + values[1] + " times, latency " + values[2] + " us");
+			break;
+
+		case 'PG':
+			// the pattern generator: write, pattern, play or stop, its detail, the status
+			console.log("pattern " + values[1] + " " + values[2] + " " + values[3]);
+			break;
+
 		case 'MQTT':
 			console.log("MQTT values[1]=" + values[1]);
 			console.log("MQTT values[2]=" + values[2]);
 			const msg = document.createElement('div')
 			msg.className = 'message-body';
-			msg.innerText = values[2] + '\nOn topic: ' + values[1];
+			msg.innerText = values[2] + (values[3] == 'cut' ? ' [cut]' : '') + '\nOn topic: ' + values[1];
 			document.getElementById('article').appendChild(msg);
 			break;
-		case 'IN':
-			if (values[2] == '0') {
-				document.getElementById(values[1] + "_span").innerHTML = "LOW";
-				document.getElementById(values[1] + "_span").classList.remove("is-black", "is-success");
-				document.getElementById(values[1] + "_span").classList.add("is-danger");
-			} else if (values[2] == '1') {
-				document.getElementById(values[1] + "_span").innerHTML = "HIGH";
-				document.getElementById(values[1] + "_span").classList.remove("is-black", "is-danger");
-				document.getElementById(values[1] + "_span").classList.add("is-success");
-			} else {
-				document.getElementById(values[1] + "_span").innerHTML = "None";
-				document.getElementById(values[1] + "_span").classList.remove("is-success", "is-danger");
-				document.getElementById(values[1] + "_span").classList.add("is-black");
-			}
+		case 'BU': {
+			// decoded bus frames, "dt_us:token" each, the first one at values[3] us
+			const frames = document.createElement('div')
+			frames.className = 'message-body';
+			frames.innerText = values[1] + ' ' + values[2].split(',').map(f => f.split(':')[1]).join(' ');
+			document.getElementById('article').appendChild(frames);
 			break;
-		case 'AN':
-			dataArray = dataArray.concat(parseInt(values[2])/1000)
-			if (curr == arrayLength) {
-				dataArray.splice(0, 1)
-			}
-			else {
-				curr++;
-			}
-		  
-			var data_update = {
-			  y: [dataArray]
-			};
-		  
-			Plotly.update(TESTER, data_update)
-			// Plotly.extendTraces(TESTER, {
-			// 	y: [[parseInt(values[2])/1000]]
-			//   }, [0])
+		}
+		case 'RU': {
+			// a rule was set, deleted or listed: name, rule, "ok" or what is wrong with it
+			const rule = document.createElement('div')
+			rule.className = 'message-body';
+			rule.innerText = 'Rule ' + values[1] + ': ' + values[2] + (values[3] == 'ok' ? '' : '\n' + values[3]);
+			document.getElementById('article').appendChild(rule);
+			break;
+		}
+		case 'GP':
+			// a command on a pin the ESP32 does not have: the pin, the command, "bad pin"
+			console.log(values[1] + ": " + values[2] + " " + values[3]);
+			break;
+		case 'IN':
+			showLevel(values[1], values[2]);
 			break;
-				
 /*
 		case 'NAME':
 			console.log("NAME values[1]=" + values[1]);
@@ -0,0 +1,194 @@
+// Rendering layer of the scope view.
+//
+// Every channel keeps its samples in a ScopeRing, a Float32Array used as a
+// ring buffer, so new samples never allocate. Samples can arrive at any
+// rate; ScopeView only marks itself dirty and draws once per
+// requestAnimationFrame. Each pixel column is drawn as the min/max of the
+// samples that fall into it, so a frame costs one pass over the visible
+// samples however many there are.
+
+function ScopeRing(capacity) {
+	this.capacity = capacity;
+	this.data = new Float32Array(capacity);
+	this.start = 0;		// index of the oldest sample
+	this.length = 0;
+	this.total = 0;		// samples ever pushed
+}
+
+ScopeRing.prototype.push = function(value) {
+	var end = (this.start + this.length) % this.capacity;
+	this.data[end] = value;
+	if (this.length < this.capacity) {
+		this.length++;
+	} else {
+		this.start = (this.start + 1) % this.capacity;
+	}
+	this.total++;
+}
+
+// appends a Float32Array (or any array) in at most two copies
+ScopeRing.prototype.pushArray = function(values) {
+	var n = values.length;
+	if (n >= this.capacity) {
+		this.data.set(values.subarray ? values.subarray(n - this.capacity) : values.slice(n - this.capacity));
+		this.start = 0;
+		this.length = this.capacity;
+		this.total += n;
+		return;
+	}
+	var end = (this.start + this.length) % this.capacity;
+	var first = Math.min(n, this.capacity - end);
+	var src = values.subarray ? values : Float32Array.from(values);
+	this.data.set(src.subarray(0, first), end);
+	if (first < n) this.data.set(src.subarray(first), 0);
+	var overflow = this.length + n - this.capacity;
+	if (overflow > 0) {
+		this.start = (this.start + overflow) % this.capacity;
+		this.length = this.capacity;
+	} else {
+		this.length += n;
+	}
+	this.total += n;
+}
+
+ScopeRing.prototype.clear = function() {
+	this.start = 0;
+	this.length = 0;
+}
+
+// options: { yMin, yMax, window (samples shown), colors, background, grid }
+function ScopeView(canvas, options) {
+	options = options || {};
+	this.canvas = canvas;
+	this.ctx = canvas.getContext('2d', { alpha: false });
+	this.yMin = options.yMin !== undefined ? options.yMin : -2.5;
+	this.yMax = options.yMax !== undefined ? options.yMax : 3;
+	this.window = options.window || 100000;
+	this.colors = options.colors || ['#3273dc', '#ffdd57', '#48c774', '#f14668'];
+	this.background = options.background || 'hsl(0, 0%, 21%)';
+	this.grid = options.grid || 'hsl(0, 0%, 29%)';
+	this.channels = [];
+	this.dirty = false;
+	this.pending = false;
+	this.onframe = null;	// called with the draw time in ms after every frame
+	var self = this;
+	this.frame = function() {
+		self.pending = false;
+		if (!self.dirty) return;
+		self.dirty = false;
+		var t0 = performance.now();
+		self.draw();
+		if (self.onframe) self.onframe(performance.now() - t0);
+	};
+	this.resize();
+}
+
+ScopeView.prototype.addChannel = function(ring) {
+	this.channels.push(ring);
+	this.invalidate();
+	return this.channels.length - 1;
+}
+
+// many pushes between two frames cost one redraw
+ScopeView.prototype.invalidate = function() {
+	this.dirty = true;
+	if (!this.pending) {
+		this.pending = true;
+		requestAnimationFrame(this.frame);
+	}
+}
+
+ScopeView.prototype.resize = function() {
+	var ratio = window.devicePixelRatio || 1;
+	var width = Math.max(1, Math.floor(this.canvas.clientWidth * ratio));
+	var height = Math.max(1, Math.floor(this.canvas.clientHeight * ratio));
+	if (this.canvas.width != width || this.canvas.height != height) {
+		this.canvas.width = width;
+		this.canvas.height = height;
+		this.colMin = new Float32Array(width);
+		this.colMax = new Float32Array(width);
+	}
+	this.invalidate();
+}
+
+ScopeView.prototype.drawGrid = function() {
+	var ctx = this.ctx, w = this.canvas.width, h = this.canvas.height;
+	ctx.fillStyle = this.background;
+	ctx.fillRect(0, 0, w, h);
+	ctx.strokeStyle = this.grid;
+	ctx.lineWidth = 1;
+	ctx.beginPath();
+	for (var i = 1; i < 10; i++) {
+		var x = Math.round(w * i / 10) + 0.5;
+		ctx.moveTo(x, 0);
+		ctx.lineTo(x, h);
+	}
+	for (var v = Math.ceil(this.yMin); v <= this.yMax; v++) {
+		var y = Math.round(this.toY(v)) + 0.5;
+		ctx.moveTo(0, y);
+		ctx.lineTo(w, y);
+	}
+	ctx.stroke();
+}
+
+ScopeView.prototype.toY = function(value) {
+	var h = this.canvas.height;
+	return h - (value - this.yMin) * h / (this.yMax - this.yMin);
+}
+
+ScopeView.prototype.draw = function() {
+	this.drawGrid();
+	for (var c = 0; c < this.channels.length; c++) {
+		this.drawChannel(this.channels[c], this.colors[c % this.colors.length]);
+	}
+}
+
+ScopeView.prototype.drawChannel = function(ring, color) {
+	var ctx = this.ctx, w = this.canvas.width;
+	var n = Math.min(ring.length, this.window);
+	if (n < 2) return;
+	var data = ring.data, cap = ring.capacity;
+	var first = (ring.start + ring.length - n) % cap;	// oldest visible sample
+	var scale = this.canvas.height / (this.yMax - this.yMin);
+	var h = this.canvas.height, yMin = this.yMin;
+
+	ctx.strokeStyle = color;
+	ctx.lineWidth = 1;
+	ctx.beginPath();
+	if (n <= w) {
+		// fewer samples than pixels: a plain polyline, the newest at the right edge
+		var dx = w / this.window;
+		var x0 = w - n * dx;
+		for (var i = 0; i < n; i++) {
+			var v = data[(first + i) % cap];
+			var y = h - (v - yMin) * scale;
+			if (i == 0) ctx.moveTo(x0, y); else ctx.lineTo(x0 + i * dx, y);
+		}
+	} else {
+		// min/max per pixel column, one pass in at most two contiguous runs
+		var colMin = this.colMin, colMax = this.colMax;
+		var cols = Math.max(1, Math.round(w * n / this.window));
+		var per = n / cols;
+		colMin.fill(Infinity, 0, cols);
+		colMax.fill(-Infinity, 0, cols);
+		var i = 0;
+		while (i < n) {
+			var idx = (first + i) % cap;
+			var run = Math.min(n - i, cap - idx);
+			for (var k = 0; k < run; k++) {
+				var col = ((i + k) / per) | 0;
+				var v = data[idx + k];
+				if (v < colMin[col]) colMin[col] = v;
+				if (v > colMax[col]) colMax[col] = v;
+			}
+			i += run;
+		}
+		var xOff = w - cols;
+		for (var col = 0; col < cols; col++) {
+			var x = xOff + col + 0.5;
+			ctx.moveTo(x, h - (colMax[col] - yMin) * scale);
+			ctx.lineTo(x, h - (colMin[col] - yMin) * scale + 1);
+		}
+	}
+	ctx.stroke();
+}
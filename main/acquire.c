@@ -0,0 +1,158 @@
+/*
+	 Acquisition task, see acquire.h
+*/
+
+#include <stdatomic.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_attr.h"
+#include "esp_log.h"
+
+#include "acquire.h"
+#include "hal.h"
+#include "spsc.h"
+
+#define ACQ_RING_BLOCKS CONFIG_ACQ_RING_BLOCKS
+#if ACQ_RING_BLOCKS < 2 || (ACQ_RING_BLOCKS & (ACQ_RING_BLOCKS - 1)) != 0
+#error "CONFIG_ACQ_RING_BLOCKS must be a power of two, 2 or more"
+#endif
+// above the application tasks and lwIP (18), below esp_timer (22) and Wi-Fi (23)
+#define ACQ_TASK_PRIORITY (configMAX_PRIORITIES - 5)
+// one wake up per sample time, above 10 kHz per two or more
+#define ACQ_TICK_MIN_US 100
+
+static const char *TAG = "acquire";
+
+static SPSC_RING_t ring;
+static SAMPLE_BLOCK_t blocks[ACQ_RING_BLOCKS];
+static _Atomic uint32_t acq_channels;
+static _Atomic uint32_t latest_mv[ACQ_MAX_CHANNELS];
+static _Atomic uint32_t produced;
+static _Atomic uint32_t late;
+static uint32_t period_us;
+static uint32_t tick_us;
+static int64_t first_tick_us;	// when the first tick is due, at the latest
+static TaskHandle_t acq_task;
+
+// the interrupt of the hal tick, wakes the task at each sample time
+static bool IRAM_ATTR acquire_tick(void *arg)
+{
+	BaseType_t woken = pdFALSE;
+	vTaskNotifyGiveFromISR(acq_task, &woken);
+	return woken == pdTRUE;
+}
+
+static void acquire_task(void *pvParameters)
+{
+	ESP_LOGI(TAG, "sampling every %u us, %d samples per block", period_us, ACQ_BLOCK_SAMPLES);
+	static SAMPLE_BLOCK_t scratch;	// sampled into when the ring is full, keeps latest_mv going
+	SAMPLE_BLOCK_t *block = NULL;
+	uint32_t seq = 0;
+	int list[ACQ_MAX_CHANNELS];	// the channels of the current block
+	int nchannels = 0;
+	int times = 0;			// sample times per block
+	// the sample times are those of the ticks, the lags those of the wake ups
+	ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+	int64_t next_us = first_tick_us;
+
+	for (;;) {
+		// take every sample that is due, one unless the task was kept from running
+		int64_t now = hal_clock_us();
+		if (now - next_us > (int64_t)period_us * ACQ_BLOCK_SAMPLES) atomic_fetch_add(&late, 1);
+		while (next_us <= now) {
+			if (block == NULL) {
+				// filled in place, the consumer gets the very same slot
+				block = spsc_claim(&ring);
+				if (block == NULL) block = &scratch;
+				block->seq = seq++;
+				block->channels = atomic_load_explicit(&acq_channels, memory_order_relaxed);
+				block->count = 0;
+				block->t0_us = next_us;
+				block->period_us = period_us;
+				nchannels = 0;
+				for (int ch = 0; ch < ACQ_MAX_CHANNELS; ch++) {
+					if (block->channels & (1 << ch)) list[nchannels++] = ch;
+				}
+				times = nchannels ? ACQ_BLOCK_SAMPLES / nchannels : ACQ_BLOCK_SAMPLES;
+			}
+			int64_t lag = hal_clock_us() - next_us;
+			block->lag_us[block->count] = lag < ACQ_LAG_UNKNOWN ? lag : ACQ_LAG_UNKNOWN;
+			uint16_t *raw = &block->raw[block->count * nchannels];
+			for (int i = 0; i < nchannels; i++) raw[i] = hal_adc_read_raw(list[i]);
+			block->count++;
+			next_us += period_us;
+
+			if (block->count == times) {
+				for (int i = 0; i < nchannels; i++) {
+					uint32_t sum = 0;
+					for (int t = 0; t < times; t++) sum += block->raw[t * nchannels + i];
+					atomic_store_explicit(&latest_mv[list[i]], hal_adc_raw_to_mv(sum / times), memory_order_relaxed);
+				}
+				if (block != &scratch) spsc_publish(&ring);
+				atomic_fetch_add_explicit(&produced, 1, memory_order_relaxed);
+				block = NULL;
+			}
+		}
+		ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+	}
+}
+
+esp_err_t acquire_start(uint32_t channels, uint32_t rate_hz)
+{
+	if (rate_hz == 0) return ESP_ERR_INVALID_ARG;
+	esp_err_t err = spsc_init(&ring, blocks, sizeof(SAMPLE_BLOCK_t), ACQ_RING_BLOCKS);
+	if (err != ESP_OK) return err;
+	acquire_set_channels(channels);
+	period_us = 1000000 / rate_hz;
+	if (period_us == 0) period_us = 1;
+
+#if portNUM_PROCESSORS > 1
+	const BaseType_t core = APP_CPU_NUM;
+#else
+	const BaseType_t core = tskNO_AFFINITY;
+#endif
+	if (xTaskCreatePinnedToCore(acquire_task, "acquire_task", 1024*3, NULL, ACQ_TASK_PRIORITY, &acq_task, core) != pdPASS) {
+		ESP_LOGE(TAG, "cannot create acquire_task");
+		return ESP_ERR_NO_MEM;
+	}
+	// paced by a timer, not by the FreeRTOS tick which may be 100 Hz
+	tick_us = period_us > ACQ_TICK_MIN_US ? period_us : ACQ_TICK_MIN_US;
+	first_tick_us = hal_clock_us() + tick_us;
+	err = hal_tick_start(tick_us, acquire_tick, NULL);
+	if (err != ESP_OK) {
+		ESP_LOGE(TAG, "cannot start the tick: %s", esp_err_to_name(err));
+		vTaskDelete(acq_task);
+		acq_task = NULL;
+	}
+	return err;
+}
+
+void acquire_set_channels(uint32_t channels)
+{
+	atomic_store(&acq_channels, channels & ((1 << ACQ_MAX_CHANNELS) - 1));
+}
+
+const SAMPLE_BLOCK_t *acquire_peek(void)
+{
+	return spsc_peek(&ring);
+}
+
+void acquire_release(void)
+{
+	spsc_release(&ring);
+}
+
+uint32_t acquire_latest_mv(int channel)
+{
+	if (channel < 0 || channel >= ACQ_MAX_CHANNELS) return 0;
+	return atomic_load_explicit(&latest_mv[channel], memory_order_relaxed);
+}
+
+void acquire_get_stats(ACQ_STATS_t *stats)
+{
+	stats->blocks = atomic_load(&produced);
+	stats->overruns = spsc_overruns(&ring);
+	stats->late = atomic_load(&late);
+	stats->used = spsc_used(&ring);
+}
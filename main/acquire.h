@@ -0,0 +1,67 @@
+/*
+	 Acquisition task: samples a set of ADC channels at a fixed rate and
+	 hands blocks of samples to the network side through an SPSC ring
+	 (spsc.h). Every channel is read at each sample time, so a block holds
+	 the readings interleaved in channel order, ACQ_BLOCK_SAMPLES in all.
+	 A hardware timer (hal_tick_start()) wakes the task at every sample
+	 time, so the rate does not depend on the FreeRTOS tick.
+
+	 The task runs above every other application task and, on dual core
+	 chips, on the APP core, so sampling does not wait for the websocket,
+	 http or MQTT work. There is a single consumer of the blocks.
+*/
+
+#ifndef MAIN_ACQUIRE_H_
+#define MAIN_ACQUIRE_H_
+
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "sdkconfig.h"
+
+#define ACQ_BLOCK_SAMPLES CONFIG_ACQ_BLOCK_SAMPLES
+#define ACQ_MAX_CHANNELS 10		// ADC1_CHANNEL_0 to ADC1_CHANNEL_9
+#define ACQ_LAG_UNKNOWN UINT16_MAX
+
+typedef struct {
+	uint32_t seq;			// block number, a gap means blocks were dropped
+	uint16_t channels;		// bit mask of the ADC1 channels in the block
+	uint16_t count;			// sample times, readings per channel
+	int64_t t0_us;			// hal_clock_us() of the first sample
+	uint32_t period_us;
+	uint16_t raw[ACQ_BLOCK_SAMPLES];	// raw ADC readings, interleaved in channel order
+	// sample time i was read at t0_us + i * period_us + lag_us[i], ACQ_LAG_UNKNOWN when far later;
+	// what equivalent-time sampling needs, the task may be kept from running by higher priorities
+	uint16_t lag_us[ACQ_BLOCK_SAMPLES];
+} SAMPLE_BLOCK_t;
+
+typedef struct {
+	uint32_t blocks;		// blocks produced
+	uint32_t overruns;		// blocks dropped because the ring was full
+	uint32_t late;			// wake ups that found more than one block period due
+	uint32_t used;			// blocks waiting for the consumer
+} ACQ_STATS_t;
+
+esp_err_t acquire_start(uint32_t channels, uint32_t rate_hz);
+// takes effect with the next block; more channels mean fewer sample times per block
+void acquire_set_channels(uint32_t channels);
+
+// consumer side, one task only
+const SAMPLE_BLOCK_t *acquire_peek(void);
+void acquire_release(void);
+
+// mean of channel in the latest block in millivolts, from any task
+uint32_t acquire_latest_mv(int channel);
+void acquire_get_stats(ACQ_STATS_t *stats);
+
+// copies the readings of one channel out of a block, returns their number (0 when it has none)
+static inline int acquire_block_channel(const SAMPLE_BLOCK_t *block, int channel, uint16_t *out)
+{
+	if (channel < 0 || channel >= ACQ_MAX_CHANNELS || (block->channels & (1 << channel)) == 0) return 0;
+	int stride = __builtin_popcount(block->channels);
+	int index = __builtin_popcount(block->channels & ((1 << channel) - 1));
+	for (int i = 0; i < block->count; i++) out[i] = block->raw[i * stride + index];
+	return block->count;
+}
+
+#endif /* MAIN_ACQUIRE_H_ */
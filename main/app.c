@@ -0,0 +1,1574 @@
+/*
+	 The application proper: websocket callback, http server, and the loop
+	 that passes messages between the websocket and the MQTT task.
+	 Talks to the board only through hal.h, so it also runs on Linux
+	 (see host/sim).
+*/
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+
+#include "sdkconfig.h"
+#include "esp_log.h"
+#include "esp_system.h"
+#include "cJSON.h"
+
+#include "websocket_server.h"
+
+#include "acquire.h"
+#include "app.h"
+#include "clocksync.h"
+#include "codec.h"
+#include "decoder.h"
+#include "ets.h"
+#include "flow.h"
+#include "hal.h"
+#include "history.h"
+#include "json_arena.h"
+#include "mqtt.h"
+#include "msg.h"
+#include "pattern.h"
+#include "protocol.h"
+#include "rules.h"
+#include "session.h"
+#include "timebase.h"
+#include "topic.h"
+#include "trace.h"
+#include "udp_stream.h"
+#include "wavegen.h"
+
+static QueueHandle_t client_queue;
+MSG_QUEUE_t main_queue;
+MSG_QUEUE_t mqtt_queue;
+
+static const int channel = 6;     // ADC1_CHANNEL_6, always sampled for 'A'
+
+const static int client_queue_size = 10;
+
+static const char *TAG = "app";
+
+typedef struct {
+	char ip[64];
+	uint16_t port;
+} SERVER_PARAM_t;
+
+static SERVER_PARAM_t server_param;
+
+// binary frames carry raw readings and a straight line to mV through the calibration
+static float frame_offset_mv;
+static float frame_mv_per_lsb;
+static _Atomic uint64_t input_pins;	// set as inputs by 'I', their levels go in the history
+static uint8_t history_msg[HISTORY_MAX_MESSAGE];	// the websocket task only
+
+// equivalent-time sampling, for one client at a time, fed by stream_task
+#define ETS_REPORT_US 500000
+static ETS_t ets;
+static SemaphoreHandle_t ets_lock;
+static int ets_client = -1;
+static int ets_channel;
+static int ets_trigger_pin = -1;
+static int64_t ets_reported_us;
+
+// the MQTT subscriptions of the clients, a sink per websocket client and the internal ones after them;
+// the broker hears of a filter when it gets its first sink and when it loses its last one
+#define SINK_TRIGGER CONFIG_WEBSOCKET_SERVER_MAX_CLIENTS	// arms the trigger of the sessions
+#define SINK_MAX (CONFIG_WEBSOCKET_SERVER_MAX_CLIENTS + 1)
+static TOPIC_TABLE_t topics;
+static uint8_t topics_arena[CONFIG_MQTT_TOPIC_ARENA_SIZE] __attribute__((aligned(8)));
+static SemaphoreHandle_t topics_lock;
+
+static void topics_start(void)
+{
+	topics_lock = xSemaphoreCreateMutex();
+	topic_table_init(&topics, topics_arena, sizeof(topics_arena));
+	const char *trigger = CONFIG_MQTT_TRIGGER_TOPIC;
+	if (trigger[0] && topic_subscribe(&topics, trigger, strlen(trigger), SINK_TRIGGER) != ESP_OK) {
+		ESP_LOGW(TAG, "bad trigger topic %s", trigger);
+	}
+}
+
+void app_each_filter(TOPIC_FILTER_CB_t cb, void *arg)
+{
+	xSemaphoreTake(topics_lock, portMAX_DELAY);
+	topic_each_filter(&topics, cb, arg);
+	xSemaphoreGive(topics_lock);
+}
+
+// subscribe-request or unsubscribe-request of client in the table, true when the broker has to hear of it
+static bool topic_request(const MSG_t *request, int client)
+{
+	const char *filter = text_get(&request->mqtt, TEXT_TOPIC_SUB);
+	size_t len = text_len(&request->mqtt, TEXT_TOPIC_SUB);
+	xSemaphoreTake(topics_lock, portMAX_DELAY);
+	bool had = topic_sinks(&topics, filter, len) > 0;
+	esp_err_t err = request->type == MSG_MQTT_SUBSCRIBE ? topic_subscribe(&topics, filter, len, client)
+		: topic_unsubscribe(&topics, filter, len, client);
+	bool has = topic_sinks(&topics, filter, len) > 0;
+	xSemaphoreGive(topics_lock);
+	if (err != ESP_OK) {
+		ESP_LOGW(TAG, "client %i %s [%s]: %s", client, msg_type_name(request->type), filter, esp_err_to_name(err));
+		return false;
+	}
+	return had != has;
+}
+
+// a filter nobody wants any more, from the websocket task; if the queue is full the broker
+// keeps sending it and topic_match() finds no sink
+static void topic_emptied(const char *filter, size_t len, void *arg)
+{
+	MSG_t *request = msg_alloc(MSG_MQTT_UNSUBSCRIBE);
+	if (request == NULL) return;
+	text_init(&request->mqtt);
+	text_set(&request->mqtt, TEXT_TOPIC_SUB, filter, len);
+	msg_send(&mqtt_queue, request);
+}
+
+static void topic_drop_client(int num)
+{
+	xSemaphoreTake(topics_lock, portMAX_DELAY);
+	topic_remove_sink(&topics, num, topic_emptied, NULL);
+	xSemaphoreGive(topics_lock);
+}
+
+// subscribe-data to the clients whose filters match its topic
+static void topic_route(const MSG_t *msg)
+{
+	uint16_t sinks[SINK_MAX];
+	xSemaphoreTake(topics_lock, portMAX_DELAY);
+	int n = topic_match(&topics, msg_topic(msg), msg->data.topic_len, sinks, SINK_MAX);
+	xSemaphoreGive(topics_lock);
+	TRACE_I("data of %u bytes on a topic of %u for %d sinks", msg->data.payload_len, msg->data.topic_len, n);
+	if (n == 0) return;
+	static char out[16 + MSG_TEXT_SIZE];
+	// "cut" when the payload did not fit in the message
+	int len = makeSendText(out, "MQTT", (char*)msg_topic(msg), (char*)msg_payload(msg), msg->data.cut ? "cut" : "");
+	for (int i = 0; i < n; i++) {
+		if (sinks[i] == SINK_TRIGGER) {
+			session_arm(hal_clock_us());
+		} else {
+			ws_server_send_text_client(sinks[i], out, len);
+		}
+	}
+}
+
+// samples what the sessions stream, the channel of 'A', the one of equivalent-time sampling
+// and those the rules measure
+static uint16_t rules_channels;
+
+static void update_channels(void)
+{
+	uint32_t channels = session_channels() | (1 << channel) | rules_channels;
+	if (ets_client >= 0) channels |= 1 << ets_channel;
+	acquire_set_channels(channels);
+}
+
+static void ets_stop(int num)
+{
+	xSemaphoreTake(ets_lock, portMAX_DELAY);
+	if (ets_client == num) {
+		ets_client = -1;
+		if (ets_trigger_pin >= 0) hal_gpio_capture_stop();
+		ets_trigger_pin = -1;
+	}
+	xSemaphoreGive(ets_lock);
+	update_channels();
+}
+
+// 'X': equivalent-time sampling of ADC cmd->pin for client num, replacing whoever had it
+static esp_err_t ets_start(int num, const COMMAND_t *cmd)
+{
+	if (cmd->pin < 0 || cmd->pin >= ACQ_MAX_CHANNELS || cmd->value < 0 || cmd->value > 3) return ESP_ERR_INVALID_ARG;
+	int external = cmd->value == 3;
+	float level = (cmd->level - frame_offset_mv) / frame_mv_per_lsb;
+	ETS_CONFIG_t config = {
+		.start_ns = -(int32_t)(cmd->bins / 8 * cmd->bin_ns),	// an eighth of the window before the trigger
+		.bin_ns = cmd->bin_ns,
+		.bins = cmd->bins,
+		.edge = external ? ETS_TRIGGER_EXTERNAL : cmd->value,
+		.level = external || level < 0 ? 0 : level,
+		.hysteresis = 10 / frame_mv_per_lsb,
+	};
+	xSemaphoreTake(ets_lock, portMAX_DELAY);
+	if (ets_trigger_pin >= 0) hal_gpio_capture_stop();
+	ets_trigger_pin = -1;
+	ets_client = -1;
+	esp_err_t err = ets_init(&ets, &config);
+	if (err == ESP_OK && external) {
+		err = hal_gpio_capture_start(cmd->level);
+		if (err == ESP_OK) ets_trigger_pin = cmd->level;
+	}
+	if (err == ESP_OK) {
+		ets_client = num;
+		ets_channel = cmd->pin;
+		ets_reported_us = hal_clock_us();
+	}
+	xSemaphoreGive(ets_lock);
+	update_channels();
+	return err;
+}
+
+// "EQ", "ADCn", mV per bin, "bin_ns start_ns coverage_permille captures"
+static int make_ets_text(char *out)
+{
+	static uint16_t mean[ETS_MAX_BINS];
+	static uint32_t counts[ETS_MAX_BINS];
+	static char values[ETS_MAX_BINS * 6];
+	char name[16];
+	char info[64];
+	ETS_STATS_t stats;
+	int pos = 0;
+	ets_read(&ets, mean, counts);
+	ets_get_stats(&ets, &stats);
+	for (int i = 0; i < ets.config.bins; i++) {
+		if (i) values[pos++] = ',';
+		if (counts[i]) pos += sprintf(values + pos, "%u", hal_adc_raw_to_mv(mean[i]));
+	}
+	values[pos] = 0;
+	sprintf(name, "ADC%d", ets_channel);
+	sprintf(info, "%u %d %u %u", ets.config.bin_ns, ets.config.start_ns, stats.coverage_permille, stats.captures);
+	return makeSendText(out, "EQ", name, values, info);
+}
+
+// the readings of the block at the times they were really taken, then the edges up to now
+static void ets_process(const SAMPLE_BLOCK_t *block)
+{
+	static char out[ETS_MAX_BINS * 6 + 128];
+	int len = 0;
+	xSemaphoreTake(ets_lock, portMAX_DELAY);
+	int client = ets_client;
+	if (client >= 0) {
+		uint16_t samples[ACQ_BLOCK_SAMPLES];
+		int count = acquire_block_channel(block, ets_channel, samples);
+		for (int i = 0; i < count; i++) {
+			if (block->lag_us[i] == ACQ_LAG_UNKNOWN) continue;
+			int64_t t_us = block->t0_us + (int64_t)i * block->period_us + block->lag_us[i];
+			ets_add_sample(&ets, samples[i], t_us * 1000);
+		}
+		if (ets_trigger_pin >= 0) {
+			int64_t edges[32];
+			int n;
+			while ((n = hal_gpio_capture_read(edges, 32)) > 0) {
+				for (int i = 0; i < n; i++) ets_add_trigger(&ets, edges[i] * 1000);
+			}
+		}
+		if (block->t0_us - ets_reported_us >= ETS_REPORT_US) {
+			ets_reported_us = block->t0_us;
+			len = make_ets_text(out);
+		}
+	}
+	xSemaphoreGive(ets_lock);
+	if (len > 0) ws_server_send_text_client(client, out, len);
+}
+
+// bus decoding on the digital channels, for one client at a time, polled by decode_task
+#define DECODE_REPORT_US 100000
+#define DECODE_TEXT_SIZE 2048
+#define DECODE_MQTT_SIZE 440	// with the topic and t0_us still fits in a MSG_MQTT_EVENT
+#define DECODE_READ 8			// edges per hal_gpio_edges_read()
+#define DECODE_TOKEN_SIZE 24	// "dt_us:token," of one frame, at most
+
+typedef struct {
+	char text[DECODE_TEXT_SIZE];
+	int len;
+	int64_t t0_us;			// of the first frame
+	int64_t last_us;		// of the frame before the next one
+} DECODE_BATCH_t;
+
+static DECODER_t decoder;
+static SemaphoreHandle_t decode_lock;
+static int decode_client = -1;
+static int decode_mqtt;
+static uint32_t decode_dropped;
+static int64_t decode_reported_us;
+static DECODE_BATCH_t decode_ws;
+static DECODE_BATCH_t decode_pub;
+
+static const char *decode_name(DECODER_BUS_t bus)
+{
+	switch (bus) {
+		case DECODER_UART: return "UART";
+		case DECODER_I2C: return "I2C";
+		case DECODER_SPI: return "SPI";
+		default: return "";
+	}
+}
+
+// the decoder of a 'B' command, ESP_ERR_NOT_FOUND for "B 0"
+static esp_err_t decode_config(const COMMAND_t *cmd, DECODER_CONFIG_t *config, int *mqtt)
+{
+	const int *a = cmd->args;
+	memset(config, 0, sizeof(*config));
+	*mqtt = 0;
+	if (strcmp(cmd->bus, "uart") == 0 && cmd->nargs >= 2) {
+		config->bus = DECODER_UART;
+		config->uart.rx = a[0];
+		config->uart.baud = a[1];
+		config->uart.bits = cmd->nargs > 2 ? a[2] : 8;
+		config->uart.parity = cmd->nargs > 3 ? a[3] : DECODER_PARITY_NONE;
+		config->uart.stop = cmd->nargs > 4 ? a[4] : 1;
+		*mqtt = cmd->nargs > 5 && a[5];
+	} else if (strcmp(cmd->bus, "i2c") == 0 && cmd->nargs >= 2) {
+		config->bus = DECODER_I2C;
+		config->i2c.scl = a[0];
+		config->i2c.sda = a[1];
+		*mqtt = cmd->nargs > 2 && a[2];
+	} else if (strcmp(cmd->bus, "spi") == 0 && cmd->nargs >= 5) {
+		config->bus = DECODER_SPI;
+		config->spi.sck = a[0];
+		config->spi.mosi = a[1];
+		config->spi.miso = a[2];
+		config->spi.cs = a[3];
+		config->spi.mode = a[4];
+		config->spi.bits = cmd->nargs > 5 ? a[5] : 8;
+		config->spi.lsb_first = cmd->nargs > 6 && a[6];
+		*mqtt = cmd->nargs > 7 && a[7];
+	} else if (strcmp(cmd->bus, "0") == 0) {
+		return ESP_ERR_NOT_FOUND;
+	} else {
+		return ESP_ERR_INVALID_ARG;
+	}
+	return ESP_OK;
+}
+
+static void decode_stop(int num)
+{
+	xSemaphoreTake(decode_lock, portMAX_DELAY);
+	if (decode_client == num) {
+		decode_client = -1;
+		hal_gpio_edges_stop();
+	}
+	xSemaphoreGive(decode_lock);
+}
+
+// 'B': decoding for client num, replacing whoever had it
+static esp_err_t decode_start(int num, const DECODER_CONFIG_t *config, int mqtt)
+{
+	xSemaphoreTake(decode_lock, portMAX_DELAY);
+	if (decode_client >= 0) hal_gpio_edges_stop();
+	decode_client = -1;
+	esp_err_t err = decoder_init(&decoder, config);
+	if (err == ESP_OK) err = hal_gpio_edges_start(decoder.mask);
+	if (err == ESP_OK) {
+		decode_client = num;
+		decode_mqtt = mqtt;
+		decode_dropped = 0;
+		decode_reported_us = hal_clock_us();
+		decode_ws.len = 0;
+		decode_pub.len = 0;
+	}
+	xSemaphoreGive(decode_lock);
+	return err;
+}
+
+// "dt_us:token," of one frame, 0 when it does not fit in size bytes of the batch
+static int decode_append(DECODE_BATCH_t *batch, int size, const DECODER_EVENT_t *ev)
+{
+	char token[DECODE_TOKEN_SIZE];
+	int64_t t_us = ev->t_ns / 1000;
+	int64_t dt_us = batch->len ? t_us - batch->last_us : 0;
+	int len = snprintf(token, sizeof(token), "%lld:", (long long)dt_us);
+	len += decoder_format(&decoder, ev, token + len, sizeof(token) - len);
+	if (len >= (int)sizeof(token)) len = sizeof(token) - 1;
+	if (batch->len + len + 1 >= size) return 0;
+	if (batch->len == 0) batch->t0_us = t_us;
+	batch->len += sprintf(batch->text + batch->len, "%s,", token);
+	batch->last_us = t_us;
+	return len + 1;
+}
+
+// "BU", bus, frames, t0_us of the batch for the client, returns the length
+static int make_decode_text(char *out)
+{
+	char t0[24];
+	decode_ws.text[decode_ws.len - 1] = 0;	// the last ','
+	sprintf(t0, "%lld", (long long)decode_ws.t0_us);
+	int len = makeSendText(out, "BU", (char*)decode_name(decoder.config.bus), decode_ws.text, t0);
+	decode_ws.len = 0;
+	return len;
+}
+
+// the same frames to ioto/<bus>/decoded, "t0_us frames"
+static void decode_send_mqtt(void)
+{
+	if (decode_pub.len == 0) return;
+	decode_pub.text[decode_pub.len - 1] = 0;
+	MSG_t *msg = msg_alloc(MSG_MQTT_EVENT);
+	if (msg) {
+		char topic[48];
+		char payload[24 + DECODE_MQTT_SIZE];
+		int topic_len = snprintf(topic, sizeof(topic), "ioto/%s/decoded", decode_name(decoder.config.bus));
+		int payload_len = snprintf(payload, sizeof(payload), "%lld %s", (long long)decode_pub.t0_us, decode_pub.text);
+		msg_set_data(msg, topic, topic_len, payload, payload_len);
+		msg_send(&mqtt_queue, msg);
+	}
+	decode_pub.len = 0;
+}
+
+static void decode_events(const DECODER_EVENT_t *events, int n)
+{
+	for (int i = 0; i < n; i++) {
+		decode_append(&decode_ws, sizeof(decode_ws.text), &events[i]);
+		if (decode_mqtt && !decode_append(&decode_pub, DECODE_MQTT_SIZE, &events[i])) {
+			decode_send_mqtt();
+			decode_append(&decode_pub, DECODE_MQTT_SIZE, &events[i]);
+		}
+	}
+}
+
+/* Feeds the edges read so far to the decoder, as long as the batch for the
+   client has room for what they can turn into. Returns the length of a
+   "BU" message in out when the batch is full or due, sets *more when
+   edges were left in the ring. */
+static int decode_poll(int64_t now_us, char *out, int *more)
+{
+	// no edge before now is still missing from the ring once it has been read
+	HAL_GPIO_EDGE_t edges[DECODE_READ];
+	DECODER_EVENT_t events[DECODER_MAX_EVENTS];
+	int n = 0;
+	*more = 0;
+	while (sizeof(decode_ws.text) - decode_ws.len > DECODE_READ * DECODER_MAX_EVENTS * DECODE_TOKEN_SIZE) {
+		n = hal_gpio_edges_read(edges, DECODE_READ);
+		if (n == 0) break;
+		for (int i = 0; i < n; i++) {
+			decode_events(events, decoder_feed(&decoder, edges[i].t_us * 1000, edges[i].levels, events));
+		}
+	}
+	if (n > 0) {
+		*more = 1;
+	} else {
+		decode_events(events, decoder_flush(&decoder, now_us * 1000, events));
+	}
+
+	uint32_t dropped = hal_gpio_edges_dropped();
+	if (dropped != decode_dropped) {
+		ESP_LOGW(TAG, "%u edges lost, the bus is too fast", dropped - decode_dropped);
+		decode_dropped = dropped;
+	}
+	if (*more || now_us - decode_reported_us >= DECODE_REPORT_US) {
+		decode_reported_us = now_us;
+		if (decode_mqtt) decode_send_mqtt();
+		if (decode_ws.len > 0) return make_decode_text(out);
+	}
+	return 0;
+}
+
+// drains the edges of hal_gpio_edges_read() into the decoder every tick
+static void decode_task(void* pvParameters) {
+	const static char* TAG = "decode_task";
+	ESP_LOGI(TAG,"starting task");
+	static char out[DECODE_TEXT_SIZE + 64];
+	int more = 0;
+
+	for(;;) {
+		if (!more) vTaskDelay(1);
+		int len = 0;
+		xSemaphoreTake(decode_lock, portMAX_DELAY);
+		int client = decode_client;
+		more = 0;
+		if (client >= 0) len = decode_poll(hal_clock_us(), out, &more);
+		xSemaphoreGive(decode_lock);
+		// outside the lock, the websocket callback may be waiting for it
+		if (len > 0) ws_server_send_text_client(client, out, len);
+	}
+}
+
+// rules over the measurements of every block, set by the browser in the main loop, evaluated by stream_task
+#define RULES_STORAGE_KEY "rules"
+static RULES_t rules;
+static SemaphoreHandle_t rules_lock;
+static uint64_t rules_pulses;
+static int64_t pulse_count[RULES_PINS];
+static int64_t pulse_us[RULES_PINS];
+
+// after a change of the rules: what to sample and count, and the rules in storage; rules_lock held
+static void rules_changed(bool save)
+{
+	static char saved[RULES_MAX * (RULES_NAME_SIZE + RULES_TEXT_SIZE + 2)];
+	uint64_t levels, pulses;
+	rules_needs(&rules, &rules_channels, &levels, &pulses);
+	for (int pin = 0; pin < RULES_PINS; pin++) {
+		uint64_t bit = 1ULL << pin;
+		if ((pulses & bit) && !(rules_pulses & bit)) {
+			if (hal_pulse_start(pin) != ESP_OK) ESP_LOGW(TAG, "cannot count the edges of GPIO%d", pin);
+			pulse_us[pin] = 0;
+		} else if (!(pulses & bit) && (rules_pulses & bit)) {
+			hal_pulse_stop(pin);
+		}
+	}
+	rules_pulses = pulses;
+	if (!save) return;
+	int len = rules_save(&rules, saved, sizeof(saved));
+	if (len >= 0 && hal_storage_set(RULES_STORAGE_KEY, saved, len + 1) != ESP_OK) ESP_LOGW(TAG, "rules not saved");
+}
+
+static void rules_start(void)
+{
+	static char saved[RULES_MAX * (RULES_NAME_SIZE + RULES_TEXT_SIZE + 2)];
+	size_t len = sizeof(saved) - 1;
+	rules_lock = xSemaphoreCreateMutex();
+	rules_init(&rules);
+	if (hal_storage_get(RULES_STORAGE_KEY, saved, &len) == ESP_OK) {
+		saved[len] = 0;
+		ESP_LOGI(TAG, "%d rules loaded", rules_load(&rules, saved));
+	}
+	xSemaphoreTake(rules_lock, portMAX_DELAY);
+	rules_changed(false);
+	xSemaphoreGive(rules_lock);
+}
+
+// the event of a rule to ioto/rules/<name>
+static void rules_publish(const RULES_EVENT_t *event)
+{
+	int64_t t_us = event->t_us;
+	timebase_to_epoch(event->t_us, &t_us);
+	ESP_LOGI(TAG, "rule %s %s, %.1f", event->rule->name, event->active ? "fired" : "cleared", event->value);
+	MSG_t *msg = msg_alloc(MSG_MQTT_EVENT);
+	if (msg == NULL) return;
+	char topic[16 + RULES_NAME_SIZE];
+	char payload[96 + RULES_NAME_SIZE];
+	int topic_len = snprintf(topic, sizeof(topic), "ioto/rules/%s", event->rule->name);
+	int payload_len = snprintf(payload, sizeof(payload),
+		"{\"rule\":\"%s\",\"active\":%s,\"value\":%.1f,\"time_us\":%lld}",
+		event->rule->name, event->active ? "true" : "false", event->value, (long long)t_us);
+	msg_set_data(msg, topic, topic_len, payload, payload_len);
+	msg_send(&mqtt_queue, msg);
+}
+
+static void rules_process(const SAMPLE_BLOCK_t *block)
+{
+	static RULES_INPUT_t input;
+	RULES_EVENT_t events[RULES_MAX];
+	xSemaphoreTake(rules_lock, portMAX_DELAY);
+	if (rules.count == 0) {
+		xSemaphoreGive(rules_lock);
+		return;
+	}
+	uint16_t channels;
+	uint64_t levels, pulses;
+	rules_needs(&rules, &channels, &levels, &pulses);
+	int64_t now_us = hal_clock_us();
+	input.t_us = block->t0_us + (int64_t)block->count * block->period_us;
+	for (int ch = 0; ch < ACQ_MAX_CHANNELS; ch++) {
+		if ((channels & (1 << ch)) == 0) continue;
+		uint16_t samples[ACQ_BLOCK_SAMPLES];
+		int count = acquire_block_channel(block, ch, samples);
+		rules_measure(&input, ch, samples, count, frame_mv_per_lsb, frame_offset_mv);
+	}
+	input.levels = 0;
+	for (int pin = 0; pin < RULES_PINS; pin++) {
+		uint64_t bit = 1ULL << pin;
+		if ((levels & bit) && hal_gpio_get_level(pin)) input.levels |= bit;
+		if ((pulses & bit) == 0) continue;
+		// edges per second since the last block
+		int64_t count = hal_pulse_count(pin);
+		if (count < 0) continue;
+		if (pulse_us[pin] > 0 && now_us > pulse_us[pin]) {
+			input.freq_hz[pin] = (count - pulse_count[pin]) * 1e6f / (now_us - pulse_us[pin]);
+		}
+		pulse_count[pin] = count;
+		pulse_us[pin] = now_us;
+	}
+	int n = rules_eval(&rules, &input, events);
+	for (int i = 0; i < n; i++) rules_publish(&events[i]);
+	xSemaphoreGive(rules_lock);
+}
+
+// "RU", name, the rule or "deleted", "ok" or the error, to every client
+static void rules_reply(const char *name, const char *text, const char *status)
+{
+	char out[RULES_REPLY_SIZE];
+	int len = rules_reply_text(out, name, text, status);
+	ws_server_send_text_all(out, len);
+}
+
+// {"id":"rule-set","name":..,"rule":..}, {"id":"rule-delete","name":..}, {"id":"rule-list"}
+static void rules_request(const char *id, cJSON *root)
+{
+	char error[RULES_ERROR_SIZE] = "ok";
+	cJSON *name = cJSON_GetObjectItem(root, "name");
+	cJSON *text = cJSON_GetObjectItem(root, "rule");
+	xSemaphoreTake(rules_lock, portMAX_DELAY);
+	if (strcmp(id, "rule-list") == 0) {
+		for (int i = 0; i < rules.count; i++) rules_reply(rules.rule[i].name, rules.rule[i].text, "ok");
+	} else if (!cJSON_IsString(name)) {
+		rules_reply("", "", "name expected");
+	} else if (strcmp(id, "rule-delete") == 0) {
+		esp_err_t err = rules_delete(&rules, name->valuestring);
+		if (err == ESP_OK) rules_changed(true);
+		rules_reply(name->valuestring, "deleted", err == ESP_OK ? "ok" : "no such rule");
+	} else if (!cJSON_IsString(text)) {
+		rules_reply(name->valuestring, "", "rule expected");
+	} else {
+		if (rules_set(&rules, name->valuestring, text->valuestring, error, sizeof(error)) == ESP_OK) {
+			strcpy(error, "ok");
+			rules_changed(true);
+		}
+		rules_reply(name->valuestring, text->valuestring, error);
+	}
+	xSemaphoreGive(rules_lock);
+	update_channels();
+}
+
+// the frames carry the shared clock of the bench once this board follows the master, or leads followers
+static bool on_shared_clock(void)
+{
+	CLOCKSYNC_STATS_t stats;
+	clocksync_get_stats(&stats);
+	return stats.state == CLOCKSYNC_LOCKED || (stats.state == CLOCKSYNC_MASTER && stats.peers > 0);
+}
+
+// "TB offset_us synced [sync]": how to turn the t0_us of the stream frames into epoch time
+static int make_timebase_text(char *out)
+{
+	char offset[24];
+	int64_t offset_us = timebase_offset_us();
+	bool synced = timebase_generation() != 0;
+	if (clocksync_state() == CLOCKSYNC_LOCKED) synced = clocksync_epoch_offset(&offset_us);
+	sprintf(offset, "%lld", (long long)offset_us);
+	return makeSendText(out, "TB", offset, synced ? "1" : "0", on_shared_clock() ? "sync" : "");
+}
+
+// the points of the table shape; the callback runs on one task, the buffer is not shared
+static void wavetable_received(uint8_t num, const uint8_t *msg, size_t len)
+{
+	static int16_t points[WAVEGEN_MAX_POINTS];
+	char out[64];
+	char count_str[16] = "";
+	int count = protocol_get_wavetable(msg, len, points, WAVEGEN_MAX_POINTS);
+	esp_err_t err = count < 0 ? ESP_ERR_INVALID_SIZE : wavegen_set_table(points, count);
+	if (err == ESP_OK) {
+		sprintf(count_str, "%i", count);
+		ESP_LOGI(TAG, "client %i uploaded a wave of %i points", num, count);
+	} else {
+		ESP_LOGW(TAG, "client %i sent a bad wave table: %s", num, esp_err_to_name(err));
+	}
+	int out_len = makeSendText(out, "WG", "table", count_str, err == ESP_OK ? "ok" : "error");
+	ws_server_send_text_client_from_callback(num, out, out_len);
+}
+
+// the steps of a digital pattern, replacing the one there was; 'P' plays it
+static void pattern_received(uint8_t num, const uint8_t *msg, size_t len)
+{
+	static PATTERN_STEP_t steps[PATTERN_MAX_STEPS];
+	char out[64];
+	char count_str[16] = "";
+	int count = protocol_get_pattern(msg, len, steps, PATTERN_MAX_STEPS);
+	esp_err_t err = count < 0 ? ESP_ERR_INVALID_SIZE : pattern_set(steps, count);
+	if (err == ESP_OK) {
+		sprintf(count_str, "%i", count);
+		ESP_LOGI(TAG, "client %i uploaded a pattern of %i steps", num, count);
+	} else {
+		ESP_LOGW(TAG, "client %i sent a bad pattern: %s", num, esp_err_to_name(err));
+	}
+	int out_len = makeSendText(out, "PG", "pattern", count_str, err == ESP_OK ? "ok" : "error");
+	ws_server_send_text_client_from_callback(num, out, out_len);
+}
+
+// whatever the way a client went, what it had goes with it
+static void client_closed(int num)
+{
+	session_close(num);
+	flow_close(num);
+	ets_stop(num);
+	decode_stop(num);
+	topic_drop_client(num);
+}
+
+// "GP", "GPIOn", the command, "bad pin" answers 'R', 'O', 'I' and 'G' on a pin the chip does not have
+static void gpio_refused(uint8_t num, int pin, const COMMAND_t *cmd)
+{
+	char out[64];
+	char gpio_num[16];
+	char op[2] = { cmd->op, 0 };
+	sprintf(gpio_num, "GPIO%i", pin);
+	int len = makeSendText(out, "GP", gpio_num, op, "bad pin");
+	len = protocol_append_seq(out, len, cmd);
+	ws_server_send_text_client_from_callback(num,out,len);
+}
+
+// handles websocket events
+void websocket_callback(uint8_t num,WEBSOCKET_TYPE_t type,char* msg,uint64_t len) {
+	const static char* TAG = "websocket_callback";
+	int value;
+	uint32_t reading;
+
+	switch(type) {
+		case WEBSOCKET_CONNECT:
+			ESP_LOGI(TAG,"client %i connected!",num);
+			session_open(num);
+			flow_open(num);
+			{
+				char out[64];
+				int len = make_timebase_text(out);
+				ws_server_send_text_client_from_callback(num,out,len);
+				// the last seconds, before the client asks for any live frame
+				int64_t start_us = hal_clock_us();
+				len = history_snapshot(history_msg, sizeof(history_msg), CODEC_RICE);
+				if (len > 0) {
+					ws_server_send_bin_client_from_callback(num, (char*)history_msg, len);
+					TRACE_D("client %i history of %i bytes in %i us", num, len, (int)(hal_clock_us() - start_us));
+				}
+			}
+			break;
+		case WEBSOCKET_DISCONNECT_EXTERNAL:
+			ESP_LOGI(TAG,"client %i sent a disconnect message",num);
+			client_closed(num);
+			break;
+		case WEBSOCKET_DISCONNECT_INTERNAL:
+			ESP_LOGI(TAG,"client %i was disconnected",num);
+			client_closed(num);
+			break;
+		case WEBSOCKET_DISCONNECT_ERROR:
+			ESP_LOGI(TAG,"client %i was disconnected due to an error",num);
+			client_closed(num);
+			break;
+		case WEBSOCKET_TEXT:
+			if(len) { // if the message length was greater than zero
+				COMMAND_t cmd;
+				protocol_parse(msg, len, &cmd);
+				// the pin a client works with is its own, not shared with the other clients
+				if (cmd.op && strchr("ROIGA", cmd.op)) session_set_pin(num, cmd.pin);
+				int gpio_pin = session_pin(num);
+				// a pin the chip does not have goes no further, not to the HAL nor into a mask
+				if (cmd.op && strchr("ROIG", cmd.op) && !hal_gpio_valid(gpio_pin)) {
+					gpio_refused(num, gpio_pin, &cmd);
+					cmd.op = 0;
+				}
+				switch(cmd.op) {
+					case 'R':
+						TRACE_I("client %i reseting GPIO%i", num, gpio_pin);
+						hal_gpio_reset(gpio_pin);
+						input_pins &= ~(1ULL << gpio_pin);
+						break;
+					case 'O':
+						value = cmd.value;
+						TRACE_I("client %i setting GPIO%i as output %i", num, gpio_pin, value);
+						// a pin that already is an output is not reconfigured, it would glitch
+						if (pattern_write(1ULL << gpio_pin, (uint64_t)(value != 0) << gpio_pin) != ESP_OK) {
+							ESP_LOGW(TAG, "client %i: GPIO%i cannot be an output", num, gpio_pin);
+						} else {
+							input_pins &= ~(1ULL << gpio_pin);
+						}
+						break;
+					case 'M': {
+						char out[64];
+						char mask_str[20];
+						TRACE_I("client %i writing %x to the GPIOs %x", num, (unsigned)cmd.mask[1], (unsigned)cmd.mask[0]);
+						esp_err_t err = pattern_write(cmd.mask[0], cmd.mask[1]);
+						if (err == ESP_OK) input_pins &= ~cmd.mask[0];
+						sprintf(mask_str, "%llx", (unsigned long long)cmd.mask[0]);
+						int len = makeSendText(out, "PG", "write", mask_str, err == ESP_OK ? "ok" : "error");
+						len = protocol_append_seq(out, len, &cmd);
+						ws_server_send_text_client_from_callback(num,out,len);
+						break;
+					}
+					case 'P': {
+						char out[80];
+						char played[48];
+						esp_err_t err = ESP_OK;
+						PATTERN_STATS_t stats;
+						if (cmd.value == 0) {
+							pattern_stop();
+						} else {
+							err = pattern_play(cmd.value);
+							if (err != ESP_OK) ESP_LOGW(TAG, "client %i cannot play the pattern: %s", num, esp_err_to_name(err));
+						}
+						// on a stop, what the last run did
+						pattern_get_stats(&stats);
+						sprintf(played, "%u %lld %lld", (unsigned)stats.played, (long long)stats.late_max_us, (long long)stats.late_mean_us);
+						int len = makeSendText(out, "PG", cmd.value ? "play" : "stop", played,
+							err != ESP_OK ? "error" : stats.playing ? "on" : "off");
+						len = protocol_append_seq(out, len, &cmd);
+						ws_server_send_text_client_from_callback(num,out,len);
+						break;
+					}
+					case 'I':
+						TRACE_I("client %i setting GPIO%i as input", num, gpio_pin);
+						hal_gpio_reset(gpio_pin);
+						/* Set the GPIO as a push/pull output */
+						hal_gpio_set_direction(gpio_pin, HAL_GPIO_MODE_INPUT);
+						reading = hal_gpio_get_level(gpio_pin);
+						TRACE_D("GPIO%i value %i", gpio_pin, reading);
+						input_pins |= 1ULL << gpio_pin;
+						// adc1_config_width(width);
+						// adc1_config_channel_atten(gpio_pin, atten);
+						break;
+					case 'G': {
+						char strftime_buf[64];
+						timebase_format(hal_clock_us(), strftime_buf, sizeof(strftime_buf));
+						reading = hal_gpio_get_level(gpio_pin);
+						TRACE_D("client %i GPIO%i value %i", num, gpio_pin, reading);
+
+						char out[64];
+						char gpio_num[16];
+						char read_str[12];
+						sprintf(gpio_num, "GPIO%i", gpio_pin);
+						sprintf(read_str, "%i", reading);
+						int len = makeSendText(out, "IN", gpio_num, read_str, strftime_buf);
+						len = protocol_append_seq(out, len, &cmd);
+						ws_server_send_text_client_from_callback(num,out,len);
+						break;
+					}
+					case 'A': {
+						// sampled by acquire_task, the callback never touches the ADC
+						uint32_t voltage = acquire_latest_mv(channel);
+
+						char strftime_buf[64];
+						timebase_format(hal_clock_us(), strftime_buf, sizeof(strftime_buf));
+						TRACE_D("client %i ADC%i value %u", num, gpio_pin, voltage);
+
+						char out[64];
+						char gpio_num[16];
+						char read_str[12];
+						sprintf(gpio_num, "GPIO%i", gpio_pin);
+						sprintf(read_str, "%u", voltage);
+						int len = makeSendText(out, "AN", gpio_num, read_str, strftime_buf);
+						len = protocol_append_seq(out, len, &cmd);
+						ws_server_send_text_client_from_callback(num,out,len);
+						break;
+					}
+					case 'S':
+						ESP_LOGI(TAG, "client %i streaming ADC%i %s", num, cmd.pin, cmd.value ? "on" : "off");
+						if (session_set_channel(num, cmd.pin, cmd.value) != ESP_OK) ESP_LOGW(TAG, "cannot stream ADC%i", cmd.pin);
+						update_channels();
+						break;
+					case 'E':
+						if (session_set_codec(num, cmd.value) != ESP_OK) {
+							ESP_LOGW(TAG, "unknown encoding %i", cmd.value);
+							break;
+						}
+						ESP_LOGI(TAG, "client %i streaming as %s", num, codec_name(cmd.value));
+						break;
+					case 'D':
+						if (session_set_decimation(num, cmd.value) != ESP_OK) ESP_LOGW(TAG, "bad decimation %i", cmd.value);
+						break;
+					case 'T':
+						if (session_set_trigger(num, cmd.value, cmd.level) != ESP_OK) ESP_LOGW(TAG, "bad trigger %i", cmd.value);
+						break;
+					case 'X': {
+						char out[64];
+						char name[16];
+						const char *status = "off";
+						if (cmd.bin_ns == 0 || cmd.value == 0) {
+							ets_stop(num);
+						} else if (ets_start(num, &cmd) == ESP_OK) {
+							status = "on";
+						} else {
+							status = "error";
+						}
+						ESP_LOGI(TAG, "client %i equivalent-time sampling of ADC%i %s", num, cmd.pin, status);
+						sprintf(name, "ADC%i", cmd.pin);
+						int len = makeSendText(out, "XS", name, (char*)status, "");
+						len = protocol_append_seq(out, len, &cmd);
+						ws_server_send_text_client_from_callback(num,out,len);
+						break;
+					}
+					case 'B': {
+						char out[64];
+						const char *status = "off";
+						DECODER_CONFIG_t config;
+						int mqtt;
+						esp_err_t err = decode_config(&cmd, &config, &mqtt);
+						if (err == ESP_ERR_NOT_FOUND) {
+							decode_stop(num);
+						} else if (err == ESP_OK && decode_start(num, &config, mqtt) == ESP_OK) {
+							status = "on";
+						} else {
+							status = "error";
+						}
+						ESP_LOGI(TAG, "client %i decoding %s %s", num, cmd.bus, status);
+						int len = makeSendText(out, "BS", (char*)decode_name(config.bus), (char*)status, "");
+						len = protocol_append_seq(out, len, &cmd);
+						ws_server_send_text_client_from_callback(num,out,len);
+						break;
+					}
+					case 'U': {
+						// the reply tells the client whether its datagrams are coming
+						char out[64];
+						char dest[32];
+						const char *status = "off";
+						if (cmd.port == 0) {
+							udp_stream_stop();
+						} else if (udp_stream_start(cmd.host, cmd.port, cmd.value) == ESP_OK) {
+							status = "on";
+						} else {
+							ESP_LOGW(TAG, "cannot stream to %s:%i as %i", cmd.host, cmd.port, cmd.value);
+							status = "error";
+						}
+						snprintf(dest, sizeof(dest), "%s:%i", cmd.host, cmd.port);
+						int len = makeSendText(out, "UD", dest, (char*)codec_name(udp_stream_codec()), (char*)status);
+						len = protocol_append_seq(out, len, &cmd);
+						ws_server_send_text_client_from_callback(num,out,len);
+						break;
+					}
+					case 'L':
+						udp_stream_report(cmd.counts[0], cmd.counts[1], cmd.counts[2]);
+						break;
+					case 'K':
+						flow_ack(num, cmd.counts[0], hal_clock_us());
+						break;
+					case 'C': {
+						// only the master coordinates, a follower answers with an error
+						char out[96];
+						char id_str[12] = "0";
+						char at[24] = "0";
+						char peers_str[12] = "error";
+						uint32_t id;
+						int64_t at_us;
+						int peers;
+						esp_err_t err = clocksync_arm_all(cmd.value, &id, &at_us, &peers);
+						if (err == ESP_OK) {
+							sprintf(id_str, "%u", (unsigned)id);
+							sprintf(at, "%lld", (long long)at_us);
+							sprintf(peers_str, "%i", peers);
+							ESP_LOGI(TAG, "client %i capture %u on %i boards in %i ms", num, (unsigned)id, peers + 1, cmd.value);
+						} else {
+							ESP_LOGW(TAG, "client %i cannot arm a capture: %s", num, esp_err_to_name(err));
+						}
+						int len = makeSendText(out, "CS", id_str, at, peers_str);
+						len = protocol_append_seq(out, len, &cmd);
+						ws_server_send_text_client_from_callback(num,out,len);
+						break;
+					}
+					case 'W': {
+						char out[80];
+						char freq[24] = "";
+						const char *status = "off";
+						WAVEGEN_CONFIG_t wave = {
+							.shape = wavegen_shape(cmd.wave),
+							.freq_hz = cmd.freq_hz[0],
+							.to_hz = cmd.freq_hz[1],
+							.sweep_ms = cmd.args[2],
+							.amplitude_mv = cmd.args[0],
+							.offset_mv = cmd.args[1],
+						};
+						esp_err_t err = wave.shape == WAVEGEN_SHAPE_MAX ? ESP_ERR_INVALID_ARG : wavegen_set(&wave);
+						if (err != ESP_OK) {
+							ESP_LOGW(TAG, "client %i cannot play %s: %s", num, cmd.wave, esp_err_to_name(err));
+							status = "error";
+						} else if (wave.shape != WAVEGEN_OFF) {
+							sprintf(freq, "%.3f", wavegen_freq_hz());
+							status = "on";
+						}
+						int len = makeSendText(out, "WG", cmd.wave, freq, (char*)status);
+						len = protocol_append_seq(out, len, &cmd);
+						ws_server_send_text_client_from_callback(num,out,len);
+						break;
+					}
+				}
+				TRACE_D("client %i message of %i bytes, '%c'", num, (int)len, cmd.op ? cmd.op : '?');
+				// only the JSON requests go on to the main loop, without waiting for it
+				if (cmd.op == '{') {
+					if (len >= MSG_TEXT_SIZE) {
+						ESP_LOGE(TAG, "request of %i bytes too long", (int)len);
+						break;
+					}
+					MSG_t *request = msg_alloc(MSG_WS_JSON);
+					if (request == NULL) break;
+					memcpy(request->text.text, msg, len);
+					request->text.text[len] = 0;
+					request->text.len = len;
+					request->text.client = num;
+					msg_send(&main_queue, request);
+				}
+			}
+			break;
+		case WEBSOCKET_BIN:
+			TRACE_I("client %i sent a binary message of %i bytes", num, (int)len);
+			if (len > 0 && msg[0] == PROTOCOL_PATTERN_MAGIC) {
+				pattern_received(num, (const uint8_t*)msg, len);
+			} else {
+				wavetable_received(num, (const uint8_t*)msg, len);
+			}
+			break;
+		case WEBSOCKET_PING:
+			TRACE_I("client %i pinged us with %i bytes", num, (int)len);
+			break;
+		case WEBSOCKET_PONG:
+			TRACE_I("client %i responded to the ping", num);
+			break;
+	}
+}
+
+// the trace rings, oldest record first, formatted while they are sent
+static void send_trace(struct netconn *conn)
+{
+	const static char TEXT_HEADER[] = "HTTP/1.1 200 OK\nContent-type: text/plain\n\n";
+	TRACE_READER_t reader;
+	TRACE_RECORD_t record;
+	char out[512];
+	size_t used = 0;
+	netconn_write(conn, TEXT_HEADER, sizeof(TEXT_HEADER)-1, NETCONN_NOCOPY);
+	trace_reader_init(&reader, 1);
+	for (int more = 1; more; ) {
+		more = trace_read(&reader, &record);
+		// a formatted record is shorter than 160 bytes, or cut there
+		if (sizeof(out) - used < 160 || !more) {
+			netconn_write(conn, out, used, NETCONN_COPY);
+			used = 0;
+		}
+		if (more) {
+			int len = trace_format(&record, out + used, 160);
+			if (len > 0) used += len < 160 ? len : 159;
+		}
+	}
+	used = snprintf(out, sizeof(out), "%u records lost\n", (unsigned)reader.lost);
+	netconn_write(conn, out, used, NETCONN_COPY);
+}
+
+// serves any clients
+static void http_serve(struct netconn *conn) {
+	const static char* TAG = "http_server";
+	const static char HTML_HEADER[] = "HTTP/1.1 200 OK\nContent-type: text/html\n\n";
+	const static char ERROR_HEADER[] = "HTTP/1.1 404 Not Found\nContent-type: text/html\n\n";
+	const static char JS_HEADER[] = "HTTP/1.1 200 OK\nContent-type: text/javascript\n\n";
+	const static char CSS_HEADER[] = "HTTP/1.1 200 OK\nContent-type: text/css\n\n";
+	//const static char PNG_HEADER[] = "HTTP/1.1 200 OK\nContent-type: image/png\n\n";
+	const static char ICO_HEADER[] = "HTTP/1.1 200 OK\nContent-type: image/x-icon\n\n";
+	//const static char PDF_HEADER[] = "HTTP/1.1 200 OK\nContent-type: application/pdf\n\n";
+	//const static char EVENT_HEADER[] = "HTTP/1.1 200 OK\nContent-Type: text/event-stream\nCache-Control: no-cache\nretry: 3000\n\n";
+	struct netbuf* inbuf;
+	static char* buf;
+	static uint16_t buflen;
+	static err_t err;
+
+	// default page
+	extern const uint8_t root_html_start[] asm("_binary_root_html_start");
+	extern const uint8_t root_html_end[] asm("_binary_root_html_end");
+	const uint32_t root_html_len = root_html_end - root_html_start;
+
+	// main.js
+	extern const uint8_t main_js_start[] asm("_binary_main_js_start");
+	extern const uint8_t main_js_end[] asm("_binary_main_js_end");
+	const uint32_t main_js_len = main_js_end - main_js_start;
+
+	// scope.js
+	extern const uint8_t scope_js_start[] asm("_binary_scope_js_start");
+	extern const uint8_t scope_js_end[] asm("_binary_scope_js_end");
+	const uint32_t scope_js_len = scope_js_end - scope_js_start;
+
+	// decode.js
+	extern const uint8_t decode_js_start[] asm("_binary_decode_js_start");
+	extern const uint8_t decode_js_end[] asm("_binary_decode_js_end");
+	const uint32_t decode_js_len = decode_js_end - decode_js_start;
+
+	// main.css
+	extern const uint8_t main_css_start[] asm("_binary_main_css_start");
+	extern const uint8_t main_css_end[] asm("_binary_main_css_end");
+	const uint32_t main_css_len = main_css_end - main_css_start;
+
+	// bulma.css
+	extern const uint8_t bulma_css_start[] asm("_binary_bulma_css_start");
+	extern const uint8_t bulma_css_end[] asm("_binary_bulma_css_end");
+	const uint32_t bulma_css_len = bulma_css_end - bulma_css_start;
+
+	// favicon.ico
+	extern const uint8_t favicon_ico_start[] asm("_binary_favicon_ico_start");
+	extern const uint8_t favicon_ico_end[] asm("_binary_favicon_ico_end");
+	const uint32_t favicon_ico_len = favicon_ico_end - favicon_ico_start;
+
+	// error page
+	extern const uint8_t error_html_start[] asm("_binary_error_html_start");
+	extern const uint8_t error_html_end[] asm("_binary_error_html_end");
+	const uint32_t error_html_len = error_html_end - error_html_start;
+
+	netconn_set_recvtimeout(conn,1000); // allow a connection timeout of 1 second
+	TRACE_D("reading from client");
+	err = netconn_recv(conn, &inbuf);
+	TRACE_D("read from client, err %i", err);
+	if(err==ERR_OK) {
+		netbuf_data(inbuf, (void**)&buf, &buflen);
+		if(buf) {
+
+			TRACE_V("request of %u bytes", buflen);
+			// default page
+			if		 (strstr(buf,"GET / ")
+					&& !strstr(buf,"Upgrade: websocket")) {
+				TRACE_I("sending /");
+				netconn_write(conn, HTML_HEADER, sizeof(HTML_HEADER)-1,NETCONN_NOCOPY);
+				netconn_write(conn, root_html_start,root_html_len,NETCONN_NOCOPY);
+				netconn_close(conn);
+				netconn_delete(conn);
+				netbuf_delete(inbuf);
+			}
+
+			// default page websocket
+			else if(strstr(buf,"GET / ")
+					 && strstr(buf,"Upgrade: websocket")) {
+				TRACE_I("websocket requested on /");
+				ws_server_add_client(conn,buf,buflen,"/",websocket_callback);
+				netbuf_delete(inbuf);
+			}
+
+			else if(strstr(buf,"GET /main.js ")) {
+				TRACE_I("sending /main.js");
+				netconn_write(conn, JS_HEADER, sizeof(JS_HEADER)-1,NETCONN_NOCOPY);
+				netconn_write(conn, main_js_start, main_js_len,NETCONN_NOCOPY);
+				netconn_close(conn);
+				netconn_delete(conn);
+				netbuf_delete(inbuf);
+			}
+
+			else if(strstr(buf,"GET /scope.js ")) {
+				TRACE_I("sending /scope.js");
+				netconn_write(conn, JS_HEADER, sizeof(JS_HEADER)-1,NETCONN_NOCOPY);
+				netconn_write(conn, scope_js_start, scope_js_len,NETCONN_NOCOPY);
+				netconn_close(conn);
+				netconn_delete(conn);
+				netbuf_delete(inbuf);
+			}
+
+			else if(strstr(buf,"GET /decode.js ")) {
+				TRACE_I("sending /decode.js");
+				netconn_write(conn, JS_HEADER, sizeof(JS_HEADER)-1,NETCONN_NOCOPY);
+				netconn_write(conn, decode_js_start, decode_js_len,NETCONN_NOCOPY);
+				netconn_close(conn);
+				netconn_delete(conn);
+				netbuf_delete(inbuf);
+			}
+
+			else if(strstr(buf,"GET /main.css ")) {
+				TRACE_I("sending /main.css");
+				netconn_write(conn, CSS_HEADER, sizeof(CSS_HEADER)-1,NETCONN_NOCOPY);
+				netconn_write(conn, main_css_start, main_css_len,NETCONN_NOCOPY);
+				netconn_close(conn);
+				netconn_delete(conn);
+				netbuf_delete(inbuf);
+			}
+
+			else if(strstr(buf,"GET /bulma.css ")) {
+				TRACE_I("sending /bulma.css");
+				netconn_write(conn, CSS_HEADER, sizeof(CSS_HEADER)-1,NETCONN_NOCOPY);
+				netconn_write(conn, bulma_css_start, bulma_css_len,NETCONN_NOCOPY);
+				netconn_close(conn);
+				netconn_delete(conn);
+				netbuf_delete(inbuf);
+			}
+
+			else if(strstr(buf,"GET /favicon.ico ")) {
+				TRACE_I("sending /favicon.ico");
+				netconn_write(conn,ICO_HEADER,sizeof(ICO_HEADER)-1,NETCONN_NOCOPY);
+				netconn_write(conn,favicon_ico_start,favicon_ico_len,NETCONN_NOCOPY);
+				netconn_close(conn);
+				netconn_delete(conn);
+				netbuf_delete(inbuf);
+			}
+
+			else if(strstr(buf,"GET /trace ")) {
+				TRACE_I("sending /trace");
+				send_trace(conn);
+				netconn_close(conn);
+				netconn_delete(conn);
+				netbuf_delete(inbuf);
+			}
+
+			else if(strstr(buf,"POST /post ")) {
+				TRACE_I("POST /post");
+#if 0
+				netconn_write(conn, HTML_HEADER, sizeof(HTML_HEADER)-1,NETCONN_NOCOPY);
+				netconn_write(conn, root_html_start,root_html_len,NETCONN_NOCOPY);
+				netconn_close(conn);
+				netconn_delete(conn);
+				netbuf_delete(inbuf);
+#endif
+			}
+
+			else if(strstr(buf,"GET /")) {
+				ESP_LOGE(TAG,"Unknown request, sending error page: %s",buf);
+				netconn_write(conn, ERROR_HEADER, sizeof(ERROR_HEADER)-1,NETCONN_NOCOPY);
+				netconn_write(conn, error_html_start, error_html_len,NETCONN_NOCOPY);
+				netconn_close(conn);
+				netconn_delete(conn);
+				netbuf_delete(inbuf);
+			}
+
+			else {
+				ESP_LOGE(TAG,"Unknown request");
+				netconn_close(conn);
+				netconn_delete(conn);
+				netbuf_delete(inbuf);
+			}
+		}
+		else {
+			ESP_LOGI(TAG,"Unknown request (empty?...)");
+			netconn_close(conn);
+			netconn_delete(conn);
+			netbuf_delete(inbuf);
+		}
+	}
+	else { // if err==ERR_OK
+		ESP_LOGI(TAG,"error on read, closing connection");
+		netconn_close(conn);
+		netconn_delete(conn);
+		netbuf_delete(inbuf);
+	}
+}
+
+// handles clients when they first connect. passes to a queue
+static void server_task(void* pvParameters) {
+	const static char* TAG = "server_task";
+	SERVER_PARAM_t *task_parameter = (SERVER_PARAM_t *)pvParameters;
+	ESP_LOGI(TAG, "Start task_parameter=%s", task_parameter->ip);
+	char url[80];
+	sprintf(url, "http://%s:%u", task_parameter->ip, task_parameter->port);
+	ESP_LOGI(TAG, "Starting server on %s", url);
+
+	struct netconn *conn, *newconn;
+	static err_t err;
+	client_queue = xQueueCreate(client_queue_size,sizeof(struct netconn*));
+	configASSERT( client_queue );
+
+	conn = netconn_new(NETCONN_TCP);
+	netconn_bind(conn,NULL,task_parameter->port);
+	netconn_listen(conn);
+	ESP_LOGI(TAG,"server listening");
+	do {
+		err = netconn_accept(conn, &newconn);
+		ESP_LOGI(TAG,"new client");
+		if(err == ERR_OK) {
+			xQueueSendToBack(client_queue,&newconn,portMAX_DELAY);
+			//http_serve(newconn);
+		}
+	} while(err == ERR_OK);
+	netconn_close(conn);
+	netconn_delete(conn);
+	ESP_LOGE(TAG,"task ending, rebooting board");
+	esp_restart();
+}
+
+// receives clients from queue, handles them
+static void server_handle_task(void* pvParameters) {
+	const static char* TAG = "server_handle_task";
+	struct netconn* conn;
+	ESP_LOGI(TAG,"task starting");
+	for(;;) {
+		xQueueReceive(client_queue,&conn,portMAX_DELAY);
+		if(!conn) continue;
+		http_serve(conn);
+	}
+	vTaskDelete(NULL);
+}
+
+/*
+v1:ID/NAME
+v2:id/name
+v3:propaty
+v4:value
+*/
+
+
+// tells the browsers when the SNTP anchor arrives (or moves), which may be long after boot,
+// and when the frames move to the clock of the bench master or off it
+static void time_task(void* pvParameters) {
+	const static char* TAG = "time_task";
+	ESP_LOGI(TAG,"starting task");
+	uint32_t generation = 0;
+	bool shared = false;
+	int64_t master_offset = 0;
+
+	for(;;) {
+		int64_t offset = 0;
+		clocksync_epoch_offset(&offset);
+		if (timebase_generation() != generation || on_shared_clock() != shared || offset != master_offset) {
+			generation = timebase_generation();
+			shared = on_shared_clock();
+			master_offset = offset;
+			char strftime_buf[64];
+			timebase_format(hal_clock_us(), strftime_buf, sizeof(strftime_buf));
+			ESP_LOGI(TAG, "The current time is: %s", strftime_buf);
+
+			char out[64];
+			int len = make_timebase_text(out);
+			int clients = ws_server_send_text_all(out,len);
+			if(clients > 0) {
+				ESP_LOGI(TAG,"sent: \"%s\" to %i clients",out,clients);
+			}
+		}
+		vTaskDelay(1000/portTICK_PERIOD_MS);
+	}
+}
+
+// a binary stream frame of one channel of the block, returns its length or -1
+static int encode_frame(uint8_t *frame, size_t size, const SAMPLE_BLOCK_t *block, int ch, CODEC_t codec)
+{
+	uint16_t samples[ACQ_BLOCK_SAMPLES];
+	int count = acquire_block_channel(block, ch, samples);
+	protocol_put_frame_header(frame, &(STREAM_FRAME_t) {
+		.channel = ch,
+		.bits = hal_adc_bits(),
+		.seq = block->seq,
+		.period_us = block->period_us,
+		.mv_per_lsb = frame_mv_per_lsb,
+		.offset_mv = frame_offset_mv,
+		.t0_us = clocksync_to_shared(block->t0_us),
+	});
+	int len = codec_encode(codec, samples, count, hal_adc_bits(),
+		frame + PROTOCOL_FRAME_HEADER_SIZE, size - PROTOCOL_FRAME_HEADER_SIZE);
+	return len < 0 ? -1 : PROTOCOL_FRAME_HEADER_SIZE + len;
+}
+
+// the consumer of acquire_task: feeds the sample blocks to the sessions of the browsers,
+// and every channel of them to the UDP client while there is one
+static void stream_task(void* pvParameters) {
+	const static char* TAG = "stream_task";
+	ESP_LOGI(TAG,"starting task");
+	uint32_t expected_seq = 0;
+	uint32_t missed = 0;
+	uint32_t reported_overruns = 0;
+
+	for(;;) {
+		const SAMPLE_BLOCK_t *block = acquire_peek();
+		if (block == NULL) {
+			vTaskDelay(1);
+			continue;
+		}
+		missed += block->seq - expected_seq;
+		expected_seq = block->seq + 1;
+
+		CODEC_t udp_codec = udp_stream_codec();
+		if (udp_codec != CODEC_TEXT) {
+			static uint8_t frame[PROTOCOL_FRAME_HEADER_SIZE + CODEC_MAX_SIZE(ACQ_BLOCK_SAMPLES)];
+			for (int ch = 0; ch < ACQ_MAX_CHANNELS; ch++) {
+				if ((block->channels & (1 << ch)) == 0) continue;
+				int frame_len = encode_frame(frame, sizeof(frame), block, ch, udp_codec);
+				if (frame_len > 0) udp_stream_send(frame, frame_len);
+			}
+		}
+		history_add(block);
+		session_process(block);
+		flow_update(hal_clock_us());
+		ets_process(block);
+		rules_process(block);
+		acquire_release();
+
+		ACQ_STATS_t stats;
+		acquire_get_stats(&stats);
+		if (stats.overruns != reported_overruns) {
+			ESP_LOGW(TAG, "%u blocks dropped so far (%u missed here), %u late wake ups",
+				stats.overruns, missed, stats.late);
+			reported_overruns = stats.overruns;
+		}
+	}
+}
+
+// how long the send blocked tells the rate control how far behind the link is
+static int session_send(int num, const void *data, size_t len, int binary)
+{
+	int64_t start_us = hal_clock_us();
+	int sent = binary ? ws_server_send_bin_client(num, (char*)data, len) : ws_server_send_text_client(num, (char*)data, len);
+	int64_t end_us = hal_clock_us();
+	if (sent) flow_sent(num, end_us, end_us - start_us, len);
+	return sent;
+}
+
+#define FLOW_INTERVAL_US 250000	// a few acknowledgements of the browser each
+
+// the rate control thins the streams of num, and tells it
+static void flow_apply(int num, int factor, uint32_t latency_us)
+{
+	char out[48];
+	char factor_str[12];
+	char latency_str[12];
+	if (session_set_thinning(num, factor) != ESP_OK) return;
+	sprintf(factor_str, "%d", factor);
+	sprintf(latency_str, "%u", (unsigned)latency_us);
+	int len = makeSendText(out, "FC", factor_str, latency_str, "");
+	ws_server_send_text_client(num, out, len);
+}
+
+static uint16_t clocksync_port = CONFIG_CLOCKSYNC_PORT;
+static char clocksync_master[16] = CONFIG_CLOCKSYNC_MASTER;
+static uint16_t clocksync_master_port = CONFIG_CLOCKSYNC_PORT;
+
+void app_set_clocksync(uint16_t port, const char *master, uint16_t master_port)
+{
+	clocksync_port = port;
+	snprintf(clocksync_master, sizeof(clocksync_master), "%s", master ? master : "");
+	clocksync_master_port = master_port;
+}
+
+// a capture the clock master asked for: the sessions with a trigger take it at the same instant on every board
+static void capture_armed(uint32_t id, int64_t mono_us)
+{
+	TRACE_I("capture %u armed, in %i ms", id, (int)((mono_us - hal_clock_us()) / 1000));
+	session_arm(mono_us);
+}
+
+static esp_err_t dac_start(uint32_t rate_hz, size_t len, void (*refill)(uint8_t *buf, size_t len, void *arg), void *arg)
+{
+	return hal_dac_stream_start(CONFIG_WAVEGEN_DAC_CHANNEL, rate_hz, len, refill, arg);
+}
+
+// the levels of the pins set as inputs, for the history
+static uint64_t input_levels(uint64_t *pins)
+{
+	uint64_t mask = input_pins;
+	uint64_t levels = 0;
+	for (uint64_t m = mask; m; m &= m - 1) {
+		int pin = __builtin_ctzll(m);
+		if (hal_gpio_get_level(pin)) levels |= 1ULL << pin;
+	}
+	*pins = mask;
+	return levels;
+}
+
+void app_start(const char *ip, uint16_t port)
+{
+	int max_raw = (1 << hal_adc_bits()) - 1;
+	frame_offset_mv = hal_adc_raw_to_mv(0);
+	frame_mv_per_lsb = ((float)hal_adc_raw_to_mv(max_raw) - frame_offset_mv) / max_raw;
+	FLOW_IO_t flow_io = {
+		.target_us = CONFIG_FLOW_TARGET_MS * 1000,
+		.interval_us = FLOW_INTERVAL_US,
+		.apply = flow_apply,
+	};
+	SESSION_IO_t session_io = {
+		.send = session_send,
+		.raw_to_mv = hal_adc_raw_to_mv,
+		.bits = hal_adc_bits(),
+		.mv_per_lsb = frame_mv_per_lsb,
+		.offset_mv = frame_offset_mv,
+		.stamp = clocksync_to_shared,
+	};
+	HISTORY_IO_t history_io = {
+		.channel = channel,
+		.bits = hal_adc_bits(),
+		.mv_per_lsb = frame_mv_per_lsb,
+		.offset_mv = frame_offset_mv,
+		.levels = input_levels,
+		.stamp = clocksync_to_shared,
+	};
+	CLOCKSYNC_IO_t clocksync_io = {
+		.clock_us = hal_clock_us,
+		.arm = capture_armed,
+	};
+	WAVEGEN_IO_t wavegen_io = {
+		.start = dac_start,
+		.stop = hal_dac_stream_stop,
+		.full_scale_mv = HAL_DAC_FULL_SCALE_MV,
+		.bits = HAL_DAC_BITS,
+	};
+	PATTERN_IO_t pattern_io = {
+		.output = hal_gpio_output,
+		.write = hal_gpio_write,
+		.start = hal_alarm_start,
+		.stop = hal_alarm_stop,
+	};
+
+	ESP_ERROR_CHECK(trace_start());
+	ESP_ERROR_CHECK(msg_pool_init());
+	json_arena_init();
+	ESP_ERROR_CHECK(udp_stream_init());
+	ESP_ERROR_CHECK(session_init(&session_io));
+	ESP_ERROR_CHECK(flow_init(&flow_io));
+	ESP_ERROR_CHECK(history_init(&history_io));
+	wavegen_init(&wavegen_io);
+	pattern_init(&pattern_io);
+	ets_lock = xSemaphoreCreateMutex();
+	decode_lock = xSemaphoreCreateMutex();
+	rules_start();
+	topics_start();
+	// the newest request wins in the UI, a request the MQTT task cannot take is refused
+	ESP_ERROR_CHECK(msg_queue_init(&main_queue, "main_queue", 8, MSG_DROP_OLDEST));
+	ESP_ERROR_CHECK(msg_queue_init(&mqtt_queue, "mqtt_queue", 4, MSG_DROP_NEWEST));
+
+	snprintf(server_param.ip, sizeof(server_param.ip), "%s", ip);
+	server_param.port = port;
+
+	ws_server_start();
+	if (clocksync_start(&clocksync_io, clocksync_port, clocksync_master, clocksync_master_port) != ESP_OK) {
+		ESP_LOGW(TAG, "no clock synchronization on UDP port %u", clocksync_port);
+	}
+	ESP_ERROR_CHECK(acquire_start((1 << channel) | rules_channels, CONFIG_ACQ_SAMPLE_RATE_HZ));
+	xTaskCreate(&stream_task, "stream_task", 1024*3, NULL, 7, NULL);
+	xTaskCreate(&decode_task, "decode_task", 1024*3, NULL, 5, NULL);
+	xTaskCreate(&server_task, "server_task", 1024*2, (void *)&server_param, 9, NULL);
+	xTaskCreate(&server_handle_task, "server_handle_task", 1024*3, NULL, 6, NULL);
+	xTaskCreate(&time_task, "time_task", 1024*2, NULL, 2, NULL);
+	xTaskCreate(mqtt, "mqtt_task", 1024*4, NULL, 2, NULL);
+}
+
+static MSG_TYPE_t request_type(const char *id)
+{
+	if (strcmp(id, "init") == 0) return MSG_MQTT_INIT;
+	if (strcmp(id, "connect-request") == 0) return MSG_MQTT_CONNECT;
+	if (strcmp(id, "disconnect-request") == 0) return MSG_MQTT_DISCONNECT;
+	if (strcmp(id, "subscribe-request") == 0) return MSG_MQTT_SUBSCRIBE;
+	if (strcmp(id, "unsubscribe-request") == 0) return MSG_MQTT_UNSUBSCRIBE;
+	if (strcmp(id, "publish-request") == 0) return MSG_MQTT_PUBLISH;
+	return MSG_TYPE_MAX;
+}
+
+// a browser request: parsed once here on the JSON arena, the MQTT task gets the fields only
+static void forward_request(const MSG_t *msg)
+{
+	json_arena_begin();
+	cJSON *root = cJSON_Parse(msg->text.text);
+	cJSON *id = cJSON_GetObjectItem(root, "id");
+	if (cJSON_IsString(id)) {
+		TRACE_D("request of %i bytes", msg->text.len);
+		MSG_TYPE_t type = request_type(id->valuestring);
+		if (strncmp(id->valuestring, "rule-", 5) == 0) {
+			rules_request(id->valuestring, root);
+		} else if (type != MSG_TYPE_MAX) {
+			MSG_t *request = msg_alloc(type);
+			if (request) {
+				text_init(&request->mqtt);
+				if (type != MSG_MQTT_INIT && type != MSG_MQTT_DISCONNECT) object2text(root, &request->mqtt);
+				if ((type != MSG_MQTT_SUBSCRIBE && type != MSG_MQTT_UNSUBSCRIBE) || topic_request(request, msg->text.client)) {
+					msg_send(&mqtt_queue, request);
+				} else {
+					msg_free(request);
+				}
+			}
+		}
+	}
+	// frees only what did not fit in the arena
+	cJSON_Delete(root);
+	json_arena_end();
+}
+
+void app_loop(void)
+{
+	while(1) {
+		MSG_t *msg = msg_receive(&main_queue, portMAX_DELAY);
+		if (msg == NULL) continue;
+		TRACE_D("%s", msg_type_name(msg->type));
+
+		switch (msg->type) {
+			case MSG_WS_JSON:
+				forward_request(msg);
+				break;
+
+			case MSG_MQTT_RESULT:
+				TRACE_I("%s result=%s", msg_type_name(msg->result.request), msg->result.ok ? "OK" : "NG");
+				if (msg->result.ok && msg->result.request == MSG_MQTT_CONNECT) {
+					char out[64];
+					int len;
+					len = makeSendText(out, "ID", "connectBtn", "value", "Connected");
+					ws_server_send_text_all(out,len);
+				}
+				if (msg->result.ok && msg->result.request == MSG_MQTT_DISCONNECT) {
+					char out[64];
+					int len;
+					len = makeSendText(out, "ID", "connectBtn", "value", "Connect");
+					ws_server_send_text_all(out,len);
+				}
+				break;
+
+			case MSG_MQTT_DATA:
+				topic_route(msg);
+				break;
+
+			default:
+				break;
+		}
+		msg_free(msg);
+
+	} // end while
+}
@@ -0,0 +1,30 @@
+/*
+	 The application proper, shared by app_main() on the board and by the
+	 Linux simulator in host/sim.
+*/
+
+#ifndef MAIN_APP_H_
+#define MAIN_APP_H_
+
+#include <stdint.h>
+
+#include "msg.h"
+#include "topic.h"
+
+// to app_loop() from the websocket callback and the MQTT task, and to the MQTT task
+extern MSG_QUEUE_t main_queue;
+extern MSG_QUEUE_t mqtt_queue;
+
+// every MQTT filter the clients and the device subscribed to, for the MQTT task after a connect
+void app_each_filter(TOPIC_FILTER_CB_t cb, void *arg);
+
+// where app_start() finds the clock master (clocksync.h), CONFIG_CLOCKSYNC_* unless set before
+void app_set_clocksync(uint16_t port, const char *master, uint16_t master_port);
+
+// starts the websocket server, the http server on port and the mqtt task
+void app_start(const char *ip, uint16_t port);
+
+// dispatches the messages of the websocket and mqtt tasks, never returns
+void app_loop(void);
+
+#endif /* MAIN_APP_H_ */
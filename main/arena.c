@@ -0,0 +1,33 @@
+/*
+	 Bump allocator, see arena.h
+*/
+
+#include "arena.h"
+
+void arena_init(ARENA_t *arena, void *buf, size_t size)
+{
+	// the start aligned too, whatever buf is
+	uintptr_t skip = -(uintptr_t)buf & (ARENA_ALIGN - 1);
+	arena->base = (uint8_t *)buf + skip;
+	arena->size = size > skip ? size - skip : 0;
+	arena->used = 0;
+	arena->high = 0;
+	arena->allocs = 0;
+}
+
+void *arena_alloc(ARENA_t *arena, size_t size)
+{
+	size_t need = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+	if (need < size || need > arena->size - arena->used) return NULL;
+	void *p = arena->base + arena->used;
+	arena->used += need;
+	arena->allocs++;
+	if (arena->used > arena->high) arena->high = arena->used;
+	return p;
+}
+
+void arena_reset(ARENA_t *arena)
+{
+	arena->used = 0;
+	arena->allocs = 0;
+}
@@ -0,0 +1,40 @@
+/*
+	 Bump allocator over a fixed buffer.
+
+	 Allocations are carved from the front of the buffer and never freed
+	 one by one; arena_reset() gives all of them back at once. Made for
+	 work that allocates a lot and keeps nothing, one request for
+	 instance: a reset per request instead of a malloc and free per object,
+	 and nothing left behind in the heap to fragment it.
+
+	 Not locked, one task at a time.
+*/
+
+#ifndef MAIN_ARENA_H_
+#define MAIN_ARENA_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define ARENA_ALIGN 8
+
+typedef struct {
+	uint8_t *base;
+	size_t size;
+	size_t used;
+	size_t high;		// most used between two resets, ever
+	uint32_t allocs;	// since the last reset
+} ARENA_t;
+
+void arena_init(ARENA_t *arena, void *buf, size_t size);
+// ARENA_ALIGN aligned, NULL when it does not fit
+void *arena_alloc(ARENA_t *arena, size_t size);
+void arena_reset(ARENA_t *arena);
+
+static inline bool arena_owns(const ARENA_t *arena, const void *p)
+{
+	return (const uint8_t *)p >= arena->base && (const uint8_t *)p < arena->base + arena->size;
+}
+
+#endif /* MAIN_ARENA_H_ */
@@ -0,0 +1,511 @@
+/*
+	 Clock synchronization between boards, see clocksync.h
+*/
+
+#include <math.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "lwip/api.h"
+#include "sdkconfig.h"
+
+#include "clocksync.h"
+#include "timebase.h"
+
+#define CLOCKSYNC_MAGIC 'Y'
+#define CLOCKSYNC_POLL_MS 20		// receive timeout, the resolution of everything else the task does
+#define CLOCKSYNC_ARM_RESEND_US 100000
+#define CLOCKSYNC_MIN_ARM_MS 100	// the followers have to hear of it in time
+#define CLOCKSYNC_PEER_TIMEOUT_US (5LL * CONFIG_CLOCKSYNC_INTERVAL_MS * 1000)
+
+static const char *TAG = "clocksync";
+
+static void put_u32(uint8_t *p, uint32_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+}
+
+static uint32_t get_u32(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void put_i64(uint8_t *p, int64_t v)
+{
+	put_u32(p, (uint64_t)v);
+	put_u32(p + 4, (uint64_t)v >> 32);
+}
+
+static int64_t get_i64(const uint8_t *p)
+{
+	return (int64_t)(get_u32(p) | ((uint64_t)get_u32(p + 4) << 32));
+}
+
+int clocksync_put_packet(uint8_t *buf, size_t size, const CLOCKSYNC_PACKET_t *packet)
+{
+	if (size < CLOCKSYNC_PACKET_SIZE) return -1;
+	buf[0] = CLOCKSYNC_MAGIC;
+	buf[1] = packet->type;
+	buf[2] = 0;
+	buf[3] = 0;
+	put_u32(buf + 4, packet->seq);
+	put_i64(buf + 8, packet->t1);
+	put_i64(buf + 16, packet->t2);
+	put_i64(buf + 24, packet->t3);
+	put_i64(buf + 32, packet->epoch_us);
+	return CLOCKSYNC_PACKET_SIZE;
+}
+
+int clocksync_get_packet(const uint8_t *buf, size_t len, CLOCKSYNC_PACKET_t *packet)
+{
+	if (len < CLOCKSYNC_PACKET_SIZE || buf[0] != CLOCKSYNC_MAGIC
+		|| buf[1] < CLOCKSYNC_REQUEST || buf[1] > CLOCKSYNC_ARMED) return -1;
+	packet->type = buf[1];
+	packet->seq = get_u32(buf + 4);
+	packet->t1 = get_i64(buf + 8);
+	packet->t2 = get_i64(buf + 16);
+	packet->t3 = get_i64(buf + 24);
+	packet->epoch_us = get_i64(buf + 32);
+	return CLOCKSYNC_PACKET_SIZE;
+}
+
+static int64_t line_to_shared(const CLOCKSYNC_LINE_t *line, int64_t local_us)
+{
+	int64_t dt;
+	if (local_us <= line->end_us) {
+		dt = local_us - line->seg_us;
+		return line->shared_us + dt + dt * line->ppb / 1000000000;
+	}
+	dt = local_us - line->end_us;
+	return line->end_shared_us + dt + dt * line->drift_ppb / 1000000000;
+}
+
+static int64_t line_to_local(const CLOCKSYNC_LINE_t *line, int64_t at_us)
+{
+	int64_t ds;
+	if (at_us <= line->end_shared_us) {
+		ds = at_us - line->shared_us;
+		return line->seg_us + ds - ds * line->ppb / (1000000000 + line->ppb);
+	}
+	ds = at_us - line->end_shared_us;
+	return line->end_us + ds - ds * line->drift_ppb / (1000000000 + line->drift_ppb);
+}
+
+// from local start_us on: shared_us there, slewing at slew_ppb for slew_us, then drifting at drift_ppb
+static void line_set(CLOCKSYNC_LINE_t *line, int64_t start_us, int64_t shared_us, int32_t drift_ppb, int32_t slew_ppb, int64_t slew_us)
+{
+	line->seg_us = start_us;
+	line->shared_us = shared_us;
+	line->ppb = drift_ppb + slew_ppb;
+	line->drift_ppb = drift_ppb;
+	line->end_us = start_us + slew_us;
+	line->end_shared_us = shared_us + slew_us + slew_us * line->ppb / 1000000000;
+}
+
+void clocksync_servo_init(CLOCKSYNC_SERVO_t *servo)
+{
+	memset(servo, 0, sizeof(*servo));
+	servo->drift_error_ppb = CLOCKSYNC_FIRST_DRIFT_ERROR_PPB;
+}
+
+int64_t clocksync_servo_to_shared(const CLOCKSYNC_SERVO_t *servo, int64_t local_us)
+{
+	return line_to_shared(&servo->clock, local_us);
+}
+
+int64_t clocksync_servo_to_local(const CLOCKSYNC_SERVO_t *servo, int64_t shared_us)
+{
+	return line_to_local(&servo->clock, shared_us);
+}
+
+bool clocksync_servo_update(CLOCKSYNC_SERVO_t *servo, int64_t t1, int64_t t2, int64_t t3, int64_t t4)
+{
+	if (t4 < t1 || t3 < t2) {
+		servo->filtered++;
+		return false;
+	}
+	int64_t rtt = (t4 - t1) - (t3 - t2);
+	uint32_t delay = rtt < 0 ? 0 : rtt > UINT32_MAX ? UINT32_MAX : (uint32_t)rtt;
+	servo->delay[servo->exchanges++ % CLOCKSYNC_WINDOW] = delay;
+	int window = servo->exchanges < CLOCKSYNC_WINDOW ? servo->exchanges : CLOCKSYNC_WINDOW;
+	uint32_t shortest = delay;
+	for (int i = 0; i < window; i++) {
+		if (servo->delay[i] < shortest) shortest = servo->delay[i];
+	}
+	// queued somewhere on the way, its offset is off by up to half the extra delay
+	uint32_t limit = shortest + shortest / 8 + 20;
+	if (delay > limit) {
+		servo->filtered++;
+		return false;
+	}
+
+	int64_t offset = ((t2 - t1) + (t3 - t4)) / 2;
+	int64_t mid = t1 + (t4 - t1) / 2;
+	if (servo->points && servo->locked) {
+		int64_t off = clocksync_servo_to_shared(servo, mid) - mid - offset;
+		if (off <= CONFIG_CLOCKSYNC_STEP_US && off >= -CONFIG_CLOCKSYNC_STEP_US) {
+			servo->far = 0;
+		} else if (++servo->far < 2) {
+			// one could be a bad one, two in a row and the master restarted
+			servo->filtered++;
+			return false;
+		} else {
+			servo->points = 0;
+			servo->drift_ppb = 0;
+			servo->drift_error_ppb = CLOCKSYNC_FIRST_DRIFT_ERROR_PPB;
+		}
+	}
+	if (servo->points == CLOCKSYNC_HISTORY) {
+		memmove(servo->point_us, servo->point_us + 1, sizeof(servo->point_us[0]) * (CLOCKSYNC_HISTORY - 1));
+		memmove(servo->point_offset, servo->point_offset + 1, sizeof(servo->point_offset[0]) * (CLOCKSYNC_HISTORY - 1));
+		memmove(servo->point_delay, servo->point_delay + 1, sizeof(servo->point_delay[0]) * (CLOCKSYNC_HISTORY - 1));
+		servo->points--;
+	}
+	servo->point_us[servo->points] = mid;
+	servo->point_offset[servo->points] = offset;
+	servo->point_delay[servo->points] = delay;
+	servo->points++;
+
+	// least squares line through the offsets, leaving out the ones a shorter delay since showed up as
+	// queued; around the latest one so the doubles keep their precision
+	int64_t t0 = mid, o0 = offset;
+	double mean_t = 0, mean_o = 0;
+	int n = 0;
+	for (int i = 0; i < servo->points; i++) {
+		if (servo->point_delay[i] > limit) continue;
+		mean_t += servo->point_us[i] - t0;
+		mean_o += servo->point_offset[i] - o0;
+		n++;
+	}
+	mean_t /= n;
+	mean_o /= n;
+	double stt = 0, sto = 0, soo = 0;
+	for (int i = 0; i < servo->points; i++) {
+		if (servo->point_delay[i] > limit) continue;
+		double dt = servo->point_us[i] - t0 - mean_t, d_o = servo->point_offset[i] - o0 - mean_o;
+		stt += dt * dt;
+		sto += dt * d_o;
+		soo += d_o * d_o;
+	}
+	// a slope the points pin down worse than the one found before is not taken (too few, too close, too
+	// noisy), the line only moves along the old one then
+	double slope = servo->drift_ppb / 1e9;
+	if (n >= CLOCKSYNC_MIN_POINTS && stt > 0) {
+		double fit = sto / stt, residual = soo - fit * sto;
+		double error = sqrt((residual > 0 ? residual : 0) / (n - 2) / stt);
+		double bar = servo->drift_error_ppb > CLOCKSYNC_DRIFT_ERROR_PPB ? servo->drift_error_ppb : CLOCKSYNC_DRIFT_ERROR_PPB;
+		if (error * 1e9 <= bar && fit < CLOCKSYNC_MAX_DRIFT_PPB / 1e9 && fit > -CLOCKSYNC_MAX_DRIFT_PPB / 1e9) {
+			slope = fit;
+			servo->drift_error_ppb = (int32_t)(error * 1e9);
+		}
+	}
+	int64_t target = t4 + o0 + (int64_t)(mean_o + slope * (t4 - t0 - mean_t));
+	int32_t drift_ppb = (int32_t)(slope * 1e9);
+
+	int64_t error = servo->locked ? clocksync_servo_to_shared(servo, t4) - target : 0;
+	if (!servo->locked || error > CONFIG_CLOCKSYNC_STEP_US || error < -CONFIG_CLOCKSYNC_STEP_US) {
+		if (servo->locked) servo->steps++;
+		line_set(&servo->clock, t4, target, drift_ppb, 0, 0);
+	} else {
+		// catch up with the line over CLOCKSYNC_SLEW_US, longer if that is too fast, continuous from now on
+		int64_t slew = -error * 1000000000 / CLOCKSYNC_SLEW_US;
+		if (slew > CLOCKSYNC_MAX_SLEW_PPB) slew = CLOCKSYNC_MAX_SLEW_PPB;
+		if (slew < -CLOCKSYNC_MAX_SLEW_PPB) slew = -CLOCKSYNC_MAX_SLEW_PPB;
+		int64_t slew_us = slew ? -error * 1000000000 / slew : 0;
+		line_set(&servo->clock, t4, clocksync_servo_to_shared(servo, t4), drift_ppb, (int32_t)slew, slew_us);
+	}
+	servo->drift_ppb = drift_ppb;
+	// once locked it holds on to the line, through a step too
+	servo->locked = servo->locked || n >= CLOCKSYNC_MIN_POINTS;
+	servo->error_us = (int32_t)error;
+	servo->delay_us = delay;
+	servo->used++;
+	return true;
+}
+
+typedef struct {
+	ip_addr_t addr;
+	uint16_t port;
+	int64_t seen_us;
+	uint32_t armed;			// id of the last capture it confirmed
+} PEER_t;
+
+static CLOCKSYNC_IO_t io;
+static struct netconn *conn;
+static struct netbuf *out;
+static uint8_t out_packet[CLOCKSYNC_PACKET_SIZE];
+static ip_addr_t master_addr;
+static uint16_t master_port;
+static CLOCKSYNC_SERVO_t servo;		// the task's own
+
+// what the other tasks see; 64 bit values are not atomic on the ESP32, so they are kept under a spinlock
+static portMUX_TYPE mux = portMUX_INITIALIZER_UNLOCKED;
+static CLOCKSYNC_STATE_t state;
+static CLOCKSYNC_LINE_t line;
+static int64_t epoch_us;
+static PEER_t peers[CLOCKSYNC_MAX_PEERS];
+static uint32_t arm_id;
+static int64_t arm_at_us;		// on the shared clock, 0 when nothing is pending
+static CLOCKSYNC_STATS_t stats;
+
+static int64_t now_us(void)
+{
+	return io.clock_us ? io.clock_us() : esp_timer_get_time();
+}
+
+static void send_packet(const CLOCKSYNC_PACKET_t *packet, const ip_addr_t *addr, uint16_t port)
+{
+	clocksync_put_packet(out_packet, sizeof(out_packet), packet);
+	netbuf_ref(out, out_packet, sizeof(out_packet));
+	if (netconn_sendto(conn, out, addr, port) != ERR_OK) ESP_LOGD(TAG, "cannot send %d", packet->type);
+}
+
+static void publish_servo(int64_t master_epoch_us)
+{
+	portENTER_CRITICAL(&mux);
+	line = servo.clock;
+	epoch_us = master_epoch_us;
+	state = servo.locked ? CLOCKSYNC_LOCKED : CLOCKSYNC_UNLOCKED;
+	stats.used = servo.used;
+	stats.filtered = servo.filtered;
+	stats.steps = servo.steps;
+	stats.error_us = servo.error_us;
+	stats.delay_us = servo.delay_us;
+	stats.drift_ppb = servo.drift_ppb;
+	portEXIT_CRITICAL(&mux);
+}
+
+// on the master: a request answered, a follower remembered
+static void on_request(const CLOCKSYNC_PACKET_t *request, int64_t t2, const ip_addr_t *addr, uint16_t port)
+{
+	portENTER_CRITICAL(&mux);
+	PEER_t *peer = NULL;
+	for (int i = 0; i < CLOCKSYNC_MAX_PEERS; i++) {
+		if (peers[i].seen_us && peers[i].addr.addr == addr->addr && peers[i].port == port) {
+			peer = &peers[i];
+			break;
+		}
+		if (peer == NULL && (peers[i].seen_us == 0 || t2 - peers[i].seen_us > CLOCKSYNC_PEER_TIMEOUT_US)) peer = &peers[i];
+	}
+	if (peer) {
+		if (peer->addr.addr != addr->addr || peer->port != port) peer->armed = 0;
+		peer->addr = *addr;
+		peer->port = port;
+		peer->seen_us = t2;
+	}
+	stats.requests++;
+	portEXIT_CRITICAL(&mux);
+
+	CLOCKSYNC_PACKET_t response = {
+		.type = CLOCKSYNC_RESPONSE,
+		.seq = request->seq,
+		.t1 = request->t1,
+		.t2 = t2,
+		.epoch_us = timebase_offset_us(),
+	};
+	response.t3 = now_us();
+	send_packet(&response, addr, port);
+}
+
+// on a follower: a capture the master asked for
+static void on_arm(const CLOCKSYNC_PACKET_t *arm, const ip_addr_t *addr, uint16_t port)
+{
+	static uint32_t last_id;
+	if (!servo.locked) return;	// no answer, the master keeps asking until it is too late
+	if (arm->seq != last_id) {
+		last_id = arm->seq;
+		int64_t local_us = clocksync_servo_to_local(&servo, arm->t1);
+		ESP_LOGI(TAG, "capture %u in %lld us", arm->seq, (long long)(local_us - now_us()));
+		if (io.arm) io.arm(arm->seq, local_us);
+	}
+	CLOCKSYNC_PACKET_t armed = { .type = CLOCKSYNC_ARMED, .seq = arm->seq };
+	send_packet(&armed, addr, port);
+}
+
+static void on_armed(const CLOCKSYNC_PACKET_t *armed, const ip_addr_t *addr, uint16_t port)
+{
+	portENTER_CRITICAL(&mux);
+	for (int i = 0; i < CLOCKSYNC_MAX_PEERS; i++) {
+		if (peers[i].seen_us && peers[i].addr.addr == addr->addr && peers[i].port == port) peers[i].armed = armed->seq;
+	}
+	portEXIT_CRITICAL(&mux);
+}
+
+// on the master: the pending capture to the followers that did not confirm it yet
+static void send_arms(int64_t now)
+{
+	CLOCKSYNC_PACKET_t arm = { .type = CLOCKSYNC_ARM };
+	PEER_t to[CLOCKSYNC_MAX_PEERS];
+	int count = 0;
+	portENTER_CRITICAL(&mux);
+	if (arm_at_us && now >= arm_at_us) arm_at_us = 0;
+	if (arm_at_us) {
+		arm.seq = arm_id;
+		arm.t1 = arm_at_us;
+		for (int i = 0; i < CLOCKSYNC_MAX_PEERS; i++) {
+			if (peers[i].seen_us && now - peers[i].seen_us <= CLOCKSYNC_PEER_TIMEOUT_US && peers[i].armed != arm_id) {
+				to[count++] = peers[i];
+			}
+		}
+	}
+	portEXIT_CRITICAL(&mux);
+	for (int i = 0; i < count; i++) {
+		send_packet(&arm, &to[i].addr, to[i].port);
+	}
+}
+
+static void clocksync_task(void *pvParameters)
+{
+	bool follower = master_port != 0;
+	uint32_t seq = 0, waiting = 0;
+	int64_t next_request = now_us();
+	int64_t next_arms = 0;
+	ESP_LOGI(TAG, "starting task, %s", follower ? "following" : "master");
+	for (;;) {
+		struct netbuf *buf;
+		err_t err = netconn_recv(conn, &buf);
+		int64_t now = now_us();
+		if (err == ERR_OK) {
+			void *data;
+			uint16_t len;
+			CLOCKSYNC_PACKET_t packet;
+			netbuf_data(buf, &data, &len);
+			if (clocksync_get_packet(data, len, &packet) > 0) {
+				ip_addr_t addr = *netbuf_fromaddr(buf);
+				uint16_t port = netbuf_fromport(buf);
+				if (packet.type == CLOCKSYNC_REQUEST && !follower) {
+					on_request(&packet, now, &addr, port);
+				} else if (packet.type == CLOCKSYNC_RESPONSE && follower && waiting && packet.seq == waiting) {
+					waiting = 0;
+					clocksync_servo_update(&servo, packet.t1, packet.t2, packet.t3, now);
+					publish_servo(packet.epoch_us);
+				} else if (packet.type == CLOCKSYNC_ARM && follower) {
+					on_arm(&packet, &addr, port);
+				} else if (packet.type == CLOCKSYNC_ARMED && !follower) {
+					on_armed(&packet, &addr, port);
+				}
+			}
+			netbuf_delete(buf);
+		}
+
+		if (follower && now >= next_request) {
+			if (waiting) {
+				portENTER_CRITICAL(&mux);
+				stats.timeouts++;
+				portEXIT_CRITICAL(&mux);
+			}
+			waiting = ++seq;
+			CLOCKSYNC_PACKET_t request = { .type = CLOCKSYNC_REQUEST, .seq = seq };
+			request.t1 = now_us();
+			send_packet(&request, &master_addr, master_port);
+			portENTER_CRITICAL(&mux);
+			stats.requests++;
+			portEXIT_CRITICAL(&mux);
+			next_request += CONFIG_CLOCKSYNC_INTERVAL_MS * 1000LL;
+			if (next_request < now) next_request = now + CONFIG_CLOCKSYNC_INTERVAL_MS * 1000LL;
+		}
+		if (!follower && now >= next_arms) {
+			send_arms(now);
+			next_arms = now + CLOCKSYNC_ARM_RESEND_US;
+		}
+	}
+}
+
+esp_err_t clocksync_start(const CLOCKSYNC_IO_t *clocksync_io, uint16_t port, const char *master, uint16_t port_of_master)
+{
+	io = *clocksync_io;
+	clocksync_servo_init(&servo);
+	master_port = 0;
+	if (master && master[0]) {
+		if (!ipaddr_aton(master, &master_addr) || port_of_master == 0) return ESP_ERR_INVALID_ARG;
+		master_port = port_of_master;
+	}
+	out = netbuf_new();
+	conn = netconn_new(NETCONN_UDP);
+	if (out == NULL || conn == NULL) return ESP_ERR_NO_MEM;
+	if (netconn_bind(conn, NULL, port) != ERR_OK) {
+		ESP_LOGE(TAG, "cannot bind UDP port %u", port);
+		return ESP_FAIL;
+	}
+	netconn_set_recvtimeout(conn, CLOCKSYNC_POLL_MS);
+	state = master_port ? CLOCKSYNC_UNLOCKED : CLOCKSYNC_MASTER;
+	// high priority, the stamps are taken in the task
+	if (xTaskCreate(clocksync_task, "clocksync_task", 1024*3, NULL, 8, NULL) != pdPASS) return ESP_ERR_NO_MEM;
+	return ESP_OK;
+}
+
+CLOCKSYNC_STATE_t clocksync_state(void)
+{
+	portENTER_CRITICAL(&mux);
+	CLOCKSYNC_STATE_t s = state;
+	portEXIT_CRITICAL(&mux);
+	return s;
+}
+
+int64_t clocksync_to_shared(int64_t local_us)
+{
+	portENTER_CRITICAL(&mux);
+	bool locked = state == CLOCKSYNC_LOCKED;
+	CLOCKSYNC_LINE_t now = line;
+	portEXIT_CRITICAL(&mux);
+	return locked ? line_to_shared(&now, local_us) : local_us;
+}
+
+int64_t clocksync_to_local(int64_t at_us)
+{
+	portENTER_CRITICAL(&mux);
+	bool locked = state == CLOCKSYNC_LOCKED;
+	CLOCKSYNC_LINE_t now = line;
+	portEXIT_CRITICAL(&mux);
+	return locked ? line_to_local(&now, at_us) : at_us;
+}
+
+bool clocksync_epoch_offset(int64_t *offset_us)
+{
+	portENTER_CRITICAL(&mux);
+	*offset_us = epoch_us;
+	bool locked = state == CLOCKSYNC_LOCKED;
+	portEXIT_CRITICAL(&mux);
+	return locked && *offset_us != 0;
+}
+
+esp_err_t clocksync_arm_all(uint32_t delay_ms, uint32_t *id, int64_t *at_us, int *count)
+{
+	if (delay_ms < CLOCKSYNC_MIN_ARM_MS) return ESP_ERR_INVALID_ARG;
+	if (clocksync_state() != CLOCKSYNC_MASTER) return ESP_ERR_INVALID_STATE;
+	int64_t now = now_us();
+	int told = 0;
+	portENTER_CRITICAL(&mux);
+	arm_id++;
+	if (arm_id == 0) arm_id = 1;
+	arm_at_us = now + delay_ms * 1000LL;
+	*id = arm_id;
+	*at_us = arm_at_us;
+	for (int i = 0; i < CLOCKSYNC_MAX_PEERS; i++) {
+		if (peers[i].seen_us && now - peers[i].seen_us <= CLOCKSYNC_PEER_TIMEOUT_US) told++;
+	}
+	portEXIT_CRITICAL(&mux);
+	*count = told;
+	// the followers get it from the task within CLOCKSYNC_POLL_MS, this board right away
+	if (io.arm) io.arm(*id, *at_us);
+	return ESP_OK;
+}
+
+void clocksync_get_stats(CLOCKSYNC_STATS_t *out_stats)
+{
+	int64_t now = now_us();
+	portENTER_CRITICAL(&mux);
+	*out_stats = stats;
+	out_stats->state = state;
+	out_stats->peers = 0;
+	for (int i = 0; i < CLOCKSYNC_MAX_PEERS; i++) {
+		if (peers[i].seen_us && now - peers[i].seen_us <= CLOCKSYNC_PEER_TIMEOUT_US) out_stats->peers++;
+	}
+	portEXIT_CRITICAL(&mux);
+}
@@ -0,0 +1,172 @@
+/*
+	 Clock synchronization between the boards of one bench, over UDP on the
+	 local network, so their samples can be put on one time axis.
+
+	 One board is the master, the others follow it. Every
+	 CONFIG_CLOCKSYNC_INTERVAL_MS a follower sends a request stamped with
+	 its monotonic clock (t1), the master stamps its arrival (t2) and the
+	 departure of the answer (t3) with its own, the follower stamps the
+	 arrival of the answer (t4). As in PTP:
+
+		offset = ((t2 - t1) + (t3 - t4)) / 2	master minus follower
+		delay  = (t4 - t1) - (t3 - t2)			round trip on the network
+
+	 which is exact when the delay is the same both ways. Exchanges that
+	 took much longer than the shortest of the recent ones sat in a queue
+	 somewhere and are left out. A straight line through the offsets of
+	 the others gives the offset and the drift of the two oscillators (the
+	 drift only once the points pin it down), and the shared clock of the
+	 follower (the master's monotonic clock, as seen from here) follows
+	 that line: it slews towards it for CLOCKSYNC_SLEW_US, then runs at
+	 the drift, and only steps when it is more than
+	 CONFIG_CLOCKSYNC_STEP_US off, after a restart of the master for
+	 instance. It never runs backwards otherwise, and carries on along the
+	 line when the master goes quiet.
+
+	 The master is also the coordinator of captures: clocksync_arm_all()
+	 picks a time T on the shared clock and tells every follower it has
+	 heard from, each board then calls io.arm() with T on its own
+	 monotonic clock.
+
+	 The servo and the packets do no I/O, they are what the host build
+	 tests; clocksync_start() runs them on a netconn.
+*/
+
+#ifndef MAIN_CLOCKSYNC_H_
+#define MAIN_CLOCKSYNC_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#define CLOCKSYNC_WINDOW 16			// exchanges the shortest delay is taken from
+#define CLOCKSYNC_HISTORY 16		// offsets the line goes through
+#define CLOCKSYNC_MIN_POINTS 3		// to call it locked
+#define CLOCKSYNC_SLEW_US 4000000	// an error is slewed away in about this long
+#define CLOCKSYNC_MAX_SLEW_PPB 500000
+#define CLOCKSYNC_MAX_DRIFT_PPB 500000	// more than any crystal, a fit beyond it is noise
+#define CLOCKSYNC_DRIFT_ERROR_PPB 5000	// a fit this good is always taken
+#define CLOCKSYNC_FIRST_DRIFT_ERROR_PPB 50000	// the first one has to be this good
+#define CLOCKSYNC_MAX_PEERS 8
+#define CLOCKSYNC_PACKET_SIZE 40
+
+typedef enum {
+	CLOCKSYNC_OFF = 0,
+	CLOCKSYNC_MASTER,
+	CLOCKSYNC_UNLOCKED,		// following, not enough exchanges yet
+	CLOCKSYNC_LOCKED,		// and stays so, the line carries on when the master is silent
+} CLOCKSYNC_STATE_t;
+
+typedef enum {
+	CLOCKSYNC_REQUEST = 1,	// follower -> master: seq, t1
+	CLOCKSYNC_RESPONSE,		// master -> follower: seq, t1, t2, t3, epoch offset of the master
+	CLOCKSYNC_ARM,			// master -> follower: id, at (shared clock)
+	CLOCKSYNC_ARMED,		// follower -> master: id
+} CLOCKSYNC_TYPE_t;
+
+/*
+	 A packet, CLOCKSYNC_PACKET_SIZE bytes little endian:
+	   u8 'Y', u8 type, u16 0, u32 seq (or capture id), i64 t1, i64 t2, i64 t3, i64 epoch_us
+	 ARM carries its time in t1.
+*/
+typedef struct {
+	CLOCKSYNC_TYPE_t type;
+	uint32_t seq;
+	int64_t t1;
+	int64_t t2;
+	int64_t t3;
+	int64_t epoch_us;		// RESPONSE: timebase_offset_us() of the master, 0 without one
+} CLOCKSYNC_PACKET_t;
+
+/*
+	 The shared clock as a function of the local one: at local seg_us it
+	 was shared_us and it runs at 1 + ppb / 1e9 of the local clock until
+	 end_us, where the slewing is over, then at 1 + drift_ppb / 1e9.
+*/
+typedef struct {
+	int64_t seg_us;
+	int64_t shared_us;
+	int32_t ppb;
+	int32_t drift_ppb;
+	int64_t end_us;
+	int64_t end_shared_us;
+} CLOCKSYNC_LINE_t;
+
+// the line the shared clock follows, and where it is now
+typedef struct {
+	CLOCKSYNC_LINE_t clock;
+	int32_t drift_ppb;		// of the last fit taken
+	int32_t drift_error_ppb;	// its standard error
+	bool locked;
+	// recent exchanges
+	uint32_t delay[CLOCKSYNC_WINDOW];
+	int exchanges;
+	// the offsets the line goes through
+	int64_t point_us[CLOCKSYNC_HISTORY];
+	int64_t point_offset[CLOCKSYNC_HISTORY];
+	uint32_t point_delay[CLOCKSYNC_HISTORY];
+	int points;
+	int far;				// exchanges in a row far off the line
+	// stats
+	uint32_t used;
+	uint32_t filtered;		// exchanges left out for their delay
+	uint32_t steps;
+	int32_t error_us;		// shared clock minus the line, before the last correction
+	uint32_t delay_us;		// of the last exchange used
+} CLOCKSYNC_SERVO_t;
+
+typedef struct {
+	// the local monotonic clock, esp_timer_get_time() when NULL
+	int64_t (*clock_us)(void);
+	// arms a capture at local_us on that clock
+	void (*arm)(uint32_t id, int64_t local_us);
+} CLOCKSYNC_IO_t;
+
+typedef struct {
+	CLOCKSYNC_STATE_t state;
+	uint32_t requests;		// sent by a follower, answered by the master
+	uint32_t timeouts;		// requests with no answer within the interval
+	uint32_t used;
+	uint32_t filtered;
+	uint32_t steps;
+	int32_t error_us;
+	uint32_t delay_us;
+	int32_t drift_ppb;
+	int peers;				// followers heard from lately, on the master
+} CLOCKSYNC_STATS_t;
+
+int clocksync_put_packet(uint8_t *buf, size_t size, const CLOCKSYNC_PACKET_t *packet);
+int clocksync_get_packet(const uint8_t *buf, size_t len, CLOCKSYNC_PACKET_t *packet);
+
+void clocksync_servo_init(CLOCKSYNC_SERVO_t *servo);
+// one exchange, all four stamps; false when it was left out
+bool clocksync_servo_update(CLOCKSYNC_SERVO_t *servo, int64_t t1, int64_t t2, int64_t t3, int64_t t4);
+int64_t clocksync_servo_to_shared(const CLOCKSYNC_SERVO_t *servo, int64_t local_us);
+int64_t clocksync_servo_to_local(const CLOCKSYNC_SERVO_t *servo, int64_t shared_us);
+
+/*
+	 Runs the protocol on UDP port. master is the IPv4 address of the
+	 master (master_port its port), NULL or "" to be the master.
+*/
+esp_err_t clocksync_start(const CLOCKSYNC_IO_t *io, uint16_t port, const char *master, uint16_t master_port);
+
+CLOCKSYNC_STATE_t clocksync_state(void);
+
+// the shared clock at a time of the local monotonic clock, and back; the same clock until locked
+int64_t clocksync_to_shared(int64_t local_us);
+int64_t clocksync_to_local(int64_t shared_us);
+
+// epoch minus shared time, from the master, false when the master has no wall clock either
+bool clocksync_epoch_offset(int64_t *offset_us);
+
+/*
+	 On the master: a capture on every board delay_ms from now. at_us is
+	 its time on the shared clock, peers the followers told.
+*/
+esp_err_t clocksync_arm_all(uint32_t delay_ms, uint32_t *id, int64_t *at_us, int *peers);
+
+void clocksync_get_stats(CLOCKSYNC_STATS_t *stats);
+
+#endif /* MAIN_CLOCKSYNC_H_ */
@@ -0,0 +1,243 @@
+/*
+	 Block encodings for streamed ADC samples, see codec.h
+*/
+
+#include <string.h>
+
+#include "codec.h"
+
+#define RICE_ESCAPE 24		// quotients this long are sent as raw values instead
+#define ZZ_BITS (CODEC_MAX_BITS + 2)	// a zigzag second order residual of 16 bit samples
+
+typedef struct {
+	uint8_t *out;
+	size_t size;
+	size_t pos;
+	uint64_t acc;
+	int nbits;
+	int overflow;
+} BIT_WRITER_t;
+
+typedef struct {
+	const uint8_t *in;
+	size_t len;
+	size_t pos;
+	uint64_t acc;
+	int nbits;
+} BIT_READER_t;
+
+static void put_bits(BIT_WRITER_t *w, uint32_t value, int bits)
+{
+	w->acc |= (uint64_t)value << w->nbits;
+	w->nbits += bits;
+	while (w->nbits >= 8) {
+		if (w->pos < w->size) w->out[w->pos++] = (uint8_t)w->acc;
+		else w->overflow = 1;
+		w->acc >>= 8;
+		w->nbits -= 8;
+	}
+}
+
+static void flush_bits(BIT_WRITER_t *w)
+{
+	if (w->nbits > 0) put_bits(w, 0, 8 - w->nbits);
+}
+
+static uint32_t get_bits(BIT_READER_t *r, int bits)
+{
+	while (r->nbits < bits) {
+		uint64_t byte = r->pos < r->len ? r->in[r->pos] : 0;
+		r->pos++;
+		r->acc |= byte << r->nbits;
+		r->nbits += 8;
+	}
+	uint32_t value = (uint32_t)(r->acc & ((1ULL << bits) - 1));
+	r->acc >>= bits;
+	r->nbits -= bits;
+	return value;
+}
+
+static inline uint32_t zigzag(int32_t v)
+{
+	return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+static inline int32_t unzigzag(uint32_t v)
+{
+	return (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+}
+
+static int bit_width(uint32_t v)
+{
+	return v ? 32 - __builtin_clz(v) : 0;
+}
+
+// residual of sample i for a first or second order predictor
+static inline int32_t residual(const uint16_t *s, int i, int order)
+{
+	if (order == 2 && i >= 2) return (int32_t)s[i] - (2 * (int32_t)s[i - 1] - (int32_t)s[i - 2]);
+	return (int32_t)s[i] - (int32_t)s[i - 1];
+}
+
+static void put_header(uint8_t *out, CODEC_t codec, int param, int count, uint16_t first)
+{
+	out[0] = codec;
+	out[1] = param;
+	out[2] = count & 0xff;
+	out[3] = count >> 8;
+	out[4] = first & 0xff;
+	out[5] = first >> 8;
+}
+
+_Static_assert(RICE_ESCAPE + ZZ_BITS == 42, "CODEC_MAX_SIZE assumes 42 bits per escaped sample");
+
+size_t codec_max_size(int count, int bits)
+{
+	// a Rice escape costs RICE_ESCAPE + ZZ_BITS bits, more than any packing
+	return CODEC_MAX_SIZE(count);
+}
+
+static int encode_packed(const uint16_t *samples, int count, int bits, BIT_WRITER_t *w)
+{
+	uint32_t mask = (1u << bits) - 1;
+	for (int i = 0; i < count; i++) put_bits(w, samples[i] & mask, bits);
+	return bits;
+}
+
+static int encode_delta(const uint16_t *samples, int count, BIT_WRITER_t *w)
+{
+	uint32_t all = 0;
+	for (int i = 1; i < count; i++) all |= zigzag(residual(samples, i, 1));
+	int width = bit_width(all);
+	if (width == 0) return 0;
+	for (int i = 1; i < count; i++) put_bits(w, zigzag(residual(samples, i, 1)), width);
+	return width;
+}
+
+// total Rice bits of the block for parameter k
+static uint32_t rice_cost(const uint16_t *samples, int count, int order, int k)
+{
+	uint32_t total = 0;
+	for (int i = 1; i < count; i++) {
+		uint32_t q = zigzag(residual(samples, i, order)) >> k;
+		total += q < RICE_ESCAPE ? q + 1 + k : RICE_ESCAPE + ZZ_BITS;
+	}
+	return total;
+}
+
+static int encode_rice(const uint16_t *samples, int count, BIT_WRITER_t *w)
+{
+	// the best k is near log2 of the mean residual; try that and its neighbours for both orders
+	int best_order = 1, best_k = 0;
+	uint32_t best = UINT32_MAX;
+	for (int order = 1; order <= 2; order++) {
+		uint64_t sum = 0;
+		for (int i = 1; i < count; i++) sum += zigzag(residual(samples, i, order));
+		int guess = count > 1 ? bit_width((uint32_t)(sum / (count - 1))) : 0;
+		for (int k = guess - 1; k <= guess + 1; k++) {
+			if (k < 0 || k > 15) continue;
+			uint32_t cost = rice_cost(samples, count, order, k);
+			if (cost < best) {
+				best = cost;
+				best_order = order;
+				best_k = k;
+			}
+		}
+	}
+
+	for (int i = 1; i < count; i++) {
+		uint32_t v = zigzag(residual(samples, i, best_order));
+		uint32_t q = v >> best_k;
+		if (q < RICE_ESCAPE) {
+			put_bits(w, (1u << q) - 1, q + 1);	// q ones and a zero
+			put_bits(w, v & ((1u << best_k) - 1), best_k);
+		} else {
+			// RICE_ESCAPE ones and no zero: the raw residual follows
+			put_bits(w, (1u << RICE_ESCAPE) - 1, RICE_ESCAPE);
+			put_bits(w, v, ZZ_BITS);
+		}
+	}
+	return best_k | (best_order == 2 ? 0x80 : 0);
+}
+
+int codec_encode(CODEC_t codec, const uint16_t *samples, int count, int bits, uint8_t *out, size_t size)
+{
+	if (count < 0 || count > 0xffff || bits < 1 || bits > CODEC_MAX_BITS || size < CODEC_HEADER_SIZE) return -1;
+	BIT_WRITER_t w = { .out = out + CODEC_HEADER_SIZE, .size = size - CODEC_HEADER_SIZE };
+	int param;
+	switch (codec) {
+		case CODEC_PACKED:
+			param = encode_packed(samples, count, bits, &w);
+			break;
+		case CODEC_DELTA:
+			param = encode_delta(samples, count, &w);
+			break;
+		case CODEC_RICE:
+			param = encode_rice(samples, count, &w);
+			break;
+		default:
+			return -1;
+	}
+	flush_bits(&w);
+	if (w.overflow) return -1;
+	put_header(out, codec, param, count, count ? samples[0] : 0);
+	return CODEC_HEADER_SIZE + w.pos;
+}
+
+int codec_decode(const uint8_t *in, size_t len, uint16_t *samples, int max_count)
+{
+	if (len < CODEC_HEADER_SIZE) return -1;
+	CODEC_t codec = in[0];
+	int param = in[1];
+	int count = in[2] | (in[3] << 8);
+	uint16_t first = in[4] | (in[5] << 8);
+	if (count > max_count) return -1;
+	if (count == 0) return 0;
+	BIT_READER_t r = { .in = in + CODEC_HEADER_SIZE, .len = len - CODEC_HEADER_SIZE };
+
+	switch (codec) {
+		case CODEC_PACKED:
+			if (param < 1 || param > CODEC_MAX_BITS) return -1;
+			for (int i = 0; i < count; i++) samples[i] = get_bits(&r, param);
+			break;
+		case CODEC_DELTA:
+			samples[0] = first;
+			for (int i = 1; i < count; i++) {
+				samples[i] = samples[i - 1] + (param ? unzigzag(get_bits(&r, param)) : 0);
+			}
+			break;
+		case CODEC_RICE: {
+			int k = param & 0x0f;
+			int order = param & 0x80 ? 2 : 1;
+			samples[0] = first;
+			for (int i = 1; i < count; i++) {
+				uint32_t q = 0;
+				while (q < RICE_ESCAPE && get_bits(&r, 1)) q++;
+				uint32_t v;
+				if (q == RICE_ESCAPE) {
+					v = get_bits(&r, ZZ_BITS);
+				} else {
+					v = (q << k) | (k ? get_bits(&r, k) : 0);
+				}
+				int32_t prediction = (order == 2 && i >= 2) ? 2 * (int32_t)samples[i - 1] - samples[i - 2] : samples[i - 1];
+				samples[i] = prediction + unzigzag(v);
+			}
+			break;
+		}
+		default:
+			return -1;
+	}
+	if (r.pos * 8 - r.nbits > r.len * 8) return -1;	// the block was cut short
+	return count;
+}
+
+const char *codec_name(CODEC_t codec)
+{
+	switch (codec) {
+		case CODEC_TEXT: return "text";
+		case CODEC_PACKED: return "packed";
+		case CODEC_DELTA: return "delta";
+		case CODEC_RICE: return "rice";
+		default: return "unknown";
+	}
+}
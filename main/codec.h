@@ -0,0 +1,49 @@
+/*
+	 Block encodings for streamed ADC samples.
+
+	 CODEC_PACKED  every sample in `bits` bits, two 12 bit samples in three bytes
+	 CODEC_DELTA   first sample, then the zigzag deltas packed at the width of
+	               the largest one in the block
+	 CODEC_RICE    first sample, then zigzag residuals of a first or second
+	               order predictor, Rice coded with the best k for the block;
+	               lossless and small for slowly varying signals
+
+	 An encoded block starts with CODEC_HEADER_SIZE bytes, little endian:
+	   u8 codec, u8 param, u16 count, u16 first sample
+	 param is the packing width for PACKED and DELTA, and k (bit 7 set for
+	 the second order predictor) for RICE. Bits are packed LSB first.
+	 html/decode.js has the matching decoder.
+*/
+
+#ifndef MAIN_CODEC_H_
+#define MAIN_CODEC_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define CODEC_HEADER_SIZE 6
+#define CODEC_MAX_BITS 16
+
+// bytes needed at most for count samples, for buffers sized at compile time (a Rice escape is 42 bits)
+#define CODEC_MAX_SIZE(count) (CODEC_HEADER_SIZE + ((size_t)(count) * 42 + 7) / 8)
+
+typedef enum {
+	CODEC_TEXT = 0,		// comma separated millivolts, the "AS" message
+	CODEC_PACKED = 1,
+	CODEC_DELTA = 2,
+	CODEC_RICE = 3,
+	CODEC_MAX
+} CODEC_t;
+
+// bytes needed at most for count samples of bits bits in any binary codec
+size_t codec_max_size(int count, int bits);
+
+// encodes count samples of bits bits, returns the bytes written or -1
+int codec_encode(CODEC_t codec, const uint16_t *samples, int count, int bits, uint8_t *out, size_t size);
+
+// decodes one block, returns the sample count or -1
+int codec_decode(const uint8_t *in, size_t len, uint16_t *samples, int max_count);
+
+const char *codec_name(CODEC_t codec);
+
+#endif /* MAIN_CODEC_H_ */
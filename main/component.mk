@@ -1,6 +1,8 @@
 COMPONENT_EMBED_FILES := ../html/error.html
 COMPONENT_EMBED_FILES += ../html/favicon.ico
 COMPONENT_EMBED_FILES += ../html/main.js
+COMPONENT_EMBED_FILES += ../html/scope.js
+COMPONENT_EMBED_FILES += ../html/decode.js
 COMPONENT_EMBED_FILES += ../html/root.html
 COMPONENT_EMBED_FILES += ../html/bulma.css
 COMPONENT_EMBED_FILES += ../html/main.css
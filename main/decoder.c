@@ -0,0 +1,294 @@
+/*
+	 Streaming protocol decoders, see decoder.h
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "decoder.h"
+
+static int level(const DECODER_t *d, uint64_t levels, int pin)
+{
+	return pin >= 0 ? (levels >> pin) & 1 : 0;
+}
+
+static uint64_t pin_bit(int pin)
+{
+	return pin >= 0 ? 1ULL << pin : 0;
+}
+
+esp_err_t decoder_init(DECODER_t *d, const DECODER_CONFIG_t *config)
+{
+	memset(d, 0, sizeof(*d));
+	d->config = *config;
+	switch (config->bus) {
+		case DECODER_UART:
+			if (config->uart.rx < 0 || config->uart.baud == 0) return ESP_ERR_INVALID_ARG;
+			if (config->uart.bits < 5 || config->uart.bits > 9) return ESP_ERR_INVALID_ARG;
+			if (config->uart.parity > DECODER_PARITY_EVEN || config->uart.stop < 1 || config->uart.stop > 2) return ESP_ERR_INVALID_ARG;
+			d->mask = pin_bit(config->uart.rx);
+			break;
+		case DECODER_I2C:
+			if (config->i2c.scl < 0 || config->i2c.sda < 0) return ESP_ERR_INVALID_ARG;
+			d->mask = pin_bit(config->i2c.scl) | pin_bit(config->i2c.sda);
+			break;
+		case DECODER_SPI:
+			if (config->spi.sck < 0 || config->spi.mode > 3 || config->spi.bits < 1 || config->spi.bits > 16) return ESP_ERR_INVALID_ARG;
+			d->mask = pin_bit(config->spi.sck) | pin_bit(config->spi.mosi) | pin_bit(config->spi.miso) | pin_bit(config->spi.cs);
+			break;
+		default:
+			return ESP_ERR_INVALID_ARG;
+	}
+	return ESP_OK;
+}
+
+static int emit(DECODER_t *d, DECODER_EVENT_t *out, int n, DECODER_EVENT_TYPE_t type, int64_t t_ns, uint16_t data, uint16_t data2, uint8_t ack)
+{
+	out[n] = (DECODER_EVENT_t) { .t_ns = t_ns, .type = type, .ack = ack, .data = data, .data2 = data2 };
+	d->events++;
+	if (type == DECODER_EV_ERROR) d->errors++;
+	return n + 1;
+}
+
+/* UART: a falling edge starts a character, then every bit is taken in its
+   middle from the level the line had there, which is the level after the
+   last edge before it. */
+
+static int uart_rx(const DECODER_t *d, uint64_t levels)
+{
+	return level(d, levels, d->config.uart.rx) ^ d->config.uart.invert;
+}
+
+// bits in a character: start, data, parity, stop
+static int uart_frame_bits(const DECODER_t *d)
+{
+	return 1 + d->config.uart.bits + (d->config.uart.parity != DECODER_PARITY_NONE) + d->config.uart.stop;
+}
+
+// samples the bits of the current character that are due before t_ns
+static int uart_advance(DECODER_t *d, int64_t t_ns, DECODER_EVENT_t *out, int n)
+{
+	const int bits = d->config.uart.bits;
+	const int parity_bit = d->config.uart.parity != DECODER_PARITY_NONE ? 1 + bits : -1;
+	const int first_stop = 1 + bits + (parity_bit > 0);
+	const int frame_bits = uart_frame_bits(d);
+	int rx = uart_rx(d, d->levels);
+	while (d->active && d->bit < frame_bits) {
+		int64_t at = d->frame_ns + ((2 * d->bit + 1) * 1000000000LL) / d->baud2;
+		if (at >= t_ns) break;
+		if (d->bit == 0) {
+			if (rx) {
+				d->active = 0;		// a glitch, not a start bit
+				break;
+			}
+		} else if (d->bit <= bits) {
+			d->shift |= rx << (d->bit - 1);
+		} else if (d->bit == parity_bit) {
+			int ones = __builtin_popcount(d->shift) + rx;
+			if ((ones & 1) != (d->config.uart.parity == DECODER_PARITY_ODD)) d->parity_error = 1;
+		} else if (d->bit >= first_stop && !rx) {
+			d->framing_error = 1;
+		}
+		d->bit++;
+	}
+	if (d->active && d->bit == frame_bits) {
+		d->active = 0;
+		if (d->framing_error && d->shift == 0 && !d->parity_error) {
+			n = emit(d, out, n, DECODER_EV_ERROR, d->frame_ns, DECODER_ERROR_BREAK, 0, 0);
+		} else if (d->framing_error) {
+			n = emit(d, out, n, DECODER_EV_ERROR, d->frame_ns, DECODER_ERROR_FRAMING, d->shift, 0);
+		} else if (d->parity_error) {
+			n = emit(d, out, n, DECODER_EV_ERROR, d->frame_ns, DECODER_ERROR_PARITY, d->shift, 0);
+		} else {
+			n = emit(d, out, n, DECODER_EV_DATA, d->frame_ns, d->shift, 0, 0);
+		}
+	}
+	return n;
+}
+
+static int uart_feed(DECODER_t *d, int64_t t_ns, uint64_t levels, DECODER_EVENT_t *out)
+{
+	int n = uart_advance(d, t_ns, out, 0);
+	int was = uart_rx(d, d->levels);
+	d->levels = levels;
+	if (!d->active && was && !uart_rx(d, levels)) {
+		d->active = 1;
+		d->frame_ns = t_ns;
+		d->bit = 0;
+		d->shift = 0;
+		d->parity_error = 0;
+		d->framing_error = 0;
+	}
+	return n;
+}
+
+/* I2C: SDA changing while SCL is high is a start or a stop, anything else
+   is a bit, read on the rising edge of SCL and kept once SCL falls again:
+   the clock pulse in front of a repeated start or a stop is not a bit. The
+   ninth is the ACK. */
+
+static int i2c_feed(DECODER_t *d, int64_t t_ns, uint64_t levels, DECODER_EVENT_t *out)
+{
+	const int scl_pin = d->config.i2c.scl, sda_pin = d->config.i2c.sda;
+	int scl0 = level(d, d->levels, scl_pin), sda0 = level(d, d->levels, sda_pin);
+	int scl = level(d, levels, scl_pin), sda = level(d, levels, sda_pin);
+	int n = 0;
+	d->levels = levels;
+
+	if (scl0 && scl && sda0 != sda) {
+		if (d->active && d->bit) n = emit(d, out, n, DECODER_EV_ERROR, d->frame_ns, DECODER_ERROR_SHORT, d->bit, 0);
+		if (!sda) {
+			n = emit(d, out, n, DECODER_EV_START, t_ns, d->active, 0, 0);
+			d->active = 1;
+			d->first = 1;
+		} else {
+			n = emit(d, out, n, DECODER_EV_STOP, t_ns, 0, 0, 0);
+			d->active = 0;
+		}
+		d->bit = 0;
+		d->shift = 0;
+		d->shift2 = 0;
+		return n;
+	}
+	if (!d->active || scl0 == scl) return n;
+	if (scl) {
+		// rising SCL: the data bit is what SDA is now, bit 1 marks it read
+		if (d->bit == 0) d->frame_ns = t_ns;
+		d->shift2 = 2 | sda;
+		return n;
+	}
+
+	// falling SCL: the bit stands, unless this is the end of a start
+	if (!d->shift2) return n;
+	int bit = d->shift2 & 1;
+	d->shift2 = 0;
+	if (d->bit < 8) {
+		d->shift = (d->shift << 1) | bit;
+		d->bit++;
+		return n;
+	}
+	if (d->first) {
+		n = emit(d, out, n, DECODER_EV_ADDRESS, d->frame_ns, d->shift >> 1, d->shift & 1, !bit);
+	} else {
+		n = emit(d, out, n, DECODER_EV_DATA, d->frame_ns, d->shift, 0, !bit);
+	}
+	d->first = 0;
+	d->bit = 0;
+	d->shift = 0;
+	return n;
+}
+
+/* SPI: a bit on each sampling edge of SCK while CS is low, the leading
+   edge for CPHA 0 and the trailing one for CPHA 1. Data is taken from the
+   levels before the edge, when both sides hold it steady. */
+
+static int spi_feed(DECODER_t *d, int64_t t_ns, uint64_t levels, DECODER_EVENT_t *out)
+{
+	const int cs_pin = d->config.spi.cs;
+	int selected0 = cs_pin < 0 || !level(d, d->levels, cs_pin);
+	int selected = cs_pin < 0 || !level(d, levels, cs_pin);
+	int sck0 = level(d, d->levels, d->config.spi.sck);
+	int sck = level(d, levels, d->config.spi.sck);
+	int cpol = d->config.spi.mode >> 1, cpha = d->config.spi.mode & 1;
+	int sample_rising = cpol == cpha;
+	uint64_t before = d->levels;
+	int n = 0;
+	d->levels = levels;
+
+	if (selected0 && !selected) {
+		if (d->bit) n = emit(d, out, n, DECODER_EV_ERROR, d->frame_ns, DECODER_ERROR_SHORT, d->bit, 0);
+		n = emit(d, out, n, DECODER_EV_STOP, t_ns, 0, 0, 0);
+		d->bit = 0;
+		return n;
+	}
+	if (!selected0 && selected) {
+		n = emit(d, out, n, DECODER_EV_START, t_ns, 0, 0, 0);
+		d->bit = 0;
+		d->shift = 0;
+		d->shift2 = 0;
+		return n;
+	}
+	if (!selected || sck0 == sck || sck != sample_rising) return n;
+
+	const int bits = d->config.spi.bits;
+	int mosi = level(d, before, d->config.spi.mosi);
+	int miso = level(d, before, d->config.spi.miso);
+	if (d->bit == 0) {
+		d->frame_ns = t_ns;
+		d->shift = 0;
+		d->shift2 = 0;
+	}
+	if (d->config.spi.lsb_first) {
+		d->shift |= mosi << d->bit;
+		d->shift2 |= miso << d->bit;
+	} else {
+		d->shift = (d->shift << 1) | mosi;
+		d->shift2 = (d->shift2 << 1) | miso;
+	}
+	if (++d->bit == bits) {
+		n = emit(d, out, n, DECODER_EV_DATA, d->frame_ns, d->shift, d->shift2, 0);
+		d->bit = 0;
+	}
+	return n;
+}
+
+int decoder_feed(DECODER_t *d, int64_t t_ns, uint64_t levels, DECODER_EVENT_t *out)
+{
+	if (!d->have_levels) {
+		// the first levels only tell where the lines are
+		d->levels = levels;
+		d->have_levels = 1;
+		if (d->config.bus == DECODER_UART) d->baud2 = 2 * (int64_t)d->config.uart.baud;
+		return 0;
+	}
+	if (((d->levels ^ levels) & d->mask) == 0) {
+		d->levels = levels;
+		return d->config.bus == DECODER_UART ? uart_advance(d, t_ns, out, 0) : 0;
+	}
+	d->edges++;
+	switch (d->config.bus) {
+		case DECODER_UART: return uart_feed(d, t_ns, levels, out);
+		case DECODER_I2C: return i2c_feed(d, t_ns, levels, out);
+		case DECODER_SPI: return spi_feed(d, t_ns, levels, out);
+		default: return 0;
+	}
+}
+
+int decoder_flush(DECODER_t *d, int64_t t_ns, DECODER_EVENT_t *out)
+{
+	if (d->config.bus != DECODER_UART || !d->have_levels) return 0;
+	return uart_advance(d, t_ns, out, 0);
+}
+
+int decoder_format(const DECODER_t *d, const DECODER_EVENT_t *ev, char *buf, size_t size)
+{
+	static const char error_code[] = { '?', 'f', 'p', 'b', 's' };
+	int wide = d->config.bus == DECODER_UART ? d->config.uart.bits > 8 : d->config.bus == DECODER_SPI && d->config.spi.bits > 8;
+	const char *hex = wide ? "%03x" : "%02x";
+	char data[8];
+	switch (ev->type) {
+		case DECODER_EV_DATA:
+			snprintf(data, sizeof(data), hex, ev->data);
+			if (d->config.bus == DECODER_I2C) return snprintf(buf, size, "%s%c", data, ev->ack ? '+' : '-');
+			if (d->config.bus == DECODER_SPI && d->config.spi.miso >= 0) {
+				char data2[8];
+				snprintf(data2, sizeof(data2), hex, ev->data2);
+				return snprintf(buf, size, "%s/%s", d->config.spi.mosi >= 0 ? data : "", data2);
+			}
+			return snprintf(buf, size, "%s", data);
+		case DECODER_EV_ADDRESS:
+			return snprintf(buf, size, "@%02x%c%c", ev->data, ev->data2 ? 'r' : 'w', ev->ack ? '+' : '-');
+		case DECODER_EV_START:
+			return snprintf(buf, size, ev->data ? "[r" : "[");
+		case DECODER_EV_STOP:
+			return snprintf(buf, size, "]");
+		case DECODER_EV_ERROR:
+			if (ev->data == DECODER_ERROR_FRAMING || ev->data == DECODER_ERROR_PARITY) {
+				snprintf(data, sizeof(data), hex, ev->data2);
+				return snprintf(buf, size, "!%c%s", error_code[ev->data], data);
+			}
+			return snprintf(buf, size, "!%c", error_code[ev->data < sizeof(error_code) ? ev->data : 0]);
+		default:
+			return snprintf(buf, size, "?");
+	}
+}
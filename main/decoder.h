@@ -0,0 +1,117 @@
+/*
+	 Streaming protocol decoders for the digital channels: UART, I2C and SPI.
+
+	 A decoder is an incremental state machine fed with the levels of all
+	 GPIOs (bit n is GPIOn) after every change, as hal_gpio_edges_read()
+	 delivers them. It turns them into frames with the time they started:
+	 characters, bytes with their ACK, SPI words, starts and stops, and
+	 errors. Edges on pins the decoder does not use are ignored.
+
+	 UART needs the time to go on without edges to finish a character
+	 whose last bits are all high, which decoder_flush() does.
+*/
+
+#ifndef MAIN_DECODER_H_
+#define MAIN_DECODER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#define DECODER_MAX_EVENTS 4	// out of one call, at most
+
+typedef enum {
+	DECODER_NONE = 0,
+	DECODER_UART,
+	DECODER_I2C,
+	DECODER_SPI,
+} DECODER_BUS_t;
+
+typedef enum {
+	DECODER_PARITY_NONE = 0,
+	DECODER_PARITY_ODD,
+	DECODER_PARITY_EVEN,
+} DECODER_PARITY_t;
+
+typedef struct {
+	DECODER_BUS_t bus;
+	union {
+		struct {
+			int8_t rx;
+			uint32_t baud;
+			uint8_t bits;		// 5 to 9
+			uint8_t parity;		// DECODER_PARITY_t
+			uint8_t stop;		// 1 or 2
+			uint8_t invert;		// idle low
+		} uart;
+		struct {
+			int8_t scl;
+			int8_t sda;
+		} i2c;
+		struct {
+			int8_t sck;
+			int8_t mosi;		// -1 when not connected
+			int8_t miso;
+			int8_t cs;			// active low, -1: always selected
+			uint8_t mode;		// CPOL << 1 | CPHA
+			uint8_t bits;		// 1 to 16
+			uint8_t lsb_first;
+		} spi;
+	};
+} DECODER_CONFIG_t;
+
+typedef enum {
+	DECODER_EV_DATA = 0,	// a character, an I2C data byte (ack), an SPI word (data mosi, data2 miso)
+	DECODER_EV_ADDRESS,		// I2C: 7 bit address in data, 1 for read in data2, ack
+	DECODER_EV_START,		// I2C start, data 1 for a repeated start; SPI chip select
+	DECODER_EV_STOP,		// I2C stop; SPI chip deselect
+	DECODER_EV_ERROR,		// DECODER_ERROR_t in data
+} DECODER_EVENT_TYPE_t;
+
+typedef enum {
+	DECODER_ERROR_FRAMING = 1,	// UART: stop bit low, data2 has the character
+	DECODER_ERROR_PARITY,		// UART: data2 has the character
+	DECODER_ERROR_BREAK,		// UART: all low, stop bit included
+	DECODER_ERROR_SHORT,		// I2C/SPI: stop or deselect in the middle of a byte
+} DECODER_ERROR_t;
+
+typedef struct {
+	int64_t t_ns;		// start of the frame
+	uint8_t type;		// DECODER_EVENT_TYPE_t
+	uint8_t ack;
+	uint16_t data;
+	uint16_t data2;
+} DECODER_EVENT_t;
+
+typedef struct {
+	DECODER_CONFIG_t config;
+	uint64_t mask;			// the pins the decoder looks at
+	uint64_t levels;
+	int have_levels;
+	int64_t baud2;			// UART: twice the baud rate, bit k is taken (2k + 1) * 1e9 / baud2 after the start
+	int active;				// in a character, a transfer, selected
+	int64_t frame_ns;
+	int bit;				// bits of the current frame so far
+	uint16_t shift;
+	uint16_t shift2;		// SPI: MISO; I2C: the bit read on SCL rising, 2 | SDA
+	int first;				// I2C: the next byte is the address
+	int parity_error;
+	int framing_error;
+	uint64_t edges;
+	uint32_t events;
+	uint32_t errors;
+} DECODER_t;
+
+esp_err_t decoder_init(DECODER_t *d, const DECODER_CONFIG_t *config);
+
+// the levels of all pins since t_ns; out has room for DECODER_MAX_EVENTS, returns the events written
+int decoder_feed(DECODER_t *d, int64_t t_ns, uint64_t levels, DECODER_EVENT_t *out);
+
+// no edge until t_ns: finishes what is complete by then
+int decoder_flush(DECODER_t *d, int64_t t_ns, DECODER_EVENT_t *out);
+
+// the event as a short token for the browser: "41", "@50w+", "[", "]", "!f41", ... returns its length
+int decoder_format(const DECODER_t *d, const DECODER_EVENT_t *ev, char *buf, size_t size);
+
+#endif /* MAIN_DECODER_H_ */
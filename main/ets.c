@@ -0,0 +1,141 @@
+/*
+	 Equivalent-time sampling, see ets.h
+*/
+
+#include <math.h>
+#include <string.h>
+
+#include "ets.h"
+
+esp_err_t ets_init(ETS_t *ets, const ETS_CONFIG_t *config)
+{
+	if (config->bins == 0 || config->bins > ETS_MAX_BINS || config->bin_ns == 0) return ESP_ERR_INVALID_ARG;
+	if (config->edge > ETS_TRIGGER_FALLING) return ESP_ERR_INVALID_ARG;
+	memset(ets, 0, sizeof(*ets));
+	ets->config = *config;
+	return ESP_OK;
+}
+
+void ets_reset(ETS_t *ets)
+{
+	memset(ets->sum, 0, sizeof(ets->sum));
+	memset(ets->sum_sq, 0, sizeof(ets->sum_sq));
+	memset(ets->count, 0, sizeof(ets->count));
+	ets->npending = 0;
+	ets->captures = 0;
+	ets->dropped = 0;
+	ets->samples = 0;
+}
+
+static int64_t window_end(const ETS_t *ets, int64_t trigger_ns)
+{
+	return trigger_ns + ets->config.start_ns + (int64_t)ets->config.bins * ets->config.bin_ns;
+}
+
+static void bin(ETS_t *ets, int64_t trigger_ns, int64_t t_ns, uint16_t raw)
+{
+	int64_t offset = t_ns - trigger_ns - ets->config.start_ns;
+	if (offset < 0) return;
+	uint64_t i = (uint64_t)offset / ets->config.bin_ns;
+	if (i >= ets->config.bins) return;
+	ets->sum[i] += raw;
+	ets->sum_sq[i] += (uint32_t)raw * raw;
+	ets->count[i]++;
+	ets->samples++;
+}
+
+void ets_add_trigger(ETS_t *ets, int64_t t_ns)
+{
+	int64_t start = t_ns + ets->config.start_ns;
+	int64_t end = window_end(ets, t_ns);
+	uint32_t kept = ets->nhistory < ETS_HISTORY ? ets->nhistory : ETS_HISTORY;
+	int64_t newest = kept ? ets->history_ns[(ets->nhistory - 1) % ETS_HISTORY] : INT64_MIN;
+	int64_t oldest = kept ? ets->history_ns[(ets->nhistory - kept) % ETS_HISTORY] : INT64_MIN;
+
+	// whole window already gone, or no room to wait for the rest of it
+	if ((kept && end <= oldest) || (end > newest && ets->npending == ETS_MAX_PENDING)) {
+		ets->dropped++;
+		return;
+	}
+	for (uint32_t n = 1; n <= kept; n++) {
+		uint32_t i = (ets->nhistory - n) % ETS_HISTORY;
+		if (ets->history_ns[i] < start) break;
+		bin(ets, t_ns, ets->history_ns[i], ets->history[i]);
+	}
+	ets->captures++;
+	if (end > newest) ets->pending[ets->npending++] = t_ns;
+}
+
+// in-band trigger between the reading before and this one, at the interpolated crossing
+static void detect(ETS_t *ets, int64_t prev_ns, uint16_t prev, int64_t t_ns, uint16_t raw)
+{
+	const ETS_CONFIG_t *c = &ets->config;
+	int rising = c->edge == ETS_TRIGGER_RISING;
+	int crossed = rising ? (prev < c->level && raw >= c->level) : (prev > c->level && raw <= c->level);
+	if (ets->armed && crossed) {
+		ets->armed = 0;
+		int64_t trigger_ns = prev_ns + (t_ns - prev_ns) * ((int32_t)c->level - prev) / ((int32_t)raw - prev);
+		ets_add_trigger(ets, trigger_ns);
+	}
+	if (rising ? raw + c->hysteresis < c->level : raw > c->level + c->hysteresis) ets->armed = 1;
+}
+
+void ets_add_sample(ETS_t *ets, uint16_t raw, int64_t t_ns)
+{
+	for (int p = 0; p < ets->npending; p++) bin(ets, ets->pending[p], t_ns, raw);
+
+	int have_prev = ets->nhistory > 0;
+	uint32_t last = (ets->nhistory - 1) % ETS_HISTORY;
+	int64_t prev_ns = have_prev ? ets->history_ns[last] : 0;
+	uint16_t prev = have_prev ? ets->history[last] : 0;
+	uint32_t i = ets->nhistory++ % ETS_HISTORY;
+	ets->history_ns[i] = t_ns;
+	ets->history[i] = raw;
+
+	// windows are in trigger order, so they close in order too
+	int closed = 0;
+	while (closed < ets->npending && window_end(ets, ets->pending[closed]) <= t_ns) closed++;
+	if (closed) {
+		ets->npending -= closed;
+		memmove(ets->pending, ets->pending + closed, ets->npending * sizeof(ets->pending[0]));
+	}
+
+	if (ets->config.edge != ETS_TRIGGER_EXTERNAL && have_prev && t_ns > prev_ns) detect(ets, prev_ns, prev, t_ns, raw);
+}
+
+void ets_add_samples(ETS_t *ets, const uint16_t *raw, int count, int64_t t0_ns, uint32_t period_ns)
+{
+	for (int k = 0; k < count; k++) ets_add_sample(ets, raw[k], t0_ns + (int64_t)k * period_ns);
+}
+
+void ets_read(const ETS_t *ets, uint16_t *mean, uint32_t *counts)
+{
+	for (int i = 0; i < ets->config.bins; i++) {
+		uint32_t n = ets->count[i];
+		mean[i] = n ? (ets->sum[i] + n / 2) / n : 0;
+		if (counts) counts[i] = n;
+	}
+}
+
+void ets_get_stats(const ETS_t *ets, ETS_STATS_t *stats)
+{
+	memset(stats, 0, sizeof(*stats));
+	stats->captures = ets->captures;
+	stats->dropped = ets->dropped;
+	stats->samples = ets->samples;
+	stats->min_count = UINT32_MAX;
+	for (int i = 0; i < ets->config.bins; i++) {
+		uint32_t n = ets->count[i];
+		if (n < stats->min_count) stats->min_count = n;
+		if (n > stats->max_count) stats->max_count = n;
+		if (n == 0) continue;
+		stats->filled++;
+		if (n < 2) continue;
+		float mean = (float)ets->sum[i] / n;
+		float var = (float)ets->sum_sq[i] / n - mean * mean;
+		float sem = var > 0 ? sqrtf(var / n) : 0;
+		if (sem > stats->max_sem) stats->max_sem = sem;
+	}
+	stats->coverage_permille = stats->filled * 1000 / ets->config.bins;
+	stats->effective_rate_hz = 1000000000u / ets->config.bin_ns;
+}
@@ -0,0 +1,99 @@
+/*
+	 Equivalent-time sampling: one high resolution waveform of a periodic
+	 signal out of many slow acquisitions.
+
+	 The ADC samples far slower than the signals we probe, but it samples
+	 at instants that have nothing to do with the signal. Relative to a
+	 trigger on the signal (a crossing of the same level on the same edge)
+	 the readings of many periods land at random offsets, so binning every
+	 reading by its offset from the latest trigger fills a waveform with a
+	 resolution of the bin width instead of the sample period.
+
+	 Triggers come either from outside with their time, ets_add_trigger()
+	 with the edge times of hal_gpio_capture_read() for instance, or are
+	 found in the readings themselves, interpolated between the two
+	 readings around the crossing (config.edge). The latter only places
+	 the trigger right when the signal is slow around the crossing.
+
+	 All times are in ns on the monotonic clock, and they have to be the
+	 times the readings were really taken: a few us off smear the waveform
+	 as much as a bin of that width. Readings have to come in
+	 time order and so do triggers, but the two may be interleaved any way:
+	 a trigger reaches back over the last ETS_HISTORY readings and waits
+	 for the rest of its window.
+*/
+
+#ifndef MAIN_ETS_H_
+#define MAIN_ETS_H_
+
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#define ETS_MAX_BINS 512
+#define ETS_MAX_PENDING 16		// triggers whose window is still open
+#define ETS_HISTORY 128			// readings kept for triggers that come late
+
+typedef enum {
+	ETS_TRIGGER_EXTERNAL = 0,	// ets_add_trigger() only
+	ETS_TRIGGER_RISING,
+	ETS_TRIGGER_FALLING,
+} ETS_TRIGGER_t;
+
+typedef struct {
+	int32_t start_ns;		// offset of bin 0 from the trigger, negative to see before it
+	uint32_t bin_ns;		// width of a bin, the equivalent sample period
+	uint16_t bins;
+	ETS_TRIGGER_t edge;
+	uint16_t level;			// in-band trigger, raw
+	uint16_t hysteresis;	// raw, the signal has to go back this far before the next trigger
+} ETS_CONFIG_t;
+
+typedef struct {
+	uint32_t captures;		// triggers used
+	uint32_t dropped;		// triggers with no room left or no readings left to reach
+	uint64_t samples;		// readings put into a bin, one reading may go into several windows
+	uint16_t filled;		// bins with at least one reading
+	uint16_t coverage_permille;	// filled of all bins
+	uint32_t min_count;		// readings in the emptiest bin
+	uint32_t max_count;
+	uint32_t effective_rate_hz;	// 1 / bin_ns, the rate the waveform is sampled at
+	float max_sem;			// largest standard error of a bin mean, raw; goes down as 1 / sqrt(count)
+} ETS_STATS_t;
+
+typedef struct {
+	ETS_CONFIG_t config;
+	uint64_t sum[ETS_MAX_BINS];
+	uint64_t sum_sq[ETS_MAX_BINS];
+	uint32_t count[ETS_MAX_BINS];
+	int64_t pending[ETS_MAX_PENDING];	// trigger times, oldest first
+	int npending;
+	int64_t history_ns[ETS_HISTORY];
+	uint16_t history[ETS_HISTORY];
+	uint32_t nhistory;			// readings ever seen, the ring index is nhistory % ETS_HISTORY
+	int armed;					// in-band: back on the other side of the level
+	uint32_t captures;
+	uint32_t dropped;
+	uint64_t samples;
+} ETS_t;
+
+esp_err_t ets_init(ETS_t *ets, const ETS_CONFIG_t *config);
+
+// drops the waveform, keeps the config
+void ets_reset(ETS_t *ets);
+
+// a trigger at t_ns, bins the readings of its window that are already there
+void ets_add_trigger(ETS_t *ets, int64_t t_ns);
+
+// one reading taken at t_ns
+void ets_add_sample(ETS_t *ets, uint16_t raw, int64_t t_ns);
+
+// count readings, the first at t0_ns, then every period_ns
+void ets_add_samples(ETS_t *ets, const uint16_t *raw, int count, int64_t t0_ns, uint32_t period_ns);
+
+// the waveform: mean raw reading per bin, rounded, and the readings it is made of (0: no value)
+void ets_read(const ETS_t *ets, uint16_t *mean, uint32_t *counts);
+
+void ets_get_stats(const ETS_t *ets, ETS_STATS_t *stats);
+
+#endif /* MAIN_ETS_H_ */
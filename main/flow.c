@@ -0,0 +1,187 @@
+/*
+	 Rate control of the streams, see flow.h
+*/
+
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+
+#include "flow.h"
+
+static const char *TAG = "flow";
+
+typedef struct {
+	bool open;
+	bool acking;		// has acknowledged once
+	uint32_t sent;
+	uint32_t acked;
+	uint32_t hold;		// frames sent at the last change, nothing decided until one more is acknowledged
+	int shift;
+	int good;			// intervals in a row well under the target
+	int64_t sent_us[FLOW_RING];
+	// the interval going on
+	uint32_t latency_us;
+	uint32_t blocked_us;
+	uint32_t bytes;
+	uint32_t frames;
+	FLOW_CLIENT_t stats;
+} CLIENT_t;
+
+typedef struct {
+	int num;
+	int factor;
+	uint32_t latency_us;
+} DECISION_t;
+
+static FLOW_IO_t io;
+static SemaphoreHandle_t lock;	// between the stream task and the websocket callback
+static CLIENT_t clients[FLOW_MAX_CLIENTS];
+static int64_t next_us;
+
+esp_err_t flow_init(const FLOW_IO_t *flow_io)
+{
+	io = *flow_io;
+	if (lock == NULL) lock = xSemaphoreCreateMutex();
+	if (lock == NULL) return ESP_ERR_NO_MEM;
+	memset(clients, 0, sizeof(clients));
+	next_us = 0;
+	return ESP_OK;
+}
+
+void flow_open(int num)
+{
+	if (num < 0 || num >= FLOW_MAX_CLIENTS) return;
+	xSemaphoreTake(lock, portMAX_DELAY);
+	memset(&clients[num], 0, sizeof(CLIENT_t));
+	clients[num].open = true;
+	clients[num].stats.factor = 1;
+	xSemaphoreGive(lock);
+}
+
+void flow_close(int num)
+{
+	if (num < 0 || num >= FLOW_MAX_CLIENTS) return;
+	xSemaphoreTake(lock, portMAX_DELAY);
+	clients[num].open = false;
+	xSemaphoreGive(lock);
+}
+
+void flow_sent(int num, int64_t now_us, uint32_t send_us, size_t bytes)
+{
+	if (num < 0 || num >= FLOW_MAX_CLIENTS) return;
+	xSemaphoreTake(lock, portMAX_DELAY);
+	CLIENT_t *c = &clients[num];
+	if (c->open) {
+		c->sent_us[c->sent % FLOW_RING] = now_us;
+		c->sent++;
+		c->frames++;
+		c->bytes += bytes;
+		if (send_us > c->blocked_us) c->blocked_us = send_us;
+	}
+	xSemaphoreGive(lock);
+}
+
+void flow_ack(int num, uint32_t frames, int64_t now_us)
+{
+	if (num < 0 || num >= FLOW_MAX_CLIENTS) return;
+	xSemaphoreTake(lock, portMAX_DELAY);
+	CLIENT_t *c = &clients[num];
+	// counts that go back or ahead of what was sent are not ours to trust
+	if (c->open && frames <= c->sent && frames >= c->acked) {
+		c->acking = true;
+		// only the frames of the current rate, see decide()
+		if (frames > c->acked && frames > c->hold && c->sent - (frames - 1) <= FLOW_RING) {
+			int64_t latency_us = now_us - c->sent_us[(frames - 1) % FLOW_RING];
+			if (latency_us > c->latency_us) c->latency_us = latency_us;
+		}
+		c->acked = frames;
+	}
+	xSemaphoreGive(lock);
+}
+
+// the end of an interval of c, true when its factor changes
+static bool decide(CLIENT_t *c, int64_t now_us, uint32_t interval_us)
+{
+	uint32_t in_flight = c->sent - c->acked;
+	uint32_t latency_us = c->latency_us;
+	if (in_flight >= FLOW_RING) {
+		latency_us = UINT32_MAX;
+	} else if (in_flight > 0) {
+		uint32_t oldest = (int32_t)(c->acked - c->hold) < 0 ? c->hold : c->acked;
+		if (oldest != c->sent && now_us - c->sent_us[oldest % FLOW_RING] > latency_us) latency_us = now_us - c->sent_us[oldest % FLOW_RING];
+	}
+	bool congested = latency_us > io.target_us || c->blocked_us > io.target_us / 4;
+	bool good = latency_us < io.target_us / 2 && c->blocked_us < io.target_us / 8;
+
+	c->stats.latency_us = latency_us;
+	c->stats.in_flight = in_flight;
+	c->stats.blocked_us = c->blocked_us;
+	c->stats.bytes_per_s = (uint64_t)c->bytes * 1000000 / interval_us;
+	uint32_t frames = c->frames;
+	c->latency_us = 0;
+	c->blocked_us = 0;
+	c->bytes = 0;
+	c->frames = 0;
+
+	// the frames of the old rate are still on their way, the first one of the new rate waits behind them
+	if ((int32_t)(c->acked - c->hold) <= 0) return false;
+	int shift = c->shift;
+	if (congested) {
+		c->good = 0;
+		if (c->shift < FLOW_MAX_SHIFT) {
+			c->shift++;
+			c->stats.slower++;
+		}
+	} else if (good) {
+		// an interval without frames tells nothing, a thinned stream has some
+		if (frames > 0 && ++c->good >= FLOW_RECOVER && c->shift > 0) {
+			c->good = 0;
+			c->shift--;
+			c->stats.faster++;
+		}
+	} else {
+		c->good = 0;
+	}
+	if (c->shift == shift) return false;
+	c->hold = c->sent;
+	c->stats.factor = 1 << c->shift;
+	return true;
+}
+
+void flow_update(int64_t now_us)
+{
+	if (io.target_us == 0 || now_us < next_us) return;
+	uint32_t interval_us = next_us ? io.interval_us + (now_us - next_us) : io.interval_us;
+	next_us = now_us + io.interval_us;
+
+	// decided under the lock, applied after it: apply() sends to the clients
+	DECISION_t decisions[FLOW_MAX_CLIENTS];
+	int count = 0;
+	xSemaphoreTake(lock, portMAX_DELAY);
+	for (int num = 0; num < FLOW_MAX_CLIENTS; num++) {
+		CLIENT_t *c = &clients[num];
+		if (!c->open || !c->acking) continue;
+		if (decide(c, now_us, interval_us)) {
+			decisions[count++] = (DECISION_t) { num, c->stats.factor, c->stats.latency_us };
+		}
+	}
+	xSemaphoreGive(lock);
+
+	for (int i = 0; i < count; i++) {
+		ESP_LOGI(TAG, "client %d thinned %d times, latency %u us", decisions[i].num, decisions[i].factor,
+			(unsigned)decisions[i].latency_us);
+		if (io.apply) io.apply(decisions[i].num, decisions[i].factor, decisions[i].latency_us);
+	}
+}
+
+bool flow_get_client(int num, FLOW_CLIENT_t *out)
+{
+	if (num < 0 || num >= FLOW_MAX_CLIENTS) return false;
+	xSemaphoreTake(lock, portMAX_DELAY);
+	bool open = clients[num].open;
+	*out = clients[num].stats;
+	xSemaphoreGive(lock);
+	return open;
+}
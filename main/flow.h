@@ -0,0 +1,69 @@
+/*
+	 Rate control of the streams, per client.
+
+	 The browser acknowledges the stream frames it has received ("K frames",
+	 protocol.h), the stream task tells what it sent and how long each
+	 send blocked. From that, once an interval, every client gets its
+	 latency: the worst of the frames acknowledged in the interval (from
+	 their send to the acknowledgement) and the age of the oldest frame
+	 not acknowledged yet. A send that blocks means the TCP send buffer is
+	 full, the link is behind as well.
+
+	 Over the target, or blocked for a quarter of it, the stream of the
+	 client is thinned twice more (apply(), the session doubles its
+	 decimation): half the frames and bytes. Well under the target for
+	 FLOW_RECOVER intervals in a row while frames flow, it is thinned half
+	 as much again. After a change nothing is decided until the frames
+	 sent since then are acknowledged, so the backlog of the old rate is
+	 not taken for the new one.
+
+	 A client that never acknowledged is left alone, an older page does not
+	 know "K".
+*/
+
+#ifndef MAIN_FLOW_H_
+#define MAIN_FLOW_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "sdkconfig.h"
+
+#define FLOW_MAX_CLIENTS CONFIG_WEBSOCKET_SERVER_MAX_CLIENTS
+#define FLOW_RING 64			// send times of the frames not acknowledged yet
+#define FLOW_MAX_SHIFT 6		// thinned 64 times at most
+#define FLOW_RECOVER 4			// good intervals before a step back
+
+typedef struct {
+	uint32_t target_us;			// end-to-end latency to stay under, 0 for no control
+	uint32_t interval_us;		// between two decisions
+	// the stream of num is to be thinned by factor, a power of two; called by flow_update()
+	void (*apply)(int num, int factor, uint32_t latency_us);
+} FLOW_IO_t;
+
+typedef struct {
+	int factor;
+	uint32_t latency_us;		// of the last interval
+	uint32_t in_flight;			// frames sent and not acknowledged
+	uint32_t blocked_us;		// longest send of the last interval
+	uint32_t bytes_per_s;		// sent in the last interval
+	uint32_t slower;			// decisions so far
+	uint32_t faster;
+} FLOW_CLIENT_t;
+
+esp_err_t flow_init(const FLOW_IO_t *io);
+void flow_open(int num);
+void flow_close(int num);
+
+// a stream frame of bytes went to num at now_us, its send blocked for send_us
+void flow_sent(int num, int64_t now_us, uint32_t send_us, size_t bytes);
+// num has received frames stream frames since it connected
+void flow_ack(int num, uint32_t frames, int64_t now_us);
+// decides for every client, at most once an interval
+void flow_update(int64_t now_us);
+
+bool flow_get_client(int num, FLOW_CLIENT_t *out);
+
+#endif /* MAIN_FLOW_H_ */
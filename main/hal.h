@@ -0,0 +1,106 @@
+/*
+	 Hardware abstraction for the parts of ioto that touch the board:
+	 ADC, DAC, GPIO, a monotonic clock and non-volatile storage.
+
+	 hal_esp.c implements it with ESP-IDF drivers, host/sim/hal_linux.c with
+	 simulated signals so the whole pipeline can run as a Linux process.
+*/
+
+#ifndef MAIN_HAL_H_
+#define MAIN_HAL_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "esp_err.h"
+
+typedef enum {
+	HAL_GPIO_MODE_DISABLE = 0,
+	HAL_GPIO_MODE_INPUT,
+	HAL_GPIO_MODE_OUTPUT,
+} HAL_GPIO_MODE_t;
+
+esp_err_t hal_init(void);
+
+/* ADC, channel is the ADC1 channel number */
+int hal_adc_read_raw(int channel);
+uint32_t hal_adc_raw_to_mv(int raw);
+uint32_t hal_adc_read_mv(int channel, int samples);
+int hal_adc_bits(void);	// width of a raw reading
+
+/* GPIO, the calls of one pin do nothing (or read 0) for a pin hal_gpio_valid() refuses */
+bool hal_gpio_valid(int pin);	// a pin of the chip
+void hal_gpio_reset(int pin);
+void hal_gpio_set_direction(int pin, HAL_GPIO_MODE_t mode);
+void hal_gpio_set_level(int pin, int level);
+int hal_gpio_get_level(int pin);
+
+/* several pins at once, bit n is GPIOn: hal_gpio_output() makes the pins of mask
+   push/pull outputs, pins that already are one are left alone so they do not glitch;
+   hal_gpio_write() sets the pins of mask to their bit of levels in one go, from a
+   task or an interrupt */
+esp_err_t hal_gpio_output(uint64_t mask);
+void hal_gpio_write(uint64_t mask, uint64_t levels);
+
+/* rising edges of one input pin, stamped with hal_clock_us() in the interrupt;
+   one pin at a time, starting another stops the first */
+esp_err_t hal_gpio_capture_start(int pin);
+void hal_gpio_capture_stop(void);
+// the edges since the last read, oldest first, returns their number
+int hal_gpio_capture_read(int64_t *times_us, int max);
+
+/* any edge on a set of input pins (bit n is GPIOn), with the levels of all
+   pins right after it; the digital capture stream of decoder.h */
+typedef struct {
+	int64_t t_us;
+	uint64_t levels;
+} HAL_GPIO_EDGE_t;
+
+esp_err_t hal_gpio_edges_start(uint64_t pins);
+void hal_gpio_edges_stop(void);
+// the edges since the last read, oldest first, returns their number; the first one
+// after the start has the levels at the start
+int hal_gpio_edges_read(HAL_GPIO_EDGE_t *edges, int max);
+// edges lost since the start because the reader was behind
+uint32_t hal_gpio_edges_dropped(void);
+
+/* rising edges of input pins counted in hardware, HAL_PULSE_PINS pins at most;
+   read a pin at least every 32767 of its edges */
+#define HAL_PULSE_PINS 4
+esp_err_t hal_pulse_start(int pin);
+void hal_pulse_stop(int pin);
+// rising edges since hal_pulse_start(), -1 when pin is not counted
+int64_t hal_pulse_count(int pin);
+
+/* the DAC played by DMA from two buffers of len codes at rate_hz, codes from 0 to
+   about HAL_DAC_FULL_SCALE_MV; refill() gets each buffer once it has been played,
+   from a task of the hal, and fills it with the codes that come after the other one;
+   ESP_ERR_NOT_SUPPORTED where the DAC has no DMA (ESP-IDF before 5.1) */
+#define HAL_DAC_BITS 8
+#define HAL_DAC_FULL_SCALE_MV 3300
+typedef void (*HAL_DAC_REFILL_t)(uint8_t *buf, size_t len, void *arg);
+esp_err_t hal_dac_stream_start(int channel, uint32_t rate_hz, size_t len, HAL_DAC_REFILL_t refill, void *arg);
+void hal_dac_stream_stop(void);
+
+/* a hardware timer: alarm() runs in its interrupt right after hal_alarm_start(), then
+   again at each time it returns, -1 to stop; times are us since the start */
+typedef int64_t (*HAL_ALARM_t)(int64_t now_us, void *arg);
+esp_err_t hal_alarm_start(HAL_ALARM_t alarm, void *arg);
+void hal_alarm_stop(void);
+
+/* a second hardware timer that reloads itself: tick() runs in its interrupt every
+   period_us, whatever the latency of the one before, and returns true when it woke a
+   task that is to run at once; the pace of the acquisition */
+typedef bool (*HAL_TICK_t)(void *arg);
+esp_err_t hal_tick_start(uint32_t period_us, HAL_TICK_t tick, void *arg);
+void hal_tick_stop(void);
+
+/* microseconds since boot, never goes backwards */
+int64_t hal_clock_us(void);
+
+/* key/value storage that survives a reboot, keys are at most 15 characters */
+esp_err_t hal_storage_get(const char *key, void *buf, size_t *len);
+esp_err_t hal_storage_set(const char *key, const void *buf, size_t len);
+
+#endif /* MAIN_HAL_H_ */
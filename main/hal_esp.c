@@ -0,0 +1,636 @@
+/*
+	 ESP-IDF backend of hal.h
+*/
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "driver/gpio.h"
+#include "driver/adc.h"
+#include "driver/pcnt.h"
+#include "driver/timer.h"
+#include "esp_adc_cal.h"
+#include "esp_attr.h"
+#include "esp_intr_alloc.h"
+#include "soc/gpio_reg.h"
+#include "soc/soc.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "esp_idf_version.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 1, 0)
+#include "driver/dac_continuous.h"
+#define HAVE_DAC_DMA 1
+#endif
+#include "nvs_flash.h"
+#include "nvs.h"
+
+#include "hal.h"
+
+#define DEFAULT_VREF    1100        //Use adc2_vref_to_gpio() to obtain a better estimate
+#define NVS_NAMESPACE   "ioto"
+
+static const char *TAG = "hal";
+
+static esp_adc_cal_characteristics_t adc_chars;
+static const adc_bits_width_t width = ADC_WIDTH_BIT_13;
+static const int width_bits = 13;
+static const adc_atten_t atten = ADC_ATTEN_DB_11;
+static const adc_unit_t unit = ADC_UNIT_1;
+static uint32_t adc_configured;	// one bit per ADC1 channel
+static uint64_t output_pins;	// configured as outputs, one bit per GPIO
+
+static void check_efuse(void)
+{
+#if CONFIG_IDF_TARGET_ESP32
+    //Check if TP is burned into eFuse
+    if (esp_adc_cal_check_efuse(ESP_ADC_CAL_VAL_EFUSE_TP) == ESP_OK) {
+        printf("eFuse Two Point: Supported\n");
+    } else {
+        printf("eFuse Two Point: NOT supported\n");
+    }
+    //Check Vref is burned into eFuse
+    if (esp_adc_cal_check_efuse(ESP_ADC_CAL_VAL_EFUSE_VREF) == ESP_OK) {
+        printf("eFuse Vref: Supported\n");
+    } else {
+        printf("eFuse Vref: NOT supported\n");
+    }
+#elif CONFIG_IDF_TARGET_ESP32S2
+    if (esp_adc_cal_check_efuse(ESP_ADC_CAL_VAL_EFUSE_TP) == ESP_OK) {
+        printf("eFuse Two Point: Supported\n");
+    } else {
+        printf("Cannot retrieve eFuse Two Point calibration values. Default calibration values will be used.\n");
+    }
+#else
+#error "This example is configured for ESP32/ESP32S2."
+#endif
+}
+
+static void print_char_val_type(esp_adc_cal_value_t val_type)
+{
+    if (val_type == ESP_ADC_CAL_VAL_EFUSE_TP) {
+        printf("Characterized using Two Point Value\n");
+    } else if (val_type == ESP_ADC_CAL_VAL_EFUSE_VREF) {
+        printf("Characterized using eFuse Vref\n");
+    } else {
+        printf("Characterized using Default Vref\n");
+    }
+}
+
+esp_err_t hal_init(void)
+{
+	check_efuse();
+	adc1_config_width(width);
+	// characterize once, it used to be done (and leaked) on every 'A' command
+	esp_adc_cal_value_t val_type = esp_adc_cal_characterize(unit, atten, width, DEFAULT_VREF, &adc_chars);
+	print_char_val_type(val_type);
+	return ESP_OK;
+}
+
+int hal_adc_read_raw(int channel)
+{
+	if ((adc_configured & (1 << channel)) == 0) {
+		adc1_config_channel_atten((adc1_channel_t)channel, atten);
+		adc_configured |= 1 << channel;
+	}
+	return adc1_get_raw((adc1_channel_t)channel);
+}
+
+uint32_t hal_adc_raw_to_mv(int raw)
+{
+	return esp_adc_cal_raw_to_voltage(raw, &adc_chars);
+}
+
+int hal_adc_bits(void)
+{
+	return width_bits;
+}
+
+uint32_t hal_adc_read_mv(int channel, int samples)
+{
+	uint32_t adc_reading = 0;
+	//Multisampling
+	for (int i = 0; i < samples; i++) {
+		adc_reading += hal_adc_read_raw(channel);
+	}
+	adc_reading /= samples;
+	return hal_adc_raw_to_mv(adc_reading);
+}
+
+bool hal_gpio_valid(int pin)
+{
+	return pin >= 0 && pin < GPIO_PIN_COUNT && GPIO_IS_VALID_GPIO(pin);
+}
+
+void hal_gpio_reset(int pin)
+{
+	if (!hal_gpio_valid(pin)) return;
+	gpio_reset_pin(pin);
+	output_pins &= ~(1ULL << pin);
+}
+
+void hal_gpio_set_direction(int pin, HAL_GPIO_MODE_t mode)
+{
+	if (!hal_gpio_valid(pin)) return;
+	if (mode == HAL_GPIO_MODE_OUTPUT) output_pins |= 1ULL << pin;
+	else output_pins &= ~(1ULL << pin);
+	switch (mode) {
+		case HAL_GPIO_MODE_INPUT:
+			gpio_set_direction(pin, GPIO_MODE_INPUT);
+			break;
+		case HAL_GPIO_MODE_OUTPUT:
+			/* Set the GPIO as a push/pull output */
+			gpio_set_direction(pin, GPIO_MODE_OUTPUT);
+			break;
+		default:
+			gpio_set_direction(pin, GPIO_MODE_DISABLE);
+			break;
+	}
+}
+
+void hal_gpio_set_level(int pin, int level)
+{
+	if (!hal_gpio_valid(pin)) return;
+	gpio_set_level(pin, level);
+}
+
+int hal_gpio_get_level(int pin)
+{
+	if (!hal_gpio_valid(pin)) return 0;
+	return gpio_get_level(pin);
+}
+
+esp_err_t hal_gpio_output(uint64_t mask)
+{
+	uint64_t pins = mask & ~output_pins;
+	for (int pin = 0; pin < 64; pin++) {
+		if ((pins & (1ULL << pin)) && !GPIO_IS_VALID_OUTPUT_GPIO(pin)) return ESP_ERR_INVALID_ARG;
+	}
+	for (int pin = 0; pin < 64; pin++) {
+		if ((pins & (1ULL << pin)) == 0) continue;
+		// the output register keeps its bit, the pin comes up at the level it was last given
+		gpio_reset_pin(pin);
+		gpio_set_direction(pin, GPIO_MODE_OUTPUT);
+	}
+	output_pins |= pins;
+	return ESP_OK;
+}
+
+void IRAM_ATTR hal_gpio_write(uint64_t mask, uint64_t levels)
+{
+	// the set and clear registers only change the bits written as 1: no read back, no lock,
+	// and the pins of a bank of 32 change within two bus writes of each other
+	uint32_t set = mask & levels, clear = mask & ~levels;
+	if (set) REG_WRITE(GPIO_OUT_W1TS_REG, set);
+	if (clear) REG_WRITE(GPIO_OUT_W1TC_REG, clear);
+	set = (mask & levels) >> 32;
+	clear = (mask & ~levels) >> 32;
+	if (set) REG_WRITE(GPIO_OUT1_W1TS_REG, set);
+	if (clear) REG_WRITE(GPIO_OUT1_W1TC_REG, clear);
+}
+
+// edge times from the interrupt, a ring with the ISR as the only writer
+#define CAPTURE_SIZE 256
+static int64_t capture_us[CAPTURE_SIZE];
+static volatile uint32_t capture_head;
+static uint32_t capture_tail;
+static int capture_pin = -1;
+
+static void IRAM_ATTR capture_isr(void *arg)
+{
+	int64_t now = esp_timer_get_time();
+	uint32_t head = capture_head;
+	if (head - capture_tail >= CAPTURE_SIZE) return;	// full, the reader is behind
+	capture_us[head % CAPTURE_SIZE] = now;
+	capture_head = head + 1;
+}
+
+// the per pin interrupt handlers, shared by capture and edges
+static esp_err_t isr_service(void)
+{
+	static bool installed;
+	if (installed) return ESP_OK;
+	esp_err_t err = gpio_install_isr_service(ESP_INTR_FLAG_IRAM);
+	if (err == ESP_OK) installed = true;
+	return err;
+}
+
+esp_err_t hal_gpio_capture_start(int pin)
+{
+	esp_err_t err = isr_service();
+	if (err != ESP_OK) return err;
+	hal_gpio_capture_stop();
+	gpio_set_direction(pin, GPIO_MODE_INPUT);
+	output_pins &= ~(1ULL << pin);
+	gpio_set_intr_type(pin, GPIO_INTR_POSEDGE);
+	capture_tail = capture_head;
+	err = gpio_isr_handler_add(pin, capture_isr, NULL);
+	if (err == ESP_OK) capture_pin = pin;
+	return err;
+}
+
+void hal_gpio_capture_stop(void)
+{
+	if (capture_pin < 0) return;
+	gpio_isr_handler_remove(capture_pin);
+	gpio_set_intr_type(capture_pin, GPIO_INTR_DISABLE);
+	capture_pin = -1;
+}
+
+int hal_gpio_capture_read(int64_t *times_us, int max)
+{
+	int n = 0;
+	uint32_t head = capture_head;
+	while (capture_tail != head && n < max) times_us[n++] = capture_us[capture_tail++ % CAPTURE_SIZE];
+	return n;
+}
+
+// any edge of a set of pins with a snapshot of all input levels, the same ring scheme
+#define EDGES_SIZE 256
+static HAL_GPIO_EDGE_t edges_ring[EDGES_SIZE];
+static volatile uint32_t edges_head;
+static uint32_t edges_tail;
+static volatile uint32_t edges_dropped;
+static uint64_t edges_pins;
+
+static inline uint64_t input_levels(void)
+{
+	return REG_READ(GPIO_IN_REG) | (uint64_t)REG_READ(GPIO_IN1_REG) << 32;
+}
+
+static void IRAM_ATTR edges_isr(void *arg)
+{
+	int64_t now = esp_timer_get_time();
+	uint64_t levels = input_levels();
+	uint32_t head = edges_head;
+	if (head - edges_tail >= EDGES_SIZE) {
+		edges_dropped++;
+		return;
+	}
+	edges_ring[head % EDGES_SIZE] = (HAL_GPIO_EDGE_t) { .t_us = now, .levels = levels };
+	edges_head = head + 1;
+}
+
+esp_err_t hal_gpio_edges_start(uint64_t pins)
+{
+	esp_err_t err = isr_service();
+	if (err != ESP_OK) return err;
+	hal_gpio_edges_stop();
+	for (int pin = 0; pin < 64; pin++) {
+		if ((pins & (1ULL << pin)) == 0) continue;
+		gpio_set_direction(pin, GPIO_MODE_INPUT);
+		gpio_set_intr_type(pin, GPIO_INTR_ANYEDGE);
+	}
+	output_pins &= ~pins;
+	// where the lines are to begin with
+	edges_tail = edges_head;
+	edges_dropped = 0;
+	edges_ring[edges_head % EDGES_SIZE] = (HAL_GPIO_EDGE_t) { .t_us = esp_timer_get_time(), .levels = input_levels() };
+	edges_head++;
+	for (int pin = 0; pin < 64; pin++) {
+		if ((pins & (1ULL << pin)) == 0) continue;
+		err = gpio_isr_handler_add(pin, edges_isr, NULL);
+		if (err != ESP_OK) break;
+		edges_pins |= 1ULL << pin;
+	}
+	if (err != ESP_OK) hal_gpio_edges_stop();
+	return err;
+}
+
+void hal_gpio_edges_stop(void)
+{
+	for (int pin = 0; pin < 64; pin++) {
+		if ((edges_pins & (1ULL << pin)) == 0) continue;
+		gpio_isr_handler_remove(pin);
+		gpio_set_intr_type(pin, GPIO_INTR_DISABLE);
+	}
+	edges_pins = 0;
+}
+
+int hal_gpio_edges_read(HAL_GPIO_EDGE_t *edges, int max)
+{
+	int n = 0;
+	uint32_t head = edges_head;
+	while (edges_tail != head && n < max) edges[n++] = edges_ring[edges_tail++ % EDGES_SIZE];
+	return n;
+}
+
+uint32_t hal_gpio_edges_dropped(void)
+{
+	return edges_dropped;
+}
+
+// one PCNT unit per pin; the counter goes back to 0 at PULSE_LIMIT and is unwrapped on every read
+#define PULSE_LIMIT 32767
+typedef struct {
+	bool used;
+	int pin;
+	int16_t last;
+	int64_t count;
+} PULSE_t;
+static PULSE_t pulse[HAL_PULSE_PINS];
+
+static PULSE_t *find_pulse(int pin)
+{
+	for (int i = 0; i < HAL_PULSE_PINS; i++) {
+		if (pulse[i].used && pulse[i].pin == pin) return &pulse[i];
+	}
+	return NULL;
+}
+
+esp_err_t hal_pulse_start(int pin)
+{
+	if (find_pulse(pin)) return ESP_OK;
+	int unit = 0;
+	while (unit < HAL_PULSE_PINS && pulse[unit].used) unit++;
+	if (unit == HAL_PULSE_PINS) return ESP_ERR_NO_MEM;
+	pcnt_config_t config = {
+		.pulse_gpio_num = pin,
+		.ctrl_gpio_num = PCNT_PIN_NOT_USED,
+		.channel = PCNT_CHANNEL_0,
+		.unit = unit,
+		.pos_mode = PCNT_COUNT_INC,
+		.neg_mode = PCNT_COUNT_DIS,
+		.lctrl_mode = PCNT_MODE_KEEP,
+		.hctrl_mode = PCNT_MODE_KEEP,
+		.counter_h_lim = PULSE_LIMIT,
+		.counter_l_lim = 0,
+	};
+	esp_err_t err = pcnt_unit_config(&config);
+	if (err != ESP_OK) return err;
+	pcnt_counter_pause(unit);
+	pcnt_counter_clear(unit);
+	pcnt_counter_resume(unit);
+	pulse[unit] = (PULSE_t) { .used = true, .pin = pin };
+	return ESP_OK;
+}
+
+void hal_pulse_stop(int pin)
+{
+	PULSE_t *p = find_pulse(pin);
+	if (p == NULL) return;
+	pcnt_counter_pause(p - pulse);
+	p->used = false;
+}
+
+int64_t hal_pulse_count(int pin)
+{
+	PULSE_t *p = find_pulse(pin);
+	if (p == NULL) return -1;
+	int16_t value;
+	if (pcnt_get_counter_value(p - pulse, &value) != ESP_OK) return p->count;
+	p->count += (value - p->last + PULSE_LIMIT) % PULSE_LIMIT;
+	p->last = value;
+	return p->count;
+}
+
+#ifdef HAVE_DAC_DMA
+/*
+	 The DAC on its DMA: every descriptor that has been played comes back
+	 through the interrupt and a queue to dac_task, which has the next codes
+	 made into dac_buf and copies them in.
+*/
+static dac_continuous_handle_t dac_handle;
+static QueueHandle_t dac_queue;
+static SemaphoreHandle_t dac_stopped;
+static HAL_DAC_REFILL_t dac_refill;
+static void *dac_arg;
+static uint8_t *dac_buf;
+static size_t dac_len;
+
+static bool IRAM_ATTR on_dac_done(dac_continuous_handle_t handle, const dac_event_data_t *event, void *user_data)
+{
+	BaseType_t woken = pdFALSE;
+	xQueueSendFromISR(dac_queue, event, &woken);
+	return woken == pdTRUE;
+}
+
+static void dac_task(void *pvParameters)
+{
+	dac_event_data_t event;
+	while (xQueueReceive(dac_queue, &event, portMAX_DELAY) == pdTRUE && event.buf) {
+		dac_refill(dac_buf, dac_len, dac_arg);
+		dac_continuous_write_asynchronously(dac_handle, event.buf, event.buf_size, dac_buf, dac_len, NULL);
+	}
+	xSemaphoreGive(dac_stopped);
+	vTaskDelete(NULL);
+}
+
+esp_err_t hal_dac_stream_start(int channel, uint32_t rate_hz, size_t len, HAL_DAC_REFILL_t refill, void *arg)
+{
+	if (dac_handle) return ESP_ERR_INVALID_STATE;
+	if (channel != 1 && channel != 2) return ESP_ERR_INVALID_ARG;
+	dac_continuous_config_t config = {
+		.chan_mask = channel == 1 ? DAC_CHANNEL_MASK_CH0 : DAC_CHANNEL_MASK_CH1,
+		.desc_num = 2,
+		.buf_size = len,
+		.freq_hz = rate_hz,
+		.offset = 0,
+		.clk_src = DAC_DIGI_CLK_SRC_DEFAULT,
+		.chan_mode = DAC_CHANNEL_MODE_SIMUL,
+	};
+	if (dac_queue == NULL) {
+		dac_queue = xQueueCreate(4, sizeof(dac_event_data_t));
+		dac_stopped = xSemaphoreCreateBinary();
+		if (dac_queue == NULL || dac_stopped == NULL) return ESP_ERR_NO_MEM;
+	}
+	dac_buf = malloc(len);
+	if (dac_buf == NULL) return ESP_ERR_NO_MEM;
+	dac_len = len;
+	dac_refill = refill;
+	dac_arg = arg;
+	xQueueReset(dac_queue);
+
+	esp_err_t err = dac_continuous_new_channels(&config, &dac_handle);
+	if (err == ESP_OK) {
+		dac_event_callbacks_t callbacks = { .on_convert_done = on_dac_done };
+		err = dac_continuous_register_event_callback(dac_handle, &callbacks, NULL);
+	}
+	if (err == ESP_OK) err = dac_continuous_enable(dac_handle);
+	if (err == ESP_OK && xTaskCreate(dac_task, "dac_task", 1024 * 2, NULL, 10, NULL) != pdPASS) err = ESP_ERR_NO_MEM;
+	if (err == ESP_OK) err = dac_continuous_start_async_writing(dac_handle);
+	if (err != ESP_OK) {
+		ESP_LOGE(TAG, "DAC %d at %u Hz: %s", channel, (unsigned)rate_hz, esp_err_to_name(err));
+		hal_dac_stream_stop();
+	}
+	return err;
+}
+
+void hal_dac_stream_stop(void)
+{
+	if (dac_handle == NULL) return;
+	dac_event_data_t last = { 0 };
+	if (xQueueSend(dac_queue, &last, pdMS_TO_TICKS(100)) == pdTRUE) xSemaphoreTake(dac_stopped, pdMS_TO_TICKS(100));
+	dac_continuous_stop_async_writing(dac_handle);
+	dac_continuous_disable(dac_handle);
+	dac_continuous_del_channels(dac_handle);
+	dac_handle = NULL;
+	free(dac_buf);
+	dac_buf = NULL;
+}
+#else
+/*
+	 Before ESP-IDF 5.1 the DAC has no DMA driver. Writing each code from
+	 a timer interrupt instead would cost the single core an interrupt per
+	 sample, 100000 a second by default, in competition with the tick of
+	 the acquisition; the generator is not offered there.
+*/
+esp_err_t hal_dac_stream_start(int channel, uint32_t rate_hz, size_t len, HAL_DAC_REFILL_t refill, void *arg)
+{
+	ESP_LOGE(TAG, "DAC %d: no DMA for the DAC before ESP-IDF 5.1", channel);
+	return ESP_ERR_NOT_SUPPORTED;
+}
+
+void hal_dac_stream_stop(void)
+{
+}
+#endif
+
+/*
+	 The alarm on timer 0 of group 0 counting us. Whatever fell due while
+	 the alarm function ran is done at once: an alarm set in the past would
+	 only go off after the counter wrapped.
+*/
+#define ALARM_GROUP TIMER_GROUP_0
+#define ALARM_TIMER TIMER_0
+static HAL_ALARM_t alarm_fn;
+static void *alarm_arg;
+static bool alarm_running;
+
+static bool IRAM_ATTR alarm_isr(void *arg)
+{
+	int64_t now = timer_group_get_counter_value_in_isr(ALARM_GROUP, ALARM_TIMER);
+	int64_t next;
+	while ((next = alarm_fn(now, alarm_arg)) >= 0) {
+		now = timer_group_get_counter_value_in_isr(ALARM_GROUP, ALARM_TIMER);
+		if (next > now) {
+			timer_group_set_alarm_value_in_isr(ALARM_GROUP, ALARM_TIMER, next);
+			timer_group_enable_alarm_in_isr(ALARM_GROUP, ALARM_TIMER);
+			break;
+		}
+	}
+	return false;
+}
+
+esp_err_t hal_alarm_start(HAL_ALARM_t alarm, void *arg)
+{
+	hal_alarm_stop();
+	timer_config_t config = {
+		.divider = APB_CLK_FREQ / 1000000,
+		.counter_dir = TIMER_COUNT_UP,
+		.counter_en = TIMER_PAUSE,
+		.alarm_en = TIMER_ALARM_EN,
+		.auto_reload = TIMER_AUTORELOAD_DIS,
+	};
+	esp_err_t err = timer_init(ALARM_GROUP, ALARM_TIMER, &config);
+	if (err != ESP_OK) return err;
+	alarm_fn = alarm;
+	alarm_arg = arg;
+	alarm_running = true;
+	timer_set_counter_value(ALARM_GROUP, ALARM_TIMER, 0);
+	timer_set_alarm_value(ALARM_GROUP, ALARM_TIMER, 1);
+	timer_enable_intr(ALARM_GROUP, ALARM_TIMER);
+	err = timer_isr_callback_add(ALARM_GROUP, ALARM_TIMER, alarm_isr, NULL, ESP_INTR_FLAG_IRAM);
+	if (err == ESP_OK) err = timer_start(ALARM_GROUP, ALARM_TIMER);
+	if (err != ESP_OK) {
+		ESP_LOGE(TAG, "alarm timer: %s", esp_err_to_name(err));
+		hal_alarm_stop();
+	}
+	return err;
+}
+
+void hal_alarm_stop(void)
+{
+	if (!alarm_running) return;
+	timer_pause(ALARM_GROUP, ALARM_TIMER);
+	timer_disable_intr(ALARM_GROUP, ALARM_TIMER);
+	timer_isr_callback_remove(ALARM_GROUP, ALARM_TIMER);
+	timer_deinit(ALARM_GROUP, ALARM_TIMER);
+	alarm_running = false;
+}
+
+/*
+	 The tick on timer 1 of group 0, reloaded by the timer itself when it
+	 goes off, so the period does not drift with the latency of the
+	 interrupt.
+*/
+#define TICK_GROUP TIMER_GROUP_0
+#define TICK_TIMER TIMER_1
+static HAL_TICK_t tick_fn;
+static void *tick_arg;
+static bool tick_running;
+
+static bool IRAM_ATTR tick_isr(void *arg)
+{
+	return tick_fn(tick_arg);
+}
+
+esp_err_t hal_tick_start(uint32_t period_us, HAL_TICK_t tick, void *arg)
+{
+	if (period_us == 0) return ESP_ERR_INVALID_ARG;
+	hal_tick_stop();
+	timer_config_t config = {
+		.divider = APB_CLK_FREQ / 1000000,
+		.counter_dir = TIMER_COUNT_UP,
+		.counter_en = TIMER_PAUSE,
+		.alarm_en = TIMER_ALARM_EN,
+		.auto_reload = TIMER_AUTORELOAD_EN,
+	};
+	esp_err_t err = timer_init(TICK_GROUP, TICK_TIMER, &config);
+	if (err != ESP_OK) return err;
+	tick_fn = tick;
+	tick_arg = arg;
+	tick_running = true;
+	timer_set_counter_value(TICK_GROUP, TICK_TIMER, 0);
+	timer_set_alarm_value(TICK_GROUP, TICK_TIMER, period_us);
+	timer_enable_intr(TICK_GROUP, TICK_TIMER);
+	err = timer_isr_callback_add(TICK_GROUP, TICK_TIMER, tick_isr, NULL, ESP_INTR_FLAG_IRAM);
+	if (err == ESP_OK) err = timer_start(TICK_GROUP, TICK_TIMER);
+	if (err != ESP_OK) {
+		ESP_LOGE(TAG, "tick timer: %s", esp_err_to_name(err));
+		hal_tick_stop();
+	}
+	return err;
+}
+
+void hal_tick_stop(void)
+{
+	if (!tick_running) return;
+	timer_pause(TICK_GROUP, TICK_TIMER);
+	timer_disable_intr(TICK_GROUP, TICK_TIMER);
+	timer_isr_callback_remove(TICK_GROUP, TICK_TIMER);
+	timer_deinit(TICK_GROUP, TICK_TIMER);
+	tick_running = false;
+}
+
+int64_t hal_clock_us(void)
+{
+	return esp_timer_get_time();
+}
+
+esp_err_t hal_storage_get(const char *key, void *buf, size_t *len)
+{
+	nvs_handle_t handle;
+	esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READONLY, &handle);
+	if (err != ESP_OK) return err;
+	err = nvs_get_blob(handle, key, buf, len);
+	nvs_close(handle);
+	return err;
+}
+
+esp_err_t hal_storage_set(const char *key, const void *buf, size_t len)
+{
+	nvs_handle_t handle;
+	esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &handle);
+	if (err != ESP_OK) return err;
+	err = nvs_set_blob(handle, key, buf, len);
+	if (err == ESP_OK) err = nvs_commit(handle);
+	nvs_close(handle);
+	if (err != ESP_OK) ESP_LOGW(TAG, "storing %s failed: %s", key, esp_err_to_name(err));
+	return err;
+}
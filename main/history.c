@@ -0,0 +1,193 @@
+/*
+	 Recent history for late clients, see history.h
+*/
+
+#include <stdbool.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+
+#include "history.h"
+
+#if HISTORY_POINTS < 1 || HISTORY_POINTS > 65535
+#error "CONFIG_HISTORY_SECONDS / CONFIG_HISTORY_POINT_MS must make 1 to 65535 points, a codec block holds no more"
+#endif
+
+static const char *TAG = "history";
+
+static HISTORY_IO_t io;
+static SemaphoreHandle_t lock;	// the rings, between the stream task and the snapshot
+static HISTORY_STATS_t stats;
+
+// the rings; head counts the points since the start, the ring index is head % HISTORY_POINTS
+static uint16_t points[HISTORY_POINTS];
+static uint32_t head;
+static int64_t last_us;		// monotonic time of the newest point
+static HISTORY_CHANGE_t changes[HISTORY_CHANGES];
+static uint32_t nchanges;		// since the start, the same way
+static HISTORY_CHANGE_t evicted;	// the last change that went out of the ring, when nchanges > HISTORY_CHANGES
+static uint64_t last_pins, last_levels;
+
+// the point being averaged
+static uint32_t next_seq;
+static int64_t next_t0_us;	// of the block after the last one
+static uint16_t last_raw;	// what a missing reading is taken as
+static uint32_t period_us;
+static int per_point;		// readings in a point
+static uint32_t acc;
+static int acc_n;
+
+// copies of the snapshot, made under the lock and encoded after it
+static uint16_t snap_points[HISTORY_POINTS];
+static HISTORY_CHANGE_t snap_changes[HISTORY_CHANGES + 1];
+
+esp_err_t history_init(const HISTORY_IO_t *history_io)
+{
+	io = *history_io;
+	lock = xSemaphoreCreateMutex();
+	if (lock == NULL) return ESP_ERR_NO_MEM;
+	return ESP_OK;
+}
+
+static void restart(const SAMPLE_BLOCK_t *block)
+{
+	if (head > 0) {
+		stats.restarts++;
+		ESP_LOGD(TAG, "restart at block %u, %u points dropped", (unsigned)block->seq, (unsigned)stats.points);
+	}
+	head = 0;
+	nchanges = 0;
+	acc = 0;
+	acc_n = 0;
+	period_us = block->period_us;
+	uint32_t interval_us = CONFIG_HISTORY_POINT_MS * 1000;
+	per_point = period_us > 0 && interval_us > period_us ? (interval_us + period_us / 2) / period_us : 1;
+	stats.interval_us = per_point * period_us;
+	stats.points = 0;
+}
+
+static void add_point(uint16_t value, int64_t t_us, uint64_t pins, uint64_t levels)
+{
+	points[head % HISTORY_POINTS] = value;
+	last_us = t_us;
+	if (head == 0 || pins != last_pins || levels != last_levels) {
+		if (nchanges >= HISTORY_CHANGES) evicted = changes[nchanges % HISTORY_CHANGES];
+		changes[nchanges % HISTORY_CHANGES] = (HISTORY_CHANGE_t) { .point = head, .pins = pins, .levels = levels };
+		nchanges++;
+		stats.changes++;
+		last_pins = pins;
+		last_levels = levels;
+	}
+	head++;
+	stats.points = head < HISTORY_POINTS ? head : HISTORY_POINTS;
+}
+
+// the readings of the blocks from next_t0_us to block as last_raw; false when that is not
+// possible or worth it, the history starts over
+static bool fill(const SAMPLE_BLOCK_t *block)
+{
+	if ((head == 0 && acc_n == 0) || block->t0_us <= next_t0_us) return false;
+	int64_t missing = (block->t0_us - next_t0_us + period_us / 2) / period_us;
+	if (missing > (int64_t)HISTORY_POINTS * per_point) return false;
+	stats.gaps++;
+	stats.filled += missing;
+	ESP_LOGD(TAG, "blocks %u to %u missing, %lld readings filled", (unsigned)next_seq, (unsigned)block->seq - 1, (long long)missing);
+	// the point being averaged, then whole points, then the start of the next
+	int64_t t_us = next_t0_us;
+	int64_t n = per_point - acc_n;
+	if (missing < n) n = missing;
+	acc += last_raw * n;
+	acc_n += n;
+	missing -= n;
+	t_us += n * period_us;
+	if (acc_n == per_point) {
+		add_point((acc + per_point / 2) / per_point, t_us - (int64_t)per_point * period_us, last_pins, last_levels);
+		acc = 0;
+		acc_n = 0;
+	}
+	for (; missing >= per_point; missing -= per_point, t_us += (int64_t)per_point * period_us) {
+		add_point(last_raw, t_us, last_pins, last_levels);
+	}
+	acc += last_raw * missing;
+	acc_n += missing;
+	return true;
+}
+
+void history_add(const SAMPLE_BLOCK_t *block)
+{
+	uint16_t raw[ACQ_BLOCK_SAMPLES];
+	int count = acquire_block_channel(block, io.channel, raw);
+	uint64_t pins = 0;
+	uint64_t levels = io.levels ? io.levels(&pins) & pins : 0;
+
+	xSemaphoreTake(lock, portMAX_DELAY);
+	if (count == 0 || block->period_us != period_us || (block->seq != next_seq && !fill(block))) restart(block);
+	next_seq = block->seq + 1;
+	next_t0_us = block->t0_us + (int64_t)count * period_us;
+	if (count > 0) last_raw = raw[count - 1];
+	for (int i = 0; i < count; i++) {
+		acc += raw[i];
+		if (++acc_n == per_point) {
+			// the time of the first reading of the point, which may be in the block before
+			int64_t t_us = block->t0_us + (int64_t)(i + 1 - per_point) * period_us;
+			add_point((acc + per_point / 2) / per_point, t_us, pins, levels);
+			acc = 0;
+			acc_n = 0;
+		}
+	}
+	xSemaphoreGive(lock);
+}
+
+int history_snapshot(uint8_t *buf, size_t size, CODEC_t codec)
+{
+	xSemaphoreTake(lock, portMAX_DELAY);
+	uint32_t n = stats.points;
+	uint32_t first = head - n;		// the number of the oldest point
+	int64_t t0_us = last_us - (int64_t)(n > 0 ? n - 1 : 0) * stats.interval_us;
+	uint32_t start = first % HISTORY_POINTS;
+	uint32_t part = HISTORY_POINTS - start < n ? HISTORY_POINTS - start : n;
+	memcpy(snap_points, points + start, part * sizeof(points[0]));
+	memcpy(snap_points + part, points, (n - part) * sizeof(points[0]));
+	// the changes in the window, and the one in force at its first point, which may have gone
+	// out of the ring
+	int nc = 0;
+	uint32_t kept = nchanges < HISTORY_CHANGES ? nchanges : HISTORY_CHANGES;
+	for (uint32_t i = nchanges - kept - (nchanges > HISTORY_CHANGES); i < nchanges; i++) {
+		HISTORY_CHANGE_t c = i < nchanges - kept ? evicted : changes[i % HISTORY_CHANGES];
+		if (c.point <= first) nc = 0;
+		c.point = c.point > first ? c.point - first : 0;
+		snap_changes[nc++] = c;
+	}
+	uint32_t interval_us = stats.interval_us;
+	stats.snapshots++;
+	xSemaphoreGive(lock);
+
+	if (n == 0) return 0;
+	if (size < PROTOCOL_FRAME_HEADER_SIZE) return -1;
+	protocol_put_history_header(buf, &(STREAM_FRAME_t) {
+		.channel = io.channel,
+		.bits = io.bits,
+		.seq = n,
+		.period_us = interval_us,
+		.mv_per_lsb = io.mv_per_lsb,
+		.offset_mv = io.offset_mv,
+		.t0_us = io.stamp ? io.stamp(t0_us) : t0_us,
+	});
+	size_t len = PROTOCOL_FRAME_HEADER_SIZE;
+	if (size - len < 2 + (size_t)nc * PROTOCOL_HISTORY_CHANGE_SIZE) return -1;
+	buf[len++] = nc;
+	buf[len++] = nc >> 8;
+	for (int i = 0; i < nc; i++, len += PROTOCOL_HISTORY_CHANGE_SIZE) protocol_put_history_change(buf + len, &snap_changes[i]);
+	int block_len = codec_encode(codec, snap_points, n, io.bits, buf + len, size - len);
+	if (block_len < 0) return -1;
+	return len + block_len;
+}
+
+void history_get_stats(HISTORY_STATS_t *out)
+{
+	xSemaphoreTake(lock, portMAX_DELAY);
+	*out = stats;
+	xSemaphoreGive(lock);
+}
@@ -0,0 +1,71 @@
+/*
+	 Recent history of the acquisition, for the clients that connect late.
+
+	 The stream task feeds every block: the readings of one channel are
+	 averaged into points of about CONFIG_HISTORY_POINT_MS, and the
+	 levels of the input pins are read once per block. The points go in a
+	 ring of HISTORY_POINTS, the last CONFIG_HISTORY_SECONDS, and the
+	 levels in a ring of their changes. A new client gets all of it as
+	 one binary message, history_snapshot(), before any live frame, so a
+	 page that is loaded again starts with the last seconds instead of an
+	 empty plot.
+
+	 Points are contiguous in time: the readings of blocks that are
+	 missing are taken as the last one before them, so a lost block
+	 leaves a flat stretch instead of an empty plot; a change of the
+	 sample period, or a gap longer than the ring, starts the history
+	 over.
+
+	 The snapshot holds the lock only to copy the rings out, the stream
+	 task never waits for an encode or a send. history_add() from the
+	 stream task, history_snapshot() from one other task at a time.
+*/
+
+#ifndef MAIN_HISTORY_H_
+#define MAIN_HISTORY_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "sdkconfig.h"
+
+#include "acquire.h"
+#include "codec.h"
+#include "protocol.h"
+
+#define HISTORY_POINTS (CONFIG_HISTORY_SECONDS * 1000 / CONFIG_HISTORY_POINT_MS)
+#define HISTORY_CHANGES 64		// changes of the levels kept, the oldest go first
+// a snapshot of a full ring at most: the changes kept and the last one that went
+#define HISTORY_MAX_MESSAGE (PROTOCOL_FRAME_HEADER_SIZE + CODEC_MAX_SIZE(HISTORY_POINTS) \
+	+ 2 + (HISTORY_CHANGES + 1) * PROTOCOL_HISTORY_CHANGE_SIZE)
+
+typedef struct {
+	int channel;			// the ADC channel of the points, sampled all the time
+	int bits;				// width of a raw reading
+	float mv_per_lsb;		// the straight line of the binary frames
+	float offset_mv;
+	// the levels of the pins followed, bit n is GPIOn, and those pins in *pins; none when NULL
+	uint64_t (*levels)(uint64_t *pins);
+	// the t0_us of the snapshot from monotonic time, unchanged when NULL
+	int64_t (*stamp)(int64_t mono_us);
+} HISTORY_IO_t;
+
+typedef struct {
+	uint32_t points;		// in the ring now
+	uint32_t interval_us;	// of a point
+	uint32_t restarts;		// changes of the period and gaps too long that started the history over
+	uint32_t gaps;			// missing blocks filled with the last reading
+	uint32_t filled;		// readings filled in
+	uint32_t changes;		// of the levels, ever
+	uint32_t snapshots;
+} HISTORY_STATS_t;
+
+esp_err_t history_init(const HISTORY_IO_t *io);
+void history_add(const SAMPLE_BLOCK_t *block);
+
+// the history message (protocol.h) in buf, returns its length, 0 with no point yet, -1 when it does not fit
+int history_snapshot(uint8_t *buf, size_t size, CODEC_t codec);
+void history_get_stats(HISTORY_STATS_t *stats);
+
+#endif /* MAIN_HISTORY_H_ */
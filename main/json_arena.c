@@ -0,0 +1,76 @@
+/*
+	 cJSON on an arena, see json_arena.h
+*/
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "cJSON.h"
+#include "sdkconfig.h"
+
+#include "arena.h"
+#include "json_arena.h"
+
+static const char *TAG = "JSON";
+
+static uint64_t buffer[CONFIG_JSON_ARENA_SIZE / sizeof(uint64_t)];
+static ARENA_t arena;
+static TaskHandle_t owner;	// NULL outside of a request
+static uint32_t requests;
+static uint32_t heap_allocs;
+static uint32_t heap_allocs_begin;
+
+static void *json_malloc(size_t size)
+{
+	if (owner && owner == xTaskGetCurrentTaskHandle()) {
+		void *p = arena_alloc(&arena, size);
+		if (p) return p;
+		heap_allocs++;
+	}
+	return malloc(size);
+}
+
+static void json_free(void *p)
+{
+	// arena memory goes back with json_arena_end()
+	if (!arena_owns(&arena, p)) free(p);
+}
+
+void json_arena_init(void)
+{
+	arena_init(&arena, buffer, sizeof(buffer));
+	cJSON_Hooks hooks = {
+		.malloc_fn = json_malloc,
+		.free_fn = json_free,
+	};
+	cJSON_InitHooks(&hooks);
+}
+
+void json_arena_begin(void)
+{
+	arena_reset(&arena);
+	heap_allocs_begin = heap_allocs;
+	owner = xTaskGetCurrentTaskHandle();
+}
+
+void json_arena_end(void)
+{
+	if (heap_allocs != heap_allocs_begin) {
+		ESP_LOGW(TAG, "request outgrew the arena of %u bytes, %u allocations on the heap",
+			(unsigned)arena.size, (unsigned)(heap_allocs - heap_allocs_begin));
+	}
+	owner = NULL;
+	arena_reset(&arena);
+	requests++;
+}
+
+void json_arena_get_stats(JSON_ARENA_STATS_t *stats)
+{
+	stats->requests = requests;
+	stats->heap_allocs = heap_allocs;
+	stats->high = arena.high;
+	stats->size = arena.size;
+}
@@ -0,0 +1,34 @@
+/*
+	 cJSON on an arena.
+
+	 json_arena_init() hooks the allocator of cJSON. Between
+	 json_arena_begin() and json_arena_end() what cJSON allocates for the
+	 task that called begin comes from a static arena of
+	 CONFIG_JSON_ARENA_SIZE bytes, and end gives it all back at once: a
+	 request costs a reset instead of a malloc and a free per node and
+	 string. Other tasks, and a request that outgrows the arena, still
+	 get the heap, so the cJSON calls stay the same, cJSON_Delete()
+	 included.
+
+	 One request at a time: the trees do not outlive json_arena_end().
+*/
+
+#ifndef MAIN_JSON_ARENA_H_
+#define MAIN_JSON_ARENA_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct {
+	uint32_t requests;
+	uint32_t heap_allocs;	// made during a request because the arena was full
+	size_t high;		// most of the arena a request used
+	size_t size;
+} JSON_ARENA_STATS_t;
+
+void json_arena_init(void);
+void json_arena_begin(void);
+void json_arena_end(void);
+void json_arena_get_stats(JSON_ARENA_STATS_t *stats);
+
+#endif /* MAIN_JSON_ARENA_H_ */
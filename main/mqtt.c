@@ -10,18 +10,20 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <stddef.h>
+#include <stdlib.h>
 #include <string.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/event_groups.h"
-#include "freertos/message_buffer.h"
 
 #include "esp_log.h"
 #include "esp_event.h"
 #include "mqtt_client.h"
-#include "cJSON.h"
 
+#include "app.h"
 #include "mqtt.h"
+#include "msg.h"
+#include "trace.h"
 
 static const char *TAG = "MQTT";
 
@@ -33,8 +35,10 @@ int MQTT_CONNECTED_BIT = BIT2;
 int MQTT_DISCONNECTED_BIT = BIT4;
 int MQTT_ERROR_BIT = BIT6;
 
-extern MessageBufferHandle_t xMessageBufferMain;
-extern MessageBufferHandle_t xMessageBufferMqtt;
+// a message the broker sent that comes in more than one MQTT_EVENT_DATA, the topic in the first
+static MSG_t *partial;
+static int partial_next;		// the offset of the part that comes next
+static uint32_t parts_lost;		// parts of messages that were not begun, or dropped unfinished
 
 static void log_error_if_nonzero(const char *message, int error_code)
 {
@@ -43,6 +47,46 @@ static void log_error_if_nonzero(const char *message, int error_code)
 	}
 }
 
+static void drop_partial(void)
+{
+	if (partial == NULL) return;
+	parts_lost++;
+	ESP_LOGW(TAG, "message on %s dropped unfinished at %d bytes, %u lost so far", msg_topic(partial), partial_next, parts_lost);
+	msg_free(partial);
+	partial = NULL;
+}
+
+// runs in the MQTT client task: must not wait for the main loop
+static void data_event(esp_mqtt_event_handle_t event)
+{
+	if (event->current_data_offset == 0) {
+		drop_partial();
+		MSG_t *msg = msg_alloc(MSG_MQTT_DATA);
+		if (msg == NULL) return;
+		msg_set_data(msg, event->topic, event->topic_len, event->data, event->data_len);
+		if (event->data_len < event->total_data_len) {
+			partial = msg;
+			partial_next = event->data_len;
+			return;
+		}
+		msg_send(&main_queue, msg);
+		return;
+	}
+	// a later part: only of the message begun, in order
+	if (partial == NULL || event->current_data_offset != partial_next) {
+		drop_partial();
+		parts_lost++;
+		ESP_LOGW(TAG, "part at %d of %d bytes without its start, dropped", event->current_data_offset, event->total_data_len);
+		return;
+	}
+	msg_append_data(partial, event->data, event->data_len);
+	partial_next += event->data_len;
+	if (partial_next >= event->total_data_len) {
+		msg_send(&main_queue, partial);
+		partial = NULL;
+	}
+}
+
 static esp_err_t mqtt_event_handler(esp_mqtt_event_handle_t event)
 {
 	// your_context_t *context = event->context;
@@ -56,45 +100,21 @@ static esp_err_t mqtt_event_handler(esp_mqtt_event_handle_t event)
 			ESP_LOGI(TAG, "MQTT_EVENT_DISCONNECTED");
 			xEventGroupClearBits(status_event_group, MQTT_CONNECTED_BIT);
 			xEventGroupSetBits(status_event_group, MQTT_DISCONNECTED_BIT);
+			drop_partial();
 			break;
 		case MQTT_EVENT_SUBSCRIBED:
-			ESP_LOGI(TAG, "MQTT_EVENT_SUBSCRIBED, msg_id=%d", event->msg_id);
+			TRACE_I("MQTT_EVENT_SUBSCRIBED, msg_id=%d", event->msg_id);
 			break;
 		case MQTT_EVENT_UNSUBSCRIBED:
-			ESP_LOGI(TAG, "MQTT_EVENT_UNSUBSCRIBED, msg_id=%d", event->msg_id);
+			TRACE_I("MQTT_EVENT_UNSUBSCRIBED, msg_id=%d", event->msg_id);
 			break;
 		case MQTT_EVENT_PUBLISHED:
-			ESP_LOGI(TAG, "MQTT_EVENT_PUBLISHED, msg_id=%d", event->msg_id);
+			TRACE_D("MQTT_EVENT_PUBLISHED, msg_id=%d", event->msg_id);
 			break;
 		case MQTT_EVENT_DATA:
-			ESP_LOGI(TAG, "MQTT_EVENT_DATA");
-			ESP_LOGI(TAG, "TOPIC=[%.*s] DATA=[%.*s]\r", event->topic_len, event->topic, event->data_len, event->data);
-
-			char * topic;
-			topic = malloc(event->topic_len+1);
-			memset(topic, 0, event->topic_len+1);
-			memcpy(topic, event->topic, event->topic_len);
-			char * payload;
-			payload = malloc(event->data_len+1);
-			memset(payload, 0, event->data_len+1);
-			memcpy(payload, event->data, event->data_len);
-
-			cJSON *response;
-			response = cJSON_CreateObject();
-			cJSON_AddStringToObject(response, "id", "subscribe-data");
-			cJSON_AddStringToObject(response, "topic", topic);
-			cJSON_AddStringToObject(response, "payload", payload);
-			char *my_json_string = cJSON_Print(response);
-			ESP_LOGI(TAG, "my_json_string\n%s",my_json_string);
-			size_t xBytesSent = xMessageBufferSend(xMessageBufferMain, my_json_string, strlen(my_json_string), portMAX_DELAY);
-			if (xBytesSent != strlen(my_json_string)) {
-				ESP_LOGE(TAG, "xMessageBufferSend fail");
-			}
-			cJSON_Delete(response);
-			cJSON_free(my_json_string);
-
-			free(topic);
-			free(payload);
+			TRACE_I("MQTT_EVENT_DATA, topic of %d bytes, %d bytes of data at %d of %d", event->topic_len, event->data_len,
+				event->current_data_offset, event->total_data_len);
+			data_event(event);
 			break;
 		case MQTT_EVENT_ERROR:
 			ESP_LOGE(TAG, "MQTT_EVENT_ERROR");
@@ -107,106 +127,48 @@ static esp_err_t mqtt_event_handler(esp_mqtt_event_handle_t event)
 			xEventGroupSetBits(status_event_group, MQTT_ERROR_BIT);
 			break;
 		default:
-			ESP_LOGI(TAG, "Other event id:%d", event->event_id);
+			TRACE_D("Other event id:%d", event->event_id);
 			break;
 	}
 	return ESP_OK;
 }
 
-char *JSON_Types(int type) {
-	if (type == cJSON_Invalid) return ("cJSON_Invalid");
-	if (type == cJSON_False) return ("cJSON_False");
-	if (type == cJSON_True) return ("cJSON_True");
-	if (type == cJSON_NULL) return ("cJSON_NULL");
-	if (type == cJSON_Number) return ("cJSON_Number");
-	if (type == cJSON_String) return ("cJSON_String");
-	if (type == cJSON_Array) return ("cJSON_Array");
-	if (type == cJSON_Object) return ("cJSON_Object");
-	if (type == cJSON_Raw) return ("cJSON_Raw");
-	return NULL;
-}
-
-int array2text(const cJSON * const item, int index, char * buf) {
-	if (cJSON_IsArray(item)) {
-		cJSON *current_element = NULL;
-		int itemNumber = 0;
-		cJSON_ArrayForEach(current_element, item) {
-			ESP_LOGD(TAG, "current_element->type=%s", JSON_Types(current_element->type));
-			if (cJSON_IsNumber(current_element)) {
-				int valueint = current_element->valueint;
-				double valuedouble = current_element->valuedouble;
-				ESP_LOGD(TAG, "valueint[%d]=%d valuedouble[%d]=%f",itemNumber, valueint, itemNumber, valuedouble);
-			}
-			if (cJSON_IsString(current_element)) {
-				const char* string = current_element->valuestring;
-				ESP_LOGD(TAG, "string[%d]=%s",itemNumber, string);
-				if (itemNumber == index) {
-					strcpy(buf, string);
-				}
-			}
-			itemNumber++;
-		}
-		return cJSON_GetArraySize(item);
-	} else {
-		return 0;
-	}
+// the filters of the table again, the broker forgot them with the last session; QoS 0, the table has no QoS
+static void resubscribe(const char *filter, size_t len, void *arg)
+{
+	int msg_id = esp_mqtt_client_subscribe((esp_mqtt_client_handle_t)arg, filter, 0);
+	ESP_LOGI(TAG, "resubscribe [%.*s] msg_id=%d", (int)len, filter, msg_id);
 }
 
-void object2text(cJSON * request, TEXT_t *textBuf) {
-	cJSON *array;
-	array = cJSON_GetObjectItem(request,"host");
-	array2text(array, 0, (char *)textBuf->host);
-	array = cJSON_GetObjectItem(request,"port");
-	array2text(array, 0, (char *)textBuf->port);
-	array = cJSON_GetObjectItem(request,"clientId");
-	array2text(array, 0, (char *)textBuf->clientId);
-	array = cJSON_GetObjectItem(request,"username");
-	array2text(array, 0, (char *)textBuf->username);
-	array = cJSON_GetObjectItem(request,"password");
-	array2text(array, 0, (char *)textBuf->password);
-	array = cJSON_GetObjectItem(request,"topic");
-	array2text(array, 0, (char *)textBuf->topicSub);
-	array2text(array, 1, (char *)textBuf->topicPub);
-	array = cJSON_GetObjectItem(request,"qos");
-	array2text(array, 0, (char *)textBuf->qosSub);
-	array2text(array, 1, (char *)textBuf->qosPub);
-	array = cJSON_GetObjectItem(request,"payload");
-	array2text(array, 0, (char *)textBuf->payload);
-
-	ESP_LOGD(TAG, "textBuf.host=[%s]", textBuf->host);
-	ESP_LOGD(TAG, "textBuf.port=[%s]", textBuf->port);
-	ESP_LOGD(TAG, "textBuf.clientId=[%s]", textBuf->clientId);
-	ESP_LOGD(TAG, "textBuf.username=[%s]", textBuf->username);
-	ESP_LOGD(TAG, "textBuf.password=[%s]", textBuf->password);
-	ESP_LOGD(TAG, "textBuf.topicSub=[%s]", textBuf->topicSub);
-	ESP_LOGD(TAG, "textBuf.topicPub=[%s]", textBuf->topicPub);
-	ESP_LOGD(TAG, "textBuf.qosSub=[%s]", textBuf->qosSub);
-	ESP_LOGD(TAG, "textBuf.qosPub=[%s]", textBuf->qosPub);
-	ESP_LOGD(TAG, "textBuf.payload=[%s]", textBuf->payload);
+// tells the main loop how request went
+static void send_result(MSG_TYPE_t request, bool ok)
+{
+	MSG_t *msg = msg_alloc(MSG_MQTT_RESULT);
+	if (msg == NULL) return;
+	msg->result.request = request;
+	msg->result.ok = ok;
+	TRACE_I("%s result=%s", msg_type_name(request), ok ? "OK" : "NG");
+	msg_send(&main_queue, msg);
 }
 
-
 void mqtt(void *pvParameters)
 {
 	ESP_LOGI(TAG, "Start MQTT");
 	status_event_group = xEventGroupCreate();
 
-	char cRxBuffer[512];
-	TEXT_t textBuf;
 	bool connected = false;
 	esp_mqtt_client_handle_t mqtt_client = NULL;
 
 	while(1) {
-		size_t readBytes = xMessageBufferReceive(xMessageBufferMqtt, cRxBuffer, sizeof(cRxBuffer), portMAX_DELAY );
-		ESP_LOGI(TAG, "readBytes=%d", readBytes);
-		cJSON *request = cJSON_Parse(cRxBuffer);
-		if (cJSON_GetObjectItem(request, "id")) {
-			char *id = cJSON_GetObjectItem(request,"id")->valuestring;
-			ESP_LOGI(TAG, "id=%s",id);
-
-			if ( strcmp (id, "init") == 0) {
+		MSG_t *request = msg_receive(&mqtt_queue, portMAX_DELAY);
+		if (request == NULL) continue;
+		TEXT_t *textBuf = &request->mqtt;
+		TRACE_D("id=%s", msg_type_name(request->type));
+
+		switch (request->type) {
+			case MSG_MQTT_INIT: {
 				ESP_LOGI(TAG, "init connected=%d", connected);
-				if (connected == false) continue;
+				if (connected == false) break;
 				//esp_mqtt_client_stop(mqtt_client);
 				esp_mqtt_client_disconnect(mqtt_client);
 				EventBits_t uxBits = xEventGroupWaitBits(status_event_group, MQTT_DISCONNECTED_BIT | MQTT_ERROR_BIT, true, false, portMAX_DELAY);
@@ -218,61 +180,28 @@ void mqtt(void *pvParameters)
 				} else if( ( uxBits & MQTT_ERROR_BIT ) != 0 ) {
 					ESP_LOGW(TAG, "Disconnect Fail");
 				}
+				break;
 			} // end of init
 
-			if ( strcmp (id, "connect-request") == 0) {
+			case MSG_MQTT_CONNECT: {
 				ESP_LOGI(TAG, "connect-request connected=%d", connected);
-				if (connected == true) continue;
-				object2text(request, &textBuf);
-
-#if 0
-				cJSON *array;
-				array = cJSON_GetObjectItem(request,"host");
-				array2text(array, 0, (char *)textBuf.host);
-				array = cJSON_GetObjectItem(request,"port");
-				array2text(array, 0, (char *)textBuf.port);
-				array = cJSON_GetObjectItem(request,"clientId");
-				array2text(array, 0, (char *)textBuf.clientId);
-				array = cJSON_GetObjectItem(request,"username");
-				array2text(array, 0, (char *)textBuf.username);
-				array = cJSON_GetObjectItem(request,"password");
-				array2text(array, 0, (char *)textBuf.password);
-				array = cJSON_GetObjectItem(request,"topic");
-				array2text(array, 0, (char *)textBuf.topicSub);
-				array2text(array, 1, (char *)textBuf.topicPub);
-				array = cJSON_GetObjectItem(request,"qos");
-				array2text(array, 0, (char *)textBuf.qosSub);
-				array2text(array, 1, (char *)textBuf.qosPub);
-				array = cJSON_GetObjectItem(request,"payload");
-				array2text(array, 0, (char *)textBuf.payload);
-
-				ESP_LOGI(TAG, "textBuf.host=[%s]", textBuf.host);
-				ESP_LOGI(TAG, "textBuf.port=[%s]", textBuf.port);
-				ESP_LOGI(TAG, "textBuf.clientId=[%s]", textBuf.clientId);
-				ESP_LOGI(TAG, "textBuf.username=[%s]", textBuf.username);
-				ESP_LOGI(TAG, "textBuf.password=[%s]", textBuf.password);
-				ESP_LOGI(TAG, "textBuf.topicSub=[%s]", textBuf.topicSub);
-				ESP_LOGI(TAG, "textBuf.topicPub=[%s]", textBuf.topicPub);
-				ESP_LOGI(TAG, "textBuf.qosSub=[%s]", textBuf.qosSub);
-				ESP_LOGI(TAG, "textBuf.qosPub=[%s]", textBuf.qosPub);
-				ESP_LOGI(TAG, "textBuf.payload=[%s]", textBuf.payload);
-#endif
-
-				uint32_t port = strtol( textBuf.port, NULL, 10 );
-				char url[64];
-				sprintf(url,"mqtt://%s", textBuf.host);
+				if (connected == true) break;
+
+				uint32_t port = strtol( text_get(textBuf, TEXT_PORT), NULL, 10 );
+				char url[16 + TEXT_BUF_SIZE];
+				snprintf(url, sizeof(url), "mqtt://%s", text_get(textBuf, TEXT_HOST));
 				ESP_LOGI(TAG, "url=[%s] port=%d", url, port);
 				esp_mqtt_client_config_t mqtt_cfg = {
 					.uri = url,
 					.port = port,
-					.client_id = textBuf.clientId,
+					.client_id = text_get(textBuf, TEXT_CLIENT_ID),
 					.event_handle = mqtt_event_handler
 				};
-				if (strlen(textBuf.username) > 0) {
-					mqtt_cfg.username = textBuf.username;
+				if (text_len(textBuf, TEXT_USERNAME) > 0) {
+					mqtt_cfg.username = text_get(textBuf, TEXT_USERNAME);
 				}
-				if (strlen(textBuf.password) > 0) {
-					mqtt_cfg.password = textBuf.password;
+				if (text_len(textBuf, TEXT_PASSWORD) > 0) {
+					mqtt_cfg.password = text_get(textBuf, TEXT_PASSWORD);
 				}
 
 				mqtt_client = esp_mqtt_client_init(&mqtt_cfg);
@@ -280,146 +209,81 @@ void mqtt(void *pvParameters)
 				EventBits_t uxBits = xEventGroupWaitBits(status_event_group, MQTT_CONNECTED_BIT | MQTT_ERROR_BIT, true, false, portMAX_DELAY);
 				ESP_LOGI(TAG, "xEventGroupWaitBits uxBits=0x%x", uxBits);
 
-				cJSON *response;
-				response = cJSON_CreateObject();
-				cJSON_AddStringToObject(response, "id", "connect-response");
 				if( ( uxBits & MQTT_CONNECTED_BIT ) != 0 ) {
 					ESP_LOGI(TAG, "Connect Success");
 					connected = true;
-					cJSON_AddStringToObject(response, "result", "OK");
+					app_each_filter(resubscribe, mqtt_client);
+					send_result(MSG_MQTT_CONNECT, true);
 				} else if( ( uxBits & MQTT_ERROR_BIT ) != 0 ) {
 					ESP_LOGW(TAG, "Connect Fail");
 					esp_mqtt_client_stop(mqtt_client);
-					cJSON_AddStringToObject(response, "result", "NG");
-				}
-				char *my_json_string = cJSON_Print(response);
-				ESP_LOGI(TAG, "my_json_string\n%s",my_json_string);
-				size_t xBytesSent = xMessageBufferSend(xMessageBufferMain, my_json_string, strlen(my_json_string), portMAX_DELAY);
-				if (xBytesSent != strlen(my_json_string)) {
-					ESP_LOGE(TAG, "xMessageBufferSend fail");
+					send_result(MSG_MQTT_CONNECT, false);
 				}
-				cJSON_Delete(response);
-				cJSON_free(my_json_string);
+				break;
 			} // end of connect-request
 
-			if ( strcmp (id, "disconnect-request") == 0) {
+			case MSG_MQTT_DISCONNECT: {
 				ESP_LOGI(TAG, "disconnect-request connected=%d", connected);
-				if (connected == false) continue;
+				if (connected == false) break;
 				//esp_mqtt_client_stop(mqtt_client);
 				esp_mqtt_client_disconnect(mqtt_client);
 				EventBits_t uxBits = xEventGroupWaitBits(status_event_group, MQTT_DISCONNECTED_BIT | MQTT_ERROR_BIT, true, false, portMAX_DELAY);
 				ESP_LOGI(TAG, "xEventGroupWaitBits uxBits=0x%x", uxBits);
 
-				cJSON *response;
-				response = cJSON_CreateObject();
-				cJSON_AddStringToObject(response, "id", "disconnect-response");
 				if( ( uxBits & MQTT_DISCONNECTED_BIT ) != 0 ) {
 					ESP_LOGI(TAG, "Disconnect Success");
 					esp_mqtt_client_stop(mqtt_client);
 					connected = false;
-					cJSON_AddStringToObject(response, "result", "OK");
+					send_result(MSG_MQTT_DISCONNECT, true);
 				} else if( ( uxBits & MQTT_ERROR_BIT ) != 0 ) {
 					ESP_LOGW(TAG, "Disconnect Fail");
-					cJSON_AddStringToObject(response, "result", "NG");
+					send_result(MSG_MQTT_DISCONNECT, false);
 				}
-				char *my_json_string = cJSON_Print(response);
-				ESP_LOGI(TAG, "my_json_string\n%s",my_json_string);
-				size_t xBytesSent = xMessageBufferSend(xMessageBufferMain, my_json_string, strlen(my_json_string), portMAX_DELAY);
-				if (xBytesSent != strlen(my_json_string)) {
-					ESP_LOGE(TAG, "xMessageBufferSend fail");
-				}
-				cJSON_Delete(response);
-				cJSON_free(my_json_string);
+				break;
 			} // end of disconnect-request
 
-			if ( strcmp (id, "subscribe-request") == 0) {
-				ESP_LOGI(TAG, "subscribe-request connected=%d", connected);
-				if (connected == false) continue;
-				object2text(request, &textBuf);
-				int qos = strtol(textBuf.qosSub, NULL, 10);
-				ESP_LOGI(TAG, "topic=%s qos=%d", textBuf.topicSub, qos);
-				int msg_id = esp_mqtt_client_subscribe(mqtt_client, textBuf.topicSub, qos);
-				ESP_LOGI(TAG, "esp_mqtt_client_subscribe msg_id=%d", msg_id);
-
-				cJSON *response;
-				response = cJSON_CreateObject();
-				cJSON_AddStringToObject(response, "id", "subscribe-response");
-				if (msg_id >= 0) {
-					ESP_LOGI(TAG, "esp_mqtt_client_subscribe Success");
-					cJSON_AddStringToObject(response, "result", "OK");
-				} else {
-					ESP_LOGW(TAG, "esp_mqtt_client_subscribe Fail");
-					cJSON_AddStringToObject(response, "result", "NG");
-				}
-				char *my_json_string = cJSON_Print(response);
-				ESP_LOGI(TAG, "my_json_string\n%s",my_json_string);
-				size_t xBytesSent = xMessageBufferSend(xMessageBufferMain, my_json_string, strlen(my_json_string), portMAX_DELAY);
-				if (xBytesSent != strlen(my_json_string)) {
-					ESP_LOGE(TAG, "xMessageBufferSend fail");
-				}
-				cJSON_Delete(response);
-				cJSON_free(my_json_string);
+			case MSG_MQTT_SUBSCRIBE: {
+				TRACE_I("subscribe-request connected=%d", connected);
+				if (connected == false) break;
+				int qos = strtol(text_get(textBuf, TEXT_QOS_SUB), NULL, 10);
+				int msg_id = esp_mqtt_client_subscribe(mqtt_client, text_get(textBuf, TEXT_TOPIC_SUB), qos);
+				TRACE_I("esp_mqtt_client_subscribe qos=%d msg_id=%d", qos, msg_id);
+				send_result(MSG_MQTT_SUBSCRIBE, msg_id >= 0);
+				break;
 			} // end of subscribe-request
 
-			if ( strcmp (id, "unsubscribe-request") == 0) {
-				ESP_LOGI(TAG, "unsubscribe-request connected=%d", connected);
-				if (connected == false) continue;
-				object2text(request, &textBuf);
-				ESP_LOGI(TAG, "topic=%s", textBuf.topicSub);
-				int msg_id = esp_mqtt_client_unsubscribe(mqtt_client, textBuf.topicSub);
-				ESP_LOGI(TAG, "esp_mqtt_client_unsubscribe msg_id=%d", msg_id);
-
-				cJSON *response;
-				response = cJSON_CreateObject();
-				cJSON_AddStringToObject(response, "id", "unsubscribe-response");
-				if (msg_id >= 0) {
-					ESP_LOGI(TAG, "esp_mqtt_client_unsubscribe Success");
-					cJSON_AddStringToObject(response, "result", "OK");
-				} else {
-					ESP_LOGW(TAG, "esp_mqtt_client_unsubscribe Fail");
-					cJSON_AddStringToObject(response, "result", "NG");
-				}
-				char *my_json_string = cJSON_Print(response);
-				ESP_LOGI(TAG, "my_json_string\n%s",my_json_string);
-				size_t xBytesSent = xMessageBufferSend(xMessageBufferMain, my_json_string, strlen(my_json_string), portMAX_DELAY);
-				if (xBytesSent != strlen(my_json_string)) {
-					ESP_LOGE(TAG, "xMessageBufferSend fail");
-				}
-				cJSON_Delete(response);
-				cJSON_free(my_json_string);
+			case MSG_MQTT_UNSUBSCRIBE: {
+				TRACE_I("unsubscribe-request connected=%d", connected);
+				if (connected == false) break;
+				int msg_id = esp_mqtt_client_unsubscribe(mqtt_client, text_get(textBuf, TEXT_TOPIC_SUB));
+				TRACE_I("esp_mqtt_client_unsubscribe msg_id=%d", msg_id);
+				send_result(MSG_MQTT_UNSUBSCRIBE, msg_id >= 0);
+				break;
 			} // end of unsubscribe-request
 
-			if ( strcmp (id, "publish-request") == 0) {
-				ESP_LOGI(TAG, "publish-request connected=%d", connected);
-				if (connected == false) continue;
-				object2text(request, &textBuf);
-				int qos = strtol(textBuf.qosPub, NULL, 10);
-				ESP_LOGI(TAG, "topic=%s qos=%d payload=%s", textBuf.topicPub, qos, textBuf.payload);
-				int msg_id = esp_mqtt_client_publish(mqtt_client, textBuf.topicPub, textBuf.payload, 0, qos, 0);
-				ESP_LOGI(TAG, "esp_mqtt_client_publish msg_id=%d", msg_id);
-
-				cJSON *response;
-				response = cJSON_CreateObject();
-				cJSON_AddStringToObject(response, "id", "publish-response");
-				if (msg_id >= 0) {
-					ESP_LOGI(TAG, "esp_mqtt_client_publish Success");
-					cJSON_AddStringToObject(response, "result", "OK");
-				} else {
-					ESP_LOGW(TAG, "esp_mqtt_client_publish Fail");
-					cJSON_AddStringToObject(response, "result", "NG");
-				}
-				char *my_json_string = cJSON_Print(response);
-				ESP_LOGI(TAG, "my_json_string\n%s",my_json_string);
-				size_t xBytesSent = xMessageBufferSend(xMessageBufferMain, my_json_string, strlen(my_json_string), portMAX_DELAY);
-				if (xBytesSent != strlen(my_json_string)) {
-					ESP_LOGE(TAG, "xMessageBufferSend fail");
-				}
-				cJSON_Delete(response);
-				cJSON_free(my_json_string);
+			case MSG_MQTT_PUBLISH: {
+				TRACE_D("publish-request connected=%d", connected);
+				if (connected == false) break;
+				int qos = strtol(text_get(textBuf, TEXT_QOS_PUB), NULL, 10);
+				int msg_id = esp_mqtt_client_publish(mqtt_client, text_get(textBuf, TEXT_TOPIC_PUB), text_get(textBuf, TEXT_PAYLOAD),
+					text_len(textBuf, TEXT_PAYLOAD), qos, 0);
+				TRACE_D("esp_mqtt_client_publish qos=%d, %u bytes, msg_id=%d", qos, (unsigned)text_len(textBuf, TEXT_PAYLOAD), msg_id);
+				send_result(MSG_MQTT_PUBLISH, msg_id >= 0);
+				break;
 			} // end of publish-request
 
-		} // end of request
-		cJSON_Delete(request);
+			case MSG_MQTT_EVENT: {
+				// decoded frames and rule events, fire and forget: nobody waits for a result
+				if (connected == false) break;
+				esp_mqtt_client_publish(mqtt_client, msg_topic(request), msg_payload(request), request->data.payload_len, 0, 0);
+				break;
+			}
+
+			default:
+				ESP_LOGW(TAG, "unexpected %s", msg_type_name(request->type));
+				break;
+		}
+		msg_free(request);
 
 	} // end of while
 
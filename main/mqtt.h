@@ -1,13 +1,77 @@
+#ifndef MAIN_MQTT_H_
+#define MAIN_MQTT_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+struct cJSON;
+
+#define TEXT_BUF_SIZE 470	// all the fields of a request together, MSG_t has room for that much
+
+typedef enum {
+	TEXT_HOST,
+	TEXT_PORT,
+	TEXT_CLIENT_ID,
+	TEXT_USERNAME,
+	TEXT_PASSWORD,
+	TEXT_TOPIC_SUB,
+	TEXT_TOPIC_PUB,
+	TEXT_QOS_SUB,
+	TEXT_QOS_PUB,
+	TEXT_PAYLOAD,
+	TEXT_FIELDS
+} TEXT_FIELD_t;
+
+// the fields of a browser request, any length each, one after the other in buf and NUL terminated
 typedef struct {
-	char host[32];
-	char port[32];
-	char clientId[32];
-	char username[32];
-	char password[32];
-	char topicSub[32];
-	char topicPub[32];
-	char qosSub[32];
-	char qosPub[32];
-	char payload[32];
+	uint16_t off[TEXT_FIELDS];
+	uint16_t len[TEXT_FIELDS];
+	uint16_t used;
+	char buf[TEXT_BUF_SIZE];
 } TEXT_t;
 
+// every field empty
+static inline void text_init(TEXT_t *t)
+{
+	memset(t->off, 0, sizeof(t->off));
+	memset(t->len, 0, sizeof(t->len));
+	t->buf[0] = 0;
+	t->used = 1;
+}
+
+// sets field f, cut to what is left of buf; false when it was cut
+static inline bool text_set(TEXT_t *t, TEXT_FIELD_t f, const char *s, size_t len)
+{
+	if (t->used >= TEXT_BUF_SIZE) {
+		t->off[f] = 0;
+		t->len[f] = 0;
+		return len == 0;
+	}
+	size_t room = TEXT_BUF_SIZE - t->used - 1;
+	bool whole = len <= room;
+	if (!whole) len = room;
+	t->off[f] = t->used;
+	t->len[f] = len;
+	memcpy(t->buf + t->used, s, len);
+	t->buf[t->used + len] = 0;
+	t->used += len + 1;
+	return whole;
+}
+
+static inline const char *text_get(const TEXT_t *t, TEXT_FIELD_t f)
+{
+	return t->buf + t->off[f];
+}
+
+static inline size_t text_len(const TEXT_t *t, TEXT_FIELD_t f)
+{
+	return t->len[f];
+}
+
+char *JSON_Types(int type);
+const char *array2text(const struct cJSON * const item, int index);
+void object2text(struct cJSON * request, TEXT_t *textBuf);
+void mqtt(void *pvParameters);
+
+#endif /* MAIN_MQTT_H_ */
@@ -0,0 +1,62 @@
+/*
+	 JSON helpers for the MQTT bridge.
+	 Converts the requests sent by the web application into TEXT_t.
+	 Independent of the MQTT client, so it is also built by the host build.
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "cJSON.h"
+
+#include "mqtt.h"
+
+static const char *TAG = "MQTT";
+
+char *JSON_Types(int type) {
+	if (type == cJSON_Invalid) return ("cJSON_Invalid");
+	if (type == cJSON_False) return ("cJSON_False");
+	if (type == cJSON_True) return ("cJSON_True");
+	if (type == cJSON_NULL) return ("cJSON_NULL");
+	if (type == cJSON_Number) return ("cJSON_Number");
+	if (type == cJSON_String) return ("cJSON_String");
+	if (type == cJSON_Array) return ("cJSON_Array");
+	if (type == cJSON_Object) return ("cJSON_Object");
+	if (type == cJSON_Raw) return ("cJSON_Raw");
+	return NULL;
+}
+
+// the string at index of the array item, NULL when there is none
+const char *array2text(const cJSON * const item, int index) {
+	if (!cJSON_IsArray(item)) return NULL;
+	cJSON *current_element = NULL;
+	int itemNumber = 0;
+	cJSON_ArrayForEach(current_element, item) {
+		ESP_LOGD(TAG, "current_element->type=%s", JSON_Types(current_element->type));
+		if (itemNumber == index) return cJSON_IsString(current_element) ? current_element->valuestring : NULL;
+		itemNumber++;
+	}
+	return NULL;
+}
+
+static void set_field(TEXT_t *textBuf, TEXT_FIELD_t field, cJSON *request, const char *name, int index) {
+	const char *string = array2text(cJSON_GetObjectItem(request, name), index);
+	if (string == NULL) return;
+	if (!text_set(textBuf, field, string, strlen(string))) ESP_LOGW(TAG, "%s[%d] cut to %u bytes", name, index, (unsigned)text_len(textBuf, field));
+	ESP_LOGD(TAG, "%s[%d]=[%s]", name, index, text_get(textBuf, field));
+}
+
+void object2text(cJSON * request, TEXT_t *textBuf) {
+	text_init(textBuf);
+	set_field(textBuf, TEXT_HOST, request, "host", 0);
+	set_field(textBuf, TEXT_PORT, request, "port", 0);
+	set_field(textBuf, TEXT_CLIENT_ID, request, "clientId", 0);
+	set_field(textBuf, TEXT_USERNAME, request, "username", 0);
+	set_field(textBuf, TEXT_PASSWORD, request, "password", 0);
+	set_field(textBuf, TEXT_TOPIC_SUB, request, "topic", 0);
+	set_field(textBuf, TEXT_TOPIC_PUB, request, "topic", 1);
+	set_field(textBuf, TEXT_QOS_SUB, request, "qos", 0);
+	set_field(textBuf, TEXT_QOS_PUB, request, "qos", 1);
+	set_field(textBuf, TEXT_PAYLOAD, request, "payload", 0);
+}
@@ -0,0 +1,162 @@
+/*
+	 Typed message pool and queues, see msg.h
+
+	 The free list is a FreeRTOS queue of pointers like the message queues,
+	 so allocation is safe from any task without a lock of our own.
+*/
+
+#include <string.h>
+
+#include "esp_log.h"
+
+#include "msg.h"
+
+static const char *TAG = "msg";
+
+static MSG_t pool[MSG_POOL_SIZE];
+static QueueHandle_t free_list;
+static _Atomic uint32_t alloc_failed;
+static _Atomic uint32_t data_cut;
+
+static const char *type_names[MSG_TYPE_MAX] = {
+	[MSG_WS_JSON] = "ws-json",
+	[MSG_MQTT_INIT] = "init",
+	[MSG_MQTT_CONNECT] = "connect-request",
+	[MSG_MQTT_DISCONNECT] = "disconnect-request",
+	[MSG_MQTT_SUBSCRIBE] = "subscribe-request",
+	[MSG_MQTT_UNSUBSCRIBE] = "unsubscribe-request",
+	[MSG_MQTT_PUBLISH] = "publish-request",
+	[MSG_MQTT_RESULT] = "result",
+	[MSG_MQTT_DATA] = "subscribe-data",
+	[MSG_MQTT_EVENT] = "event",
+};
+
+esp_err_t msg_pool_init(void)
+{
+	if (free_list) return ESP_OK;
+	free_list = xQueueCreate(MSG_POOL_SIZE, sizeof(MSG_t *));
+	if (free_list == NULL) return ESP_ERR_NO_MEM;
+	for (int i = 0; i < MSG_POOL_SIZE; i++) {
+		MSG_t *msg = &pool[i];
+		xQueueSend(free_list, &msg, 0);
+	}
+	return ESP_OK;
+}
+
+MSG_t *msg_alloc(MSG_TYPE_t type)
+{
+	MSG_t *msg;
+	if (xQueueReceive(free_list, &msg, 0) != pdTRUE) {
+		alloc_failed++;
+		ESP_LOGW(TAG, "pool empty, %s not sent", msg_type_name(type));
+		return NULL;
+	}
+	msg->type = type;
+	return msg;
+}
+
+void msg_free(MSG_t *msg)
+{
+	if (msg == NULL) return;
+	xQueueSend(free_list, &msg, 0);
+}
+
+void msg_pool_stats(uint32_t *free, uint32_t *failed)
+{
+	*free = uxQueueMessagesWaiting(free_list);
+	*failed = alloc_failed;
+}
+
+bool msg_set_data(MSG_t *msg, const char *topic, size_t topic_len, const char *payload, size_t payload_len)
+{
+	bool whole = true;
+	size_t room = sizeof(msg->data.buf) - 2;
+	if (topic_len > room) {
+		topic_len = room;
+		whole = false;
+	}
+	if (payload_len > room - topic_len) {
+		payload_len = room - topic_len;
+		whole = false;
+	}
+	memcpy(msg->data.buf, topic, topic_len);
+	msg->data.buf[topic_len] = 0;
+	memcpy(msg->data.buf + topic_len + 1, payload, payload_len);
+	msg->data.buf[topic_len + 1 + payload_len] = 0;
+	msg->data.topic_len = topic_len;
+	msg->data.payload_len = payload_len;
+	msg->data.cut = !whole;
+	if (!whole) {
+		data_cut++;
+		ESP_LOGW(TAG, "data cut to a topic of %u and %u bytes", (unsigned)topic_len, (unsigned)payload_len);
+	}
+	return whole;
+}
+
+bool msg_append_data(MSG_t *msg, const char *payload, size_t len)
+{
+	size_t room = sizeof(msg->data.buf) - 2 - msg->data.topic_len - msg->data.payload_len;
+	bool whole = len <= room;
+	if (!whole) len = room;
+	char *end = msg->data.buf + msg->data.topic_len + 1 + msg->data.payload_len;
+	if (len > 0) memcpy(end, payload, len);
+	end[len] = 0;
+	msg->data.payload_len += len;
+	if (!whole && !msg->data.cut) {
+		data_cut++;
+		ESP_LOGW(TAG, "data on %s cut to %u bytes", msg->data.buf, (unsigned)msg->data.payload_len);
+	}
+	msg->data.cut |= !whole;
+	return whole;
+}
+
+uint32_t msg_data_cut(void)
+{
+	return data_cut;
+}
+
+esp_err_t msg_queue_init(MSG_QUEUE_t *q, const char *name, int depth, MSG_OVERFLOW_t overflow)
+{
+	memset(q, 0, sizeof(MSG_QUEUE_t));
+	q->queue = xQueueCreate(depth, sizeof(MSG_t *));
+	if (q->queue == NULL) return ESP_ERR_NO_MEM;
+	q->name = name;
+	q->overflow = overflow;
+	return ESP_OK;
+}
+
+esp_err_t msg_send(MSG_QUEUE_t *q, MSG_t *msg)
+{
+	if (xQueueSend(q->queue, &msg, 0) == pdTRUE) {
+		q->sent++;
+		return ESP_OK;
+	}
+	q->dropped++;
+	if (q->overflow == MSG_DROP_OLDEST) {
+		MSG_t *oldest;
+		if (xQueueReceive(q->queue, &oldest, 0) == pdTRUE) {
+			ESP_LOGW(TAG, "%s full, dropped %s", q->name, msg_type_name(oldest->type));
+			msg_free(oldest);
+		}
+		if (xQueueSend(q->queue, &msg, 0) == pdTRUE) {
+			q->sent++;
+			return ESP_OK;
+		}
+	}
+	ESP_LOGW(TAG, "%s full, dropped %s", q->name, msg_type_name(msg->type));
+	msg_free(msg);
+	return ESP_FAIL;
+}
+
+MSG_t *msg_receive(MSG_QUEUE_t *q, TickType_t wait)
+{
+	MSG_t *msg;
+	if (xQueueReceive(q->queue, &msg, wait) != pdTRUE) return NULL;
+	return msg;
+}
+
+const char *msg_type_name(MSG_TYPE_t type)
+{
+	if (type < 0 || type >= MSG_TYPE_MAX) return "unknown";
+	return type_names[type];
+}
@@ -0,0 +1,110 @@
+/*
+	 Typed messages between the main loop, the websocket callback and the
+	 MQTT task.
+
+	 Messages live in a fixed pool and only their handle (a pointer) goes
+	 through the queues, so nothing is copied, serialized or parsed again
+	 on the way. Sending never blocks: a full queue applies its overflow
+	 policy and the dropped message goes back to the pool, so no task can
+	 end up waiting on another one that waits on it.
+*/
+
+#ifndef MAIN_MSG_H_
+#define MAIN_MSG_H_
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "esp_err.h"
+
+#include "mqtt.h"
+
+#define MSG_POOL_SIZE 12
+#define MSG_TEXT_SIZE 512
+
+typedef enum {
+	MSG_WS_JSON,			// JSON request from a browser, text
+	MSG_MQTT_INIT,			// to the MQTT task, no payload
+	MSG_MQTT_CONNECT,		// to the MQTT task, mqtt
+	MSG_MQTT_DISCONNECT,	// to the MQTT task, no payload
+	MSG_MQTT_SUBSCRIBE,		// to the MQTT task, mqtt
+	MSG_MQTT_UNSUBSCRIBE,	// to the MQTT task, mqtt
+	MSG_MQTT_PUBLISH,		// to the MQTT task, mqtt
+	MSG_MQTT_RESULT,		// from the MQTT task, result
+	MSG_MQTT_DATA,			// from the MQTT task, data
+	MSG_MQTT_EVENT,			// to the MQTT task, data the device publishes itself, no result
+	MSG_TYPE_MAX
+} MSG_TYPE_t;
+
+typedef struct {
+	MSG_TYPE_t type;
+	union {
+		TEXT_t mqtt;
+		struct {
+			MSG_TYPE_t request;
+			bool ok;
+		} result;
+		struct {
+			uint16_t topic_len;
+			uint16_t payload_len;
+			bool cut;					// the topic or the payload did not fit
+			char buf[MSG_TEXT_SIZE];	// the topic then the payload, each NUL terminated
+		} data;
+		struct {
+			uint8_t client;				// the websocket client that sent it
+			uint16_t len;
+			char text[MSG_TEXT_SIZE];	// NUL terminated
+		} text;
+	};
+} MSG_t;
+
+typedef enum {
+	MSG_DROP_NEWEST,	// the message being sent is dropped
+	MSG_DROP_OLDEST,	// the oldest queued message makes room
+} MSG_OVERFLOW_t;
+
+typedef struct {
+	QueueHandle_t queue;
+	MSG_OVERFLOW_t overflow;
+	const char *name;
+	_Atomic uint32_t sent;
+	_Atomic uint32_t dropped;
+} MSG_QUEUE_t;
+
+esp_err_t msg_pool_init(void);
+// a free message of type, NULL (never waits) when the pool is empty
+MSG_t *msg_alloc(MSG_TYPE_t type);
+void msg_free(MSG_t *msg);
+// free messages left in the pool and failed allocations so far
+void msg_pool_stats(uint32_t *free, uint32_t *failed);
+
+// topic and payload of any length that fits together, cut to that otherwise; false when cut
+bool msg_set_data(MSG_t *msg, const char *topic, size_t topic_len, const char *payload, size_t payload_len);
+// more of the payload, for a message that comes in parts; false when cut
+bool msg_append_data(MSG_t *msg, const char *payload, size_t len);
+// messages whose data was cut so far
+uint32_t msg_data_cut(void);
+
+static inline const char *msg_topic(const MSG_t *msg)
+{
+	return msg->data.buf;
+}
+
+static inline const char *msg_payload(const MSG_t *msg)
+{
+	return msg->data.buf + msg->data.topic_len + 1;
+}
+
+esp_err_t msg_queue_init(MSG_QUEUE_t *q, const char *name, int depth, MSG_OVERFLOW_t overflow);
+// hands msg over, never blocks; ESP_FAIL when msg itself was dropped (and freed)
+esp_err_t msg_send(MSG_QUEUE_t *q, MSG_t *msg);
+// the next message or NULL after wait ticks; free it with msg_free()
+MSG_t *msg_receive(MSG_QUEUE_t *q, TickType_t wait);
+
+const char *msg_type_name(MSG_TYPE_t type);
+
+#endif /* MAIN_MSG_H_ */
@@ -0,0 +1,128 @@
+/*
+	 Digital pattern generator, see pattern.h
+*/
+
+#include <string.h>
+
+#include "esp_attr.h"
+#include "esp_log.h"
+
+#include "pattern.h"
+
+static const char *TAG = "pattern";
+
+esp_err_t pattern_load(PATTERN_t *pattern, const PATTERN_STEP_t *steps, int count)
+{
+	if (count < 1 || count > PATTERN_MAX_STEPS) return ESP_ERR_INVALID_ARG;
+	uint64_t pins = 0;
+	int64_t period_us = 0;
+	for (int i = 0; i < count; i++) {
+		pins |= steps[i].mask;
+		period_us += steps[i].delay_us;
+	}
+	// a pass of zero length would keep the interrupt from ever returning
+	if (period_us == 0) return ESP_ERR_INVALID_ARG;
+	memcpy(pattern->steps, steps, count * sizeof(steps[0]));
+	pattern->count = count;
+	pattern->pins = pins;
+	pattern_rewind(pattern, 1, 0);
+	return ESP_OK;
+}
+
+void pattern_rewind(PATTERN_t *pattern, int32_t loops, int64_t start_us)
+{
+	pattern->next = 0;
+	pattern->due_us = start_us;
+	pattern->loops = loops > 0 ? loops - 1 : -1;
+	pattern->played = 0;
+	pattern->late_max_us = 0;
+	pattern->late_sum_us = 0;
+}
+
+int64_t IRAM_ATTR pattern_run(PATTERN_t *pattern, int64_t now_us, PATTERN_WRITE_t write)
+{
+	while (pattern->due_us <= now_us) {
+		const PATTERN_STEP_t *step = &pattern->steps[pattern->next];
+		write(step->mask, step->levels);
+		int64_t late = now_us - pattern->due_us;
+		if (late > pattern->late_max_us) pattern->late_max_us = late;
+		pattern->late_sum_us += late;
+		pattern->played++;
+		if (++pattern->next == pattern->count) {
+			if (pattern->loops == 0) return -1;
+			if (pattern->loops > 0) pattern->loops--;
+			pattern->next = 0;
+		}
+		pattern->due_us += step->delay_us;
+	}
+	return pattern->due_us;
+}
+
+/*
+	 On the board: the alarm interrupt is the only one to run the player
+	 while it plays, the task side stops it before it changes anything.
+*/
+
+static PATTERN_IO_t io;
+static PATTERN_t player;
+static bool playing;
+
+static int64_t IRAM_ATTR on_alarm(int64_t now_us, void *arg)
+{
+	return pattern_run(&player, now_us, io.write);
+}
+
+void pattern_init(const PATTERN_IO_t *pattern_io)
+{
+	io = *pattern_io;
+}
+
+esp_err_t pattern_write(uint64_t mask, uint64_t levels)
+{
+	if (io.write == NULL) return ESP_ERR_INVALID_STATE;
+	esp_err_t err = io.output(mask);
+	if (err != ESP_OK) return err;
+	io.write(mask, levels);
+	return ESP_OK;
+}
+
+esp_err_t pattern_set(const PATTERN_STEP_t *steps, int count)
+{
+	pattern_stop();
+	return pattern_load(&player, steps, count);
+}
+
+esp_err_t pattern_play(int32_t loops)
+{
+	if (io.start == NULL || player.count == 0) return ESP_ERR_INVALID_STATE;
+	pattern_stop();
+	esp_err_t err = io.output(player.pins);
+	if (err != ESP_OK) return err;
+	pattern_rewind(&player, loops, 0);
+	err = io.start(on_alarm, NULL);
+	if (err != ESP_OK) {
+		ESP_LOGW(TAG, "cannot start the timer: %s", esp_err_to_name(err));
+		return err;
+	}
+	playing = true;
+	ESP_LOGI(TAG, "%d steps on pins %llx, %d times", player.count, (unsigned long long)player.pins, (int)loops);
+	return ESP_OK;
+}
+
+void pattern_stop(void)
+{
+	if (!playing) return;
+	io.stop();
+	playing = false;
+}
+
+void pattern_get_stats(PATTERN_STATS_t *stats)
+{
+	// counters the interrupt may be updating, near enough for a report
+	stats->playing = playing;
+	stats->steps = player.count;
+	stats->pins = player.pins;
+	stats->played = player.played;
+	stats->late_max_us = player.late_max_us;
+	stats->late_mean_us = player.played ? player.late_sum_us / player.played : 0;
+}
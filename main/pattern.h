@@ -0,0 +1,88 @@
+/*
+	 Digital pattern generator on the GPIOs.
+
+	 A pattern is a list of steps, each one a set of pins (mask, bit n is
+	 GPIOn), the levels to give them and how long to hold them before the
+	 next step. The steps are played from the interrupt of a hardware timer
+	 (hal_alarm_start()) on a schedule of their own: a step is due delay_us
+	 after the one before was due, not after it ran, so the latency of one
+	 interrupt does not add up over the pattern. All pins of a step change
+	 together through the set/clear registers (hal_gpio_write()).
+
+	 pattern_run() does no I/O and takes the time as an argument, it is what
+	 the host build tests against a simulated clock; pattern_play() runs it
+	 on the output of pattern_init().
+*/
+
+#ifndef MAIN_PATTERN_H_
+#define MAIN_PATTERN_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#define PATTERN_MAX_STEPS 256
+
+typedef struct {
+	uint64_t mask;		// the pins the step changes
+	uint64_t levels;	// their levels, the bits outside mask are ignored
+	uint32_t delay_us;	// until the next step is due
+} PATTERN_STEP_t;
+
+typedef struct {
+	PATTERN_STEP_t steps[PATTERN_MAX_STEPS];
+	int count;
+	uint64_t pins;		// all the masks together
+	int next;			// the step due at due_us
+	int64_t due_us;
+	int32_t loops;		// passes left after this one, -1 forever
+	// how it went: steps written and how late, in us after they were due
+	uint32_t played;
+	int64_t late_max_us;
+	int64_t late_sum_us;
+} PATTERN_t;
+
+typedef void (*PATTERN_WRITE_t)(uint64_t mask, uint64_t levels);
+
+esp_err_t pattern_load(PATTERN_t *pattern, const PATTERN_STEP_t *steps, int count);
+// the first step due at start_us, loops times through the steps, 0 or less forever
+void pattern_rewind(PATTERN_t *pattern, int32_t loops, int64_t start_us);
+
+/*
+	 Writes the steps due by now_us, returns when the next one is due or -1
+	 once the last pass is over. Steps with a delay of 0 go out back to back.
+*/
+int64_t pattern_run(PATTERN_t *pattern, int64_t now_us, PATTERN_WRITE_t write);
+
+// the output, the GPIO functions of hal.h on the board
+typedef struct {
+	esp_err_t (*output)(uint64_t mask);
+	PATTERN_WRITE_t write;
+	esp_err_t (*start)(int64_t (*alarm)(int64_t now_us, void *arg), void *arg);
+	void (*stop)(void);
+} PATTERN_IO_t;
+
+void pattern_init(const PATTERN_IO_t *io);
+
+// the pins of mask as outputs at their bit of levels, all at once
+esp_err_t pattern_write(uint64_t mask, uint64_t levels);
+
+// replaces the pattern, stops the one playing
+esp_err_t pattern_set(const PATTERN_STEP_t *steps, int count);
+// plays the pattern loops times (0 or less forever) from its first step
+esp_err_t pattern_play(int32_t loops);
+void pattern_stop(void);
+
+typedef struct {
+	bool playing;		// started and not stopped, it may have played its last pass
+	int steps;
+	uint64_t pins;
+	uint32_t played;	// steps written since the start
+	int64_t late_max_us;
+	int64_t late_mean_us;
+} PATTERN_STATS_t;
+
+void pattern_get_stats(PATTERN_STATS_t *stats);
+
+#endif /* MAIN_PATTERN_H_ */
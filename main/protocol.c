@@ -0,0 +1,249 @@
+/*
+	 Text protocol helpers shared by the websocket callback and the main loop.
+	 Nothing in here touches the hardware, so it is also built by the host build.
+*/
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_log.h"
+
+#include "protocol.h"
+
+static const char *TAG = "protocol";
+
+int makeSendText(char* buf, char* v1, char* v2, char* v3, char* v4)
+{
+	char DEL = PROTOCOL_DEL;
+	int len = sprintf(buf,"%s%c%s%c%s%c%s", v1, DEL, v2, DEL, v3, DEL, v4);
+	ESP_LOGD(TAG, "buf=[%s]", buf);
+	return len;
+}
+
+// parses one websocket text message into cmd, returns cmd->op
+int protocol_parse(const char* msg, size_t len, COMMAND_t* cmd)
+{
+	cmd->op = 0;
+	cmd->pin = -1;
+	cmd->value = 0;
+	cmd->seq = -1;
+	cmd->port = 0;
+	if (len == 0) return 0;
+
+	switch(msg[0]) {
+		case 'R':
+			if (sscanf(msg, "R GPIO%i", &cmd->pin) == 1) cmd->op = 'R';
+			break;
+		case 'O':
+			if (sscanf(msg, "O GPIO%i %i", &cmd->pin, &cmd->value) >= 1) cmd->op = 'O';
+			break;
+		case 'I':
+			if (sscanf(msg, "I GPIO%i", &cmd->pin) == 1) cmd->op = 'I';
+			break;
+		case 'G':
+			if (sscanf(msg, "G GPIO%i_pin", &cmd->pin) == 1) cmd->op = 'G';
+			break;
+		case 'A':
+			if (sscanf(msg, "A GPIO%i_pin", &cmd->pin) == 1) cmd->op = 'A';
+			break;
+		case 'S':
+			if (sscanf(msg, "S GPIO%i_pin %i", &cmd->pin, &cmd->value) == 2) cmd->op = 'S';
+			break;
+		case 'E':
+			if (sscanf(msg, "E GPIO%i_pin %i", &cmd->pin, &cmd->value) == 2) cmd->op = 'E';
+			break;
+		case 'D':
+			if (sscanf(msg, "D GPIO%i_pin %i", &cmd->pin, &cmd->value) == 2) cmd->op = 'D';
+			break;
+		case 'T':
+			cmd->level = 0;
+			if (sscanf(msg, "T GPIO%i_pin %i %i", &cmd->pin, &cmd->value, &cmd->level) >= 2) cmd->op = 'T';
+			break;
+		case 'X':
+			cmd->level = 0;
+			cmd->bin_ns = 0;
+			cmd->bins = 0;
+			if (sscanf(msg, "X GPIO%i_pin %" SCNu32 " %i %i %i", &cmd->pin, &cmd->bin_ns, &cmd->bins, &cmd->value, &cmd->level) >= 2) cmd->op = 'X';
+			break;
+		case 'B':
+			cmd->nargs = sscanf(msg, "B %7s %i %i %i %i %i %i %i %i", cmd->bus, &cmd->args[0], &cmd->args[1],
+				&cmd->args[2], &cmd->args[3], &cmd->args[4], &cmd->args[5], &cmd->args[6], &cmd->args[7]) - 1;
+			if (cmd->nargs >= 0) cmd->op = 'B';
+			break;
+		case 'U':
+			cmd->value = 1;	// CODEC_PACKED
+			if (sscanf(msg, "U %15s %i %i", cmd->host, &cmd->port, &cmd->value) >= 2) {
+				cmd->op = 'U';
+			} else if (sscanf(msg, "U %i", &cmd->port) == 1 && cmd->port == 0) {
+				cmd->op = 'U';
+				cmd->host[0] = 0;
+			}
+			break;
+		case 'C':
+			if (sscanf(msg, "C %i", &cmd->value) == 1) cmd->op = 'C';
+			break;
+		case 'L':
+			if (sscanf(msg, "L %" SCNu32 " %" SCNu32 " %" SCNu32, &cmd->counts[0], &cmd->counts[1], &cmd->counts[2]) == 3) cmd->op = 'L';
+			break;
+		case 'W':
+			cmd->args[0] = cmd->args[1] = cmd->args[2] = 0;
+			cmd->freq_hz[0] = cmd->freq_hz[1] = 0;
+			if (sscanf(msg, "W %9s %f %i %i %f %i", cmd->wave, &cmd->freq_hz[0], &cmd->args[0], &cmd->args[1],
+				&cmd->freq_hz[1], &cmd->args[2]) >= 1) cmd->op = 'W';
+			break;
+		case 'M':
+			if (sscanf(msg, "M %" SCNx64 " %" SCNx64, &cmd->mask[0], &cmd->mask[1]) == 2) cmd->op = 'M';
+			break;
+		case 'P':
+			if (sscanf(msg, "P %i", &cmd->value) == 1) cmd->op = 'P';
+			break;
+		case 'K':
+			if (sscanf(msg, "K %" SCNu32, &cmd->counts[0]) == 1) cmd->op = 'K';
+			break;
+		case '{':
+			cmd->op = '{';
+			return cmd->op;
+	}
+
+	const char *tag = memchr(msg, '#', len);
+	if (tag) cmd->seq = strtol(tag + 1, NULL, 10);
+	return cmd->op;
+}
+
+// adds the sequence number of cmd to a reply built by makeSendText, returns the new length
+int protocol_append_seq(char* buf, int len, const COMMAND_t* cmd)
+{
+	if (cmd->seq < 0) return len;
+	return len + sprintf(buf + len, "%c%ld", PROTOCOL_DEL, cmd->seq);
+}
+
+static void put_u32(uint8_t* p, uint32_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+}
+
+static uint32_t get_u32(const uint8_t* p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void put_f32(uint8_t* p, float f)
+{
+	uint32_t v;
+	memcpy(&v, &f, sizeof(v));
+	put_u32(p, v);
+}
+
+static float get_f32(const uint8_t* p)
+{
+	uint32_t v = get_u32(p);
+	float f;
+	memcpy(&f, &v, sizeof(f));
+	return f;
+}
+
+static void put_header(uint8_t* buf, uint8_t magic, const STREAM_FRAME_t* frame)
+{
+	buf[0] = magic;
+	buf[1] = frame->channel;
+	buf[2] = frame->bits;
+	buf[3] = 0;
+	put_u32(buf + 4, frame->seq);
+	put_u32(buf + 8, frame->period_us);
+	put_f32(buf + 12, frame->mv_per_lsb);
+	put_f32(buf + 16, frame->offset_mv);
+	put_u32(buf + 20, (uint64_t)frame->t0_us);
+	put_u32(buf + 24, (uint64_t)frame->t0_us >> 32);
+}
+
+static int get_header(const uint8_t* buf, size_t len, uint8_t magic, STREAM_FRAME_t* frame)
+{
+	if (len < PROTOCOL_FRAME_HEADER_SIZE || buf[0] != magic) return -1;
+	frame->channel = buf[1];
+	frame->bits = buf[2];
+	frame->seq = get_u32(buf + 4);
+	frame->period_us = get_u32(buf + 8);
+	frame->mv_per_lsb = get_f32(buf + 12);
+	frame->offset_mv = get_f32(buf + 16);
+	frame->t0_us = (int64_t)(get_u32(buf + 20) | ((uint64_t)get_u32(buf + 24) << 32));
+	return PROTOCOL_FRAME_HEADER_SIZE;
+}
+
+// writes the PROTOCOL_FRAME_HEADER_SIZE bytes of a binary stream frame
+void protocol_put_frame_header(uint8_t* buf, const STREAM_FRAME_t* frame)
+{
+	put_header(buf, PROTOCOL_FRAME_MAGIC, frame);
+}
+
+// reads the header of a binary stream frame, returns its size or -1
+int protocol_get_frame_header(const uint8_t* buf, size_t len, STREAM_FRAME_t* frame)
+{
+	return get_header(buf, len, PROTOCOL_FRAME_MAGIC, frame);
+}
+
+// the same for a history message, seq is the number of points and period_us their interval
+void protocol_put_history_header(uint8_t* buf, const STREAM_FRAME_t* frame)
+{
+	put_header(buf, PROTOCOL_HISTORY_MAGIC, frame);
+}
+
+int protocol_get_history_header(const uint8_t* buf, size_t len, STREAM_FRAME_t* frame)
+{
+	return get_header(buf, len, PROTOCOL_HISTORY_MAGIC, frame);
+}
+
+// reads a binary wavetable upload into points, returns their number or -1
+int protocol_get_wavetable(const uint8_t* buf, size_t len, int16_t* points, int max)
+{
+	if (len < 4 || buf[0] != PROTOCOL_WAVETABLE_MAGIC) return -1;
+	int count = buf[2] | (buf[3] << 8);
+	if (count > max || len != 4 + 2 * (size_t)count) return -1;
+	for (int i = 0; i < count; i++) points[i] = (int16_t)(buf[4 + 2 * i] | (buf[5 + 2 * i] << 8));
+	return count;
+}
+
+static uint64_t get_u64(const uint8_t* p)
+{
+	return get_u32(p) | ((uint64_t)get_u32(p + 4) << 32);
+}
+
+static void put_u64(uint8_t* p, uint64_t v)
+{
+	put_u32(p, v);
+	put_u32(p + 4, v >> 32);
+}
+
+// writes the PROTOCOL_HISTORY_CHANGE_SIZE bytes of a change of the levels
+void protocol_put_history_change(uint8_t* buf, const HISTORY_CHANGE_t* change)
+{
+	put_u32(buf, change->point);
+	put_u64(buf + 4, change->pins);
+	put_u64(buf + 12, change->levels);
+}
+
+void protocol_get_history_change(const uint8_t* buf, HISTORY_CHANGE_t* change)
+{
+	change->point = get_u32(buf);
+	change->pins = get_u64(buf + 4);
+	change->levels = get_u64(buf + 12);
+}
+
+// reads a binary pattern upload into steps, returns their number or -1
+int protocol_get_pattern(const uint8_t* buf, size_t len, PATTERN_STEP_t* steps, int max)
+{
+	if (len < 4 || buf[0] != PROTOCOL_PATTERN_MAGIC) return -1;
+	int count = buf[2] | (buf[3] << 8);
+	if (count > max || len != 4 + PROTOCOL_PATTERN_STEP_SIZE * (size_t)count) return -1;
+	for (int i = 0; i < count; i++) {
+		const uint8_t* p = buf + 4 + PROTOCOL_PATTERN_STEP_SIZE * i;
+		steps[i].mask = get_u64(p);
+		steps[i].levels = get_u64(p + 8);
+		steps[i].delay_us = get_u32(p + 16);
+	}
+	return count;
+}
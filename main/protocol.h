@@ -0,0 +1,166 @@
+/*
+	 Text protocol spoken over the websocket between the browser and the ESP32.
+
+	 Browser -> ESP32 : "R GPIOn", "O GPIOn v", "I GPIOn", "G GPIOn_pin", "A GPIOn_pin",
+	                    "S GPIOn_pin 1|0" to start/stop streaming ADC channel n,
+	                    "E GPIOn_pin codec" to pick the stream encoding (codec.h),
+	                    "D GPIOn_pin decimation" for the timebase,
+	                    "T GPIOn_pin edge level_mv" for the trigger, edge 0 off,
+	                    1 rising, 2 falling; S/E/D/T only change the session
+	                    of the sender (session.h),
+	                    "X GPIOn_pin bin_ns bins edge level" for equivalent-time
+	                    sampling (ets.h), edge 0 off, 1 rising, 2 falling at
+	                    level mV, 3 the rising edges of GPIO level; "X GPIOn_pin 0"
+	                    stops it,
+	                    "B uart rx baud [bits parity stop mqtt]", "B i2c scl sda [mqtt]",
+	                    "B spi sck mosi miso cs mode [bits lsb_first mqtt]" to decode
+	                    a bus on the GPIOs (decoder.h), parity 0 none, 1 odd, 2 even,
+	                    -1 for an SPI pin that is not there, mqtt 1 to publish the
+	                    frames too; "B 0" stops it,
+	                    "U host port [codec]" / "U 0" to start/stop UDP streaming
+	                    and "L received lost reordered" to report on it (udp_stream.h),
+	                    "C delay_ms" to the clock master for a capture on every
+	                    board of the bench delay_ms from now (clocksync.h),
+	                    "W shape freq_hz amp_mv offset_mv [to_hz sweep_ms]" for the
+	                    waveform generator on the DAC (wavegen.h), shape sine,
+	                    square, triangle, sweep (from freq_hz to to_hz in
+	                    sweep_ms, over and over) or table; "W off" stops it,
+	                    "M mask levels" (hex, bit n is GPIOn) to set several
+	                    output pins at once, "P loops" to play the uploaded
+	                    pattern loops times, -1 until "P 0" stops it (pattern.h),
+	                    "K frames" with the stream frames ("AS" and binary 'S')
+	                    received since the connection, about ten times a
+	                    second while they come (flow.h),
+	                    or a JSON object for the MQTT bridge.
+	 Browser -> ESP32, binary: the points of the table shape,
+	                    PROTOCOL_WAVETABLE_MAGIC, u8 0, u16 count, then count
+	                    i16 from -32767 to 32767, little endian.
+	                    The steps of a digital pattern, PROTOCOL_PATTERN_MAGIC,
+	                    u8 0, u16 count, then count times u64 mask, u64 levels,
+	                    u32 delay_us, little endian.
+	 ESP32 -> Browser : four fields separated by EOT (0x04), see makeSendText().
+	                    Replies go to the client that asked, MQTT messages to all.
+	                    A streamed block is "AS", "ADCn", comma separated mV,
+	                    and the time of its first sample in us.
+	                    With a binary encoding it is a binary message instead:
+	                    a frame header (STREAM_FRAME_t) and one codec block.
+	                    "XS", "ADCn", on|off|error answers 'X', then
+	                    "EQ", "ADCn", comma separated mV per bin (empty: no reading
+	                    yet), "bin_ns start_ns coverage_permille captures" about
+	                    twice a second while equivalent-time sampling runs.
+	                    "BS", "UART|I2C|SPI", on|off|error answers 'B', then
+	                    "BU", "UART|I2C|SPI", "dt_us:token,..." the decoded frames
+	                    with the us since the one before (decoder_format()), and
+	                    the time of the first frame in us, about ten times a second.
+	                    "TB", offset_us, synced on connect and when SNTP sets the
+	                    time: the time of samples is the monotonic clock since
+	                    boot, epoch time is it plus offset_us once synced is 1.
+	                    A fourth field "sync" says the times are on the clock of
+	                    the master of the bench instead, the same on every board
+	                    (clocksync.h); offset_us is then the master's.
+	                    "CS", id, at_us, peers|error answers 'C': the capture
+	                    and its time on that clock.
+	                    "WG", shape, the frequency played in Hz (the step of
+	                    the phase rounds it) or the points of a table,
+	                    on|off|error answers 'W' and a table upload.
+	                    "PG", "write", mask, ok|error answers 'M';
+	                    "PG", "pattern", steps, ok|error a pattern upload;
+	                    "PG", play|stop, "played late_max_us late_mean_us",
+	                    on|off|error answers 'P', with how the steps written
+	                    since the last start kept to their times.
+	                    "GP", "GPIOn", R|O|I|G, "bad pin" answers those on a pin
+	                    the chip does not have, instead of doing anything.
+	                    "FC", factor, latency_us when the rate control thins
+	                    the streams of the client factor times, 1 for none.
+	 ESP32 -> Browser, binary: on connect, before anything else, the recent
+	                    history (history.h) when there is some: a history
+	                    header, u16 changes and that many changes of the
+	                    levels, oldest first, then one codec block of the
+	                    points.
+
+	 A command may end with " #seq". The reply to it then carries seq as a
+	 fifth field, so a client can match replies to requests (tools/loadgen).
+*/
+
+#ifndef MAIN_PROTOCOL_H_
+#define MAIN_PROTOCOL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "pattern.h"
+
+#define PROTOCOL_DEL 0x04
+
+/*
+	 Header of a binary stream frame, PROTOCOL_FRAME_HEADER_SIZE bytes little endian:
+	   u8 'S', u8 channel, u8 adc bits, u8 0, u32 seq, u32 period_us,
+	   f32 mv_per_lsb, f32 offset_mv, i64 t0_us (monotonic, see timebase.h)
+	 The raw readings of the block decode to mV as offset_mv + raw * mv_per_lsb.
+*/
+#define PROTOCOL_FRAME_MAGIC 'S'
+#define PROTOCOL_FRAME_HEADER_SIZE 28
+
+/*
+	 Header of a history message, the same as a stream frame but for
+	   u8 'H' and u32 points instead of seq; period_us is the interval of
+	   the points and t0_us the time of the first one.
+	 A change of the levels is PROTOCOL_HISTORY_CHANGE_SIZE bytes:
+	   u32 point, u64 pins, u64 levels
+	 from that point on, pins (bit n is GPIOn) were followed and read levels.
+*/
+#define PROTOCOL_HISTORY_MAGIC 'H'
+#define PROTOCOL_HISTORY_CHANGE_SIZE 20
+
+#define PROTOCOL_WAVETABLE_MAGIC 'W'
+#define PROTOCOL_PATTERN_MAGIC 'P'
+#define PROTOCOL_PATTERN_STEP_SIZE 20
+
+typedef struct {
+	uint8_t channel;
+	uint8_t bits;
+	uint32_t seq;
+	uint32_t period_us;
+	float mv_per_lsb;
+	float offset_mv;
+	int64_t t0_us;
+} STREAM_FRAME_t;
+
+typedef struct {
+	uint32_t point;
+	uint64_t pins;
+	uint64_t levels;
+} HISTORY_CHANGE_t;
+
+typedef struct {
+	char op;	// 'R', 'O', 'I', 'G', 'A', 'S', 'E', 'D', 'T', 'X', 'B', 'U', 'L', 'C', 'W', 'M', 'P', 'K', '{' for JSON, 0 when not understood
+	int pin;
+	int value;	// the codec for 'E' and 'U', the edge for 'T' and 'X', the delay for 'C', the loops for 'P'
+	int level;	// 'T' and 'X', in mV, or the trigger pin for 'X' edge 3
+	uint32_t bin_ns;	// 'X'
+	int bins;	// 'X'
+	char bus[8];	// 'B': "uart", "i2c", "spi" or "0"
+	int args[8];	// 'B', the numbers after the bus; 'W' amp_mv offset_mv sweep_ms
+	int nargs;
+	long seq;	// -1 when the command had no " #seq"
+	char host[16];	// 'U', IPv4 dotted quad
+	int port;	// 'U', 0 to stop
+	uint32_t counts[3];	// 'L': received, lost, reordered; 'K': frames
+	char wave[10];	// 'W': the shape, or "off"
+	float freq_hz[2];	// 'W': freq_hz and to_hz
+	uint64_t mask[2];	// 'M': mask and levels
+} COMMAND_t;
+
+int makeSendText(char* buf, char* v1, char* v2, char* v3, char* v4);
+int protocol_parse(const char* msg, size_t len, COMMAND_t* cmd);
+int protocol_append_seq(char* buf, int len, const COMMAND_t* cmd);
+void protocol_put_frame_header(uint8_t* buf, const STREAM_FRAME_t* frame);
+int protocol_get_frame_header(const uint8_t* buf, size_t len, STREAM_FRAME_t* frame);
+void protocol_put_history_header(uint8_t* buf, const STREAM_FRAME_t* frame);
+int protocol_get_history_header(const uint8_t* buf, size_t len, STREAM_FRAME_t* frame);
+void protocol_put_history_change(uint8_t* buf, const HISTORY_CHANGE_t* change);
+void protocol_get_history_change(const uint8_t* buf, HISTORY_CHANGE_t* change);
+int protocol_get_wavetable(const uint8_t* buf, size_t len, int16_t* points, int max);
+int protocol_get_pattern(const uint8_t* buf, size_t len, PATTERN_STEP_t* steps, int max);
+
+#endif /* MAIN_PROTOCOL_H_ */
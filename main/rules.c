@@ -0,0 +1,557 @@
+/*
+	 Rules compiler and evaluator, see rules.h.
+
+	 The compiler is a recursive descent parser that emits stack machine
+	 code as it goes; it works out the stack depth at compile time, so the
+	 evaluator runs without any checks but the end of the code.
+*/
+
+#include <ctype.h>
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "protocol.h"
+#include "rules.h"
+
+typedef enum {
+	OP_END = 0,
+	OP_CONST,		// f32 follows, little endian
+	OP_MEAN,		// channel follows
+	OP_RMS,
+	OP_MIN,
+	OP_MAX,
+	OP_PP,
+	OP_LEVEL,		// pin follows
+	OP_FREQ,
+	OP_ADD,
+	OP_SUB,
+	OP_MUL,
+	OP_DIV,
+	OP_NEG,
+	OP_GT,
+	OP_GE,
+	OP_LT,
+	OP_LE,
+	OP_EQ,
+	OP_NE,
+	OP_AND,
+	OP_OR,
+	OP_NOT,
+} OP_t;
+
+static const struct {
+	const char *name;
+	uint8_t op;
+} functions[] = {
+	{ "mean", OP_MEAN }, { "rms", OP_RMS }, { "min", OP_MIN }, { "max", OP_MAX }, { "pp", OP_PP },
+	{ "level", OP_LEVEL }, { "freq", OP_FREQ },
+};
+
+// D1 to D6 of the board
+static const int digital_pins[] = { 42, 41, 40, 39, 38, 37 };
+
+typedef struct {
+	const char *text;
+	const char *p;
+	RULE_CODE_t *code;
+	int depth;
+	char *error;
+	size_t error_size;
+	int failed;
+} PARSER_t;
+
+static void fail(PARSER_t *ps, const char *fmt, ...)
+{
+	if (ps->failed) return;
+	ps->failed = 1;
+	int len = snprintf(ps->error, ps->error_size, "at %d: ", (int)(ps->p - ps->text));
+	if (len < 0 || (size_t)len >= ps->error_size) return;
+	va_list ap;
+	va_start(ap, fmt);
+	vsnprintf(ps->error + len, ps->error_size - len, fmt, ap);
+	va_end(ap);
+}
+
+static void skip_space(PARSER_t *ps)
+{
+	while (isspace((unsigned char)*ps->p)) ps->p++;
+}
+
+// the word at p, without taking it; returns its length
+static int peek_word(PARSER_t *ps, char *word, size_t size)
+{
+	skip_space(ps);
+	int len = 0;
+	while (isalnum((unsigned char)ps->p[len]) || ps->p[len] == '_') len++;
+	if ((size_t)len >= size) len = size - 1;
+	memcpy(word, ps->p, len);
+	word[len] = 0;
+	return len;
+}
+
+static int accept_word(PARSER_t *ps, const char *word)
+{
+	char next[16];
+	int len = peek_word(ps, next, sizeof(next));
+	if (len == 0 || strcmp(next, word) != 0) return 0;
+	ps->p += len;
+	return 1;
+}
+
+static int accept(PARSER_t *ps, const char *symbol)
+{
+	skip_space(ps);
+	size_t len = strlen(symbol);
+	if (strncmp(ps->p, symbol, len) != 0) return 0;
+	ps->p += len;
+	return 1;
+}
+
+// one opcode and its operand bytes; pushes and pops are its effect on the stack
+static void emit(PARSER_t *ps, int pushes, int pops, uint8_t op, const void *operand, size_t size)
+{
+	RULE_CODE_t *code = ps->code;
+	if (ps->failed) return;
+	if (code->len + 1 + size >= RULES_CODE_SIZE) {
+		fail(ps, "too long");
+		return;
+	}
+	code->code[code->len++] = op;
+	memcpy(code->code + code->len, operand, size);
+	code->len += size;
+	ps->depth += pushes - pops;
+	if (ps->depth > RULES_STACK) fail(ps, "too deeply nested");
+}
+
+static void emit_const(PARSER_t *ps, float value)
+{
+	uint32_t v;
+	memcpy(&v, &value, sizeof(v));
+	uint8_t bytes[4] = { v, v >> 8, v >> 16, v >> 24 };
+	emit(ps, 1, 0, OP_CONST, bytes, sizeof(bytes));
+}
+
+static int parse_number(PARSER_t *ps, float *value)
+{
+	skip_space(ps);
+	char *end;
+	*value = strtof(ps->p, &end);
+	if (end == ps->p) return 0;
+	ps->p = end;
+	return 1;
+}
+
+static void parse_or(PARSER_t *ps);
+
+// mean(6), level(D3), freq(40)
+static void parse_function(PARSER_t *ps, uint8_t op)
+{
+	if (!accept(ps, "(")) {
+		fail(ps, "( expected");
+		return;
+	}
+	char word[8];
+	int arg = -1;
+	int len = peek_word(ps, word, sizeof(word));
+	const char *at = ps->p;
+	if ((word[0] == 'D' || word[0] == 'd') && len == 2 && word[1] >= '1' && word[1] <= '6') {
+		arg = digital_pins[word[1] - '1'];
+		ps->p += len;
+	} else {
+		float value;
+		if (parse_number(ps, &value) && value == (int)value) arg = value;
+	}
+	int digital = op == OP_LEVEL || op == OP_FREQ;
+	if (arg < 0 || arg >= (digital ? RULES_PINS : ACQ_MAX_CHANNELS)) {
+		ps->p = at;
+		fail(ps, digital ? "bad pin" : "bad channel");
+		return;
+	}
+	if (!accept(ps, ")")) {
+		fail(ps, ") expected");
+		return;
+	}
+	uint8_t operand = arg;
+	emit(ps, 1, 0, op, &operand, 1);
+	if (op == OP_LEVEL) {
+		ps->code->levels |= 1ULL << arg;
+	} else if (op == OP_FREQ) {
+		ps->code->pulses |= 1ULL << arg;
+	} else {
+		ps->code->channels |= 1 << arg;
+	}
+}
+
+static void parse_factor(PARSER_t *ps)
+{
+	float value;
+	char word[16];
+	if (ps->failed) return;
+	if (accept(ps, "(")) {
+		parse_or(ps);
+		if (!accept(ps, ")")) fail(ps, ") expected");
+		return;
+	}
+	if (accept(ps, "-")) {
+		parse_factor(ps);
+		emit(ps, 1, 1, OP_NEG, NULL, 0);
+		return;
+	}
+	int len = peek_word(ps, word, sizeof(word));
+	if (len > 0 && isalpha((unsigned char)word[0])) {
+		for (size_t i = 0; i < sizeof(functions) / sizeof(functions[0]); i++) {
+			if (strcmp(word, functions[i].name) == 0) {
+				ps->p += len;
+				parse_function(ps, functions[i].op);
+				return;
+			}
+		}
+		fail(ps, "unknown '%s'", word);
+		return;
+	}
+	if (parse_number(ps, &value)) {
+		emit_const(ps, value);
+		return;
+	}
+	fail(ps, *ps->p ? "unexpected '%c'" : "unexpected end", *ps->p);
+}
+
+static void parse_term(PARSER_t *ps)
+{
+	parse_factor(ps);
+	while (!ps->failed) {
+		if (accept(ps, "*")) {
+			parse_factor(ps);
+			emit(ps, 1, 2, OP_MUL, NULL, 0);
+		} else if (accept(ps, "/")) {
+			parse_factor(ps);
+			emit(ps, 1, 2, OP_DIV, NULL, 0);
+		} else {
+			return;
+		}
+	}
+}
+
+static void parse_sum(PARSER_t *ps)
+{
+	parse_term(ps);
+	while (!ps->failed) {
+		if (accept(ps, "+")) {
+			parse_term(ps);
+			emit(ps, 1, 2, OP_ADD, NULL, 0);
+		} else if (accept(ps, "-")) {
+			parse_term(ps);
+			emit(ps, 1, 2, OP_SUB, NULL, 0);
+		} else {
+			return;
+		}
+	}
+}
+
+// one comparison at most, the longer symbols first
+static void parse_compare(PARSER_t *ps)
+{
+	static const struct {
+		const char *symbol;
+		uint8_t op;
+	} compares[] = {
+		{ ">=", OP_GE }, { "<=", OP_LE }, { "==", OP_EQ }, { "!=", OP_NE }, { ">", OP_GT }, { "<", OP_LT },
+	};
+	parse_sum(ps);
+	for (size_t i = 0; i < sizeof(compares) / sizeof(compares[0]) && !ps->failed; i++) {
+		if (accept(ps, compares[i].symbol)) {
+			parse_sum(ps);
+			emit(ps, 1, 2, compares[i].op, NULL, 0);
+			return;
+		}
+	}
+}
+
+static void parse_not(PARSER_t *ps)
+{
+	if (accept_word(ps, "not")) {
+		parse_not(ps);
+		emit(ps, 1, 1, OP_NOT, NULL, 0);
+		return;
+	}
+	parse_compare(ps);
+}
+
+static void parse_and(PARSER_t *ps)
+{
+	parse_not(ps);
+	while (!ps->failed && accept_word(ps, "and")) {
+		parse_not(ps);
+		emit(ps, 1, 2, OP_AND, NULL, 0);
+	}
+}
+
+static void parse_or(PARSER_t *ps)
+{
+	parse_and(ps);
+	while (!ps->failed && accept_word(ps, "or")) {
+		parse_and(ps);
+		emit(ps, 1, 2, OP_OR, NULL, 0);
+	}
+}
+
+// for, hyst, every, each once
+static void parse_options(PARSER_t *ps)
+{
+	int seen = 0;
+	while (!ps->failed) {
+		skip_space(ps);
+		if (*ps->p == 0) return;
+		float value;
+		int option = accept_word(ps, "for") ? 1 : accept_word(ps, "hyst") ? 2 : accept_word(ps, "every") ? 4 : 0;
+		if (option == 0) {
+			fail(ps, "for, hyst or every expected");
+		} else if (seen & option) {
+			fail(ps, "option given twice");
+		} else if (!parse_number(ps, &value) || value < 0) {
+			fail(ps, "number expected");
+		} else if (option == 1) {
+			ps->code->for_ms = value;
+		} else if (option == 2) {
+			ps->code->hyst = value;
+		} else {
+			ps->code->every_ms = value;
+		}
+		seen |= option;
+	}
+}
+
+esp_err_t rules_compile(const char *text, RULE_CODE_t *code, char *error, size_t error_size)
+{
+	PARSER_t ps = { .text = text, .p = text, .code = code, .error = error, .error_size = error_size };
+	memset(code, 0, sizeof(*code));
+	code->every_ms = RULES_EVERY_MS;
+	if (error_size) error[0] = 0;
+	if (strlen(text) >= RULES_TEXT_SIZE) {
+		fail(&ps, "longer than %d", RULES_TEXT_SIZE - 1);
+		return ESP_ERR_INVALID_ARG;
+	}
+	parse_or(&ps);
+	parse_options(&ps);
+	emit(&ps, 0, 0, OP_END, NULL, 0);
+	return ps.failed ? ESP_ERR_INVALID_ARG : ESP_OK;
+}
+
+// the value of the expression; active relaxes the comparisons by hyst
+static float run(const RULE_CODE_t *code, const RULES_INPUT_t *in, int active, float *subject)
+{
+	float stack[RULES_STACK];
+	int sp = 0;
+	float hyst = active ? code->hyst : 0;
+	const uint8_t *pc = code->code;
+	for (;;) {
+		uint8_t op = *pc++;
+		float a, b;
+		if (op >= OP_ADD && op != OP_NEG && op != OP_NOT) {
+			b = stack[--sp];
+			a = stack[sp - 1];
+		}
+		switch (op) {
+			case OP_END:
+				return stack[0];
+			case OP_CONST: {
+				uint32_t v = pc[0] | pc[1] << 8 | pc[2] << 16 | (uint32_t)pc[3] << 24;
+				memcpy(&stack[sp++], &v, sizeof(float));
+				pc += 4;
+				break;
+			}
+			case OP_MEAN: stack[sp++] = in->mean[*pc++]; break;
+			case OP_RMS: stack[sp++] = in->rms[*pc++]; break;
+			case OP_MIN: stack[sp++] = in->min[*pc++]; break;
+			case OP_MAX: stack[sp++] = in->max[*pc++]; break;
+			case OP_PP: stack[sp++] = in->max[*pc] - in->min[*pc]; pc++; break;
+			case OP_LEVEL: stack[sp++] = (in->levels >> *pc++) & 1; break;
+			case OP_FREQ: stack[sp++] = in->freq_hz[*pc++]; break;
+			case OP_ADD: stack[sp - 1] = a + b; break;
+			case OP_SUB: stack[sp - 1] = a - b; break;
+			case OP_MUL: stack[sp - 1] = a * b; break;
+			case OP_DIV: stack[sp - 1] = b != 0 ? a / b : 0; break;
+			case OP_NEG: stack[sp - 1] = -stack[sp - 1]; break;
+			case OP_GT: *subject = a; stack[sp - 1] = a > b - hyst; break;
+			case OP_GE: *subject = a; stack[sp - 1] = a >= b - hyst; break;
+			case OP_LT: *subject = a; stack[sp - 1] = a < b + hyst; break;
+			case OP_LE: *subject = a; stack[sp - 1] = a <= b + hyst; break;
+			case OP_EQ: *subject = a; stack[sp - 1] = a == b; break;
+			case OP_NE: *subject = a; stack[sp - 1] = a != b; break;
+			case OP_AND: stack[sp - 1] = a != 0 && b != 0; break;
+			case OP_OR: stack[sp - 1] = a != 0 || b != 0; break;
+			case OP_NOT: stack[sp - 1] = stack[sp - 1] == 0; break;
+		}
+	}
+}
+
+void rules_init(RULES_t *rules)
+{
+	memset(rules, 0, sizeof(*rules));
+}
+
+static RULE_t *find(RULES_t *rules, const char *name)
+{
+	for (int i = 0; i < rules->count; i++) {
+		if (strcmp(rules->rule[i].name, name) == 0) return &rules->rule[i];
+	}
+	return NULL;
+}
+
+esp_err_t rules_set(RULES_t *rules, const char *name, const char *text, char *error, size_t error_size)
+{
+	size_t len = strlen(name);
+	int valid = len > 0 && len < RULES_NAME_SIZE;
+	for (size_t i = 0; i < len; i++) valid &= isalnum((unsigned char)name[i]) || name[i] == '_' || name[i] == '-';
+	if (!valid) {
+		snprintf(error, error_size, "bad name");
+		return ESP_ERR_INVALID_ARG;
+	}
+	if (strlen(text) >= RULES_TEXT_SIZE) {
+		snprintf(error, error_size, "rule longer than %d", RULES_TEXT_SIZE - 1);
+		return ESP_ERR_INVALID_ARG;
+	}
+	if (strpbrk(text, "\t\n")) {
+		snprintf(error, error_size, "tab or newline in the rule");
+		return ESP_ERR_INVALID_ARG;
+	}
+	RULE_CODE_t code;
+	esp_err_t err = rules_compile(text, &code, error, error_size);
+	if (err != ESP_OK) return err;
+	RULE_t *rule = find(rules, name);
+	if (rule == NULL) {
+		if (rules->count == RULES_MAX) {
+			snprintf(error, error_size, "no room, %d rules at most", RULES_MAX);
+			return ESP_ERR_NO_MEM;
+		}
+		rule = &rules->rule[rules->count++];
+	}
+	memset(rule, 0, sizeof(*rule));
+	strcpy(rule->name, name);
+	strcpy(rule->text, text);
+	rule->code = code;
+	rule->since_us = -1;
+	return ESP_OK;
+}
+
+esp_err_t rules_delete(RULES_t *rules, const char *name)
+{
+	RULE_t *rule = find(rules, name);
+	if (rule == NULL) return ESP_ERR_NOT_FOUND;
+	int i = rule - rules->rule;
+	memmove(&rules->rule[i], &rules->rule[i + 1], (rules->count - i - 1) * sizeof(RULE_t));
+	rules->count--;
+	return ESP_OK;
+}
+
+int rules_reply_text(char *out, const char *name, const char *text, const char *status)
+{
+	char del = PROTOCOL_DEL;
+	int len = snprintf(out, RULES_REPLY_SIZE, "RU%c%.*s%c%.*s%c%.*s", del, RULES_NAME_SIZE - 1, name,
+		del, RULES_TEXT_SIZE - 1, text, del, RULES_ERROR_SIZE - 1, status);
+	return len < RULES_REPLY_SIZE ? len : RULES_REPLY_SIZE - 1;
+}
+
+void rules_needs(const RULES_t *rules, uint16_t *channels, uint64_t *levels, uint64_t *pulses)
+{
+	*channels = 0;
+	*levels = 0;
+	*pulses = 0;
+	for (int i = 0; i < rules->count; i++) {
+		*channels |= rules->rule[i].code.channels;
+		*levels |= rules->rule[i].code.levels;
+		*pulses |= rules->rule[i].code.pulses;
+	}
+}
+
+void rules_measure(RULES_INPUT_t *input, int channel, const uint16_t *raw, int count, float mv_per_lsb, float offset_mv)
+{
+	if (channel < 0 || channel >= ACQ_MAX_CHANNELS || count <= 0) return;
+	uint32_t sum = 0;
+	uint64_t sum_sq = 0;
+	uint16_t lo = UINT16_MAX, hi = 0;
+	for (int i = 0; i < count; i++) {
+		uint16_t r = raw[i];
+		sum += r;
+		sum_sq += (uint32_t)r * r;
+		if (r < lo) lo = r;
+		if (r > hi) hi = r;
+	}
+	// mV = offset + k * raw, so mean(mV^2) = offset^2 + 2 offset k mean(raw) + k^2 mean(raw^2)
+	float mean_raw = (float)sum / count;
+	float mean_sq_raw = (float)sum_sq / count;
+	float ms = offset_mv * offset_mv + 2 * offset_mv * mv_per_lsb * mean_raw + mv_per_lsb * mv_per_lsb * mean_sq_raw;
+	input->mean[channel] = offset_mv + mv_per_lsb * mean_raw;
+	input->rms[channel] = sqrtf(ms > 0 ? ms : 0);
+	input->min[channel] = offset_mv + mv_per_lsb * lo;
+	input->max[channel] = offset_mv + mv_per_lsb * hi;
+}
+
+int rules_eval(RULES_t *rules, const RULES_INPUT_t *input, RULES_EVENT_t *events)
+{
+	int n = 0;
+	for (int i = 0; i < rules->count; i++) {
+		RULE_t *r = &rules->rule[i];
+		float value = 0;
+		int holds = run(&r->code, input, r->active, &value) != 0;
+		r->value = value;
+		if (!holds) {
+			r->since_us = -1;
+			if (r->active) {
+				r->active = 0;
+				events[n++] = (RULES_EVENT_t) { r, 0, value, input->t_us };
+			}
+			continue;
+		}
+		if (r->active) continue;
+		if (r->since_us < 0) r->since_us = input->t_us;
+		if (input->t_us - r->since_us < (int64_t)r->code.for_ms * 1000) continue;
+		// every: the rule waits, still holding, until it may fire again
+		if (r->fired && input->t_us - r->fired_us < (int64_t)r->code.every_ms * 1000) {
+			r->suppressed++;
+			continue;
+		}
+		r->active = 1;
+		r->fired++;
+		r->fired_us = input->t_us;
+		events[n++] = (RULES_EVENT_t) { r, 1, value, input->t_us };
+	}
+	return n;
+}
+
+int rules_save(const RULES_t *rules, char *buf, size_t size)
+{
+	size_t len = 0;
+	if (size) buf[0] = 0;
+	for (int i = 0; i < rules->count; i++) {
+		int n = snprintf(buf + len, size - len, "%s\t%s\n", rules->rule[i].name, rules->rule[i].text);
+		if (n < 0 || len + n >= size) return -1;
+		len += n;
+	}
+	return len;
+}
+
+int rules_load(RULES_t *rules, const char *buf)
+{
+	char error[48];
+	rules_init(rules);
+	while (*buf) {
+		const char *tab = strchr(buf, '\t');
+		const char *end = strchr(buf, '\n');
+		if (end == NULL) end = buf + strlen(buf);
+		if (tab && tab < end && tab - buf < RULES_NAME_SIZE && end - tab - 1 < RULES_TEXT_SIZE) {
+			char name[RULES_NAME_SIZE];
+			char text[RULES_TEXT_SIZE];
+			memcpy(name, buf, tab - buf);
+			name[tab - buf] = 0;
+			memcpy(text, tab + 1, end - tab - 1);
+			text[end - tab - 1] = 0;
+			rules_set(rules, name, text, error, sizeof(error));
+		}
+		buf = *end ? end + 1 : end;
+	}
+	return rules->count;
+}
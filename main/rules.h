@@ -0,0 +1,118 @@
+/*
+	 Rules: conditions on the signals that publish an MQTT event when they
+	 start and stop holding, instead of streaming telemetry.
+
+	 A rule is one line of text,
+
+	     rms(6) > 500 for 200 hyst 20 every 5000
+
+	 an expression, true when not 0, and options: `for` ms the expression
+	 has to hold before the rule fires, `hyst` how far a comparison may go
+	 back over its threshold while the rule is active, `every` ms at least
+	 between two firings (1000 by default). Expressions have numbers,
+	 + - * /, comparisons (> >= < <= == !=), and, or, not, parentheses and
+	 the measurements of the latest acquisition block:
+
+	     mean(ch) rms(ch) min(ch) max(ch) pp(ch)   ADC1 channel ch, mV
+	     level(pin) freq(pin)                      GPIO pin, 0/1 and Hz of
+	                                               rising edges; D1 to D6
+	                                               name the digital channels
+
+	 rules_compile() turns the text into a few bytes of stack machine code
+	 once, rules_eval() runs every rule on a block. Nothing in here touches
+	 the hardware or takes a lock, the caller serializes.
+*/
+
+#ifndef MAIN_RULES_H_
+#define MAIN_RULES_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#include "acquire.h"
+
+#define RULES_MAX 32
+#define RULES_NAME_SIZE 16
+#define RULES_TEXT_SIZE 96
+#define RULES_ERROR_SIZE 64
+// "RU", name, text and status with their separators
+#define RULES_REPLY_SIZE (8 + RULES_NAME_SIZE + RULES_TEXT_SIZE + RULES_ERROR_SIZE)
+#define RULES_CODE_SIZE 64
+#define RULES_STACK 8
+#define RULES_PINS 48			// GPIO0 to GPIO47
+#define RULES_EVERY_MS 1000
+
+typedef struct {
+	uint8_t code[RULES_CODE_SIZE];
+	uint8_t len;
+	uint16_t channels;		// ADC1 channels it measures
+	uint64_t levels;		// GPIOs it reads the level of
+	uint64_t pulses;		// GPIOs it needs the frequency of
+	uint32_t for_ms;
+	uint32_t every_ms;
+	float hyst;
+} RULE_CODE_t;
+
+typedef struct {
+	char name[RULES_NAME_SIZE];
+	char text[RULES_TEXT_SIZE];
+	RULE_CODE_t code;
+	int active;
+	int64_t since_us;		// the expression holds since, -1 when it does not
+	int64_t fired_us;		// the last firing
+	float value;			// left side of the last comparison, what the event reports
+	uint32_t fired;
+	uint32_t suppressed;	// firings held back by every
+} RULE_t;
+
+typedef struct {
+	RULE_t rule[RULES_MAX];
+	int count;
+} RULES_t;
+
+// what rules_eval() looks at, filled for the channels and pins of rules_needs()
+typedef struct {
+	int64_t t_us;
+	float mean[ACQ_MAX_CHANNELS];
+	float rms[ACQ_MAX_CHANNELS];
+	float min[ACQ_MAX_CHANNELS];
+	float max[ACQ_MAX_CHANNELS];
+	uint64_t levels;
+	float freq_hz[RULES_PINS];
+} RULES_INPUT_t;
+
+typedef struct {
+	const RULE_t *rule;
+	int active;				// 1 it fired, 0 it stopped holding
+	float value;
+	int64_t t_us;
+} RULES_EVENT_t;
+
+// text into code; on an error ESP_ERR_INVALID_ARG, what went wrong and where in error
+esp_err_t rules_compile(const char *text, RULE_CODE_t *code, char *error, size_t error_size);
+
+void rules_init(RULES_t *rules);
+// adds or replaces the rule called name
+esp_err_t rules_set(RULES_t *rules, const char *name, const char *text, char *error, size_t error_size);
+esp_err_t rules_delete(RULES_t *rules, const char *name);
+// "RU", name, text, status for the browser into out (RULES_REPLY_SIZE), each cut to what
+// a rule or an error holds: name and text may be what a client sent; returns the length
+int rules_reply_text(char *out, const char *name, const char *text, const char *status);
+
+// the channels, level and frequency pins all rules together need
+void rules_needs(const RULES_t *rules, uint16_t *channels, uint64_t *levels, uint64_t *pulses);
+
+// mean, rms, min and max of one channel of a block into input, raw readings to mV on a straight line
+void rules_measure(RULES_INPUT_t *input, int channel, const uint16_t *raw, int count, float mv_per_lsb, float offset_mv);
+
+// runs every rule on input, returns the events written to events (room for RULES_MAX)
+int rules_eval(RULES_t *rules, const RULES_INPUT_t *input, RULES_EVENT_t *events);
+
+// "name\ttext\n" per rule, for storage; returns the length or -1 when size is too small
+int rules_save(const RULES_t *rules, char *buf, size_t size);
+// the rules of rules_save(), replacing all; rules that no longer compile are skipped
+int rules_load(RULES_t *rules, const char *buf);
+
+#endif /* MAIN_RULES_H_ */
@@ -0,0 +1,453 @@
+/*
+	 Per-client capture sessions, see session.h
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+
+#include "protocol.h"
+#include "session.h"
+
+// "AS", "ADCn", SESSION_OUT_SAMPLES comma separated mV and t0, or a binary frame
+#define TEXT_SIZE (32 + SESSION_OUT_SAMPLES * 6)
+#define FRAME_SIZE (PROTOCOL_FRAME_HEADER_SIZE + CODEC_MAX_SIZE(SESSION_OUT_SAMPLES))
+#define OUT_SIZE (TEXT_SIZE > FRAME_SIZE ? TEXT_SIZE : FRAME_SIZE)
+
+static const char *TAG = "session";
+
+typedef struct {
+	int channel;
+	int decimation;
+	SESSION_TRIGGER_t edge;
+	int level_raw;
+	CODEC_t codec;
+} VIEW_t;
+
+typedef struct {
+	VIEW_t view;
+	int users;			// sessions bound to it, 0 when free
+	int fresh;			// the state is reset before the next block
+	// decimation
+	uint32_t acc;
+	int acc_n;
+	int64_t acc_t0_us;
+	// trigger
+	int prev;
+	int have_prev;
+	int capturing;
+	int64_t arm_us;		// session_arm(), 0 when not armed
+	// output
+	uint32_t seq;
+	int64_t t0_us;
+	int count;
+	uint16_t out[SESSION_OUT_SAMPLES];
+} PIPELINE_t;
+
+typedef struct {
+	int open;
+	uint32_t channels;
+	int decimation;
+	int thinning;		// of the rate control (flow.h), decimation times this
+	SESSION_TRIGGER_t edge;
+	int level_mv;
+	CODEC_t codec;
+	int pin;
+	int8_t pipe[ACQ_MAX_CHANNELS];	// pipeline of every channel, -1 for none
+} SESSION_t;
+
+typedef struct {
+	uint32_t clients;	// bit per session
+	int binary;
+	int len;
+	uint8_t data[OUT_SIZE];
+} OUTPUT_t;
+
+static SESSION_IO_t io;
+static SemaphoreHandle_t lock;	// sessions and pipelines, between the websocket and the stream task
+static SESSION_t sessions[SESSION_MAX];
+static PIPELINE_t pipelines[SESSION_MAX_PIPELINES];
+static SESSION_STATS_t stats;
+
+// filled under the lock, sent after it, so no websocket call is made while holding it
+static OUTPUT_t outputs[SESSION_MAX_PIPELINES];
+static int output_count;
+
+_Static_assert(SESSION_MAX <= 32, "OUTPUT_t.clients has a bit per session");
+
+esp_err_t session_init(const SESSION_IO_t *session_io)
+{
+	io = *session_io;
+	lock = xSemaphoreCreateMutex();
+	if (lock == NULL) return ESP_ERR_NO_MEM;
+	for (int i = 0; i < SESSION_MAX; i++) memset(sessions[i].pipe, -1, sizeof(sessions[i].pipe));
+	return ESP_OK;
+}
+
+static int mv_to_raw(int mv)
+{
+	if (io.mv_per_lsb <= 0) return mv;
+	int raw = (int)((mv - io.offset_mv) / io.mv_per_lsb + 0.5f);
+	return raw < 0 ? 0 : raw;
+}
+
+static void unbind(SESSION_t *s, int channel)
+{
+	int p = s->pipe[channel];
+	if (p < 0) return;
+	s->pipe[channel] = -1;
+	if (--pipelines[p].users == 0) stats.pipelines--;
+}
+
+// a pipeline for view, shared with the sessions that already have the same one
+static int bind(const VIEW_t *view)
+{
+	int free_slot = -1;
+	for (int p = 0; p < SESSION_MAX_PIPELINES; p++) {
+		if (pipelines[p].users == 0) {
+			if (free_slot < 0) free_slot = p;
+		} else if (memcmp(&pipelines[p].view, view, sizeof(*view)) == 0) {
+			pipelines[p].users++;
+			return p;
+		}
+	}
+	if (free_slot < 0) return -1;
+	PIPELINE_t *pipe = &pipelines[free_slot];
+	pipe->view = *view;
+	pipe->users = 1;
+	pipe->fresh = 1;
+	stats.pipelines++;
+	return free_slot;
+}
+
+// puts the session on the pipelines of its current view
+static esp_err_t rebind(SESSION_t *s)
+{
+	esp_err_t ret = ESP_OK;
+	for (int ch = 0; ch < ACQ_MAX_CHANNELS; ch++) {
+		int pipe = -1;
+		if (s->channels & (1 << ch)) {
+			int decimation = s->decimation * s->thinning;
+			VIEW_t view = {
+				.channel = ch,
+				.decimation = decimation < SESSION_MAX_DECIMATION ? decimation : SESSION_MAX_DECIMATION,
+				.edge = s->edge,
+				.level_raw = s->edge == SESSION_TRIGGER_NONE ? 0 : mv_to_raw(s->level_mv),
+				.codec = s->codec,
+			};
+			// bound before the old one is let go, so an unchanged view keeps its state
+			pipe = bind(&view);
+			if (pipe < 0) {
+				ESP_LOGW(TAG, "no pipeline left for channel %d", ch);
+				ret = ESP_ERR_NO_MEM;
+			}
+		}
+		unbind(s, ch);
+		s->pipe[ch] = pipe;
+	}
+	return ret;
+}
+
+static void reset(SESSION_t *s)
+{
+	s->channels = 0;
+	s->decimation = 1;
+	s->thinning = 1;
+	s->edge = SESSION_TRIGGER_NONE;
+	s->level_mv = 0;
+	s->codec = CODEC_TEXT;
+	s->pin = -1;
+}
+
+// the session of num, opened on first use; call with the lock held
+static SESSION_t *get(int num)
+{
+	if (num < 0 || num >= SESSION_MAX) return NULL;
+	SESSION_t *s = &sessions[num];
+	if (!s->open) {
+		reset(s);
+		s->open = 1;
+		stats.sessions++;
+	}
+	return s;
+}
+
+void session_open(int num)
+{
+	xSemaphoreTake(lock, portMAX_DELAY);
+	SESSION_t *s = get(num);
+	if (s) {
+		// a new client on a reused num starts from the defaults
+		reset(s);
+		rebind(s);
+	}
+	xSemaphoreGive(lock);
+}
+
+void session_close(int num)
+{
+	if (num < 0 || num >= SESSION_MAX) return;
+	xSemaphoreTake(lock, portMAX_DELAY);
+	SESSION_t *s = &sessions[num];
+	if (s->open) {
+		for (int ch = 0; ch < ACQ_MAX_CHANNELS; ch++) unbind(s, ch);
+		s->open = 0;
+		stats.sessions--;
+	}
+	xSemaphoreGive(lock);
+}
+
+esp_err_t session_set_channel(int num, int channel, int on)
+{
+	if (channel < 0 || channel >= ACQ_MAX_CHANNELS) return ESP_ERR_INVALID_ARG;
+	xSemaphoreTake(lock, portMAX_DELAY);
+	SESSION_t *s = get(num);
+	esp_err_t ret = ESP_ERR_INVALID_ARG;
+	if (s) {
+		if (on) s->channels |= 1 << channel;
+		else s->channels &= ~(1 << channel);
+		ret = rebind(s);
+	}
+	xSemaphoreGive(lock);
+	return ret;
+}
+
+esp_err_t session_set_codec(int num, CODEC_t codec)
+{
+	if (codec < CODEC_TEXT || codec >= CODEC_MAX) return ESP_ERR_INVALID_ARG;
+	xSemaphoreTake(lock, portMAX_DELAY);
+	SESSION_t *s = get(num);
+	esp_err_t ret = ESP_ERR_INVALID_ARG;
+	if (s) {
+		s->codec = codec;
+		ret = rebind(s);
+	}
+	xSemaphoreGive(lock);
+	return ret;
+}
+
+esp_err_t session_set_decimation(int num, int decimation)
+{
+	if (decimation < 1 || decimation > SESSION_MAX_DECIMATION) return ESP_ERR_INVALID_ARG;
+	xSemaphoreTake(lock, portMAX_DELAY);
+	SESSION_t *s = get(num);
+	esp_err_t ret = ESP_ERR_INVALID_ARG;
+	if (s) {
+		s->decimation = decimation;
+		ret = rebind(s);
+	}
+	xSemaphoreGive(lock);
+	return ret;
+}
+
+esp_err_t session_set_thinning(int num, int factor)
+{
+	if (num < 0 || num >= SESSION_MAX || factor < 1) return ESP_ERR_INVALID_ARG;
+	xSemaphoreTake(lock, portMAX_DELAY);
+	SESSION_t *s = &sessions[num];
+	esp_err_t ret = ESP_ERR_INVALID_STATE;
+	// not opened by it, the client may be gone
+	if (s->open) {
+		s->thinning = factor;
+		ret = rebind(s);
+	}
+	xSemaphoreGive(lock);
+	return ret;
+}
+
+esp_err_t session_set_trigger(int num, SESSION_TRIGGER_t edge, int level_mv)
+{
+	if (edge < SESSION_TRIGGER_NONE || edge > SESSION_TRIGGER_FALLING) return ESP_ERR_INVALID_ARG;
+	xSemaphoreTake(lock, portMAX_DELAY);
+	SESSION_t *s = get(num);
+	esp_err_t ret = ESP_ERR_INVALID_ARG;
+	if (s) {
+		s->edge = edge;
+		s->level_mv = level_mv;
+		ret = rebind(s);
+	}
+	xSemaphoreGive(lock);
+	return ret;
+}
+
+void session_set_pin(int num, int pin)
+{
+	xSemaphoreTake(lock, portMAX_DELAY);
+	SESSION_t *s = get(num);
+	if (s) s->pin = pin;
+	xSemaphoreGive(lock);
+}
+
+int session_pin(int num)
+{
+	if (num < 0 || num >= SESSION_MAX) return -1;
+	xSemaphoreTake(lock, portMAX_DELAY);
+	int pin = sessions[num].open ? sessions[num].pin : -1;
+	xSemaphoreGive(lock);
+	return pin;
+}
+
+void session_arm(int64_t mono_us)
+{
+	xSemaphoreTake(lock, portMAX_DELAY);
+	for (int p = 0; p < SESSION_MAX_PIPELINES; p++) {
+		if (pipelines[p].users > 0 && pipelines[p].view.edge != SESSION_TRIGGER_NONE) pipelines[p].arm_us = mono_us;
+	}
+	xSemaphoreGive(lock);
+}
+
+uint32_t session_channels(void)
+{
+	uint32_t channels = 0;
+	xSemaphoreTake(lock, portMAX_DELAY);
+	for (int i = 0; i < SESSION_MAX; i++) {
+		if (sessions[i].open) channels |= sessions[i].channels;
+	}
+	xSemaphoreGive(lock);
+	return channels;
+}
+
+// the message of a full output buffer, once for all the clients of the pipeline
+static void emit(PIPELINE_t *pipe, uint32_t period_us)
+{
+	int index = pipe - pipelines;
+	uint32_t clients = 0;
+	for (int i = 0; i < SESSION_MAX; i++) {
+		if (sessions[i].open && sessions[i].pipe[pipe->view.channel] == index) clients |= 1u << i;
+	}
+	if (clients == 0) return;
+	if (output_count == SESSION_MAX_PIPELINES) {
+		stats.dropped++;
+		return;
+	}
+	OUTPUT_t *out = &outputs[output_count];
+	out->clients = clients;
+	int64_t t0_us = io.stamp ? io.stamp(pipe->t0_us) : pipe->t0_us;
+
+	if (pipe->view.codec == CODEC_TEXT) {
+		char values[SESSION_OUT_SAMPLES * 6];
+		char name[16];
+		char t0[24];
+		int pos = 0;
+		for (int i = 0; i < pipe->count; i++) {
+			pos += sprintf(values + pos, "%s%u", i ? "," : "", io.raw_to_mv(pipe->out[i]));
+		}
+		sprintf(name, "ADC%d", pipe->view.channel);
+		sprintf(t0, "%lld", (long long)t0_us);
+		out->binary = 0;
+		out->len = makeSendText((char *)out->data, "AS", name, values, t0);
+	} else {
+		protocol_put_frame_header(out->data, &(STREAM_FRAME_t) {
+			.channel = pipe->view.channel,
+			.bits = io.bits,
+			.seq = pipe->seq,
+			.period_us = period_us,
+			.mv_per_lsb = io.mv_per_lsb,
+			.offset_mv = io.offset_mv,
+			.t0_us = t0_us,
+		});
+		int len = codec_encode(pipe->view.codec, pipe->out, pipe->count, io.bits,
+			out->data + PROTOCOL_FRAME_HEADER_SIZE, sizeof(out->data) - PROTOCOL_FRAME_HEADER_SIZE);
+		if (len < 0) return;
+		out->binary = 1;
+		out->len = PROTOCOL_FRAME_HEADER_SIZE + len;
+	}
+	pipe->seq++;
+	output_count++;
+	stats.outputs++;
+}
+
+// one decimated sample into the output buffer, through the trigger
+static void push(PIPELINE_t *pipe, int value, int64_t t_us, uint32_t period_us)
+{
+	const VIEW_t *v = &pipe->view;
+	if (v->edge != SESSION_TRIGGER_NONE && !pipe->capturing) {
+		int crossed = pipe->have_prev && (v->edge == SESSION_TRIGGER_RISING
+			? pipe->prev < v->level_raw && value >= v->level_raw
+			: pipe->prev > v->level_raw && value <= v->level_raw);
+		// an armed capture waits for its time, not for the edge
+		if (pipe->arm_us) {
+			crossed = t_us >= pipe->arm_us;
+			if (crossed) pipe->arm_us = 0;
+		}
+		pipe->prev = value;
+		pipe->have_prev = 1;
+		if (!crossed) return;
+		pipe->capturing = 1;
+	}
+	pipe->prev = value;
+	pipe->have_prev = 1;
+	if (pipe->count == 0) pipe->t0_us = t_us;
+	pipe->out[pipe->count++] = value;
+	if (pipe->count == SESSION_OUT_SAMPLES) {
+		emit(pipe, period_us);
+		pipe->count = 0;
+		pipe->capturing = 0;
+	}
+}
+
+static void run(PIPELINE_t *pipe, const SAMPLE_BLOCK_t *block)
+{
+	uint16_t samples[ACQ_BLOCK_SAMPLES];
+	if (pipe->fresh) {
+		VIEW_t view = pipe->view;
+		int users = pipe->users;
+		memset(pipe, 0, sizeof(*pipe));
+		pipe->view = view;
+		pipe->users = users;
+	}
+	int n = acquire_block_channel(block, pipe->view.channel, samples);
+	int decimation = pipe->view.decimation;
+	uint32_t period_us = block->period_us * decimation;
+	for (int i = 0; i < n; i++) {
+		if (decimation == 1) {
+			push(pipe, samples[i], block->t0_us + (int64_t)i * block->period_us, period_us);
+			continue;
+		}
+		if (pipe->acc_n == 0) pipe->acc_t0_us = block->t0_us + (int64_t)i * block->period_us;
+		pipe->acc += samples[i];
+		if (++pipe->acc_n == decimation) {
+			push(pipe, (pipe->acc + decimation / 2) / decimation, pipe->acc_t0_us, period_us);
+			pipe->acc = 0;
+			pipe->acc_n = 0;
+		}
+	}
+}
+
+void session_process(const SAMPLE_BLOCK_t *block)
+{
+	xSemaphoreTake(lock, portMAX_DELAY);
+	output_count = 0;
+	for (int p = 0; p < SESSION_MAX_PIPELINES; p++) {
+		if (pipelines[p].users > 0) run(&pipelines[p], block);
+	}
+	int count = output_count;
+	xSemaphoreGive(lock);
+
+	// outputs[] only changes in here, and this runs in a single task
+	uint32_t sends = 0;
+	for (int o = 0; o < count; o++) {
+		const OUTPUT_t *out = &outputs[o];
+		for (int i = 0; i < SESSION_MAX; i++) {
+			if (out->clients & (1u << i)) {
+				io.send(i, out->data, out->len, out->binary);
+				sends++;
+			}
+		}
+	}
+	if (sends) {
+		xSemaphoreTake(lock, portMAX_DELAY);
+		stats.sends += sends;
+		xSemaphoreGive(lock);
+	}
+}
+
+void session_get_stats(SESSION_STATS_t *out)
+{
+	xSemaphoreTake(lock, portMAX_DELAY);
+	*out = stats;
+	xSemaphoreGive(lock);
+}
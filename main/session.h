@@ -0,0 +1,83 @@
+/*
+	 Per-client capture sessions, all served from the one acquisition stream.
+
+	 Every websocket client (by num) has its own view: the channels it
+	 streams, a decimation (the timebase), a trigger and the encoding, and
+	 the pin its G/A commands refer to. A view of one channel is computed
+	 by a pipeline: average of `decimation` readings, then either a
+	 continuous stream or, with a trigger, one capture of
+	 SESSION_OUT_SAMPLES after every crossing of the level. Sessions whose
+	 views are equal share the pipeline, so its output is computed and
+	 encoded once and only sent once per client.
+
+	 session_process() runs in the consumer of the acquisition ring, the
+	 setters in the websocket callback.
+*/
+
+#ifndef MAIN_SESSION_H_
+#define MAIN_SESSION_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "sdkconfig.h"
+
+#include "acquire.h"
+#include "codec.h"
+
+#define SESSION_MAX CONFIG_WEBSOCKET_SERVER_MAX_CLIENTS	// one per websocket client
+#define SESSION_MAX_PIPELINES 16
+#define SESSION_OUT_SAMPLES ACQ_BLOCK_SAMPLES	// samples per message
+#define SESSION_MAX_DECIMATION 10000
+
+typedef enum {
+	SESSION_TRIGGER_NONE = 0,
+	SESSION_TRIGGER_RISING,
+	SESSION_TRIGGER_FALLING,
+} SESSION_TRIGGER_t;
+
+typedef struct {
+	// sends one message to one client, binary or text; the websocket server on the board
+	int (*send)(int num, const void *data, size_t len, int binary);
+	uint32_t (*raw_to_mv)(int raw);
+	int bits;				// width of a raw reading
+	float mv_per_lsb;		// the straight line of the binary frames
+	float offset_mv;
+	// the t0_us of a message from the monotonic time of its first sample, unchanged when NULL
+	int64_t (*stamp)(int64_t mono_us);
+} SESSION_IO_t;
+
+typedef struct {
+	uint32_t sessions;		// open sessions
+	uint32_t pipelines;		// pipelines in use
+	uint32_t outputs;		// messages built
+	uint32_t sends;			// messages sent, one per output and client
+	uint32_t dropped;		// outputs that found no room, should stay 0
+} SESSION_STATS_t;
+
+esp_err_t session_init(const SESSION_IO_t *io);
+
+void session_open(int num);
+void session_close(int num);
+
+esp_err_t session_set_channel(int num, int channel, int on);
+esp_err_t session_set_codec(int num, CODEC_t codec);
+esp_err_t session_set_decimation(int num, int decimation);
+// the decimation of num times factor, for the rate control (flow.h); its own decimation is kept
+esp_err_t session_set_thinning(int num, int factor);
+esp_err_t session_set_trigger(int num, SESSION_TRIGGER_t edge, int level_mv);
+void session_set_pin(int num, int pin);
+int session_pin(int num);
+
+// the next capture of every session with a trigger starts at mono_us instead of at an edge
+void session_arm(int64_t mono_us);
+
+// union of the channels of all sessions, what the acquisition has to sample
+uint32_t session_channels(void);
+
+// feeds one block through every pipeline and sends what they produced
+void session_process(const SAMPLE_BLOCK_t *block);
+void session_get_stats(SESSION_STATS_t *stats);
+
+#endif /* MAIN_SESSION_H_ */
@@ -0,0 +1,74 @@
+/*
+	 Wait-free single producer / single consumer ring, see spsc.h
+
+	 head and tail count slots forever and wrap at 2^32, the slot index is
+	 the count masked by the ring size. The producer publishes with a
+	 release store of head, the consumer hands slots back with a release
+	 store of tail; each side reads the other's index with acquire only when
+	 its cached copy says the ring is full or empty.
+*/
+
+#include "spsc.h"
+
+esp_err_t spsc_init(SPSC_RING_t *ring, void *storage, size_t slot_size, uint32_t count)
+{
+	if (storage == NULL || slot_size == 0 || count == 0 || (count & (count - 1)) != 0) {
+		return ESP_ERR_INVALID_ARG;
+	}
+	atomic_init(&ring->head, 0);
+	atomic_init(&ring->tail, 0);
+	atomic_init(&ring->overruns, 0);
+	ring->tail_cache = 0;
+	ring->head_cache = 0;
+	ring->slots = storage;
+	ring->slot_size = slot_size;
+	ring->mask = count - 1;
+	return ESP_OK;
+}
+
+void *spsc_claim(SPSC_RING_t *ring)
+{
+	uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	if (head - ring->tail_cache > ring->mask) {
+		ring->tail_cache = atomic_load_explicit(&ring->tail, memory_order_acquire);
+		if (head - ring->tail_cache > ring->mask) {
+			atomic_fetch_add_explicit(&ring->overruns, 1, memory_order_relaxed);
+			return NULL;
+		}
+	}
+	return ring->slots + (size_t)(head & ring->mask) * ring->slot_size;
+}
+
+void spsc_publish(SPSC_RING_t *ring)
+{
+	uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+const void *spsc_peek(SPSC_RING_t *ring)
+{
+	uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+	if (tail == ring->head_cache) {
+		ring->head_cache = atomic_load_explicit(&ring->head, memory_order_acquire);
+		if (tail == ring->head_cache) return NULL;
+	}
+	return ring->slots + (size_t)(tail & ring->mask) * ring->slot_size;
+}
+
+void spsc_release(SPSC_RING_t *ring)
+{
+	uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+	atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+}
+
+uint32_t spsc_used(SPSC_RING_t *ring)
+{
+	uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+	uint32_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+	return head - tail;
+}
+
+uint32_t spsc_overruns(SPSC_RING_t *ring)
+{
+	return atomic_load_explicit(&ring->overruns, memory_order_relaxed);
+}
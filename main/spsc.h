@@ -0,0 +1,59 @@
+/*
+	 Wait-free single producer / single consumer ring of fixed size slots.
+
+	 The producer claims a slot, fills it in place and publishes it; the
+	 consumer peeks at the oldest slot and releases it when done. Nothing is
+	 copied and no lock or critical section is taken, so the producer can be
+	 a high priority task (or an ISR) and never waits for the consumer.
+	 When the ring is full the new data is dropped and counted as an overrun.
+
+	 Exactly one task may call the producer functions and exactly one task
+	 the consumer functions.
+*/
+
+#ifndef MAIN_SPSC_H_
+#define MAIN_SPSC_H_
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+// head and tail on their own cache lines, so the two sides do not share one
+#define SPSC_CACHE_LINE 64
+
+typedef struct {
+	// written by the producer
+	_Alignas(SPSC_CACHE_LINE) _Atomic uint32_t head;
+	uint32_t tail_cache;		// last tail seen by the producer
+	_Atomic uint32_t overruns;
+
+	// written by the consumer
+	_Alignas(SPSC_CACHE_LINE) _Atomic uint32_t tail;
+	uint32_t head_cache;		// last head seen by the consumer
+
+	// constant after spsc_init()
+	_Alignas(SPSC_CACHE_LINE) uint8_t *slots;
+	size_t slot_size;
+	uint32_t mask;
+} SPSC_RING_t;
+
+// count must be a power of two, storage holds count * slot_size bytes
+esp_err_t spsc_init(SPSC_RING_t *ring, void *storage, size_t slot_size, uint32_t count);
+
+// producer: a free slot to fill, or NULL (and one more overrun) when full
+void *spsc_claim(SPSC_RING_t *ring);
+// producer: hands the slot returned by spsc_claim() to the consumer
+void spsc_publish(SPSC_RING_t *ring);
+
+// consumer: the oldest published slot, or NULL when empty
+const void *spsc_peek(SPSC_RING_t *ring);
+// consumer: gives the slot returned by spsc_peek() back to the producer
+void spsc_release(SPSC_RING_t *ring);
+
+// either side
+uint32_t spsc_used(SPSC_RING_t *ring);
+uint32_t spsc_overruns(SPSC_RING_t *ring);
+
+#endif /* MAIN_SPSC_H_ */
@@ -0,0 +1,61 @@
+/*
+	 The time base of samples and messages, see timebase.h
+*/
+
+#include <stdio.h>
+#include <time.h>
+
+#include "freertos/FreeRTOS.h"
+#include "sdkconfig.h"
+
+#include "timebase.h"
+
+// 64 bit values are not atomic on the ESP32, so the anchor is kept under a spinlock
+static portMUX_TYPE mux = portMUX_INITIALIZER_UNLOCKED;
+static int64_t offset_us;
+static uint32_t generation;
+
+void timebase_set_anchor(int64_t epoch_us, int64_t mono_us)
+{
+	portENTER_CRITICAL(&mux);
+	offset_us = epoch_us - mono_us;
+	generation++;
+	portEXIT_CRITICAL(&mux);
+}
+
+bool timebase_to_epoch(int64_t mono_us, int64_t *epoch_us)
+{
+	portENTER_CRITICAL(&mux);
+	int64_t offset = offset_us;
+	uint32_t gen = generation;
+	portEXIT_CRITICAL(&mux);
+	*epoch_us = gen ? mono_us + offset : 0;
+	return gen != 0;
+}
+
+int64_t timebase_offset_us(void)
+{
+	int64_t epoch_us;
+	return timebase_to_epoch(0, &epoch_us) ? epoch_us : 0;
+}
+
+uint32_t timebase_generation(void)
+{
+	portENTER_CRITICAL(&mux);
+	uint32_t gen = generation;
+	portEXIT_CRITICAL(&mux);
+	return gen;
+}
+
+int timebase_format(int64_t mono_us, char *buf, size_t size)
+{
+	int64_t epoch_us;
+	if (!timebase_to_epoch(mono_us, &epoch_us)) {
+		int64_t s = mono_us / 1000000;
+		return snprintf(buf, size, "+%02d:%02d:%02d", (int)(s / 3600), (int)(s / 60 % 60), (int)(s % 60));
+	}
+	time_t now = epoch_us / 1000000 + CONFIG_LOCAL_TIMEZONE*60*60;
+	struct tm timeinfo;
+	localtime_r(&now, &timeinfo);
+	return strftime(buf, size, "%H:%M:%S", &timeinfo);
+}
@@ -0,0 +1,34 @@
+/*
+	 The time base of samples and messages.
+
+	 Everything on the board is stamped with the monotonic clock,
+	 esp_timer_get_time() (hal_clock_us() is the same clock), which runs
+	 from boot and never jumps. Wall clock time is an anchor on top of it:
+	 the epoch time of one monotonic instant, set when SNTP gets through.
+	 Until then, and for good on a network without a time server, times are
+	 only relative to boot, and clients get told which of the two they see.
+*/
+
+#ifndef MAIN_TIMEBASE_H_
+#define MAIN_TIMEBASE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// epoch_us (microseconds since 1970) was the time at mono_us
+void timebase_set_anchor(int64_t epoch_us, int64_t mono_us);
+
+// epoch time of a monotonic time, false while there is no anchor
+bool timebase_to_epoch(int64_t mono_us, int64_t *epoch_us);
+
+// epoch minus monotonic time, 0 while there is no anchor
+int64_t timebase_offset_us(void);
+
+// counts the anchors set, to notice a new one
+uint32_t timebase_generation(void);
+
+// "HH:MM:SS" local time, or "+HH:MM:SS" since boot while there is no anchor
+int timebase_format(int64_t mono_us, char *buf, size_t size);
+
+#endif /* MAIN_TIMEBASE_H_ */
@@ -0,0 +1,376 @@
+/*
+	 Topic trie of the MQTT subscriptions, see topic.h
+*/
+
+#include <string.h>
+
+#include "topic.h"
+
+struct TOPIC_SUB {
+	TOPIC_SUB_t *next;
+	uint16_t sink;
+};
+
+struct TOPIC_NODE {
+	TOPIC_NODE_t *parent;
+	TOPIC_NODE_t *chain;	// next in the bucket of the plain children
+	TOPIC_NODE_t *child;	// first of the plain children
+	TOPIC_NODE_t *next;		// next sibling, or next on the free list
+	TOPIC_NODE_t *plus;		// the '+' child
+	TOPIC_NODE_t *hash;		// the '#' child
+	TOPIC_SUB_t *subs;		// sinks of the filter that ends here
+	uint32_t level_hash;
+	uint16_t len;
+	uint16_t room;			// of level, up to the next ARENA_ALIGN
+	char level[];			// not NUL terminated
+};
+
+// the levels of a filter or a name
+typedef struct {
+	int count;
+	const char *start[TOPIC_MAX_LEVELS];
+	uint16_t len[TOPIC_MAX_LEVELS];
+} LEVELS_t;
+
+typedef struct {
+	uint16_t *sinks;
+	int max;
+	int count;
+} MATCH_t;
+
+// FNV-1a
+static uint32_t hash_level(const char *s, size_t len)
+{
+	uint32_t h = 2166136261u;
+	for (size_t i = 0; i < len; i++) h = (h ^ (uint8_t)s[i]) * 16777619u;
+	return h;
+}
+
+static bool split(const char *s, size_t len, LEVELS_t *levels)
+{
+	if (len == 0 || len > TOPIC_MAX_LEN) return false;
+	levels->count = 0;
+	const char *start = s;
+	for (size_t i = 0; i <= len; i++) {
+		if (i < len && s[i] != '/') continue;
+		if (s + i != start && memchr(start, 0, s + i - start)) return false;
+		if (levels->count == TOPIC_MAX_LEVELS) return false;
+		levels->start[levels->count] = start;
+		levels->len[levels->count] = s + i - start;
+		levels->count++;
+		start = s + i + 1;
+	}
+	return true;
+}
+
+static bool is_level(const LEVELS_t *levels, int i, char c)
+{
+	return levels->len[i] == 1 && levels->start[i][0] == c;
+}
+
+static bool check_filter(const char *filter, size_t len, LEVELS_t *levels)
+{
+	if (!split(filter, len, levels)) return false;
+	for (int i = 0; i < levels->count; i++) {
+		const char *p = levels->start[i];
+		uint16_t n = levels->len[i];
+		if (n > 1 && (memchr(p, '+', n) || memchr(p, '#', n))) return false;
+		if (is_level(levels, i, '#') && i != levels->count - 1) return false;
+	}
+	return true;
+}
+
+bool topic_valid_filter(const char *filter, size_t len)
+{
+	LEVELS_t levels;
+	return check_filter(filter, len, &levels);
+}
+
+bool topic_valid_name(const char *name, size_t len)
+{
+	LEVELS_t levels;
+	return split(name, len, &levels) && !memchr(name, '+', len) && !memchr(name, '#', len);
+}
+
+// plain children are found by their parent and level in the buckets of the table
+static uint32_t bucket(const TOPIC_TABLE_t *table, const TOPIC_NODE_t *parent, uint32_t level_hash)
+{
+	return (level_hash ^ (uint32_t)((uintptr_t)parent >> 3) * 2654435761u) & table->mask;
+}
+
+// a node from the free list with room for the level, the first that has it, or from the arena
+static TOPIC_NODE_t *new_node(TOPIC_TABLE_t *table, const char *level, uint16_t len)
+{
+	TOPIC_NODE_t *node = NULL;
+	for (TOPIC_NODE_t **p = &table->free_nodes; *p; p = &(*p)->next) {
+		if ((*p)->room >= len) {
+			node = *p;
+			*p = node->next;
+			break;
+		}
+	}
+	uint16_t room;
+	if (node) {
+		room = node->room;
+	} else {
+		size_t size = (sizeof(TOPIC_NODE_t) + len + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+		node = arena_alloc(&table->arena, size);
+		if (node == NULL) return NULL;
+		room = size - sizeof(TOPIC_NODE_t);
+	}
+	memset(node, 0, sizeof(*node));
+	node->room = room;
+	node->level_hash = hash_level(level, len);
+	node->len = len;
+	memcpy(node->level, level, len);
+	table->nodes++;
+	return node;
+}
+
+void topic_table_init(TOPIC_TABLE_t *table, void *buf, size_t size)
+{
+	arena_init(&table->arena, buf, size);
+	// a bucket per 128 bytes of arena, a power of two
+	uint32_t buckets = 1;
+	while (buckets * 2 <= size / 128) buckets *= 2;
+	table->buckets = arena_alloc(&table->arena, buckets * sizeof(TOPIC_NODE_t *));
+	table->mask = buckets - 1;
+	if (table->buckets) memset(table->buckets, 0, buckets * sizeof(TOPIC_NODE_t *));
+	table->free_subs = NULL;
+	table->free_nodes = NULL;
+	table->filters = 0;
+	table->nodes = 0;
+	table->root = table->buckets ? new_node(table, "", 0) : NULL;
+}
+
+static TOPIC_NODE_t *find_child(const TOPIC_TABLE_t *table, const TOPIC_NODE_t *node, const char *level, uint16_t len, uint32_t h)
+{
+	for (TOPIC_NODE_t *c = table->buckets[bucket(table, node, h)]; c; c = c->chain) {
+		if (c->parent == node && c->level_hash == h && c->len == len && memcmp(c->level, level, len) == 0) return c;
+	}
+	return NULL;
+}
+
+static bool unused(const TOPIC_NODE_t *node)
+{
+	return node->subs == NULL && node->child == NULL && node->plus == NULL && node->hash == NULL;
+}
+
+// takes an unused node out of the trie onto the free list, returns its parent
+static TOPIC_NODE_t *release(TOPIC_TABLE_t *table, TOPIC_NODE_t *node)
+{
+	TOPIC_NODE_t *parent = node->parent;
+	if (parent->plus == node) {
+		parent->plus = NULL;
+	} else if (parent->hash == node) {
+		parent->hash = NULL;
+	} else {
+		TOPIC_NODE_t **p = &parent->child;
+		while (*p != node) p = &(*p)->next;
+		*p = node->next;
+		p = &table->buckets[bucket(table, parent, node->level_hash)];
+		while (*p != node) p = &(*p)->chain;
+		*p = node->chain;
+	}
+	node->next = table->free_nodes;
+	table->free_nodes = node;
+	table->nodes--;
+	return parent;
+}
+
+// node and the parents it leaves unused
+static void prune(TOPIC_TABLE_t *table, TOPIC_NODE_t *node)
+{
+	while (node != table->root && unused(node)) node = release(table, node);
+}
+
+// the node of the filter, made on the way when make
+static TOPIC_NODE_t *walk_filter(TOPIC_TABLE_t *table, bool make, const LEVELS_t *levels)
+{
+	TOPIC_NODE_t *node = table->root;
+	for (int i = 0; i < levels->count && node; i++) {
+		const char *level = levels->start[i];
+		uint16_t len = levels->len[i];
+		TOPIC_NODE_t **slot = NULL;
+		if (is_level(levels, i, '+')) {
+			slot = &node->plus;
+		} else if (is_level(levels, i, '#')) {
+			slot = &node->hash;
+		}
+		if (slot) {
+			if (*slot == NULL && make) {
+				*slot = new_node(table, level, len);
+				if (*slot == NULL) {
+					prune(table, node);	// the nodes made for it so far
+					return NULL;
+				}
+				(*slot)->parent = node;
+			}
+			node = *slot;
+			continue;
+		}
+		uint32_t h = hash_level(level, len);
+		TOPIC_NODE_t *child = find_child(table, node, level, len, h);
+		if (child == NULL && make) {
+			child = new_node(table, level, len);
+			if (child == NULL) {
+				prune(table, node);
+				return NULL;
+			}
+			child->parent = node;
+			child->next = node->child;
+			node->child = child;
+			TOPIC_NODE_t **b = &table->buckets[bucket(table, node, h)];
+			child->chain = *b;
+			*b = child;
+		}
+		node = child;
+	}
+	return node;
+}
+
+esp_err_t topic_subscribe(TOPIC_TABLE_t *table, const char *filter, size_t len, uint16_t sink)
+{
+	LEVELS_t levels;
+	if (!check_filter(filter, len, &levels)) return ESP_ERR_INVALID_ARG;
+	TOPIC_NODE_t *node = walk_filter(table, true, &levels);
+	if (node == NULL) return ESP_ERR_NO_MEM;
+	for (TOPIC_SUB_t *s = node->subs; s; s = s->next) {
+		if (s->sink == sink) return ESP_OK;
+	}
+	TOPIC_SUB_t *sub = table->free_subs;
+	if (sub) {
+		table->free_subs = sub->next;
+	} else {
+		sub = arena_alloc(&table->arena, sizeof(*sub));
+		if (sub == NULL) {
+			prune(table, node);
+			return ESP_ERR_NO_MEM;
+		}
+	}
+	if (node->subs == NULL) table->filters++;
+	sub->sink = sink;
+	sub->next = node->subs;
+	node->subs = sub;
+	return ESP_OK;
+}
+
+// takes sink off node, returns true when it was there
+static bool remove_sub(TOPIC_TABLE_t *table, TOPIC_NODE_t *node, uint16_t sink)
+{
+	for (TOPIC_SUB_t **p = &node->subs; *p; p = &(*p)->next) {
+		if ((*p)->sink != sink) continue;
+		TOPIC_SUB_t *sub = *p;
+		*p = sub->next;
+		sub->next = table->free_subs;
+		table->free_subs = sub;
+		if (node->subs == NULL) table->filters--;
+		return true;
+	}
+	return false;
+}
+
+esp_err_t topic_unsubscribe(TOPIC_TABLE_t *table, const char *filter, size_t len, uint16_t sink)
+{
+	LEVELS_t levels;
+	if (!check_filter(filter, len, &levels)) return ESP_ERR_INVALID_ARG;
+	TOPIC_NODE_t *node = walk_filter(table, false, &levels);
+	if (node == NULL || !remove_sub(table, node, sink)) return ESP_ERR_NOT_FOUND;
+	prune(table, node);
+	return ESP_OK;
+}
+
+int topic_sinks(const TOPIC_TABLE_t *table, const char *filter, size_t len)
+{
+	LEVELS_t levels;
+	if (!check_filter(filter, len, &levels)) return 0;
+	TOPIC_NODE_t *node = walk_filter((TOPIC_TABLE_t *)table, false, &levels);
+	int n = 0;
+	for (TOPIC_SUB_t *s = node ? node->subs : NULL; s; s = s->next) n++;
+	return n;
+}
+
+typedef struct {
+	TOPIC_TABLE_t *table;		// NULL to only list the filters
+	uint16_t sink;
+	TOPIC_FILTER_CB_t cb;
+	void *arg;
+	char path[TOPIC_MAX_LEN + 1];
+} WALK_t;
+
+static void walk(WALK_t *w, TOPIC_NODE_t *node, size_t len, bool root);
+
+static void walk_child(WALK_t *w, TOPIC_NODE_t *child, size_t len, bool root)
+{
+	// the filters are TOPIC_MAX_LEN at most, so are the paths to their nodes
+	if (!root) w->path[len++] = '/';
+	memcpy(w->path + len, child->level, child->len);
+	walk(w, child, len + child->len, false);
+}
+
+// visits node, whose filter is the first len bytes of w->path, and everything below it
+static void walk(WALK_t *w, TOPIC_NODE_t *node, size_t len, bool root)
+{
+	if (node->subs) {
+		bool emptied = w->table && remove_sub(w->table, node, w->sink) && node->subs == NULL;
+		if ((w->table == NULL || emptied) && w->cb) {
+			w->path[len] = 0;
+			w->cb(w->path, len, w->arg);
+		}
+	}
+	if (node->plus) walk_child(w, node->plus, len, root);
+	if (node->hash) walk_child(w, node->hash, len, root);
+	for (TOPIC_NODE_t *c = node->child, *next; c; c = next) {
+		next = c->next;		// c may go to the free list
+		walk_child(w, c, len, root);
+	}
+	// removing a sink: the nodes left unused go, the children first
+	if (w->table && !root && unused(node)) release(w->table, node);
+}
+
+void topic_remove_sink(TOPIC_TABLE_t *table, uint16_t sink, TOPIC_FILTER_CB_t emptied, void *arg)
+{
+	if (table->root == NULL) return;
+	WALK_t w = { .table = table, .sink = sink, .cb = emptied, .arg = arg };
+	walk(&w, table->root, 0, true);
+}
+
+void topic_each_filter(const TOPIC_TABLE_t *table, TOPIC_FILTER_CB_t cb, void *arg)
+{
+	if (table->root == NULL) return;
+	WALK_t w = { .table = NULL, .cb = cb, .arg = arg };
+	walk(&w, table->root, 0, true);
+}
+
+static void collect(MATCH_t *m, const TOPIC_SUB_t *s)
+{
+	for (; s; s = s->next) {
+		int i = 0;
+		while (i < m->count && m->sinks[i] != s->sink) i++;
+		if (i == m->count && m->count < m->max) m->sinks[m->count++] = s->sink;
+	}
+}
+
+// node matched the levels before i; dollar keeps the wildcards off level i
+static void match(const TOPIC_TABLE_t *table, const TOPIC_NODE_t *node, const LEVELS_t *levels, int i, MATCH_t *m, bool dollar)
+{
+	if (node->hash && !dollar) collect(m, node->hash->subs);
+	if (i == levels->count) {
+		collect(m, node->subs);
+		return;
+	}
+	if (node->plus && !dollar) match(table, node->plus, levels, i + 1, m, false);
+	const char *level = levels->start[i];
+	uint16_t len = levels->len[i];
+	const TOPIC_NODE_t *child = find_child(table, node, level, len, hash_level(level, len));
+	if (child) match(table, child, levels, i + 1, m, false);
+}
+
+int topic_match(const TOPIC_TABLE_t *table, const char *name, size_t len, uint16_t *sinks, int max)
+{
+	LEVELS_t levels;
+	if (table->root == NULL || !split(name, len, &levels)) return 0;
+	MATCH_t m = { .sinks = sinks, .max = max };
+	match(table, table->root, &levels, 0, &m, name[0] == '$');
+	return m.count;
+}
@@ -0,0 +1,78 @@
+/*
+	 MQTT subscriptions: which topic filters are wanted, and by whom.
+
+	 The filters go in a trie of their levels, built in an arena: a node
+	 per level, with the '+' and '#' children apart from the others, and
+	 on the node where a filter ends the sinks that subscribed to it. A
+	 sink is a number chosen by the caller, a websocket client or an
+	 internal consumer. Matching a topic walks the trie a level at a time,
+	 following the level itself, '+' and '#'. The plain children are found
+	 in a hash of (parent, level) with a bucket per 128 bytes of arena, so
+	 a match costs the depth of the topic, not the number of filters.
+
+	 A node left with no sink and no child, when the last sink of its
+	 filter goes, is taken out of the trie onto a free list, and so are
+	 the parents it leaves the same way; a new node takes the first free
+	 one with room for its level before the arena. The entries of the
+	 sinks have a free list of their own. So subscriptions that come and
+	 go keep to the arena of the most there were at once; the arena is
+	 only given back by topic_table_init().
+
+	 Filters and names follow MQTT 3.1.1: '+' is a whole level, '#' the
+	 whole last level and matches its parent too ("a/#" matches "a"), and
+	 wildcards at the first level do not match topics that start with '$'.
+
+	 Not locked.
+*/
+
+#ifndef MAIN_TOPIC_H_
+#define MAIN_TOPIC_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#include "arena.h"
+
+#define TOPIC_MAX_LEN 256		// of a filter or a name
+#define TOPIC_MAX_LEVELS 32
+
+typedef struct TOPIC_SUB TOPIC_SUB_t;
+typedef struct TOPIC_NODE TOPIC_NODE_t;
+
+typedef struct {
+	ARENA_t arena;
+	TOPIC_NODE_t *root;
+	TOPIC_NODE_t **buckets;	// of the plain children, by parent and level
+	uint32_t mask;
+	TOPIC_SUB_t *free_subs;
+	TOPIC_NODE_t *free_nodes;
+	uint32_t filters;		// with at least one sink
+	uint32_t nodes;			// in the trie
+} TOPIC_TABLE_t;
+
+// called with a filter, NUL terminated, while walking the table
+typedef void (*TOPIC_FILTER_CB_t)(const char *filter, size_t len, void *arg);
+
+void topic_table_init(TOPIC_TABLE_t *table, void *buf, size_t size);
+
+bool topic_valid_filter(const char *filter, size_t len);
+bool topic_valid_name(const char *name, size_t len);
+
+// ESP_ERR_INVALID_ARG for a bad filter, ESP_ERR_NO_MEM when the arena is full; twice is once
+esp_err_t topic_subscribe(TOPIC_TABLE_t *table, const char *filter, size_t len, uint16_t sink);
+// ESP_ERR_NOT_FOUND when sink had no such filter
+esp_err_t topic_unsubscribe(TOPIC_TABLE_t *table, const char *filter, size_t len, uint16_t sink);
+// removes sink from every filter, emptied gets the filters left with no sink
+void topic_remove_sink(TOPIC_TABLE_t *table, uint16_t sink, TOPIC_FILTER_CB_t emptied, void *arg);
+// sinks of exactly this filter
+int topic_sinks(const TOPIC_TABLE_t *table, const char *filter, size_t len);
+// every filter that has a sink
+void topic_each_filter(const TOPIC_TABLE_t *table, TOPIC_FILTER_CB_t cb, void *arg);
+
+// the sinks whose filters match the topic name, each once; returns how many, up to max in sinks
+int topic_match(const TOPIC_TABLE_t *table, const char *name, size_t len, uint16_t *sinks, int max);
+
+#endif /* MAIN_TOPIC_H_ */
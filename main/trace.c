@@ -0,0 +1,153 @@
+/*
+	 Deferred binary tracing, see trace.h
+
+	 One ring per core. A writer takes its slot with an atomic add on the
+	 head of the ring of the core it runs on, so tasks and interrupts of
+	 the same core may write at once; the slot's seq goes to 0 while it is
+	 filled and to its index + 1 after, with release. A reader copies the
+	 record and checks seq before and after the copy: a record that
+	 changed under it was overwritten and is counted as lost.
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "trace.h"
+
+#if TRACE_RECORDS < 2 || (TRACE_RECORDS & (TRACE_RECORDS - 1)) != 0
+#error "CONFIG_TRACE_RECORDS must be a power of two, 2 or more"
+#endif
+
+#define TRACE_DRAIN_MS 100
+
+static const char *TAG = "TRACE";
+
+static TRACE_RECORD_t ring[portNUM_PROCESSORS][TRACE_RECORDS];
+static _Atomic uint32_t head[portNUM_PROCESSORS];
+
+void trace_write(const TRACE_SITE_t *site, const uintptr_t *args)
+{
+	int core = xPortGetCoreID();
+	uint32_t i = atomic_fetch_add_explicit(&head[core], 1, memory_order_relaxed);
+	TRACE_RECORD_t *record = &ring[core][i & (TRACE_RECORDS - 1)];
+	atomic_store_explicit(&record->seq, 0, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	record->t_us = esp_timer_get_time();
+	record->site = site;
+	for (int a = 0; a < site->nargs; a++) {
+		record->args[a] = args[a];
+	}
+	atomic_store_explicit(&record->seq, i + 1, memory_order_release);
+}
+
+void trace_reader_init(TRACE_READER_t *reader, int oldest)
+{
+	reader->lost = 0;
+	for (int core = 0; core < portNUM_PROCESSORS; core++) {
+		uint32_t h = atomic_load_explicit(&head[core], memory_order_acquire);
+		reader->next[core] = (oldest && h > TRACE_RECORDS) ? h - TRACE_RECORDS : (oldest ? 0 : h);
+	}
+}
+
+// the record at reader->next[core] into record: 1 when it is there, 0 when not written yet
+static int read_core(TRACE_READER_t *reader, int core, TRACE_RECORD_t *record)
+{
+	for (;;) {
+		uint32_t next = reader->next[core];
+		uint32_t h = atomic_load_explicit(&head[core], memory_order_acquire);
+		if (h == next) return 0;
+		if (h - next > TRACE_RECORDS) {
+			reader->lost += h - next - TRACE_RECORDS;
+			reader->next[core] = next = h - TRACE_RECORDS;
+		}
+		const TRACE_RECORD_t *slot = &ring[core][next & (TRACE_RECORDS - 1)];
+		uint32_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+		if (seq == next + 1) {
+			record->t_us = slot->t_us;
+			record->site = slot->site;
+			memcpy(record->args, slot->args, sizeof(record->args));
+			atomic_thread_fence(memory_order_acquire);
+			if (atomic_load_explicit(&slot->seq, memory_order_relaxed) == seq) {
+				atomic_store_explicit(&record->seq, seq, memory_order_relaxed);
+				return 1;
+			}
+		} else if ((int32_t)(seq - (next + 1)) < 0) {
+			return 0;	// still being written, or its writer was preempted
+		}
+		// overwritten by a later record while we looked
+		reader->lost++;
+		reader->next[core] = next + 1;
+	}
+}
+
+int trace_read(TRACE_READER_t *reader, TRACE_RECORD_t *record)
+{
+	int found = -1;
+	for (int core = 0; core < portNUM_PROCESSORS; core++) {
+		TRACE_RECORD_t candidate;
+		if (read_core(reader, core, &candidate) && (found < 0 || candidate.t_us < record->t_us)) {
+			found = core;
+			record->t_us = candidate.t_us;
+			record->site = candidate.site;
+			memcpy(record->args, candidate.args, sizeof(record->args));
+			atomic_store_explicit(&record->seq, atomic_load_explicit(&candidate.seq, memory_order_relaxed),
+				memory_order_relaxed);
+		}
+	}
+	if (found < 0) return 0;
+	reader->next[found]++;
+	return 1;
+}
+
+int trace_format(const TRACE_RECORD_t *record, char *buf, size_t size)
+{
+	const TRACE_SITE_t *site = record->site;
+	int len = snprintf(buf, size, "%c (%lld) %s: ", "?EWIDV"[site->level < 6 ? site->level : 0],
+		(long long)(record->t_us / 1000), *site->tag);
+	if (len < 0) return len;
+	size_t used = (size_t)len < size ? (size_t)len : size;
+	const uintptr_t *a = record->args;
+	int text = snprintf(buf + used, size - used, site->fmt, a[0], a[1], a[2], a[3]);
+	if (text < 0) return text;
+	len += text;
+	if ((size_t)len + 1 < size) {
+		buf[len] = '\n';
+		buf[len + 1] = '\0';
+	}
+	return len + 1;
+}
+
+static void trace_task(void *pvParameters)
+{
+	TRACE_READER_t reader;
+	TRACE_RECORD_t record;
+	char line[160];
+	uint32_t reported = 0;
+	trace_reader_init(&reader, 1);
+	for (;;) {
+		while (trace_read(&reader, &record)) {
+			if (record.site->level > CONFIG_TRACE_ECHO_LEVEL) continue;
+			if (trace_format(&record, line, sizeof(line)) > 0) {
+				fputs(line, stdout);
+			}
+		}
+		if (reader.lost != reported) {
+			ESP_LOGW(TAG, "%u records lost", (unsigned)(reader.lost - reported));
+			reported = reader.lost;
+		}
+		vTaskDelay(TRACE_DRAIN_MS / portTICK_PERIOD_MS);
+	}
+}
+
+esp_err_t trace_start(void)
+{
+	if (xTaskCreate(trace_task, "trace_task", 1024*3, NULL, 1, NULL) != pdPASS) {
+		return ESP_ERR_NO_MEM;
+	}
+	return ESP_OK;
+}
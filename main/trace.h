@@ -0,0 +1,130 @@
+/*
+	 Deferred binary tracing for the hot paths.
+
+	 TRACE_I("client %d sent %d bytes", num, len) writes a fixed size
+	 record (time, call site, up to TRACE_MAX_ARGS arguments) into a RAM
+	 ring of the core it runs on, with one atomic add and no lock, and
+	 returns. Nothing is formatted there: the call site is a static const
+	 struct holding the tag and the format string, so the string is in
+	 flash once and the record only points to it. Records are formatted
+	 later, by the low priority drain task (trace_start()) that prints
+	 them, or all at once for the /trace download.
+
+	 Arguments are integers of 32 bits at most, or pointers to strings
+	 that outlive the record (literals, names from a table): %s is read
+	 when the record is formatted, not when it is written.
+
+	 A module keeps its records down to a level of its own by defining
+	 TRACE_LEVEL before it includes this header; the levels above it
+	 compile to nothing, arguments included. The default is
+	 CONFIG_TRACE_LEVEL.
+
+	 When the readers fall behind, the oldest records are overwritten and
+	 counted as lost: tracing never waits.
+*/
+
+#ifndef MAIN_TRACE_H_
+#define MAIN_TRACE_H_
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+#include "esp_err.h"
+#include "sdkconfig.h"
+
+#define TRACE_NONE 0
+#define TRACE_ERROR 1
+#define TRACE_WARN 2
+#define TRACE_INFO 3
+#define TRACE_DEBUG 4
+#define TRACE_VERBOSE 5
+
+#ifndef TRACE_LEVEL
+#define TRACE_LEVEL CONFIG_TRACE_LEVEL
+#endif
+
+#define TRACE_MAX_ARGS 4
+#define TRACE_RECORDS CONFIG_TRACE_RECORDS	// per core, a power of two
+
+typedef struct {
+	const char *const *tag;		// the TAG of the module, a constant address
+	const char *fmt;
+	uint8_t level;
+	uint8_t nargs;
+} TRACE_SITE_t;
+
+typedef struct {
+	_Atomic uint32_t seq;		// index in the ring + 1 once written, 0 while being written
+	int64_t t_us;
+	const TRACE_SITE_t *site;
+	uintptr_t args[TRACE_MAX_ARGS];
+} TRACE_RECORD_t;
+
+// a position in every ring; a reader sees each record once
+typedef struct {
+	uint32_t next[portNUM_PROCESSORS];
+	uint32_t lost;			// records overwritten before this reader got to them
+} TRACE_READER_t;
+
+void trace_write(const TRACE_SITE_t *site, const uintptr_t *args);
+
+// oldest: from the oldest record still in the rings, else from now on
+void trace_reader_init(TRACE_READER_t *reader, int oldest);
+// the next record of all cores in time order into record, returns 0 when there is none yet
+int trace_read(TRACE_READER_t *reader, TRACE_RECORD_t *record);
+// "I (t_ms) tag: text\n" like esp_log, returns the length (snprintf rules)
+int trace_format(const TRACE_RECORD_t *record, char *buf, size_t size);
+
+// the drain task, printing the records at CONFIG_TRACE_ECHO_LEVEL and above
+esp_err_t trace_start(void);
+
+#define TRACE_NARGS_(...) TRACE_NARGS2_(0, ##__VA_ARGS__, 4, 3, 2, 1, 0)
+#define TRACE_NARGS2_(_0, _1, _2, _3, _4, n, ...) n
+#define TRACE_CAST_0()
+#define TRACE_CAST_1(a) , (uintptr_t)(a)
+#define TRACE_CAST_2(a, b) , (uintptr_t)(a), (uintptr_t)(b)
+#define TRACE_CAST_3(a, b, c) , (uintptr_t)(a), (uintptr_t)(b), (uintptr_t)(c)
+#define TRACE_CAST_4(a, b, c, d) , (uintptr_t)(a), (uintptr_t)(b), (uintptr_t)(c), (uintptr_t)(d)
+#define TRACE_CAST_(n) TRACE_CAST_##n
+#define TRACE_CAST(n) TRACE_CAST_(n)
+
+#define TRACE_AT(lvl, format, ...) do {                                                      \
+		static const TRACE_SITE_t trace_site_ = {                                            \
+			&TAG, format, lvl, TRACE_NARGS_(__VA_ARGS__) };                                  \
+		const uintptr_t trace_args_[] = { 0 TRACE_CAST(TRACE_NARGS_(__VA_ARGS__))(__VA_ARGS__) }; \
+		trace_write(&trace_site_, trace_args_ + 1);                                          \
+	} while (0)
+
+// compiled out: the arguments are neither evaluated nor left unused
+static inline void trace_off_(int unused, ...) { (void)unused; }
+#define TRACE_OFF(format, ...) do { if (0) trace_off_(0, ##__VA_ARGS__); } while (0)
+
+#if TRACE_LEVEL >= TRACE_ERROR
+#define TRACE_E(format, ...) TRACE_AT(TRACE_ERROR, format, ##__VA_ARGS__)
+#else
+#define TRACE_E(format, ...) TRACE_OFF(format, ##__VA_ARGS__)
+#endif
+#if TRACE_LEVEL >= TRACE_WARN
+#define TRACE_W(format, ...) TRACE_AT(TRACE_WARN, format, ##__VA_ARGS__)
+#else
+#define TRACE_W(format, ...) TRACE_OFF(format, ##__VA_ARGS__)
+#endif
+#if TRACE_LEVEL >= TRACE_INFO
+#define TRACE_I(format, ...) TRACE_AT(TRACE_INFO, format, ##__VA_ARGS__)
+#else
+#define TRACE_I(format, ...) TRACE_OFF(format, ##__VA_ARGS__)
+#endif
+#if TRACE_LEVEL >= TRACE_DEBUG
+#define TRACE_D(format, ...) TRACE_AT(TRACE_DEBUG, format, ##__VA_ARGS__)
+#else
+#define TRACE_D(format, ...) TRACE_OFF(format, ##__VA_ARGS__)
+#endif
+#if TRACE_LEVEL >= TRACE_VERBOSE
+#define TRACE_V(format, ...) TRACE_AT(TRACE_VERBOSE, format, ##__VA_ARGS__)
+#else
+#define TRACE_V(format, ...) TRACE_OFF(format, ##__VA_ARGS__)
+#endif
+
+#endif /* MAIN_TRACE_H_ */
@@ -0,0 +1,129 @@
+/*
+	 UDP streaming of sample blocks, see udp_stream.h
+*/
+
+#include <stdatomic.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "lwip/api.h"
+
+#include "udp_stream.h"
+
+static const char *TAG = "udp_stream";
+
+static SemaphoreHandle_t lock;	// destination and stats, between the websocket and the stream task
+static struct netconn *conn;
+static struct netbuf *buf;		// reused for every datagram, netbuf_ref() points it at the data
+static _Atomic int stream_codec = CODEC_TEXT;
+static uint32_t next_seq;
+static UDP_STREAM_STATS_t stats;
+static uint8_t datagram[UDP_STREAM_MAX_DATAGRAM];
+
+esp_err_t udp_stream_init(void)
+{
+	lock = xSemaphoreCreateMutex();
+	buf = netbuf_new();
+	return lock && buf ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+static void close_locked(void)
+{
+	atomic_store(&stream_codec, CODEC_TEXT);
+	if (conn) {
+		netconn_delete(conn);
+		conn = NULL;
+	}
+}
+
+esp_err_t udp_stream_start(const char *host, uint16_t port, CODEC_t codec)
+{
+	if (codec <= CODEC_TEXT || codec >= CODEC_MAX || port == 0) return ESP_ERR_INVALID_ARG;
+	ip_addr_t addr;
+	if (!ipaddr_aton(host, &addr)) return ESP_ERR_INVALID_ARG;
+
+	xSemaphoreTake(lock, portMAX_DELAY);
+	close_locked();
+	esp_err_t ret = ESP_OK;
+	conn = netconn_new(NETCONN_UDP);
+	if (conn == NULL) {
+		ret = ESP_ERR_NO_MEM;
+	} else if (netconn_connect(conn, &addr, port) != ERR_OK) {
+		close_locked();
+		ret = ESP_FAIL;
+	} else {
+		next_seq = 0;
+		memset(&stats, 0, sizeof(stats));
+		atomic_store(&stream_codec, codec);
+		ESP_LOGI(TAG, "streaming to %s:%u as %s", host, port, codec_name(codec));
+	}
+	xSemaphoreGive(lock);
+	return ret;
+}
+
+void udp_stream_stop(void)
+{
+	xSemaphoreTake(lock, portMAX_DELAY);
+	if (conn) {
+		ESP_LOGI(TAG, "stopped after %u datagrams, %u send errors, client lost %u of %u",
+			stats.sent, stats.send_errors, stats.lost, stats.received + stats.lost);
+	}
+	close_locked();
+	xSemaphoreGive(lock);
+}
+
+CODEC_t udp_stream_codec(void)
+{
+	return atomic_load_explicit(&stream_codec, memory_order_relaxed);
+}
+
+esp_err_t udp_stream_send(const uint8_t *frame, size_t len)
+{
+	if (len > sizeof(datagram) - UDP_STREAM_HEADER_SIZE) return ESP_ERR_INVALID_SIZE;
+	xSemaphoreTake(lock, portMAX_DELAY);
+	if (conn == NULL) {
+		xSemaphoreGive(lock);
+		return ESP_ERR_INVALID_STATE;
+	}
+	uint32_t seq = next_seq++;
+	datagram[0] = seq;
+	datagram[1] = seq >> 8;
+	datagram[2] = seq >> 16;
+	datagram[3] = seq >> 24;
+	memcpy(datagram + UDP_STREAM_HEADER_SIZE, frame, len);
+
+	esp_err_t ret = ESP_OK;
+	if (netbuf_ref(buf, datagram, UDP_STREAM_HEADER_SIZE + len) != ERR_OK || netconn_send(conn, buf) != ERR_OK) {
+		// the number is used up all the same, the client counts it as lost
+		stats.send_errors++;
+		ret = ESP_FAIL;
+	} else {
+		stats.sent++;
+	}
+	xSemaphoreGive(lock);
+	return ret;
+}
+
+void udp_stream_report(uint32_t received, uint32_t lost, uint32_t reordered)
+{
+	xSemaphoreTake(lock, portMAX_DELAY);
+	stats.received = received;
+	stats.lost = lost;
+	stats.reordered = reordered;
+	stats.report_us = esp_timer_get_time();
+	uint32_t sent = stats.sent;
+	uint32_t errors = stats.send_errors;
+	xSemaphoreGive(lock);
+	ESP_LOGI(TAG, "client got %u, lost %u, reordered %u; sent %u, %u send errors",
+		received, lost, reordered, sent, errors);
+}
+
+void udp_stream_get_stats(UDP_STREAM_STATS_t *out)
+{
+	xSemaphoreTake(lock, portMAX_DELAY);
+	*out = stats;
+	xSemaphoreGive(lock);
+}
@@ -0,0 +1,51 @@
+/*
+	 UDP streaming of sample blocks, the high rate alternative to the
+	 websocket for a client on a busy network: no head-of-line blocking
+	 and no retransmit stalls, a lost datagram is just a gap.
+
+	 A client registers host:port over the websocket ("U host port codec"),
+	 then gets one datagram per block: a u32 datagram sequence number (little
+	 endian) and a binary stream frame (protocol.h) in the chosen codec. It
+	 reports what arrived with "L received lost reordered", which ends up in
+	 the stats here. host/tools/udprecv is such a client.
+*/
+
+#ifndef MAIN_UDP_STREAM_H_
+#define MAIN_UDP_STREAM_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#include "codec.h"
+
+#define UDP_STREAM_HEADER_SIZE 4
+#define UDP_STREAM_MAX_DATAGRAM 1472	// fits an Ethernet/Wi-Fi MTU without fragments
+
+typedef struct {
+	uint32_t sent;			// datagrams handed to the stack
+	uint32_t send_errors;	// datagrams the stack refused, out of buffers mostly
+	// the last report of the client
+	uint32_t received;
+	uint32_t lost;
+	uint32_t reordered;
+	int64_t report_us;		// esp_timer_get_time() of the report, 0 before the first one
+} UDP_STREAM_STATS_t;
+
+esp_err_t udp_stream_init(void);
+
+// sends to host:port from now on, replacing any earlier destination
+esp_err_t udp_stream_start(const char *host, uint16_t port, CODEC_t codec);
+void udp_stream_stop(void);
+
+// codec of the stream, CODEC_TEXT while there is none
+CODEC_t udp_stream_codec(void);
+
+// sends one frame (protocol_put_frame_header() and a codec block) as the next datagram
+esp_err_t udp_stream_send(const uint8_t *frame, size_t len);
+
+void udp_stream_report(uint32_t received, uint32_t lost, uint32_t reordered);
+void udp_stream_get_stats(UDP_STREAM_STATS_t *stats);
+
+#endif /* MAIN_UDP_STREAM_H_ */
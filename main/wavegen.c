@@ -0,0 +1,217 @@
+/*
+	 Arbitrary waveform generator, see wavegen.h
+*/
+
+#include <math.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+#include "sdkconfig.h"
+
+#include "wavegen.h"
+
+#define FRACTION_BITS 14		// of the interpolation between two entries
+#define GAIN_SHIFT 22
+
+static const char *TAG = "wavegen";
+
+static const char *const shape_names[WAVEGEN_SHAPE_MAX] = { "off", "sine", "square", "triangle", "sweep", "table" };
+
+const char *wavegen_shape_name(WAVEGEN_SHAPE_t shape)
+{
+	return shape < WAVEGEN_SHAPE_MAX ? shape_names[shape] : "?";
+}
+
+WAVEGEN_SHAPE_t wavegen_shape(const char *name)
+{
+	for (int i = 0; i < WAVEGEN_SHAPE_MAX; i++) {
+		if (strcmp(name, shape_names[i]) == 0) return i;
+	}
+	return WAVEGEN_SHAPE_MAX;
+}
+
+static uint32_t step_of(float hz, uint32_t rate_hz)
+{
+	return (uint32_t)((double)hz * 4294967296.0 / rate_hz + 0.5);
+}
+
+static void fill_table(int16_t *table, WAVEGEN_SHAPE_t shape, const int16_t *points, int count)
+{
+	for (int i = 0; i < WAVEGEN_TABLE_SIZE; i++) {
+		int32_t v = 0;
+		switch (shape) {
+			case WAVEGEN_SINE:
+			case WAVEGEN_SWEEP:
+				v = lroundf(32767 * sinf(2 * (float)M_PI * i / WAVEGEN_TABLE_SIZE));
+				break;
+			case WAVEGEN_SQUARE:
+				v = i < WAVEGEN_TABLE_SIZE / 2 ? 32767 : -32767;
+				break;
+			case WAVEGEN_TRIANGLE: {
+				// in phase with the sine: up to the peak at a quarter, down to the trough at three quarters
+				int32_t ramp = (int32_t)(4 * 32767LL * i / WAVEGEN_TABLE_SIZE);
+				if (i < WAVEGEN_TABLE_SIZE / 4) v = ramp;
+				else if (i < 3 * WAVEGEN_TABLE_SIZE / 4) v = 2 * 32767 - ramp;
+				else v = ramp - 4 * 32767;
+				break;
+			}
+			case WAVEGEN_TABLE: {
+				// the points as one period, straight lines in between
+				uint32_t x = (uint32_t)((uint64_t)i * count * 65536 / WAVEGEN_TABLE_SIZE);
+				int j = x >> 16;
+				int32_t a = points[j], b = points[(j + 1) % count];
+				v = a + (int32_t)(((int64_t)(b - a) * (x & 0xffff)) >> 16);
+				break;
+			}
+			default:
+				break;
+		}
+		table[i] = v;
+	}
+	table[WAVEGEN_TABLE_SIZE] = table[0];
+}
+
+esp_err_t wavegen_configure(WAVEGEN_t *gen, const WAVEGEN_CONFIG_t *cfg, const int16_t *points, int count,
+	uint32_t rate_hz, uint32_t full_scale_mv, int bits)
+{
+	// everything checked before gen is touched
+	if (cfg->shape <= WAVEGEN_OFF || cfg->shape >= WAVEGEN_SHAPE_MAX || rate_hz == 0 || bits < 1 || bits > 8) return ESP_ERR_INVALID_ARG;
+	if (!(cfg->freq_hz > 0) || cfg->freq_hz >= rate_hz / 2.0f) return ESP_ERR_INVALID_ARG;
+	if (cfg->amplitude_mv > full_scale_mv || cfg->offset_mv > full_scale_mv) return ESP_ERR_INVALID_ARG;
+	uint64_t chunks = 0;
+	if (cfg->shape == WAVEGEN_SWEEP) {
+		if (!(cfg->to_hz > 0) || cfg->to_hz >= rate_hz / 2.0f) return ESP_ERR_INVALID_ARG;
+		chunks = (uint64_t)cfg->sweep_ms * rate_hz / 1000 / WAVEGEN_SWEEP_CHUNK;
+		if (chunks == 0) return ESP_ERR_INVALID_ARG;
+	}
+	if (cfg->shape == WAVEGEN_TABLE && (points == NULL || count < 2 || count > WAVEGEN_MAX_POINTS)) return ESP_ERR_INVALID_STATE;
+
+	fill_table(gen->table, cfg->shape, points, count);
+	gen->max_code = (1 << bits) - 1;
+	gen->gain = (int32_t)((int64_t)cfg->amplitude_mv * gen->max_code * (1 << GAIN_SHIFT) / full_scale_mv / 32767);
+	gen->offset = (int32_t)((int64_t)cfg->offset_mv * gen->max_code * (1 << GAIN_SHIFT) / full_scale_mv) + (1 << (GAIN_SHIFT - 1));
+	gen->step = step_of(cfg->freq_hz, rate_hz);
+	gen->step_delta = 0;
+	if (cfg->shape == WAVEGEN_SWEEP) {
+		gen->step_from = gen->step;
+		gen->step_to = step_of(cfg->to_hz, rate_hz);
+		int64_t delta = ((int64_t)gen->step_to - gen->step_from) / (int64_t)chunks;
+		// slower than one step a chunk is not possible, the sweep then takes longer
+		if (delta == 0) delta = gen->step_to >= gen->step_from ? 1 : -1;
+		gen->step_delta = (int32_t)delta;
+		gen->chunk = WAVEGEN_SWEEP_CHUNK;
+	}
+	return ESP_OK;
+}
+
+void wavegen_fill(WAVEGEN_t *gen, uint8_t *buf, size_t len)
+{
+	const int16_t *table = gen->table;
+	const int32_t offset = gen->offset, gain = gen->gain, max_code = gen->max_code;
+	uint32_t phase = gen->phase, step = gen->step;
+	size_t i = 0;
+	while (i < len) {
+		// a sweep changes the step between chunks only, the loop below is the same for every shape
+		size_t end = gen->step_delta && len - i > gen->chunk ? i + gen->chunk : len;
+		size_t done = end - i;
+		for (; i < end; i++) {
+			uint32_t index = phase >> (32 - WAVEGEN_TABLE_BITS);
+			int32_t frac = (phase >> (32 - WAVEGEN_TABLE_BITS - FRACTION_BITS)) & ((1 << FRACTION_BITS) - 1);
+			int32_t a = table[index];
+			int32_t v = a + (((table[index + 1] - a) * frac) >> FRACTION_BITS);
+			int32_t code = (offset + v * gain) >> GAIN_SHIFT;
+			buf[i] = code < 0 ? 0 : code > max_code ? max_code : code;
+			phase += step;
+		}
+		if (gen->step_delta && (gen->chunk -= done) == 0) {
+			gen->chunk = WAVEGEN_SWEEP_CHUNK;
+			step += gen->step_delta;
+			if (gen->step_delta > 0 ? step >= gen->step_to : step <= gen->step_to) step = gen->step_from;
+		}
+	}
+	gen->phase = phase;
+	gen->step = step;
+}
+
+/*
+	 On the DAC: the refill task plays gens[active], wavegen_set() prepares
+	 the other one and flags it pending, the refill swaps at its next buffer.
+*/
+
+static WAVEGEN_IO_t io;
+static WAVEGEN_t gens[2];
+static int active;
+static bool pending;
+static bool running;
+static portMUX_TYPE mux = portMUX_INITIALIZER_UNLOCKED;
+static int16_t points[WAVEGEN_MAX_POINTS];
+static int point_count;
+static float played_hz;
+
+static void refill(uint8_t *buf, size_t len, void *arg)
+{
+	portENTER_CRITICAL(&mux);
+	if (pending) {
+		gens[!active].phase = gens[active].phase;
+		active = !active;
+		pending = false;
+	}
+	WAVEGEN_t *gen = &gens[active];
+	portEXIT_CRITICAL(&mux);
+	wavegen_fill(gen, buf, len);
+}
+
+void wavegen_init(const WAVEGEN_IO_t *wavegen_io)
+{
+	io = *wavegen_io;
+}
+
+esp_err_t wavegen_set(const WAVEGEN_CONFIG_t *cfg)
+{
+	if (io.start == NULL) return ESP_ERR_INVALID_STATE;
+	if (cfg->shape == WAVEGEN_OFF) {
+		if (running) io.stop();
+		running = false;
+		played_hz = 0;
+		return ESP_OK;
+	}
+	portENTER_CRITICAL(&mux);
+	bool was_pending = pending;
+	pending = false;
+	WAVEGEN_t *next = &gens[!active];
+	portEXIT_CRITICAL(&mux);
+
+	esp_err_t err = wavegen_configure(next, cfg, points, point_count, CONFIG_WAVEGEN_RATE_HZ, io.full_scale_mv, io.bits);
+	portENTER_CRITICAL(&mux);
+	pending = err == ESP_OK || was_pending;
+	portEXIT_CRITICAL(&mux);
+	if (err != ESP_OK) return err;
+
+	played_hz = (float)((double)next->step * CONFIG_WAVEGEN_RATE_HZ / 4294967296.0);
+	if (!running) {
+		err = io.start(CONFIG_WAVEGEN_RATE_HZ, CONFIG_WAVEGEN_BUFFER, refill, NULL);
+		if (err != ESP_OK) {
+			ESP_LOGW(TAG, "cannot start the DAC: %s", esp_err_to_name(err));
+			return err;
+		}
+		running = true;
+	}
+	ESP_LOGI(TAG, "%s at %.3f Hz, %u mV around %u mV", wavegen_shape_name(cfg->shape), played_hz,
+		(unsigned)cfg->amplitude_mv, (unsigned)cfg->offset_mv);
+	return ESP_OK;
+}
+
+esp_err_t wavegen_set_table(const int16_t *values, int count)
+{
+	if (count < 2 || count > WAVEGEN_MAX_POINTS) return ESP_ERR_INVALID_ARG;
+	memcpy(points, values, count * sizeof(points[0]));
+	point_count = count;
+	return ESP_OK;
+}
+
+float wavegen_freq_hz(void)
+{
+	return played_hz;
+}
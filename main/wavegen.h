@@ -0,0 +1,101 @@
+/*
+	 Arbitrary waveform generator on the DAC.
+
+	 One period of the wave is a table of WAVEGEN_TABLE_SIZE values; a
+	 32 bit phase accumulator walks through it at freq_hz, the top bits
+	 pick the entry and the next ones interpolate to the following entry.
+	 The DAC plays a buffer of codes by DMA at CONFIG_WAVEGEN_RATE_HZ while
+	 the other one is refilled by wavegen_fill(), so no sample costs the
+	 CPU anything at the time it is output (hal_dac_stream_start()).
+
+	 A sweep is a sine whose frequency goes from freq_hz to to_hz in
+	 sweep_ms and starts over; its step changes every WAVEGEN_SWEEP_CHUNK
+	 samples. A table shape plays the points uploaded last, resampled to
+	 the table size.
+
+	 The synthesis does no I/O, it is what the host build tests;
+	 wavegen_set() runs it on the output of wavegen_init().
+*/
+
+#ifndef MAIN_WAVEGEN_H_
+#define MAIN_WAVEGEN_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#define WAVEGEN_TABLE_BITS 10
+#define WAVEGEN_TABLE_SIZE (1 << WAVEGEN_TABLE_BITS)
+#define WAVEGEN_MAX_POINTS WAVEGEN_TABLE_SIZE	// of an uploaded table
+#define WAVEGEN_SWEEP_CHUNK 32
+
+typedef enum {
+	WAVEGEN_OFF = 0,
+	WAVEGEN_SINE,
+	WAVEGEN_SQUARE,
+	WAVEGEN_TRIANGLE,
+	WAVEGEN_SWEEP,
+	WAVEGEN_TABLE,
+	WAVEGEN_SHAPE_MAX,
+} WAVEGEN_SHAPE_t;
+
+typedef struct {
+	WAVEGEN_SHAPE_t shape;
+	float freq_hz;			// a sweep starts here
+	float to_hz;			// sweep: and ends here
+	uint32_t sweep_ms;		// sweep: in this long
+	uint32_t amplitude_mv;	// peak, from the middle
+	uint32_t offset_mv;		// the middle
+} WAVEGEN_CONFIG_t;
+
+typedef struct {
+	int16_t table[WAVEGEN_TABLE_SIZE + 1];	// one period, the first entry again at the end
+	uint32_t phase;
+	uint32_t step;			// phase per sample, 2^32 is one period
+	// sweep: step goes from step_from to step_to, by step_delta every WAVEGEN_SWEEP_CHUNK samples
+	uint32_t step_from;
+	uint32_t step_to;
+	int32_t step_delta;
+	uint32_t chunk;			// samples left with this step
+	// code = (offset + table * gain) >> 22, between 0 and max_code
+	int32_t offset;
+	int32_t gain;
+	int32_t max_code;
+} WAVEGEN_t;
+
+const char *wavegen_shape_name(WAVEGEN_SHAPE_t shape);
+WAVEGEN_SHAPE_t wavegen_shape(const char *name);	// WAVEGEN_SHAPE_MAX when unknown
+
+/*
+	 Sets gen up for cfg at rate_hz into codes of bits bits spanning 0 to
+	 full_scale_mv. points/count is the table of WAVEGEN_TABLE, values
+	 from -32767 to 32767. The phase is kept, so a change does not jump.
+*/
+esp_err_t wavegen_configure(WAVEGEN_t *gen, const WAVEGEN_CONFIG_t *cfg, const int16_t *points, int count,
+	uint32_t rate_hz, uint32_t full_scale_mv, int bits);
+
+// the next len codes
+void wavegen_fill(WAVEGEN_t *gen, uint8_t *buf, size_t len);
+
+// the output, hal_dac_stream_start() on a DAC channel on the board
+typedef struct {
+	esp_err_t (*start)(uint32_t rate_hz, size_t len, void (*refill)(uint8_t *buf, size_t len, void *arg), void *arg);
+	void (*stop)(void);
+	uint32_t full_scale_mv;
+	int bits;
+} WAVEGEN_IO_t;
+
+void wavegen_init(const WAVEGEN_IO_t *io);
+
+/*
+	 Starts, changes or (WAVEGEN_OFF) stops the output, a change takes
+	 effect with the next buffer. Called from one task at a time.
+*/
+esp_err_t wavegen_set(const WAVEGEN_CONFIG_t *cfg);
+// the table of WAVEGEN_TABLE, used by the next wavegen_set()
+esp_err_t wavegen_set_table(const int16_t *points, int count);
+// the frequency actually played, after the rounding of the phase step
+float wavegen_freq_hz(void);
+
+#endif /* MAIN_WAVEGEN_H_ */